@@ -24,6 +24,16 @@ extern IFileSystem *filesystem;
 
 ConVar	cl_phys_timescale( "cl_phys_timescale", "1", 0, "Sets the scale of time for client-side physics (ragdolls)" );
 
+static void PhysParallelChanged_Callback( ConVar *var, const char *pOldString )
+{
+	if ( physenv )
+	{
+		physenv->EnableParallelSimulation( var->GetBool() );
+	}
+}
+
+ConVar	cl_phys_parallel( "cl_phys_parallel", "0", 0, "Simulate independent groups of client-side physics objects (ragdolls) on the worker threads (only while the worker pool has threads)", PhysParallelChanged_Callback );
+
 extern ConVar phys_rolling_drag;
 
 //FIXME: Replicated from server end, consolidate?
@@ -107,6 +117,7 @@ void PhysicsLevelInit( void )
 	physenv->SetSimulationTimestep( 0.015 ); // 15 ms per tick
 	physenv->SetCollisionEventHandler( &g_Collisions );
 	physenv->SetCollisionSolver( &g_Collisions );
+	physenv->EnableParallelSimulation( cl_phys_parallel.GetBool() );
 
 	g_PhysWorldObject = PhysCreateWorld_Shared( GetClientWorldEntity(), modelinfo->GetVCollide(1), g_PhysDefaultObjectParams );
 
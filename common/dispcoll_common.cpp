@@ -8,6 +8,7 @@
 #include "cmodel.h"
 #include "dispcoll_common.h"
 #include "collisionutils.h"
+#include <xmmintrin.h>
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -23,6 +24,10 @@
 #define COLLTREE_ROOTNODE	0
 #define ONPLANE_EPSILON		0.03125
 
+// Deepest the SIMD walks' stacks get is three nodes a level plus the four below
+// the last one, a power 4 displacement has 5 levels
+#define COLLTREE_WALK_STACK_SIZE	32
+
 //-----------------------------------------------------------------------------
 // Purpose: displacement collision axial-aligned bounding-box initialization
 //-----------------------------------------------------------------------------
@@ -113,6 +118,9 @@ CDispCollTree::CDispCollTree()
 
 	m_NodeCount = 0;
 	m_pNodes = NULL;
+	m_iFirstLeafNode = 0;
+	m_pNodeBounds = NULL;
+	m_bSSE = false;
 
 	m_nTriCount = 0;
 	m_pTris = NULL;
@@ -121,11 +129,6 @@ CDispCollTree::CDispCollTree()
 	m_pVerts = m_pOriginalVerts = NULL;
 	m_pVertNormals = NULL;
 
-	for (int i = 0; i < MAX_CHECK_COUNT_DEPTH; ++i)
-	{
-		m_CheckCount[i] = 0;
-	}
-
 	m_BBoxWithFace[0].Init( 99999.0f, 99999.0f, 99999.0f );
 	m_BBoxWithFace[1].Init( -99999.0f, -99999.0f, -99999.0f );
 
@@ -134,7 +137,6 @@ CDispCollTree::CDispCollTree()
 	m_Contents = -1;
 	m_SurfaceProps[0] = 0;
 	m_SurfaceProps[1] = 0;
-	m_iLatestSurfProp = 0;
 	m_pLeafLinkHead = NULL;
 }
 
@@ -225,6 +227,10 @@ bool CDispCollTree::Create( CCoreDispInfo *pDisp )
 	// create tree nodes
 	Nodes_Create();
 
+	// pack the child bounds for the SIMD walks
+	m_bSSE = MathLib_SSEEnabled();
+	NodeBounds_Update();
+
 	// create the bounding box of the displacement surface + the base face
 	CalcFullBBox();
 
@@ -502,6 +508,46 @@ inline int CDispCollTree::Nodes_GetIndexFromComponents( int x, int y )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: get the node index of the first child in a block of child bounds
+//   Input: iBlock - index into m_pNodeBounds
+//  Output: int - the node in lane 0, the other lanes follow it
+//-----------------------------------------------------------------------------
+inline int CDispCollTree::NodeBounds_GetChild( int iBlock )
+{
+	// the root block only has the root in it
+	if( iBlock == 0 )
+		return COLLTREE_ROOTNODE;
+
+	return Nodes_GetChild( iBlock - 1, 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: copy the node bounds into the blocks the SIMD walks test, has to be
+//          redone whenever the node bounds change
+//-----------------------------------------------------------------------------
+void CDispCollTree::NodeBounds_Update( void )
+{
+	for( int iBlock = 0; iBlock <= m_iFirstLeafNode; iBlock++ )
+	{
+		DispNodeBounds_t &bounds = m_pNodeBounds[iBlock];
+		int iFirstChild = NodeBounds_GetChild( iBlock );
+
+		for( int iLane = 0; iLane < 4; iLane++ )
+		{
+			// the root block repeats the root, the walks mask off the other lanes
+			Node_t *pNode = &m_pNodes[( iBlock == 0 ) ? iFirstChild : iFirstChild + iLane];
+			for( int iAxis = 0; iAxis < 3; iAxis++ )
+			{
+				bounds.m_Mins[iAxis][iLane] = pNode->m_BBox[0][iAxis];
+				bounds.m_Maxs[iAxis][iLane] = pNode->m_BBox[1][iAxis];
+			}
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: allocate memory for the displacement collision tree nodes
 //  Output: sucess? (true/false)
@@ -519,6 +565,15 @@ int CDispCollTree::Nodes_Alloc( void )
 		return false;
 	}
 
+	// one block of child bounds for the root and one for each node above the leaves
+	m_iFirstLeafNode = ( short )Nodes_CalcCount( m_Power - 1 );
+	m_pNodeBounds = new DispNodeBounds_t[m_iFirstLeafNode + 1];
+	if( !m_pNodeBounds )
+	{
+		Nodes_Free();
+		return false;
+	}
+
 	//
 	// initialize the nodes
 	//
@@ -543,6 +598,13 @@ void CDispCollTree::Nodes_Free( void )
 		m_pNodes = NULL;
 	}
 	m_NodeCount = 0;
+
+	if( m_pNodeBounds )
+	{
+		delete [] m_pNodeBounds;
+		m_pNodeBounds = NULL;
+	}
+	m_iFirstLeafNode = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -740,6 +802,7 @@ void CDispCollTree::ApplyTerrainMod( ITerrainMod *pMod )
 
 	// create tree nodes
 	Nodes_Create();
+	NodeBounds_Update();
 
 	CalcFullBBox();
 }
@@ -1032,20 +1095,13 @@ bool CDispCollTree::RayTest( const Vector &rayStart, const Vector &rayEnd )
 // Purpose:
 //-----------------------------------------------------------------------------
 bool CDispCollTree::RayTest( const Vector &rayStart, const Vector &rayEnd, 
-							 float startFrac, float endFrac, CBaseTrace *pTrace )
+							 float startFrac, float endFrac, CBaseTrace *pTrace, short *pSurfProp,
+							 bool bSIMDWalk )
 {
 	// Check for opacity?!
 	if ( !( m_Contents & MASK_OPAQUE ) )
 		return false;
 
-	// Create and initialize the triangle list
-	TriList_t triList;
-	triList.m_Count = 0;
-
-	// Create and initialize the primary AABB
-	AABB_t AABBox;
-	AABB_Init( AABBox );
-
 	bool bHasTrace = true;
 	if( !pTrace )
 	{
@@ -1060,20 +1116,41 @@ bool CDispCollTree::RayTest( const Vector &rayStart, const Vector &rayEnd,
 	VectorMA( rayStart, startFrac, delta, clipRayStart );
 	VectorMA( rayStart, endFrac, delta, clipRayEnd );
 
-	// Collide against the bboxed quad-tree and generate a initial list of collision tris.
-	Ray_BuildTriList( clipRayStart, clipRayEnd, 0 /*root node*/, AABBox, triList );
-
 	// Save the starting fraction
 	float preIntersectFrac = pTrace->fraction;
+	unsigned short iSurfProp = 0;
 
-	if( triList.m_Count != 0 )
+	if( bSIMDWalk )
 	{
-		Ray_IntersectTriList( rayStart, rayEnd, startFrac, endFrac, pTrace, triList );
+		Ray_WalkTree( rayStart, rayEnd, clipRayStart, clipRayEnd, startFrac, endFrac, pTrace, iSurfProp );
+	}
+	else
+	{
+		// Create and initialize the triangle list
+		TriList_t triList;
+		triList.m_Count = 0;
+
+		// Create and initialize the primary AABB
+		AABB_t AABBox;
+		AABB_Init( AABBox );
+
+		// Collide against the bboxed quad-tree and generate a initial list of collision tris.
+		Ray_BuildTriList( clipRayStart, clipRayEnd, 0 /*root node*/, AABBox, triList );
+
+		if( triList.m_Count != 0 )
+		{
+			Ray_IntersectTriList( rayStart, rayEnd, startFrac, endFrac, pTrace, triList, iSurfProp );
+		}
 	}
 
 	// Collision
 	if( preIntersectFrac > pTrace->fraction )
 	{
+		if( pSurfProp )
+		{
+			*pSurfProp = m_SurfaceProps[iSurfProp];
+		}
+
 		if( !bHasTrace )
 		{
 			delete pTrace;
@@ -1290,7 +1367,7 @@ bool CDispCollTree::Ray_IntersectTriListTest( const Vector &rayStart, const Vect
 //-----------------------------------------------------------------------------
 void CDispCollTree::Ray_IntersectTriList( const Vector &rayStart, const Vector &rayEnd,
 										  float startFrac, float endFrac, CBaseTrace *pTrace, 
-										  TriList_t const &triList )
+										  TriList_t const &triList, unsigned short &iSurfProp )
 {
 	// initialize the ray structure
 	Ray_t ray;
@@ -1323,7 +1400,7 @@ void CDispCollTree::Ray_IntersectTriList( const Vector &rayStart, const Vector &
 			pTrace->plane.dist = pTri->m_flDist;
 			pTrace->dispFlags = pTri->m_nFlags;
 
-			m_iLatestSurfProp = pTri->m_iSurfProp;
+			iSurfProp = pTri->m_iSurfProp;
 		}
 	}
 }
@@ -1331,20 +1408,23 @@ void CDispCollTree::Ray_IntersectTriList( const Vector &rayStart, const Vector &
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
-bool CDispCollTree::AABBIntersect( const Vector &boxCenter, const Vector &boxMin, const Vector &boxMax )
+bool CDispCollTree::AABBIntersect( const Vector &boxCenter, const Vector &boxMin, const Vector &boxMax, bool bSIMDWalk )
 {
-	//
-	// create and initialize the triangle list
-	//
-	TriList_t triList;
-	triList.m_Count = 0;
-
 	//
 	// calc box extents
 	//
 	Vector boxExtents;
 	boxExtents = ( ( boxMax + boxMin ) * 0.5f ) - boxMin;
 
+	if( bSIMDWalk )
+		return AABB_WalkTree( boxCenter, boxExtents );
+
+	//
+	// create and initialize the triangle list
+	//
+	TriList_t triList;
+	triList.m_Count = 0;
+
 	//
 	// collide against the bboxed quad-tree and generate a initial list of
 	// collision tris
@@ -1448,7 +1528,6 @@ bool CDispCollTree::AABB_IntersectTriList( const Vector &boxCenter, const Vector
 									     m_pVerts[pTri->m_uiVerts[1]],
 									     pTri->m_vecNormal, pTri->m_flDist ) )
 		{
-			m_iLatestSurfProp = pTri->m_iSurfProp;
 			return true;
 		}
 	}
@@ -1461,43 +1540,55 @@ bool CDispCollTree::AABB_IntersectTriList( const Vector &boxCenter, const Vector
 // Purpose:
 //-----------------------------------------------------------------------------
 bool CDispCollTree::AABBSweep( const Vector &rayStart, const Vector &rayEnd, const Vector &boxExtents, 
-							   float startFrac, float endFrac, CBaseTrace *pTrace )
+							   float startFrac, float endFrac, CBaseTrace *pTrace, short *pSurfProp, bool bSIMDWalk )
 {
 	static bool bRender = false;
 
-	//
-	// create and initialize the triangle list
-	//
-	TriList_t triList;
-	triList.m_Count = 0;
-
-	//
-	// create and initialize the primary AABB
-	//
-	AABB_t AABBox;
-	AABB_Init( AABBox );
-
-	//
-	// sweep box against the axial-aligned bboxed quad-tree and generate an initial
-	// list of collision tris
-	//
-	SweptAABB_BuildTriList( rayStart, rayEnd, boxExtents, 0, AABBox, triList );
-
 	// save the starting fraction
 	float preIntersectFrac = pTrace->fraction;
+	unsigned short iSurfProp = 0;
 
-	//
-	// sweep axis-aligned bounding box against the triangles in the list
-	//
-	if( triList.m_Count > 0 )
+	if( bSIMDWalk )
 	{
-		SweptAABB_IntersectTriList( rayStart, rayEnd, boxExtents, startFrac,
-				                    endFrac, pTrace, triList );
+		SweptAABB_WalkTree( rayStart, rayEnd, boxExtents, pTrace, iSurfProp );
+	}
+	else
+	{
+		//
+		// create and initialize the triangle list
+		//
+		TriList_t triList;
+		triList.m_Count = 0;
+
+		//
+		// create and initialize the primary AABB
+		//
+		AABB_t AABBox;
+		AABB_Init( AABBox );
+
+		//
+		// sweep box against the axial-aligned bboxed quad-tree and generate an initial
+		// list of collision tris
+		//
+		SweptAABB_BuildTriList( rayStart, rayEnd, boxExtents, 0, AABBox, triList );
+
+		//
+		// sweep axis-aligned bounding box against the triangles in the list
+		//
+		if( triList.m_Count > 0 )
+		{
+			SweptAABB_IntersectTriList( rayStart, rayEnd, boxExtents, startFrac,
+					                    endFrac, pTrace, triList, iSurfProp );
+		}
 	}
 
 	// collision
 	if( preIntersectFrac > pTrace->fraction )
 	{
+		if( pSurfProp )
+		{
+			*pSurfProp = m_SurfaceProps[iSurfProp];
+		}
 		return true;
 	}
 
@@ -1665,7 +1756,7 @@ bool CDispCollTree::SweptAABB_NodeTest( const Vector &rayStart, const Vector &ra
 //-----------------------------------------------------------------------------
 void CDispCollTree::SweptAABB_IntersectTriList( const Vector &rayStart, const Vector &rayEnd, 
 											    const Vector &boxExtents, float startFrac, float endFrac, 
-												CBaseTrace *pTrace, TriList_t const &triList )
+												CBaseTrace *pTrace, TriList_t const &triList, unsigned short &iSurfProp )
 {
 	Tri_t *pTri;
 
@@ -1695,7 +1786,7 @@ void CDispCollTree::SweptAABB_IntersectTriList( const Vector &rayStart, const Ve
 									 m_pVerts[pTri->m_uiVerts[1]],
 									 pTri->m_vecNormal, pTri->m_flDist,
 									 pTri->m_nFlags, pTri->m_iSurfProp,
-									 /*fraction,*/ pTrace, true );
+									 /*fraction,*/ pTrace, true, iSurfProp );
 
 #if 0
 		// a negative fraction means no collision
@@ -1709,13 +1800,399 @@ void CDispCollTree::SweptAABB_IntersectTriList( const Vector &rayStart, const Ve
 			pTrace->plane.normal = pTri->m_Normal;
 			pTrace->plane.dist = pTri->m_Dist;
 
-			m_iLatestSurfProp = pTri->m_iSurfProp;
+			iSurfProp = pTri->m_iSurfProp;
 		}
 #endif
 	}
 }
 
 
+//=============================================================================
+//
+// SIMD walks
+//
+// The BuildTriList walks rebuild six planes and run a branchy test with divides
+// for every node they visit, and quietly stop adding triangles once the list is
+// full.  These test all four children of a node at once against bounds packed
+// at load time (m_pNodeBounds) and test a leaf's triangles as soon as they get
+// to it.  Children come off the stack in the same order the recursive walks
+// take them, so the triangles get tested in the same order too.
+//
+
+//-----------------------------------------------------------------------------
+// A ray, or a box swept along it, set up for testing against child bounds.  The
+// bounds get grown by the box extents and twice DIST_EPSILON, which takes in
+// everything Ray_NodeTest and SweptAABB_NodeTest let through.
+//-----------------------------------------------------------------------------
+struct DispSegmentTest_t
+{
+	Vector	m_Lo;			// start + bloat, child mins minus this is the distance to the near side
+	Vector	m_Hi;			// start - bloat
+	Vector	m_InvDelta;
+
+	__m128	m_Lo4[3];
+	__m128	m_Hi4[3];
+	__m128	m_InvDelta4[3];
+};
+
+static void DispSegmentTest_Init( DispSegmentTest_t &test, const Vector &start, const Vector &end, const Vector &bloat )
+{
+	for( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		// Don't divide by zero on a flat axis.  A huge slope still puts both sides
+		// of the slab way out past [0,1] when the start isn't between them.
+		float flDelta = end[iAxis] - start[iAxis];
+		if( ( flDelta < 1e-6f ) && ( flDelta > -1e-6f ) )
+		{
+			test.m_InvDelta[iAxis] = ( flDelta < 0.0f ) ? -1e30f : 1e30f;
+		}
+		else
+		{
+			test.m_InvDelta[iAxis] = 1.0f / flDelta;
+		}
+
+		test.m_Lo[iAxis] = start[iAxis] + bloat[iAxis];
+		test.m_Hi[iAxis] = start[iAxis] - bloat[iAxis];
+
+		test.m_Lo4[iAxis] = _mm_set1_ps( test.m_Lo[iAxis] );
+		test.m_Hi4[iAxis] = _mm_set1_ps( test.m_Hi[iAxis] );
+		test.m_InvDelta4[iAxis] = _mm_set1_ps( test.m_InvDelta[iAxis] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Returns a bit for each of the four children the segment reaches before flMaxFrac
+//-----------------------------------------------------------------------------
+static inline int DispSegmentTest_SSE( const DispSegmentTest_t &test, const DispNodeBounds_t &bounds, float flMaxFrac )
+{
+	__m128 tNear = _mm_setzero_ps();
+	__m128 tFar = _mm_set1_ps( flMaxFrac );
+	for( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( bounds.m_Mins[iAxis] ), test.m_Lo4[iAxis] ), test.m_InvDelta4[iAxis] );
+		__m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( bounds.m_Maxs[iAxis] ), test.m_Hi4[iAxis] ), test.m_InvDelta4[iAxis] );
+		tNear = _mm_max_ps( tNear, _mm_min_ps( t1, t2 ) );
+		tFar = _mm_min_ps( tFar, _mm_max_ps( t1, t2 ) );
+	}
+	return _mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) );
+}
+
+static int DispSegmentTest_Scalar( const DispSegmentTest_t &test, const DispNodeBounds_t &bounds, float flMaxFrac )
+{
+	int nMask = 0;
+	for( int iLane = 0; iLane < 4; iLane++ )
+	{
+		float flNear = 0.0f;
+		float flFar = flMaxFrac;
+		for( int iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			float t1 = ( bounds.m_Mins[iAxis][iLane] - test.m_Lo[iAxis] ) * test.m_InvDelta[iAxis];
+			float t2 = ( bounds.m_Maxs[iAxis][iLane] - test.m_Hi[iAxis] ) * test.m_InvDelta[iAxis];
+			if( t1 > t2 )
+			{
+				float flTemp = t1;
+				t1 = t2;
+				t2 = flTemp;
+			}
+
+			if( t1 > flNear ) { flNear = t1; }
+			if( t2 < flFar ) { flFar = t2; }
+		}
+
+		if( flNear <= flFar )
+		{
+			nMask |= ( 1 << iLane );
+		}
+	}
+	return nMask;
+}
+
+//-----------------------------------------------------------------------------
+// A box set up for testing against child bounds, the same test as AABB_NodeTest
+//-----------------------------------------------------------------------------
+struct DispBoxTest_t
+{
+	Vector	m_Mins;
+	Vector	m_Maxs;
+
+	__m128	m_Mins4[3];
+	__m128	m_Maxs4[3];
+};
+
+static void DispBoxTest_Init( DispBoxTest_t &test, const Vector &boxCenter, const Vector &boxExtents )
+{
+	for( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		test.m_Mins[iAxis] = boxCenter[iAxis] - boxExtents[iAxis];
+		test.m_Maxs[iAxis] = boxCenter[iAxis] + boxExtents[iAxis];
+
+		test.m_Mins4[iAxis] = _mm_set1_ps( test.m_Mins[iAxis] );
+		test.m_Maxs4[iAxis] = _mm_set1_ps( test.m_Maxs[iAxis] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Returns a bit for each of the four children the box touches
+//-----------------------------------------------------------------------------
+static inline int DispBoxTest_SSE( const DispBoxTest_t &test, const DispNodeBounds_t &bounds )
+{
+	__m128 overlap = _mm_and_ps( _mm_cmple_ps( _mm_loadu_ps( bounds.m_Mins[0] ), test.m_Maxs4[0] ),
+		_mm_cmple_ps( test.m_Mins4[0], _mm_loadu_ps( bounds.m_Maxs[0] ) ) );
+	for( int iAxis = 1; iAxis < 3; iAxis++ )
+	{
+		overlap = _mm_and_ps( overlap, _mm_cmple_ps( _mm_loadu_ps( bounds.m_Mins[iAxis] ), test.m_Maxs4[iAxis] ) );
+		overlap = _mm_and_ps( overlap, _mm_cmple_ps( test.m_Mins4[iAxis], _mm_loadu_ps( bounds.m_Maxs[iAxis] ) ) );
+	}
+	return _mm_movemask_ps( overlap );
+}
+
+static int DispBoxTest_Scalar( const DispBoxTest_t &test, const DispNodeBounds_t &bounds )
+{
+	int nMask = 0;
+	for( int iLane = 0; iLane < 4; iLane++ )
+	{
+		int iAxis;
+		for( iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			if( ( bounds.m_Mins[iAxis][iLane] > test.m_Maxs[iAxis] ) || ( bounds.m_Maxs[iAxis][iLane] < test.m_Mins[iAxis] ) )
+				break;
+		}
+
+		if( iAxis == 3 )
+		{
+			nMask |= ( 1 << iLane );
+		}
+	}
+	return nMask;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: same as Ray_BuildTriList + Ray_IntersectTriList
+//-----------------------------------------------------------------------------
+void CDispCollTree::Ray_WalkTree( const Vector &rayStart, const Vector &rayEnd, const Vector &clipRayStart, const Vector &clipRayEnd,
+								  float startFrac, float endFrac, CBaseTrace *pTrace, unsigned short &iSurfProp )
+{
+	// the nodes get tested against the ray clipped to the leaf, the triangles against the whole ray
+	DispSegmentTest_t test;
+	Vector bloat( 2.0f * DIST_EPSILON, 2.0f * DIST_EPSILON, 2.0f * DIST_EPSILON );
+	DispSegmentTest_Init( test, clipRayStart, clipRayEnd, bloat );
+
+	Ray_t ray;
+	ray.m_Start = rayStart;
+	ray.m_Delta = rayEnd - rayStart;
+	ray.m_Extents.Init();
+
+	//
+	// a triangle can't change the trace unless it's closer than what's been hit so far,
+	// so skip nodes the clipped ray only gets to after that.  Hits before the start of
+	// the clipped ray can still be in the nodes it starts in, so this never goes below 0.
+	//
+	float clipScale = ( endFrac > startFrac ) ? 1.0f / ( endFrac - startFrac ) : 0.0f;
+	float maxFrac = 1.0f;
+	if( clipScale != 0.0f )
+	{
+		maxFrac = clamp( ( pTrace->fraction - startFrac ) * clipScale, 0.0f, 1.0f );
+	}
+
+	int stack[COLLTREE_WALK_STACK_SIZE];
+	int nStack = 0;
+	stack[nStack++] = 0;
+
+	while( nStack > 0 )
+	{
+		int iBlock = stack[--nStack];
+		int nMask = m_bSSE ? DispSegmentTest_SSE( test, m_pNodeBounds[iBlock], maxFrac ) :
+			                 DispSegmentTest_Scalar( test, m_pNodeBounds[iBlock], maxFrac );
+		if( iBlock == 0 )
+		{
+			nMask &= 1;
+		}
+
+		int iFirstChild = NodeBounds_GetChild( iBlock );
+		if( iFirstChild < m_iFirstLeafNode )
+		{
+			// push them backwards so they come off in order
+			for( int iPush = 3; iPush >= 0; iPush-- )
+			{
+				if( nMask & ( 1 << iPush ) )
+				{
+					Assert( nStack < COLLTREE_WALK_STACK_SIZE );
+					stack[nStack++] = iFirstChild + iPush + 1;
+				}
+			}
+			continue;
+		}
+
+		for( int iLane = 0; iLane < 4; iLane++ )
+		{
+			if( !( nMask & ( 1 << iLane ) ) )
+				continue;
+
+			Node_t *pNode = &m_pNodes[iFirstChild + iLane];
+			for( int iTri = 0; iTri < 2; iTri++ )
+			{
+				Tri_t *pTri = &m_pTris[pNode->m_iTris[iTri]];
+
+				float intFrac = IntersectRayWithTriangle( ray,
+														  m_pVerts[pTri->m_uiVerts[0]],
+														  m_pVerts[pTri->m_uiVerts[2]],
+														  m_pVerts[pTri->m_uiVerts[1]],
+														  true );
+
+				// a negative fraction means no collision
+				if( intFrac < 0.0f )
+					continue;
+
+				if( intFrac < pTrace->fraction )
+				{
+					pTrace->fraction = intFrac;
+					pTrace->plane.normal = pTri->m_vecNormal;
+					pTrace->plane.dist = pTri->m_flDist;
+					pTrace->dispFlags = pTri->m_nFlags;
+
+					iSurfProp = pTri->m_iSurfProp;
+
+					if( clipScale != 0.0f )
+					{
+						maxFrac = clamp( ( pTrace->fraction - startFrac ) * clipScale, 0.0f, 1.0f );
+					}
+				}
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: same as SweptAABB_BuildTriList + SweptAABB_IntersectTriList.  The box
+//          test can back the fraction off quite a ways from where the box touches
+//          at glancing angles, so unlike rays this doesn't skip nodes past the
+//          closest hit.
+//-----------------------------------------------------------------------------
+void CDispCollTree::SweptAABB_WalkTree( const Vector &rayStart, const Vector &rayEnd, const Vector &boxExtents,
+									    CBaseTrace *pTrace, unsigned short &iSurfProp )
+{
+	DispSegmentTest_t test;
+	Vector bloat( boxExtents.x + 2.0f * DIST_EPSILON, boxExtents.y + 2.0f * DIST_EPSILON, boxExtents.z + 2.0f * DIST_EPSILON );
+	DispSegmentTest_Init( test, rayStart, rayEnd, bloat );
+
+	int stack[COLLTREE_WALK_STACK_SIZE];
+	int nStack = 0;
+	stack[nStack++] = 0;
+
+	while( nStack > 0 )
+	{
+		int iBlock = stack[--nStack];
+		int nMask = m_bSSE ? DispSegmentTest_SSE( test, m_pNodeBounds[iBlock], 1.0f ) :
+			                 DispSegmentTest_Scalar( test, m_pNodeBounds[iBlock], 1.0f );
+		if( iBlock == 0 )
+		{
+			nMask &= 1;
+		}
+
+		int iFirstChild = NodeBounds_GetChild( iBlock );
+		if( iFirstChild < m_iFirstLeafNode )
+		{
+			// push them backwards so they come off in order
+			for( int iPush = 3; iPush >= 0; iPush-- )
+			{
+				if( nMask & ( 1 << iPush ) )
+				{
+					Assert( nStack < COLLTREE_WALK_STACK_SIZE );
+					stack[nStack++] = iFirstChild + iPush + 1;
+				}
+			}
+			continue;
+		}
+
+		for( int iLane = 0; iLane < 4; iLane++ )
+		{
+			if( !( nMask & ( 1 << iLane ) ) )
+				continue;
+
+			Node_t *pNode = &m_pNodes[iFirstChild + iLane];
+			for( int iTri = 0; iTri < 2; iTri++ )
+			{
+				Tri_t *pTri = &m_pTris[pNode->m_iTris[iTri]];
+
+				IntersectAABoxSweptTriangle( rayStart, rayEnd, boxExtents,
+											 m_pVerts[pTri->m_uiVerts[0]],
+											 m_pVerts[pTri->m_uiVerts[2]],
+											 m_pVerts[pTri->m_uiVerts[1]],
+											 pTri->m_vecNormal, pTri->m_flDist,
+											 pTri->m_nFlags, pTri->m_iSurfProp,
+											 pTrace, true, iSurfProp );
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: same as AABB_BuildTriList + AABB_IntersectTriList, but done at the
+//          first triangle the box touches
+//-----------------------------------------------------------------------------
+bool CDispCollTree::AABB_WalkTree( const Vector &boxCenter, const Vector &boxExtents )
+{
+	DispBoxTest_t test;
+	DispBoxTest_Init( test, boxCenter, boxExtents );
+
+	int stack[COLLTREE_WALK_STACK_SIZE];
+	int nStack = 0;
+	stack[nStack++] = 0;
+
+	while( nStack > 0 )
+	{
+		int iBlock = stack[--nStack];
+		int nMask = m_bSSE ? DispBoxTest_SSE( test, m_pNodeBounds[iBlock] ) :
+			                 DispBoxTest_Scalar( test, m_pNodeBounds[iBlock] );
+		if( iBlock == 0 )
+		{
+			nMask &= 1;
+		}
+
+		int iFirstChild = NodeBounds_GetChild( iBlock );
+		if( iFirstChild < m_iFirstLeafNode )
+		{
+			// push them backwards so they come off in order
+			for( int iPush = 3; iPush >= 0; iPush-- )
+			{
+				if( nMask & ( 1 << iPush ) )
+				{
+					Assert( nStack < COLLTREE_WALK_STACK_SIZE );
+					stack[nStack++] = iFirstChild + iPush + 1;
+				}
+			}
+			continue;
+		}
+
+		for( int iLane = 0; iLane < 4; iLane++ )
+		{
+			if( !( nMask & ( 1 << iLane ) ) )
+				continue;
+
+			Node_t *pNode = &m_pNodes[iFirstChild + iLane];
+			for( int iTri = 0; iTri < 2; iTri++ )
+			{
+				Tri_t *pTri = &m_pTris[pNode->m_iTris[iTri]];
+
+				if( SeparatingAxisAABoxTriangle( boxCenter, boxExtents,
+												 m_pVerts[pTri->m_uiVerts[0]], 
+												 m_pVerts[pTri->m_uiVerts[2]],
+												 m_pVerts[pTri->m_uiVerts[1]],
+												 pTri->m_vecNormal, pTri->m_flDist ) )
+				{
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 inline void FindMin( float v1, float v2, float v3, float &min )
@@ -2312,7 +2789,7 @@ void CDispCollTree::IntersectAABoxSweptTriangle( const Vector &boxStart, const V
 								                 const Vector &v2, const Vector &v3,
 								                 const Vector &triNormal, float triDist,
 												 unsigned short triFlags, unsigned short triSurfProp,
-												 CBaseTrace *pTrace, bool bStartOutside )
+												 CBaseTrace *pTrace, bool bStartOutside, unsigned short &iSurfProp )
 {
 	//
 	// make sure the box and triangle are not initially intersecting!!
@@ -2434,7 +2911,7 @@ void CDispCollTree::IntersectAABoxSweptTriangle( const Vector &boxStart, const V
 			pTrace->plane.normal = triNormal;
 			pTrace->plane.dist = triDist;
 			pTrace->dispFlags = triFlags;
-			m_iLatestSurfProp = triSurfProp;
+			iSurfProp = triSurfProp;
 		}
 	}
 }
@@ -28,6 +28,14 @@ struct RayDispOutput_t
 	float	dist;			// intersection distance
 };
 
+// Bounds of a node's four children, one lane per child, so a walk can test all
+// four with one set of SSE instructions
+struct DispNodeBounds_t
+{
+	float	m_Mins[3][4];
+	float	m_Maxs[3][4];
+};
+
 //=============================================================================
 //
 // Displacement Collision Tree Data
@@ -55,13 +63,17 @@ public:
 	bool RayTest( Ray_t const &ray, RayDispOutput_t &output );
 
 	bool RayTest( Vector const &rayStart, Vector const &rayEnd );  // return true/false no other collision info
-	bool RayTest( Vector const &rayStart, Vector const &rayEnd, float startFrac, float endFrac, CBaseTrace *pTrace );
+	// pSurfProp gets the surface properties of the triangle hit, if there was a hit
+	// bSIMDWalk walks the tree four children at a time and tests triangles as it reaches
+	// them, false builds a triangle list with the original recursive walk (cm_dispsimd)
+	bool RayTest( Vector const &rayStart, Vector const &rayEnd, float startFrac, float endFrac, CBaseTrace *pTrace, short *pSurfProp = NULL,
+		          bool bSIMDWalk = true );
 
 	bool RayTest( Ray_t &ray, Vector2D &texUV );
 
 	bool AABBSweep( Vector const &rayStart, Vector const &rayEnd, Vector const &boxExtents, 
-		            float startFrac, float endFrac, CBaseTrace *pTrace );
-	bool AABBIntersect( Vector const &boxCenter, Vector const &boxMin, Vector const &boxMax );
+		            float startFrac, float endFrac, CBaseTrace *pTrace, short *pSurfProp = NULL, bool bSIMDWalk = true );
+	bool AABBIntersect( Vector const &boxCenter, Vector const &boxMin, Vector const &boxMax, bool bSIMDWalk = true );
 	bool PointInBounds( Vector const &pos, Vector const &boxMin, Vector const &boxMax, bool bIsPoint );
 
 	void ApplyTerrainMod( ITerrainMod *pMod );
@@ -77,9 +89,6 @@ public:
 	inline int GetHeight( void );
 	inline int GetSize( void );
 
-	inline void SetCheckCount( int nDepth, int count );
-	inline int GetCheckCount( int nDepth ) const;
-
 	inline void GetStabDirection( Vector &dir );
 
 	inline int GetContents( void );
@@ -95,8 +104,6 @@ public:
 	inline void SetSurfaceProps2( short surfaceProps )						{ m_SurfaceProps[1] = surfaceProps; }
 	inline short GetSurfaceProps2( void )									{ return m_SurfaceProps[1]; }
 
-	inline short GetCollisionSurfProp( void )								{ return m_SurfaceProps[m_iLatestSurfProp]; }
-
 	inline void SetTriFlags( short iTri, unsigned short nFlags )			{ m_pTris[iTri].m_nFlags = nFlags; }
 
 protected:
@@ -165,6 +172,10 @@ protected:
 	int Nodes_Alloc( void );
 	void Nodes_Free( void );
 
+	// Child bounds for the SIMD walks, block 0 holds the root, block n + 1 the children of node n
+	void NodeBounds_Update( void );
+	inline int NodeBounds_GetChild( int iBlock );
+
 	void CalcFullBBox();
 	int AllocVertData( void );
 	void FreeVertData( void );
@@ -174,7 +185,8 @@ protected:
 
 	void Ray_BuildTriList( Vector const &rayStart, Vector const &rayEnd, int ndxNode, AABB_t &AABBox, TriList_t &triList ); 
 	bool FASTCALL Ray_NodeTest( Vector const &rayStart, Vector const &rayEnd, AABB_t const &AABBox );
-	void Ray_IntersectTriList( Vector const &rayStart, Vector const &rayEnd, float startFrac, float endFrac, CBaseTrace *pTrace, TriList_t const &triList );
+	void Ray_IntersectTriList( Vector const &rayStart, Vector const &rayEnd, float startFrac, float endFrac, CBaseTrace *pTrace, TriList_t const &triList,
+							   unsigned short &iSurfProp );
 	bool Ray_IntersectTriListTest( Vector const &rayStart, Vector const &rayEnd, TriList_t const &triList );
 
 	void AABB_BuildTriList( Vector const &boxCenter, Vector const &boxExtents, int ndxNode, TriList_t &triList );
@@ -185,11 +197,18 @@ protected:
 		                         int ndxNode, AABB_t &AABBox, TriList_t &triList );
 	bool SweptAABB_NodeTest( Vector const &rayStart, Vector const &rayEnd,
 							 Vector const &boxExtents, AABB_t const &AABBox );
+
+	// The SIMD walks, these test triangles in the same order the tri lists above would hold them
+	void Ray_WalkTree( Vector const &rayStart, Vector const &rayEnd, Vector const &clipRayStart, Vector const &clipRayEnd,
+					   float startFrac, float endFrac, CBaseTrace *pTrace, unsigned short &iSurfProp );
+	void SweptAABB_WalkTree( Vector const &rayStart, Vector const &rayEnd, Vector const &boxExtents,
+							 CBaseTrace *pTrace, unsigned short &iSurfProp );
+	bool AABB_WalkTree( Vector const &boxCenter, Vector const &boxExtents );
 	int SweptAABB_CullTriList( Vector const &rayStart, Vector const &rayEnd,
 							   Vector const &boxExtents, TriList_t &triList );
 	void SweptAABB_IntersectTriList( Vector const &rayStart, Vector const &rayEnd, 
 									 Vector const &boxExtents, float startFrac, float endFrac, 
-									 CBaseTrace *pTrace, TriList_t const &triList );
+									 CBaseTrace *pTrace, TriList_t const &triList, unsigned short &iSurfProp );
 
 
 	bool SeparatingAxisAABoxTriangle( Vector const &boxCenter, Vector const &boxExtents,
@@ -201,7 +220,7 @@ protected:
 								      Vector const &boxExtents, Vector const &v1,
 								      Vector const &v2, Vector const &v3,
 								      Vector const &triNormal, float triDist, unsigned short triFlags, unsigned short triSurfProp,
-								      /*float &fraction,*/ CBaseTrace *pTrace, bool bStartOutside );
+								      /*float &fraction,*/ CBaseTrace *pTrace, bool bStartOutside, unsigned short &iSurfProp );
 
 	inline bool AxialPlanesXYZ( Vector const &v1, Vector const &v2, Vector const &v3,
 								Vector const &boxStart, Vector const &boxEnd, Vector const &boxExtents,
@@ -244,20 +263,15 @@ protected:
 
 protected:
 
-	enum { MAX_CHECK_COUNT_DEPTH = 2 };
-
 	int					m_Power;				// size of the displacement ( 2^power + 1 )
 
 	Vector				m_SurfPoints[4];		// Base surface points.
 	int                 m_Contents;				// the displacement surface "contents" (solid, etc...)
-	unsigned short		m_iLatestSurfProp;		//
 	short				m_SurfaceProps[2];		// surface properties (save off from texdata for impact responses)
 
 	Vector				m_StabDir;				// the direction to stab for this displacement surface (is the base face normal)
 	Vector				m_BBoxWithFace[2];		// the bounding box of the displacement surface and base face
 
-	int					m_CheckCount[MAX_CHECK_COUNT_DEPTH];			// per frame collision flag (so we check only once)
-	
 	short				m_VertCount;			// number of vertices on displacement collision surface
 	Vector				*m_pVerts;				// list of displacement vertices
 	Vector				*m_pOriginalVerts;		// Original vertex positions, used for limiting terrain mods.
@@ -268,6 +282,9 @@ protected:
 
 	short				m_NodeCount;			// number of nodes in displacement collision tree
 	Node_t				*m_pNodes;				// list of nodes
+	short				m_iFirstLeafNode;		// nodes from here on are leaves
+	DispNodeBounds_t	*m_pNodeBounds;			// child bounds of the root and each non-leaf node
+	bool				m_bSSE;
 
 	CDispLeafLink		*m_pLeafLinkHead;		// List that links it into the leaves.
 };
@@ -329,24 +346,6 @@ inline int CDispCollTree::GetContents( void )
 }
 
 
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-inline void CDispCollTree::SetCheckCount( int nDepth, int count )
-{
-	Assert( (nDepth >= 0) && (nDepth < MAX_CHECK_COUNT_DEPTH) );
-	m_CheckCount[nDepth] = count;
-}
-
-	
-//-----------------------------------------------------------------------------
-//-----------------------------------------------------------------------------
-inline int CDispCollTree::GetCheckCount( int nDepth ) const
-{
-	Assert( (nDepth >= 0) && (nDepth < MAX_CHECK_COUNT_DEPTH) );
-	return m_CheckCount[nDepth];
-}
-
-
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 inline void CDispCollTree::GetBounds( Vector &boxMin, Vector &boxMax )
@@ -49,6 +49,12 @@ enum
 
 #define DELTASIZE_BITS		21
 
+// EnterPVS and DeltaEnt props are preceded by their length in bits, so the client can split
+// a packet into entities from the headers alone.  A one bit flag picks the short or long form.
+#define ENTITY_PROPS_SHORT_BITS		8
+#define ENTITY_PROPS_LONG_BITS		14
+#define ENTITY_PROPS_MAX_BITS		( ( 1 << ENTITY_PROPS_LONG_BITS ) - 1 )
+
 
 #define DELTAFRAME_NUMBITS	12
 #define DELTAFRAME_MASK		((1 << DELTAFRAME_NUMBITS)-1)
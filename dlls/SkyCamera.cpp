@@ -44,6 +44,13 @@ void CSkyCamera::Spawn( void )
 	m_skyboxData.origin = GetLocalOrigin();
 	m_skyboxData.area = engine->GetArea( m_skyboxData.origin );
 	Precache(); 
+
+	// Entities that spawned before us may have taken the PVS transmit hint in our area
+	CBaseEntity *pEnt = NULL;
+	while ( ( pEnt = gEntList.NextEnt( pEnt ) ) != NULL )
+	{
+		pEnt->UpdateTransmitFlags();
+	}
 }
 
 void CSkyCamera::Precache( void )
@@ -7117,6 +7117,8 @@ CAI_BaseNPC::CAI_BaseNPC(void)
 
 	SetHullType(HULL_HUMAN);  // Give human hull by default, subclasses should override
 
+	SetDefaultTransmitPVSBound();
+
 	m_iMySquadSlot				= SQUAD_SLOT_NONE;
 	m_flSumDamage				= 0;
 	m_flLastDamageTime			= 0;
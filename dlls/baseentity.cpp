@@ -265,6 +265,8 @@ CBaseEntity::CBaseEntity( bool bServerOnly )
 	pev = NULL;
 
 	m_pTransmitProxy = NULL;
+	m_bTransmitPVSBound = false;
+	m_nTransmitArea = 0;
 
 	// clear debug overlays
 	m_debugOverlays  = 0;
@@ -794,6 +796,7 @@ void CBaseEntity::AttachEdict( edict_t *pRequiredEdict )
 	}
 
 	pev->SetFullEdict( true );
+	UpdateTransmitFlags();
 }
 
 
@@ -2885,6 +2888,50 @@ void CBaseEntity::SetTransmitProxy( CBaseTransmitProxy *pProxy )
 	m_pTransmitProxy = pProxy;
 	if ( m_pTransmitProxy )
 		m_pTransmitProxy->AddRef();
+
+	UpdateTransmitFlags();
+}
+
+
+void CBaseEntity::SetTransmitPVSBound( bool bPVSBound )
+{
+	m_bTransmitPVSBound = bPVSBound;
+	UpdateTransmitFlags();
+}
+
+
+void CBaseEntity::SetDefaultTransmitPVSBound()
+{
+#ifndef TF2_DLL
+	SetTransmitPVSBound( true );
+#endif
+}
+
+
+static bool IsSkyCameraArea( int area )
+{
+	for ( CSkyCamera *pCur = CSkyList::m_pSkyCameras; pCur; pCur = pCur->m_pNextSkyCamera )
+	{
+		if ( pCur->m_skyboxData.area == area )
+			return true;
+	}
+	return false;
+}
+
+
+void CBaseEntity::UpdateTransmitFlags()
+{
+	if ( !pev )
+		return;
+
+	m_nTransmitArea = pev->areanum;
+
+	// A proxy or the skybox can make us transmit outside the PVS, so the engine has to ask.
+	// ShouldTransmit sends anything in the player's 3D skybox area without a PVS check.
+	if ( m_bTransmitPVSBound && !m_pTransmitProxy && !IsEFlagSet( EFL_IN_SKYBOX ) && !IsSkyCameraArea( pev->areanum ) )
+		pev->transmitflags |= FL_EDICT_PVSCHECK;
+	else
+		pev->transmitflags &= ~FL_EDICT_PVSCHECK;
 }
 
 
@@ -2926,6 +2973,7 @@ bool CBaseEntity::DetectInSkybox()
 		if ( engine->CheckAreasConnected( area, pCur->m_skyboxData.area ) )
 		{
 			m_iEFlags |= EFL_IN_SKYBOX;
+			UpdateTransmitFlags();
 			return true;
 		}
 
@@ -2933,6 +2981,7 @@ bool CBaseEntity::DetectInSkybox()
 	}
 
 	m_iEFlags &= ~EFL_IN_SKYBOX;
+	UpdateTransmitFlags();
 	return false;
 }
 
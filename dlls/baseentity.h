@@ -304,6 +304,7 @@ public:
 	virtual void			CheckTransmit( CCheckTransmitInfo *pInfo );
 	virtual EntityChange_t	DetectNetworkStateChanges();
 	virtual void			ResetNetworkStateChanges();
+	virtual int				GetNetworkVarChanges( const NetworkVarChange_t **ppChanges );
 	virtual CBaseNetworkable* GetBaseNetworkable();
 	virtual CBaseEntity*	GetBaseEntity();
 
@@ -402,6 +403,23 @@ public:
 	// Returns true if the entity is in the skybox (and EFL_IN_SKYBOX was set).
 	bool					DetectInSkybox();
 
+protected:
+	// Entities whose ShouldTransmit never returns true outside the recipient's PVS can call this
+	// so the engine skips CheckTransmit for clients that can't see them (FL_EDICT_PVSCHECK).
+	// Transmit proxies, EFL_IN_SKYBOX and being in a sky camera's area turn the hint back off.
+	void					SetTransmitPVSBound( bool bPVSBound );
+	// Same for classes that keep CBaseEntity::ShouldTransmit. Outside the PVS that sends the world,
+	// entities in the player's 3D skybox area (covered by the sky camera check above) and whatever
+	// team rules ask for, which only TF2's teams do, so this does nothing in TF2.
+	void					SetDefaultTransmitPVSBound();
+
+public:
+	// Redoes FL_EDICT_PVSCHECK. Sky cameras call this on every entity when they spawn.
+	void					UpdateTransmitFlags();
+	// Called from the simulation loop, the hint depends on the area the engine linked us into.
+	void					CheckTransmitArea();
+
+
 	bool					IsSimulatedEveryTick() const;
 	bool					IsAnimatedEveryTick() const;
 	void					SetSimulatedEveryTick( bool sim );
@@ -502,6 +520,7 @@ public:
 	void	NetworkStateForceUpdate()					{ m_NetStateMgr.StateChanged(); }
 	void	NetworkStateManualMode( bool activate )		{ m_NetStateMgr.EnableManualMode( activate ); }
 	void	NetworkStateChanged()						{ m_NetStateMgr.StateChanged(); }
+	void	NetworkStateChanged( void *pVar, int nBytes )	{ m_NetStateMgr.NetworkVarChanged( (char*)pVar - (char*)this, nBytes ); }
 	bool	IsUsingNetworkManualMode()					{ return m_NetStateMgr.IsUsingManualMode(); }
 
 	//
@@ -1394,6 +1413,8 @@ protected:
 
 private:
 	CBaseTransmitProxy *m_pTransmitProxy;
+	bool			m_bTransmitPVSBound;
+	int				m_nTransmitArea;		// pev->areanum when FL_EDICT_PVSCHECK was last worked out
 
 	QAngle			m_angAbsRotation;
 
@@ -1672,6 +1693,14 @@ inline void CBaseEntity::RemoveEFlags( int nEFlagMask )
 	m_iEFlags &= ~nEFlagMask;
 }
 
+inline void CBaseEntity::CheckTransmitArea()
+{
+	if ( m_bTransmitPVSBound && pev && pev->areanum != m_nTransmitArea )
+	{
+		UpdateTransmitFlags();
+	}
+}
+
 inline bool CBaseEntity::IsEFlagSet( int nEFlagMask ) const
 {
 	return (m_iEFlags & nEFlagMask) != 0;
@@ -1950,6 +1979,11 @@ inline void	CBaseEntity::ResetNetworkStateChanges()
 	m_NetStateMgr.ResetStateChanges(); 
 }
 
+inline int CBaseEntity::GetNetworkVarChanges( const NetworkVarChange_t **ppChanges )
+{
+	return m_NetStateMgr.GetNetworkVarChanges( ppChanges );
+}
+
 inline void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
 {
 	m_hGroundEntity = ground;
@@ -71,6 +71,12 @@ void CBaseNetworkable::ResetNetworkStateChanges()
 {
 }
 
+int CBaseNetworkable::GetNetworkVarChanges( const NetworkVarChange_t **ppChanges )
+{
+	// DetectNetworkStateChanges always autodetects, so there's no change list to go on.
+	return -1;
+}
+
 
 int CBaseNetworkable::GetEFlags() const
 {
@@ -151,3 +157,9 @@ void CBaseNetworkable::NetworkStateChanged()
 }
 
 
+void CBaseNetworkable::NetworkStateChanged( void *pVar, int nBytes )
+{
+	m_NetStateMgr.NetworkVarChanged( (char*)pVar - (char*)this, nBytes );
+}
+
+
@@ -44,6 +44,7 @@ public:
 	int						entindex() const;
 
 	void NetworkStateChanged();
+	void NetworkStateChanged( void *pVar, int nBytes );
 
 
 // IHandleEntity overrides.
@@ -58,6 +59,7 @@ public:
 
 	virtual EntityChange_t	DetectNetworkStateChanges();
 	virtual void			ResetNetworkStateChanges();
+	virtual int				GetNetworkVarChanges( const NetworkVarChange_t **ppChanges );
 
 	virtual int				GetEFlags() const;
 	virtual void			SetEFlags( int iEFlags );
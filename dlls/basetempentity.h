@@ -55,6 +55,7 @@ public:
 
 	void NetworkStateChanged() {}	// TE's are sent out right away so we don't track whether state changes or not,
 									// but we want to allow CNetworkVars.
+	void NetworkStateChanged( void *pVar, int nBytes ) {}
 
 private:
 	// Descriptive name, for when running tests
@@ -488,6 +488,7 @@ void CGib :: Spawn( const char *szGibModel )
 	SetCollisionGroup( COLLISION_GROUP_DEBRIS );
 
 	SetModel( szGibModel );
+	SetDefaultTransmitPVSBound();
 #ifdef HL1_DLL
 	SetElasticity( 1.0 ); // VXP
 	UTIL_SetSize(this, vec3_origin, vec3_origin);
@@ -18,6 +18,7 @@ CNetStateMgr::CNetStateMgr()
 	m_bUsingManualMode = false;
 	m_NSUpdateInterval = 0;
 	m_NSUpdateCounter = 0;
+	m_nVarChanges = -1;
 }
 
 
@@ -82,5 +83,17 @@ void CNetStateMgr::ResetStateChanges()
 {
 	m_bTimerElapsed = false;
 	m_bChanged = false;
+	m_nVarChanges = 0;
+}
+
+
+int CNetStateMgr::GetNetworkVarChanges( const NetworkVarChange_t **ppChanges ) const
+{
+	// Without network vars, nobody is recording changes.
+	if ( !g_bUseNetworkVars )
+		return -1;
+
+	*ppChanges = m_VarChanges;
+	return m_nVarChanges;
 }
 
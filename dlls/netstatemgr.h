@@ -57,11 +57,22 @@ public:
 	// entity is using an update interval, it will return a change next frame.
 	void			StateChanged( bool bForceUpdate = false );
 
+	// Called by network vars. Same as StateChanged, but it also remembers which bytes 
+	// of the entity changed so the engine only has to re-encode the props that read them.
+	void			NetworkVarChanged( int offset, int nBytes );
+
+	// Returns the network vars that changed since the last ResetStateChanges, or -1 
+	// if StateChanged was called or too many vars changed to keep track of.
+	int				GetNetworkVarChanges( const NetworkVarChange_t **ppChanges ) const;
+
 private:
 	bool			m_bUsingManualMode;
 	bool			m_bChanged;
 	bool			m_bTimerElapsed;
 
+	NetworkVarChange_t	m_VarChanges[MAX_NETWORKVAR_CHANGES];
+	int				m_nVarChanges;		// -1 if we lost track.
+
 	// Counters for SetUpdateInterval.
 	unsigned short	m_NSUpdateInterval;	// Real value is m_AutoUpdateFrequency * AUTOUPDATE_FREQ_SCALE
 	unsigned short	m_NSUpdateCounter;	// Counts down to zero. When zero, it triggers an auto update.
@@ -81,10 +92,36 @@ inline bool CNetStateMgr::IsUsingManualMode()
 inline void CNetStateMgr::StateChanged( bool bForceUpdate )
 {
 	m_bChanged = true;
+	m_nVarChanges = -1;
 	
 	if ( bForceUpdate )
 		m_NSUpdateCounter = 0;
 }
 
+inline void CNetStateMgr::NetworkVarChanged( int offset, int nBytes )
+{
+	m_bChanged = true;
+
+	if ( m_nVarChanges < 0 )
+		return;
+
+	// Vars tend to get set over and over, so check if we've already got it.
+	for ( int i=0; i < m_nVarChanges; i++ )
+	{
+		if ( m_VarChanges[i].m_Offset == offset )
+			return;
+	}
+
+	if ( m_nVarChanges >= MAX_NETWORKVAR_CHANGES || offset < 0 || offset > 0xFFFF || nBytes > 0xFFFF )
+	{
+		m_nVarChanges = -1;
+		return;
+	}
+
+	m_VarChanges[m_nVarChanges].m_Offset = (unsigned short)offset;
+	m_VarChanges[m_nVarChanges].m_nBytes = (unsigned short)nBytes;
+	++m_nVarChanges;
+}
+
 
 #endif // NETSTATEMGR_H
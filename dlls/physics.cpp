@@ -41,6 +41,16 @@
 
 ConVar phys_timescale( "phys_timescale", "1" );
 ConVar phys_speeds( "phys_speeds", "0" );
+
+static void PhysParallelChanged_Callback( ConVar *var, const char *pOldString )
+{
+	if ( physenv )
+	{
+		physenv->EnableParallelSimulation( var->GetBool() );
+	}
+}
+
+ConVar phys_parallel( "phys_parallel", "0", 0, "Simulate independent groups of physics objects on the worker threads (only while sv_workerthreads > 0)", PhysParallelChanged_Callback );
 extern ConVar phys_rolling_drag;
 
 // defined in phys_constraint
@@ -256,6 +266,7 @@ void CPhysicsHook::LevelInitPreEntity()
 	physenv->SetSimulationTimestep( 0.015 ); // 15 ms per tick
 	// HL Game gravity, not real-world gravity
 	physenv->SetGravity( Vector( 0, 0, -sv_gravity.GetFloat() ) );
+	physenv->EnableParallelSimulation( phys_parallel.GetBool() );
 	g_PhysAverageSimTime = 0;
 
 	g_PhysWorldObject = PhysCreateWorld( GetWorldEntity() );
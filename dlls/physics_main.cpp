@@ -1685,6 +1685,8 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 			pEntity->PhysicsSimulate();
 		}
 
+		pEntity->CheckTransmitArea();
+
 		// Restore suppression filter
 		IPredictionSystem::SuppressHostEvents( NULL );
 	}
@@ -9,14 +9,19 @@
 #include "usercmd.h"
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
+#include "tier0/fasttimer.h"
+
+#include <xmmintrin.h>
 
 static ConVar sv_unlag("sv_unlag", "1", FCVAR_SERVER );
 static ConVar sv_maxunlag("sv_maxunlag"	, "0.5", FCVAR_NONE );
 static ConVar sv_unlagpush("sv_unlagpush"	, "0.0", FCVAR_NONE );
 static ConVar sv_unlagsamples("sv_unlagsamples", "1", FCVAR_NONE );
+static ConVar sv_unlagcone("sv_unlagcone", "0", FCVAR_NONE, "Only move back players that were within this many degrees of the shooter's aim (0 = move back everyone). Culled players are not moved for hit tests or the shooter's own movement." );
 
 #define LC_NONE				0
 #define LC_ALIVE			(1<<0)
+#define LC_ACTIVE			(1<<1)
 
 #define LC_ORIGIN_CHANGED	(1<<8)
 #define LC_ANGLES_CHANGED	(1<<9)
@@ -29,6 +34,26 @@ static ConVar sv_unlagsamples("sv_unlagsamples", "1", FCVAR_NONE );
 // Only keep 1 second of data
 #define LAG_COMPENSATION_DATA_TIME	1.0f
 
+// Records kept for each player.  Must be a power of two and hold
+//  LAG_COMPENSATION_DATA_TIME worth of frames.
+#define LAG_COMPENSATION_HISTORY		128
+#define LAG_COMPENSATION_HISTORY_MASK	( LAG_COMPENSATION_HISTORY - 1 )
+
+// How far the shooter's eyes can be from where they were at the start of the
+//  command when the weapon fires, on top of the distance they can run
+#define LAG_COMPENSATION_CONE_SLOP	32.0f
+
+// Each record is these floats, interpolated the same way
+enum
+{
+	LC_ORIGIN = 0,
+	LC_ANGLES = 3,
+	LC_MINS = 6,
+	LC_MAXS = 9,
+
+	LC_NUM_COMPONENTS = 12
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -74,31 +99,389 @@ public:
 };
 
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Purpose: One player's history.  Each component has its own ring, so the
+//  same value from consecutive records is contiguous.
+//-----------------------------------------------------------------------------
+struct LagPlayerHistory_t
+{
+	float			m_flComponents[ LC_NUM_COMPONENTS ][ LAG_COMPENSATION_HISTORY ];
+	int				m_fFlags[ LAG_COMPENSATION_HISTORY ];
+	// Number of records, from this one back, the player can be interpolated
+	//  across without a gap, a death or respawn, or a teleport
+	int				m_nTrack[ LAG_COMPENSATION_HISTORY ];
+};
+
+struct LagInterpolated_t
+{
+	float			m_flComponents[ LC_NUM_COMPONENTS ];
+};
+
+// Where the shooter can hit anything this command
+struct LagFireCone_t
+{
+	Vector			m_vecApex;
+	Vector			m_vecAxis;
+	float			m_flSin;
+	float			m_flCos;
+	// Added to the radius of everything tested against the cone
+	float			m_flSlop;
+};
+
 //-----------------------------------------------------------------------------
-class LagCompensationContext
+// Purpose: Position history of every player.  Records are addressed by age,
+//  0 is the newest.
+//-----------------------------------------------------------------------------
+class CLagCompensationHistory
 {
 public:
-	LagCompensationContext()
-	{ 
-		m_flRecordTime = 0.0f;
-		memset( m_Records, 0, sizeof( m_Records ) );
+	CLagCompensationHistory( int nPlayers );
+	~CLagCompensationHistory();
+
+	void			Clear();
+
+	// Drops records from before deadtime
+	void			Decay( float deadtime );
+
+	// Starts a new record with every player absent, then fills in the ones that are there
+	void			BeginRecord( float flTime );
+	void			RecordPlayer( int index, bool bAlive, const Vector &origin, const QAngle &angles, const Vector &mins, const Vector &maxs );
+
+	int				Count() const;
+	float			GetRecordTime( int age ) const;
+	bool			FindSpanningRecords( float targettime, int *newer, int *older ) const;
+
+	// The player was there, alive and not teleporting, in every record from the newest to older
+	bool			CanInterpolate( int index, int older ) const;
+	// Also walks the records like CanInterpolate, without the track lengths
+	bool			CanInterpolateSlow( int index, int older ) const;
+
+	// World space box of the player in a record
+	void			GetAbsBox( int index, int age, Vector &absmins, Vector &absmaxs ) const;
+	// The player's box now, or anywhere between the two records, touches the cone
+	bool			CrossesCone( int index, int newer, int older, const Vector &absmins, const Vector &absmaxs, const LagFireCone_t &cone ) const;
+
+	// Interpolates the listed players between the two records, four at a time
+	void			Interpolate( const int *pIndices, int nPlayers, int newer, int older, float frac, LagInterpolated_t *pOut ) const;
+	void			InterpolateSlow( int index, int newer, int older, float frac, LagInterpolated_t *pOut ) const;
+
+private:
+	int				Slot( int age ) const;
+
+	LagPlayerHistory_t	*m_pPlayers;
+	int				m_nPlayers;
+
+	float			m_flRecordTime[ LAG_COMPENSATION_HISTORY ];
+	// Slot of the newest record
+	int				m_nNewest;
+	int				m_nCount;
+};
+
+CLagCompensationHistory::CLagCompensationHistory( int nPlayers )
+{
+	m_nPlayers = nPlayers;
+	m_pPlayers = new LagPlayerHistory_t[ nPlayers ];
+	Clear();
+}
+
+CLagCompensationHistory::~CLagCompensationHistory()
+{
+	delete[] m_pPlayers;
+}
+
+void CLagCompensationHistory::Clear()
+{
+	m_nNewest = 0;
+	m_nCount = 0;
+	memset( m_flRecordTime, 0, sizeof( m_flRecordTime ) );
+	memset( m_pPlayers, 0, m_nPlayers * sizeof( LagPlayerHistory_t ) );
+}
+
+inline int CLagCompensationHistory::Slot( int age ) const
+{
+	Assert( age >= 0 && age < m_nCount );
+	return ( m_nNewest - age ) & LAG_COMPENSATION_HISTORY_MASK;
+}
+
+inline int CLagCompensationHistory::Count() const
+{
+	return m_nCount;
+}
+
+inline float CLagCompensationHistory::GetRecordTime( int age ) const
+{
+	return m_flRecordTime[ Slot( age ) ];
+}
+
+void CLagCompensationHistory::Decay( float deadtime )
+{
+	// Records only get newer going forward, so the stale ones are all at the end
+	while ( m_nCount > 0 && m_flRecordTime[ Slot( m_nCount - 1 ) ] < deadtime )
+	{
+		m_nCount--;
+	}
+}
+
+void CLagCompensationHistory::BeginRecord( float flTime )
+{
+	m_nNewest = ( m_nNewest + 1 ) & LAG_COMPENSATION_HISTORY_MASK;
+	m_nCount = min( m_nCount + 1, LAG_COMPENSATION_HISTORY );
+
+	m_flRecordTime[ m_nNewest ] = flTime;
+
+	int i;
+	for ( i = 0; i < m_nPlayers; i++ )
+	{
+		m_pPlayers[ i ].m_fFlags[ m_nNewest ] = LC_NONE;
+		m_pPlayers[ i ].m_nTrack[ m_nNewest ] = 0;
+	}
+}
+
+void CLagCompensationHistory::RecordPlayer( int index, bool bAlive, const Vector &origin, const QAngle &angles, const Vector &mins, const Vector &maxs )
+{
+	Assert( index >= 0 && index < m_nPlayers );
+	LagPlayerHistory_t *history = &m_pPlayers[ index ];
+	int slot = m_nNewest;
+
+	int i;
+	for ( i = 0; i < 3; i++ )
+	{
+		history->m_flComponents[ LC_ORIGIN + i ][ slot ] = origin[ i ];
+		history->m_flComponents[ LC_ANGLES + i ][ slot ] = angles[ i ];
+		history->m_flComponents[ LC_MINS + i ][ slot ] = mins[ i ];
+		history->m_flComponents[ LC_MAXS + i ][ slot ] = maxs[ i ];
+	}
+
+	history->m_fFlags[ slot ] = LC_ACTIVE | ( bAlive ? LC_ALIVE : 0 );
+	history->m_nTrack[ slot ] = 1;
+
+	// Extend the previous record's track if the player didn't respawn, die or teleport since
+	if ( m_nCount < 2 )
+		return;
+
+	int prev = Slot( 1 );
+	if ( !( history->m_fFlags[ prev ] & LC_ACTIVE ) )
+		return;
+
+	if ( ( history->m_fFlags[ prev ] ^ history->m_fFlags[ slot ] ) & LC_ALIVE )
+		return;
+
+	Vector delta;
+	for ( i = 0; i < 3; i++ )
+	{
+		delta[ i ] = history->m_flComponents[ LC_ORIGIN + i ][ prev ] - origin[ i ];
+	}
+	if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
+		return;
+
+	history->m_nTrack[ slot ] = history->m_nTrack[ prev ] + 1;
+}
+
+bool CLagCompensationHistory::FindSpanningRecords( float targettime, int *newer, int *older ) const
+{
+	Assert( older && newer );
+	*newer = -1;
+	*older = -1;
+
+	int count = m_nCount;
+	if ( count < 2 )
+		return false;
+
+	int i;
+	for ( i = 0; i < count - 1; i++ )
+	{
+		if ( targettime >= GetRecordTime( i + 1 ) &&
+			 targettime <= GetRecordTime( i ) )
+		{
+			*newer = i;
+			*older = i + 1;
+			return true;
+		}
 	}
-	LagCompensationContext( const LagCompensationContext& src )
+
+	*newer = count - 2;
+	*older = count - 1;
+	return true;
+}
+
+inline bool CLagCompensationHistory::CanInterpolate( int index, int older ) const
+{
+	return m_pPlayers[ index ].m_nTrack[ m_nNewest ] > older;
+}
+
+bool CLagCompensationHistory::CanInterpolateSlow( int index, int older ) const
+{
+	const LagPlayerHistory_t *history = &m_pPlayers[ index ];
+
+	int j;
+	for ( j = 0; j <= older; j++ )
 	{
-		m_flRecordTime = src.m_flRecordTime;
+		int slot = Slot( j );
+		if ( !( history->m_fFlags[ slot ] & LC_ACTIVE ) )
+			return false;
+
+		if ( j == 0 )
+			continue;
+
+		int prev = Slot( j - 1 );
+		if ( ( history->m_fFlags[ prev ] ^ history->m_fFlags[ slot ] ) & LC_ALIVE )
+			return false;
+
+		Vector delta;
 		int i;
-		for ( i = 0; i < MAX_CLIENTS; i++ )
+		for ( i = 0; i < 3; i++ )
 		{
-			m_Records[ i ] = src.m_Records[ i ];
+			delta[ i ] = history->m_flComponents[ LC_ORIGIN + i ][ slot ] - history->m_flComponents[ LC_ORIGIN + i ][ prev ];
 		}
+		if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
+			return false;
 	}
-	// Timestamp record was created (at end of frame?)
-	float			m_flRecordTime;
-	LagRecord		m_Records[ MAX_CLIENTS ];	
-};
+	return true;
+}
+
+void CLagCompensationHistory::GetAbsBox( int index, int age, Vector &absmins, Vector &absmaxs ) const
+{
+	const LagPlayerHistory_t *history = &m_pPlayers[ index ];
+	int slot = Slot( age );
+
+	int i;
+	for ( i = 0; i < 3; i++ )
+	{
+		absmins[ i ] = history->m_flComponents[ LC_ORIGIN + i ][ slot ] + history->m_flComponents[ LC_MINS + i ][ slot ];
+		absmaxs[ i ] = history->m_flComponents[ LC_ORIGIN + i ][ slot ] + history->m_flComponents[ LC_MAXS + i ][ slot ];
+	}
+}
+
+bool CLagCompensationHistory::CrossesCone( int index, int newer, int older, const Vector &absmins, const Vector &absmaxs, const LagFireCone_t &cone ) const
+{
+	// Interpolated boxes are always inside the bounds of the two records
+	Vector newmins, newmaxs, oldmins, oldmaxs;
+	GetAbsBox( index, newer, newmins, newmaxs );
+	GetAbsBox( index, older, oldmins, oldmaxs );
+
+	Vector mins, maxs;
+	int i;
+	for ( i = 0; i < 3; i++ )
+	{
+		mins[ i ] = min( absmins[ i ], min( newmins[ i ], oldmins[ i ] ) );
+		maxs[ i ] = max( absmaxs[ i ], max( newmaxs[ i ], oldmaxs[ i ] ) );
+	}
+
+	// Test the bounding sphere
+	Vector center = ( mins + maxs ) * 0.5f;
+	float radius = ( maxs - mins ).Length() * 0.5f + cone.m_flSlop;
+
+	Vector v = center - cone.m_vecApex;
+	float distSqr = v.LengthSqr();
+	if ( distSqr <= radius * radius )
+		return true;
+
+	// Distance from the center to the side of the cone.  Behind the apex this
+	//  comes out shorter than it is, which only lets more through.
+	float along = DotProduct( v, cone.m_vecAxis );
+	float across = sqrt( max( distSqr - along * along, 0.0f ) );
+	return ( across * cone.m_flCos - along * cone.m_flSin ) <= radius;
+}
+
+void CLagCompensationHistory::Interpolate( const int *pIndices, int nPlayers, int newer, int older, float frac, LagInterpolated_t *pOut ) const
+{
+	int newslot = Slot( newer );
+	int oldslot = Slot( older );
+
+	__m128 vFrac = _mm_set1_ps( frac );
+
+	int i;
+	for ( i = 0; i < nPlayers; i += 4 )
+	{
+		// A short last batch just repeats its last player
+		const LagPlayerHistory_t *history[ 4 ];
+		int k;
+		for ( k = 0; k < 4; k++ )
+		{
+			history[ k ] = &m_pPlayers[ pIndices[ min( i + k, nPlayers - 1 ) ] ];
+		}
+
+		float result[ LC_NUM_COMPONENTS ][ 4 ];
+
+		int c;
+		for ( c = 0; c < LC_NUM_COMPONENTS; c++ )
+		{
+			__m128 vOld = _mm_setr_ps( history[ 0 ]->m_flComponents[ c ][ oldslot ], history[ 1 ]->m_flComponents[ c ][ oldslot ],
+				history[ 2 ]->m_flComponents[ c ][ oldslot ], history[ 3 ]->m_flComponents[ c ][ oldslot ] );
+			__m128 vNew = _mm_setr_ps( history[ 0 ]->m_flComponents[ c ][ newslot ], history[ 1 ]->m_flComponents[ c ][ newslot ],
+				history[ 2 ]->m_flComponents[ c ][ newslot ], history[ 3 ]->m_flComponents[ c ][ newslot ] );
+
+			_mm_storeu_ps( result[ c ], _mm_add_ps( vOld, _mm_mul_ps( vFrac, _mm_sub_ps( vNew, vOld ) ) ) );
+		}
+
+		int nBatch = min( 4, nPlayers - i );
+		for ( k = 0; k < nBatch; k++ )
+		{
+			for ( c = 0; c < LC_NUM_COMPONENTS; c++ )
+			{
+				pOut[ i + k ].m_flComponents[ c ] = result[ c ][ k ];
+			}
+		}
+	}
+}
+
+void CLagCompensationHistory::InterpolateSlow( int index, int newer, int older, float frac, LagInterpolated_t *pOut ) const
+{
+	const LagPlayerHistory_t *history = &m_pPlayers[ index ];
+	int newslot = Slot( newer );
+	int oldslot = Slot( older );
+
+	int c;
+	for ( c = 0; c < LC_NUM_COMPONENTS; c++ )
+	{
+		float src = history->m_flComponents[ c ][ oldslot ];
+		float dest = history->m_flComponents[ c ][ newslot ];
+		pOut->m_flComponents[ c ] = src + frac * ( dest - src );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets up the cone the shooter can fire into
+// Input  : degrees - angle between the aim and the side of the cone
+//			slop - how far the shooter can move before firing
+//-----------------------------------------------------------------------------
+static void LagCompensation_BuildFireCone( const Vector &eyes, const QAngle &viewangles, float degrees, float slop, LagFireCone_t *cone )
+{
+	cone->m_vecApex = eyes;
+	AngleVectors( viewangles, &cone->m_vecAxis );
+	cone->m_flSin = sin( DEG2RAD( degrees ) );
+	cone->m_flCos = cos( DEG2RAD( degrees ) );
+	cone->m_flSlop = slop;
+}
 
+//-----------------------------------------------------------------------------
+// Purpose: Cone from sv_unlagcone, returns false if it doesn't limit anything
+//-----------------------------------------------------------------------------
+static bool LagCompensation_GetFireCone( const Vector &eyes, const QAngle &viewangles, float slop, LagFireCone_t *cone )
+{
+	float degrees = sv_unlagcone.GetFloat();
+	if ( degrees <= 0.0f || degrees >= 180.0f )
+		return false;
+
+	LagCompensation_BuildFireCone( eyes, viewangles, degrees, slop, cone );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Span of history a usercmd wants the other players moved back to
+//-----------------------------------------------------------------------------
+static float LagCompensation_GetFraction( const CLagCompensationHistory &history, float targettime, int newer, int older )
+{
+	float newtime = history.GetRecordTime( newer );
+	float oldtime = history.GetRecordTime( older );
 
+	float frac = 1.0f;
+	if ( oldtime != newtime )
+	{
+		frac = ( targettime - oldtime ) / ( newtime - oldtime );
+		frac = clamp( frac, 0.0f, 1.0f );
+	}
+	return frac;
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -106,15 +489,19 @@ public:
 class CLagCompensationManager : public CAutoGameSystem, public ILagCompensationManager
 {
 public:
+	CLagCompensationManager() : m_History( MAX_CLIENTS )
+	{
+	}
+
 	// IServerSystem stuff
 	virtual void Shutdown()
 	{
-		m_Data.Purge();
+		m_History.Clear();
 	}
 
 	virtual void LevelShutdownPostEntity()
 	{
-		m_Data.RemoveAll();
+		m_History.Clear();
 	}
 
 	// called after entities think
@@ -128,11 +515,9 @@ public:
 
 private:
 	float			GetLatency( CBasePlayer *player );
-	void			DecayStaleContextData( void );
-
-	bool			FindSpanningContexts( float targettime, int *context1, int *context2 );
+	void			BacktrackPlayer( CBasePlayer *pPlayer, const LagInterpolated_t &interpolated );
 
-	CUtlVector< LagCompensationContext >	m_Data;
+	CLagCompensationHistory	m_History;
 
 	// Scratchpad for determining what needs to be restored
 	unsigned int	restorebits;
@@ -168,31 +553,13 @@ float CLagCompensationManager::GetLatency ( CBasePlayer *player )
 	return ping;
 }
 
-void CLagCompensationManager::DecayStaleContextData( void )
-{
-	float deadtime = gpGlobals->realtime - LAG_COMPENSATION_DATA_TIME;
-
-	int c = m_Data.Size();
-	int i;
-	for ( i = c - 1; i >= 0; i-- )
-	{
-		LagCompensationContext *context = &m_Data[ i ];
-		if ( context->m_flRecordTime >= deadtime )
-			continue;
-
-		m_Data.Remove( i );
-	}
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: Called once per frame after all entities have had a chance to think
 //-----------------------------------------------------------------------------
 void CLagCompensationManager::FrameUpdatePostEntityThink()
 {
-	DecayStaleContextData();
-
-	LagCompensationContext context;
-	context.m_flRecordTime = gpGlobals->realtime;
+	m_History.Decay( gpGlobals->realtime - LAG_COMPENSATION_DATA_TIME );
+	m_History.BeginRecord( gpGlobals->realtime );
 
 	// Iterate all active players
 	int i;
@@ -202,82 +569,8 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 		if ( !pPlayer )
 			continue;
 
-		LagRecord *record = &context.m_Records[ i - 1 ];
-		record->m_bActive = true;
-		record->m_nPlayerIndex = pPlayer->entindex();
-		record->m_fFlags = 0;
-		if ( pPlayer->IsAlive() )
-		{
-			record->m_fFlags |= LC_ALIVE;
-		}
-		record->m_vecAngles			= pPlayer->GetLocalAngles();
-		record->m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record->m_vecMaxs			= pPlayer->WorldAlignMaxs();
-		record->m_vecMins			= pPlayer->WorldAlignMins();
-	}
-
-	m_Data.AddToHead( context );
-}
-
-bool CLagCompensationManager::FindSpanningContexts( float targettime, int *newer, int *older )
-{
-	Assert( older && newer );
-	*newer = -1;
-	*older = -1;
-
-	int count = m_Data.Size();
-	if ( count < 2 )
-		return false;
-
-	int i;
-	int j;
-	for ( i = 0; i < count - 1; i++ )
-	{
-		j = i + 1;
-
-		// New items are pushed onto front of stack
-		LagCompensationContext *c1, *c2;
-		c1 = &m_Data[ i ]; // newer
-		c2 = &m_Data[ j ]; // older
-
-		if ( targettime >= c2->m_flRecordTime && 
-			 targettime <= c1->m_flRecordTime )
-		{
-			*newer = i;
-			*older = j;
-			return true;
-		}
-	}
-
-	*newer = count - 2;
-	*older = count - 1;
-	return true;
-}
-
-//-----------------------------------------------------------------------------
-// Purpose: Simple linear interpolation
-// Input  : frac - 
-//			src - 
-//			dest - 
-//			output - 
-//-----------------------------------------------------------------------------
-static void InterpolateVector( float frac, const Vector& src, const Vector& dest, Vector& output )
-{
-	int i;
-
-	for ( i = 0; i < 3; i++ )
-	{
-		output[ i ] = src[ i ] + frac * ( dest[ i ] - src[ i ] );
-	}
-}
-
-static void InterpolateAngles( float frac, const QAngle& src, const QAngle& dest, QAngle& output )
-{
-	int i;
-
-	for ( i = 0; i < 3; i++ )
-	{
-		output[ i ] = src[ i ] + frac * ( dest[ i ] - src[ i ] );
+		m_History.RecordPlayer( pPlayer->entindex() - 1, pPlayer->IsAlive(),
+			pPlayer->GetLocalOrigin(), pPlayer->GetLocalAngles(), pPlayer->WorldAlignMins(), pPlayer->WorldAlignMaxs() );
 	}
 }
 
@@ -287,7 +580,6 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 	// Assume no players need to be restored
 	restorebits = 0UL;
 	m_bNeedToRestore = false;
-	memset( restoreData, 0, sizeof( restoreData ) );
 
 	// Player not wanting lag compensation
 	if ( !cmd->lag_compensation )
@@ -342,7 +634,7 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 	int newer = -1;
 	int older = -1;
 
-	if ( !FindSpanningContexts( targettime, &newer, &older ) )
+	if ( !m_History.FindSpanningRecords( targettime, &newer, &older ) )
 	{
 		return;
 	}
@@ -353,6 +645,15 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		return;
 	}
 
+	// Players that can't be anywhere the shooter might fire this command don't need to move
+	LagFireCone_t cone;
+	float slop = LAG_COMPENSATION_CONE_SLOP + player->GetAbsVelocity().Length() * cmd->frametime;
+	bool cull = LagCompensation_GetFireCone( player->EyePosition(), cmd->viewangles, slop, &cone );
+
+	CBasePlayer *players[ MAX_CLIENTS ];
+	int indices[ MAX_CLIENTS ];
+	int count = 0;
+
 	// Iterate all active players
 	int i;
 	for ( i = 1; i <= gpGlobals->maxClients; i++ )
@@ -371,171 +672,134 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 
 		int index = pPlayer->entindex() - 1;
 
-		// Walk context looking for any invalidating event
-		Vector prevOrigin;
-		prevOrigin.Init();
-		bool wasAlive = true;
-
-		bool lost_track = false;
-
-		for ( int j = 0; j <= older; j++ )
-		{
-			LagCompensationContext *context = &m_Data[ j ];
-			Assert( context );
-
-			LagRecord *record = &context->m_Records[ index ];
-
-			if ( !record->m_bActive )
-			{
-				lost_track = true;
-				break;
-			}
-
-			if ( j != 0 )
-			{
-				// Check for state change
-				bool alive = ( record->m_fFlags & LC_ALIVE ) ? true : false;
-				if ( alive ^ wasAlive )
-				{
-					// Respawned or died, stop chain here
-					lost_track = true;
-					break;
-				}
-
-				Vector delta = record->m_vecOrigin - prevOrigin;
-				if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
-				{
-					lost_track = true;
-					break;
-				}
-			}
-
-			wasAlive = ( record->m_fFlags & LC_ALIVE ) ? true : false;
-			prevOrigin = record->m_vecOrigin;
-		}
-
 		// Player didn't exist all the way through history to spanning contexts!!!
-		if ( lost_track )
+		if ( !m_History.CanInterpolate( index, older ) )
 			continue;
 
-		// Okay, interpolate data
-		LagCompensationContext *newcontext, *oldcontext;
-		
-		newcontext = &m_Data[ newer ];
-		oldcontext = &m_Data[ older ];
+		if ( cull && !m_History.CrossesCone( index, newer, older,
+				pPlayer->GetLocalOrigin() + pPlayer->WorldAlignMins(), pPlayer->GetLocalOrigin() + pPlayer->WorldAlignMaxs(), cone ) )
+			continue;
 
-		LagRecord *newrecord, *oldrecord;
+		players[ count ] = pPlayer;
+		indices[ count ] = index;
+		count++;
+	}
 
-		newrecord = &newcontext->m_Records[ index ];
-		oldrecord = &oldcontext->m_Records[ index ];
-		Assert( oldrecord && newrecord );
+	if ( !count )
+		return;
 
-		float frac = 1.0f;
-		if ( oldcontext->m_flRecordTime != newcontext->m_flRecordTime )
-		{
-			frac = ( targettime - oldcontext->m_flRecordTime ) / ( newcontext->m_flRecordTime - oldcontext->m_flRecordTime );
-			frac = clamp( frac, 0.0f, 1.0f );
-		}
+	// Okay, interpolate data
+	LagInterpolated_t interpolated[ MAX_CLIENTS ];
+	float frac = LagCompensation_GetFraction( m_History, targettime, newer, older );
+	m_History.Interpolate( indices, count, newer, older, frac, interpolated );
 
-		// Compute interpolated values
-		Vector org;
-		QAngle ang;
-		Vector mins;
-		Vector maxs;
+	for ( i = 0; i < count; i++ )
+	{
+		BacktrackPlayer( players[ i ], interpolated[ i ] );
+	}
+}
 
-		InterpolateVector( frac, oldrecord->m_vecOrigin, newrecord->m_vecOrigin, org );
-		InterpolateAngles( frac, oldrecord->m_vecAngles, newrecord->m_vecAngles, ang );
-		InterpolateVector( frac, oldrecord->m_vecMins, newrecord->m_vecMins, mins );
-		InterpolateVector( frac, oldrecord->m_vecMaxs, newrecord->m_vecMaxs, maxs );
+//-----------------------------------------------------------------------------
+// Purpose: Moves a player to where they were, remembering where to put them back
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, const LagInterpolated_t &interpolated )
+{
+	int index = pPlayer->entindex() - 1;
 
-		// See if this represents a change for the player
-		int flags = 0;
-		LagRecord *restore = &restoreData[ RESTORE_RECORD ][ index ];
-		LagRecord *change  = &restoreData[ CHANGE_RECORD ][ index ];
+	// Compute interpolated values
+	const float *f = interpolated.m_flComponents;
+	Vector org( f[ LC_ORIGIN ], f[ LC_ORIGIN + 1 ], f[ LC_ORIGIN + 2 ] );
+	QAngle ang( f[ LC_ANGLES ], f[ LC_ANGLES + 1 ], f[ LC_ANGLES + 2 ] );
+	Vector mins( f[ LC_MINS ], f[ LC_MINS + 1 ], f[ LC_MINS + 2 ] );
+	Vector maxs( f[ LC_MAXS ], f[ LC_MAXS + 1 ], f[ LC_MAXS + 2 ] );
 
-		QAngle angdiff = pPlayer->GetLocalAngles() - ang;
+	// See if this represents a change for the player
+	int flags = 0;
+	LagRecord *restore = &restoreData[ RESTORE_RECORD ][ index ];
+	LagRecord *change  = &restoreData[ CHANGE_RECORD ][ index ];
 
-		if ( angdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
-		{
-			flags |= LC_ANGLES_CHANGED;
-			restore->m_vecAngles = pPlayer->GetLocalAngles();
-			pPlayer->SetLocalAngles( angdiff );
-			change->m_vecAngles = angdiff;
-		}
+	QAngle angdiff = pPlayer->GetLocalAngles() - ang;
 
-		// Use absoluate equality here
-		if ( ( mins != pPlayer->WorldAlignMins() ) ||
-			 ( maxs != pPlayer->WorldAlignMaxs() ) )
-		{
-			flags |= LC_SIZE_CHANGED;
-			restore->m_vecMins = pPlayer->WorldAlignMins() ;
-			restore->m_vecMaxs = pPlayer->WorldAlignMaxs();
-			pPlayer->SetSize( mins, maxs );
-			change->m_vecMins = mins;
-			change->m_vecMaxs = maxs;
-		}
+	if ( angdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
+	{
+		flags |= LC_ANGLES_CHANGED;
+		restore->m_vecAngles = pPlayer->GetLocalAngles();
+		pPlayer->SetLocalAngles( angdiff );
+		change->m_vecAngles = angdiff;
+	}
 
-		Vector diff = pPlayer->GetLocalOrigin() - org;
+	// Use absoluate equality here
+	if ( ( mins != pPlayer->WorldAlignMins() ) ||
+		 ( maxs != pPlayer->WorldAlignMaxs() ) )
+	{
+		flags |= LC_SIZE_CHANGED;
+		restore->m_vecMins = pPlayer->WorldAlignMins() ;
+		restore->m_vecMaxs = pPlayer->WorldAlignMaxs();
+		pPlayer->SetSize( mins, maxs );
+		change->m_vecMins = mins;
+		change->m_vecMaxs = maxs;
+	}
 
-		// Note, do origin at end since it causes a relink into the k/d tree
-		if ( diff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
-		{
-			flags |= LC_ORIGIN_CHANGED;
-			restore->m_vecOrigin = pPlayer->GetLocalOrigin();
-			// Move player, but don't fire triggers
-			UTIL_SetOrigin( pPlayer, org );
-			change->m_vecOrigin = org;
-		}
+	Vector diff = pPlayer->GetLocalOrigin() - org;
 
-		if ( !flags )
-		{
-			continue;
-		}
+	// Note, do origin at end since it causes a relink into the k/d tree
+	if ( diff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
+	{
+		flags |= LC_ORIGIN_CHANGED;
+		restore->m_vecOrigin = pPlayer->GetLocalOrigin();
+		// Move player, but don't fire triggers
+		UTIL_SetOrigin( pPlayer, org );
+		change->m_vecOrigin = org;
+	}
+
+	if ( !flags )
+	{
+		return;
+	}
 
-		restorebits |= (1<<index);
-		m_bNeedToRestore = true;
-		restore->m_bActive = true;
-		restore->m_fFlags = flags;
+	restorebits |= (1<<index);
+	m_bNeedToRestore = true;
+	restore->m_bActive = true;
+	restore->m_fFlags = flags;
 
-		change->m_bActive = true;
-		change->m_fFlags = flags;
+	change->m_bActive = true;
+	change->m_fFlags = flags;
 
-		/*
-		if ( cmd->lc_index == pPlayer->entindex() )
+	/*
+	if ( cmd->lc_index == pPlayer->entindex() )
+	{
+		Vector lc_error;
+		lc_error = pPlayer->GetLocalOrigin() - cmd->lc_origin;
+
+		if ( lc_error.LengthSqr() > LAG_COMPENSATION_ERROR_EPS_SQR )
 		{
-			Vector lc_error;
-			lc_error = pPlayer->GetLocalOrigin() - cmd->lc_origin;
+			static float last_message;
 
-			if ( lc_error.LengthSqr() > LAG_COMPENSATION_ERROR_EPS_SQR )
+			if ( realtime > last_message + 0.5f )
 			{
-				static float last_message;
-
-				if ( realtime > last_message + 0.5f )
-				{
-					last_message = realtime;
-					//
-					//ClientPrint( player, HUD_PRINTCONSOLE, 
-					//	UTIL_VarArgs( "LC error on command %i cl %f %f %f sv %f %f %f delta %f %f %f\n",
-					//		cmd->command_number,
-					//		cmd->lc_origin.x,
-					//		cmd->lc_origin.y,
-					//		cmd->lc_origin.z,
-					//		pPlayer->GetLocalOrigin().x,
-					//		pPlayer->GetLocalOrigin().y,
-					//		pPlayer->GetLocalOrigin().z,
-					//		lc_error.x,
-					//		lc_error.y,
-					//		lc_error.z ) );
-					//
-
-					// FIXME:  Could send down some bboxs overlays, too
-					NDebugOverlay::Box( cmd->lc_origin, pPlayer->WorldAlignMins(), pPlayer->WorldAlignMaxs(), 255, 0, 255, 0 ,5.0f);
-					NDebugOverlay::Box( pPlayer->GetAbsOrigin(), pPlayer->WorldAlignMins(), pPlayer->WorldAlignMaxs(), 255, 255, 0, 0 ,5.0f);
-				}
+				last_message = realtime;
+				//
+				//ClientPrint( player, HUD_PRINTCONSOLE, 
+				//	UTIL_VarArgs( "LC error on command %i cl %f %f %f sv %f %f %f delta %f %f %f\n",
+				//		cmd->command_number,
+				//		cmd->lc_origin.x,
+				//		cmd->lc_origin.y,
+				//		cmd->lc_origin.z,
+				//		pPlayer->GetLocalOrigin().x,
+				//		pPlayer->GetLocalOrigin().y,
+				//		pPlayer->GetLocalOrigin().z,
+				//		lc_error.x,
+				//		lc_error.y,
+				//		lc_error.z ) );
+				//
+
+				// FIXME:  Could send down some bboxs overlays, too
+				NDebugOverlay::Box( cmd->lc_origin, pPlayer->WorldAlignMins(), pPlayer->WorldAlignMaxs(), 255, 0, 255, 0 ,5.0f);
+				NDebugOverlay::Box( pPlayer->GetAbsOrigin(), pPlayer->WorldAlignMins(), pPlayer->WorldAlignMaxs(), 255, 255, 0, 0 ,5.0f);
 			}
 		}
-		*/
 	}
+	*/
 }
 
 void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
@@ -636,3 +900,215 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		}
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Times the part of StartLagCompensation that runs for every usercmd, on made
+// up history for more players than a server can hold.  The old way walks every
+// player's history and interpolates them one at a time; the new way uses the
+// track lengths and interpolates in batches, with and without the cone cull.
+// Nobody is actually moved, so the relinks the cull saves aren't counted.
+//-----------------------------------------------------------------------------
+
+#define LAG_BENCHMARK_PLAYERS	64
+#define LAG_BENCHMARK_CMDS		256
+
+struct LagBenchmarkCmd_t
+{
+	int				m_nShooter;
+	float			m_flTargetTime;
+	LagFireCone_t	m_Cone;
+};
+
+static float LagCompensation_BenchmarkOld( const CLagCompensationHistory &history, const LagBenchmarkCmd_t &cmd, int *pMoved )
+{
+	int newer, older;
+	if ( !history.FindSpanningRecords( cmd.m_flTargetTime, &newer, &older ) )
+		return 0.0f;
+
+	float frac = LagCompensation_GetFraction( history, cmd.m_flTargetTime, newer, older );
+	float sum = 0.0f;
+
+	int i;
+	for ( i = 0; i < LAG_BENCHMARK_PLAYERS; i++ )
+	{
+		if ( i == cmd.m_nShooter || !history.CanInterpolateSlow( i, older ) )
+			continue;
+
+		LagInterpolated_t interpolated;
+		history.InterpolateSlow( i, newer, older, frac, &interpolated );
+		sum += interpolated.m_flComponents[ LC_ORIGIN ];
+		(*pMoved)++;
+	}
+	return sum;
+}
+
+static float LagCompensation_BenchmarkNew( const CLagCompensationHistory &history, const LagBenchmarkCmd_t &cmd, bool cull, int *pMoved )
+{
+	int newer, older;
+	if ( !history.FindSpanningRecords( cmd.m_flTargetTime, &newer, &older ) )
+		return 0.0f;
+
+	int indices[ LAG_BENCHMARK_PLAYERS ];
+	int count = 0;
+
+	int i;
+	for ( i = 0; i < LAG_BENCHMARK_PLAYERS; i++ )
+	{
+		if ( i == cmd.m_nShooter || !history.CanInterpolate( i, older ) )
+			continue;
+
+		// The current box is the newest record's
+		Vector absmins, absmaxs;
+		history.GetAbsBox( i, 0, absmins, absmaxs );
+		if ( cull && !history.CrossesCone( i, newer, older, absmins, absmaxs, cmd.m_Cone ) )
+			continue;
+
+		indices[ count++ ] = i;
+	}
+
+	LagInterpolated_t interpolated[ LAG_BENCHMARK_PLAYERS ];
+	float frac = LagCompensation_GetFraction( history, cmd.m_flTargetTime, newer, older );
+	history.Interpolate( indices, count, newer, older, frac, interpolated );
+
+	float sum = 0.0f;
+	for ( i = 0; i < count; i++ )
+	{
+		sum += interpolated[ i ].m_flComponents[ LC_ORIGIN ];
+	}
+	*pMoved += count;
+	return sum;
+}
+
+CON_COMMAND( sv_unlag_benchmark, "Time lag compensation setup per usercmd for 64 players. Usage: sv_unlag_benchmark [iterations]" )
+{
+	int nIterations = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 100;
+	nIterations = max( nIterations, 1 );
+
+	// Everyone runs in circles around the map, a few die and respawn somewhere else
+	CLagCompensationHistory history( LAG_BENCHMARK_PLAYERS );
+
+	Vector centers[ LAG_BENCHMARK_PLAYERS ];
+	float radii[ LAG_BENCHMARK_PLAYERS ];
+	float speeds[ LAG_BENCHMARK_PLAYERS ];
+	int i;
+	for ( i = 0; i < LAG_BENCHMARK_PLAYERS; i++ )
+	{
+		centers[ i ].Init( random->RandomFloat( -2048, 2048 ), random->RandomFloat( -2048, 2048 ), 0 );
+		radii[ i ] = random->RandomFloat( 64, 512 );
+		speeds[ i ] = 250.0f / radii[ i ];
+	}
+
+	Vector mins( -16, -16, 0 );
+	Vector maxs( 16, 16, 72 );
+	int nRecords = (int)( LAG_COMPENSATION_DATA_TIME / TICK_RATE );
+	float now = 0.0f;
+	int j;
+	for ( j = 0; j < nRecords; j++ )
+	{
+		now = j * TICK_RATE;
+		history.BeginRecord( now );
+		for ( i = 0; i < LAG_BENCHMARK_PLAYERS; i++ )
+		{
+			if ( ( i % 16 ) == 0 && j == nRecords / 2 )
+			{
+				centers[ i ].x += 1024.0f;
+			}
+
+			float a = now * speeds[ i ];
+			Vector origin = centers[ i ] + Vector( cos( a ) * radii[ i ], sin( a ) * radii[ i ], 0 );
+			history.RecordPlayer( i, true, origin, QAngle( 0, RAD2DEG( a ) + 90.0f, 0 ), mins, maxs );
+		}
+	}
+
+	// Shooters looking every which way with up to 300 msec of lag
+	float degrees = sv_unlagcone.GetFloat();
+	if ( degrees <= 0.0f || degrees >= 180.0f )
+	{
+		degrees = 45.0f;
+	}
+
+	LagBenchmarkCmd_t cmds[ LAG_BENCHMARK_CMDS ];
+	for ( i = 0; i < LAG_BENCHMARK_CMDS; i++ )
+	{
+		LagBenchmarkCmd_t *cmd = &cmds[ i ];
+		cmd->m_nShooter = i % LAG_BENCHMARK_PLAYERS;
+		cmd->m_flTargetTime = now - random->RandomFloat( 0.0f, 0.3f );
+
+		float a = now * speeds[ cmd->m_nShooter ];
+		Vector eyes = centers[ cmd->m_nShooter ] + Vector( cos( a ) * radii[ cmd->m_nShooter ], sin( a ) * radii[ cmd->m_nShooter ], 64 );
+		QAngle viewangles( random->RandomFloat( -30, 30 ), random->RandomFloat( 0, 360 ), 0 );
+		LagCompensation_BuildFireCone( eyes, viewangles, degrees, LAG_COMPENSATION_CONE_SLOP, &cmd->m_Cone );
+	}
+
+	// Make sure the batches come out the same as one at a time
+	float maxerror = 0.0f;
+	for ( i = 0; i < LAG_BENCHMARK_CMDS; i++ )
+	{
+		int newer, older;
+		if ( !history.FindSpanningRecords( cmds[ i ].m_flTargetTime, &newer, &older ) )
+			continue;
+
+		float frac = LagCompensation_GetFraction( history, cmds[ i ].m_flTargetTime, newer, older );
+		int indices[ LAG_BENCHMARK_PLAYERS ];
+		LagInterpolated_t batch[ LAG_BENCHMARK_PLAYERS ];
+		for ( j = 0; j < LAG_BENCHMARK_PLAYERS; j++ )
+		{
+			indices[ j ] = j;
+		}
+		history.Interpolate( indices, LAG_BENCHMARK_PLAYERS, newer, older, frac, batch );
+
+		for ( j = 0; j < LAG_BENCHMARK_PLAYERS; j++ )
+		{
+			LagInterpolated_t single;
+			history.InterpolateSlow( j, newer, older, frac, &single );
+			for ( int c = 0; c < LC_NUM_COMPONENTS; c++ )
+			{
+				maxerror = max( maxerror, (float)fabs( single.m_flComponents[ c ] - batch[ j ].m_flComponents[ c ] ) );
+			}
+		}
+	}
+
+	Msg( "\nLag compensation, %d players, %d records, %d usercmds x %d iterations\n", 
+		LAG_BENCHMARK_PLAYERS, history.Count(), LAG_BENCHMARK_CMDS, nIterations );
+	Msg( "------------------------------------------------------------\n" );
+	Msg( "Method                           usercmds/sec   moved/cmd\n" );
+	Msg( "------------------------------------------------------------\n" );
+
+	float checksum = 0.0f;
+	for ( int method = 0; method < 3; method++ )
+	{
+		int nMoved = 0;
+
+		CFastTimer timer;
+		timer.Start();
+		for ( j = 0; j < nIterations; j++ )
+		{
+			for ( i = 0; i < LAG_BENCHMARK_CMDS; i++ )
+			{
+				if ( method == 0 )
+				{
+					checksum += LagCompensation_BenchmarkOld( history, cmds[ i ], &nMoved );
+				}
+				else
+				{
+					checksum += LagCompensation_BenchmarkNew( history, cmds[ i ], method == 2, &nMoved );
+				}
+			}
+		}
+		timer.End();
+
+		static const char *s_pMethodNames[] = 
+		{
+			"History walk, scalar lerp",
+			"Track lengths, SSE lerp",
+			"Track lengths, SSE lerp, cull",
+		};
+
+		double seconds = timer.GetDuration().GetSeconds();
+		int nCmds = nIterations * LAG_BENCHMARK_CMDS;
+		Msg( "%-30s %12.0f   %9.2f\n", s_pMethodNames[ method ], 
+			( seconds > 0 ) ? nCmds / seconds : 0.0, (float)nMoved / nCmds );
+	}
+
+	Msg( "Cull cone %.0f degrees, max SSE lerp difference %g (checksum %g)\n\n", degrees, maxerror, checksum );
+}
@@ -260,6 +260,9 @@ void CBaseProp::Spawn( void )
 	Precache();
 	SetModel( szModel );
 
+	// Props are most of the entities on a map, let the engine skip the ones out of the PVS
+	SetDefaultTransmitPVSBound();
+
 	// Load this prop's data from the propdata file
 	int iResult = ParsePropData();
 	if ( !OverridePropdata() )
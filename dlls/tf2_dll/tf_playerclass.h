@@ -189,6 +189,7 @@ public:
 
 	// For CNetworkVar support. Chain to the player entity.
 	void NetworkStateChanged();
+	void NetworkStateChanged( void *pVar, int nBytes ) { NetworkStateChanged(); }
 
 	TFClass					m_TFClass;
 
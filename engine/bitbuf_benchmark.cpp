@@ -0,0 +1,383 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: bitbuf_benchmark: replays the network messages in a demo through
+//			bf_read/bf_write and through the dword-at-a-time code they used
+//			before the qword fast paths, and checks that the bits come out the same.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "bitbuf.h"
+#include "demo.h"
+#include "net.h"
+#include "tier0/fasttimer.h"
+
+
+extern unsigned long g_BitWriteMasks[32][33];
+extern unsigned long g_ExtraMasks[32];
+
+
+// ------------------------------------------------------------------------------------ //
+// The old bf_read/bf_write paths. These leave out bounds checking because the benchmark
+// sizes all its buffers up front.
+// ------------------------------------------------------------------------------------ //
+
+class CRefBitReader
+{
+public:
+	CRefBitReader( const void *pData, int nBits )
+	{
+		m_pData = (const unsigned char*)pData;
+		m_nDataBits = nBits;
+		m_iCurBit = 0;
+	}
+
+	unsigned int ReadUBitLong( int numbits )
+	{
+		// Read the current dword.
+		int idword1 = m_iCurBit >> 5;
+		unsigned int dword1 = ((unsigned int*)m_pData)[idword1];
+		dword1 >>= (m_iCurBit & 31); // Get the bits we're interested in.
+
+		m_iCurBit += numbits;
+		unsigned int ret = dword1;
+
+		// Does it span this dword?
+		if ( (m_iCurBit-1) >> 5 == idword1 )
+		{
+			if(numbits != 32)
+				ret &= g_ExtraMasks[numbits];
+		}
+		else
+		{
+			int nExtraBits = m_iCurBit & 31;
+			unsigned int dword2 = ((unsigned int*)m_pData)[idword1+1] & g_ExtraMasks[nExtraBits];
+
+			// No need to mask since we hit the end of the dword.
+			// Shift the second dword's part into the high bits.
+			ret |= (dword2 << (numbits - nExtraBits));
+		}
+
+		return ret;
+	}
+
+	void ReadBits( void *pOutData, int nBits )
+	{
+		unsigned char *pOut = (unsigned char*)pOutData;
+		int nBitsLeft = nBits;
+
+		// Get output dword-aligned.
+		while(((unsigned long)pOut & 3) != 0 && nBitsLeft >= 8)
+		{
+			*pOut = (unsigned char)ReadUBitLong(8);
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		// Read dwords.
+		while(nBitsLeft >= 32)
+		{
+			*((unsigned long*)pOut) = ReadUBitLong(32);
+			pOut += sizeof(unsigned long);
+			nBitsLeft -= 32;
+		}
+
+		// Read the remaining bytes.
+		while(nBitsLeft >= 8)
+		{
+			*pOut = ReadUBitLong(8);
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		// Read the remaining bits.
+		if(nBitsLeft)
+		{
+			*pOut = ReadUBitLong(nBitsLeft);
+		}
+	}
+
+	const unsigned char	*m_pData;
+	int					m_nDataBits;
+	int					m_iCurBit;
+};
+
+
+class CRefBitWriter
+{
+public:
+	CRefBitWriter( void *pData, int nBytes )
+	{
+		m_pData = (unsigned char*)pData;
+		m_nDataBytes = nBytes;
+		m_iCurBit = 0;
+	}
+
+	void WriteUBitLong( unsigned int curData, int numbits )
+	{
+		int nBitsLeft = numbits;
+		int iCurBit = m_iCurBit;
+
+		// Mask in a dword.
+		unsigned int iDWord = iCurBit >> 5;
+		Assert( (iDWord*4 + sizeof(long)) <= (unsigned int)m_nDataBytes );
+
+		unsigned long iCurBitMasked = iCurBit & 31;
+		((unsigned long*)m_pData)[iDWord] &= g_BitWriteMasks[iCurBitMasked][nBitsLeft];
+		((unsigned long*)m_pData)[iDWord] |= curData << iCurBitMasked;
+
+		// Did it span a dword?
+		int nBitsWritten = 32 - iCurBitMasked;
+		if(nBitsWritten < nBitsLeft)
+		{
+			nBitsLeft -= nBitsWritten;
+			iCurBit += nBitsWritten;
+			curData >>= nBitsWritten;
+
+			unsigned long iCurBitMasked = iCurBit & 31;
+			((unsigned long*)m_pData)[iDWord+1] &= g_BitWriteMasks[iCurBitMasked][nBitsLeft];
+			((unsigned long*)m_pData)[iDWord+1] |= curData << iCurBitMasked;
+		}
+
+		m_iCurBit += numbits;
+	}
+
+	void WriteBits( const void *pInData, int nBits )
+	{
+		unsigned char *pOut = (unsigned char*)pInData;
+		int nBitsLeft = nBits;
+
+		// Get output dword-aligned.
+		while(((unsigned long)pOut & 3) != 0 && nBitsLeft >= 8)
+		{
+			WriteUBitLong( *pOut, 8 );
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		// Read dwords.
+		while(nBitsLeft >= 32)
+		{
+			WriteUBitLong( *((unsigned long*)pOut), 32 );
+			pOut += sizeof(unsigned long);
+			nBitsLeft -= 32;
+		}
+
+		// Read the remaining bytes.
+		while(nBitsLeft >= 8)
+		{
+			WriteUBitLong( *pOut, 8 );
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		// Read the remaining bits.
+		if(nBitsLeft)
+		{
+			WriteUBitLong( *pOut, nBitsLeft );
+		}
+	}
+
+	void WriteBitsFromBuffer( CRefBitReader *pIn, int nBits )
+	{
+		while ( nBits > 32 )
+		{
+			WriteUBitLong( pIn->ReadUBitLong( 32 ), 32 );
+			nBits -= 32;
+		}
+
+		WriteUBitLong( pIn->ReadUBitLong( nBits ), nBits );
+	}
+
+	unsigned char	*m_pData;
+	int				m_nDataBytes;
+	int				m_iCurBit;
+};
+
+
+// ------------------------------------------------------------------------------------ //
+// Replay.
+// ------------------------------------------------------------------------------------ //
+
+// The message bits get cut into fields of these sizes. They're the bit counts that
+// message headers and common props use, so reads and writes land at every alignment.
+static const int s_BenchFieldBits[] = { 1, 1, 3, 5, 6, 7, 8, 10, 11, 12, 13, 16, 17, 20, 32 };
+
+#define BENCH_SCRATCH_BYTES		128
+
+
+// Reads nBits out of in and writes them to out the way the network code would:
+// mostly small fields, with the occasional run copied through a scratch buffer
+// (strings, blobs) or straight from the other buffer (entity deltas).
+template< class Reader, class Writer >
+static void BitBufBench_Replay( Reader &in, Writer &out, int nBits, unsigned char *pScratch )
+{
+	for ( int iField=0; nBits > 0; iField++ )
+	{
+		int nFieldBits;
+		if ( (iField & 15) == 15 )
+		{
+			nFieldBits = min( nBits, 8 + ((iField * 37) & 511) );
+			in.ReadBits( pScratch, nFieldBits );
+			out.WriteBits( pScratch, nFieldBits );
+		}
+		else if ( (iField & 15) == 7 )
+		{
+			nFieldBits = min( nBits, 32 + ((iField * 53) & 1023) );
+			out.WriteBitsFromBuffer( &in, nFieldBits );
+		}
+		else
+		{
+			nFieldBits = min( nBits, s_BenchFieldBits[iField % ARRAYSIZE( s_BenchFieldBits )] );
+			out.WriteUBitLong( in.ReadUBitLong( nFieldBits ), nFieldBits );
+		}
+
+		nBits -= nFieldBits;
+	}
+}
+
+
+static bool BitBufBench_BitsMatch( const void *p1, const void *p2, int nBits )
+{
+	int nBytes = nBits >> 3;
+	if ( memcmp( p1, p2, nBytes ) != 0 )
+		return false;
+
+	int nExtraBits = nBits & 7;
+	if ( nExtraBits )
+	{
+		int mask = (1 << nExtraBits) - 1;
+		if ( (((const unsigned char*)p1)[nBytes] & mask) != (((const unsigned char*)p2)[nBytes] & mask) )
+			return false;
+	}
+
+	return true;
+}
+
+
+static void BitBuf_Benchmark_f( void )
+{
+	if ( Cmd_Argc() < 2 )
+	{
+		Con_Printf( "bitbuf_benchmark <demoname> [iterations]: replay a demo's network messages through the old and new bf_read/bf_write paths\n" );
+		return;
+	}
+
+	char name[ MAX_OSPATH ];
+	Q_strncpy( name, Cmd_Argv( 1 ), sizeof( name ) );
+	COM_DefaultExtension( name, ".dem", sizeof( name ) );
+
+	int nIterations = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 10;
+	nIterations = max( nIterations, 1 );
+
+	CUtlVector< unsigned int > data;
+	CUtlVector< int > messageBytes;
+	if ( !Demo_LoadNetworkMessages( name, data, messageBytes ) || messageBytes.Count() == 0 )
+	{
+		Con_Printf( "bitbuf_benchmark: no network messages loaded from %s.\n", name );
+		return;
+	}
+
+	// Room for the biggest message plus a qword so the fast paths aren't
+	// always falling back at the end.
+	const int nOutBytes = PAD_NUMBER( NET_MAX_MESSAGE, 4 ) + 8;
+	unsigned int *pRefOut = new unsigned int[ nOutBytes / 4 ];
+	unsigned int *pNewOut = new unsigned int[ nOutBytes / 4 ];
+	unsigned int scratch[ BENCH_SCRATCH_BYTES / 4 ];
+
+	// First make sure both paths put out the bits they were given.
+	int nMismatches = 0;
+	int iData = 0;
+	int nTotalBytes = 0;
+	int iMsg;
+	for ( iMsg=0; iMsg < messageBytes.Count(); iMsg++ )
+	{
+		const unsigned int *pMsg = &data[iData];
+		int nBytes = messageBytes[iMsg];
+		int nBits = nBytes << 3;
+
+		CRefBitReader refIn( pMsg, nBits );
+		CRefBitWriter refOut( pRefOut, nOutBytes );
+		BitBufBench_Replay( refIn, refOut, nBits, (unsigned char*)scratch );
+
+		bf_read newIn( "bitbuf_benchmark", pMsg, PAD_NUMBER( nBytes, 4 ), nBits );
+		bf_write newOut( "bitbuf_benchmark", pNewOut, nOutBytes );
+		BitBufBench_Replay( newIn, newOut, nBits, (unsigned char*)scratch );
+
+		if ( refOut.m_iCurBit != nBits || newOut.GetNumBitsWritten() != nBits ||
+			newIn.IsOverflowed() || newOut.IsOverflowed() ||
+			!BitBufBench_BitsMatch( pRefOut, pMsg, nBits ) ||
+			!BitBufBench_BitsMatch( pNewOut, pRefOut, nBits ) )
+		{
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "bitbuf_benchmark: message %d (%d bytes) doesn't match.\n", iMsg, nBytes );
+			}
+			++nMismatches;
+		}
+
+		iData += PAD_NUMBER( nBytes, 4 ) >> 2;
+		nTotalBytes += nBytes;
+	}
+
+	// Now time them.
+	CFastTimer refTimer;
+	refTimer.Start();
+	for ( int iRefIteration=0; iRefIteration < nIterations; iRefIteration++ )
+	{
+		iData = 0;
+		for ( iMsg=0; iMsg < messageBytes.Count(); iMsg++ )
+		{
+			int nBytes = messageBytes[iMsg];
+			CRefBitReader refIn( &data[iData], nBytes << 3 );
+			CRefBitWriter refOut( pRefOut, nOutBytes );
+			BitBufBench_Replay( refIn, refOut, nBytes << 3, (unsigned char*)scratch );
+			iData += PAD_NUMBER( nBytes, 4 ) >> 2;
+		}
+	}
+	refTimer.End();
+
+	CFastTimer newTimer;
+	newTimer.Start();
+	for ( int iNewIteration=0; iNewIteration < nIterations; iNewIteration++ )
+	{
+		iData = 0;
+		for ( iMsg=0; iMsg < messageBytes.Count(); iMsg++ )
+		{
+			int nBytes = messageBytes[iMsg];
+			bf_read newIn( "bitbuf_benchmark", &data[iData], PAD_NUMBER( nBytes, 4 ), nBytes << 3 );
+			bf_write newOut( "bitbuf_benchmark", pNewOut, nOutBytes );
+			BitBufBench_Replay( newIn, newOut, nBytes << 3, (unsigned char*)scratch );
+			iData += PAD_NUMBER( nBytes, 4 ) >> 2;
+		}
+	}
+	newTimer.End();
+
+	double flRefMS = refTimer.GetDuration().GetMillisecondsF();
+	double flNewMS = newTimer.GetDuration().GetMillisecondsF();
+	double flMB = (double)nTotalBytes * nIterations / (1024.0 * 1024.0);
+
+	Con_Printf( "\nbitbuf_benchmark: %s, %d messages, %d bytes, %d iterations\n",
+		name, messageBytes.Count(), nTotalBytes, nIterations );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Path        Total ms        MB/s\n" );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "dword     %10.3f  %10.2f\n", flRefMS, ( flRefMS > 0 ) ? flMB * 1000.0 / flRefMS : 0.0 );
+	Con_Printf( "qword     %10.3f  %10.2f\n", flNewMS, ( flNewMS > 0 ) ? flMB * 1000.0 / flNewMS : 0.0 );
+	Con_Printf( "Speedup: %.2fx\n", ( flNewMS > 0 ) ? flRefMS / flNewMS : 0.0 );
+
+	if ( nMismatches )
+	{
+		Con_Printf( "%d of %d messages did NOT come out bit-identical.\n\n", nMismatches, messageBytes.Count() );
+	}
+	else
+	{
+		Con_Printf( "All messages came out bit-identical.\n\n" );
+	}
+
+	delete [] pRefOut;
+	delete [] pNewOut;
+}
+
+static ConCommand bitbuf_benchmark( "bitbuf_benchmark", BitBuf_Benchmark_f, "Time bf_read/bf_write against the old dword code by replaying a demo's network messages, and check they write the same bits. Usage: bitbuf_benchmark <demoname> [iterations]" );
@@ -0,0 +1,378 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: brushclip_record/brushclip_benchmark: records the brush tests real
+//			traces make, then replays them through both the scalar and SSE
+//			versions of CM_ClipBoxToBrush/CM_TestBoxInBrush, checks that they
+//			come up with exactly the same traces and times them.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "cmodel_engine.h"
+#include "cmodel_private.h"
+#include "gametrace.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+
+
+#define BRUSHCLIP_FILE_ID		"BRUSHCLP"
+#define BRUSHCLIP_FILE_VERSION	1
+
+// Most records brushclip_benchmark will load
+#define BRUSHCLIP_MAX_RECORDS	( 4 * 1024 * 1024 )
+
+typedef struct
+{
+	char		id[8];
+	int			version;
+	char		mapname[MAX_QPATH];
+	int			numbrushes;
+	int			numbrushsides;
+} brushclipheader_t;
+
+typedef struct
+{
+	int			type;				// BRUSHCLIP_CLIP or BRUSHCLIP_TEST
+	int			brush;				// numbrushes for any of the box hulls
+	int			ispoint;
+	Vector		mins, maxs;
+	Vector		p1, p2;
+	Vector		boxmins, boxmaxs;	// The box, if it's a box hull
+
+	// The trace going in
+	float		fraction;
+	float		fractionleftsolid;
+	int			startsolid;
+	int			allsolid;
+	int			contents;
+} brushcliprecord_t;
+
+extern cplane_t *box_planes;
+
+bool g_bBrushClipRecording = false;
+static FileHandle_t s_hBrushClipFile = FILESYSTEM_INVALID_HANDLE;
+static int s_nBrushClipRecords = 0;
+static CThreadMutex s_BrushClipMutex;		// Traces can be on any thread
+
+
+//-----------------------------------------------------------------------------
+// Called by CM_ClipBoxToBrush and CM_TestBoxInBrush while recording
+//-----------------------------------------------------------------------------
+void BrushClip_Record( int type, TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, 
+					  const Vector& p1, const Vector& p2, const trace_t *trace, const cbrush_t *brush )
+{
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+
+	brushcliprecord_t record;
+	memset( &record, 0, sizeof( record ) );
+
+	record.type = type;
+	record.brush = brush - pBSPData->map_brushes.Base();
+	record.ispoint = pTraceInfo->m_ispoint ? 1 : 0;
+	record.mins = mins;
+	record.maxs = maxs;
+	record.p1 = p1;
+	record.p2 = p2;
+	if ( record.brush >= pBSPData->numbrushes )
+	{
+		// One of the box hulls, the sides go +x -x +y -y +z -z (see CM_InitBoxHull)
+		const cbrushside_t *sides = &pBSPData->map_brushsides[brush->firstbrushside];
+		record.brush = pBSPData->numbrushes;
+		record.boxmaxs.Init( sides[0].plane->dist, sides[2].plane->dist, sides[4].plane->dist );
+		record.boxmins.Init( -sides[1].plane->dist, -sides[3].plane->dist, -sides[5].plane->dist );
+	}
+
+	record.fraction = trace->fraction;
+	record.fractionleftsolid = trace->fractionleftsolid;
+	record.startsolid = trace->startsolid ? 1 : 0;
+	record.allsolid = trace->allsolid ? 1 : 0;
+	record.contents = trace->contents;
+
+	CThreadAutoLock lock( s_BrushClipMutex );
+	if ( s_hBrushClipFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	g_pFileSystem->Write( &record, sizeof( record ), s_hBrushClipFile );
+	++s_nBrushClipRecords;
+}
+
+
+//-----------------------------------------------------------------------------
+// Stops recording, CM_FreeMap calls this since the brushes are about to go away
+//-----------------------------------------------------------------------------
+void BrushClip_StopRecording( void )
+{
+	if ( s_hBrushClipFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	g_bBrushClipRecording = false;
+
+	CThreadAutoLock lock( s_BrushClipMutex );
+	g_pFileSystem->Close( s_hBrushClipFile );
+	s_hBrushClipFile = FILESYSTEM_INVALID_HANDLE;
+
+	Con_Printf( "brushclip_record: stopped, recorded %d brush tests.\n", s_nBrushClipRecords );
+}
+
+
+static void BrushClip_Record_f( void )
+{
+	if ( Cmd_Argc() < 2 )
+	{
+		if ( s_hBrushClipFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			Con_Printf( "Usage: brushclip_record <filename>, brushclip_record with no filename stops recording.\n" );
+		}
+		BrushClip_StopRecording();
+		return;
+	}
+
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	if ( !pBSPData->numnodes )
+	{
+		Con_Printf( "brushclip_record: no map loaded.\n" );
+		return;
+	}
+
+	BrushClip_StopRecording();
+
+	s_hBrushClipFile = g_pFileSystem->Open( Cmd_Argv( 1 ), "wb" );
+	if ( s_hBrushClipFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Con_Printf( "brushclip_record: couldn't open %s.\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	brushclipheader_t header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.id, BRUSHCLIP_FILE_ID, sizeof( header.id ) );
+	header.version = BRUSHCLIP_FILE_VERSION;
+	Q_strncpy( header.mapname, pBSPData->map_name, sizeof( header.mapname ) );
+	header.numbrushes = pBSPData->numbrushes;
+	header.numbrushsides = pBSPData->numbrushsides;
+	g_pFileSystem->Write( &header, sizeof( header ), s_hBrushClipFile );
+
+	s_nBrushClipRecords = 0;
+	g_bBrushClipRecording = true;
+	Con_Printf( "brushclip_record: recording brush tests on %s to %s.\n", pBSPData->map_name, Cmd_Argv( 1 ) );
+}
+
+static ConCommand brushclip_record( "brushclip_record", BrushClip_Record_f, "Record every brush test traces make into a file for brushclip_benchmark. Usage: brushclip_record <filename>, or brushclip_record to stop" );
+
+
+//-----------------------------------------------------------------------------
+// Sets up the trace and the box hull the way they were when the record was made
+//-----------------------------------------------------------------------------
+static cbrush_t *BrushClip_Setup( TraceInfo_t *pTraceInfo, const brushcliprecord_t &record, trace_t *trace )
+{
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+	if ( record.brush == pBSPData->numbrushes )
+	{
+		// Replayed on the first box hull, whichever one it was recorded on
+		CM_HeadnodeForBoxHull( record.boxmins, record.boxmaxs );
+	}
+
+	CM_ClearTrace( trace );
+	trace->fraction = record.fraction;
+	trace->fractionleftsolid = record.fractionleftsolid;
+	trace->startsolid = record.startsolid != 0;
+	trace->allsolid = record.allsolid != 0;
+	trace->contents = record.contents;
+
+	pTraceInfo->m_ispoint = record.ispoint;
+	return &pBSPData->map_brushes[record.brush];
+}
+
+
+//-----------------------------------------------------------------------------
+// Every field the brush tests can write has to be exactly the same
+//-----------------------------------------------------------------------------
+static bool BrushClip_TracesMatch( const trace_t &a, const trace_t &b )
+{
+	return ( *(const unsigned int *)&a.fraction == *(const unsigned int *)&b.fraction ) &&
+		( *(const unsigned int *)&a.fractionleftsolid == *(const unsigned int *)&b.fractionleftsolid ) &&
+		a.startsolid == b.startsolid && a.allsolid == b.allsolid && a.contents == b.contents &&
+		a.plane.normal == b.plane.normal && a.plane.dist == b.plane.dist && 
+		a.surface.name == b.surface.name && a.surface.flags == b.surface.flags;
+}
+
+
+static void BrushClip_Run( TraceInfo_t *pTraceInfo, const brushcliprecord_t &record, trace_t *trace, bool bSSE )
+{
+	cbrush_t *brush = BrushClip_Setup( pTraceInfo, record, trace );
+	if ( record.type == BRUSHCLIP_CLIP )
+	{
+		if ( bSSE )
+			CM_ClipBoxToBrushSSE( pTraceInfo, record.mins, record.maxs, record.p1, record.p2, trace, brush );
+		else
+			CM_ClipBoxToBrushScalar( pTraceInfo, record.mins, record.maxs, record.p1, record.p2, trace, brush );
+	}
+	else
+	{
+		if ( bSSE )
+			CM_TestBoxInBrushSSE( pTraceInfo, record.mins, record.maxs, record.p1, trace, brush );
+		else
+			CM_TestBoxInBrushScalar( pTraceInfo, record.mins, record.maxs, record.p1, trace, brush );
+	}
+}
+
+
+static void BrushClip_Benchmark_f( void )
+{
+	if ( Cmd_Argc() < 2 )
+	{
+		Con_Printf( "Usage: brushclip_benchmark <filename> [iterations]\n" );
+		return;
+	}
+
+	if ( g_bBrushClipRecording )
+	{
+		Con_Printf( "brushclip_benchmark: stop brushclip_record first.\n" );
+		return;
+	}
+
+	int nIterations = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 10;
+	nIterations = max( nIterations, 1 );
+
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+
+	FileHandle_t hFile = g_pFileSystem->Open( Cmd_Argv( 1 ), "rb" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Con_Printf( "brushclip_benchmark: couldn't open %s.\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	brushclipheader_t header;
+	if ( g_pFileSystem->Read( &header, sizeof( header ), hFile ) != sizeof( header ) ||
+		memcmp( header.id, BRUSHCLIP_FILE_ID, sizeof( header.id ) ) || header.version != BRUSHCLIP_FILE_VERSION )
+	{
+		Con_Printf( "brushclip_benchmark: %s isn't a brushclip_record file.\n", Cmd_Argv( 1 ) );
+		g_pFileSystem->Close( hFile );
+		return;
+	}
+
+	header.mapname[ sizeof( header.mapname ) - 1 ] = 0;
+	if ( Q_stricmp( header.mapname, pBSPData->map_name ) || header.numbrushes != pBSPData->numbrushes ||
+		header.numbrushsides != pBSPData->numbrushsides )
+	{
+		Con_Printf( "brushclip_benchmark: %s was recorded on %s, load that map first.\n", Cmd_Argv( 1 ), header.mapname );
+		g_pFileSystem->Close( hFile );
+		return;
+	}
+
+	int nRecords = ( g_pFileSystem->Size( hFile ) - sizeof( header ) ) / sizeof( brushcliprecord_t );
+	nRecords = min( nRecords, BRUSHCLIP_MAX_RECORDS );
+	if ( nRecords <= 0 )
+	{
+		Con_Printf( "brushclip_benchmark: %s is empty.\n", Cmd_Argv( 1 ) );
+		g_pFileSystem->Close( hFile );
+		return;
+	}
+
+	brushcliprecord_t *pRecords = new brushcliprecord_t[nRecords];
+	g_pFileSystem->Read( pRecords, nRecords * sizeof( brushcliprecord_t ), hFile );
+	g_pFileSystem->Close( hFile );
+
+	int iRecord;
+	for ( iRecord=0; iRecord < nRecords; iRecord++ )
+	{
+		if ( pRecords[iRecord].brush < 0 || pRecords[iRecord].brush > pBSPData->numbrushes )
+		{
+			Con_Printf( "brushclip_benchmark: %s has a bad brush in it.\n", Cmd_Argv( 1 ) );
+			delete [] pRecords;
+			return;
+		}
+	}
+
+	// Leave the box hull the way the replay found it
+	Vector boxMins( box_planes[2].dist, box_planes[6].dist, box_planes[10].dist );
+	Vector boxMaxs( box_planes[0].dist, box_planes[4].dist, box_planes[8].dist );
+
+	TraceInfo_t *pTraceInfo = CM_BeginTrace();
+
+	// First make sure both ways come up with the same traces.
+	int nMismatches = 0;
+	int nClips = 0;
+	for ( iRecord=0; iRecord < nRecords; iRecord++ )
+	{
+		const brushcliprecord_t &record = pRecords[iRecord];
+		trace_t scalarTrace, sseTrace;
+		BrushClip_Run( pTraceInfo, record, &scalarTrace, false );
+		BrushClip_Run( pTraceInfo, record, &sseTrace, true );
+
+		if ( !BrushClip_TracesMatch( scalarTrace, sseTrace ) )
+		{
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "brushclip_benchmark: record %d (%s brush %d): scalar fraction %.9g leftsolid %.9g, SSE fraction %.9g leftsolid %.9g\n",
+					iRecord, ( record.type == BRUSHCLIP_CLIP ) ? "clip" : "test", record.brush,
+					scalarTrace.fraction, scalarTrace.fractionleftsolid, sseTrace.fraction, sseTrace.fractionleftsolid );
+			}
+			++nMismatches;
+		}
+
+		if ( record.type == BRUSHCLIP_CLIP )
+		{
+			++nClips;
+		}
+	}
+
+	// Now time them.
+	trace_t trace;
+	CFastTimer scalarTimer;
+	scalarTimer.Start();
+	for ( int iScalarIteration=0; iScalarIteration < nIterations; iScalarIteration++ )
+	{
+		for ( iRecord=0; iRecord < nRecords; iRecord++ )
+		{
+			BrushClip_Run( pTraceInfo, pRecords[iRecord], &trace, false );
+		}
+	}
+	scalarTimer.End();
+
+	CFastTimer sseTimer;
+	sseTimer.Start();
+	for ( int iSSEIteration=0; iSSEIteration < nIterations; iSSEIteration++ )
+	{
+		for ( iRecord=0; iRecord < nRecords; iRecord++ )
+		{
+			BrushClip_Run( pTraceInfo, pRecords[iRecord], &trace, true );
+		}
+	}
+	sseTimer.End();
+
+	CM_EndTrace( pTraceInfo );
+	CM_HeadnodeForBoxHull( boxMins, boxMaxs );
+
+	double flScalarMS = scalarTimer.GetDuration().GetMillisecondsF();
+	double flSSEMS = sseTimer.GetDuration().GetMillisecondsF();
+	double flTests = (double)nRecords * nIterations;
+
+	Con_Printf( "\nbrushclip_benchmark: %s, %d brush tests (%d clips, %d position tests), %d iterations\n",
+		header.mapname, nRecords, nClips, nRecords - nClips, nIterations );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Path          Total ms     Tests/sec\n" );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Scalar      %10.3f  %12.0f\n", flScalarMS, ( flScalarMS > 0 ) ? flTests * 1000.0 / flScalarMS : 0.0 );
+	Con_Printf( "SSE         %10.3f  %12.0f\n", flSSEMS, ( flSSEMS > 0 ) ? flTests * 1000.0 / flSSEMS : 0.0 );
+	Con_Printf( "Speedup: %.2fx\n", ( flSSEMS > 0 ) ? flScalarMS / flSSEMS : 0.0 );
+
+	if ( nMismatches )
+	{
+		// The scalar version keeps extra precision in x87 registers on builds that don't do float math with SSE
+		Con_Printf( "%d of %d traces did NOT match.\n", nMismatches, nRecords );
+	}
+	else
+	{
+		Con_Printf( "All traces matched.\n" );
+	}
+	Con_Printf( "\n" );
+
+	delete [] pRecords;
+}
+
+static ConCommand brushclip_benchmark( "brushclip_benchmark", BrushClip_Benchmark_f, "Replay brush tests recorded with brushclip_record through the scalar and SSE versions of CM_ClipBoxToBrush/CM_TestBoxInBrush, check they give exactly the same traces and time them. Usage: brushclip_benchmark <filename> [iterations]" );
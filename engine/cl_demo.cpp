@@ -197,6 +197,8 @@ public:
 	int				GetNumFrames( const char *name );
 	void			List( const char *name );
 
+	bool			LoadNetworkMessages( const char *name, CUtlVector< unsigned int >& data, CUtlVector< int >& messageBytes );
+
 	void			Play_TimeDemo( const char *name );
 
 private:
@@ -374,6 +376,10 @@ bool Demo_IsPlayingBack_TimeDemo()
 {
 	return demo->IsPlayingBack_TimeDemo();
 }
+bool Demo_LoadNetworkMessages( const char *name, CUtlVector< unsigned int >& data, CUtlVector< int >& messageBytes )
+{
+	return g_Demo.LoadNetworkMessages( name, data, messageBytes );
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -585,6 +591,136 @@ int CDemo::GetNumFrames( const char *name )
 	return numFrames;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Reads all the network messages out of a demo file without playing it.
+//  Each message starts on a dword boundary in data, and messageBytes gets the
+//  length of each one.
+// Input  : *name - 
+//			data - 
+//			messageBytes - 
+// Output : Returns true on success, false on failure.
+//-----------------------------------------------------------------------------
+bool CDemo::LoadNetworkMessages( const char *name, CUtlVector< unsigned int >& data, CUtlVector< int >& messageBytes )
+{
+	FileHandle_t demofile;
+	COM_OpenFile( name, &demofile );
+	if ( !demofile )
+	{
+		Con_Printf( "ERROR: couldn't open %s.\n", name );
+		return false;
+	}
+
+	demoheader_t header;
+	g_pFileSystem->Read( &header, sizeof(header), demofile );
+	if ( strcmp( header.demofilestamp, "HLDEMO" ) || header.demoprotocol != DEMO_PROTOCOL )
+	{
+		Con_Printf( "%s is not a demo file or its demo protocol is outdated\n", name );
+		g_pFileSystem->Close( demofile );
+		return false;
+	}
+
+	demodirectory_t directory;
+
+	// Now read in the directory structure.
+	g_pFileSystem->Seek( demofile, header.directory_offset, FILESYSTEM_SEEK_HEAD );
+	g_pFileSystem->Read( &directory.numentries, sizeof(int), demofile );
+
+	if ( directory.numentries < 1 ||
+		 directory.numentries > 1024 )
+	{
+		Con_Printf( "CDemo::LoadNetworkMessages: demo had bogus # of directory entries:  %i\n",
+			directory.numentries );
+		g_pFileSystem->Close( demofile );
+		return false;
+	}
+
+	demoentry_t entry;
+	int i;
+	for ( i = 0; i < directory.numentries; i++ )
+	{
+		memset( &entry, 0, sizeof( entry ) );
+		g_pFileSystem->Read( &entry, sizeof( entry ), demofile );
+		directory.entries.AddToTail( entry );
+	}
+
+	for ( i = 0; i < directory.numentries; i++ )
+	{
+		g_pFileSystem->Seek( demofile, directory.entries[i].offset, FILESYSTEM_SEEK_HEAD );
+
+		bool entryfinished = false;
+		while ( !entryfinished && !g_pFileSystem->EndOfFile( demofile ) )
+		{
+			float		f = 0.0f;
+			int			dframe = 0;
+			byte		cmd;
+
+			ReadCmdHeader( demofile, cmd, f, dframe );
+
+			switch ( cmd )
+			{
+			case dem_jumptime:
+				break;
+			case dem_stop:
+				{
+					entryfinished = true;
+				}
+				break;
+			case dem_clientdll:
+				{
+					int length;
+					g_pFileSystem->Read( &length, sizeof( int ), demofile );
+					Assert( length >= 1 && length <= 2048 );
+					char szCmdName[ 2048 ];
+					g_pFileSystem->Read ( szCmdName, length, demofile );
+				}
+				break;
+			case dem_stringtables:
+				{
+					int length;
+					g_pFileSystem->Read( &length, sizeof( int ), demofile );
+					int curpos = g_pFileSystem->Tell( demofile );
+					// Skip ahead
+					g_pFileSystem->Seek( demofile, curpos + length, FILESYSTEM_SEEK_HEAD );
+				}
+				break;
+			case dem_usercmd:
+				{
+					ReadUserCmd( demofile, true );
+				}
+				break;
+			default:
+				{
+					democmdinfo_t info;
+					ReadCmdInfo( demofile, info );
+					ReadSequenceInfo( demofile, true );
+
+					int msglen = 0;
+					g_pFileSystem->Read( &msglen, sizeof(int), demofile );
+					msglen = LittleLong( msglen );
+					if ( msglen < 0 || msglen > NET_MAX_MESSAGE )
+					{
+						Con_Printf( "CDemo::LoadNetworkMessages: bad message length %i in %s\n", msglen, name );
+						g_pFileSystem->Close( demofile );
+						return false;
+					}
+
+					if ( msglen > 0 )
+					{
+						int iStart = data.AddMultipleToTail( PAD_NUMBER( msglen, 4 ) >> 2 );
+						data[data.Count()-1] = 0;
+						g_pFileSystem->Read( &data[iStart], msglen, demofile );
+						messageBytes.AddToTail( msglen );
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	g_pFileSystem->Close( demofile );
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: List the contents of a demo file.
 // Input  : *name - 
@@ -64,12 +64,63 @@ typedef struct
 // List of entities we are keeping data bout
 static ENTITYBITS s_EntityBits[ MAX_HISTORY_ENTITIES ];
 
+//-----------------------------------------------------------------------------
+// Purpose: Timing of the last entity packet
+//-----------------------------------------------------------------------------
+typedef struct
+{
+	// Entities decoded
+	int				entities;
+	// Splitting and decoding the props
+	float			decodems;
+	// Rolling average and peak of decodems
+	float			average;
+	float			peak;
+	float			peaktime;
+	// PostDataUpdate calls
+	float			postdataupdatems;
+	// Decoded on the worker pool
+	bool			parallel;
+} PACKETDECODE;
+
+static PACKETDECODE s_PacketDecode;
+
 //-----------------------------------------------------------------------------
 // Purpose: Zero out structure ( level transition/startup )
 //-----------------------------------------------------------------------------
 void CL_ResetEntityBits( void )
 {
 	memset( s_EntityBits, 0, sizeof( s_EntityBits ) );
+	memset( &s_PacketDecode, 0, sizeof( s_PacketDecode ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Record how long the last entity packet took to decode
+// Input  : entitycount - 
+//			decodems - 
+//			postdataupdatems - 
+//			parallel - 
+//-----------------------------------------------------------------------------
+void CL_RecordPacketDecode( int entitycount, float decodems, float postdataupdatems, bool parallel )
+{
+	PACKETDECODE *p = &s_PacketDecode;
+
+	p->entities = entitycount;
+	p->decodems = decodems;
+	p->postdataupdatems = postdataupdatems;
+	p->parallel = parallel;
+	p->average = ( BITCOUNT_AVERAGE ) * p->average + ( 1.f - BITCOUNT_AVERAGE ) * decodems;
+
+	if ( realtime >= p->peaktime )
+	{
+		p->peak = 0.0f;
+		p->peaktime = realtime + PEAK_LATCH_TIME;
+	}
+
+	if ( decodems > p->peak )
+	{
+		p->peak = decodems;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -337,6 +388,12 @@ void CEntityReportPanel::Paint()
 	int colwidth = 160;
 	int rowheight = vgui::surface()->GetFontTall( m_hFont );
 
+	DrawColoredText( m_hFont, left, top, 255, 255, 255, 255, 
+		"decode %i ents: %.2f ms (avg %.2f, peak %.2f)%s, PostDataUpdate %.2f ms",
+		s_PacketDecode.entities, s_PacketDecode.decodems, s_PacketDecode.average, s_PacketDecode.peak,
+		s_PacketDecode.parallel ? " threaded" : "", s_PacketDecode.postdataupdatems );
+	top += rowheight;
+
 	IClientNetworkable *pNet;
 	ClientClass			*pClientClass;
 	bool				inpvs;
@@ -18,4 +18,7 @@ void CL_RecordAddEntity( int entnum );
 void CL_RecordLeavePVS( int entnum );
 void CL_RecordDeleteEntity( int entnum, ClientClass *pclass );
 
+// Time taken by the last entity packet
+void CL_RecordPacketDecode( int entitycount, float decodems, float postdataupdatems, bool parallel );
+
 #endif // CL_ENTITYREPORT_H
\ No newline at end of file
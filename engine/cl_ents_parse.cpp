@@ -15,6 +15,7 @@
 #include "iprediction.h"
 #include "cl_entityreport.h"
 #include "host.h"
+#include "server.h"
 #include "demo.h"
 #include "UtlVector.h"
 #include "FileSystem_Engine.h"
@@ -27,6 +28,8 @@
 #include "dt_localtransfer.h"
 #include "iprediction.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
 #include "vstdlib/icommandline.h"
 
 
@@ -39,6 +42,41 @@ public:
 };
 
 
+// With cl_decodethreads set, CL_ReadPacketEntities only reads the headers, creates the
+// entities and calls PreDataUpdate. The length in front of each entity's props lets it skip
+// straight to the next header. The props are decoded afterwards, on the worker pool
+// if their tables allow it, and anything that calls into the client DLL goes back to the 
+// main thread in packet order.
+class CEntityDecodeJob
+{
+public:
+	int				m_iEnt;
+	RecvTable		*m_pRecvTable;
+	void			*m_pStruct;
+
+	// New entities are decoded from their baseline first.
+	const void		*m_pFromData;
+	int				m_nFromBits;
+	PackedEntity	*m_pLockedBaseline;
+
+	// Where the props are in the packet.
+	const void		*m_pPacketData;
+	int				m_iStartBit;
+	int				m_nBits;
+
+	// RecvTable_DecodeParallel can be used on this table.
+	bool			m_bParallel;
+
+	// Results.
+	bool			m_bOk;
+	int				m_nPropsDecoded;
+	CUtlVector<CDeferredRecvProp>	m_FromDeferred;
+	CUtlVector<CDeferredRecvProp>	m_Deferred;
+};
+
+static CEntityDecodeJob g_EntityDecodeJobs[MAX_EDICTS];
+
+
 // Passed around the read functions.
 class CEntityReadInfo
 {
@@ -73,6 +111,9 @@ public:
 
 	CPostDataUpdateCall	m_PostDataUpdateCalls[MAX_EDICTS];
 	int					m_nPostDataUpdateCalls;
+
+	bool				m_bParallelDecode;	// Decode props after the whole packet is read.
+	int					m_nDecodeJobs;		// in g_EntityDecodeJobs
 };
 
 
@@ -82,6 +123,9 @@ ConVar cl_packettrace( "cl_packettrace", "1", 0, "For debugging, massive spew to
 
 ConVar cl_showdecodecount( "cl_showdecodecount", "0", 0, "For debugging, show # props decoded" );
 
+static void CL_DecodeThreadsChanged_f( ConVar *var, char const *pOldString );
+ConVar cl_decodethreads( "cl_decodethreads", "0", 0, "Number of worker threads used to decode entity packets (0 = decode them on the main thread). Shares the worker pool with sv_workerthreads.", CL_DecodeThreadsChanged_f );
+
 
 // Prints important entity creation/deletion events to console
 #if defined( _DEBUG )
@@ -376,34 +420,202 @@ RecvTable* GetEntRecvTable( int entnum )
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Can go from either a baseline or a previous packet_entity
-//  The delta (difference) between the from and to state is used to alter the from fields
-//  into the to fields.
-// Input  : *from - 
-//			*to - 
-//			entNum - 
-//			bNew - 
-// Output : Returns true on success, false on failure.
+// Entity decode jobs.
 //-----------------------------------------------------------------------------
-void CL_ParseDelta( 
-	bf_read *pInput,
+
+static void CL_DecodeThreadsChanged_f( ConVar *var, char const *pOldString )
+{
+	// On a listen server the pool is shared with sv_workerthreads, the bigger one wins.
+	SV_SetClientWorkerThreads( var->GetInt() );
+}
+
+
+static inline int CL_ReadEntityPropsLength()
+{
+	if ( MSG_ReadOneBit() )
+		return MSG_ReadBitLong( ENTITY_PROPS_LONG_BITS );
+	else
+		return MSG_ReadBitLong( ENTITY_PROPS_SHORT_BITS );
+}
+
+
+static inline void CL_SetupJobFromBuf( CEntityDecodeJob *pJob, bf_read *pBuf )
+{
+	pBuf->StartReading( pJob->m_pFromData, PAD_NUMBER( pJob->m_nFromBits, 8 ) / 8, 0, pJob->m_nFromBits );
+}
+
+
+// Only lets the decode read up to the end of the entity's props.
+static inline void CL_SetupJobPropsBuf( CEntityDecodeJob *pJob, bf_read *pBuf )
+{
+	int iEndBit = pJob->m_iStartBit + pJob->m_nBits;
+	pBuf->StartReading( pJob->m_pPacketData, PAD_NUMBER( iEndBit, 8 ) / 8, pJob->m_iStartBit, iEndBit );
+}
+
+
+// Decodes the baseline and props on the main thread, calling proxies as it goes.
+static void CL_DecodeEntity( CEntityDecodeJob *pJob )
+{
+	if ( pJob->m_pFromData )
+	{
+		bf_read fromBuf( "CL_DecodeEntity->fromBuf", NULL, 0 );
+		CL_SetupJobFromBuf( pJob, &fromBuf );
+		RecvTable_Decode( pJob->m_pRecvTable, pJob->m_pStruct, &fromBuf, pJob->m_iEnt );
+	}
+
+	bf_read propsBuf( "CL_DecodeEntity->propsBuf", NULL, 0 );
+	CL_SetupJobPropsBuf( pJob, &propsBuf );
+	RecvTable_Decode( pJob->m_pRecvTable, pJob->m_pStruct, &propsBuf, pJob->m_iEnt );
+
+	pJob->m_bOk = !propsBuf.IsOverflowed() && propsBuf.GetNumBitsLeft() == 0;
+}
+
+
+// Runs on the worker pool.
+static void CL_DecodeEntityJob( void *pContext, int iJob )
+{
+	CEntityDecodeJob *pJob = &((CEntityDecodeJob*)pContext)[iJob];
+	if ( !pJob->m_bParallel )
+		return;
+
+	// Shows up on the worker's row of vprof_trace
+	VPROF( "CL_DecodeEntityJob" );
+
+	pJob->m_nPropsDecoded = 0;
+	pJob->m_FromDeferred.RemoveAll();
+	pJob->m_Deferred.RemoveAll();
+
+	if ( pJob->m_pFromData )
+	{
+		bf_read fromBuf( "CL_DecodeEntityJob->fromBuf", NULL, 0 );
+		CL_SetupJobFromBuf( pJob, &fromBuf );
+		RecvTable_DecodeParallel( pJob->m_pRecvTable, pJob->m_pStruct, &fromBuf, pJob->m_iEnt, pJob->m_FromDeferred, &pJob->m_nPropsDecoded );
+	}
+
+	bf_read propsBuf( "CL_DecodeEntityJob->propsBuf", NULL, 0 );
+	CL_SetupJobPropsBuf( pJob, &propsBuf );
+	RecvTable_DecodeParallel( pJob->m_pRecvTable, pJob->m_pStruct, &propsBuf, pJob->m_iEnt, pJob->m_Deferred, &pJob->m_nPropsDecoded );
+
+	pJob->m_bOk = !propsBuf.IsOverflowed() && propsBuf.GetNumBitsLeft() == 0;
+}
+
+
+// Main thread work after CL_DecodeEntityJob: the proxies it skipped and the baseline unlock.
+static void CL_FinishDecodeJob( CEntityDecodeJob *pJob )
+{
+	if ( pJob->m_bParallel )
+	{
+		g_nPropsDecoded += pJob->m_nPropsDecoded;
+
+		if ( pJob->m_FromDeferred.Count() )
+		{
+			bf_read fromBuf( "CL_FinishDecodeJob->fromBuf", NULL, 0 );
+			CL_SetupJobFromBuf( pJob, &fromBuf );
+			RecvTable_ApplyDeferred( pJob->m_pRecvTable, &fromBuf, pJob->m_FromDeferred.Base(), pJob->m_FromDeferred.Count(), pJob->m_iEnt );
+		}
+
+		if ( pJob->m_Deferred.Count() )
+		{
+			bf_read propsBuf( "CL_FinishDecodeJob->propsBuf", NULL, 0 );
+			CL_SetupJobPropsBuf( pJob, &propsBuf );
+			RecvTable_ApplyDeferred( pJob->m_pRecvTable, &propsBuf, pJob->m_Deferred.Base(), pJob->m_Deferred.Count(), pJob->m_iEnt );
+		}
+	}
+	else
+	{
+		CL_DecodeEntity( pJob );
+	}
+
+	if ( pJob->m_pLockedBaseline )
+		pJob->m_pLockedBaseline->UnlockData();
+
+	if ( !pJob->m_bOk )
+	{
+		Host_Error( "CL_ReadPacketEntities: props for ent %d don't match their length.\n", pJob->m_iEnt );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the props for u.m_NewNum in the packet and decodes them into pDest, 
+//  after the baseline if pFromData is set.  With u.m_bParallelDecode the decode waits
+//  for CL_DecodeEntities and the read position just skips past the props.
+// Output : Number of bits the props took, including their length.
+//-----------------------------------------------------------------------------
+static int CL_ParseDelta( 
+	CEntityReadInfo &u,
 	IClientNetworkable *pDest,
-	int entNum, 
-	unsigned char *flags )
+	const void *pFromData,
+	int nFromBits,
+	PackedEntity *pLockedBaseline )
 {
 	// If ent doesn't think it's in PVS, signal that it is
-	CL_AddInPVSFlag( flags, entNum );
-	
+	CL_AddInPVSFlag( u.m_pEntityInPVS, u.m_NewNum );
 	
 	// The goal here is to copy the data either from 'from' or from the network stream so 'to' is a valid 
 	// delta-encoded entity state.
-	RecvTable *pRecvTable = GetEntRecvTable( entNum );
+	RecvTable *pRecvTable = GetEntRecvTable( u.m_NewNum );
 	if( !pRecvTable )
-		Host_Error( "CL_ParseDelta: invalid recv table for ent %d.\n", entNum );
+		Host_Error( "CL_ParseDelta: invalid recv table for ent %d.\n", u.m_NewNum );
+
+	ErrorIfNot( u.m_nDecodeJobs < MAX_EDICTS,
+		("CL_ParseDelta: overflowed g_EntityDecodeJobs") );
+
+	bf_read *pRead = MSG_GetReadBuf();
+	int iLengthBit = pRead->GetNumBitsRead();
+	int nBits = CL_ReadEntityPropsLength();
+
+	CEntityDecodeJob *pJob = &g_EntityDecodeJobs[u.m_nDecodeJobs];
+	pJob->m_iEnt = u.m_NewNum;
+	pJob->m_pRecvTable = pRecvTable;
+	pJob->m_pStruct = pDest->GetDataTableBasePtr();
+	pJob->m_pFromData = pFromData;
+	pJob->m_nFromBits = nFromBits;
+	pJob->m_pLockedBaseline = pLockedBaseline;
+	pJob->m_pPacketData = pRead->GetBasePointer();
+	pJob->m_iStartBit = pRead->GetNumBitsRead();
+	pJob->m_nBits = nBits;
+	pJob->m_bParallel = false;
+	pJob->m_bOk = false;
+
+	if ( pJob->m_iStartBit + nBits > pRead->m_nDataBits )
+	{
+		Host_Error( "CL_ParseDelta: props for ent %d run past the end of the packet.\n", u.m_NewNum );
+	}
 
-	RecvTable_Decode( pRecvTable, pDest->GetDataTableBasePtr(), pInput, entNum );
+	if ( u.m_bParallelDecode )
+	{
+		pJob->m_bParallel = RecvTable_CanDecodeParallel( pRecvTable );
+		++u.m_nDecodeJobs;
+	}
+	else
+	{
+		CL_FinishDecodeJob( pJob );
+	}
+
+	pRead->Seek( pJob->m_iStartBit + nBits );
+	return pRead->GetNumBitsRead() - iLengthBit;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Decodes the props CL_ParseDelta queued up.
+//-----------------------------------------------------------------------------
+static void CL_DecodeEntities( CEntityReadInfo &u )
+{
+	VPROF( "CL_DecodeEntities" );
+
+	ThreadPool_ParallelFor( u.m_nDecodeJobs, CL_DecodeEntityJob, g_EntityDecodeJobs );
+
+	for ( int i=0; i < u.m_nDecodeJobs; i++ )
+	{
+		CL_FinishDecodeJob( &g_EntityDecodeJobs[i] );
+	}
+
+	u.m_nDecodeJobs = 0;
 }
 
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes existing entities from packet
 // Input  : *pPacket - 
@@ -535,20 +747,19 @@ void CL_CopyNewEntity(
 		bNew = true;
 	}
 
-	int start_bit = MSG_GetReadBuf()->m_iCurBit;
-
 	DataUpdateType_t updateType = bNew ? DATA_UPDATE_CREATED : DATA_UPDATE_DATATABLE_CHANGED;
 	ent->PreDataUpdate( updateType );
 
 		// Get either the static or instance baseline.
 		const void *pFromData;
 		int nFromBits;
-		bool bUseStaticBaseline = false;
+		PackedEntity *pLockedBaseline = NULL;
 
 		PackedEntity *baseline = GetStaticBaseline( u.m_NewNum );
 		if ( baseline && baseline->m_pRecvTable && baseline->m_pRecvTable == pClass->m_pRecvTable )
 		{
-			bUseStaticBaseline = true;
+			// CL_ParseDelta unlocks it when it's done with it.
+			pLockedBaseline = baseline;
 			pFromData = baseline->LockData();
 			nFromBits = baseline->GetNumBits();
 		}
@@ -565,16 +776,8 @@ void CL_CopyNewEntity(
 			nFromBits = nFromBytes * 8;
 		}
 
-		// Delta from baseline
-		bf_read fromBuf( "CL_CopyNewEntity->fromBuf", pFromData, PAD_NUMBER( nFromBits, 8 ) / 8, nFromBits );
-		CL_ParseDelta( &fromBuf, ent, u.m_NewNum, u.m_pEntityInPVS );
-
-		// Unlock the static baseline's data if we need to.
-		if ( bUseStaticBaseline )
-			baseline->UnlockData();
-
-		// Now parse in the contents of the network stream.
-		CL_ParseDelta( MSG_GetReadBuf(), ent, u.m_NewNum, u.m_pEntityInPVS );
+		// Delta from baseline, then the contents of the network stream.
+		int nBits = CL_ParseDelta( u, ent, pFromData, nFromBits, pLockedBaseline );
 
 	CL_AddPostDataUpdateCall( u, u.m_NewNum, updateType );
 
@@ -583,17 +786,16 @@ void CL_CopyNewEntity(
 	//
 	// Net stats..
 	//
-	int end_bit = MSG_GetReadBuf()->m_iCurBit;
-	CL_RecordEntityBits( u.m_NewNum, end_bit - start_bit );
+	CL_RecordEntityBits( u.m_NewNum, nBits );
 	if ( CL_IsPlayerIndex( u.m_NewNum ) )
 	{
 		if ( u.m_NewNum == cl.playernum + 1 )
 		{
-			*u.m_pLocalPlayerBits += ( end_bit - start_bit  );
+			*u.m_pLocalPlayerBits += nBits;
 		}
 		else
 		{
-			*u.m_pOtherPlayerBits += ( end_bit - start_bit  );
+			*u.m_pOtherPlayerBits += nBits;
 		}
 	}
 }
@@ -601,8 +803,6 @@ void CL_CopyNewEntity(
 
 void CL_CopyExistingEntity( CEntityReadInfo &u )
 {
-	int start_bit = MSG_GetReadBuf()->m_iCurBit;
-
 	IClientNetworkable *pEnt = entitylist->GetClientNetworkable( u.m_NewNum );
 	if ( !pEnt )
 	{
@@ -613,24 +813,23 @@ void CL_CopyExistingEntity( CEntityReadInfo &u )
 	// Read raw data from the network stream
 	pEnt->PreDataUpdate( DATA_UPDATE_DATATABLE_CHANGED );
 
-		CL_ParseDelta( MSG_GetReadBuf(), pEnt, u.m_NewNum, u.m_pEntityInPVS	);
+		int nBits = CL_ParseDelta( u, pEnt, NULL, 0, NULL );
 			
 	CL_AddPostDataUpdateCall( u, u.m_NewNum, DATA_UPDATE_DATATABLE_CHANGED );
 
 	u.m_pNew->SetEntityIndex( u.m_NewIndex, u.m_NewNum );
 
-	int end_bit = MSG_GetReadBuf()->GetNumBitsRead();
-	CL_RecordEntityBits( u.m_NewNum, end_bit - start_bit );
+	CL_RecordEntityBits( u.m_NewNum, nBits );
 
 	if ( CL_IsPlayerIndex( u.m_NewNum ) )
 	{
 		if ( u.m_NewNum == cl.playernum + 1 )
 		{
-			*u.m_pLocalPlayerBits += ( end_bit - start_bit  );
+			*u.m_pLocalPlayerBits += nBits;
 		}
 		else
 		{
-			*u.m_pOtherPlayerBits += ( end_bit - start_bit  );
+			*u.m_pOtherPlayerBits += nBits;
 		}
 	}
 }
@@ -905,7 +1104,11 @@ void CL_ReadPacketEntities(
 	u.m_nHeaderBase = 0;
 	u.m_nHeaderCount = headercount;
 	u.m_nPostDataUpdateCalls = 0;
+	u.m_bParallelDecode = cl_decodethreads.GetInt() > 0 && ThreadPool_GetThreadCount() > 0;
+	u.m_nDecodeJobs = 0;
 
+	CFastTimer decodeTimer;
+	decodeTimer.Start();
 
 	memset( u.m_pEntityInPVS, 0, PAD_NUMBER( MAX_EDICTS, 8 ) );
 	u.m_iStartBit = MSG_GetReadBuf()->GetNumBitsRead();
@@ -947,11 +1150,23 @@ void CL_ReadPacketEntities(
 			break;
 	}
 
+	int nDecodedEntities = u.m_nPostDataUpdateCalls;
+	CL_DecodeEntities( u );
+
+	decodeTimer.End();
+
 	// Now process explicit deletes.
 	CL_ReadDeletions( u.m_bUncompressed, u.m_bFinished );
 
+	CFastTimer postDataUpdateTimer;
+	postDataUpdateTimer.Start();
+
 	CL_CallPostDataUpdates( u );
 
+	postDataUpdateTimer.End();
+	CL_RecordPacketDecode( nDecodedEntities, decodeTimer.GetDuration().GetMillisecondsF(), 
+		postDataUpdateTimer.GetDuration().GetMillisecondsF(), u.m_bParallelDecode );
+
 	// Something didn't parse...
 	if ( MSG_IsOverflowed() )							
 	{	
@@ -1081,6 +1296,13 @@ int _CL_ParsePacketEntities ( qboolean delta, int *localplayerbits, int *otherpl
 				return 0;
 			}
 
+			// A relay forwards the server's deltas, which can be based on a packet we dropped
+			if ( cl.frames[ oldpacket & CL_UPDATE_MASK ].receivedtime < 0 )
+			{
+				CL_FlushEntityPacket( endbit, newp, "Delta base was dropped\n" );
+				return 0;
+			}
+
 			// Otherwise, mark where we are valid to and point to the packet entities we'll be updating from.
 			oldp = &cl.frames[oldpacket&CL_UPDATE_MASK].packet_entities;
 
@@ -85,6 +85,7 @@ void COM_CopyFile (char *netpath, char *cachepath);
 CGlobalVarsBase g_ClientGlobalVariables( true );
 
 extern ConVar rcon_password;
+extern ConVar net_compress;
 
 static server_cache_t	cached_servers[MAX_LOCAL_SERVERS];
 static int		num_servers;
@@ -487,6 +488,12 @@ void CL_ConnectClient( void )
 	// Initiate the network channel
 	Netchan_Setup (NS_CLIENT, &cls.netchan, net_from );
 
+	// Server tells us whether it agreed to compressed fragments
+	cls.netchan.compress = ( Cmd_Argc() > 1 && Q_atoi( Cmd_Argv( 1 ) ) ) ? true : false;
+
+	// Spectator relays say so, they don't run usercmds
+	cls.relayviewer = ( Cmd_Argc() > 2 && Q_atoi( Cmd_Argv( 2 ) ) ) ? true : false;
+
 	// Clear remaining lagged packets to prevent problems
 	NET_ClearLagData( true, false );
 
@@ -1186,6 +1193,12 @@ void CL_SendConnectPacket (void)
 	Info_SetValueForKey( protinfo, "prot", va( "%i", s_connection.authprotocol ), 1024 );
 	Info_SetValueForKey( protinfo, "raw", (char *)buffer, 1024 );
 
+	// Let the server know we can decompress fragments
+	if ( net_compress.GetInt() )
+	{
+		Info_SetValueForKey( protinfo, "lz", "1", 1024 );
+	}
+
 	CL_CheckLogoFile( protinfo, sizeof( protinfo ) );
 	CL_CheckSendTableCRC( protinfo, sizeof( protinfo ) );
 
@@ -1400,6 +1413,87 @@ static void CL_SetupMapName( char const* pName, char* pFixedName )
 		*pExt = 0;
 }
 
+//-----------------------------------------------------------------------------
+// Connect benchmark.  Loads a map over loopback without and then with netchan
+// compression, and reports the signon traffic and how long each connect took.
+//-----------------------------------------------------------------------------
+static struct
+{
+	bool	active;
+	int		pass;			// 0 == uncompressed, 1 == compressed
+	char	mapname[ MAX_QPATH ];
+	int		oldcompress;
+	double	starttime;
+	double	time[ 2 ];
+	int		frombytes[ 2 ];
+	int		tobytes[ 2 ];
+} s_ConnectBench;
+
+static void CL_ConnectBench_StartPass( void )
+{
+	net_compress.SetValue( s_ConnectBench.pass );
+	s_ConnectBench.starttime = Sys_FloatTime();
+	Cbuf_AddText( va( "map %s\n", s_ConnectBench.mapname ) );
+}
+
+static void CL_ConnectBench_f( void )
+{
+	if ( Cmd_Argc() != 2 )
+	{
+		Con_Printf( "Usage:  net_connectbench <map>\n" );
+		return;
+	}
+
+	Q_strncpy( s_ConnectBench.mapname, Cmd_Argv( 1 ), sizeof( s_ConnectBench.mapname ) );
+	s_ConnectBench.oldcompress = net_compress.GetInt();
+	s_ConnectBench.pass = 0;
+	s_ConnectBench.active = true;
+
+	CL_ConnectBench_StartPass();
+}
+
+static ConCommand net_connectbench( "net_connectbench", CL_ConnectBench_f, "Time a loopback connect to a map with and without netchan compression. Usage: net_connectbench <map>" );
+
+//-----------------------------------------------------------------------------
+// Purpose: Signon finished, record the pass and start the next one
+//-----------------------------------------------------------------------------
+static void CL_ConnectBench_SignonDone( void )
+{
+	int pass;
+
+	if ( !s_ConnectBench.active )
+		return;
+
+	pass = s_ConnectBench.pass;
+	s_ConnectBench.time[ pass ]		 = Sys_FloatTime() - s_ConnectBench.starttime;
+	s_ConnectBench.frombytes[ pass ] = cls.netchan.flow[ FLOW_INCOMING ].totalbytes;
+	s_ConnectBench.tobytes[ pass ]	 = cls.netchan.flow[ FLOW_OUTGOING ].totalbytes;
+
+	if ( pass == 0 )
+	{
+		s_ConnectBench.pass = 1;
+		CL_ConnectBench_StartPass();
+		return;
+	}
+
+	s_ConnectBench.active = false;
+	net_compress.SetValue( s_ConnectBench.oldcompress );
+
+	Con_Printf( "net_connectbench %s:\n", s_ConnectBench.mapname );
+	Con_Printf( "                 time      from server    to server\n" );
+	Con_Printf( "  raw          %7.3f s   %10i    %10i\n", 
+		s_ConnectBench.time[ 0 ], s_ConnectBench.frombytes[ 0 ], s_ConnectBench.tobytes[ 0 ] );
+	Con_Printf( "  compressed   %7.3f s   %10i    %10i\n", 
+		s_ConnectBench.time[ 1 ], s_ConnectBench.frombytes[ 1 ], s_ConnectBench.tobytes[ 1 ] );
+
+	if ( s_ConnectBench.frombytes[ 0 ] > 0 && s_ConnectBench.time[ 0 ] > 0 )
+	{
+		Con_Printf( "  compressed connect used %.1f%% of the bytes and %.1f%% of the time\n",
+			100.0f * s_ConnectBench.frombytes[ 1 ] / s_ConnectBench.frombytes[ 0 ],
+			100.0f * s_ConnectBench.time[ 1 ] / s_ConnectBench.time[ 0 ] );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: A svc_signonnum has been received, perform a client side setup
 // Output : void CL_SignonReply
@@ -1474,6 +1568,8 @@ void CL_SignonReply (void)
 			{
 				Netchan_ReportFlow( &cls.netchan );
 			}
+
+			CL_ConnectBench_SignonDone();
 		}
 		break;
 	}
@@ -1985,6 +2081,52 @@ void CL_ExtraMouseUpdate( float frametime )
 
 }
 
+/*
+=================
+CL_SendRelayAck
+
+Relay viewers have nobody to run usercmds, they just ack entity updates at cl_cmdrate
+=================
+*/
+static void CL_SendRelayAck( void )
+{
+	byte	data[ 16 ];
+	bf_write buf( "CL_SendRelayAck", data, sizeof( data ) );
+
+	if ( ( realtime < cls.nextcmdtime ) || !Netchan_CanPacket( &cls.netchan ) )
+		return;
+
+	if ( cl_cmdrate.GetInt() > 0 )
+	{
+		cls.nextcmdtime = realtime + ( 1.0f / cl_cmdrate.GetFloat() );
+	}
+	else
+	{
+		cls.nextcmdtime = realtime;
+	}
+
+	if ( cl.validsequence && ( cls.state == ca_active ) )
+	{
+		cl.delta_sequence = cl.validsequence;
+
+		buf.WriteByte( clc_delta );
+		buf.WriteUBitLong( cl.validsequence & DELTAFRAME_MASK, DELTAFRAME_NUMBITS );
+	}
+	else
+	{
+		// Tell the relay we need an uncompressed update
+		cl.delta_sequence = -1;
+	}
+
+	cls.lastoutgoingcommand = cls.netchan.outgoing_sequence;
+	cl.commands[ cls.netchan.outgoing_sequence & CL_UPDATE_MASK ].sendsize = buf.GetNumBytesWritten();
+
+	// Voice and the like have nowhere to go
+	cls.datagram.Reset();
+
+	Netchan_Transmit( &cls.netchan, buf.GetNumBytesWritten(), buf.GetBasePointer() );
+}
+
 /*
 =================
 CL_Move
@@ -2047,6 +2189,13 @@ void CL_Move( float accumulated_extra_samples )
 	pcmd->heldback			= false;
 	pcmd->sendsize			= 0;
 
+	if ( cls.relayviewer )
+	{
+		CL_SendRelayAck();
+		Netchan_UpdateProgress( &cls.netchan );
+		return;
+	}
+
 	// Are we fully signed on?
 	active =  !demo->IsPlayingBack() && ( cls.signon == SIGNONS ) ? 1 : 0;
 
@@ -10,6 +10,7 @@
 #include "client.h"
 #include "enginestats.h"
 #include "convar.h"
+#include "demo.h"
 
 client_static_t	cls;
 CClientState	cl;
@@ -25,5 +26,10 @@ bool Demo_IsPlayingBack_TimeDemo()
 	return false;
 }
 
+bool Demo_LoadNetworkMessages( const char *name, CUtlVector< unsigned int >& data, CUtlVector< int >& messageBytes )
+{
+	return false;
+}
+
 
 #endif
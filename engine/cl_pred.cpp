@@ -76,6 +76,10 @@ void CL_RunPrediction( PREDICTION_REASON reason )
 	if ( cls.state != ca_active )
 		return;
 
+	// Relay viewers don't send usercmds, nothing to predict
+	if ( cls.relayviewer )
+		return;
+
 	if ( !cl.validsequence ||
 		 ( ( cls.netchan.outgoing_sequence + 1 - cls.netchan.incoming_acknowledged ) >= CL_UPDATE_MASK ) )
 	{
@@ -129,6 +129,9 @@ typedef struct
 
 	int			snapshotnumber;
 	char		retry_address[ MAX_OSPATH ];
+
+	// Connected to a spectator relay ( sv_relay.cpp ), we only watch
+	qboolean	relayviewer;
 } client_static_t;
 
 extern client_static_t	cls;
@@ -23,61 +23,37 @@
 #include "vphysics_interface.h"
 #include "icliententity.h"
 #include "engine/icollideable.h"
+#include "tier0/threadtools.h"
+#include <xmmintrin.h>
 
 
 CCollisionBSPData g_BSPData;								// the global collision bsp
 CCollisionCounts  g_CollisionCounts;						// collision test counters
 
-Vector trace_start;
-Vector trace_end;
-Vector trace_mins;
-Vector trace_maxs;
-Vector trace_extents;
-
-trace_t trace_trace;
-trace_t g_StabTrace;
-
-int trace_contents;
-qboolean trace_ispoint;
-
 csurface_t nullsurface = { "**empty**", 0 };				// generic null collision model surface
 
-enum
-{
-	MAX_CHECK_COUNT_DEPTH = 2
-};
-
-int s_nCheckCount[MAX_CHECK_COUNT_DEPTH];					// global collision checkcount
-int s_nCheckCountDepth = -1;
-
-void BeginCheckCount()
-{
-	++s_nCheckCountDepth;
-	Assert( (s_nCheckCountDepth >= 0) && (s_nCheckCountDepth < MAX_CHECK_COUNT_DEPTH) );
-	++s_nCheckCount[s_nCheckCountDepth];
-}
-
-int CurrentCheckCount()
-{
-	return s_nCheckCount[s_nCheckCountDepth];
-}
+typedef CUtlVector<cnode_t> CSubBSPTree;
+static CSubBSPTree s_BSPSubTree;
+static bool s_bBSPSubTreeHooked = false;					// CM_BeginBSPSubTree, main thread traces only
 
-int CurrentCheckCountDepth()
-{
-	return s_nCheckCountDepth;
-}
+// Trace contexts, see CM_BeginTrace.  The mutex is only taken when a thread needs a new one.
+static CThreadMutex s_TraceInfoMutex;
+static CUtlVector<TraceInfo_t*> s_TraceInfos;
+static CUtlVector<TraceInfo_t*> s_FreeTraceInfos;
 
-void EndCheckCount()
+// Each thread keeps the context of its last trace for the next one
+struct TraceInfoCache_t
 {
-	--s_nCheckCountDepth;
-	Assert( s_nCheckCountDepth >= -1 );
-}
-
-
-typedef CUtlVector<cnode_t> CSubBSPTree;
-static CSubBSPTree s_BSPSubTree;
+	TraceInfo_t		*m_pTraceInfo;
+	// The context went back to s_FreeTraceInfos if this isn't s_nTraceInfoGeneration
+	int				m_nGeneration;
+};
+static CThreadLocalPtr s_TraceInfoCache;
+static int s_nTraceInfoGeneration = 0;
 
 static ConVar map_noareas( "map_noareas", "0", 0 );
+static ConVar cm_brushsse( "cm_brushsse", "1", 0, "Clip traces against brushes four sides at a time with SSE" );
+ConVar cm_dispsimd( "cm_dispsimd", "1", 0, "Walk displacement collision trees four nodes at a time, 0 uses the original recursive walk" );
 
 void	CM_InitBoxHull (CCollisionBSPData *pBSPData);
 void	FloodAreaConnections (CCollisionBSPData *pBSPData);
@@ -230,9 +206,22 @@ int	CM_LeafArea( int leafnum )
 //-----------------------------------------------------------------------------
 void CM_FreeMap(void)
 {
+	// The check counts are indexed by brush and displacement, start them over for the next map
+	for ( int i = 0; i < s_TraceInfos.Count(); i++ )
+	{
+		for ( int j = 0; j < MAX_CHECK_COUNT_DEPTH; j++ )
+		{
+			s_TraceInfos[i]->m_BrushCounts[j].Purge();
+			s_TraceInfos[i]->m_DispCounts[j].Purge();
+		}
+	}
+
 	// get the current collision bsp -- there is only one!
 	CCollisionBSPData *pBSPData = GetCollisionBSPData();
 
+	// the recorded brush indices are no good on another map
+	BrushClip_StopRecording();
+
 	// free the collision bsp data
 	CollisionBSPData_Destroy( pBSPData );
 }
@@ -344,6 +333,7 @@ vcollide_t* CM_VCollideForModel( int modelindex, model_t* pModel )
 
 //=======================================================================
 
+// The first of the MAX_BOX_HULLS box hulls, the one CM_HeadnodeForBoxHull uses
 cplane_t	*box_planes;
 int			box_headnode;
 cbrush_t	*box_brush;
@@ -355,6 +345,9 @@ CM_InitBoxHull
 
 Set up the planes and nodes so that the six floats of a bounding box
 can just be stored out and get a proper clipping hull structure.
+
+There are MAX_BOX_HULLS of them one after another, so traces on different
+threads can each have their own.
 ===================
 */
 void CM_InitBoxHull( CCollisionBSPData *pBSPData )
@@ -367,57 +360,95 @@ void CM_InitBoxHull( CCollisionBSPData *pBSPData )
 
 	box_headnode = pBSPData->numnodes;
 	box_planes = &pBSPData->map_planes[pBSPData->numplanes];
-
 	box_brush = &pBSPData->map_brushes[pBSPData->numbrushes];
-	memset( box_brush, 0, sizeof(*box_brush) );
-	box_brush->numsides = 6;
-	box_brush->firstbrushside = pBSPData->numbrushsides;
-	box_brush->contents = CONTENTS_SOLID;
-
 	box_leaf = &pBSPData->map_leafs[pBSPData->numleafs];
-	memset( box_leaf, 0, sizeof(*box_leaf) );
-	box_leaf->contents = CONTENTS_SOLID;
-	box_leaf->firstleafbrush = pBSPData->numleafbrushes;
-	box_leaf->numleafbrushes = 1;
-
-	pBSPData->map_leafbrushes[pBSPData->numleafbrushes] = pBSPData->numbrushes;
 
-	for (i=0 ; i<6 ; i++)
+	for (int nHull=0 ; nHull<MAX_BOX_HULLS ; nHull++)
 	{
-		side = i&1;
+		int headnode = box_headnode + nHull*6;
+		int firstplane = pBSPData->numplanes + nHull*12;
+		int firstside = pBSPData->numbrushsides + nHull*6;
 
-		// brush sides
-		s = &pBSPData->map_brushsides[pBSPData->numbrushsides+i];
-		s->plane = &pBSPData->map_planes[(pBSPData->numplanes+i*2+side)];
-		s->surface = &nullsurface;
-		s->bBevel = false;
+		cbrush_t *brush = &box_brush[nHull];
+		memset( brush, 0, sizeof(*brush) );
+		brush->numsides = 6;
+		brush->firstbrushside = firstside;
+		brush->contents = CONTENTS_SOLID;
 
-		// nodes
-		c = &pBSPData->map_rootnode[box_headnode+i];
-		c->plane = &pBSPData->map_planes[(pBSPData->numplanes+i*2)];
-		c->children[side] = -1 - pBSPData->emptyleaf;
-		if (i != 5)
-		{
-			c->children[side^1] = box_headnode+i + 1;
-		}
-		else
+		cleaf_t *leaf = &box_leaf[nHull];
+		memset( leaf, 0, sizeof(*leaf) );
+		leaf->contents = CONTENTS_SOLID;
+		leaf->firstleafbrush = pBSPData->numleafbrushes + nHull;
+		leaf->numleafbrushes = 1;
+
+		pBSPData->map_leafbrushes[pBSPData->numleafbrushes + nHull] = pBSPData->numbrushes + nHull;
+
+		for (i=0 ; i<6 ; i++)
 		{
-			c->children[side^1] = -1 - pBSPData->numleafs;
-		}
+			side = i&1;
+
+			// brush sides
+			s = &pBSPData->map_brushsides[firstside+i];
+			s->plane = &pBSPData->map_planes[(firstplane+i*2+side)];
+			s->surface = &nullsurface;
+			s->bBevel = false;
+
+			// nodes
+			c = &pBSPData->map_nodes[headnode+i];
+			c->plane = &pBSPData->map_planes[(firstplane+i*2)];
+			c->children[side] = -1 - pBSPData->emptyleaf;
+			if (i != 5)
+			{
+				c->children[side^1] = headnode+i + 1;
+			}
+			else
+			{
+				c->children[side^1] = -1 - (pBSPData->numleafs + nHull);
+			}
+
+			// planes
+			p = &pBSPData->map_planes[firstplane+i*2];
+			p->type = i>>1;
+			p->signbits = 0;
+			VectorClear (p->normal);
+			p->normal[i>>1] = 1;
+
+			p = &pBSPData->map_planes[firstplane+i*2+1];
+			p->type = 3 + (i>>1);
+			p->signbits = 0;
+			VectorClear (p->normal);
+			p->normal[i>>1] = -1;
+		}	
+
+		// The side groups after the map's, see CollisionBSPData_LoadBrushSideGroups
+		brush->firstsidegroup = pBSPData->numbrushsidegroups + nHull*2;
+		CM_BuildBrushSideGroups( pBSPData, brush );
+	}
+}
 
-		// planes
-		p = &box_planes[i*2];
-		p->type = i>>1;
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = 1;
 
-		p = &box_planes[i*2+1];
-		p->type = 3 + (i>>1);
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = -1;
-	}	
+//-----------------------------------------------------------------------------
+// Moves the planes of one of the box hulls to the box, returns its headnode
+//-----------------------------------------------------------------------------
+static int CM_SetBoxHull( CCollisionBSPData *pBSPData, int nHull, const Vector& mins, const Vector& maxs )
+{
+	cplane_t *planes = &box_planes[nHull*12];
+	planes[0].dist = maxs[0];
+	planes[1].dist = -maxs[0];
+	planes[2].dist = mins[0];
+	planes[3].dist = -mins[0];
+	planes[4].dist = maxs[1];
+	planes[5].dist = -maxs[1];
+	planes[6].dist = mins[1];
+	planes[7].dist = -mins[1];
+	planes[8].dist = maxs[2];
+	planes[9].dist = -maxs[2];
+	planes[10].dist = mins[2];
+	planes[11].dist = -mins[2];
+
+	CM_BuildBrushSideGroups( pBSPData, &box_brush[nHull] );
+
+	return box_headnode + nHull*6;
 }
 
 
@@ -427,24 +458,164 @@ CM_HeadnodeForBox
 
 To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
+
+This is the shared box hull, so only the main thread can use it.  Traces
+elsewhere use CM_TransformedBoxTraceToBox.
 ===================
 */
 int	CM_HeadnodeForBoxHull(const Vector& mins, const Vector& maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = -maxs[0];
-	box_planes[2].dist = mins[0];
-	box_planes[3].dist = -mins[0];
-	box_planes[4].dist = maxs[1];
-	box_planes[5].dist = -maxs[1];
-	box_planes[6].dist = mins[1];
-	box_planes[7].dist = -mins[1];
-	box_planes[8].dist = maxs[2];
-	box_planes[9].dist = -maxs[2];
-	box_planes[10].dist = mins[2];
-	box_planes[11].dist = -mins[2];
+	Assert( Plat_IsPrimaryThread() );
+	return CM_SetBoxHull( GetCollisionBSPData(), 0, mins, maxs );
+}
+
+
+//-----------------------------------------------------------------------------
+// Is this headnode one of the box hulls?  They don't get rotated.
+//-----------------------------------------------------------------------------
+static inline bool CM_IsBoxHull( int headnode )
+{
+	return headnode >= box_headnode;
+}
+
+
+//-----------------------------------------------------------------------------
+// Trace contexts.  There's one per trace in flight, and each one keeps the
+// box hull it was created with.  A thread holds on to its context between
+// traces, so the lock is only taken the first time a thread traces or when
+// traces nest.
+//-----------------------------------------------------------------------------
+TraceInfo_t::TraceInfo_t()
+{
+	m_pBSPData = NULL;
+	m_pRootNode = NULL;
+	for ( int i = 0; i < MAX_CHECK_COUNT_DEPTH; i++ )
+	{
+		m_Count[i] = 0;
+	}
+	m_nCheckDepth = -1;
+	m_nBoxHull = 0;
+	m_bBrushSSE = false;
+	m_bDispSIMD = false;
+	m_bDispHit = false;
+	m_contents = 0;
+	m_ispoint = false;
+}
+
+static TraceInfoCache_t *CM_GetTraceInfoCache( void )
+{
+	TraceInfoCache_t *pCache = (TraceInfoCache_t *)s_TraceInfoCache.Get();
+	if ( !pCache )
+	{
+		// Never freed, threads don't tell us when they exit
+		pCache = new TraceInfoCache_t;
+		pCache->m_pTraceInfo = NULL;
+		pCache->m_nGeneration = s_nTraceInfoGeneration;
+		s_TraceInfoCache.Set( pCache );
+	}
+	else if ( pCache->m_nGeneration != s_nTraceInfoGeneration )
+	{
+		pCache->m_pTraceInfo = NULL;
+		pCache->m_nGeneration = s_nTraceInfoGeneration;
+	}
+	return pCache;
+}
+
+TraceInfo_t *CM_BeginTrace( void )
+{
+	TraceInfoCache_t *pCache = CM_GetTraceInfoCache();
+	TraceInfo_t *pTraceInfo = pCache->m_pTraceInfo;
+	if ( pTraceInfo )
+	{
+		pCache->m_pTraceInfo = NULL;
+	}
+	else
+	{
+		CThreadAutoLock lock( s_TraceInfoMutex );
+		if ( s_FreeTraceInfos.Count() )
+		{
+			pTraceInfo = s_FreeTraceInfos[ s_FreeTraceInfos.Count() - 1 ];
+			s_FreeTraceInfos.FastRemove( s_FreeTraceInfos.Count() - 1 );
+		}
+		else
+		{
+			// The first box hull is CM_HeadnodeForBoxHull's
+			if ( s_TraceInfos.Count() >= MAX_BOX_HULLS - 1 )
+			{
+				Sys_Error( "CM_BeginTrace: more than %d threads or nested traces\n", MAX_BOX_HULLS - 1 );
+			}
+
+			pTraceInfo = new TraceInfo_t;
+			pTraceInfo->m_nBoxHull = s_TraceInfos.Count() + 1;
+			s_TraceInfos.AddToTail( pTraceInfo );
+		}
+	}
+
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	pTraceInfo->m_pBSPData = pBSPData;
+
+	// The subtree is only hooked in for the thread that built it
+	if ( s_bBSPSubTreeHooked && Plat_IsPrimaryThread() )
+	{
+		pTraceInfo->m_pRootNode = s_BSPSubTree.Base();
+	}
+	else
+	{
+		pTraceInfo->m_pRootNode = pBSPData->map_nodes.Base();
+	}
+
+	// The box hull brushes are after the map's
+	int nBrushCount = pBSPData->numbrushes + MAX_BOX_HULLS;
+	if ( pTraceInfo->m_BrushCounts[0].Count() != nBrushCount || 
+		pTraceInfo->m_DispCounts[0].Count() != g_DispCollTreeCount )
+	{
+		for ( int i = 0; i < MAX_CHECK_COUNT_DEPTH; i++ )
+		{
+			pTraceInfo->m_BrushCounts[i].SetCount( nBrushCount );
+			memset( pTraceInfo->m_BrushCounts[i].Base(), 0, nBrushCount * sizeof(int) );
+			pTraceInfo->m_DispCounts[i].SetCount( g_DispCollTreeCount );
+			if ( g_DispCollTreeCount )
+			{
+				memset( pTraceInfo->m_DispCounts[i].Base(), 0, g_DispCollTreeCount * sizeof(int) );
+			}
+			pTraceInfo->m_Count[i] = 0;
+		}
+	}
+
+	pTraceInfo->m_nCheckDepth = -1;
+	pTraceInfo->m_bBrushSSE = cm_brushsse.GetBool() && MathLib_SSEEnabled();
+	pTraceInfo->m_bDispSIMD = cm_dispsimd.GetBool();
+	return pTraceInfo;
+}
+
+void CM_EndTrace( TraceInfo_t *&pTraceInfo )
+{
+	Assert( pTraceInfo->m_nCheckDepth == -1 );
+
+	TraceInfoCache_t *pCache = CM_GetTraceInfoCache();
+	if ( !pCache->m_pTraceInfo )
+	{
+		pCache->m_pTraceInfo = pTraceInfo;
+	}
+	else
+	{
+		CThreadAutoLock lock( s_TraceInfoMutex );
+		s_FreeTraceInfos.AddToTail( pTraceInfo );
+	}
+	pTraceInfo = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Worker threads that exit keep their contexts, and each one has a box hull.
+// This takes every context back.
+//-----------------------------------------------------------------------------
+void CM_ReclaimTraceInfos( void )
+{
+	CThreadAutoLock lock( s_TraceInfoMutex );
 
-	return box_headnode;
+	s_FreeTraceInfos.RemoveAll();
+	s_FreeTraceInfos.AddVectorToTail( s_TraceInfos );
+	s_nTraceInfoGeneration++;
 }
 
 
@@ -500,12 +671,18 @@ Fills in a list of all the leafs touched
 =============
 */
 
-static int		leaf_count, leaf_maxcount;
-static int		*leaf_list;
-static const Vector *leaf_mins, *leaf_maxs;
-static int		leaf_topnode;
+struct leafnums_t
+{
+	int		leafTopNode;
+	int		leafMaxCount;
+	int		leafCount;
+	int		*pLeafList;
+	Vector	leafMins;
+	Vector	leafMaxs;
+	cnode_t	*pRootNode;
+};
 
-void CM_BoxLeafnums_r( CCollisionBSPData *pBSPData, int nodenum )
+static void CM_BoxLeafnums_r( leafnums_t *pLeafnums, int nodenum )
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -519,26 +696,23 @@ void CM_BoxLeafnums_r( CCollisionBSPData *pBSPData, int nodenum )
 			// This handles the case when the box lies completely
 			// within a single node. In that case, the top node should be
 			// the parent of the leaf
-			if (leaf_topnode == -1)
-				leaf_topnode = prev_topnode;
+			if (pLeafnums->leafTopNode == -1)
+				pLeafnums->leafTopNode = prev_topnode;
 
-			if (leaf_count >= leaf_maxcount)
+			if (pLeafnums->leafCount >= pLeafnums->leafMaxCount)
 			{
 //				Com_Printf ("CM_BoxLeafnums_r: overflow\n");
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			pLeafnums->pLeafList[pLeafnums->leafCount++] = -1 - nodenum;
 			return;
 		}
 	
-		node = &pBSPData->map_rootnode[nodenum];
+		node = &pLeafnums->pRootNode[nodenum];
 		plane = node->plane;
 //		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
 //		s = BOX_ON_PLANE_SIDE(*leaf_mins, *leaf_maxs, plane);
-		Vector mins, maxs;
-		mins = *leaf_mins;
-		maxs = *leaf_maxs;
-		s = BoxOnPlaneSide2( mins, maxs, plane );
+		s = BoxOnPlaneSide2( pLeafnums->leafMins, pLeafnums->leafMaxs, plane );
 
 		prev_topnode = nodenum;
 		if (s == 1)
@@ -547,30 +721,31 @@ void CM_BoxLeafnums_r( CCollisionBSPData *pBSPData, int nodenum )
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			CM_BoxLeafnums_r (pBSPData, node->children[0]);
+			if (pLeafnums->leafTopNode == -1)
+				pLeafnums->leafTopNode = nodenum;
+			CM_BoxLeafnums_r (pLeafnums, node->children[0]);
 			nodenum = node->children[1];
 		}
 	}
 }
 
-int	CM_BoxLeafnums_headnode ( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, int *list, int listsize, int headnode, int *topnode)
+static int CM_BoxLeafnums_headnode ( cnode_t *pRootNode, const Vector& mins, const Vector& maxs, int *list, int listsize, int headnode, int *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = &mins;
-	leaf_maxs = &maxs;
+	leafnums_t leafnums;
+	leafnums.pLeafList = list;
+	leafnums.leafCount = 0;
+	leafnums.leafMaxCount = listsize;
+	leafnums.leafMins = mins;
+	leafnums.leafMaxs = maxs;
+	leafnums.leafTopNode = -1;
+	leafnums.pRootNode = pRootNode;
 
-	leaf_topnode = -1;
-
-	CM_BoxLeafnums_r (pBSPData, headnode);
+	CM_BoxLeafnums_r (&leafnums, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = leafnums.leafTopNode;
 
-	return leaf_count;
+	return leafnums.leafCount;
 }
 
 int	CM_BoxLeafnums ( const Vector& mins, const Vector& maxs, int *list, int listsize, int *topnode)
@@ -578,7 +753,7 @@ int	CM_BoxLeafnums ( const Vector& mins, const Vector& maxs, int *list, int list
 	// get the current collision bsp -- there is only one!
 	CCollisionBSPData *pBSPData = GetCollisionBSPData();
 
-	return CM_BoxLeafnums_headnode (pBSPData, mins, maxs, list,
+	return CM_BoxLeafnums_headnode (pBSPData->map_rootnode, mins, maxs, list,
 		listsize, pBSPData->map_cmodels[0].headnode, topnode);
 }
 
@@ -639,8 +814,8 @@ static int InsertNodeIntoTree( CCollisionBSPData *pBSPData, int node, int parent
 	}
 }
 
-static void CM_BuildSubTree_r( CCollisionBSPData *pBSPData, int nodenum, 
-									int parentNode, int childNum )
+static void CM_BuildSubTree_r( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, 
+							   int nodenum, int parentNode, int childNum )
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -659,7 +834,7 @@ static void CM_BuildSubTree_r( CCollisionBSPData *pBSPData, int nodenum,
 		plane = node->plane;
 //		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
 //		s = BOX_ON_PLANE_SIDE(*leaf_mins, *leaf_maxs, plane);
-		s = BoxOnPlaneSide2( *leaf_mins, *leaf_maxs, plane );
+		s = BoxOnPlaneSide2( mins, maxs, plane );
 
 		if (s == 1)
 			nodenum = node->children[0];
@@ -671,7 +846,7 @@ static void CM_BuildSubTree_r( CCollisionBSPData *pBSPData, int nodenum,
 			parentNode = InsertNodeIntoTree( pBSPData, nodenum, parentNode, childNum );
 
 			// go down both
-			CM_BuildSubTree_r (pBSPData, node->children[0], parentNode, 0);
+			CM_BuildSubTree_r (pBSPData, mins, maxs, node->children[0], parentNode, 0);
 
 			childNum = 1;
 			nodenum = node->children[1];
@@ -688,32 +863,29 @@ void CM_BuildBSPSubTree( const Vector& mins, const Vector& maxs )
 	CCollisionBSPData *pBSPData = GetCollisionBSPData();
 
 	// We can't be using the subtree and building it also...
-	Assert( pBSPData->map_rootnode == pBSPData->map_nodes.Base() );
+	Assert( !s_bBSPSubTreeHooked );
+	Assert( Plat_IsPrimaryThread() );
 
 	s_BSPSubTree.RemoveAll();
 
-	leaf_mins = &mins;
-	leaf_maxs = &maxs;
-
-	CM_BuildSubTree_r( pBSPData, 0, -1, -1 );
+	CM_BuildSubTree_r( pBSPData, mins, maxs, 0, -1, -1 );
 }
 
 //-----------------------------------------------------------------------------
-// This here hooks in the subtree for all computations
+// This here hooks in the subtree for traces on the main thread.  Traces on
+// other threads keep using the whole tree.
 //-----------------------------------------------------------------------------
 
 void CM_BeginBSPSubTree( )
 {
-	// Hook in the subtree
-	CCollisionBSPData *pBSPData = GetCollisionBSPData();
-	pBSPData->map_rootnode = s_BSPSubTree.Base();
+	Assert( Plat_IsPrimaryThread() );
+	s_bBSPSubTreeHooked = true;
 }
 
 void CM_EndBSPSubTree( )
 {
-	// Unhook the subtree
-	CCollisionBSPData *pBSPData = GetCollisionBSPData();
-	pBSPData->map_rootnode = pBSPData->map_nodes.Base();
+	Assert( Plat_IsPrimaryThread() );
+	s_bBSPSubTreeHooked = false;
 }
 
 
@@ -762,7 +934,7 @@ int	CM_TransformedPointContents ( const Vector& p, int headnode, const Vector& o
 	VectorSubtract (p, origin, p_l);
 
 	// rotate start and end into the models frame of reference
-	if (headnode != box_headnode && 
+	if (!CM_IsBoxHull( headnode ) && 
 	(angles[0] || angles[1] || angles[2]) )
 	{
 		AngleVectors (angles, &forward, &right, &up);
@@ -787,12 +959,136 @@ BOX TRACING
 ===============================================================================
 */
 
+/*
+================
+CM_BuildBrushSideGroups
+
+Copies the brush's planes into its side groups, four sides to a group.  Lanes
+past the last side repeat it.
+================
+*/
+void CM_BuildBrushSideGroups( CCollisionBSPData *pBSPData, cbrush_t *brush )
+{
+	int numgroups = ( brush->numsides + 3 ) >> 2;
+	for ( int g = 0; g < numgroups; g++ )
+	{
+		cbrushsidegroup_t *group = &pBSPData->map_brushsidegroups[brush->firstsidegroup+g];
+		for ( int k = 0; k < 4; k++ )
+		{
+			int i = min( g * 4 + k, brush->numsides - 1 );
+			cbrushside_t *side = &pBSPData->map_brushsides[brush->firstbrushside+i];
+			group->normal[0][k] = side->plane->normal[0];
+			group->normal[1][k] = side->plane->normal[1];
+			group->normal[2][k] = side->plane->normal[2];
+			group->dist[k] = side->plane->dist;
+			group->bevel[k] = side->bBevel ? 0xFFFFFFFF : 0;
+		}
+	}
+}
+
+
 /*
 ================
 CM_ClipBoxToBrush
 ================
 */
-void FASTCALL CM_ClipBoxToBrush( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+void FASTCALL CM_ClipBoxToBrush( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+										     trace_t *trace, cbrush_t *brush )
+{
+	if ( g_bBrushClipRecording )
+	{
+		BrushClip_Record( BRUSHCLIP_CLIP, pTraceInfo, mins, maxs, p1, p2, trace, brush );
+	}
+
+	if ( pTraceInfo->m_bBrushSSE )
+	{
+		CM_ClipBoxToBrushSSE( pTraceInfo, mins, maxs, p1, p2, trace, brush );
+	}
+	else
+	{
+		CM_ClipBoxToBrushScalar( pTraceInfo, mins, maxs, p1, p2, trace, brush );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Where the brush leaves the trace, shared by both versions of CM_ClipBoxToBrush
+//-----------------------------------------------------------------------------
+static inline void CM_ClipBoxToBrushResult( TraceInfo_t *pTraceInfo, trace_t *trace, cbrush_t *brush, float enterfrac, float leavefrac,
+										    bool startout, bool getout, cplane_t *clipplane, cbrushside_t *leadside )
+{
+	// when this happens, we entered the brush *after* leaving the previous brush.
+	// Therefore, we're still outside!
+
+	// NOTE: We only do this test against points because fractionleftsolid is
+	// not possible to compute for brush sweeps without a *lot* more computation
+	// So, client code will never get fractionleftsolid for box sweeps
+	if (pTraceInfo->m_ispoint && startout)
+	{ 
+		// Add a little sludge.  The sludge should already be in the fractionleftsolid
+		// (for all intents and purposes is a leavefrac value) and enterfrac values.  
+		// Both of these values have +/- DIST_EPSILON values calculated in.  Thus, I 
+		// think the test should be against "0.0."  If we experience new "left solid"
+		// problems you may want to take a closer look here!
+//		if ((trace->fractionleftsolid - enterfrac) > -1e-6)
+		if ((trace->fractionleftsolid - enterfrac) > 0.0f )
+			startout = false;
+	}
+
+	if (!startout)
+	{	// original point was inside brush
+		trace->startsolid = true;
+		// return starting contents
+		trace->contents = brush->contents;
+
+		if (!getout)
+		{
+			trace->allsolid = true;
+			trace->fraction = 0.0f;
+			trace->fractionleftsolid = 1.0f;
+		}
+		else
+		{
+			// if leavefrac == 1, this means it's never been updated or we're in allsolid
+			// the allsolid case was handled above
+			if ((leavefrac != 1) && (leavefrac > trace->fractionleftsolid))
+			{
+				trace->fractionleftsolid = leavefrac;
+
+				// This could occur if a previous trace didn't start us in solid
+				if (trace->fraction <= leavefrac)
+				{
+					trace->fraction = 1.0f;
+					trace->surface = nullsurface;
+				}
+			}
+		}
+		return;
+	}
+
+	// We haven't hit anything at all until we've left...
+	if (enterfrac < leavefrac)
+	{
+		if (enterfrac > NEVER_UPDATED && enterfrac < trace->fraction)
+		{
+			if (enterfrac < 0)
+				enterfrac = 0;
+			trace->fraction = enterfrac;
+			pTraceInfo->m_bDispHit = false;
+			trace->plane = *clipplane;
+			trace->surface = *leadside->surface;
+			trace->contents = brush->contents;
+		}
+	}
+}
+
+
+/*
+================
+CM_ClipBoxToBrushScalar
+================
+*/
+void FASTCALL CM_ClipBoxToBrushScalar( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
 										     trace_t *trace, cbrush_t *brush )
 {
 	
@@ -801,6 +1097,8 @@ void FASTCALL CM_ClipBoxToBrush( CCollisionBSPData *pBSPData, const Vector& mins
 
 	g_CollisionCounts.m_BrushTraces++;
 
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+
 	float enterfrac = NEVER_UPDATED;
 	float leavefrac = 1.f;
 	cplane_t* clipplane = NULL;
@@ -816,7 +1114,7 @@ void FASTCALL CM_ClipBoxToBrush( CCollisionBSPData *pBSPData, const Vector& mins
 	{
 		cplane_t *plane = side->plane;
 
-		if (!trace_ispoint)
+		if (!pTraceInfo->m_ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
@@ -894,77 +1192,157 @@ void FASTCALL CM_ClipBoxToBrush( CCollisionBSPData *pBSPData, const Vector& mins
 		}
 	}
 
-	// when this happens, we entered the brush *after* leaving the previous brush.
-	// Therefore, we're still outside!
+	CM_ClipBoxToBrushResult( pTraceInfo, trace, brush, enterfrac, leavefrac, startout, getout, clipplane, leadside );
+}
 
-	// NOTE: We only do this test against points because fractionleftsolid is
-	// not possible to compute for brush sweeps without a *lot* more computation
-	// So, client code will never get fractionleftsolid for box sweeps
-	if (trace_ispoint && startout)
-	{ 
-		// Add a little sludge.  The sludge should already be in the fractionleftsolid
-		// (for all intents and purposes is a leavefrac value) and enterfrac values.  
-		// Both of these values have +/- DIST_EPSILON values calculated in.  Thus, I 
-		// think the test should be against "0.0."  If we experience new "left solid"
-		// problems you may want to take a closer look here!
-//		if ((trace->fractionleftsolid - enterfrac) > -1e-6)
-		if ((trace->fractionleftsolid - enterfrac) > 0.0f )
-			startout = false;
-	}
 
-	if (!startout)
-	{	// original point was inside brush
-		trace->startsolid = true;
-		// return starting contents
-		trace->contents = brush->contents;
+/*
+================
+CM_ClipBoxToBrushSSE
 
-		if (!getout)
-		{
-			trace->allsolid = true;
-			trace->fraction = 0.0f;
-			trace->fractionleftsolid = 1.0f;
+Same as CM_ClipBoxToBrushScalar, but the distances to each group of four
+sides are worked out at once.  The fractions are still done a side at a
+time in the same order so the result comes out exactly the same.
+================
+*/
+void FASTCALL CM_ClipBoxToBrushSSE( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+										     trace_t *trace, cbrush_t *brush )
+{
+	if (!brush->numsides)
+		return;
+
+	g_CollisionCounts.m_BrushTraces++;
+
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+
+	float enterfrac = NEVER_UPDATED;
+	float leavefrac = 1.f;
+	cplane_t* clipplane = NULL;
+
+	bool getout = false;
+	bool startout = false;
+	cbrushside_t* leadside = NULL;
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 p1x = _mm_set1_ps( p1[0] ), p1y = _mm_set1_ps( p1[1] ), p1z = _mm_set1_ps( p1[2] );
+	__m128 p2x = _mm_set1_ps( p2[0] ), p2y = _mm_set1_ps( p2[1] ), p2z = _mm_set1_ps( p2[2] );
+	__m128 minx = _mm_set1_ps( mins[0] ), miny = _mm_set1_ps( mins[1] ), minz = _mm_set1_ps( mins[2] );
+	__m128 maxx = _mm_set1_ps( maxs[0] ), maxy = _mm_set1_ps( maxs[1] ), maxz = _mm_set1_ps( maxs[2] );
+
+	float d1[4], d2[4];
+
+	int numgroups = ( brush->numsides + 3 ) >> 2;
+	const cbrushsidegroup_t *group = &pBSPData->map_brushsidegroups[brush->firstsidegroup];
+	for ( int g = 0; g < numgroups; g++, group++ )
+	{
+		__m128 nx = _mm_loadu_ps( group->normal[0] );
+		__m128 ny = _mm_loadu_ps( group->normal[1] );
+		__m128 nz = _mm_loadu_ps( group->normal[2] );
+		__m128 dist = _mm_loadu_ps( group->dist );
+		int skip = 0;
+
+		if (!pTraceInfo->m_ispoint)
+		{	// general box case, push the planes out apropriately for mins/maxs
+			__m128 ox = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( nx, zero ), maxx ), _mm_andnot_ps( _mm_cmplt_ps( nx, zero ), minx ) );
+			__m128 oy = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( ny, zero ), maxy ), _mm_andnot_ps( _mm_cmplt_ps( ny, zero ), miny ) );
+			__m128 oz = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( nz, zero ), maxz ), _mm_andnot_ps( _mm_cmplt_ps( nz, zero ), minz ) );
+
+			__m128 ofsdist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) );
+			dist = _mm_sub_ps( dist, ofsdist );
 		}
 		else
 		{
-			// if leavefrac == 1, this means it's never been updated or we're in allsolid
-			// the allsolid case was handled above
-			if ((leavefrac != 1) && (leavefrac > trace->fractionleftsolid))
-			{
-				trace->fractionleftsolid = leavefrac;
+			// don't trace rays against bevel planes 
+			skip = _mm_movemask_ps( _mm_loadu_ps( (const float *)group->bevel ) );
+		}
 
-				// This could occur if a previous trace didn't start us in solid
-				if (trace->fraction <= leavefrac)
+		__m128 v1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( p1x, nx ), _mm_mul_ps( p1y, ny ) ), _mm_mul_ps( p1z, nz ) ), dist );
+		__m128 v2 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( p2x, nx ), _mm_mul_ps( p2y, ny ) ), _mm_mul_ps( p2z, nz ) ), dist );
+
+		int front1 = _mm_movemask_ps( _mm_cmpgt_ps( v1, zero ) ) & ~skip;
+
+		// if completely in front of any face, no intersection
+		if ( front1 & _mm_movemask_ps( _mm_cmpgt_ps( v2, zero ) ) )
+			return;
+
+		// sides the trace stays behind don't matter
+		int cross = ( front1 | ~_mm_movemask_ps( _mm_cmple_ps( v2, zero ) ) ) & ~skip & 0xF;
+		if ( !cross )
+			continue;
+
+		if ( front1 )
+		{
+			startout = true;
+		}
+		if ( cross & ~front1 )
+		{
+			getout = true;
+		}
+
+		_mm_storeu_ps( d1, v1 );
+		_mm_storeu_ps( d2, v2 );
+
+		for ( int k = 0; k < 4; k++ )
+		{
+			if ( !( cross & ( 1 << k ) ) )
+				continue;
+
+			// crosses face
+			if (d1[k] > d2[k])
+			{	// enter
+				float f = (d1[k]-DIST_EPSILON);
+				if ( f < 0.f )
+					f = 0.f;
+				f = f / (d1[k]-d2[k]);
+				if (f > enterfrac)
 				{
-					trace->fraction = 1.0f;
-					trace->surface = nullsurface;
+					enterfrac = f;
+					leadside = &pBSPData->map_brushsides[brush->firstbrushside+min( g * 4 + k, brush->numsides - 1 )];
+					clipplane = leadside->plane;
 				}
 			}
+			else
+			{	// leave
+				float f = (d1[k]+DIST_EPSILON) / (d1[k]-d2[k]);
+				if (f < leavefrac)
+					leavefrac = f;
+			}
 		}
-		return;
 	}
 
-	// We haven't hit anything at all until we've left...
-	if (enterfrac < leavefrac)
+	CM_ClipBoxToBrushResult( pTraceInfo, trace, brush, enterfrac, leavefrac, startout, getout, clipplane, leadside );
+}
+
+/*
+================
+CM_TestBoxInBrush
+================
+*/
+void CM_TestBoxInBrush( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
+					    trace_t *trace, cbrush_t *brush )
+{
+	if ( g_bBrushClipRecording )
 	{
-		if (enterfrac > NEVER_UPDATED && enterfrac < trace->fraction)
-		{
-			if (enterfrac < 0)
-				enterfrac = 0;
-			trace->fraction = enterfrac;
-			trace_bDispHit = false;
-			trace->plane = *clipplane;
-			trace->surface = *leadside->surface;
-			trace->contents = brush->contents;
-		}
+		BrushClip_Record( BRUSHCLIP_TEST, pTraceInfo, mins, maxs, p1, p1, trace, brush );
+	}
+
+	if ( pTraceInfo->m_bBrushSSE )
+	{
+		CM_TestBoxInBrushSSE( pTraceInfo, mins, maxs, p1, trace, brush );
+	}
+	else
+	{
+		CM_TestBoxInBrushScalar( pTraceInfo, mins, maxs, p1, trace, brush );
 	}
 }
 
+
 /*
 ================
-CM_TestBoxInBrush
+CM_TestBoxInBrushScalar
 ================
 */
-void CM_TestBoxInBrush( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, const Vector& p1,
+void CM_TestBoxInBrushScalar( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
 					    trace_t *trace, cbrush_t *brush )
 {
 	int			i, j;
@@ -977,6 +1355,8 @@ void CM_TestBoxInBrush( CCollisionBSPData *pBSPData, const Vector& mins, const V
 	if (!brush->numsides)
 		return;
 
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+
 	for (i=0 ; i<brush->numsides ; i++)
 	{
 		side = &pBSPData->map_brushsides[brush->firstbrushside+i];
@@ -1015,17 +1395,67 @@ void CM_TestBoxInBrush( CCollisionBSPData *pBSPData, const Vector& mins, const V
 }
 
 
+/*
+================
+CM_TestBoxInBrushSSE
+================
+*/
+void CM_TestBoxInBrushSSE( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
+					    trace_t *trace, cbrush_t *brush )
+{
+	if (!brush->numsides)
+		return;
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 p1x = _mm_set1_ps( p1[0] ), p1y = _mm_set1_ps( p1[1] ), p1z = _mm_set1_ps( p1[2] );
+	__m128 minx = _mm_set1_ps( mins[0] ), miny = _mm_set1_ps( mins[1] ), minz = _mm_set1_ps( mins[2] );
+	__m128 maxx = _mm_set1_ps( maxs[0] ), maxy = _mm_set1_ps( maxs[1] ), maxz = _mm_set1_ps( maxs[2] );
+
+	int numgroups = ( brush->numsides + 3 ) >> 2;
+	const cbrushsidegroup_t *group = &pTraceInfo->m_pBSPData->map_brushsidegroups[brush->firstsidegroup];
+	for ( int g = 0; g < numgroups; g++, group++ )
+	{
+		__m128 nx = _mm_loadu_ps( group->normal[0] );
+		__m128 ny = _mm_loadu_ps( group->normal[1] );
+		__m128 nz = _mm_loadu_ps( group->normal[2] );
+
+		// push the planes out apropriately for mins/maxs
+		__m128 ox = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( nx, zero ), maxx ), _mm_andnot_ps( _mm_cmplt_ps( nx, zero ), minx ) );
+		__m128 oy = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( ny, zero ), maxy ), _mm_andnot_ps( _mm_cmplt_ps( ny, zero ), miny ) );
+		__m128 oz = _mm_or_ps( _mm_and_ps( _mm_cmplt_ps( nz, zero ), maxz ), _mm_andnot_ps( _mm_cmplt_ps( nz, zero ), minz ) );
+
+		__m128 ofsdist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) );
+		__m128 dist = _mm_sub_ps( _mm_loadu_ps( group->dist ), ofsdist );
+
+		__m128 d1 = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( p1x, nx ), _mm_mul_ps( p1y, ny ) ), _mm_mul_ps( p1z, nz ) ), dist );
+
+		// if completely in front of face, no intersection
+		if ( _mm_movemask_ps( _mm_cmpgt_ps( d1, zero ) ) )
+			return;
+	}
+
+	// inside this brush
+	trace->startsolid = trace->allsolid = true;
+	trace->fraction = 0;
+	trace->fractionleftsolid = 1.0f;
+	trace->contents = brush->contents;
+}
+
+
 /*
 ================
 CM_TraceToLeaf
 ================
 */
-void FASTCALL CM_TraceToLeaf( CCollisionBSPData *pBSPData, int ndxLeaf, float startFrac, float endFrac )
+void FASTCALL CM_TraceToLeaf( TraceInfo_t *pTraceInfo, int ndxLeaf, float startFrac, float endFrac )
 {
-	int nCurrentCheckCount = CurrentCheckCount();
-	int nDepth = CurrentCheckCountDepth();
+	int nCurrentCheckCount = CurrentCheckCount( pTraceInfo );
+	int nDepth = CurrentCheckCountDepth( pTraceInfo );
+	int *pBrushCounts = pTraceInfo->m_BrushCounts[nDepth].Base();
+	trace_t *pTrace = &pTraceInfo->m_trace;
 
 	// get the leaf
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
 	cleaf_t *pLeaf = &pBSPData->map_leafs[ndxLeaf];
 
 	//
@@ -1038,28 +1468,28 @@ void FASTCALL CM_TraceToLeaf( CCollisionBSPData *pBSPData, int ndxLeaf, float st
 		cbrush_t *pBrush = &pBSPData->map_brushes[ndxBrush];
 
 		// make sure we only check this brush once per trace/stab
-		if( pBrush->checkcount[nDepth] == nCurrentCheckCount )
+		if( pBrushCounts[ndxBrush] == nCurrentCheckCount )
 			continue;
 
 		// mark the brush as checked
-		pBrush->checkcount[nDepth] = nCurrentCheckCount;
+		pBrushCounts[ndxBrush] = nCurrentCheckCount;
 
 		// only collide with objects you are interested in
-		if( !( pBrush->contents & trace_contents ) )
+		if( !( pBrush->contents & pTraceInfo->m_contents ) )
 			continue;
 
 		// trace against the brush and find impact point -- if any?
-		// NOTE: trace_trace.fraction == 0.0f only when trace starts inside of a brush!
-		CM_ClipBoxToBrush( pBSPData, trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, pBrush );
-		if( !trace_trace.fraction )
+		// NOTE: pTrace->fraction == 0.0f only when trace starts inside of a brush!
+		CM_ClipBoxToBrush( pTraceInfo, pTraceInfo->m_mins, pTraceInfo->m_maxs, pTraceInfo->m_start, pTraceInfo->m_end, pTrace, pBrush );
+		if( !pTrace->fraction )
 			return;
 	}
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 
 	// TODO: this may be redundant
-	if( trace_trace.startsolid )
+	if( pTrace->startsolid )
 		return;
 
 	// Collide (test) against displacement surfaces in this leaf.
@@ -1068,35 +1498,37 @@ void FASTCALL CM_TraceToLeaf( CCollisionBSPData *pBSPData, int ndxLeaf, float st
 		//
 		// trace ray/swept box against all displacement surfaces in this leaf
 		//
+		int *pDispCounts = pTraceInfo->m_DispCounts[nDepth].Base();
 		for( CDispIterator it( pLeaf->m_pDisplacements, CDispLeafLink::LIST_LEAF ); it.IsValid(); )
 		{
 			CDispCollTree *pDispTree = static_cast<CDispCollTree*>( it.Inc()->m_pDispInfo );
+			int ndxDisp = pDispTree - g_pDispCollTrees;
 			
 			// make sure we only check this brush once per trace/stab
-			if( pDispTree->GetCheckCount(nDepth) == nCurrentCheckCount )
+			if( pDispCounts[ndxDisp] == nCurrentCheckCount )
 				continue;
 			
 			// mark the brush as checked
-			if( !trace_ispoint )
+			if( !pTraceInfo->m_ispoint )
 			{
-				pDispTree->SetCheckCount( nDepth, nCurrentCheckCount );
+				pDispCounts[ndxDisp] = nCurrentCheckCount;
 			}
 			
 			// only collide with objects you are interested in
-			if( !( pDispTree->GetContents() & trace_contents ) )
+			if( !( pDispTree->GetContents() & pTraceInfo->m_contents ) )
 				continue;
 
-			CM_TraceToDispTree( pDispTree, trace_start, trace_end, trace_mins, trace_maxs, 
-				                startFrac, endFrac, &trace_trace, ( trace_ispoint == 1 ) );
-			if( !trace_trace.fraction )
+			CM_TraceToDispTree( pTraceInfo, pDispTree, pTraceInfo->m_start, pTraceInfo->m_end, pTraceInfo->m_mins, pTraceInfo->m_maxs, 
+				                startFrac, endFrac, pTrace, ( pTraceInfo->m_ispoint == 1 ) );
+			if( !pTrace->fraction )
 				break;
 		}
 		
-		CM_PostTraceToDispTree();
+		CM_PostTraceToDispTree( pTraceInfo );
 	}
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 }
 
 
@@ -1105,12 +1537,15 @@ void FASTCALL CM_TraceToLeaf( CCollisionBSPData *pBSPData, int ndxLeaf, float st
 CM_TestInLeaf
 ================
 */
-void CM_TestInLeaf( CCollisionBSPData *pBSPData, int ndxLeaf )
+void CM_TestInLeaf( TraceInfo_t *pTraceInfo, int ndxLeaf )
 {
-	int nCurrentCheckCount = CurrentCheckCount();
-	int nDepth = CurrentCheckCountDepth();
+	int nCurrentCheckCount = CurrentCheckCount( pTraceInfo );
+	int nDepth = CurrentCheckCountDepth( pTraceInfo );
+	int *pBrushCounts = pTraceInfo->m_BrushCounts[nDepth].Base();
+	trace_t *pTrace = &pTraceInfo->m_trace;
 
 	// get the leaf
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
 	cleaf_t *pLeaf = &pBSPData->map_leafs[ndxLeaf];
 
 	//
@@ -1123,41 +1558,41 @@ void CM_TestInLeaf( CCollisionBSPData *pBSPData, int ndxLeaf )
 		cbrush_t *pBrush = &pBSPData->map_brushes[ndxBrush];
 
 		// make sure we only check this brush once per trace/stab
-		if( pBrush->checkcount[nDepth] == nCurrentCheckCount )
+		if( pBrushCounts[ndxBrush] == nCurrentCheckCount )
 			continue;
 
 		// mark the brush as checked
-		pBrush->checkcount[nDepth] = nCurrentCheckCount;
+		pBrushCounts[ndxBrush] = nCurrentCheckCount;
 
 		// only collide with objects you are interested in
-		if( !( pBrush->contents & trace_contents ) )
+		if( !( pBrush->contents & pTraceInfo->m_contents ) )
 			continue;
 
 		//
 		// test to see if the point/box is inside of any solid
-		// NOTE: trace_trace.fraction == 0.0f only when trace starts inside of a brush!
+		// NOTE: pTrace->fraction == 0.0f only when trace starts inside of a brush!
 		//
-		CM_TestBoxInBrush( pBSPData, trace_mins, trace_maxs, trace_start, &trace_trace, pBrush );
-		if( !trace_trace.fraction )
+		CM_TestBoxInBrush( pTraceInfo, pTraceInfo->m_mins, pTraceInfo->m_maxs, pTraceInfo->m_start, pTrace, pBrush );
+		if( !pTrace->fraction )
 			return;
 	}
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 
 	// TODO: this may be redundant
-	if( trace_trace.startsolid )
+	if( pTrace->startsolid )
 		return;
 
 	// if there are no displacement surfaces in this leaf -- we are done testing
 	if( pLeaf->m_pDisplacements )
 	{
 		// test to see if the point/box is inside of any of the displacement surface
-		CM_TestInDispTree( pBSPData, pLeaf, trace_start, trace_mins, trace_maxs, trace_contents, &trace_trace );
+		CM_TestInDispTree( pTraceInfo, pLeaf, pTraceInfo->m_start, pTraceInfo->m_mins, pTraceInfo->m_maxs, pTraceInfo->m_contents, pTrace );
 	}
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 }
 
 
@@ -1168,12 +1603,15 @@ CM_RecursiveHullCheck
 ==================
 Attempt to do whatever is nessecary to get this function to unroll at least once
 */
-void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData,
+void FASTCALL CM_RecursiveHullCheck ( TraceInfo_t *pTraceInfo,
 	int num, float p1f, float p2f, const Vector& p1, const Vector& p2)
 {
-	if (trace_trace.fraction <= p1f)
+	if (pTraceInfo->m_trace.fraction <= p1f)
 		return;		// already hit something nearer
 
+	cnode_t		*pRootNode = pTraceInfo->m_pRootNode;
+	const Vector &extents = pTraceInfo->m_extents;
+
 	cnode_t		*node = NULL;
 	cplane_t	*plane;
 	float		t1 = 0, t2 = 0, offset = 0;
@@ -1189,18 +1627,18 @@ void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData,
 
 	// NJS: Hoisted loop invariant comparison to trace_ispoint
 
-	if( trace_ispoint )
+	if( pTraceInfo->m_ispoint )
 	{
 		while( num >= 0 )
 		{
-			node = pBSPData->map_rootnode + num;
+			node = pRootNode + num;
 			plane = node->plane;
 
 			if (plane->type < 3)
 			{
 				t1 = p1[plane->type] - plane->dist;
 				t2 = p2[plane->type] - plane->dist;
-				offset = trace_extents[plane->type];
+				offset = extents[plane->type];
 			}
 			else
 			{
@@ -1227,22 +1665,22 @@ void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData,
 	{
 		while( num >= 0 )
 		{
-			node = pBSPData->map_rootnode + num;
+			node = pRootNode + num;
 			plane = node->plane;
 
 			if (plane->type < 3)
 			{
 				t1 = p1[plane->type] - plane->dist;
 				t2 = p2[plane->type] - plane->dist;
-				offset = trace_extents[plane->type];
+				offset = extents[plane->type];
 			}
 			else
 			{
 				t1 = DotProduct (plane->normal, p1) - plane->dist;
 				t2 = DotProduct (plane->normal, p2) - plane->dist;
-				offset = fabs(trace_extents[0]*plane->normal[0]) +
-						 fabs(trace_extents[1]*plane->normal[1]) +
-						 fabs(trace_extents[2]*plane->normal[2]);
+				offset = fabs(extents[0]*plane->normal[0]) +
+						 fabs(extents[1]*plane->normal[1]) +
+						 fabs(extents[2]*plane->normal[2]);
 			}
 
 			// see which sides we need to consider
@@ -1265,7 +1703,7 @@ void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData,
 	// if < 0, we are in a leaf node
 	if (num < 0)
 	{
-		CM_TraceToLeaf (pBSPData, -1-num, p1f, p2f);
+		CM_TraceToLeaf (pTraceInfo, -1-num, p1f, p2f);
 		return;
 	}
 	
@@ -1296,14 +1734,14 @@ void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData,
 	midf = p1f + (p2f - p1f)*frac;
 	VectorLerp( p1, p2, frac, mid );
 
-	CM_RecursiveHullCheck (pBSPData, node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck (pTraceInfo, node->children[side], p1f, midf, p1, mid);
 
 	// go past the node
 	frac2 = clamp( frac2, 0, 1 );
 	midf = p1f + (p2f - p1f)*frac2;
 	VectorLerp( p1, p2, frac2, mid );
 
-	CM_RecursiveHullCheck (pBSPData, node->children[side^1], midf, p2f, mid, p2);
+	CM_RecursiveHullCheck (pTraceInfo, node->children[side^1], midf, p2f, mid, p2);
 }
 
 void CM_ClearTrace( trace_t *trace )
@@ -1331,12 +1769,12 @@ static inline void CM_ComputeTraceEndpoints( const Ray_t& ray, trace_t& tr )
 	Vector start;
 	VectorAdd( ray.m_Start, ray.m_StartOffset, start );
 
-	if (trace_trace.fraction == 1)
+	if (tr.fraction == 1)
 		VectorAdd(start, ray.m_Delta, tr.endpos);
 	else
 		VectorMA( start, tr.fraction, ray.m_Delta, tr.endpos );
 
-	if (trace_trace.fractionleftsolid == 0)
+	if (tr.fractionleftsolid == 0)
 	{
 		VectorCopy (start, tr.startpos);
 	}
@@ -1357,9 +1795,12 @@ static inline void CM_ComputeTraceEndpoints( const Ray_t& ray, trace_t& tr )
 // Test an unswept box
 //-----------------------------------------------------------------------------
 
-static inline void CM_UnsweptBoxTrace( CCollisionBSPData *pBSPData, 
+static inline void CM_UnsweptBoxTrace( TraceInfo_t *pTraceInfo, 
 								const Ray_t& ray, int headnode, int brushmask )
 {
+	CCollisionBSPData *pBSPData = pTraceInfo->m_pBSPData;
+	trace_t *pTrace = &pTraceInfo->m_trace;
+
 	int		leafs[1024];
 	int		i, numleafs;
 	Vector	boxMins, boxMaxs;
@@ -1376,7 +1817,7 @@ static inline void CM_UnsweptBoxTrace( CCollisionBSPData *pBSPData,
 	}
 
 	bool bFoundNonSolidLeaf = false;
-	numleafs = CM_BoxLeafnums_headnode ( pBSPData, boxMins, boxMaxs, leafs, 1024, headnode, &topnode);
+	numleafs = CM_BoxLeafnums_headnode ( pTraceInfo->m_pRootNode, boxMins, boxMaxs, leafs, 1024, headnode, &topnode);
 	for (i=0 ; i<numleafs ; i++)
 	{
 		if ((pBSPData->map_leafs[leafs[i]].contents & CONTENTS_SOLID) == 0)
@@ -1384,78 +1825,156 @@ static inline void CM_UnsweptBoxTrace( CCollisionBSPData *pBSPData,
 			bFoundNonSolidLeaf = true;
 		}
 
-		CM_TestInLeaf ( pBSPData, leafs[i] );
-		if (trace_trace.allsolid)
+		CM_TestInLeaf ( pTraceInfo, leafs[i] );
+		if (pTrace->allsolid)
 			break;
 	}
 
 	if (!bFoundNonSolidLeaf)
 	{
-		trace_trace.allsolid = trace_trace.startsolid = 1;
-		trace_trace.fraction = 0.0f;
-		trace_trace.fractionleftsolid = 1.0f;
+		pTrace->allsolid = pTrace->startsolid = 1;
+		pTrace->fraction = 0.0f;
+		pTrace->fractionleftsolid = 1.0f;
 	}
 }
 
-void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr )
+static void CM_BoxTraceInternal( TraceInfo_t *pTraceInfo, const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr )
 {
 	g_EngineStats.IncrementCountedStat( ENGINE_STATS_NUM_BOX_TRACES, 1 );
 	MEASURE_TIMED_STAT( ENGINE_STATS_BOX_TRACE_TIME );
 	
 	// for multi-check avoidance
-	BeginCheckCount();		
+	BeginCheckCount( pTraceInfo );
 
 	// for statistics, may be zeroed
 	g_CollisionCounts.m_Traces++;		
 
 	// fill in a default trace
-	CM_ClearTrace( &trace_trace );
-
-	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	trace_t *pTrace = &pTraceInfo->m_trace;
+	CM_ClearTrace( pTrace );
 
 	// check if the map is not loaded
-	if (!pBSPData->numnodes)	
+	if (!pTraceInfo->m_pBSPData->numnodes)	
 	{
-		tr = trace_trace;
-		EndCheckCount();
+		tr = *pTrace;
+		EndCheckCount( pTraceInfo );
 		return;
 	}
 
-	trace_bDispHit = false;
-	trace_StabDir.Init();
-	trace_contents = brushmask;
-	VectorCopy (ray.m_Start, trace_start);
-	VectorAdd  (ray.m_Start, ray.m_Delta, trace_end);
-	VectorMultiply (ray.m_Extents, -1.0f, trace_mins);
-	VectorCopy (ray.m_Extents, trace_maxs);
-	VectorCopy (ray.m_Extents, trace_extents);
-	trace_ispoint = ray.m_IsRay;
+	pTraceInfo->m_bDispHit = false;
+	pTraceInfo->m_StabDir.Init();
+	pTraceInfo->m_contents = brushmask;
+	VectorCopy (ray.m_Start, pTraceInfo->m_start);
+	VectorAdd  (ray.m_Start, ray.m_Delta, pTraceInfo->m_end);
+	VectorMultiply (ray.m_Extents, -1.0f, pTraceInfo->m_mins);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_maxs);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_extents);
+	pTraceInfo->m_ispoint = ray.m_IsRay;
 
 
 	if (!ray.m_IsSwept)
 	{
 		// check for position test special case
-		CM_UnsweptBoxTrace( pBSPData, ray, headnode, brushmask );
+		CM_UnsweptBoxTrace( pTraceInfo, ray, headnode, brushmask );
 	}
 	else
 	{
 		// general sweeping through world
-		CM_RecursiveHullCheck( pBSPData, headnode, 0, 1, trace_start, trace_end );
+		CM_RecursiveHullCheck( pTraceInfo, headnode, 0, 1, pTraceInfo->m_start, pTraceInfo->m_end );
 	}
 	// Compute the trace start + end points
 	if (computeEndpt)
 	{
-		CM_ComputeTraceEndpoints( ray, trace_trace );
+		CM_ComputeTraceEndpoints( ray, *pTrace );
 	}
 
 	// Copy off the results
-	tr = trace_trace;
-	EndCheckCount();
+	tr = *pTrace;
+	EndCheckCount( pTraceInfo );
 	Assert( !ray.m_IsRay || tr.allsolid || (tr.fraction >= tr.fractionleftsolid) );
 }
 
+void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr )
+{
+	TraceInfo_t *pTraceInfo = CM_BeginTrace();
+	CM_BoxTraceInternal( pTraceInfo, ray, headnode, brushmask, computeEndpt, tr );
+	CM_EndTrace( pTraceInfo );
+}
 
-void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
+
+//-----------------------------------------------------------------------------
+// Walks down from headnode while the box is all on one side of each node.
+// Anything inside the box takes the same path, so its traces can start from
+// the node this returns.
+//-----------------------------------------------------------------------------
+static int CM_BoxTopNode( cnode_t *pRootNode, const Vector& mins, const Vector& maxs, int headnode )
+{
+	int nodenum = headnode;
+	while (nodenum >= 0)
+	{
+		cnode_t *node = &pRootNode[nodenum];
+		int s = BoxOnPlaneSide2( mins, maxs, node->plane );
+		if (s == 1)
+			nodenum = node->children[0];
+		else if (s == 2)
+			nodenum = node->children[1];
+		else
+			break;
+	}
+	return nodenum;
+}
+
+
+//-----------------------------------------------------------------------------
+// Traces a packet of rays, sharing the descent down to the first node that
+// splits them
+//-----------------------------------------------------------------------------
+void CM_BoxTraces( const Ray_t *pRays, int nRays, int headnode, int brushmask, bool computeEndpt, trace_t *pTraces )
+{
+	if (nRays <= 0)
+		return;
+
+	TraceInfo_t *pTraceInfo = CM_BeginTrace();
+
+	int topnode = headnode;
+	if (pTraceInfo->m_pBSPData->numnodes && nRays > 1)
+	{
+		// Everything the packet sweeps through.  This is bloated more than
+		// CM_UnsweptBoxTrace bloats its box, so that box is inside this one,
+		// and enough that CM_RecursiveHullCheck never sees a plane the
+		// whole packet isn't clear of.
+		Vector mins, maxs;
+		ClearBounds( mins, maxs );
+		for (int i=0 ; i<nRays ; i++)
+		{
+			Vector start, end;
+			VectorSubtract( pRays[i].m_Start, pRays[i].m_Extents, start );
+			VectorAdd( pRays[i].m_Start, pRays[i].m_Extents, end );
+			AddPointToBounds( start, mins, maxs );
+			AddPointToBounds( end, mins, maxs );
+			AddPointToBounds( start + pRays[i].m_Delta, mins, maxs );
+			AddPointToBounds( end + pRays[i].m_Delta, mins, maxs );
+		}
+
+		for (int j=0 ; j<3 ; j++)
+		{
+			mins[j] -= 2;
+			maxs[j] += 2;
+		}
+
+		topnode = CM_BoxTopNode( pTraceInfo->m_pRootNode, mins, maxs, headnode );
+	}
+
+	for (int i=0 ; i<nRays ; i++)
+	{
+		CM_BoxTraceInternal( pTraceInfo, pRays[i], topnode, brushmask, computeEndpt, pTraces[i] );
+	}
+
+	CM_EndTrace( pTraceInfo );
+}
+
+
+static void CM_TransformedBoxTraceInternal( TraceInfo_t *pTraceInfo, const Ray_t& ray, int headnode, int brushmask,
 							const Vector& origin, QAngle const& angles, trace_t& tr )
 {
 	matrix3x4_t	localToWorld;
@@ -1468,7 +1987,7 @@ void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
 	VectorCopy( ray.m_Extents, ray_l.m_Extents );
 
 	// Are we rotated?
-	bool rotated = (headnode != box_headnode) && (angles[0] || angles[1] || angles[2]);
+	bool rotated = !CM_IsBoxHull( headnode ) && (angles[0] || angles[1] || angles[2]);
 
 	// rotate start and end into the models frame of reference
 	if (rotated)
@@ -1493,7 +2012,7 @@ void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
 	ray_l.m_IsSwept = ray.m_IsSwept;
 
 	// sweep the box through the model, don't compute endpoints
-	CM_BoxTrace( ray_l, headnode, brushmask, false, tr );
+	CM_BoxTraceInternal( pTraceInfo, ray_l, headnode, brushmask, false, tr );
 
 	// If we hit, gotta fix up the normal...
 	if (( tr.fraction != 1 ) && rotated )
@@ -1507,6 +2026,27 @@ void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
 	CM_ComputeTraceEndpoints( ray, tr );
 }
 
+void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
+							const Vector& origin, QAngle const& angles, trace_t& tr )
+{
+	TraceInfo_t *pTraceInfo = CM_BeginTrace();
+	CM_TransformedBoxTraceInternal( pTraceInfo, ray, headnode, brushmask, origin, angles, tr );
+	CM_EndTrace( pTraceInfo );
+}
+
+//-----------------------------------------------------------------------------
+// Same as CM_HeadnodeForBoxHull + CM_TransformedBoxTrace, but with the trace's
+// own box hull, so it can be called from any thread
+//-----------------------------------------------------------------------------
+void CM_TransformedBoxTraceToBox( const Ray_t& ray, const Vector& mins, const Vector& maxs, int brushmask,
+								  const Vector& origin, trace_t& tr )
+{
+	TraceInfo_t *pTraceInfo = CM_BeginTrace();
+	int headnode = CM_SetBoxHull( pTraceInfo->m_pBSPData, pTraceInfo->m_nBoxHull, mins, maxs );
+	CM_TransformedBoxTraceInternal( pTraceInfo, ray, headnode, brushmask, origin, vec3_angle, tr );
+	CM_EndTrace( pTraceInfo );
+}
+
 int CM_TransformedBoxContents( const Vector& pos, const Vector& mins, const Vector& maxs, int headnode, const Vector& origin, QAngle const& angles )
 {
 	Ray_t ray;
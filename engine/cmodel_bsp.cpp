@@ -33,6 +33,7 @@ void CollisionBSPData_LoadLeafBrushes( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadPlanes( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadBrushes( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadBrushSides( CCollisionBSPData *pBSPData, CUtlVector<unsigned short> &map_texinfo );
+void CollisionBSPData_LoadBrushSideGroups( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadSubmodels( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadNodes( CCollisionBSPData *pBSPData );
 void CollisionBSPData_LoadAreas( CCollisionBSPData *pBSPData );
@@ -157,6 +158,12 @@ void CollisionBSPData_Destroy( CCollisionBSPData *pBSPData )
 		pBSPData->map_brushsides.Detach();
 	}
 
+	if ( pBSPData->map_brushsidegroups.Base() )
+	{
+		free( pBSPData->map_brushsidegroups.Base() );
+		pBSPData->map_brushsidegroups.Detach();
+	}
+
 	if ( pBSPData->map_vis )
 	{
 		free( pBSPData->map_vis );
@@ -165,6 +172,7 @@ void CollisionBSPData_Destroy( CCollisionBSPData *pBSPData )
 
 	pBSPData->numplanes = 0;
 	pBSPData->numbrushsides = 0;
+	pBSPData->numbrushsidegroups = 0;
 	pBSPData->emptyleaf = pBSPData->solidleaf =0;
 	pBSPData->numnodes = 0;
 	pBSPData->numleafs = 0;
@@ -252,6 +260,7 @@ bool CollisionBSPData_Load( const char *pName, CCollisionBSPData *pBSPData )
 	CollisionBSPData_LoadPlanes( pBSPData );
 	CollisionBSPData_LoadBrushes( pBSPData );
 	CollisionBSPData_LoadBrushSides( pBSPData, map_texinfo );
+	CollisionBSPData_LoadBrushSideGroups( pBSPData );
 	CollisionBSPData_LoadSubmodels( pBSPData );
 	CollisionBSPData_LoadNodes( pBSPData );
 	CollisionBSPData_LoadAreas( pBSPData );
@@ -401,9 +410,9 @@ void CollisionBSPData_LoadLeafs( CCollisionBSPData *pBSPData )
 	}
 
 	// Need an extra one for the emptyleaf below, another extra one
-	// needed for CM_InitBoxHull
-	int nSize = (count + 2) * sizeof(cleaf_t);
-	pBSPData->map_leafs.Attach( count + 2, (cleaf_t*)malloc( nSize ) );
+	// needed for each of CM_InitBoxHull's hulls
+	int nSize = (count + 1 + MAX_BOX_HULLS) * sizeof(cleaf_t);
+	pBSPData->map_leafs.Attach( count + 1 + MAX_BOX_HULLS, (cleaf_t*)malloc( nSize ) );
 	memset( pBSPData->map_leafs.Base(), 0, nSize );
 
 	pBSPData->numleafs = count;
@@ -466,8 +475,8 @@ void CollisionBSPData_LoadLeafBrushes( CCollisionBSPData *pBSPData )
 		Sys_Error( "Map has too many leafbrushes");
 	}
 
-	// Extra one added for CM_InitBoxHull
-	pBSPData->map_leafbrushes.Attach( count + 1, (unsigned short*)malloc( ( count + 1 ) * sizeof(unsigned short) ) );
+	// Extra one added for each of CM_InitBoxHull's hulls
+	pBSPData->map_leafbrushes.Attach( count + MAX_BOX_HULLS, (unsigned short*)malloc( ( count + MAX_BOX_HULLS ) * sizeof(unsigned short) ) );
 	pBSPData->numleafbrushes = count;
 
 	for ( i=0 ; i<count ; i++, in++)
@@ -507,9 +516,9 @@ void CollisionBSPData_LoadPlanes( CCollisionBSPData *pBSPData )
 		Sys_Error( "Map has too many planes");
 	}
 
-	// Add extra room for CM_InitBoxHull
-	int nSize = ( count + 12 ) * sizeof(cplane_t);
-	pBSPData->map_planes.Attach( count + 12, (cplane_t*)malloc( nSize ) );
+	// Add extra room for CM_InitBoxHull, 12 per hull
+	int nSize = ( count + 12 * MAX_BOX_HULLS ) * sizeof(cplane_t);
+	pBSPData->map_planes.Attach( count + 12 * MAX_BOX_HULLS, (cplane_t*)malloc( nSize ) );
 	memset( pBSPData->map_planes.Base(), 0, nSize );
 
 	pBSPData->numplanes = count;
@@ -555,9 +564,9 @@ void CollisionBSPData_LoadBrushes( CCollisionBSPData *pBSPData )
 		Sys_Error( "Map has too many brushes");
 	}
 
-	// Extra one for CM_InitBoxHull
-	int nSize = ( count + 1 ) * sizeof(cbrush_t);
-	pBSPData->map_brushes.Attach( count+1, (cbrush_t*)malloc( nSize ) );
+	// Extra one for each of CM_InitBoxHull's hulls
+	int nSize = ( count + MAX_BOX_HULLS ) * sizeof(cbrush_t);
+	pBSPData->map_brushes.Attach( count + MAX_BOX_HULLS, (cbrush_t*)malloc( nSize ) );
 	memset( pBSPData->map_brushes.Base(), 0, nSize );
 
 	pBSPData->numbrushes = count;
@@ -598,9 +607,9 @@ void CollisionBSPData_LoadBrushSides( CCollisionBSPData *pBSPData, CUtlVector<un
 		Sys_Error( "Map has too many planes");
 	}
 
-	// Extra 6 for CM_InitBoxHull
-	int nSize = ( count + 6 ) * sizeof(cbrushside_t);
-	pBSPData->map_brushsides.Attach( count + 6, (cbrushside_t*)malloc( nSize ) );
+	// Extra 6 for each of CM_InitBoxHull's hulls
+	int nSize = ( count + 6 * MAX_BOX_HULLS ) * sizeof(cbrushside_t);
+	pBSPData->map_brushsides.Attach( count + 6 * MAX_BOX_HULLS, (cbrushside_t*)malloc( nSize ) );
 	memset( pBSPData->map_brushsides.Base(), 0, nSize );
 
 	pBSPData->numbrushsides = count;
@@ -632,6 +641,41 @@ void CollisionBSPData_LoadBrushSides( CCollisionBSPData *pBSPData, CUtlVector<un
 }
 
 
+//-----------------------------------------------------------------------------
+// Packs each brush's sides into groups of four, see cbrushsidegroup_t
+//-----------------------------------------------------------------------------
+void CollisionBSPData_LoadBrushSideGroups( CCollisionBSPData *pBSPData )
+{
+	int		i;
+	int		count = 0;
+
+	for ( i=0 ; i<pBSPData->numbrushes ; i++ )
+	{
+		cbrush_t *brush = &pBSPData->map_brushes[i];
+		if ( brush->firstbrushside < 0 || brush->numsides < 0 || 
+			brush->firstbrushside + brush->numsides > pBSPData->numbrushsides )
+		{
+			Sys_Error( "CMod_LoadBrushSideGroups: bad brush sides");
+		}
+
+		brush->firstsidegroup = count;
+		count += ( brush->numsides + 3 ) >> 2;
+	}
+
+	// Extra 2 for each of CM_InitBoxHull's hulls
+	int nSize = ( count + 2 * MAX_BOX_HULLS ) * sizeof(cbrushsidegroup_t);
+	pBSPData->map_brushsidegroups.Attach( count + 2 * MAX_BOX_HULLS, (cbrushsidegroup_t*)malloc( nSize ) );
+	memset( pBSPData->map_brushsidegroups.Base(), 0, nSize );
+
+	pBSPData->numbrushsidegroups = count;
+
+	for ( i=0 ; i<pBSPData->numbrushes ; i++ )
+	{
+		CM_BuildBrushSideGroups( pBSPData, &pBSPData->map_brushes[i] );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CollisionBSPData_LoadSubmodels( CCollisionBSPData *pBSPData )
@@ -691,9 +735,9 @@ void CollisionBSPData_LoadNodes( CCollisionBSPData *pBSPData )
 	if (count > MAX_MAP_NODES)
 		Sys_Error( "Map has too many nodes");
 
-	// 6 extra for box hull
-	int nSize = ( count + 6 ) * sizeof(cnode_t);
-	pBSPData->map_nodes.Attach( count + 6, (cnode_t*)malloc( nSize ) );
+	// 6 extra for each box hull
+	int nSize = ( count + 6 * MAX_BOX_HULLS ) * sizeof(cnode_t);
+	pBSPData->map_nodes.Attach( count + 6 * MAX_BOX_HULLS, (cnode_t*)malloc( nSize ) );
 	memset( pBSPData->map_nodes.Base(), 0, nSize );
 
 	pBSPData->numnodes = count;
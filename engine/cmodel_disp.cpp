@@ -13,9 +13,6 @@
 #include "collisionutils.h"
 #include "enginestats.h"
 
-Vector trace_StabDir;		// the direction to stab in
-int trace_bDispHit;			// hit displacement surface last
-
 int g_DispCollTreeCount = 0;
 CDispCollTree *g_pDispCollTrees = NULL;
 
@@ -23,18 +20,18 @@ CDispCollTree *g_pDispCollTrees = NULL;
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-void SetDispTraceSurfaceProps( trace_t *pTrace, CDispCollTree *pDisp )
+void SetDispTraceSurfaceProps( trace_t *pTrace, short surfaceProp )
 {
 	// use the default surface properties
 	pTrace->surface.name = "**displacement**";
 	pTrace->surface.flags = 0;
-	pTrace->surface.surfaceProps = pDisp->GetCollisionSurfProp();
+	pTrace->surface.surfaceProps = surfaceProp;
 }
 
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_PreStab( cleaf_t *pLeaf, Vector &vStabDir, int collisionMask, int &contents )
+void CM_PreStab( TraceInfo_t *pTraceInfo, cleaf_t *pLeaf, Vector &vStabDir, int collisionMask, int &contents )
 {
 	if( !pLeaf->m_pDisplacements )
 		return;
@@ -57,9 +54,9 @@ void CM_PreStab( cleaf_t *pLeaf, Vector &vStabDir, int collisionMask, int &conte
 		if( !(pDispTree->GetContents() & collisionMask) )
 			continue;
 
-		bool bIsPoint = ( trace_ispoint == 1 );
+		bool bIsPoint = ( pTraceInfo->m_ispoint == 1 );
 
-		if( pDispTree->PointInBounds( trace_start, trace_mins, trace_maxs, bIsPoint ) )
+		if( pDispTree->PointInBounds( pTraceInfo->m_start, pTraceInfo->m_mins, pTraceInfo->m_maxs, bIsPoint ) )
 		{
 			pDispTree->GetStabDirection( vStabDir );
 			contents = pDispTree->GetContents();
@@ -71,75 +68,77 @@ void CM_PreStab( cleaf_t *pLeaf, Vector &vStabDir, int collisionMask, int &conte
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_Stab( CCollisionBSPData *pBSPData, const Vector &start, const Vector &vStabDir, int contents )
+void CM_Stab( TraceInfo_t *pTraceInfo, const Vector &start, const Vector &vStabDir, int contents )
 {
 	//
 	// initialize the displacement trace parameters
 	//
-	trace_trace.fraction = 1.0f;
-	trace_trace.fractionleftsolid = 0.0f;
-	trace_trace.surface = nullsurface;
+	trace_t *pTrace = &pTraceInfo->m_trace;
+	pTrace->fraction = 1.0f;
+	pTrace->fractionleftsolid = 0.0f;
+	pTrace->surface = nullsurface;
 
-	trace_trace.startsolid = false;
-	trace_trace.allsolid = false;
+	pTrace->startsolid = false;
+	pTrace->allsolid = false;
 
-	trace_bDispHit = false;
-	trace_StabDir = vStabDir;
+	pTraceInfo->m_bDispHit = false;
+	pTraceInfo->m_StabDir = vStabDir;
 
-	Vector end = trace_end;
+	Vector end = pTraceInfo->m_end;
 
-	trace_start = start;
-	trace_end = start + ( vStabDir * /* world extents * 2*/99999.9f );
+	pTraceInfo->m_start = start;
+	pTraceInfo->m_end = start + ( vStabDir * /* world extents * 2*/99999.9f );
 
 	// increment the checkcount -- so we can retest objects that may have been tested
 	// previous to the stab
-	BeginCheckCount();
+	BeginCheckCount( pTraceInfo );
 
 	// increment the stab count -- statistics
 	g_CollisionCounts.m_Stabs++;
 
 	// stab
-	CM_RecursiveHullCheck( pBSPData, 0 /*root*/, 0.0f, 1.0f, trace_start, trace_end );
+	CM_RecursiveHullCheck( pTraceInfo, 0 /*root*/, 0.0f, 1.0f, pTraceInfo->m_start, pTraceInfo->m_end );
 
-	EndCheckCount();
+	EndCheckCount( pTraceInfo );
 
-	trace_end = end;
+	pTraceInfo->m_end = end;
 }
 
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_PostStab( void )
+void CM_PostStab( TraceInfo_t *pTraceInfo )
 {
 	//
 	// only need to resolve things that impacted against a displacement surface,
 	// this is partially resolved in the post trace phase -- so just use that
 	// data to determine
 	//
-	if( trace_bDispHit && trace_trace.startsolid )
+	trace_t *pTrace = &pTraceInfo->m_trace;
+	if( pTraceInfo->m_bDispHit && pTrace->startsolid )
 	{
-		trace_trace.allsolid = true;
-		trace_trace.fraction = 0.0f;
-		trace_trace.fractionleftsolid = 0.0f;
+		pTrace->allsolid = true;
+		pTrace->fraction = 0.0f;
+		pTrace->fractionleftsolid = 0.0f;
 	}
 	else
 	{
-		trace_trace.startsolid = false;
-		trace_trace.allsolid = false;
-		trace_trace.contents = 0;
-		trace_trace.fraction = 1.0f;
-		trace_trace.fractionleftsolid = 0.0f;
+		pTrace->startsolid = false;
+		pTrace->allsolid = false;
+		pTrace->contents = 0;
+		pTrace->fraction = 1.0f;
+		pTrace->fractionleftsolid = 0.0f;
 	}
 }
 
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_TestInDispTree( CCollisionBSPData *pBSPData, cleaf_t *pLeaf, const Vector &traceStart,
+void CM_TestInDispTree( TraceInfo_t *pTraceInfo, cleaf_t *pLeaf, const Vector &traceStart,
 		const Vector &boxMin, const Vector &boxMax, int collisionMask, trace_t *pTrace )
 {
-	int nCurrentCheckCount = CurrentCheckCount();
-	int nDepth = CurrentCheckCountDepth();
+	int nCurrentCheckCount = CurrentCheckCount( pTraceInfo );
+	int nDepth = CurrentCheckCountDepth( pTraceInfo );
 
 	bool bIsBox = ( ( boxMin.x != 0.0f ) || ( boxMin.y != 0.0f ) || ( boxMin.z != 0.0f ) ||
 		            ( boxMax.x != 0.0f ) || ( boxMax.y != 0.0f ) || ( boxMax.z != 0.0f ) );
@@ -150,23 +149,25 @@ void CM_TestInDispTree( CCollisionBSPData *pBSPData, cleaf_t *pLeaf, const Vecto
 		//
 		// test box against all displacements in the leaf
 		//
+		int *pDispCounts = pTraceInfo->m_DispCounts[nDepth].Base();
 		for( CDispIterator it( pLeaf->m_pDisplacements, CDispLeafLink::LIST_LEAF ); it.IsValid(); )
 		{
 			CDispCollTree *pDispTree = static_cast<CDispCollTree*>( it.Inc()->m_pDispInfo );
+			int ndxDisp = pDispTree - g_pDispCollTrees;
 
 			// make sure we only check this brush once per trace/stab
-			if( pDispTree->GetCheckCount(nDepth) == nCurrentCheckCount )
+			if( pDispCounts[ndxDisp] == nCurrentCheckCount )
 				continue;
 
 			// mark the displacement as checked
-			pDispTree->SetCheckCount( nDepth, nCurrentCheckCount );
+			pDispCounts[ndxDisp] = nCurrentCheckCount;
 
 			// Respect trace contents
 			if( !(pDispTree->GetContents() & collisionMask) )
 				continue;
 
 			// box/tree intersection test
-			if( pDispTree->AABBIntersect( traceStart, boxMin, boxMax ) )
+			if( pDispTree->AABBIntersect( traceStart, boxMin, boxMax, pTraceInfo->m_bDispSIMD ) )
 			{
 				pTrace->startsolid = true;
 				pTrace->allsolid = true;
@@ -178,37 +179,39 @@ void CM_TestInDispTree( CCollisionBSPData *pBSPData, cleaf_t *pLeaf, const Vecto
 		}
 	}
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 
 	//
 	// need to stab if is was a point test or the box test yeilded no intersection
 	//
 	Vector stabDir;
 	int    contents;
-	CM_PreStab( pLeaf, stabDir, collisionMask, contents );
-	CM_Stab( pBSPData, traceStart, stabDir, contents );
-	CM_PostStab();
+	CM_PreStab( pTraceInfo, pLeaf, stabDir, collisionMask, contents );
+	CM_Stab( pTraceInfo, traceStart, stabDir, contents );
+	CM_PostStab( pTraceInfo );
 
-	Assert( nDepth == CurrentCheckCountDepth() );
-	Assert( nCurrentCheckCount == CurrentCheckCount() );
+	Assert( nDepth == CurrentCheckCountDepth( pTraceInfo ) );
+	Assert( nCurrentCheckCount == CurrentCheckCount( pTraceInfo ) );
 }
 
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_TraceToDispTree( CDispCollTree *pDispTree, Vector &traceStart, Vector &traceEnd,
+void CM_TraceToDispTree( TraceInfo_t *pTraceInfo, CDispCollTree *pDispTree, Vector &traceStart, Vector &traceEnd,
 						 Vector &boxMin, Vector &boxMax, float startFrac, float endFrac, 
 						 trace_t *pTrace, bool bRayCast )
 {
+	short surfaceProp;
+
 	// ray cast
 	if( bRayCast )
 	{
-		if( pDispTree->RayTest( traceStart, traceEnd, startFrac, endFrac, pTrace ) )
+		if( pDispTree->RayTest( traceStart, traceEnd, startFrac, endFrac, pTrace, &surfaceProp, pTraceInfo->m_bDispSIMD ) )
 		{
-			trace_bDispHit = true;
+			pTraceInfo->m_bDispHit = true;
 			pTrace->contents = pDispTree->GetContents();
-			SetDispTraceSurfaceProps( pTrace, pDispTree );
+			SetDispTraceSurfaceProps( pTrace, surfaceProp );
 		}
 	}
 	// box sweep
@@ -217,11 +220,11 @@ void CM_TraceToDispTree( CDispCollTree *pDispTree, Vector &traceStart, Vector &t
 		Vector boxExtents = ( ( boxMin + boxMax ) * 0.5f ) - boxMin;
 
 		if( pDispTree->AABBSweep( traceStart, traceEnd, boxExtents,
-			                      startFrac, endFrac, pTrace ) )
+			                      startFrac, endFrac, pTrace, &surfaceProp, pTraceInfo->m_bDispSIMD ) )
 		{
-			trace_bDispHit = true;
+			pTraceInfo->m_bDispHit = true;
 			pTrace->contents = pDispTree->GetContents();
-			SetDispTraceSurfaceProps( pTrace, pDispTree );
+			SetDispTraceSurfaceProps( pTrace, surfaceProp );
 		}
 	}
 }
@@ -229,21 +232,21 @@ void CM_TraceToDispTree( CDispCollTree *pDispTree, Vector &traceStart, Vector &t
 //-----------------------------------------------------------------------------
 // New Collision!
 //-----------------------------------------------------------------------------
-void CM_PostTraceToDispTree( void )
+void CM_PostTraceToDispTree( TraceInfo_t *pTraceInfo )
 {
 	// only resolve things that impacted against a displacement surface
-	if( !trace_bDispHit )
+	if( !pTraceInfo->m_bDispHit )
 		return;
 
 	//
 	// determine whether or not we are in solid
 	//	
-	Vector traceDir = trace_end - trace_start;
+	Vector traceDir = pTraceInfo->m_end - pTraceInfo->m_start;
 	
-	if( DotProduct( trace_trace.plane.normal, traceDir ) > 0.0f )
+	if( DotProduct( pTraceInfo->m_trace.plane.normal, traceDir ) > 0.0f )
 	{
-		trace_trace.startsolid = true;
-		trace_trace.allsolid = true;
+		pTraceInfo->m_trace.startsolid = true;
+		pTraceInfo->m_trace.allsolid = true;
 	}
 }
 
@@ -31,7 +31,7 @@ int			CM_InlineModelContents( int index );	// 1, 2, etc
 int			CM_NumClusters( void );
 char		*CM_EntityString( void );
 
-// creates a clipping hull for an arbitrary box
+// creates a clipping hull for an arbitrary box, main thread only
 int			CM_HeadnodeForBoxHull( const Vector& mins, const Vector& maxs );
 
 
@@ -51,7 +51,7 @@ int			CM_PointLeafnum( const Vector& p );
 // This builds a subtree that lies within the bounding volume
 void		CM_BuildBSPSubTree( const Vector& mins, const Vector& maxs );
 
-// This here hooks in/unhooks the subtree for all computations
+// This here hooks in/unhooks the subtree for traces on the main thread
 void		CM_BeginBSPSubTree( );
 void		CM_EndBSPSubTree( );
 
@@ -63,7 +63,11 @@ int			CM_TransformedBoxContents( const Vector& pos, const Vector& mins, const Ve
 
 // Versions that accept rays...
 void		CM_TransformedBoxTrace (const Ray_t& ray, int headnode, int brushmask, const Vector& origin, QAngle const& angles, trace_t& tr );
+// Traces against an unrotated box, safe to call from any thread unlike CM_HeadnodeForBoxHull
+void		CM_TransformedBoxTraceToBox( const Ray_t& ray, const Vector& mins, const Vector& maxs, int brushmask, const Vector& origin, trace_t& tr );
 void		CM_BoxTrace (const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr );
+// Same results as calling CM_BoxTrace on each ray
+void		CM_BoxTraces( const Ray_t *pRays, int nRays, int headnode, int brushmask, bool computeEndpt, trace_t *pTraces );
 
 int			CM_LeafContents( int leafnum );
 int			CM_LeafCluster( int leafnum );
@@ -17,18 +17,6 @@
 #include "utlvector.h"
 #include "disp_leaflink.h"
 
-extern Vector trace_start;
-extern Vector trace_end;
-extern Vector trace_mins;
-extern Vector trace_maxs;
-extern Vector trace_extents;
-
-extern trace_t trace_trace;
-extern trace_t g_StabTrace;
-
-extern int trace_contents;
-extern qboolean trace_ispoint;
-
 #include "coordsize.h"
 
 // JAYHL2: This used to be -1, but that caused lots of epsilon issues
@@ -57,10 +45,20 @@ typedef struct cbrush_s
 	int				contents;
 	int				numsides;
 	int				firstbrushside;
-	int				checkcount[2];			// to avoid repeated testings
+	int				firstsidegroup;			// sides four at a time, see cbrushsidegroup_t
 	struct cbrush_s	*next;
 } cbrush_t;
 
+// A brush's sides four at a time, for the SSE versions of CM_ClipBoxToBrush
+// and CM_TestBoxInBrush.  The last group of a brush is padded with copies of
+// its last side, which can't change what either test comes up with.
+struct cbrushsidegroup_t
+{
+	float			normal[3][4];
+	float			dist[4];
+	unsigned int	bevel[4];				// all ones for bevel planes
+};
+
 struct cleaf_t
 {
 	int			    contents;
@@ -87,11 +85,81 @@ struct cnode_t
 };
 
 
-// global collision checkcount
-void BeginCheckCount();
-int CurrentCheckCount();
-int CurrentCheckCountDepth();
-void EndCheckCount();
+class CCollisionBSPData;
+
+// Traces can nest once, for the displacement stab
+#define MAX_CHECK_COUNT_DEPTH	2
+
+// Box hulls at the end of the map's nodes, planes, brushes etc., see CM_InitBoxHull.
+// The first is CM_HeadnodeForBoxHull's, each TraceInfo_t has one of the rest.
+#define MAX_BOX_HULLS			64
+
+//-----------------------------------------------------------------------------
+// Everything a trace through the collision BSP keeps track of as it goes.  A
+// trace checks one out with CM_BeginTrace and gives it back with CM_EndTrace, 
+// so any number of traces can run at once on different threads.
+//-----------------------------------------------------------------------------
+struct TraceInfo_t
+{
+	TraceInfo_t();
+
+	Vector			m_start;
+	Vector			m_end;
+	Vector			m_mins;
+	Vector			m_maxs;
+	Vector			m_extents;
+
+	trace_t			m_trace;
+
+	int				m_contents;
+	qboolean		m_ispoint;
+	bool			m_bBrushSSE;			// cm_brushsse
+	bool			m_bDispSIMD;			// cm_dispsimd
+	int				m_bDispHit;				// hit displacement surface last
+	Vector			m_StabDir;				// the direction to stab in
+
+	CCollisionBSPData	*m_pBSPData;
+	cnode_t			*m_pRootNode;			// nodes to walk, CM_BeginBSPSubTree can swap in a subtree
+
+	// Brushes and displacements get the current count as they are tested, so ones
+	// in several leaves are only tested once per trace/stab.  Indexed by brush and
+	// displacement.
+	int				m_Count[MAX_CHECK_COUNT_DEPTH];
+	int				m_nCheckDepth;
+	CUtlVector<int>	m_BrushCounts[MAX_CHECK_COUNT_DEPTH];
+	CUtlVector<int>	m_DispCounts[MAX_CHECK_COUNT_DEPTH];
+
+	// Which of the box hulls this trace gets for CM_TransformedBoxTraceToBox
+	int				m_nBoxHull;
+};
+
+TraceInfo_t *CM_BeginTrace( void );
+void CM_EndTrace( TraceInfo_t *&pTraceInfo );
+// Call after the worker pool changes size, with no traces running
+void CM_ReclaimTraceInfos( void );
+
+inline void BeginCheckCount( TraceInfo_t *pTraceInfo )
+{
+	++pTraceInfo->m_nCheckDepth;
+	Assert( (pTraceInfo->m_nCheckDepth >= 0) && (pTraceInfo->m_nCheckDepth < MAX_CHECK_COUNT_DEPTH) );
+	++pTraceInfo->m_Count[pTraceInfo->m_nCheckDepth];
+}
+
+inline int CurrentCheckCount( TraceInfo_t *pTraceInfo )
+{
+	return pTraceInfo->m_Count[pTraceInfo->m_nCheckDepth];
+}
+
+inline int CurrentCheckCountDepth( TraceInfo_t *pTraceInfo )
+{
+	return pTraceInfo->m_nCheckDepth;
+}
+
+inline void EndCheckCount( TraceInfo_t *pTraceInfo )
+{
+	--pTraceInfo->m_nCheckDepth;
+	Assert( pTraceInfo->m_nCheckDepth >= -1 );
+}
 
 
 //-----------------------------------------------------------------------------
@@ -165,9 +233,7 @@ T *CRangeValidatedArray<T>::Base()
 class CCollisionBSPData
 {
 public:
-	// This is sort of a hack, but it was a little too painful to do this any other way
-	// The goal of this dude is to allow us to override the tree with some
-	// other tree (or a subtree)
+	// Always map_nodes now, subtrees from CM_BeginBSPSubTree go into TraceInfo_t::m_pRootNode
 	cnode_t*					map_rootnode;
 
 	char						map_name[MAX_QPATH];
@@ -187,6 +253,8 @@ public:
 	CRangeValidatedArray<cmodel_t>		map_cmodels;
 	int									numbrushes;
 	CRangeValidatedArray<cbrush_t>		map_brushes;
+	int									numbrushsidegroups;
+	CRangeValidatedArray<cbrushsidegroup_t>	map_brushsidegroups;
 	
 	// this points to the whole block of memory for vis data, but it is used to
 	// reference the header at the top of the block.
@@ -254,7 +322,8 @@ inline CCollisionBSPData *GetCollisionBSPData( void /*int ndxBSP*/ )
 
 //=============================================================================
 //
-// Collision Model Counts
+// Collision Model Counts, just statistics so they aren't interlocked; they
+// lose counts when traces run on several threads at once.
 //
 class CCollisionCounts
 {
@@ -281,9 +350,6 @@ extern CCollisionCounts g_CollisionCounts;
 //
 // Displacement Collision Functions and Data
 //
-extern Vector trace_StabDir;		// the direction to stab in
-extern int trace_bDispHit;			// hit displacement surface last
-
 extern int g_DispCollTreeCount;
 extern CDispCollTree *g_pDispCollTrees;
 
@@ -297,24 +363,50 @@ void DispCollTrees_FreeLeafList( CCollisionBSPData *pBSPData );
 void CM_DispTreeLeafnum( CCollisionBSPData *pBSPData );
 
 // collision
-void CM_PreStab( cleaf_t *pLeaf, Vector &vStabDir, int &contents );
-void CM_Stab( CCollisionBSPData *pBSPData, Vector const &start, Vector const &vStabDir, int contents );
-void CM_PostStab( void );
-void CM_TestInDispTree( CCollisionBSPData *pBSPData, cleaf_t *pLeaf, Vector const &traceStart, 
+void CM_PreStab( TraceInfo_t *pTraceInfo, cleaf_t *pLeaf, Vector &vStabDir, int collisionMask, int &contents );
+void CM_Stab( TraceInfo_t *pTraceInfo, Vector const &start, Vector const &vStabDir, int contents );
+void CM_PostStab( TraceInfo_t *pTraceInfo );
+void CM_TestInDispTree( TraceInfo_t *pTraceInfo, cleaf_t *pLeaf, Vector const &traceStart, 
 				Vector const &boxMin, Vector const &boxMax, int collisionMask, trace_t *pTrace );
-void CM_TraceToDispTree( CDispCollTree *pDispTree, Vector &traceStart, Vector &traceEnd,
+void CM_TraceToDispTree( TraceInfo_t *pTraceInfo, CDispCollTree *pDispTree, Vector &traceStart, Vector &traceEnd,
 		    			 Vector &boxMin, Vector &boxMax, float startFrac, float endFrac, trace_t *pTrace, bool bRayCast );
-void CM_PostTraceToDispTree( void );
+void CM_PostTraceToDispTree( TraceInfo_t *pTraceInfo );
 
 //=============================================================================
 //
 // profiling purposes only -- remove when done!!!
 //
-void FASTCALL CM_ClipBoxToBrush ( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
-								  trace_t *trace, cbrush_t *brush, BOOL bDispSurf );
-void CM_TestBoxInBrush ( CCollisionBSPData *pBSPData, const Vector& mins, const Vector& maxs, const Vector& p1,
-					  trace_t *trace, cbrush_t *brush, BOOL bDispSurf );
-void FASTCALL CM_RecursiveHullCheck ( CCollisionBSPData *pBSPData, int num, float p1f, float p2f, const Vector& p1, const Vector& p2);
+void FASTCALL CM_ClipBoxToBrush ( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+								  trace_t *trace, cbrush_t *brush );
+void CM_TestBoxInBrush ( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
+					  trace_t *trace, cbrush_t *brush );
+
+// The two versions of each that the above pick between (cm_brushsse), for brushclip_benchmark
+void FASTCALL CM_ClipBoxToBrushScalar( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+								  trace_t *trace, cbrush_t *brush );
+void FASTCALL CM_ClipBoxToBrushSSE( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1, const Vector& p2,
+								  trace_t *trace, cbrush_t *brush );
+void CM_TestBoxInBrushScalar( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
+					  trace_t *trace, cbrush_t *brush );
+void CM_TestBoxInBrushSSE( TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, const Vector& p1,
+					  trace_t *trace, cbrush_t *brush );
+
+// Refills a brush's side groups from its sides' planes
+void CM_BuildBrushSideGroups( CCollisionBSPData *pBSPData, cbrush_t *brush );
+
+// brushclip_benchmark can record every brush test into a file
+enum
+{
+	BRUSHCLIP_CLIP = 0,
+	BRUSHCLIP_TEST,
+};
+
+extern bool g_bBrushClipRecording;
+void BrushClip_StopRecording( void );
+void BrushClip_Record( int type, TraceInfo_t *pTraceInfo, const Vector& mins, const Vector& maxs, 
+					  const Vector& p1, const Vector& p2, const trace_t *trace, const cbrush_t *brush );
+
+void FASTCALL CM_RecursiveHullCheck ( TraceInfo_t *pTraceInfo, int num, float p1f, float p2f, const Vector& p1, const Vector& p2);
 
 
 #endif // CMODEL_PRIVATE_H
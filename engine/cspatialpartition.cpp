@@ -39,6 +39,11 @@
 // of the entry associated with the handle whose leaf list it is. Having that 
 // there was neceesary for a constant-time element removal.
 //
+// Enumerations can run on any thread, so traces can, but handles can only be
+// inserted, moved or removed on the main thread while nothing else is
+// enumerating.  Only main thread enumerations stamp the handles' m_EnumId, 
+// the others keep what they've visited in a hash.
+//
 //=============================================================================
 
 #include "ispatialpartitioninternal.h"
@@ -51,6 +56,7 @@
 #include "bsptreedata.h"
 #include "utlhash.h"
 #include "tier0/dbg.h"
+#include "vstdlib/icommandline.h"
 
 
 //-----------------------------------------------------------------------------
@@ -121,6 +127,10 @@ public:
 		const Ray_t& ray, bool coarseTest, 
 		IPartitionEnumerator* pIterator );
 
+	// Methods of ISpatialPartitionInternal
+	void EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask,
+		const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator );
+
 	// For debugging.... suppress queries on particular lists
 	virtual void SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress );
 	virtual SpatialPartitionListMask_t GetSuppressedLists();
@@ -136,6 +146,7 @@ public:
 	bool	EnumerateLeavesInBox( const Vector& mins, const Vector& maxs, ISpatialLeafEnumerator* pEnum, int context );
 	bool	EnumerateLeavesInSphere( const Vector& center, float radius, ISpatialLeafEnumerator* pEnum, int context );
 	bool	EnumerateLeavesAlongRay( const Ray_t& ray, ISpatialLeafEnumerator* pEnum, int context );
+	bool	EnumerateLeavesAlongRays( const Ray_t *pRays, int nRays, ISpatialLeafEnumerator* pEnum, int context );
 
 	// Enumerates the elements in a leaf
 	bool	EnumerateElementsInLeaf( int leaf, IBSPTreeDataEnumerator* pEnum, int context );
@@ -143,6 +154,9 @@ public:
 	// Gets handle info (for enumerations)
 	HandleInfo_t&	HandleInfo( SpatialPartitionHandle_t handle );
 
+	// The id for a new enumeration, only main thread enumerations use them
+	int		NextEnumId();
+
 private:
 
 	// All the information associated with a node in the KD tree
@@ -175,6 +189,8 @@ private:
 	bool EnumerateLeavesExtrudedRay_R( int node, const Ray_t& ray,
 		const Vector& invDelta,	const Vector& start, 
 		const Vector& end, ISpatialLeafEnumerator* pEnum, int context );
+	bool EnumerateLeavesRays_R( int node, const Ray_t *pRays, int nRays, unsigned int nRayMask,
+		const float *pStartFrac, const float *pEndFrac, ISpatialLeafEnumerator* pEnum, int context );
 
 	// The set of area nodes. Assume a uniformly deep tree.
 	CUtlVector<AreaNode_t>	m_Node;
@@ -197,22 +213,49 @@ private:
 
 
 //-----------------------------------------------------------------------------
-// Expose CSpatialPartition to the game + client DLL.
+// Expose ISpatialPartitionInternal to the engine.  Which one it is gets picked
+// the first time anything asks, at startup, and everything holds on to it.
 //-----------------------------------------------------------------------------
 
 static CSpatialPartition	g_SpatialPartition;
-EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CSpatialPartition, ISpatialPartition, 
-					INTERFACEVERSION_SPATIALPARTITION, g_SpatialPartition);
+static ISpatialPartitionInternal *s_pSpatialPartition = NULL;
+
+ISpatialPartitionInternal* SpatialPartition()
+{
+	if ( !s_pSpatialPartition )
+	{
+		if ( CommandLine()->FindParm( "-spatialgrid" ) )
+		{
+			s_pSpatialPartition = CreateSpatialPartitionGrid();
+		}
+		else
+		{
+			s_pSpatialPartition = &g_SpatialPartition;
+		}
+
+		if ( CommandLine()->FindParm( "-partitionrecord" ) )
+		{
+			s_pSpatialPartition = CreateSpatialPartitionRecorder( s_pSpatialPartition );
+		}
+	}
+	return s_pSpatialPartition;
+}
+
+ISpatialPartitionInternal* CreateSpatialPartitionTree()
+{
+	return new CSpatialPartition;
+}
 
 
 //-----------------------------------------------------------------------------
-// Expose ISpatialPartitionInternal to the engine.
+// Expose the same one to the game + client DLL.
 //-----------------------------------------------------------------------------
 
-ISpatialPartitionInternal* SpatialPartition()
+static void* CreateSpatialPartitionInterface()
 {
-	return &g_SpatialPartition;
+	return static_cast<ISpatialPartition*>( SpatialPartition() );
 }
+EXPOSE_INTERFACE_FN( CreateSpatialPartitionInterface, ISpatialPartition, INTERFACEVERSION_SPATIALPARTITION );
 
 
 //-----------------------------------------------------------------------------
@@ -487,6 +530,18 @@ inline HandleInfo_t& CSpatialPartition::HandleInfo( SpatialPartitionHandle_t han
 }
 
 
+//-----------------------------------------------------------------------------
+// The id for a new enumeration.  Other threads use CEnumBase's hash instead,
+// so they mustn't touch m_EnumId.
+//-----------------------------------------------------------------------------
+inline int CSpatialPartition::NextEnumId()
+{
+	if ( !Plat_IsPrimaryThread() )
+		return -1;
+	return ++m_EnumId;
+}
+
+
 //-----------------------------------------------------------------------------
 // Returns the number of leaves
 //-----------------------------------------------------------------------------
@@ -800,6 +855,125 @@ bool CSpatialPartition::EnumerateLeavesAlongRay( const Ray_t& ray,
 }
 
 
+//-----------------------------------------------------------------------------
+// Tree traversal for a packet of rays.  Each ray keeps the part of itself,
+// as fractions of its delta, that is still inside the current node.  Rays
+// and extruded rays are both thickened by their extents + TEST_EPSILON, so a
+// ray can go to a few more leaves than EnumerateLeavesAlongRay sends it to.
+//-----------------------------------------------------------------------------
+bool CSpatialPartition::EnumerateLeavesRays_R( int node, const Ray_t *pRays, int nRays, 
+	unsigned int nRayMask, const float *pStartFrac, const float *pEndFrac,
+	ISpatialLeafEnumerator* pEnum, int context )
+{
+	float startFrac[MAX_PARTITION_RAYS], endFrac[MAX_PARTITION_RAYS];
+	memcpy( startFrac, pStartFrac, nRays * sizeof(float) );
+	memcpy( endFrac, pEndFrac, nRays * sizeof(float) );
+
+	float frontStart[MAX_PARTITION_RAYS], frontEnd[MAX_PARTITION_RAYS];
+
+	// Keep going until we hit a leaf or the packet splits...
+	while (node >= 0)
+	{
+		AreaNode_t& nodeInfo = m_Node[node];
+		int axis = nodeInfo.m_Axis;
+
+		unsigned int nBehindMask = 0;
+		unsigned int nFrontMask = 0;
+		for ( int i = 0; i < nRays; ++i )
+		{
+			if ( !( nRayMask & ( 1U << i ) ) )
+				continue;
+
+			const Ray_t &ray = pRays[i];
+			float start = ray.m_Start[axis] - nodeInfo.m_Dist;
+			float delta = ray.m_Delta[axis];
+			float tStart = start + startFrac[i] * delta;
+			float tEnd = start + endFrac[i] * delta;
+			float extents = ray.m_Extents[axis] + TEST_EPSILON;
+
+			frontStart[i] = startFrac[i];
+			frontEnd[i] = endFrac[i];
+
+			if ( (tStart < -extents) && (tEnd < -extents) )
+			{
+				nBehindMask |= ( 1U << i );
+				continue;
+			}
+
+			if ( (tStart > extents) && (tEnd > extents) )
+			{
+				nFrontMask |= ( 1U << i );
+				continue;
+			}
+
+			nBehindMask |= ( 1U << i );
+			nFrontMask |= ( 1U << i );
+
+			// Parallel case, send the entire ray to both children
+			if ( delta == 0.0f )
+				continue;
+
+			// Behind gets the part up to plane + extent, in front the part from plane - extent
+			float splitfracBehind = ( extents - start ) / delta;
+			float splitfracInFront = ( -extents - start ) / delta;
+			if ( delta > 0.0f )
+			{
+				endFrac[i] = min( endFrac[i], splitfracBehind );
+				frontStart[i] = max( frontStart[i], splitfracInFront );
+			}
+			else
+			{
+				startFrac[i] = max( startFrac[i], splitfracBehind );
+				frontEnd[i] = min( frontEnd[i], splitfracInFront );
+			}
+		}
+
+		if ( !nFrontMask )
+		{
+			node = nodeInfo.m_Children[0];
+			continue;
+		}
+
+		if ( !nBehindMask )
+		{
+			memcpy( startFrac, frontStart, nRays * sizeof(float) );
+			memcpy( endFrac, frontEnd, nRays * sizeof(float) );
+			node = nodeInfo.m_Children[1];
+			continue;
+		}
+
+		// Here the packet is split by the node
+		if ( !EnumerateLeavesRays_R( nodeInfo.m_Children[0], pRays, nRays, nBehindMask,
+			startFrac, endFrac, pEnum, context ) )
+		{
+			return false;
+		}
+
+		return EnumerateLeavesRays_R( nodeInfo.m_Children[1], pRays, nRays, nFrontMask,
+			frontStart, frontEnd, pEnum, context );
+	}
+
+	int leaf = - node - 1;
+	return pEnum->EnumerateLeaf( leaf, context );
+}
+
+bool CSpatialPartition::EnumerateLeavesAlongRays( const Ray_t *pRays, int nRays, 
+									ISpatialLeafEnumerator* pEnum, int context )
+{
+	Assert( nRays > 0 && nRays <= MAX_PARTITION_RAYS );
+
+	float startFrac[MAX_PARTITION_RAYS], endFrac[MAX_PARTITION_RAYS];
+	for ( int i = 0; i < nRays; ++i )
+	{
+		startFrac[i] = 0.0f;
+		endFrac[i] = 1.0f;
+	}
+
+	unsigned int nRayMask = ( nRays == 32 ) ? 0xFFFFFFFF : ( ( 1U << nRays ) - 1 );
+	return EnumerateLeavesRays_R( 0, pRays, nRays, nRayMask, startFrac, endFrac, pEnum, context );
+}
+
+
 //-----------------------------------------------------------------------------
 // Inserts an element into the tree
 //-----------------------------------------------------------------------------
@@ -917,31 +1091,40 @@ class CEnumBase : public ISpatialLeafEnumerator, public IBSPTreeDataEnumerator
 public:
 
 	// UNDONE: Allow construction based on a set of listIds or a mask?
-	CEnumBase( SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator )
+	CEnumBase( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator )
 	{
+		m_pPartition = pPartition;
 		m_pIterator = pIterator;
 		m_ListMask = listMask;
 		m_CoarseTest = coarseTest;
 		m_pHash = NULL;
 		// The enumeration context written into each handle is not reentrant.
 		// s_NestLevel is a simple counter that checks for reentrant calls and
-		// uses a hash table to store the visit status for nested calls
-		if ( s_NestLevel > 0 )
+		// uses a hash table to store the visit status for nested calls.
+		// Enumerations on other threads always use the hash.
+		m_bPrimaryThread = Plat_IsPrimaryThread();
+		if ( !m_bPrimaryThread || s_NestLevel > 0 )
 		{
 			m_pHash = new CUtlHash<int>( 64, 0, 0, Int_CompareFunc, Int_KeyFunc );
 		}
-		s_NestLevel++;
+		if ( m_bPrimaryThread )
+		{
+			s_NestLevel++;
+		}
 	}
 	~CEnumBase()
 	{
 		delete m_pHash;
 		m_pHash = NULL;
-		s_NestLevel--;
+		if ( m_bPrimaryThread )
+		{
+			s_NestLevel--;
+		}
 	}
 
 	bool EnumerateLeaf( int leaf, int context )
 	{
-		return g_SpatialPartition.EnumerateElementsInLeaf( leaf, this, context );
+		return m_pPartition->EnumerateElementsInLeaf( leaf, this, context );
 	}
 
 	bool ShouldVisit( int partitionHandle, HandleInfo_t &handleInfo, int enumId )
@@ -972,7 +1155,7 @@ public:
 	bool FASTCALL EnumerateElement( int partitionHandle, int enumId )
 	{
 		// Get at the handle
-		HandleInfo_t& handleInfo = g_SpatialPartition.HandleInfo( partitionHandle );
+		HandleInfo_t& handleInfo = m_pPartition->HandleInfo( partitionHandle );
 
 		if ( !ShouldVisit( partitionHandle, handleInfo, enumId ) )
 			return true;
@@ -994,9 +1177,11 @@ public:
 private:
 	static int s_NestLevel;
 protected:
+	CSpatialPartition* m_pPartition;
 	IPartitionEnumerator* m_pIterator;
 	int		m_ListMask;
 	bool	m_CoarseTest;
+	bool	m_bPrimaryThread;
 	CUtlHash<int> *m_pHash;
 };
 
@@ -1009,9 +1194,9 @@ int CEnumBase::s_NestLevel = 0;
 class CEnumPoint : public CEnumBase
 {
 public:
-	CEnumPoint( SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
+	CEnumPoint( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
 				const Vector& pt ) :
-		CEnumBase( listMask, coarseTest, pIterator )
+		CEnumBase( pPartition, listMask, coarseTest, pIterator )
 	{
 		if (!m_CoarseTest)
 		{
@@ -1039,9 +1224,9 @@ void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t lis
 	if ( listMask == 0 )
 		return;
 
-	CEnumPoint enumPoint( listMask, coarseTest, pIterator, pt );
-	++m_EnumId;
-	m_pTreeData->EnumerateLeavesAtPoint( pt, &enumPoint, m_EnumId );
+	CEnumPoint enumPoint( this, listMask, coarseTest, pIterator, pt );
+	int nEnumId = NextEnumId();
+	m_pTreeData->EnumerateLeavesAtPoint( pt, &enumPoint, nEnumId );
 }
 
 
@@ -1051,9 +1236,9 @@ void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t lis
 class CEnumBox : public CEnumBase
 {
 public:
-	CEnumBox( SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
+	CEnumBox( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
 				const Vector& mins, const Vector& maxs ) :
-		CEnumBase( listMask, coarseTest, pIterator )
+		CEnumBase( pPartition, listMask, coarseTest, pIterator )
 	{
 		if (!m_CoarseTest)
 		{
@@ -1085,9 +1270,9 @@ void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listM
 	if ( listMask == 0 )
 		return;
 
-	CEnumBox enumBox( listMask, coarseTest, pIterator, mins, maxs );
-	++m_EnumId;
-	m_pTreeData->EnumerateLeavesInBox( mins, maxs, &enumBox, m_EnumId );
+	CEnumBox enumBox( this, listMask, coarseTest, pIterator, mins, maxs );
+	int nEnumId = NextEnumId();
+	m_pTreeData->EnumerateLeavesInBox( mins, maxs, &enumBox, nEnumId );
 }
 
 
@@ -1097,9 +1282,9 @@ void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listM
 class CEnumSphere : public CEnumBase
 {
 public:
-	CEnumSphere( SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
+	CEnumSphere( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
 				const Vector& center, float radius ) :
-		CEnumBase( listMask, coarseTest, pIterator )
+		CEnumBase( pPartition, listMask, coarseTest, pIterator )
 	{
 		if (!m_CoarseTest)
 		{
@@ -1130,9 +1315,9 @@ void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t li
 	if ( listMask == 0 )
 		return;
 
-	CEnumSphere enumSphere( listMask, coarseTest, pIterator, origin, radius );
-	++m_EnumId;
-	m_pTreeData->EnumerateLeavesInSphere( origin, radius, &enumSphere, m_EnumId );
+	CEnumSphere enumSphere( this, listMask, coarseTest, pIterator, origin, radius );
+	int nEnumId = NextEnumId();
+	m_pTreeData->EnumerateLeavesInSphere( origin, radius, &enumSphere, nEnumId );
 }
 
 
@@ -1143,9 +1328,9 @@ void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t li
 class CEnumRay : public CEnumBase
 {
 public:
-	CEnumRay( SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
+	CEnumRay( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, bool coarseTest, IPartitionEnumerator* pIterator, 
 				const Ray_t& ray ) :
-		CEnumBase( listMask, coarseTest, pIterator )
+		CEnumBase( pPartition, listMask, coarseTest, pIterator )
 	{
 		m_pRay = &ray;
 	}
@@ -1193,9 +1378,93 @@ void CSpatialPartition::EnumerateElementsAlongRay( SpatialPartitionListMask_t li
 		return;
 	}
 
-	CEnumRay enumRay( listMask, coarseTest, pIterator, ray );
-	++m_EnumId;
-	m_pTreeData->EnumerateLeavesAlongRay( ray, &enumRay, m_EnumId );
+	CEnumRay enumRay( this, listMask, coarseTest, pIterator, ray );
+	int nEnumId = NextEnumId();
+	m_pTreeData->EnumerateLeavesAlongRay( ray, &enumRay, nEnumId );
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities along a packet of rays...
+//-----------------------------------------------------------------------------
+class CEnumRays : public CEnumBase
+{
+public:
+	CEnumRays( CSpatialPartition *pPartition, SpatialPartitionListMask_t listMask, IPartitionRaysEnumerator* pIterator, 
+				const Ray_t *pRays, int nRays ) :
+		CEnumBase( pPartition, listMask, false, NULL )
+	{
+		m_pRaysIterator = pIterator;
+		m_pRays = pRays;
+		m_nRays = nRays;
+		m_nRayMask = 0;
+	}
+
+	// Elements are only visited once for the whole packet, so test them against every ray here
+	bool Intersect( HandleInfo_t& handleInfo )
+	{
+		m_nRayMask = 0;
+		for ( int i = 0; i < m_nRays; ++i )
+		{
+			const Ray_t &ray = m_pRays[i];
+
+			Vector bmin, bmax;
+			VectorSubtract( handleInfo.m_Min, ray.m_Extents, bmin );
+			VectorAdd( handleInfo.m_Max, ray.m_Extents, bmax );
+
+			bool bHit;
+			if ( !ray.m_IsSwept )
+			{
+				bHit = IsPointInBox( ray.m_Start, bmin, bmax );
+			}
+			else
+			{
+				bHit = IsBoxIntersectingRay( bmin, bmax, ray.m_Start, ray.m_Delta );
+			}
+
+			if ( bHit )
+			{
+				m_nRayMask |= ( 1U << i );
+			}
+		}
+		return ( m_nRayMask != 0 );
+	}
+
+	bool FASTCALL EnumerateElement( int partitionHandle, int enumId )
+	{
+		HandleInfo_t& handleInfo = m_pPartition->HandleInfo( partitionHandle );
+
+		if ( !ShouldVisit( partitionHandle, handleInfo, enumId ) )
+			return true;
+
+		if ( !Intersect( handleInfo ) )
+			return true;
+
+		IterationRetval_t retVal = m_pRaysIterator->EnumElement( handleInfo.m_pHandleEntity, m_nRayMask );
+		return (retVal != ITERATION_STOP);
+	}
+
+private:
+	IPartitionRaysEnumerator* m_pRaysIterator;
+	const Ray_t* m_pRays;
+	int		m_nRays;
+	unsigned int m_nRayMask;
+};
+
+void CSpatialPartition::EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask, 
+	const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator )
+{
+	// If this assertion fails, you're using a list
+	// at a point where the spatial partition elements aren't set up!
+	Assert( (listMask & m_nSuppressedListMask) == 0);
+	
+	// Early-out.
+	if ( listMask == 0 || nRays <= 0 )
+		return;
+
+	CEnumRays enumRays( this, listMask, pIterator, pRays, nRays );
+	int nEnumId = NextEnumId();
+	EnumerateLeavesAlongRays( pRays, nRays, &enumRays, nEnumId );
 }
 
 
@@ -21,6 +21,7 @@ typedef struct sizebuf_s sizebuf_t;
 
 bool Demo_IsPlayingBack();  // C wrapper function so demo object isn't included in server side only code
 bool Demo_IsPlayingBack_TimeDemo();  // C wrapper function so demo object isn't included in server side only code
+bool Demo_LoadNetworkMessages( const char *name, CUtlVector< unsigned int >& data, CUtlVector< int >& messageBytes ); // Returns false on the dedicated server.
 
 struct demoentry_t
 {
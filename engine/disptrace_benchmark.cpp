@@ -0,0 +1,381 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: disptrace_benchmark: makes up player movement traces over the
+//			displacements in the loaded map, runs them through both the
+//			original recursive displacement tree walk and the SIMD one
+//			(cm_dispsimd), checks they hit the same things and times them.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "cmodel_engine.h"
+#include "cmodel_private.h"
+#include "dispcoll_common.h"
+#include "gametrace.h"
+#include "vstdlib/random.h"
+#include "tier0/fasttimer.h"
+
+
+// Standing player hull, the box traces are made with its center
+static const Vector s_PlayerExtents( 16.0f, 16.0f, 36.0f );
+
+// What game movement traces for, in about the mix it does them in
+enum
+{
+	DISPTRACE_WALK = 0,		// One tick of running along the ground
+	DISPTRACE_GROUND,		// Checking for ground just under the player
+	DISPTRACE_FALL,			// Jumping and falling
+	DISPTRACE_POSITION,		// Checking the player isn't stuck
+	DISPTRACE_SHOT,			// Bullets hitting the ground
+	DISPTRACE_NUMTYPES
+};
+
+static const char *s_pDispTraceTypeNames[DISPTRACE_NUMTYPES] = { "Walk", "Ground", "Fall", "Position", "Shot" };
+static const int s_DispTraceTypePercent[DISPTRACE_NUMTYPES] = { 40, 25, 10, 15, 10 };
+
+typedef struct
+{
+	int			type;
+	int			disp;
+	Vector		start;		// Center of the box
+	Vector		end;
+} disptrace_t;
+
+extern ConVar cm_dispsimd;
+
+
+//-----------------------------------------------------------------------------
+// Picks a spot on the surface of a displacement by dropping a ray on it
+//-----------------------------------------------------------------------------
+static bool DispTrace_FindGround( CUniformRandomStream &random, CDispCollTree *pDisp, Vector &ground )
+{
+	Vector mins, maxs;
+	pDisp->GetBounds( mins, maxs );
+
+	for ( int iTry=0; iTry < 20; iTry++ )
+	{
+		Vector start( random.RandomFloat( mins.x, maxs.x ), random.RandomFloat( mins.y, maxs.y ), maxs.z + 64.0f );
+		Vector end( start.x, start.y, mins.z - 64.0f );
+
+		CBaseTrace trace;
+		memset( &trace, 0, sizeof( trace ) );
+		trace.fraction = 1.0f;
+		if ( pDisp->RayTest( start, end, 0.0f, 1.0f, &trace ) )
+		{
+			VectorLerp( start, end, trace.fraction, ground );
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Makes up a trace of the given type starting from a spot on the ground
+//-----------------------------------------------------------------------------
+static void DispTrace_Generate( CUniformRandomStream &random, int type, const Vector &ground, disptrace_t &dt )
+{
+	Vector dir;
+	float flYaw = random.RandomFloat( 0.0f, 2.0f * M_PI );
+	dir.Init( cos( flYaw ), sin( flYaw ), 0.0f );
+
+	dt.type = type;
+	switch ( type )
+	{
+	case DISPTRACE_WALK:
+		// 320 units/sec at 66 ticks a second, sometimes stepping up first
+		dt.start = ground + Vector( 0.0f, 0.0f, s_PlayerExtents.z + random.RandomFloat( 0.0f, 2.0f ) );
+		if ( random.RandomInt( 0, 3 ) == 0 )
+		{
+			dt.start.z += 18.0f;
+		}
+		dt.end = dt.start + dir * random.RandomFloat( 2.0f, 8.0f );
+		break;
+
+	case DISPTRACE_GROUND:
+		dt.start = ground + Vector( 0.0f, 0.0f, s_PlayerExtents.z + random.RandomFloat( 0.0f, 2.0f ) );
+		dt.end = dt.start - Vector( 0.0f, 0.0f, 2.0f );
+		break;
+
+	case DISPTRACE_FALL:
+		dt.start = ground + Vector( 0.0f, 0.0f, s_PlayerExtents.z + random.RandomFloat( 16.0f, 128.0f ) );
+		dt.end = dt.start + dir * random.RandomFloat( 0.0f, 64.0f ) - Vector( 0.0f, 0.0f, random.RandomFloat( 16.0f, 256.0f ) );
+		break;
+
+	case DISPTRACE_POSITION:
+		dt.start = ground + Vector( 0.0f, 0.0f, s_PlayerExtents.z + random.RandomFloat( -1.0f, 1.0f ) );
+		dt.end = dt.start;
+		break;
+
+	default:
+		// From somewhere above, through the spot and on into the ground
+		dt.start = ground + Vector( random.RandomFloat( -512.0f, 512.0f ), random.RandomFloat( -512.0f, 512.0f ), random.RandomFloat( 32.0f, 256.0f ) );
+		dt.end = ground + ( ground - dt.start );
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs a trace against just the displacement it was made for
+//-----------------------------------------------------------------------------
+static void DispTrace_Run( const disptrace_t &dt, CBaseTrace *pTrace, bool bSIMDWalk )
+{
+	CDispCollTree *pDisp = &g_pDispCollTrees[dt.disp];
+
+	memset( pTrace, 0, sizeof( *pTrace ) );
+	pTrace->fraction = 1.0f;
+
+	short surfaceProp;
+	switch ( dt.type )
+	{
+	case DISPTRACE_POSITION:
+		if ( pDisp->AABBIntersect( dt.start, -s_PlayerExtents, s_PlayerExtents, bSIMDWalk ) )
+		{
+			pTrace->startsolid = true;
+			pTrace->fraction = 0.0f;
+		}
+		break;
+
+	case DISPTRACE_SHOT:
+		pDisp->RayTest( dt.start, dt.end, 0.0f, 1.0f, pTrace, &surfaceProp, bSIMDWalk );
+		break;
+
+	default:
+		pDisp->AABBSweep( dt.start, dt.end, s_PlayerExtents, 0.0f, 1.0f, pTrace, &surfaceProp, bSIMDWalk );
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs a trace against the whole map, the way game movement would
+//-----------------------------------------------------------------------------
+static void DispTrace_RunWorld( const disptrace_t &dt, trace_t *pTrace )
+{
+	Ray_t ray;
+	if ( dt.type == DISPTRACE_SHOT )
+	{
+		ray.Init( dt.start, dt.end );
+	}
+	else
+	{
+		ray.Init( dt.start, dt.end, -s_PlayerExtents, s_PlayerExtents );
+	}
+
+	CM_BoxTrace( ray, 0, ( dt.type == DISPTRACE_SHOT ) ? MASK_SHOT : MASK_PLAYERSOLID, true, *pTrace );
+}
+
+
+static bool DispTrace_TracesMatch( const CBaseTrace &a, const CBaseTrace &b )
+{
+	return ( *(const unsigned int *)&a.fraction == *(const unsigned int *)&b.fraction ) &&
+		a.startsolid == b.startsolid && a.allsolid == b.allsolid && a.endpos == b.endpos &&
+		a.plane.normal == b.plane.normal && a.plane.dist == b.plane.dist && a.dispFlags == b.dispFlags;
+}
+
+
+static void DispTrace_Benchmark_f( void )
+{
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	if ( !pBSPData->numnodes )
+	{
+		Con_Printf( "disptrace_benchmark: no map loaded.\n" );
+		return;
+	}
+
+	int nTraces = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 20000;
+	int nIterations = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 10;
+	nTraces = max( nTraces, DISPTRACE_NUMTYPES );
+	nIterations = max( nIterations, 1 );
+
+	// Only solid displacements get traced against
+	CUtlVector<int> solidDisps;
+	int nTris = 0;
+	int iDisp;
+	for ( iDisp=0; iDisp < g_DispCollTreeCount; iDisp++ )
+	{
+		if ( g_pDispCollTrees[iDisp].GetContents() & MASK_OPAQUE )
+		{
+			solidDisps.AddToTail( iDisp );
+			int nQuads = 1 << g_pDispCollTrees[iDisp].GetPower();
+			nTris += nQuads * nQuads * 2;
+		}
+	}
+
+	if ( !solidDisps.Count() )
+	{
+		Con_Printf( "disptrace_benchmark: %s doesn't have any solid displacements.\n", pBSPData->map_name );
+		return;
+	}
+
+	// The same traces every time for a given set of arguments, grouped by type
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	disptrace_t *pTraces = new disptrace_t[nTraces];
+	int typeStart[DISPTRACE_NUMTYPES + 1];
+	int nGenerated = 0;
+	int iType;
+	for ( iType=0; iType < DISPTRACE_NUMTYPES; iType++ )
+	{
+		typeStart[iType] = nGenerated;
+
+		int nTypeTraces = ( iType == DISPTRACE_NUMTYPES - 1 ) ? nTraces - nGenerated : max( nTraces * s_DispTraceTypePercent[iType] / 100, 1 );
+		for ( int iTypeTrace=0; iTypeTrace < nTypeTraces; iTypeTrace++ )
+		{
+			// A few displacements can be hard to land a ray on, give up on them after a while
+			Vector ground;
+			int iPick;
+			for ( iPick=0; iPick < 100; iPick++ )
+			{
+				iDisp = solidDisps[random.RandomInt( 0, solidDisps.Count() - 1 )];
+				if ( DispTrace_FindGround( random, &g_pDispCollTrees[iDisp], ground ) )
+					break;
+			}
+
+			if ( iPick == 100 )
+			{
+				Con_Printf( "disptrace_benchmark: couldn't find the surface of any displacements.\n" );
+				delete [] pTraces;
+				return;
+			}
+
+			disptrace_t &dt = pTraces[nGenerated++];
+			dt.disp = iDisp;
+			DispTrace_Generate( random, iType, ground, dt );
+		}
+	}
+	typeStart[DISPTRACE_NUMTYPES] = nGenerated;
+
+	// First make sure both walks come up with the same traces, on the trees and against the whole map
+	int nMismatches = 0;
+	int nHits = 0;
+	int iTrace;
+	for ( iTrace=0; iTrace < nTraces; iTrace++ )
+	{
+		CBaseTrace recursiveTrace, simdTrace;
+		DispTrace_Run( pTraces[iTrace], &recursiveTrace, false );
+		DispTrace_Run( pTraces[iTrace], &simdTrace, true );
+
+		if ( !DispTrace_TracesMatch( recursiveTrace, simdTrace ) )
+		{
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "disptrace_benchmark: trace %d (%s, displacement %d): recursive fraction %.9g, SIMD fraction %.9g\n",
+					iTrace, s_pDispTraceTypeNames[pTraces[iTrace].type], pTraces[iTrace].disp, recursiveTrace.fraction, simdTrace.fraction );
+			}
+			++nMismatches;
+		}
+
+		if ( simdTrace.fraction < 1.0f || simdTrace.startsolid )
+		{
+			++nHits;
+		}
+	}
+
+	int nOldDispSIMD = cm_dispsimd.GetInt();
+
+	int nWorldMismatches = 0;
+	for ( iTrace=0; iTrace < nTraces; iTrace++ )
+	{
+		trace_t recursiveTrace, simdTrace;
+		cm_dispsimd.SetValue( 0 );
+		DispTrace_RunWorld( pTraces[iTrace], &recursiveTrace );
+		cm_dispsimd.SetValue( 1 );
+		DispTrace_RunWorld( pTraces[iTrace], &simdTrace );
+
+		if ( !DispTrace_TracesMatch( recursiveTrace, simdTrace ) )
+		{
+			++nWorldMismatches;
+		}
+	}
+
+	// Now time them, on their own and in with everything else in the map
+	double recursiveMS[DISPTRACE_NUMTYPES + 1];
+	double simdMS[DISPTRACE_NUMTYPES + 1];
+	CBaseTrace trace;
+	for ( iType=0; iType < DISPTRACE_NUMTYPES; iType++ )
+	{
+		for ( int iWalk=0; iWalk < 2; iWalk++ )
+		{
+			CFastTimer timer;
+			timer.Start();
+			for ( int iIteration=0; iIteration < nIterations; iIteration++ )
+			{
+				for ( iTrace=typeStart[iType]; iTrace < typeStart[iType + 1]; iTrace++ )
+				{
+					DispTrace_Run( pTraces[iTrace], &trace, iWalk != 0 );
+				}
+			}
+			timer.End();
+
+			if ( iWalk )
+			{
+				simdMS[iType] = timer.GetDuration().GetMillisecondsF();
+			}
+			else
+			{
+				recursiveMS[iType] = timer.GetDuration().GetMillisecondsF();
+			}
+		}
+	}
+
+	trace_t worldTrace;
+	for ( int iWorldWalk=0; iWorldWalk < 2; iWorldWalk++ )
+	{
+		cm_dispsimd.SetValue( iWorldWalk );
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int iIteration=0; iIteration < nIterations; iIteration++ )
+		{
+			for ( iTrace=0; iTrace < nTraces; iTrace++ )
+			{
+				DispTrace_RunWorld( pTraces[iTrace], &worldTrace );
+			}
+		}
+		timer.End();
+
+		if ( iWorldWalk )
+		{
+			simdMS[DISPTRACE_NUMTYPES] = timer.GetDuration().GetMillisecondsF();
+		}
+		else
+		{
+			recursiveMS[DISPTRACE_NUMTYPES] = timer.GetDuration().GetMillisecondsF();
+		}
+	}
+
+	cm_dispsimd.SetValue( nOldDispSIMD );
+
+	Con_Printf( "\ndisptrace_benchmark: %s, %d solid displacements (%d triangles), %d traces (%d hit), %d iterations, SSE %s\n",
+		pBSPData->map_name, solidDisps.Count(), nTris, nTraces, nHits, nIterations, MathLib_SSEEnabled() ? "on" : "off" );
+	Con_Printf( "-----------------------------------------------------------\n" );
+	Con_Printf( "Traces           Count   Recursive ms     SIMD ms   Speedup\n" );
+	Con_Printf( "-----------------------------------------------------------\n" );
+	for ( iType=0; iType <= DISPTRACE_NUMTYPES; iType++ )
+	{
+		const char *pName = ( iType < DISPTRACE_NUMTYPES ) ? s_pDispTraceTypeNames[iType] : "Whole map";
+		int nCount = ( iType < DISPTRACE_NUMTYPES ) ? typeStart[iType + 1] - typeStart[iType] : nTraces;
+		Con_Printf( "%-12s  %8d  %13.3f  %10.3f  %7.2fx\n", pName, nCount, recursiveMS[iType], simdMS[iType],
+			( simdMS[iType] > 0 ) ? recursiveMS[iType] / simdMS[iType] : 0.0 );
+	}
+
+	if ( nMismatches || nWorldMismatches )
+	{
+		// The recursive walk stops adding triangles once its list is full, long traces over big
+		// displacements can miss things it never got to
+		Con_Printf( "%d of %d traces against the displacements and %d against the whole map did NOT match.\n", nMismatches, nTraces, nWorldMismatches );
+	}
+	else
+	{
+		Con_Printf( "All traces matched.\n" );
+	}
+	Con_Printf( "\n" );
+
+	delete [] pTraces;
+}
+
+static ConCommand disptrace_benchmark( "disptrace_benchmark", DispTrace_Benchmark_f, "Make up player movement traces over the displacements in the loaded map, check the original and SIMD displacement tree walks (cm_dispsimd) give the same traces and time them. Usage: disptrace_benchmark [traces] [iterations]" );
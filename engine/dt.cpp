@@ -26,6 +26,7 @@
 ConVar g_CV_DTWatchEnt( "dtwatchent", "-1", 0 );
 ConVar g_CV_DTWatchVar( "dtwatchvar", "", 0 );
 ConVar g_CV_DTWarning( "dtwarning", "0", 0 );
+ConVar g_CV_DTPropCodecs( "dtpropcodecs", "1", 0, "Encode and decode props with the ops compiled at init time instead of through g_PropTypeFns." );
 
 
 
@@ -211,6 +211,16 @@ inline bool CSendNode::IsPropInRecursiveProps( int i ) const
 // ----------------------------------------------------------------------------- //
 // CSendTablePrecalc
 // ----------------------------------------------------------------------------- //
+
+// The bytes of the object that a property's value is read from.
+class CPropVarRange
+{
+public:
+	int		m_Offset;	// -1 if the prop has to be re-encoded any time the object changes.
+	int		m_nBytes;
+};
+
+
 class CSendTablePrecalc
 {
 public:
@@ -243,6 +253,13 @@ public:
 	// These are the datatable properties (SendPropDataTable).
 	CUtlVector<const SendProp*>	m_DatatableProps;
 
+	// Parallel to m_Props. Used to map network var changes to props.
+	CUtlVector<CPropVarRange>	m_PropVarRanges;
+
+	// Parallel to m_Props. The encode/decode op for each prop. SendTable_Init sets these
+	// up for the server's tables and RecvTable_CreateDecoders sets them up in each CRecvDecoder.
+	CUtlVector<CPropCodec>		m_PropCodecs;
+
 	// This is the property hierarchy, with the nodes indexing m_Props.
 	CSendNode				m_Root;
 
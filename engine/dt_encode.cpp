@@ -54,14 +54,8 @@ static inline bool EncodeSpecialFloat( const SendProp *pProp, float fVal, bf_wri
 }
 
 
-static inline void EncodeFloat( const SendProp *pProp, float fVal, bf_write *pOut, int objectID )
+static inline void EncodeQuantizedFloat( const SendProp *pProp, float fVal, bf_write *pOut, int objectID )
 {
-	// Check for special flags like SPROP_COORD, SPROP_NOSCALE, and SPROP_NORMAL.
-	if( EncodeSpecialFloat( pProp, fVal, pOut ) )
-	{
-		return;
-	}
-
 	unsigned long ulVal;
 	if( fVal < pProp->m_fLowValue )
 	{
@@ -93,6 +87,18 @@ static inline void EncodeFloat( const SendProp *pProp, float fVal, bf_write *pOu
 }
 
 
+static inline void EncodeFloat( const SendProp *pProp, float fVal, bf_write *pOut, int objectID )
+{
+	// Check for special flags like SPROP_COORD, SPROP_NOSCALE, and SPROP_NORMAL.
+	if( EncodeSpecialFloat( pProp, fVal, pOut ) )
+	{
+		return;
+	}
+
+	EncodeQuantizedFloat( pProp, fVal, pOut, objectID );
+}
+
+
 // Look for special flags like SPROP_COORD, SPROP_NOSCALE, and SPROP_NORMAL and
 // decode if they're there. Fills in fVal and returns true if it decodes anything.
 static inline bool DecodeSpecialFloat( SendProp const *pProp, bf_read *pIn, float &fVal )
@@ -120,10 +126,18 @@ static inline bool DecodeSpecialFloat( SendProp const *pProp, bf_read *pIn, floa
 }
 
 
+static inline float DecodeQuantizedFloat( SendProp const *pProp, bf_read *pIn )
+{
+	unsigned long dwInterp = pIn->ReadUBitLong(pProp->m_nBits);
+	float fVal = (float)dwInterp / ((1 << pProp->m_nBits) - 1);
+	fVal = pProp->m_fLowValue + (pProp->m_fHighValue - pProp->m_fLowValue) * fVal;
+	return fVal;
+}
+
+
 static float DecodeFloat(SendProp const *pProp, bf_read *pIn)
 {
 	float fVal;
-	unsigned long dwInterp;
 
 	// Check for special flags..
 	if( DecodeSpecialFloat( pProp, pIn, fVal ) )
@@ -131,10 +145,7 @@ static float DecodeFloat(SendProp const *pProp, bf_read *pIn)
 		return fVal;
 	}
 
-	dwInterp = pIn->ReadUBitLong(pProp->m_nBits);
-	fVal = (float)dwInterp / ((1 << pProp->m_nBits) - 1);
-	fVal = pProp->m_fLowValue + (pProp->m_fHighValue - pProp->m_fLowValue) * fVal;
-	return fVal;
+	return DecodeQuantizedFloat( pProp, pIn );
 }
 
 
@@ -381,6 +392,21 @@ void Vector_Encode( const unsigned char *pStruct, DVariant *pVar, const SendProp
 }
 
 
+// Rebuild a normal's z component from x, y, and the sign bit.
+static inline void DecodeNormalZ( float *v, int signbit )
+{
+	float v0v0v1v1 = v[0] * v[0] +
+		v[1] * v[1];
+	if (v0v0v1v1 < 1.0f)
+		v[2] = sqrtf( 1.0f - v0v0v1v1 );
+	else
+		v[2] = 0.0f;
+
+	if (signbit)
+		v[2] *= -1.0f;
+}
+
+
 void Vector_Decode(DecodeInfo *pInfo)
 {
 	float *v = pInfo->m_Value.m_Vector;
@@ -396,16 +422,7 @@ void Vector_Decode(DecodeInfo *pInfo)
 	else
 	{
 		int signbit = pInfo->m_pIn->ReadOneBit();
-
-		float v0v0v1v1 = v[0] * v[0] +
-			v[1] * v[1];
-		if (v0v0v1v1 < 1.0f)
-			v[2] = sqrtf( 1.0f - v0v0v1v1 );
-		else
-			v[2] = 0.0f;
-
-		if (signbit)
-			v[2] *= -1.0f;
+		DecodeNormalZ( v, signbit );
 	}
 
 	if( pInfo->m_pRecvProp )
@@ -853,3 +870,272 @@ PropTypeFns g_PropTypeFns[DPT_NUMSendPropTypes] =
 		DataTable_GetTypeNameString
 	},
 };
+
+
+
+// ---------------------------------------------------------------------------------------- //
+// CPropCodec.
+// ---------------------------------------------------------------------------------------- //
+
+void PropCodec_Init( CPropCodec *pCodec, const SendProp *pProp, DTStockProxy stockProxy )
+{
+	pCodec->m_pProp = pProp;
+	pCodec->m_Offset = pProp->GetOffset();
+	pCodec->m_nBits = pProp->m_nBits;
+	pCodec->m_Op = PROPCODEC_GENERIC;
+	pCodec->m_Access = DSTOCKPROXY_NONE;
+
+	int flags = pProp->GetFlags();
+	switch ( pProp->GetType() )
+	{
+		case DPT_Int:
+		{
+			pCodec->m_Op = ( flags & SPROP_UNSIGNED ) ? PROPCODEC_INT_UNSIGNED : PROPCODEC_INT_SIGNED;
+			
+			if ( stockProxy >= DSTOCKPROXY_INT8 && stockProxy <= DSTOCKPROXY_UINT32 )
+				pCodec->m_Access = stockProxy;
+		}
+		break;
+
+		case DPT_Float:
+		{
+			// Same precedence as EncodeSpecialFloat.
+			if ( flags & SPROP_COORD )
+				pCodec->m_Op = PROPCODEC_FLOAT_COORD;
+			else if ( flags & SPROP_NOSCALE )
+				pCodec->m_Op = PROPCODEC_FLOAT_NOSCALE;
+			else if ( flags & SPROP_NORMAL )
+				pCodec->m_Op = PROPCODEC_FLOAT_NORMAL;
+			else
+				pCodec->m_Op = PROPCODEC_FLOAT_QUANTIZED;
+
+			if ( stockProxy == DSTOCKPROXY_FLOAT || stockProxy == DSTOCKPROXY_ANGLE )
+				pCodec->m_Access = stockProxy;
+		}
+		break;
+
+		case DPT_Vector:
+		{
+			if ( flags & SPROP_NORMAL )
+			{
+				// Normals with COORD or NOSCALE set are odd enough to leave to Vector_Encode.
+				if ( !( flags & (SPROP_COORD | SPROP_NOSCALE) ) )
+					pCodec->m_Op = PROPCODEC_VECTOR_NORMAL;
+			}
+			else if ( flags & SPROP_COORD )
+				pCodec->m_Op = PROPCODEC_VECTOR_COORD;
+			else if ( flags & SPROP_NOSCALE )
+				pCodec->m_Op = PROPCODEC_VECTOR_NOSCALE;
+			else
+				pCodec->m_Op = PROPCODEC_VECTOR_QUANTIZED;
+
+			if ( stockProxy == DSTOCKPROXY_VECTOR || stockProxy == DSTOCKPROXY_QANGLES )
+				pCodec->m_Access = stockProxy;
+		}
+		break;
+
+		case DPT_String:
+		{
+			if ( stockProxy == DSTOCKPROXY_STRING )
+				pCodec->m_Access = stockProxy;
+		}
+		break;
+	}
+}
+
+
+void PropCodec_Encode( const CPropCodec *pCodec, const unsigned char *pStructBase, bf_write *pOut, int objectID )
+{
+	const SendProp *pProp = pCodec->m_pProp;
+	const unsigned char *pData = pStructBase + pCodec->m_Offset;
+
+	// Get the value. These do the same thing as the stock SendProxies.
+	DVariant var;
+	switch ( pCodec->m_Access )
+	{
+		case DSTOCKPROXY_INT8:		var.m_Int = *((char*)pData);								break;
+		case DSTOCKPROXY_INT16:		var.m_Int = *((short*)pData);								break;
+		case DSTOCKPROXY_INT32:		var.m_Int = *((int*)pData);									break;
+		case DSTOCKPROXY_UINT8:		var.m_Int = *((unsigned char*)pData);						break;
+		case DSTOCKPROXY_UINT16:	var.m_Int = *((unsigned short*)pData);						break;
+		case DSTOCKPROXY_UINT32:	*((unsigned long*)&var.m_Int) = *((unsigned long*)pData);	break;
+		case DSTOCKPROXY_FLOAT:		var.m_Float = *((float*)pData);								break;
+		case DSTOCKPROXY_ANGLE:		var.m_Float = anglemod( *((float*)pData) );					break;
+		case DSTOCKPROXY_STRING:	var.m_pString = (char*)pData;								break;
+		
+		case DSTOCKPROXY_VECTOR:
+		{
+			var.m_Vector[0] = ((float*)pData)[0];
+			var.m_Vector[1] = ((float*)pData)[1];
+			var.m_Vector[2] = ((float*)pData)[2];
+		}
+		break;
+		
+		case DSTOCKPROXY_QANGLES:
+		{
+			var.m_Vector[0] = anglemod( ((float*)pData)[0] );
+			var.m_Vector[1] = anglemod( ((float*)pData)[1] );
+			var.m_Vector[2] = anglemod( ((float*)pData)[2] );
+		}
+		break;
+
+		default:
+		{
+			pProp->GetProxyFn()( pStructBase, pData, &var, 0, objectID );
+		}
+		break;
+	}
+
+	// Encode it.
+	switch ( pCodec->m_Op )
+	{
+		case PROPCODEC_INT_SIGNED:		pOut->WriteSBitLong( var.m_Int, pCodec->m_nBits );					break;
+		case PROPCODEC_INT_UNSIGNED:	pOut->WriteUBitLong( (unsigned int)var.m_Int, pCodec->m_nBits );	break;
+		case PROPCODEC_FLOAT_COORD:		pOut->WriteBitCoord( var.m_Float );									break;
+		case PROPCODEC_FLOAT_NOSCALE:	pOut->WriteBitFloat( var.m_Float );									break;
+		case PROPCODEC_FLOAT_NORMAL:	pOut->WriteBitNormal( var.m_Float );								break;
+		case PROPCODEC_FLOAT_QUANTIZED:	EncodeQuantizedFloat( pProp, var.m_Float, pOut, objectID );			break;
+
+		case PROPCODEC_VECTOR_COORD:
+		{
+			pOut->WriteBitCoord( var.m_Vector[0] );
+			pOut->WriteBitCoord( var.m_Vector[1] );
+			pOut->WriteBitCoord( var.m_Vector[2] );
+		}
+		break;
+
+		case PROPCODEC_VECTOR_NOSCALE:
+		{
+			pOut->WriteBitFloat( var.m_Vector[0] );
+			pOut->WriteBitFloat( var.m_Vector[1] );
+			pOut->WriteBitFloat( var.m_Vector[2] );
+		}
+		break;
+
+		case PROPCODEC_VECTOR_NORMAL:
+		{
+			pOut->WriteBitNormal( var.m_Vector[0] );
+			pOut->WriteBitNormal( var.m_Vector[1] );
+			pOut->WriteOneBit( var.m_Vector[2] <= -NORMAL_RESOLUTION );
+		}
+		break;
+
+		case PROPCODEC_VECTOR_QUANTIZED:
+		{
+			EncodeQuantizedFloat( pProp, var.m_Vector[0], pOut, objectID );
+			EncodeQuantizedFloat( pProp, var.m_Vector[1], pOut, objectID );
+			EncodeQuantizedFloat( pProp, var.m_Vector[2], pOut, objectID );
+		}
+		break;
+
+		default:
+		{
+			g_PropTypeFns[pProp->m_Type].Encode( pStructBase, &var, pProp, pOut, objectID );
+		}
+		break;
+	}
+}
+
+
+void PropCodec_Decode( const CPropCodec *pCodec, DecodeInfo *pInfo )
+{
+	const SendProp *pProp = pCodec->m_pProp;
+	bf_read *pIn = pInfo->m_pIn;
+	float *v = pInfo->m_Value.m_Vector;
+
+	switch ( pCodec->m_Op )
+	{
+		case PROPCODEC_INT_SIGNED:		pInfo->m_Value.m_Int = pIn->ReadSBitLong( pCodec->m_nBits );	break;
+		case PROPCODEC_INT_UNSIGNED:	pInfo->m_Value.m_Int = pIn->ReadUBitLong( pCodec->m_nBits );	break;
+		case PROPCODEC_FLOAT_COORD:		pInfo->m_Value.m_Float = pIn->ReadBitCoord();					break;
+		case PROPCODEC_FLOAT_NOSCALE:	pInfo->m_Value.m_Float = pIn->ReadBitFloat();					break;
+		case PROPCODEC_FLOAT_NORMAL:	pInfo->m_Value.m_Float = pIn->ReadBitNormal();					break;
+		case PROPCODEC_FLOAT_QUANTIZED:	pInfo->m_Value.m_Float = DecodeQuantizedFloat( pProp, pIn );	break;
+
+		case PROPCODEC_VECTOR_COORD:
+		{
+			v[0] = pIn->ReadBitCoord();
+			v[1] = pIn->ReadBitCoord();
+			v[2] = pIn->ReadBitCoord();
+		}
+		break;
+
+		case PROPCODEC_VECTOR_NOSCALE:
+		{
+			v[0] = pIn->ReadBitFloat();
+			v[1] = pIn->ReadBitFloat();
+			v[2] = pIn->ReadBitFloat();
+		}
+		break;
+
+		case PROPCODEC_VECTOR_NORMAL:
+		{
+			v[0] = pIn->ReadBitNormal();
+			v[1] = pIn->ReadBitNormal();
+			DecodeNormalZ( v, pIn->ReadOneBit() );
+		}
+		break;
+
+		case PROPCODEC_VECTOR_QUANTIZED:
+		{
+			v[0] = DecodeQuantizedFloat( pProp, pIn );
+			v[1] = DecodeQuantizedFloat( pProp, pIn );
+			v[2] = DecodeQuantizedFloat( pProp, pIn );
+		}
+		break;
+
+		default:
+		{
+			// This calls the RecvProxy too.
+			pInfo->m_pProp = pProp;
+			g_PropTypeFns[pProp->m_Type].Decode( pInfo );
+		}
+		return;
+	}
+
+	if ( !pInfo->m_pRecvProp )
+		return;
+
+	// Store the value. These do the same thing as the stock RecvProxies.
+	switch ( pCodec->m_Access )
+	{
+		case DSTOCKPROXY_INT8:		*((unsigned char*)pInfo->m_pData) = *((unsigned char*)&pInfo->m_Value.m_Int);	break;
+		case DSTOCKPROXY_INT16:		*((unsigned short*)pInfo->m_pData) = *((unsigned short*)&pInfo->m_Value.m_Int);	break;
+		case DSTOCKPROXY_INT32:		*((unsigned long*)pInfo->m_pData) = *((unsigned long*)&pInfo->m_Value.m_Int);	break;
+		case DSTOCKPROXY_FLOAT:		*((float*)pInfo->m_pData) = pInfo->m_Value.m_Float;								break;
+
+		case DSTOCKPROXY_VECTOR:
+		{
+			((float*)pInfo->m_pData)[0] = v[0];
+			((float*)pInfo->m_pData)[1] = v[1];
+			((float*)pInfo->m_pData)[2] = v[2];
+		}
+		break;
+
+		default:
+		{
+			pInfo->m_pRecvProp->GetProxyFn()( pInfo, pInfo->m_pStruct, pInfo->m_pData );
+		}
+		break;
+	}
+}
+
+
+bool PropCodec_StoresInPlace( const CPropCodec *pCodec )
+{
+	if ( pCodec->m_Op == PROPCODEC_GENERIC )
+		return false;
+
+	switch ( pCodec->m_Access )
+	{
+		case DSTOCKPROXY_INT8:
+		case DSTOCKPROXY_INT16:
+		case DSTOCKPROXY_INT32:
+		case DSTOCKPROXY_FLOAT:
+		case DSTOCKPROXY_VECTOR:
+			return true;
+
+		default:
+			return false;
+	}
+}
@@ -85,6 +85,59 @@ typedef struct
 extern PropTypeFns g_PropTypeFns[DPT_NUMSendPropTypes];
 
 
+// ---------------------------------------------------------------------------------------- //
+// CPropCodec
+//
+// When the tables are set up (SendTable_Init on the server, RecvTable_CreateDecoders on the 
+// client), each flat property is compiled into one of these. The prop's type and flags are 
+// resolved down to a single op, and if the prop uses a stock proxy, the variable is read
+// (server) or written (client) in place instead of calling the proxy. Props the ops don't 
+// cover (arrays, strings, odd flag combinations) fall back to g_PropTypeFns.
+//
+// The encoded bits are exactly the same either way.
+// ---------------------------------------------------------------------------------------- //
+
+enum
+{
+	PROPCODEC_GENERIC=0,		// Use g_PropTypeFns.
+	PROPCODEC_INT_SIGNED,
+	PROPCODEC_INT_UNSIGNED,
+	PROPCODEC_FLOAT_COORD,
+	PROPCODEC_FLOAT_NOSCALE,
+	PROPCODEC_FLOAT_NORMAL,
+	PROPCODEC_FLOAT_QUANTIZED,
+	PROPCODEC_VECTOR_COORD,
+	PROPCODEC_VECTOR_NOSCALE,
+	PROPCODEC_VECTOR_NORMAL,	// Two normal-encoded components and a sign bit for z.
+	PROPCODEC_VECTOR_QUANTIZED
+};
+
+
+class CPropCodec
+{
+public:
+	const SendProp	*m_pProp;		// The prop that describes the encoding.
+	int				m_Offset;		// Server only: SendProp::GetOffset().
+	int				m_nBits;
+	unsigned char	m_Op;			// PROPCODEC_ define.
+	unsigned char	m_Access;		// DTStockProxy of the proxy that reads or writes the variable.
+};
+
+
+// Set up the codec for pProp. stockProxy comes from the SendProp on the server and the 
+// matching RecvProp on the client.
+void PropCodec_Init( CPropCodec *pCodec, const SendProp *pProp, DTStockProxy stockProxy );
+
+// Same as calling the prop's proxy and then g_PropTypeFns[type].Encode.
+void PropCodec_Encode( const CPropCodec *pCodec, const unsigned char *pStructBase, bf_write *pOut, int objectID );
+
+// Same as g_PropTypeFns[type].Decode.
+void PropCodec_Decode( const CPropCodec *pCodec, DecodeInfo *pInfo );
+
+// True if PropCodec_Decode stores the value itself instead of calling the RecvProxy.
+bool PropCodec_StoresInPlace( const CPropCodec *pCodec );
+
+
 // This is used for comparing packed buffers. Just extracts the raw bits for the 
 // data and returns the number of bits used to encode the data.
 int	DecodeBits( DecodeInfo *pInfo, unsigned char *pOut );
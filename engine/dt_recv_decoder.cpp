@@ -16,6 +16,7 @@ CRecvDecoder::CRecvDecoder()
 {
 	m_pTable = 0;
 	m_pClientSendTable = 0;
+	m_bParallelDecode = false;
 }
 
 CClientSendProp::CClientSendProp()
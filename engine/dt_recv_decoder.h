@@ -101,6 +101,10 @@ public:
 	CUtlVector<const RecvProp*>	m_Props;
 	CUtlVector<const RecvProp*>	m_DatatableProps;
 
+	// Set by RecvTable_CreateDecoders if all the datatable proxies are stock ones, so
+	// RecvTable_DecodeParallel can walk the tables off the main thread.
+	bool				m_bParallelDecode;
+
 	CDTIRecvTable *m_pDTITable;
 };
 
@@ -14,6 +14,7 @@
 #include "tier0/dbg.h"
 #include "dt_recv_decoder.h"
 #include "vstdlib/strtools.h"
+#include "convar.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -64,6 +65,8 @@ CUtlLinkedList< CClientSendTable*, unsigned short > g_ClientSendTables;
 
 int g_nPropsDecoded = 0;
 
+extern ConVar g_CV_DTPropCodecs;
+
 
 // ------------------------------------------------------------------------------------ //
 // Static helper functions.
@@ -400,6 +403,31 @@ bool RecvTable_CreateDecoders()
 		CSendTablePrecalc *pPrecalc = &pDecoder->m_Precalc;
 		CopySendPropsToRecvProps( pPrecalc->m_Props, pDecoder->m_Props );
 		CopySendPropsToRecvProps( pPrecalc->m_DatatableProps, pDecoder->m_DatatableProps );
+
+		// Compile the decode ops. The encoding comes from the server's SendProp and the
+		// way the value gets stored comes from our RecvProp.
+		pPrecalc->m_PropCodecs.SetSize( pPrecalc->GetNumProps() );
+		for ( int iProp=0; iProp < pPrecalc->GetNumProps(); iProp++ )
+		{
+			const RecvProp *pRecvProp = pDecoder->GetProp( iProp );
+			PropCodec_Init( 
+				&pPrecalc->m_PropCodecs[iProp], 
+				pPrecalc->GetProp( iProp ), 
+				pRecvProp ? pRecvProp->GetStockProxy() : DSTOCKPROXY_NONE );
+		}
+
+		// Custom datatable proxies get called while walking the tables, so those tables
+		// have to be decoded on the main thread.
+		pDecoder->m_bParallelDecode = true;
+		for ( int iDTProp=0; iDTProp < pDecoder->GetNumDatatableProps(); iDTProp++ )
+		{
+			const RecvProp *pDTProp = pDecoder->GetDatatableProp( iDTProp );
+			if ( !pDTProp || pDTProp->GetStockProxy() != DSTOCKPROXY_DATATABLE )
+			{
+				pDecoder->m_bParallelDecode = false;
+				break;
+			}
+		}
 	
 		DTI_HookRecvDecoder( pDecoder );
 	}
@@ -423,6 +451,8 @@ bool RecvTable_Decode(
 	// While there are properties, decode them.. walk the stack as you go.
 	CClientDatatableStack theStack( pDecoder, (unsigned char*)pStruct, objectID );
 
+	const CPropCodec *pCodecs = g_CV_DTPropCodecs.GetInt() ? pDecoder->m_Precalc.m_PropCodecs.Base() : NULL;
+
 	int iStartBit = 0, nIndexBits = 0, iLastBit = pIn->GetNumBitsRead();
 	
 	int iProp;
@@ -449,7 +479,11 @@ bool RecvTable_Decode(
 		decodeInfo.m_pIn = pIn;
 		decodeInfo.m_ObjectID = objectID;
 
-		g_PropTypeFns[pProp->GetType()].Decode( &decodeInfo );
+		if ( pCodecs )
+			PropCodec_Decode( &pCodecs[iProp], &decodeInfo );
+		else
+			g_PropTypeFns[pProp->GetType()].Decode( &decodeInfo );
+		
 		++g_nPropsDecoded;
 
 		// Instrumentation (store # bits for the encoded property).
@@ -464,6 +498,97 @@ bool RecvTable_Decode(
 }
 
 
+bool RecvTable_CanDecodeParallel( RecvTable *pTable )
+{
+	CRecvDecoder *pDecoder = pTable->m_pDecoder;
+	return pDecoder && pDecoder->m_bParallelDecode && g_CV_DTPropCodecs.GetInt() && !g_bDTIEnabled;
+}
+
+
+bool RecvTable_DecodeParallel( 
+	RecvTable *pTable, 
+	void *pStruct, 
+	bf_read *pIn, 
+	int objectID,
+	CUtlVector<CDeferredRecvProp> &deferred,
+	int *pnPropsDecoded
+	)
+{
+	CRecvDecoder *pDecoder = pTable->m_pDecoder;
+	Assert( pDecoder && pDecoder->m_bParallelDecode );
+
+	CClientDatatableStack theStack( pDecoder, (unsigned char*)pStruct, objectID );
+
+	const CPropCodec *pCodecs = pDecoder->m_Precalc.m_PropCodecs.Base();
+	
+	int iProp;
+	CDeltaBitsReader deltaBitsReader( pIn );
+	while ( deltaBitsReader.ReadNextPropIndex( &iProp ) )
+	{
+		theStack.SeekToProp( iProp );
+		
+		const RecvProp *pProp = pDecoder->GetProp( iProp );
+		Assert( pProp );
+
+		DecodeInfo decodeInfo;
+		decodeInfo.m_pStruct = theStack.GetCurStructBase();
+		decodeInfo.m_pData = theStack.GetCurStructBase() + pProp->GetOffset();
+		decodeInfo.m_pRecvProp = theStack.IsCurProxyValid() ? pProp : NULL;
+		decodeInfo.m_pProp = pDecoder->GetSendProp( iProp );
+		decodeInfo.m_pIn = pIn;
+		decodeInfo.m_ObjectID = objectID;
+
+		// Props with custom proxies are skipped here and decoded again when
+		// RecvTable_ApplyDeferred calls the proxy on the main thread.
+		if ( decodeInfo.m_pRecvProp && !PropCodec_StoresInPlace( &pCodecs[iProp] ) )
+		{
+			CDeferredRecvProp *pDeferred = &deferred[ deferred.AddToTail() ];
+			pDeferred->m_pStruct = theStack.GetCurStructBase();
+			pDeferred->m_iProp = iProp;
+			pDeferred->m_iBit = pIn->GetNumBitsRead();
+
+			decodeInfo.m_pRecvProp = NULL;
+		}
+
+		PropCodec_Decode( &pCodecs[iProp], &decodeInfo );
+		++(*pnPropsDecoded);
+	}
+	
+	return !pIn->IsOverflowed();	
+}
+
+
+void RecvTable_ApplyDeferred( 
+	RecvTable *pTable, 
+	bf_read *pIn, 
+	const CDeferredRecvProp *pProps, 
+	int nProps, 
+	int objectID 
+	)
+{
+	CRecvDecoder *pDecoder = pTable->m_pDecoder;
+	const CPropCodec *pCodecs = pDecoder->m_Precalc.m_PropCodecs.Base();
+
+	for ( int i=0; i < nProps; i++ )
+	{
+		const CDeferredRecvProp *pDeferred = &pProps[i];
+		const RecvProp *pProp = pDecoder->GetProp( pDeferred->m_iProp );
+
+		pIn->Seek( pDeferred->m_iBit );
+
+		DecodeInfo decodeInfo;
+		decodeInfo.m_pStruct = pDeferred->m_pStruct;
+		decodeInfo.m_pData = pDeferred->m_pStruct + pProp->GetOffset();
+		decodeInfo.m_pRecvProp = pProp;
+		decodeInfo.m_pProp = pDecoder->GetSendProp( pDeferred->m_iProp );
+		decodeInfo.m_pIn = pIn;
+		decodeInfo.m_ObjectID = objectID;
+
+		PropCodec_Decode( &pCodecs[pDeferred->m_iProp], &decodeInfo );
+	}
+}
+
+
 void RecvTable_DecodeZeros( RecvTable *pTable, void *pStruct, int objectID )
 {
 	CRecvDecoder *pDecoder = pTable->m_pDecoder;
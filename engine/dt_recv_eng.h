@@ -14,6 +14,7 @@
 
 #include "dt_recv.h"
 #include "bitbuf.h"
+#include "utlvector.h"
 #include "dt.h"
 
 
@@ -46,6 +47,42 @@ bool		RecvTable_Decode(
 	int objectID
 	);
 
+// A prop that RecvTable_DecodeParallel read past without calling its RecvProxy.
+class CDeferredRecvProp
+{
+public:
+	unsigned char	*m_pStruct;		// Base of the datatable the prop lives in.
+	int				m_iProp;
+	int				m_iBit;			// Where the prop's data starts in the input buffer.
+};
+
+// Returns true if RecvTable_DecodeParallel can be used on this table (no custom 
+// datatable proxies, and prop codecs and DTI are in their default state).
+bool		RecvTable_CanDecodeParallel( RecvTable *pTable );
+
+// Same as RecvTable_Decode, but doesn't call any custom code so it can run on a worker
+// thread. Props with stock proxies are stored right away. The rest are added to deferred,
+// pass them to RecvTable_ApplyDeferred on the main thread. The decoded prop count 
+// is added to *pnPropsDecoded instead of g_nPropsDecoded.
+bool		RecvTable_DecodeParallel( 
+	RecvTable *pTable, 
+	void *pStruct, 
+	bf_read *pIn, 
+	int objectID,
+	CUtlVector<CDeferredRecvProp> &deferred,
+	int *pnPropsDecoded
+	);
+
+// Decodes the deferred props again and calls their proxies. pIn must be the 
+// buffer RecvTable_DecodeParallel read them from.
+void		RecvTable_ApplyDeferred( 
+	RecvTable *pTable, 
+	bf_read *pIn, 
+	const CDeferredRecvProp *pProps, 
+	int nProps, 
+	int objectID 
+	);
+
 // This acts like a RecvTable_Decode() call where all properties are written and all their values are zero.
 void RecvTable_DecodeZeros( RecvTable *pTable, void *pStruct, int objectID );
 
@@ -13,13 +13,17 @@
 #include "tier0/dbg.h"
 #include "tier0/vprof.h"
 #include "checksum_crc.h"
+#include "convar.h"
 #include "sv_packedentities.h"
+#include "packed_entity.h"
+#include "iservernetworkable.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 
 extern int host_framecount;
+extern ConVar g_CV_DTPropCodecs;
 void Con_DPrintf (const char *fmt, ...);
 
 class CSendTablePrecalc;
@@ -360,6 +364,7 @@ public:
 					CEncodeInfo( CSendTablePrecalc *pPrecalc, unsigned char *pStructBase, int objectID ) :
 						CServerDatatableStack( pPrecalc, pStructBase, objectID )
 					{
+						m_bUseCodecs = g_CV_DTPropCodecs.GetInt() != 0;
 					}
 
 public:
@@ -372,6 +377,9 @@ public:
 	int			m_nOverheadBits;
 	int			m_nDataBits;
 
+	// Encode with CSendTablePrecalc::m_PropCodecs instead of the proxies and g_PropTypeFns.
+	bool		m_bUseCodecs;
+
 	CDeltaBitsWriter	*m_pDeltaBitsWriter;
 };
 
@@ -389,10 +397,8 @@ CUtlVector< SendTable* > g_SendTables;
 // SendTable functions.
 // ------------------------------------------------------------------------ //
 
-static bool debug_info_shown = false;
-static int  debug_bits_start = 0;
-
-static inline void ShowEncodeDeltaWatchInfo( 
+// Returns true if it printed any watch info.
+static inline bool ShowEncodeDeltaWatchInfo( 
 	const SendProp *pProp, 
 	const DVariant *pVar,
 	const int objectID )
@@ -409,12 +415,12 @@ static inline void ShowEncodeDeltaWatchInfo(
 				Con_DPrintf( "%i\n", host_framecount );
 			}
 
-			debug_info_shown = true;
-
 			g_PropTypeFns[pProp->m_Type].ShowSendWatchInfo( pVar, pProp, objectID );
+			return true;
 		}
 	}
 #endif
+	return false;
 }
 
 
@@ -427,29 +433,36 @@ static void SendTable_EncodeProp( CEncodeInfo *pInfo, unsigned long iProp )
 	// Write the index.
 	pInfo->m_nOverheadBits += pInfo->m_pDeltaBitsWriter->WritePropIndex( iProp );
 
-	const SendProp *pProp = pInfo->GetCurProp();
+	int iStartPos = pInfo->m_pOut->GetNumBitsWritten();
 
-	// Call their proxy to get the property's value.
-	DVariant var;
-	
-	pProp->GetProxyFn()( 
-		pInfo->GetCurStructBase(), 
-		pInfo->GetCurStructBase() + pProp->GetOffset(), 
-		&var, 
-		0, // iElement
-		pInfo->m_ObjectID
-		);
+	if ( pInfo->m_bUseCodecs )
+	{
+		PropCodec_Encode( &pInfo->m_pPrecalc->m_PropCodecs[iProp], pInfo->GetCurStructBase(), pInfo->m_pOut, pInfo->m_ObjectID );
+	}
+	else
+	{
+		const SendProp *pProp = pInfo->GetCurProp();
 
-	// Encode it.
-	int iStartPos = pInfo->m_pOut->GetNumBitsWritten();
+		// Call their proxy to get the property's value.
+		DVariant var;
+		
+		pProp->GetProxyFn()( 
+			pInfo->GetCurStructBase(), 
+			pInfo->GetCurStructBase() + pProp->GetOffset(), 
+			&var, 
+			0, // iElement
+			pInfo->m_ObjectID
+			);
 
-	g_PropTypeFns[pProp->m_Type].Encode( 
-		pInfo->GetCurStructBase(), 
-		&var, 
-		pProp, 
-		pInfo->m_pOut, 
-		pInfo->m_ObjectID
-		); 
+		// Encode it.
+		g_PropTypeFns[pProp->m_Type].Encode( 
+			pInfo->GetCurStructBase(), 
+			&var, 
+			pProp, 
+			pInfo->m_pOut, 
+			pInfo->m_ObjectID
+			); 
+	}
 
 	pInfo->m_nDataBits += ( pInfo->m_pOut->GetNumBitsWritten() - iStartPos ); // record # bits written.
 }
@@ -592,9 +605,8 @@ void SendTable_WritePropList(
 	const int *pCheckProps,
 	const int nCheckProps )
 {
-
-	debug_info_shown = false;
-	debug_bits_start = pOut->GetNumBitsWritten();
+	bool debug_info_shown = false;
+	int  debug_bits_start = pOut->GetNumBitsWritten();
 
 	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
 	CDeltaBitsWriter deltaBitsWriter( pOut );
@@ -631,7 +643,8 @@ void SendTable_WritePropList(
 			int nToStateBits = inputBuffer.GetNumBitsRead() - iStartBit;
 
 			// Show debug stuff.
-			ShowEncodeDeltaWatchInfo( pProp, &propSkipper.m_Value, objectID );
+			if ( ShowEncodeDeltaWatchInfo( pProp, &propSkipper.m_Value, objectID ) )
+				debug_info_shown = true;
 			
 			// Write the data into the output.
 			deltaBitsWriter.WritePropIndex( iToProp );
@@ -701,6 +714,179 @@ int SendTable_CalcDelta(
 }
 
 
+int SendTable_GetPropsFromVarChanges(
+	const SendTable *pTable,
+	const NetworkVarChange_t *pChanges,
+	int nChanges,
+	int *pOutProps,
+	int nMaxOutProps
+	)
+{
+	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
+	int nOutProps = 0;
+
+	for ( int iProp=0; iProp < pPrecalc->GetNumProps(); iProp++ )
+	{
+		const CPropVarRange *pRange = &pPrecalc->m_PropVarRanges[iProp];
+
+		bool bChanged = ( pRange->m_Offset == -1 );
+		for ( int i=0; i < nChanges && !bChanged; i++ )
+		{
+			bChanged = pRange->m_Offset < pChanges[i].m_Offset + pChanges[i].m_nBytes && 
+				pRange->m_Offset + pRange->m_nBytes > pChanges[i].m_Offset;
+		}
+
+		if ( bChanged )
+		{
+			ErrorIfNot( nOutProps < nMaxOutProps, ("SendTable_GetPropsFromVarChanges: overflow in '%s'.", pTable->GetName()) );
+			pOutProps[nOutProps++] = iProp;
+		}
+	}
+
+	return nOutProps;
+}
+
+
+bool SendTable_EncodeChangedProps(
+	const SendTable *pTable,
+	const void *pStruct,
+	const void *pPrevState,
+	const int nPrevBits,
+	const int *pEncodeProps,
+	const int nEncodeProps,
+	bf_write *pOut,
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	int *pDeltaProps,
+	int nMaxDeltaProps,
+	int &nDeltaProps
+	)
+{
+	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
+	ErrorIfNot( pPrecalc, ("SendTable_EncodeChangedProps: Missing m_pPrecalc for SendTable %s.", pTable->m_pNetTableName) );
+	if ( pRecipients )
+	{
+		ErrorIfNot(	pRecipients->NumAllocated() >= pTable->GetNumDataTableProxies(), ("SendTable_EncodeChangedProps: pRecipients array too small.") );
+	}
+
+	VPROF( "SendTable_EncodeChangedProps" );
+
+	CServerDTITimer timer( pTable, SERVERDTI_ENCODE );
+
+	// Encode the props that may have changed.
+	char changedData[MAX_PACKEDENTITY_DATA];
+	bf_write changedBuf( "SendTable_EncodeChangedProps->changedBuf", changedData, sizeof( changedData ) );
+	{
+		CDeltaBitsWriter deltaBitsWriter( &changedBuf );
+
+		CEncodeInfo info( pPrecalc, (unsigned char*)pStruct, objectID );
+		info.m_pOut = &changedBuf;
+		info.m_ObjectID = objectID;
+		info.m_nDataBits = 0;
+		info.m_nOverheadBits = 0;
+		info.m_pDeltaBitsWriter = &deltaBitsWriter;
+		info.m_pRecipients = pRecipients;
+
+		// This calls all the datatable proxies, so pRecipients is filled in even if there's nothing to encode.
+		info.Init();
+
+		for ( int i=0; i < nEncodeProps; i++ )
+		{
+			info.SeekToProp( pEncodeProps[i] );
+			SendTable_EncodeProp( &info, pEncodeProps[i] );
+		}
+	}
+
+	if ( changedBuf.IsOverflowed() )
+		return false;
+
+	// Now merge them with the previous state. Both lists are sorted by prop index.
+	bf_read prevBuf( "SendTable_EncodeChangedProps->prevBuf", pPrevState, BitByte( nPrevBits ), nPrevBits );
+	CDeltaBitsReader prevBitsReader( &prevBuf );
+	DecodeInfo prevSkipper;
+	InitDecodeInfoForSkippingProps( &prevSkipper, &prevBuf, objectID );
+
+	bf_read changedReadBuf( "SendTable_EncodeChangedProps->changedReadBuf", changedData, changedBuf.GetNumBytesWritten(), changedBuf.GetNumBitsWritten() );
+	CDeltaBitsReader changedBitsReader( &changedReadBuf );
+	DecodeInfo changedSkipper;
+	InitDecodeInfoForSkippingProps( &changedSkipper, &changedReadBuf, objectID );
+
+	nDeltaProps = 0;
+	{
+		CDeltaBitsWriter deltaBitsWriter( pOut );
+
+		int iPrevProp = NextProp( &prevBitsReader );
+		int iChangedProp = NextProp( &changedBitsReader );
+		int iEncodeProp = 0;
+		while ( iPrevProp != PROP_SENTINEL || iChangedProp != PROP_SENTINEL )
+		{
+			if ( iChangedProp <= iPrevProp )
+			{
+				// Use the newly encoded value.
+				const SendProp *pProp = pPrecalc->GetProp( iChangedProp );
+				int iStartBit = changedReadBuf.GetNumBitsRead();
+
+				bool bChange = true;
+				if ( iChangedProp == iPrevProp )
+				{
+					bChange = g_PropTypeFns[pProp->m_Type].CompareDeltas( pProp, &prevBuf, &changedReadBuf );
+					iPrevProp = NextProp( &prevBitsReader );
+				}
+				else
+				{
+					SkipPropData( &changedSkipper, pProp );
+				}
+
+				int nBits = changedReadBuf.GetNumBitsRead() - iStartBit;
+				deltaBitsWriter.WritePropIndex( iChangedProp );
+				changedReadBuf.Seek( iStartBit );
+				pOut->WriteBitsFromBuffer( &changedReadBuf, nBits );
+
+				if ( bChange )
+				{
+					if ( nDeltaProps < nMaxDeltaProps )
+					{
+						pDeltaProps[nDeltaProps] = iChangedProp;
+					}
+					++nDeltaProps;
+				}
+
+				iChangedProp = NextProp( &changedBitsReader );
+			}
+			else
+			{
+				// Copy the old value unless we re-encoded this prop and its proxy left it out this time.
+				const SendProp *pProp = pPrecalc->GetProp( iPrevProp );
+				int iStartBit = prevBuf.GetNumBitsRead();
+				SkipPropData( &prevSkipper, pProp );
+
+				while ( iEncodeProp < nEncodeProps && pEncodeProps[iEncodeProp] < iPrevProp )
+				{
+					++iEncodeProp;
+				}
+
+				if ( iEncodeProp == nEncodeProps || pEncodeProps[iEncodeProp] != iPrevProp )
+				{
+					int nBits = prevBuf.GetNumBitsRead() - iStartBit;
+					deltaBitsWriter.WritePropIndex( iPrevProp );
+					prevBuf.Seek( iStartBit );
+					pOut->WriteBitsFromBuffer( &prevBuf, nBits );
+				}
+
+				iPrevProp = NextProp( &prevBitsReader );
+			}
+		}
+	}
+
+	ErrorIfNot( 
+		nDeltaProps <= nMaxDeltaProps && !prevBuf.IsOverflowed() && !changedReadBuf.IsOverflowed(), 
+		( "SendTable_EncodeChangedProps: overflowed on datatable '%s'.", pTable->GetName() ) 
+		);
+
+	return !pOut->IsOverflowed();
+}
+
+
 bool SendTable_SendInfo( SendTable *pTable, bf_write *pBuf )
 {
 	pBuf->WriteString(pTable->m_pNetTableName);
@@ -777,6 +963,54 @@ static void SendTable_Validate( CSendTablePrecalc *pPrecalc )
 }
 
 
+// Figures out which bytes of the object each prop's value comes from. baseOffset is where pNode's
+// data starts in the object, or -1 if a proxy above it points somewhere else.
+static void SendTable_SetupPropVarRanges_R( CSendTablePrecalc *pPrecalc, CSendNode *pNode, int baseOffset )
+{
+	for ( int i=0; i < pNode->GetNumProps(); i++ )
+	{
+		int iProp = pNode->GetFirstPropIndex() + i;
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+		CPropVarRange *pRange = &pPrecalc->m_PropVarRanges[iProp];
+
+		pRange->m_Offset = -1;
+		pRange->m_nBytes = 0;
+
+		if ( baseOffset == -1 )
+			continue;
+
+		if ( pProp->GetType() == DPT_Array )
+		{
+			// Note we get the OFFSET from the array element property and the STRIDE from the array itself.
+			const SendProp *pArrayProp = pProp->GetArrayProp();
+			if ( pArrayProp->IsDirectProxy() && !pProp->GetArrayLengthProxy() && pProp->GetElementStride() > 0 )
+			{
+				pRange->m_Offset = baseOffset + pArrayProp->GetOffset();
+				pRange->m_nBytes = pProp->GetNumElements() * pProp->GetElementStride();
+			}
+		}
+		else if ( pProp->IsDirectProxy() )
+		{
+			// The prop starts reading at its offset, so it's affected by whichever var contains that byte.
+			pRange->m_Offset = baseOffset + pProp->GetOffset();
+			pRange->m_nBytes = 1;
+		}
+	}
+
+	for ( int iChild=0; iChild < pNode->GetNumChildren(); iChild++ )
+	{
+		CSendNode *pChild = pNode->GetChild( iChild );
+		const SendProp *pDatatableProp = pPrecalc->GetDatatableProp( pChild->m_iDatatableProp );
+
+		int childOffset = -1;
+		if ( baseOffset != -1 && pDatatableProp->IsDirectProxy() )
+			childOffset = baseOffset + pDatatableProp->GetOffset();
+
+		SendTable_SetupPropVarRanges_R( pPrecalc, pChild, childOffset );
+	}
+}
+
+
 static bool SendTable_InitTable( SendTable *pTable )
 {
 	if( pTable->m_pPrecalc )
@@ -796,6 +1030,16 @@ static bool SendTable_InitTable( SendTable *pTable )
 	if ( !pPrecalc->SetupFlatPropertyArray() )
 		return false;
 
+	pPrecalc->m_PropVarRanges.SetSize( pPrecalc->GetNumProps() );
+	SendTable_SetupPropVarRanges_R( pPrecalc, pPrecalc->GetRootNode(), 0 );
+
+	pPrecalc->m_PropCodecs.SetSize( pPrecalc->GetNumProps() );
+	for ( int iProp=0; iProp < pPrecalc->GetNumProps(); iProp++ )
+	{
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+		PropCodec_Init( &pPrecalc->m_PropCodecs[iProp], pProp, pProp->GetStockProxy() );
+	}
+
 	SendTable_Validate( pPrecalc );
 	return true;
 }
@@ -16,6 +16,8 @@
 #include "bitbuf.h"
 #include "utlmemory.h"
 
+struct NetworkVarChange_t;
+
 typedef unsigned long CRC32_t;
 
 
@@ -103,6 +105,38 @@ bool		SendTable_Encode(
 	);
 
 
+// Fills in pOutProps with the properties (sorted) that read from the network vars in pChanges, plus 
+// any properties whose values can't be traced back to a network var. Returns the number of properties.
+int			SendTable_GetPropsFromVarChanges(
+	const SendTable *pTable,
+	const NetworkVarChange_t *pChanges,
+	int nChanges,
+	int *pOutProps,
+	int nMaxOutProps
+	);
+
+
+// Like SendTable_Encode, but it only re-encodes the properties in pEncodeProps and copies the rest
+// from pPrevState, which must be an earlier SendTable_Encode of the same object.
+//
+// The indices of the properties whose encoded values differ from pPrevState are written into pDeltaProps 
+// (like SendTable_CalcDelta would) and their count into nDeltaProps.
+bool		SendTable_EncodeChangedProps(
+	const SendTable *pTable,
+	const void *pStruct,
+	const void *pPrevState,
+	const int nPrevBits,
+	const int *pEncodeProps,
+	const int nEncodeProps,
+	bf_write *pOut,
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	int *pDeltaProps,
+	int nMaxDeltaProps,
+	int &nDeltaProps
+	);
+
+
 // In order to receive a table, you must send it from the server and receive its info
 // on the client so the client knows how to unpack it.
 bool		SendTable_SendInfo( SendTable *pTable, bf_write *pBuf );
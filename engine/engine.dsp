@@ -314,6 +314,10 @@ SOURCE=..\Public\bitbuf.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\bitbuf_benchmark.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\bitbuf_errorhandler.cpp
 # End Source File
 # Begin Source File
@@ -322,6 +326,10 @@ SOURCE=..\Public\BSPTreeData.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\brushclip_benchmark.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\bugreporter.cpp
 # End Source File
 # Begin Source File
@@ -1145,6 +1153,10 @@ SOURCE=.\DisplayStats.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\disptrace_benchmark.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\dt.cpp
 # End Source File
 # Begin Source File
@@ -1782,6 +1794,10 @@ SOURCE=.\net_chan.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\net_lz.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\net_synctags.cpp
 # End Source File
 # Begin Source File
@@ -1875,6 +1891,10 @@ SOURCE=.\packed_entity.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\physics_benchmark.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\Pr_edict.cpp
 # End Source File
 # Begin Source File
@@ -2038,6 +2058,18 @@ SOURCE=.\audio\private\snd_dsp.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\spatialpartition_benchmark.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\spatialpartition_grid.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\staticpropbvh.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\StaticPropMgr.cpp
 # End Source File
 # Begin Source File
@@ -2094,6 +2126,10 @@ SOURCE=.\sv_redirect.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\sv_relay.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\Sv_user.cpp
 # End Source File
 # Begin Source File
@@ -2215,6 +2251,10 @@ SOURCE=.\tmessage.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\trace_benchmark.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\traceinit.cpp
 # SUBTRACT CPP /YX /Yc /Yu
 # End Source File
@@ -2952,6 +2992,10 @@ SOURCE=.\NET.H
 # End Source File
 # Begin Source File
 
+SOURCE=.\net_lz.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\net_synctags.h
 # End Source File
 # Begin Source File
@@ -3100,6 +3144,10 @@ SOURCE=.\SPRITEGN.H
 # End Source File
 # Begin Source File
 
+SOURCE=.\staticpropbvh.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\StaticPropMgr.h
 # End Source File
 # Begin Source File
@@ -3136,6 +3184,10 @@ SOURCE=.\sv_precache.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\sv_relay.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\SYS.H
 # End Source File
 # Begin Source File
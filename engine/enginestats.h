@@ -15,6 +15,7 @@
 #include "utlvector.h"
 #include "sysexternal.h"
 #include "filesystem.h" // FileHandle_t define
+#include "tier0/platform.h"
 
 class IClientStats;
 struct IClientStatsTextDisplay;
@@ -309,6 +310,7 @@ inline void CEngineStats::SetTimedStat( EngineTimedStatId_t stat, float time )
 	m_StatGroup.m_StatFrameTime[stat] = time; 
 }
 
+// This isn't interlocked, counts from other threads (traces on worker threads) can get lost
 inline void CEngineStats::IncrementCountedStat( EngineCountedStatId_t stat, int inc )
 {
 	if (m_InFrame)
@@ -341,9 +343,11 @@ class CMeasureTimedStat
 {
 public:
 	// constructor, destructor
+	// Only the main thread's time is measured, the timers aren't per thread
 	CMeasureTimedStat( EngineTimedStatId_t stat ) : m_Stat(stat)
 	{
-		if( r_speeds.GetBool() )
+		m_bTimed = r_speeds.GetBool() && Plat_IsPrimaryThread();
+		if( m_bTimed )
 		{
 			g_EngineStats.BeginTimedStat(m_Stat);
 		}
@@ -351,7 +355,7 @@ public:
 
 	~CMeasureTimedStat()
 	{
-		if( r_speeds.GetBool() )
+		if( m_bTimed )
 		{
 			g_EngineStats.EndTimedStat(m_Stat);
 		}
@@ -359,6 +363,7 @@ public:
 
 private:
 	EngineTimedStatId_t m_Stat;
+	bool m_bTimed;
 };
 
 
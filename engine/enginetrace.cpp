@@ -50,6 +50,9 @@ public:
 	// Same thing, but enumerate entitys within a box
 	virtual void	EnumerateEntities( const Vector &vecAbsMins, const Vector &vecAbsMaxs, IEntityEnumerator *pEnumerator );
 
+	// TraceRay for a batch of rays
+	virtual void	TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces );
+
 	// FIXME: Different versions for client + server. Eventually we need to make these go away
 	virtual void HandleEntityToCollideable( IHandleEntity *pHandleEntity, ICollideable **ppCollide, const char **ppDebugName ) = 0;
 	virtual ICollideable *GetWorldCollideable() = 0;
@@ -88,6 +91,14 @@ private:
 	// Clips a trace to another trace
 	bool ClipTraceToTrace( trace_t &clipTrace, trace_t *pFinalTrace );
 
+	// Pieces of TraceRay that TraceRays does for a packet at a time
+	void SetupEntityRay( const Ray_t &ray, trace_t *pTrace, Ray_t &entityRay, 
+		float &flWorldFraction, float &flWorldFractionLeftSolidScale );
+	ICollideable *GetTraceCandidate( IHandleEntity *pHandleEntity, unsigned int fMask, ITraceFilter *pTraceFilter );
+	void FinishTraceRay( const Ray_t &ray, trace_t *pTrace, 
+		float flWorldFraction, float flWorldFractionLeftSolidScale );
+	void TraceRayPacket( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces );
+
 };
 
 class CEngineTraceServer : public CEngineTrace
@@ -301,6 +312,12 @@ int	CEngineTrace::GetPointContents( const Vector &vecAbsPosition, IHandleEntity*
 		SpatialPartition()->EnumerateElementsAtPoint( SpatialPartitionMask(),
 			vecAbsPosition, false, &contentsEnum );
 
+		// Static props in the BVH aren't in the solid lists
+		if ( contentsEnum.m_Contents == CONTENTS_EMPTY )
+		{
+			StaticPropMgr()->EnumerateSolidPropsAtPoint( vecAbsPosition, &contentsEnum );
+		}
+
 		int nEntityContents = contentsEnum.m_Contents;
 		if ( nEntityContents & MASK_CURRENT )
 			nContents = CONTENTS_WATER;
@@ -505,10 +522,8 @@ bool CEngineTrace::ClipRayToBBox( const Ray_t &ray, unsigned int fMask, ICollide
 	if ( pEntity->GetSolid() != SOLID_BBOX )
 		return false;
 
-	int nHeadNode = CM_HeadnodeForBoxHull( pEntity->WorldAlignMins(), pEntity->WorldAlignMaxs() );
-
 	// bboxes don't rotate
-	CM_TransformedBoxTrace( ray, nHeadNode, fMask, pEntity->GetCollisionOrigin(), vec3_angle, *pTrace );
+	CM_TransformedBoxTraceToBox( ray, pEntity->WorldAlignMins(), pEntity->WorldAlignMaxs(), fMask, pEntity->GetCollisionOrigin(), *pTrace );
 	return true;
 }
 
@@ -799,6 +814,130 @@ ICollideable *CEngineTraceServer::GetWorldCollideable()
 }
 
 
+//-----------------------------------------------------------------------------
+// Shortens a ray that got past the world so it stops where the world trace
+// did, and sets up the trace to be clipped against entities along it
+//-----------------------------------------------------------------------------
+void CEngineTrace::SetupEntityRay( const Ray_t &ray, trace_t *pTrace, Ray_t &entityRay, 
+	float &flWorldFraction, float &flWorldFractionLeftSolidScale )
+{
+	// Save the world collision fraction.
+	flWorldFraction = pTrace->fraction;
+	flWorldFractionLeftSolidScale = flWorldFraction; // VXP
+
+	// Create a ray that extends only until we hit the world
+	// and adjust the trace accordingly
+	entityRay = ray;
+//	entityRay.m_Delta *= pTrace->fraction;
+
+	if ( pTrace->fraction == 0 )
+	{
+		entityRay.m_Delta.Init();
+		flWorldFractionLeftSolidScale = pTrace->fractionleftsolid;
+		pTrace->fractionleftsolid = 1.0f;
+		pTrace->fraction = 1.0f;
+	}
+	else
+	{
+		// Explicitly compute end so that this computation happens at the quantization of
+		// the output (endpos).  That way we won't miss any intersections we would get
+		// by feeding these results back in to the tracer
+		// This is not the same as entityRay.m_Delta *= pTrace->fraction which happens 
+		// at a quantization that is more precise as m_Start moves away from the origin
+		Vector end;
+		VectorMA( entityRay.m_Start, pTrace->fraction, entityRay.m_Delta, end );
+		VectorSubtract(end, entityRay.m_Start, entityRay.m_Delta);
+		// We know this is safe because pTrace->fraction != 0
+		pTrace->fractionleftsolid /= pTrace->fraction;
+ 		pTrace->fraction = 1.0;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns the collideable for an entity along the ray, or NULL if the trace
+// should skip it
+//-----------------------------------------------------------------------------
+ICollideable *CEngineTrace::GetTraceCandidate( IHandleEntity *pHandleEntity, unsigned int fMask, ITraceFilter *pTraceFilter )
+{
+	bool bNoStaticProps = pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY;
+	bool bFilterStaticProps = pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS;
+
+	// Generate a collideable
+	ICollideable *pCollideable;
+	const char *pDebugName;
+	HandleEntityToCollideable( pHandleEntity, &pCollideable, &pDebugName );
+
+	// Check for error condition
+	if ( !IsSolid( pCollideable->GetSolid(), pCollideable->GetSolidFlags() ) )
+	{
+	//	char temp[1024];
+	//	Q_snprintf(temp, sizeof( temp ), "%s in solid list (not solid)\n", pDebugName );
+	//	Sys_Error (temp);
+		Assert( 0 );
+		Msg( "%s in solid list (not solid)\n", pDebugName );
+		return NULL;
+	}
+
+	if ( !StaticPropMgr()->IsStaticProp( pHandleEntity ) )
+	{
+		if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
+			return NULL;
+	}
+	else
+	{
+		// FIXME: Could remove this check here by
+		// using a different spatial partition mask. Look into it
+		// if we want more speedups here.
+		if ( bNoStaticProps )
+			return NULL;
+
+		if ( bFilterStaticProps )
+		{
+			if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
+				return NULL;
+		}
+	}
+
+	return pCollideable;
+}
+
+
+//-----------------------------------------------------------------------------
+// Takes a trace clipped against the world and then entities back to the
+// original ray
+//-----------------------------------------------------------------------------
+void CEngineTrace::FinishTraceRay( const Ray_t &ray, trace_t *pTrace, 
+	float flWorldFraction, float flWorldFractionLeftSolidScale )
+{
+	// Fix up the fractions so they are appropriate given the original
+	// unclipped-to-world ray
+	pTrace->fraction *= flWorldFraction;
+	pTrace->fractionleftsolid *= flWorldFractionLeftSolidScale;
+
+#ifdef _DEBUG
+	Vector vecOffset, vecEndTest;
+	VectorAdd( ray.m_Start, ray.m_StartOffset, vecOffset );
+	VectorMA( vecOffset, pTrace->fractionleftsolid, ray.m_Delta, vecEndTest );
+	Assert( VectorsAreEqual( vecEndTest, pTrace->startpos, 0.1f ) );
+	VectorMA( vecOffset, pTrace->fraction, ray.m_Delta, vecEndTest );
+	Assert( VectorsAreEqual( vecEndTest, pTrace->endpos, 0.1f ) ); // VXP: When in HL1 you try to move a physics box by pressing E and moving (at least in the hazard course, t0a0b1)
+//	Assert( !ray.m_IsRay || pTrace->allsolid || pTrace->fraction >= pTrace->fractionleftsolid );
+#endif
+
+	if ( !ray.m_IsRay )
+	{
+		// Make sure no fractionleftsolid can be used with box sweeps
+		VectorAdd( ray.m_Start, ray.m_StartOffset, pTrace->startpos );
+		pTrace->fractionleftsolid = 0;
+
+#ifdef _DEBUG
+		pTrace->fractionleftsolid = VEC_T_NAN;
+#endif
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // A version that simply accepts a ray (can work as a traceline or tracehull)
 //-----------------------------------------------------------------------------
@@ -849,36 +988,9 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		VectorAdd( pTrace->startpos, ray.m_Delta, pTrace->endpos );
 	}
 
-	// Save the world collision fraction.
-	float flWorldFraction = pTrace->fraction;
-	float flWorldFractionLeftSolidScale = flWorldFraction; // VXP
-
-	// Create a ray that extends only until we hit the world
-	// and adjust the trace accordingly
-	Ray_t entityRay = ray;
-//	entityRay.m_Delta *= pTrace->fraction;
-
-	if ( pTrace->fraction == 0 )
-	{
-		entityRay.m_Delta.Init();
-		flWorldFractionLeftSolidScale = pTrace->fractionleftsolid;
-		pTrace->fractionleftsolid = 1.0f;
-		pTrace->fraction = 1.0f;
-	}
-	else
-	{
-		// Explicitly compute end so that this computation happens at the quantization of
-		// the output (endpos).  That way we won't miss any intersections we would get
-		// by feeding these results back in to the tracer
-		// This is not the same as entityRay.m_Delta *= pTrace->fraction which happens 
-		// at a quantization that is more precise as m_Start moves away from the origin
-		Vector end;
-		VectorMA( entityRay.m_Start, pTrace->fraction, entityRay.m_Delta, end );
-		VectorSubtract(end, entityRay.m_Start, entityRay.m_Delta);
-		// We know this is safe because pTrace->fraction != 0
-		pTrace->fractionleftsolid /= pTrace->fraction;
- 		pTrace->fraction = 1.0;
-	}
+	Ray_t entityRay;
+	float flWorldFraction, flWorldFractionLeftSolidScale;
+	SetupEntityRay( ray, pTrace, entityRay, flWorldFraction, flWorldFractionLeftSolidScale );
 
 	// Collide with entities along the ray
 	// FIXME: Hitbox code causes this to be re-entrant for the IK stuff.
@@ -887,85 +999,191 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 	CEntitiesAlongRay enumerator;
 	enumerator.Reset();
 	SpatialPartition()->EnumerateElementsAlongRay( SpatialPartitionMask(), entityRay, false, &enumerator );
-
-	bool bNoStaticProps = pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY;
-	bool bFilterStaticProps = pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS;
+	if ( pTraceFilter->GetTraceType() != TRACE_ENTITIES_ONLY )
+	{
+		StaticPropMgr()->EnumerateSolidPropsAlongRay( entityRay, &enumerator );
+	}
 
 	trace_t tr;
-	ICollideable *pCollideable;
-	const char *pDebugName;
 	int nCount = enumerator.m_EntityHandles.Count();
 	for ( int i = 0; i < nCount; ++i )
 	{
-		// Generate a collideable
-		IHandleEntity *pHandleEntity = enumerator.m_EntityHandles[i];
-		HandleEntityToCollideable( pHandleEntity, &pCollideable, &pDebugName );
+		ICollideable *pCollideable = GetTraceCandidate( enumerator.m_EntityHandles[i], fMask, pTraceFilter );
+		if ( !pCollideable )
+			continue;
+
+		ClipRayToCollideable( entityRay, fMask, pCollideable, &tr );
 
-		// Check for error condition
-		if ( !IsSolid( pCollideable->GetSolid(), pCollideable->GetSolidFlags() ) )
+		// Make sure the ray is always shorter than it currently is
+		ClipTraceToTrace( tr, pTrace );
+
+		// Stop if we're in allsolid
+		if (pTrace->allsolid)
+			break;
+	}
+
+	FinishTraceRay( ray, pTrace, flWorldFraction, flWorldFractionLeftSolidScale );
+}
+
+
+//-----------------------------------------------------------------------------
+// Grabs all entities along a packet of rays, with the rays that touch each
+//-----------------------------------------------------------------------------
+class CEntitiesAlongRays : public IPartitionRaysEnumerator
+{
+public:
+	struct Entity_t
+	{
+		IHandleEntity	*m_pHandleEntity;
+		unsigned int	m_nRayMask;
+	};
+
+	CEntitiesAlongRays( ) : m_Entities(0, 64) {}
+
+	IterationRetval_t EnumElement( IHandleEntity *pHandleEntity, unsigned int nRayMask )
+	{
+		int i = m_Entities.AddToTail();
+		m_Entities[i].m_pHandleEntity = pHandleEntity;
+		m_Entities[i].m_nRayMask = nRayMask;
+		return ITERATION_CONTINUE;
+	}
+
+	CUtlVector< Entity_t >	m_Entities;
+};
+
+
+//-----------------------------------------------------------------------------
+// Traces up to MAX_PARTITION_RAYS rays.  This is TraceRay with each step done
+// for the whole packet before moving on to the next.
+//-----------------------------------------------------------------------------
+void CEngineTrace::TraceRayPacket( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces )
+{
+	Assert( nRays > 0 && nRays <= MAX_PARTITION_RAYS );
+
+	// Rays that still need to be clipped against entities
+	unsigned int nActiveMask = ( nRays == 32 ) ? 0xFFFFFFFF : ( ( 1U << nRays ) - 1 );
+	int i;
+
+	// Collide with the world.
+	if ( pTraceFilter->GetTraceType() != TRACE_ENTITIES_ONLY )
+	{
+		ICollideable *pCollide = GetWorldCollideable();
+		Assert( pCollide );
+		Assert(!pCollide || pCollide->GetCollisionOrigin() == vec3_origin );
+		Assert(!pCollide || pCollide->GetCollisionAngles() == vec3_angle );
+
+		CM_BoxTraces( pRays, nRays, 0, fMask, true, pTraces );
+
+		for ( i = 0; i < nRays; ++i )
 		{
-		//	char temp[1024];
-		//	Q_snprintf(temp, sizeof( temp ), "%s in solid list (not solid)\n", pDebugName );
-		//	Sys_Error (temp);
-			Assert( 0 );
-			Msg( "%s in solid list (not solid)\n", pDebugName );
-			continue;
+			SetTraceEntity( pCollide, &pTraces[i] );
+
+			// Blocked by the world, or only tracing against it
+			if ( pTraces[i].startsolid || pTraceFilter->GetTraceType() == TRACE_WORLD_ONLY )
+			{
+				nActiveMask &= ~( 1U << i );
+			}
 		}
 
-		if ( !StaticPropMgr()->IsStaticProp( pHandleEntity ) )
+		if ( !nActiveMask )
+			return;
+	}
+	else
+	{
+		for ( i = 0; i < nRays; ++i )
 		{
-			if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
-				continue;
+			CM_ClearTrace( &pTraces[i] );
+			VectorAdd( pRays[i].m_Start, pRays[i].m_StartOffset, pTraces[i].startpos );
+			VectorAdd( pTraces[i].startpos, pRays[i].m_Delta, pTraces[i].endpos );
 		}
-		else
+	}
+
+	// Only the rays that made it past the world are in the packet from here on
+	Ray_t entityRays[MAX_PARTITION_RAYS];
+	int rayIndex[MAX_PARTITION_RAYS];
+	float flWorldFraction[MAX_PARTITION_RAYS];
+	float flWorldFractionLeftSolidScale[MAX_PARTITION_RAYS];
+	int nEntityRays = 0;
+	for ( i = 0; i < nRays; ++i )
+	{
+		if ( !( nActiveMask & ( 1U << i ) ) )
+			continue;
+
+		SetupEntityRay( pRays[i], &pTraces[i], entityRays[nEntityRays], 
+			flWorldFraction[nEntityRays], flWorldFractionLeftSolidScale[nEntityRays] );
+		rayIndex[nEntityRays] = i;
+		++nEntityRays;
+	}
+
+	// One walk through the spatial partition for the whole packet.  This isn't static
+	// for the same reason TraceRay's enumerator isn't.
+	CEntitiesAlongRays enumerator;
+	SpatialPartition()->EnumerateElementsAlongRays( SpatialPartitionMask(), entityRays, nEntityRays, &enumerator );
+	if ( pTraceFilter->GetTraceType() != TRACE_ENTITIES_ONLY )
+	{
+		StaticPropMgr()->EnumerateSolidPropsAlongRays( entityRays, nEntityRays, &enumerator );
+	}
+
+	// Each entity is turned into a collideable and filtered once, then clipped
+	// against every ray that touches its bounds
+	unsigned int nClipMask = ( nEntityRays == 32 ) ? 0xFFFFFFFF : ( ( 1U << nEntityRays ) - 1 );
+	trace_t tr;
+	int nCount = enumerator.m_Entities.Count();
+	for ( int j = 0; j < nCount && nClipMask; ++j )
+	{
+		unsigned int nRayMask = enumerator.m_Entities[j].m_nRayMask & nClipMask;
+		if ( !nRayMask )
+			continue;
+
+		ICollideable *pCollideable = GetTraceCandidate( enumerator.m_Entities[j].m_pHandleEntity, fMask, pTraceFilter );
+		if ( !pCollideable )
+			continue;
+
+		for ( i = 0; i < nEntityRays; ++i )
 		{
-			// FIXME: Could remove this check here by
-			// using a different spatial partition mask. Look into it
-			// if we want more speedups here.
-			if ( bNoStaticProps )
+			if ( !( nRayMask & ( 1U << i ) ) )
 				continue;
 
-			if ( bFilterStaticProps )
+			trace_t *pTrace = &pTraces[ rayIndex[i] ];
+			ClipRayToCollideable( entityRays[i], fMask, pCollideable, &tr );
+
+			// Make sure the ray is always shorter than it currently is
+			ClipTraceToTrace( tr, pTrace );
+
+			// Stop if we're in allsolid
+			if (pTrace->allsolid)
 			{
-				if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
-					continue;
+				nClipMask &= ~( 1U << i );
 			}
 		}
+	}
 
-		ClipRayToCollideable( entityRay, fMask, pCollideable, &tr );
+	for ( i = 0; i < nEntityRays; ++i )
+	{
+		FinishTraceRay( pRays[ rayIndex[i] ], &pTraces[ rayIndex[i] ], 
+			flWorldFraction[i], flWorldFractionLeftSolidScale[i] );
+	}
+}
 
-		// Make sure the ray is always shorter than it currently is
-		ClipTraceToTrace( tr, pTrace );
 
-		// Stop if we're in allsolid
-		if (pTrace->allsolid)
-			break;
+//-----------------------------------------------------------------------------
+// TraceRay for a batch of rays, a packet at a time
+//-----------------------------------------------------------------------------
+void CEngineTrace::TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces )
+{
+	CTraceFilterHitAll traceFilter;
+	if ( !pTraceFilter )
+	{
+		pTraceFilter = &traceFilter;
 	}
 
-	// Fix up the fractions so they are appropriate given the original
-	// unclipped-to-world ray
-	pTrace->fraction *= flWorldFraction;
-	pTrace->fractionleftsolid *= flWorldFractionLeftSolidScale;
-
-#ifdef _DEBUG
-	Vector vecOffset, vecEndTest;
-	VectorAdd( ray.m_Start, ray.m_StartOffset, vecOffset );
-	VectorMA( vecOffset, pTrace->fractionleftsolid, ray.m_Delta, vecEndTest );
-	Assert( VectorsAreEqual( vecEndTest, pTrace->startpos, 0.1f ) );
-	VectorMA( vecOffset, pTrace->fraction, ray.m_Delta, vecEndTest );
-	Assert( VectorsAreEqual( vecEndTest, pTrace->endpos, 0.1f ) ); // VXP: When in HL1 you try to move a physics box by pressing E and moving (at least in the hazard course, t0a0b1)
-//	Assert( !ray.m_IsRay || pTrace->allsolid || pTrace->fraction >= pTrace->fractionleftsolid );
-#endif
+	// Gather statistics.
+	g_EngineStats.IncrementCountedStat( ENGINE_STATS_NUM_TRACE_LINES, nRays );
+	MEASURE_TIMED_STAT( ENGINE_STATS_TRACE_LINE_TIME );
 
-	if ( !ray.m_IsRay )
+	for ( int i = 0; i < nRays; i += MAX_PARTITION_RAYS )
 	{
-		// Make sure no fractionleftsolid can be used with box sweeps
-		VectorAdd( ray.m_Start, ray.m_StartOffset, pTrace->startpos );
-		pTrace->fractionleftsolid = 0;
-
-#ifdef _DEBUG
-		pTrace->fractionleftsolid = VEC_T_NAN;
-#endif
+		TraceRayPacket( &pRays[i], min( nRays - i, MAX_PARTITION_RAYS ), fMask, pTraceFilter, &pTraces[i] );
 	}
 }
 
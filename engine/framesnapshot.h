@@ -11,8 +11,10 @@
 #endif
 
 #include "mempool.h"
+#include "tier0/threadtools.h"
 
 class PackedEntity;
+class PackedDataArena;
 
 //-----------------------------------------------------------------------------
 // Purpose: Individual entity data, did the entity exist and what was it's serial number
@@ -35,20 +37,19 @@ typedef int PackedEntityHandle_t;
 class CFrameSnapshot
 {
 	DECLARE_FIXEDSIZE_ALLOCATOR( CFrameSnapshot );
+	friend class CFrameSnapshotManager;
 
 public:
 
 							CFrameSnapshot();
 							~CFrameSnapshot();
 
-	// Reference-counting.
+	// Reference-counting. These are safe to call from any thread.
 	void					AddReference();
 	void					ReleaseReference();
 						
 
 public:
-	unsigned short			m_ListIndex;	// Index info CFrameSnapshotManager::m_FrameSnapshots.
-
 	// Associated frame. This comes from host_tickcount.
 	int						m_nTickNumber;
 
@@ -58,11 +59,14 @@ public:
 	// Keeps track of the fullpack info for this frame for all entities in any pvs
 	PackedEntityHandle_t	m_pPackedData[ MAX_EDICTS ];
 
+	// The entities packed this tick put their data in here (NULL if sv_snapshotarena is 0).
+	PackedDataArena			*m_pArena;
+
 
 private:
 
-	// Snapshots auto-delete themselves when their refcount goes to zero.
-	unsigned short			m_nReferences;
+	// When the refcount goes to zero the manager deletes the snapshot on the main thread.
+	long volatile			m_nReferences;
 };
 
 //-----------------------------------------------------------------------------
@@ -97,6 +101,15 @@ public:
 	virtual PackedEntity*	GetPreviouslySentPacket( int iEntity, int iSerialNumber ) = 0;
 };
 
+// Threading notes:
+// - TakeTickSnapshot, CreatePackedEntity and UsePreviouslySentPacket are only called
+//   from the main thread while the client packs are being computed.
+// - Once packing is done, SV_CreatePacketEntities may run for several clients at once
+//   (see sv_workerthreads). During that phase GetPackedEntity and GetPreviouslySentPacket
+//   are read-only, and snapshot references may be added and
+//   released from any thread without a lock. Snapshots whose refcount reaches zero are
+//   only deleted by the main thread, at the next TakeTickSnapshot or LevelChanged.
+
 extern IFrameSnapshot *framesnapshot;
 
 #endif // FRAMESNAPSHOT_H
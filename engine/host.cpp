@@ -29,6 +29,7 @@
 #include "zone.h"
 #include "game_interface.h"
 #include "sv_filter.h"
+#include "sv_relay.h"
 #include "vid.h"
 #include "glquake.h"
 
@@ -72,6 +73,7 @@
 #include "tmessage.h"
 #include "cl_ents.h"
 #include "tier0/vprof.h"
+#include "vprof_engine.h"
 #include "vstdlib/ICommandLine.h"
 #include "materialsystem/imaterialsystemhardwareconfig.h"
 #include "glquake.h"
@@ -1240,6 +1242,9 @@ void _Host_RunFrame_Server( bool finaltick )
 	SV_Frame ( send_client_updates );
 	g_HostTimes.EndFrameSegment( FRAME_SEGMENT_SERVER );
 
+	// A relay without a map reads the server socket itself, rcon included
+	SV_RelayFrame();
+
 	// Look for connectionless rcon packets on dedicated servers
 	SV_CheckRcom();
 
@@ -1478,7 +1483,9 @@ void _Host_RunFrame (float time)
 		//-------------------
 		// Only send updates to clients on final tick so we don't reencode network data multiple times per frame unnecessarily
 		bool finaltick = ( tick == numticks - 1 ) ? true : false;
+		VProfTrace_BeginTick( host_tickcount );
 		_Host_RunFrame_Server( finaltick );
+		VProfTrace_EndTick( host_tickcount );
 
 		//-------------------
 		//
@@ -16,6 +16,22 @@
 
 #include "ispatialpartition.h"
 
+struct Ray_t;
+
+// Most rays EnumerateElementsAlongRays can take at once
+#define MAX_PARTITION_RAYS	32
+
+
+//-----------------------------------------------------------------------------
+// Gets each element along a packet of rays once, with a bit set in nRayMask
+// for each ray that touches its bounds
+//-----------------------------------------------------------------------------
+class IPartitionRaysEnumerator
+{
+public:
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity, unsigned int nRayMask ) = 0;
+};
+
 
 //-----------------------------------------------------------------------------
 // These methods of the spatial partition manager are only used in the engine
@@ -23,17 +39,33 @@
 class ISpatialPartitionInternal : public ISpatialPartition
 {
 public:
+	virtual ~ISpatialPartitionInternal() {}
+
 	// Call this to clear out the spatial partition and to re-initialize
 	// it given a particular world size
 	virtual void Init( const Vector& worldmin, const Vector& worldmax ) = 0;
+
+	// Like EnumerateElementsAlongRay, but walks the tree once for up to
+	// MAX_PARTITION_RAYS rays.  Elements come out in tree order, not ray order.
+	virtual void EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask,
+		const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator ) = 0;
 };
 
 
 //-----------------------------------------------------------------------------
-// Method to get at the singleton implementation of the spatial partition mgr
+// Method to get at the singleton implementation of the spatial partition mgr.
+// It's the voxel tree, or the loose grid with -spatialgrid.  With
+// -partitionrecord it goes through a recorder for spatialpartition_record.
 //-----------------------------------------------------------------------------
 ISpatialPartitionInternal* SpatialPartition();
 
+// The implementations, spatialpartition_benchmark makes its own.  Delete them when done.
+ISpatialPartitionInternal* CreateSpatialPartitionTree();
+ISpatialPartitionInternal* CreateSpatialPartitionGrid();
+
+// Wraps a spatial partition so spatialpartition_record can record what's done with it
+ISpatialPartitionInternal* CreateSpatialPartitionRecorder( ISpatialPartitionInternal *pPartition );
+
 
 #endif	// ISPATIALPARTITIONINTERNAL_H
 
@@ -49,6 +49,8 @@
 #include "materialsystem/imesh.h"
 #include "icliententity.h"
 #include "sys_dll.h"
+#include "sys.h"
+#include "zone.h"
 #include "gl_rmain.h"
 #include "debugoverlay.h"
 #include "enginetrace.h"
@@ -225,6 +227,117 @@ void Mod_UnloadStudioModel(model_t *mod)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// .phy files in the mapped layout are kept around while vphysics uses their solids
+// in place.  Loose files are mapped, files in pack files are read into one aligned
+// block.  Old .phy files are read into temp memory and the solids copied out.
+//-----------------------------------------------------------------------------
+struct physfile_t
+{
+	void	*pAlloc;	// NULL if the file is mapped
+	int		size;
+};
+
+static double	s_flPhysFileLoadTime = 0;
+static int		s_nPhysFiles = 0;
+static int		s_nPhysFileBytes = 0;
+static int		s_nPhysFilesMapped = 0;
+static int		s_nPhysFilesCopied = 0;	// old layout
+
+static void Mod_ReleasePhysFile( const void *pFile, void *pContext )
+{
+	physfile_t *pPhysFile = (physfile_t *)pContext;
+	if ( pPhysFile->pAlloc )
+	{
+		free( pPhysFile->pAlloc );
+	}
+	else
+	{
+		Sys_UnmapFile( (void *)pFile, pPhysFile->size );
+	}
+	delete pPhysFile;
+}
+
+static bool Mod_LoadPhysFile( vcollide_t *pCollide, const char *pFileName )
+{
+	FileHandle_t hFile;
+	int fileSize = COM_OpenFile( pFileName, &hFile );
+	if ( !hFile )
+		return false;
+
+	int version = 0;
+	if ( fileSize >= (int)sizeof(phyheader_t) )
+	{
+		g_pFileSystem->Read( &version, sizeof(version), hFile );
+	}
+	g_pFileSystem->Seek( hFile, 0, FILESYSTEM_SEEK_HEAD );
+
+	s_nPhysFiles++;
+	s_nPhysFileBytes += fileSize;
+
+	if ( version != sizeof(phymappedheader_t) )
+	{
+		// load into tempalloc
+		s_nPhysFilesCopied++;
+		byte *buf = (byte *)Hunk_TempAlloc( fileSize + 1 );
+		g_pFileSystem->Read( buf, fileSize, hFile );
+		COM_CloseFile( hFile );
+		return physcollision->VCollideLoadFile( pCollide, buf, fileSize, NULL, NULL );
+	}
+
+	physfile_t *pPhysFile = new physfile_t;
+	pPhysFile->pAlloc = NULL;
+	pPhysFile->size = fileSize;
+
+	void *pData = NULL;
+	char localPath[ MAX_OSPATH ];
+	if ( g_pFileSystem->GetLocalPath( pFileName, localPath ) )
+	{
+		pData = Sys_MapFile( localPath, fileSize );
+	}
+
+	if ( pData )
+	{
+		s_nPhysFilesMapped++;
+	}
+	else
+	{
+		pPhysFile->pAlloc = malloc( fileSize + PHY_MAPPED_ALIGN - 1 );
+		pData = (void *)( ( (unsigned int)pPhysFile->pAlloc + PHY_MAPPED_ALIGN - 1 ) & ~( PHY_MAPPED_ALIGN - 1 ) );
+		g_pFileSystem->Read( pData, fileSize, hFile );
+	}
+	COM_CloseFile( hFile );
+
+	// vphysics calls Mod_ReleasePhysFile when it's done with the file, maybe right away
+	return physcollision->VCollideLoadFile( pCollide, pData, fileSize, Mod_ReleasePhysFile, pPhysFile );
+}
+
+static void Mod_VCollideStats_f( void )
+{
+	vcollidestats_t stats;
+
+	// Lets a load be timed on its own, the solid figures are always what's loaded now
+	if ( Cmd_Argc() == 2 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ) )
+	{
+		s_flPhysFileLoadTime = 0;
+		s_nPhysFiles = 0;
+		s_nPhysFileBytes = 0;
+		s_nPhysFilesMapped = 0;
+		s_nPhysFilesCopied = 0;
+		return;
+	}
+
+	physcollision->VCollideGetStats( &stats );
+
+	Con_Printf( "%d .phy files, %d KB (%d old layout, %d mapped), loaded in %.1f ms\n", s_nPhysFiles, s_nPhysFileBytes / 1024,
+		s_nPhysFilesCopied, s_nPhysFilesMapped, s_flPhysFileLoadTime * 1000.0 );
+	Con_Printf( "%d solids, %d KB: %d KB copied to the heap, %d KB used in place from %d files\n", stats.solidCount,
+		stats.solidBytes / 1024, stats.copiedBytes / 1024, stats.mappedBytes / 1024, stats.fileCount );
+	Con_Printf( "%d solids shared between models, saving %d KB\n", stats.sharedCount, stats.sharedBytes / 1024 );
+}
+
+static ConCommand vcollide_stats( "vcollide_stats", Mod_VCollideStats_f, "Shows .phy load time since startup or the last 'vcollide_stats reset' and the memory used by the loaded collision models." );
+
 //=============================================================================
 vcollide_t *Mod_VCollide( model_t *pModel )
 {
@@ -248,27 +361,19 @@ vcollide_t *Mod_VCollide( model_t *pModel )
 	memset( &pModel->studio.vcollisionData, 0, sizeof( pModel->studio.vcollisionData ) );
 
 	char fileName[256];
-	int fileSize = 0;
 
 	COM_StripExtension( pModel->name, fileName, sizeof( fileName ) );
 	COM_DefaultExtension( fileName, ".PHY", sizeof( fileName ) );
 	
-	// load into tempalloc
-	byte *buf = COM_LoadFile( fileName, 2, &fileSize );
-	if ( !buf )
-		return NULL;
+	vcollide_t *pCollide = &pModel->studio.vcollisionData;
 
-	phyheader_t header;
-	memcpy( &header, buf, sizeof(header) );
-	buf += sizeof(header);
-	fileSize -= sizeof(header);
+	double start = Sys_FloatTime();
+	bool loaded = Mod_LoadPhysFile( pCollide, fileName );
+	s_flPhysFileLoadTime += Sys_FloatTime() - start;
 
-	if ( header.size != sizeof(header) || header.solidCount <= 0 )
+	if ( !loaded )
 		return NULL;
 
-	vcollide_t *pCollide = &pModel->studio.vcollisionData;
-	physcollision->VCollideLoad( pCollide, header.solidCount, (const char *)buf, fileSize );
-	
 	return pCollide;
 }
 
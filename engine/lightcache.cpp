@@ -2163,8 +2163,15 @@ void MarkDLightsOnStaticProps( void )
 #endif
 		s_pDLightVis = NULL;
 		s_MarkStaticPropLightsEnumerator.SetLightID( i );
-		SpatialPartition()->EnumerateElementsInSphere( PARTITION_ENGINE_STATIC_PROPS, 
-			l->origin, l->radius, true, &s_MarkStaticPropLightsEnumerator );
+		if ( StaticPropMgr()->HasPropBVH() )
+		{
+			StaticPropMgr()->EnumerateSolidPropsInSphere( l->origin, l->radius, &s_MarkStaticPropLightsEnumerator );
+		}
+		else
+		{
+			SpatialPartition()->EnumerateElementsInSphere( PARTITION_ENGINE_STATIC_PROPS, 
+				l->origin, l->radius, true, &s_MarkStaticPropLightsEnumerator );
+		}
 	}
 }
 
@@ -31,12 +31,13 @@
 //  4 bytes of incoming seq
 //  and for each stream
 // {
-//  byte (on/off)
-//  int (fragment id)
-//  short (startpos)
-//  short (length)
+//  byte (0 if off, else FRAGHDR_ flags)
+//  int (offset of fragment data in the payload)
+//  int (bytes of fragment data)
+//  int (total size of the payload)
+//  int (startpos)
 // }
-#define HEADER_BYTES ( 8 + MAX_STREAMS * 9 )
+#define HEADER_BYTES ( 8 + MAX_STREAMS * 17 )
 
 // Pad this to next higher 16 byte boundary
 // This is the largest packet that can come in/out over the wire, before processing the header
@@ -67,6 +68,10 @@ void		NET_Shutdown (void);
 qboolean	NET_GetPacket (netsrc_t nSock);
 // Send packet over network layer
 void		NET_SendPacket (netsrc_t nSock, int length, void *data, netadr_t to);
+// Packets sent between these go out together at NET_FlushSendBatch (net_batchio, Linux only).
+// NET_FlushSendBatch also ends a frame for net_iostats.
+void		NET_BeginSendBatch( void );
+void		NET_FlushSendBatch( void );
 // Start up/shut down sockets layer
 void		NET_Config (qboolean multiplayer);
 // Check state
@@ -122,42 +127,60 @@ typedef struct
 // Size of fragmentation buffer internal buffers
 #define FRAGMENT_SIZE 1400
 
+// Most fragments a stream can pack into one reliable message
+#define MAX_FRAG_WINDOW 16
+
+// Largest payload the file stream will send or accept ( file name + data )
+#define NET_MAX_FILE_PAYLOAD ( 32 * 1024 * 1024 )
+
 #define	FRAG_NORMAL_STREAM	0
 #define FRAG_FILE_STREAM	1
 
-// Generic fragment structure
-typedef struct fragbuf_s
+// Per stream header flags
+#define FRAGHDR_PRESENT		( 1 << 0 )
+#define FRAGHDR_COMPRESSED	( 1 << 1 )	// Payload is an uncompressed size followed by NET_LZCompress data
+
+// Refcounted block of outgoing data.  Fragments are just byte ranges of it, the data
+//  is copied once when it's queued and then straight into each packet that carries it.
+typedef struct fragpayload_s
 {
-	// Next buffer in chain
-	struct fragbuf_s	*next;
-	// Id of this buffer
-	int					bufferid;
-	// Message buffer where raw data is stored
-	bf_write			frag_message;
-	// The actual data sits here
-	byte				frag_message_buf[ FRAGMENT_SIZE ];
-	// Is this a file buffer?
-	qboolean			isfile;
-	// Is this file buffer from memory ( custom decal, etc. ).
-	qboolean			isbuffer;
-	// Name of the file to save out on remote host
-	char				filename[ MAX_OSPATH ];
-	// Offset in file from which to read data
-	int					foffset;  
-	// Size of data to read at that offset
-	int					size;
-} fragbuf_t;
-
-// Waiting list of fragbuf chains
-typedef struct fragbufwaiting_s
+	// Send queues and reliable messages referencing this payload
+	int						refcount;
+	// Bytes of data.  File payloads start with the file name.
+	int						size;
+	byte					*data;
+	// Data went through NET_LZCompress
+	qboolean				compressed;
+	// Files read from disk are shared by every channel sending them
+	char					filename[ MAX_OSPATH ];
+	struct fragpayload_s	*nextfile;
+} fragpayload_t;
+
+// Payload queued on an outgoing stream
+typedef struct fragsend_s
 {
-	// Next chain in waiting list
-	struct fragbufwaiting_s		*next;
-	// Number of buffers in this chain
-	int							fragbufcount;
-	// The actual buffers
-	fragbuf_t					*fragbufs;
-} fragbufwaiting_t;
+	// Next payload in the queue
+	struct fragsend_s		*next;
+	fragpayload_t			*payload;
+	// Size of each fragment
+	int						chunksize;
+	// Next byte of the payload to go out
+	int						sendpos;
+} fragsend_t;
+
+// Incoming payload, reassembled in place as fragments arrive
+typedef struct
+{
+	byte		*data;
+	// Bytes allocated at data, this grows with the data received rather than the size
+	//  the sender claims
+	int			allocated;
+	int			size;
+	// Fragments arrive in order, so this is also the offset of the next one
+	int			received;
+	// Sender compressed the payload
+	qboolean	compressed;
+} fragrecv_t;
 
 // Network Connection Channel
 typedef struct
@@ -167,6 +190,12 @@ typedef struct
 
 	// Address this channel is talking to.
 	netadr_t	remote_address;  
+
+	// Remote side can decompress fragment payloads, agreed on at connect time
+	qboolean	compress;
+	// Send all reliable data as fragment payloads so it never shares a packet with the
+	//  unreliable datagram.  Spectator relays ( sv_relay.cpp ) ask for this at connect time.
+	qboolean	fragreliable;
 	
 	// For timeouts.  Time last message was received.
 	float		last_received;		
@@ -200,31 +229,31 @@ typedef struct
 	bf_write	message;
 	byte		message_buf[NET_MAX_PAYLOAD];
 
-	// Reliable message buffer.  We keep adding to it until reliable is acknowledged.  Then we clear it.
+	// Reliable message bits, including fragment data.  We keep adding to it until reliable
+	//  is acknowledged.  Then we clear it.
 	int			reliable_length;
+	// Bits of the reliable message that sit in reliable_buf, the fragment data follows them
+	int			reliable_buflength;
 	byte		reliable_buf[NET_MAX_PAYLOAD];	// unacked reliable message
 
-	// Waiting list of buffered fragments to go onto queue.
-	// Multiple outgoing buffers can be queued in succession
-	fragbufwaiting_t *waitlist[ MAX_STREAMS ]; 
+	// Outgoing payloads queued on each stream, the head is the one being sent.
+	fragsend_t	*fragsend[ MAX_STREAMS ];
 
-	// Is reliable waiting buf a fragment?
+	// Is there fragment data in the reliable message?
 	int				reliable_fragment[ MAX_STREAMS ];          
-	// Buffer id for each waiting fragment
-	unsigned int	reliable_fragid[ MAX_STREAMS ];
-
-	// The current fragment being set
-	fragbuf_t	*fragbufs[ MAX_STREAMS ];
-	// The total number of fragments in this stream
-	int			fragbufcount[ MAX_STREAMS ];
+	// Fragment data in the reliable message.  This is a view into the payload, resends
+	//  read it from there again.
+	fragpayload_t	*reliable_payload[ MAX_STREAMS ];
+	int				reliable_fragpos[ MAX_STREAMS ];
+	int				reliable_fragsize[ MAX_STREAMS ];
 
 	// Position in outgoing buffer where frag data starts
-	short		frag_startpos[ MAX_STREAMS ];
+	int			frag_startpos[ MAX_STREAMS ];
 	// Length of frag data in the buffer
-	short		frag_length[ MAX_STREAMS ];
+	int			frag_length[ MAX_STREAMS ];
 
-	// Incoming fragments are stored here
-	fragbuf_t	*incomingbufs[ MAX_STREAMS ];
+	// Incoming payloads are reassembled here
+	fragrecv_t	incoming[ MAX_STREAMS ];
 	// Set to true when incoming data is ready
 	qboolean	incomingready[ MAX_STREAMS ];
 
@@ -257,8 +286,10 @@ void	Netchan_OutOfBandPrint (netsrc_t sock, netadr_t adr, char *format, ...);
 void	Netchan_CreateFragments( qboolean server, netchan_t *chan, bf_write *msg );
 int		Netchan_CreateFileFragments( qboolean server, netchan_t *chan, char *filename );
 void	Netchan_CreateFileFragmentsFromBuffer ( qboolean server, netchan_t *chan, char *filename, unsigned char *pbuf, int size );
-// Force fragments into ready queue
-void	Netchan_FragSend( netchan_t *chan );
+// Refcounted payloads shared by many channels, the caller owns one reference
+fragpayload_t *Netchan_CreatePayload( byte *data, int size, qboolean compress );
+void	Netchan_QueueSharedPayload( netchan_t *chan, fragpayload_t *payload );
+void	Netchan_ReleasePayload( fragpayload_t *payload );
 // Update download/upload slider
 void	Netchan_UpdateProgress( netchan_t *chan );
 void	Netchan_ReportFlow( netchan_t *chan );
@@ -273,6 +304,8 @@ qboolean Netchan_CopyNormalFragments( netchan_t *chan );
 qboolean Netchan_CopyFileFragments( netchan_t *chan );
 // Is data being sent on this channel
 qboolean Netchan_IsSending( netchan_t *chan );
+// Bytes queued on the channel's streams that haven't gone out yet
+int		Netchan_QueuedBytes( netchan_t *chan );
 // Is data being received on this channel
 qboolean Netchan_IsReceiving( netchan_t *chan );
 // Is data ready
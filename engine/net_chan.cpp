@@ -10,14 +10,11 @@
 #include "host.h"
 #include "demo.h"
 #include "filesystem_engine.h"
+#include "net_lz.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
-#define MAKE_FRAGID(id,count)	( ( ( id & 0xffff ) << 16 ) | ( count & 0xffff ) )
-#define FRAG_GETID(fragid)		( ( fragid >> 16 ) & 0xffff )
-#define FRAG_GETCOUNT(fragid)	( fragid & 0xffff )
-
 // UDP has 28 byte headers
 #define UDP_HEADER_SIZE 28
 
@@ -29,6 +26,9 @@
 // Biggest packet that has frag and or reliable data
 #define MAX_RELIABLE_PAYLOAD 1200
 
+// Payloads smaller than this aren't worth compressing
+#define MIN_COMPRESS_PAYLOAD 128
+
 // Biggest packet on a resend ( if datagram size is > this - the 1200 ( 200 bytes ) for the reliable, it gets discarded )
 #define MAX_RESEND_PAYLOAD 1400
 
@@ -36,7 +36,7 @@ extern ConVar scr_downloading;
 
 // Forward declarations
 void Netchan_FlushIncoming( netchan_t *chan, int stream );
-void Netchan_AddBufferToList( fragbuf_t **pplist, fragbuf_t *pbuf );
+void Netchan_CreateFragments_( qboolean server, netchan_t *chan, bf_write *msg );
 
 int		net_drop;
 
@@ -44,49 +44,193 @@ ConVar	net_showpackets( "net_showpackets", "0", 0, "Dump packet summary to conso
 ConVar	net_showdrop( "net_showdrop", "0", 0, "Show dropped packets in console" );
 ConVar	net_drawslider( "net_drawslider", "0", 0, "Draw completion slider during signon" );
 ConVar  net_chokeloopback( "net_chokeloop", "0", 0, "Apply bandwidth choke to loopback packets" ); 
+ConVar	net_compress( "net_compress", "1", 0, "Compress large reliable messages and file transfers if the remote side supports it" );
+static ConVar net_fragwindow( "net_fragwindow", "4", 0, "Number of net_blocksize fragments each stream packs into a reliable message.",
+	true, 1, true, MAX_FRAG_WINDOW );
+
+// File payloads that are being sent, so channels downloading the same file share one copy
+static fragpayload_t *s_pFilePayloads = NULL;
 
 /*
 ==============================
-Netchan_UnlinkFragment
+Netchan_AllocPayload
 
+Returns a payload with one reference, owned by the caller
 ==============================
 */
-void Netchan_UnlinkFragment( fragbuf_t *buf, fragbuf_t **list )
+static fragpayload_t *Netchan_AllocPayload( int size )
 {
-	fragbuf_t *search;
+	fragpayload_t *payload;
 
-	if ( !list )
-	{
-		Con_Printf( "Netchan_UnlinkFragment:  Asked to unlink fragment from empty list, ignored\n" );
+	// Data follows the header in the same block
+	payload = ( fragpayload_t * )new byte[ sizeof( fragpayload_t ) + size ];
+	memset( payload, 0, sizeof( *payload ) );
+
+	payload->refcount	= 1;
+	payload->size		= size;
+	payload->data		= ( byte * )( payload + 1 );
+
+	return payload;
+}
+
+/*
+==============================
+Netchan_ReleasePayload
+
+==============================
+*/
+void Netchan_ReleasePayload( fragpayload_t *payload )
+{
+	fragpayload_t **pp;
+
+	Assert( payload->refcount > 0 );
+	if ( --payload->refcount > 0 )
 		return;
+
+	if ( payload->filename[ 0 ] )
+	{
+		for ( pp = &s_pFilePayloads; *pp; pp = &(*pp)->nextfile )
+		{
+			if ( *pp == payload )
+			{
+				*pp = payload->nextfile;
+				break;
+			}
+		}
 	}
 
-	// At head of list
-	if ( buf == *list )
+	delete[] ( byte * )payload;
+}
+
+/*
+==============================
+Netchan_CompressPayload
+
+Returns a compressed copy of payload if that's smaller, either way the caller's reference moves to
+the returned payload
+==============================
+*/
+static fragpayload_t *Netchan_CompressPayload( fragpayload_t *payload )
+{
+	fragpayload_t *compressed;
+	byte *scratch;
+	int size;
+
+	if ( payload->compressed || payload->size < MIN_COMPRESS_PAYLOAD )
+		return payload;
+
+	// Only keep it if it shrinks
+	scratch = new byte[ payload->size ];
+	size = NET_LZCompress( payload->data, payload->size, scratch + 4, payload->size - 5 );
+	if ( !size )
 	{
-		// Remove first element
-		*list = buf->next;
-		
-		// Destroy remnant
-		delete[] buf;
-		return;
+		delete[] scratch;
+		return payload;
 	}
 
-	search = *list;
-	while ( search->next )
+	// Uncompressed size goes in front so the remote side can allocate for it
+	scratch[ 0 ] = payload->size & 0xff;
+	scratch[ 1 ] = ( payload->size >> 8 ) & 0xff;
+	scratch[ 2 ] = ( payload->size >> 16 ) & 0xff;
+	scratch[ 3 ] = ( payload->size >> 24 ) & 0xff;
+
+	compressed = Netchan_AllocPayload( size + 4 );
+	Q_memcpy( compressed->data, scratch, size + 4 );
+	compressed->compressed = true;
+
+	delete[] scratch;
+	Netchan_ReleasePayload( payload );
+	return compressed;
+}
+
+/*
+==============================
+Netchan_UncompressedSize
+
+Returns the uncompressed size of a completed incoming payload after making sure it's sane
+==============================
+*/
+static int Netchan_UncompressedSize( fragrecv_t *pin, int maxsize )
+{
+	int size;
+
+	if ( pin->size < 4 )
+		return -1;
+
+	size = pin->data[ 0 ] | ( pin->data[ 1 ] << 8 ) | ( pin->data[ 2 ] << 16 ) | ( pin->data[ 3 ] << 24 );
+	if ( size <= 0 || size > maxsize )
+		return -1;
+
+	return size;
+}
+
+/*
+==============================
+Netchan_QueuePayload
+
+Adds payload to the end of the stream's send queue, the queue takes over the caller's reference
+==============================
+*/
+static void Netchan_QueuePayload( netchan_t *chan, int stream, fragpayload_t *payload, int chunksize )
+{
+	fragsend_t *send, **pp;
+
+	send = new fragsend_t;
+	send->next		= NULL;
+	send->payload	= payload;
+	send->chunksize	= chunksize;
+	send->sendpos	= 0;
+
+	pp = &chan->fragsend[ stream ];
+	while ( *pp )
+	{
+		pp = &(*pp)->next;
+	}
+	*pp = send;
+}
+
+/*
+==============================
+Netchan_PopPayload
+
+Removes the payload at the head of the stream's send queue
+==============================
+*/
+static void Netchan_PopPayload( netchan_t *chan, int stream )
+{
+	fragsend_t *send;
+
+	send = chan->fragsend[ stream ];
+	if ( !send )
+		return;
+
+	chan->fragsend[ stream ] = send->next;
+	Netchan_ReleasePayload( send->payload );
+	delete send;
+}
+
+/*
+==============================
+Netchan_ReleaseReliableFragments
+
+Drops the reliable message's references to fragment data once it's been acked
+==============================
+*/
+static void Netchan_ReleaseReliableFragments( netchan_t *chan )
+{
+	int i;
+
+	for ( i = 0; i < MAX_STREAMS; i++ )
 	{
-		if ( search->next == buf )
+		if ( chan->reliable_payload[ i ] )
 		{
-			search->next = buf->next;
-			// Detroy remnant
-			delete[] buf;
-			return;
+			Netchan_ReleasePayload( chan->reliable_payload[ i ] );
+			chan->reliable_payload[ i ] = NULL;
 		}
-
-		search = search->next;
+		chan->reliable_fragment[ i ]	= 0;
+		chan->reliable_fragpos[ i ]		= 0;
+		chan->reliable_fragsize[ i ]	= 0;
 	}
-
-	Con_Printf( "Netchan_UnlinkFragment:  Couldn't find fragment\n" );
 }
 
 /*
@@ -136,30 +280,6 @@ void Netchan_OutOfBandPrint (netsrc_t sock, netadr_t adr, char *format, ...)
 }
 
 
-/*
-==============================
-Netchan_ClearFragbufs
-
-==============================
-*/
-void Netchan_ClearFragbufs( fragbuf_t **ppbuf )
-{
-	fragbuf_t *buf, *n;
-
-	if ( !ppbuf )
-		return;
-
-	// Throw away any that are sitting around
-	buf = *ppbuf;
-	while ( buf )
-	{
-		n = buf->next;
-		delete[] buf;
-		buf = n;
-	}
-	*ppbuf = NULL;
-}
-
 /*
 ==============================
 Netchan_ClearFragments
@@ -168,20 +288,18 @@ Netchan_ClearFragments
 */
 void Netchan_ClearFragments( netchan_t *chan )
 {
-	fragbufwaiting_t *wait;
 	int i;
 
+	Netchan_ReleaseReliableFragments( chan );
+
 	for ( i = 0; i < MAX_STREAMS; i++ )
 	{
-		wait = chan->waitlist[ i ];
-		while ( wait )
+		// Throw away any that are sitting around
+		while ( chan->fragsend[ i ] )
 		{
-			Netchan_ClearFragbufs( &wait->fragbufs );
-			wait = wait->next;
+			Netchan_PopPayload( chan, i );
 		}
-		chan->waitlist[ i ] = NULL;
 
-		Netchan_ClearFragbufs( &chan->fragbufs[ i ] );
 		Netchan_FlushIncoming( chan, i );
 	}
 }
@@ -199,12 +317,10 @@ void Netchan_Clear( netchan_t *chan )
 
 	chan->cleartime			= 0.0;
 	chan->reliable_length	= 0;
+	chan->reliable_buflength = 0;
 
 	for ( i = 0 ; i < MAX_STREAMS; i++ )
 	{
-		chan->reliable_fragid[ i ]		= 0;
-		chan->reliable_fragment[ i ]	= 0;
-		chan->fragbufcount[ i ]			= 0;
 		chan->frag_startpos[ i ]		= 0;
 		chan->frag_length[ i ]			= 0;
 		chan->incomingready[ i ]		= false;
@@ -372,15 +488,22 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 	if ( !chan->reliable_length )
 	{
 		qboolean send_frag = false;
-		fragbuf_t *pbuf;
+		fragsend_t *pfrag;
+		int window;
 
 		// Will be true if we are active and should let chan->message get some bandwidth
 		int		 send_from_frag[ MAX_STREAMS ] = { 0, 0 };
 		int		 send_from_regular	= 0;
 
-		// If we have data in the waiting list(s) and we have cleared the current queue(s), then 
-		//  push the waitlist(s) into the current queue(s)
-		Netchan_FragSend( chan );
+		// The last reliable message got through, let go of the fragment data it carried
+		Netchan_ReleaseReliableFragments( chan );
+
+		// Relays want the reliable data on its own, queue it behind the fragments
+		if ( chan->fragreliable && chan->message.GetNumBytesWritten() )
+		{
+			Netchan_CreateFragments_( chan == &cls.netchan ? false : true, chan, &chan->message );
+			chan->message.Reset();
+		}
 
 		// Sending regular payload
 		send_from_regular = ( chan->message.GetNumBytesWritten() ) ? 1 : 0;
@@ -389,7 +512,7 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 		//
 		for ( i = 0; i < MAX_STREAMS; i++ )
 		{
-			if ( chan->fragbufs[ i ] )
+			if ( chan->fragsend[ i ] )
 			{
 				send_from_frag[ i ] = 1;
 			}
@@ -415,9 +538,6 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 			chan->frag_startpos[ i ]		= 0;
 
 			// Assume no fragment is being sent
-
-			chan->reliable_fragment[ i ]	= 0;
-			chan->reliable_fragid[ i ]		= 0;
 			chan->frag_length[ i ]			= 0;
 
 			if ( send_from_frag[ i ] )
@@ -432,10 +552,13 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 			send_reliable = true;
 		}
 
+		chan->reliable_buflength = 0;
+
 		if ( send_from_regular )
 		{
 			Q_memcpy ( chan->reliable_buf, chan->message_buf, chan->message.GetNumBytesWritten() );
 			chan->reliable_length = chan->message.GetNumBitsWritten();
+			chan->reliable_buflength = chan->reliable_length;
 			chan->message.Reset();
 
 			// If we send fragments, this is where they'll start
@@ -445,71 +568,48 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 			}
 		}
 
+		window = clamp( net_fragwindow.GetInt(), 1, MAX_FRAG_WINDOW );
+
 		for ( i = 0 ; i < MAX_STREAMS; i++ )
 		{
 			int fragment_size;
+			int newpayloadsize;
 
-			extern int host_framecount;
-
-			// Is there someting in the fragbuf?
-			pbuf = chan->fragbufs[ i ];
+			// Is there someting in the send queue?
+			pfrag = chan->fragsend[ i ];
+			if ( !send_from_frag[ i ] || !pfrag )
+				continue;
 
-			fragment_size = 0; // Compiler warning.
-			if ( pbuf )
-			{
-				fragment_size = pbuf->frag_message.GetNumBytesWritten();
-				
-				// Files set size a bit differently.
-				if ( pbuf->isfile && !pbuf->isbuffer )
-				{
-					fragment_size = pbuf->size;
-				}
-			}
+			// Send up to a window's worth of fragments in this message
+			fragment_size = min( pfrag->payload->size - pfrag->sendpos, window * pfrag->chunksize );
 
-			int newpayloadsize = ( ( chan->reliable_length + ( fragment_size << 3 ) ) + 7 ) >> 3;
+			newpayloadsize = ( ( chan->reliable_length + ( fragment_size << 3 ) ) + 7 ) >> 3;
 
 			// Make sure we have enought space left
-			if ( send_from_frag[ i ] && 
-				pbuf && 
-				( newpayloadsize < MAX_RELIABLE_PAYLOAD ) )
-			{
-				chan->reliable_fragid[ i ] = MAKE_FRAGID(pbuf->bufferid,chan->fragbufcount[ i ]); // Which buffer are we sending?
-			
-				// If it's not in-memory, then we'll need to copy it in frame the file handle.
-				if ( pbuf->isfile && !pbuf->isbuffer )
-				{
-					unsigned char filebuffer[ 2048 ];
-
-					FileHandle_t hfile;
-
-					COM_OpenFile( pbuf->filename, &hfile );
-					g_pFileSystem->Seek( hfile, pbuf->foffset, FILESYSTEM_SEEK_HEAD );
-					g_pFileSystem->Read( filebuffer, pbuf->size, hfile );
-
-					pbuf->frag_message.WriteBits( filebuffer, pbuf->size << 3 );
-
-					COM_CloseFile( hfile );
-				}
-
-				// Copy frag stuff on top of current buffer
-				bf_write temp;
-				temp.StartWriting( chan->reliable_buf, sizeof( chan->reliable_buf ), chan->reliable_length );
-
-				temp.WriteBits( pbuf->frag_message.GetData(), pbuf->frag_message.GetNumBitsWritten() );
+			if ( newpayloadsize > NET_MAX_PAYLOAD )
+				continue;
 
-				chan->reliable_length += pbuf->frag_message.GetNumBitsWritten();
-				chan->frag_length[ i ] = pbuf->frag_message.GetNumBitsWritten();
+			// Reference the data rather than copying it, it's written into each packet that carries it
+			pfrag->payload->refcount++;
+			chan->reliable_payload[ i ] = pfrag->payload;
+			chan->reliable_fragpos[ i ] = pfrag->sendpos;
+			chan->reliable_fragsize[ i ] = fragment_size;
+			chan->reliable_fragment[ i ] = 1;
 
-				// Unlink  pbuf
-				Netchan_UnlinkFragment( pbuf, &chan->fragbufs[ i ] );	
+			chan->frag_length[ i ] = fragment_size << 3;
+			chan->reliable_length += chan->frag_length[ i ];
 
-				chan->reliable_fragment[ i ] = 1;
+			// Done with this payload once the message carrying its last fragment goes out
+			pfrag->sendpos += fragment_size;
+			if ( pfrag->sendpos >= pfrag->payload->size )
+			{
+				Netchan_PopPayload( chan, i );
+			}
 
-				// Offset the rest of the starting positions
-				for ( j = i + 1; j < MAX_STREAMS; j++ )
-				{
-					chan->frag_startpos[ j ] += chan->frag_length[ i ];
-				}
+			// Offset the rest of the starting positions
+			for ( j = i + 1; j < MAX_STREAMS; j++ )
+			{
+				chan->frag_startpos[ j ] += chan->frag_length[ i ];
 			}
 		}
 	}
@@ -547,10 +647,12 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 		{
 			if ( chan->reliable_fragment[ i ] )
 			{
-				send.WriteByte( 1 );
-				send.WriteLong( chan->reliable_fragid[ i ] );
+				send.WriteByte( chan->reliable_payload[ i ]->compressed ? 
+					( FRAGHDR_PRESENT | FRAGHDR_COMPRESSED ) : FRAGHDR_PRESENT );
+				send.WriteLong( chan->reliable_fragpos[ i ] );
+				send.WriteLong( chan->reliable_fragsize[ i ] );
+				send.WriteLong( chan->reliable_payload[ i ]->size );
 				send.WriteLong( chan->frag_startpos[ i ] );
-				send.WriteLong( chan->frag_length[ i ] );
 			}
 			else 
 			{
@@ -562,7 +664,18 @@ void Netchan_TransmitBits (netchan_t *chan, int length, byte *data)
 	// Copy the reliable message to the packet first
 	if ( send_reliable )
 	{
-		send.WriteBits( chan->reliable_buf, chan->reliable_length );
+		send.WriteBits( chan->reliable_buf, chan->reliable_buflength );
+
+		// Fragment data comes straight from the payloads
+		for ( i = 0 ; i < MAX_STREAMS; i++ )
+		{
+			if ( chan->reliable_fragment[ i ] )
+			{
+				send.WriteBits( chan->reliable_payload[ i ]->data + chan->reliable_fragpos[ i ], 
+					chan->reliable_fragsize[ i ] << 3 );
+			}
+		}
+
 		chan->last_reliable_sequence = chan->outgoing_sequence - 1;
 	}
 
@@ -649,97 +762,93 @@ void Netchan_Transmit (netchan_t *chan, int lengthInBytes, byte *data)
 
 /*
 ==============================
-Netchan_AllocFragbuf
+Netchan_GrowIncoming
 
+Makes room for needed bytes of the incoming payload, keeping what's been received
 ==============================
 */
-fragbuf_t *Netchan_AllocFragbuf( void )
+static void Netchan_GrowIncoming( fragrecv_t *pin, int needed )
 {
-	fragbuf_t *buf;
-
-	buf = ( fragbuf_t * )new fragbuf_t;
-	memset( buf, 0, sizeof( *buf ) );
-
-	buf->frag_message.StartWriting( buf->frag_message_buf, sizeof( buf->frag_message_buf ) );
-	buf->frag_message.SetDebugName( "fragbuf_t::frag_message" );
-
-	return buf;
-}
-
-/*
-==============================
-Netchan_FindBufferById
+	byte *data;
+	int allocated;
 
-==============================
-*/
-fragbuf_t *Netchan_FindBufferById( fragbuf_t **pplist, int id, qboolean allocate )
-{
-	fragbuf_t *list = *pplist;
-	fragbuf_t *pnewbuf;
+	// Double it so a big payload isn't copied once per fragment
+	allocated = min( max( needed, pin->allocated * 2 ), pin->size );
 
-	while ( list )
+	data = new byte[ allocated ];
+	if ( pin->received > 0 )
 	{
-		if ( list->bufferid == id )
-			return list;
-
-		list = list->next;
+		Q_memcpy( data, pin->data, pin->received );
 	}
 
-	if ( !allocate )
-		return NULL;
-
-// Create new entry
-	pnewbuf = Netchan_AllocFragbuf();
-	pnewbuf->bufferid = id;
-	Netchan_AddBufferToList( pplist, pnewbuf );
-
-	return pnewbuf;
+	delete[] pin->data;
+	pin->data = data;
+	pin->allocated = allocated;
 }
 
 /*
 ==============================
-Netchan_CheckForCompletion
+Netchan_ReceiveFragment
 
+Reads fragment data for stream out of net_message, right into the incoming payload
 ==============================
 */
-void Netchan_CheckForCompletion( netchan_t *chan, int stream, int intotalbuffers )
+static void Netchan_ReceiveFragment( netchan_t *chan, int stream, int pos, int size, int total, qboolean compressed, int startbit )
 {
-	int c;
-	int size;
-	int id;
-	fragbuf_t *p;
+	fragrecv_t *pin;
+	int maxsize;
 
-	size = 0;
-	c = 0;
+	pin = &chan->incoming[ stream ];
+	maxsize = ( stream == FRAG_FILE_STREAM ) ? NET_MAX_FILE_PAYLOAD : NET_MAX_PAYLOAD;
 
-	
-	p = chan->incomingbufs[ stream ];
-	if ( !p )
+	if ( total <= 0 || total > maxsize || pos < 0 || pos > total || size > total - pos )
+	{
+		Con_DPrintf( "Netchan_ReceiveFragment:  Bad fragment %i/%i/%i from %s\n", 
+			pos, size, total, NET_AdrToString( chan->remote_address ) );
+		return;
+	}
+
+	if ( chan->incomingready[ stream ] )
+	{
+		Con_DPrintf( "Netchan_ReceiveFragment:  Fragment arrived before last payload was processed, ignored\n" );
 		return;
+	}
 
-	while ( p )
+	// Start of a new payload.  Nothing is allocated for the total the sender claims,
+	//  the buffer grows as the fragments come in.
+	if ( pos == 0 )
 	{
-		size += p->frag_message.GetNumBytesWritten();
-		c++;
+		pin->size		= total;
+		pin->received	= 0;
+		pin->compressed	= compressed;
+	}
 
-		id = FRAG_GETID( p->bufferid );
-		if ( id != c )
+	if ( total != pin->size || pos != pin->received )
+	{
+		if ( chan == &cls.netchan )
 		{
-			if ( chan == &cls.netchan )
-			{
-				Con_Printf( "Netchan_CheckForCompletion:  Lost/dropped fragment would cause stall, retrying connection\n" );
-				Cbuf_AddText( "retry\n" );
-			}
+			Con_Printf( "Netchan_ReceiveFragment:  Lost/dropped fragment would cause stall, retrying connection\n" );
+			Cbuf_AddText( "retry\n" );
 		}
+		return;
+	}
 
-		p = p->next;
+	if ( pos + size > pin->allocated )
+	{
+		Netchan_GrowIncoming( pin, pos + size );
 	}
 
-	// Received final message
-	if ( c == intotalbuffers )
+	// Copy in data
+	bf_read temp;
+	temp.StartReading( net_message.data, net_message.cursize, startbit );
+	temp.ReadBits( pin->data + pos, size << 3 );
+
+	pin->received += size;
+
+	// Received final fragment
+	if ( pin->received == pin->size )
 	{
 		chan->incomingready[ stream ] = true;
-		// Con_Printf( "\nincoming is complete %i bytes waiting\n", size );
 	}
 }
 
@@ -756,10 +865,12 @@ qboolean Netchan_Process (netchan_t *chan)
 	int				i;
 	unsigned int	sequence, sequence_ack;
 	unsigned int	reliable_ack, reliable_message;
-	unsigned int	fragid[ MAX_STREAMS ] = { 0, 0 };
 	qboolean		frag_message[ MAX_STREAMS ] = { false, false };
+	qboolean		frag_compressed[ MAX_STREAMS ] = { false, false };
+	int				frag_pos[ MAX_STREAMS ] = { 0, 0 };
+	int				frag_size[ MAX_STREAMS ] = { 0, 0 };
+	int				frag_total[ MAX_STREAMS ] = { 0, 0 };
 	int				frag_offset[ MAX_STREAMS ] = { 0, 0 };
-	int				frag_length[ MAX_STREAMS ] = { 0, 0 };
 	qboolean		message_contains_fragments;
 
 	if (
@@ -784,14 +895,40 @@ qboolean Netchan_Process (netchan_t *chan)
 	{
 		for ( i = 0; i < MAX_STREAMS; i++ )
 		{
-			if ( MSG_ReadByte() )
+			int flags = MSG_ReadByte();
+			if ( flags )
 			{
 				frag_message[ i ] = true;
-				fragid[ i ] = MSG_ReadLong();
+				frag_compressed[ i ] = ( flags & FRAGHDR_COMPRESSED ) ? true : false;
+				frag_pos[ i ] = (int)MSG_ReadLong();
+				frag_size[ i ] = (int)MSG_ReadLong();
+				frag_total[ i ] = (int)MSG_ReadLong();
 				frag_offset[ i ] = (int)MSG_ReadLong();
-				frag_length[ i ] = (int)MSG_ReadLong();
 			}
 		}
+
+		// Make sure the fragment data is really in the packet before we touch anything
+		int bitsleft = MSG_GetReadBuf()->GetNumBitsLeft();
+		int fragend = 0;
+		for ( i = 0; i < MAX_STREAMS; i++ )
+		{
+			if ( !frag_message[ i ] )
+				continue;
+
+			if ( MSG_GetReadBuf()->IsOverflowed() ||
+				frag_size[ i ] < 0 || frag_size[ i ] > ( bitsleft >> 3 ) ||
+				frag_offset[ i ] < fragend || frag_offset[ i ] > bitsleft ||
+				frag_offset[ i ] + ( frag_size[ i ] << 3 ) > bitsleft )
+			{
+				if ( net_showdrop.GetInt() )
+				{
+					Con_Printf( "%s:bad fragment header\n", NET_AdrToString( chan->remote_address ) );
+				}
+				return false;
+			}
+
+			fragend = frag_offset[ i ] + ( frag_size[ i ] << 3 );
+		}
 	}
 
 	sequence &= ~(1<<31);	
@@ -894,55 +1031,26 @@ qboolean Netchan_Process (netchan_t *chan)
 		for ( i = 0 ; i < MAX_STREAMS; i++ )
 		{
 			int j;
-			fragbuf_t *pbuf;
-			int inbufferid;
-			int intotalbuffers;
 
 			if ( !frag_message[ i ] )
 				continue;
-		
-			inbufferid = FRAG_GETID( fragid[ i ] );
-			intotalbuffers = FRAG_GETCOUNT( fragid[ i ] );
 
-			if ( fragid[ i ]  != 0 )
+			if ( frag_size[ i ] > 0 )
 			{
-				pbuf = Netchan_FindBufferById( &chan->incomingbufs[ i ], fragid[ i ], true );
-				if ( pbuf )
-				{
-					int bits;
-
-					bits = frag_length[ i ];
-				
-						// Copy in data
-					pbuf->frag_message.Reset();
-
-					bf_read temp;
-					temp.StartReading( net_message.data, net_message.cursize, 
-						MSG_GetReadBuf()->GetNumBitsRead() + frag_offset[ i ] );
-
-					byte buffer[ 2048 ];
-					temp.ReadBits( buffer, bits );
-					pbuf->frag_message.WriteBits( buffer, bits );
-				}
-				else
-				{
-					Con_Printf( "Netchan_Process:  Couldn't allocate or find buffer %i\n", inbufferid );
-				}
-
-				// Count # of incoming bufs we've queued? are we done?
-				Netchan_CheckForCompletion( chan, i, intotalbuffers );
+				Netchan_ReceiveFragment( chan, i, frag_pos[ i ], frag_size[ i ], frag_total[ i ], frag_compressed[ i ],
+					MSG_GetReadBuf()->GetNumBitsRead() + frag_offset[ i ] );
 			}
 
 			// Rearrange incoming data to not have the frag stuff in the middle of it
 			int oldpos = MSG_GetReadBuf()->GetNumBitsRead();
 			int curbit = MSG_GetReadBuf()->GetNumBitsRead() + frag_offset[ i ];
-			int numbitstoremove = frag_length[ i ];
+			int numbitstoremove = frag_size[ i ] << 3;
 			MSG_GetReadBuf()->ExciseBits( curbit , numbitstoremove );
 			MSG_GetReadBuf()->Seek( oldpos );
 
 			for ( j = i + 1; j < MAX_STREAMS; j++ )
 			{
-				frag_offset[ j ] -= frag_length[ i ];
+				frag_offset[ j ] -= numbitstoremove;
 			}
 		}
 
@@ -955,218 +1063,92 @@ qboolean Netchan_Process (netchan_t *chan)
 	return true;
 }
 
-/*
-==============================
-Netchan_FragSend
-
-Fragmentation buffer is full and user is prepared to send
-==============================
-*/
-void Netchan_FragSend( netchan_t *chan )
-{
-	fragbufwaiting_t *wait;
-	int i;
-
-	if ( !chan )
-		return;
-
-	for ( i = 0 ; i < MAX_STREAMS; i++ )
-	{
-		// Already something queued up, just leave in waitlist
-		if ( chan->fragbufs[ i ] )
-		{
-			continue;
-		}
-
-		// Nothing to queue?
-		if ( !chan->waitlist[ i ] )
-		{
-			continue;
-		}
-
-		wait = chan->waitlist[ i ] ;
-		chan->waitlist[ i ]  = chan->waitlist[ i ] ->next;
-
-		wait->next = NULL;
-
-		// Copy in to fragbuf
-		chan->fragbufs[ i ] = wait->fragbufs;
-		chan->fragbufcount[ i ] = wait->fragbufcount;
-
-		// Throw away wait list
-		delete wait;
-	}
-}
+static ConVar net_blocksize( "net_blocksize", "1024", 0, "Network file fragmentation block size.",
+	true, 16, true, 1400 );
 
 /*
 ==============================
-Netchan_AddBufferToList
+Netchan_CreateFragments_
 
 ==============================
 */
-void Netchan_AddBufferToList( fragbuf_t **pplist, fragbuf_t *pbuf )
+void Netchan_CreateFragments_( qboolean server, netchan_t *chan, bf_write *msg )
 {
-	// Find best slot
-	fragbuf_t *pprev, *n;
-	int		id1, id2;
-
-	pbuf->next = NULL;
-
-	if ( !pplist )
-		return;
+	fragpayload_t *payload;
+	int chunksize;
 
-	if ( !*pplist )
-	{
-		pbuf->next = *pplist;
-		*pplist = pbuf;
+	if ( msg->GetNumBytesWritten() == 0 )
 		return;
-	}
 
-	pprev = *pplist;
-	while ( pprev->next )
-	{
-		n = pprev->next; // Next item in list
-		id1 = FRAG_GETID( n->bufferid );
-		id2 = FRAG_GETID( pbuf->bufferid );
+	chunksize = clamp( net_blocksize.GetInt(), 16, 1400 );
 
-		if ( id1 > id2 )
-		{
-			// Insert here
-			pbuf->next = n->next;
-			pprev->next = pbuf;
-			return;
-		}
+	// One copy of the message, fragments are cut from it as they're sent
+	payload = Netchan_AllocPayload( msg->GetNumBytesWritten() );
+	Q_memcpy( payload->data, msg->GetData(), msg->GetNumBytesWritten() );
 
-		pprev = pprev->next;
+	if ( chan->compress && net_compress.GetInt() )
+	{
+		payload = Netchan_CompressPayload( payload );
 	}
 
-	// Insert at end
-	pprev->next = pbuf;
+	// Now add it to end of the queue
+	Netchan_QueuePayload( chan, FRAG_NORMAL_STREAM, payload, chunksize );
 }
 
 /*
 ==============================
-Netchan_AddFragbufToTail
+Netchan_CreateFragments
 
 ==============================
 */
-void Netchan_AddFragbufToTail( fragbufwaiting_t *wait, fragbuf_t *buf )
+void Netchan_CreateFragments( qboolean server, netchan_t *chan, bf_write *msg )
 {
-	fragbuf_t *p;
-
-	buf->next = NULL;
-	wait->fragbufcount++;
-	if ( !wait->fragbufs )
-	{
-		wait->fragbufs = buf;
-		return;
-	}
-
-	p = wait->fragbufs;
-	while ( p->next )
+	// Always queue any pending reliable data ahead of the fragmentation buffer
+	if ( chan->message.GetNumBytesWritten() > 0 )
 	{
-		p = p->next;
+		Netchan_CreateFragments_( server, chan, &chan->message );
+		chan->message.Reset();
 	}
 
-	p->next = buf;
+	Netchan_CreateFragments_( server, chan, msg );
 }
 
-static ConVar net_blocksize( "net_blocksize", "1024", 0, "Network file fragmentation block size.",
-	true, 16, true, 1400 );
-
 /*
 ==============================
-Netchan_CreateFragments_
+Netchan_CreatePayload
 
+Returns a payload holding a copy of data, compressed if that's smaller and compress is set.  The caller
+owns one reference and can queue the payload on any number of channels.
 ==============================
 */
-void Netchan_CreateFragments_( qboolean server, netchan_t *chan, bf_write *msg )
+fragpayload_t *Netchan_CreatePayload( byte *data, int size, qboolean compress )
 {
-	fragbuf_t *buf;
-	int chunksize;
-	int send;
-	int remaining;
-	int pos;
-	int bufferid = 1;
-	
-	fragbufwaiting_t *wait, *p;
-	
-	if ( msg->GetNumBytesWritten() == 0 )
-		return;
+	fragpayload_t *payload;
 
-	chunksize = clamp( net_blocksize.GetInt(), 16, 1400 );
-
-	wait = ( fragbufwaiting_t * )new fragbufwaiting_t;
-	memset( wait, 0, sizeof( *wait ) );
+	payload = Netchan_AllocPayload( size );
+	Q_memcpy( payload->data, data, size );
 
-	remaining = msg->GetNumBytesWritten();
-	pos = 0;
-	while ( remaining > 0 )
+	if ( compress )
 	{
-		send = min( remaining, chunksize );
-		remaining -= send;
-	
-		// 
-		buf = Netchan_AllocFragbuf();
-		if ( !buf )
-		{
-			Con_Printf( "Couldn't allocate fragbuf_t\n" );
-			delete wait;
-
-			if ( server )
-			{
-				SV_DropClient( host_client, false, "Malloc problem" );
-			}
-			else
-			{
-				Host_Disconnect();
-			}
-			return;
-		}
-
-		buf->bufferid = bufferid++;
-
-		// Copy in data
-		buf->frag_message.Reset();
-		buf->frag_message.WriteBits( &msg->GetData()[ pos ], send << 3 );
-		pos += send;
-
-		Netchan_AddFragbufToTail( wait, buf );
+		payload = Netchan_CompressPayload( payload );
 	}
 
-	// Now add waiting list item to end of buffer queue
-	if ( !chan->waitlist[ FRAG_NORMAL_STREAM ] )
-	{
-		chan->waitlist[ FRAG_NORMAL_STREAM ] = wait;
-	}
-	else
-	{
-		p = chan->waitlist[ FRAG_NORMAL_STREAM ];
-		while ( p->next )
-		{
-			p = p->next;
-		}
-
-		p->next = wait;
-	}
+	return payload;
 }
 
 /*
 ==============================
-Netchan_CreateFragments
+Netchan_QueueSharedPayload
 
+Queues a payload created by Netchan_CreatePayload on the normal stream, the queue takes its own reference
 ==============================
 */
-void Netchan_CreateFragments( qboolean server, netchan_t *chan, bf_write *msg )
+void Netchan_QueueSharedPayload( netchan_t *chan, fragpayload_t *payload )
 {
-	// Always queue any pending reliable data ahead of the fragmentation buffer
-	if ( chan->message.GetNumBytesWritten() > 0 )
-	{
-		Netchan_CreateFragments_( server, chan, &chan->message );
-		chan->message.Reset();
-	}
+	Assert( payload->refcount > 0 && !payload->filename[ 0 ] );
 
-	Netchan_CreateFragments_( server, chan, msg );
+	payload->refcount++;
+	Netchan_QueuePayload( chan, FRAG_NORMAL_STREAM, payload, clamp( net_blocksize.GetInt(), 16, 1400 ) );
 }
 
 /*
@@ -1177,91 +1159,34 @@ Netchan_CreateFileFragmentsFromBuffer
 */
 void Netchan_CreateFileFragmentsFromBuffer ( qboolean server, netchan_t *chan, char *filename, unsigned char *pbuf, int size )
 {
-	fragbuf_t *buf;
+	fragpayload_t *payload;
 	int chunksize;
-	int send;
-	int remaining;
-	int pos;
-	int bufferid = 1;
-	qboolean firstfragment = true;
-	
-	fragbufwaiting_t *wait, *p;
+	int namelen;
 
 	if ( !size )
 		return;
 
 	chunksize = clamp( net_blocksize.GetInt(), 16, 512 );
 
-	wait = ( fragbufwaiting_t * )new fragbufwaiting_t;
-	memset( wait, 0, sizeof( *wait ) );
-
-	remaining = size;
-	pos = 0;
-	while ( remaining > 0 )
+	namelen = Q_strlen( filename ) + 1;
+	if ( size > NET_MAX_FILE_PAYLOAD - namelen )
 	{
-		send = min( remaining, chunksize );
-
-		buf = Netchan_AllocFragbuf();
-		if ( !buf )
-		{
-			Con_Printf( "Couldn't allocate fragbuf_t\n"  );
-			delete wait;
-
-			if ( server )
-			{
-				SV_DropClient( host_client, false, "Malloc problem" );
-			}
-			else
-			{
-				Host_Disconnect();
-			}
-			return;
-		}
-
-		buf->bufferid = bufferid++;
-
-		// Copy in data
-		buf->frag_message.Reset();
-
-		// 
-		if ( firstfragment )
-		{
-			firstfragment = false;
-			// Write filename
-			buf->frag_message.WriteString( filename );
-
-			// Send a bit less on first package
-			send -= buf->frag_message.GetNumBytesWritten();
-		}
-
-		buf->isbuffer = true;
-		buf->isfile = true;
-		buf->size = send;
-		buf->foffset = pos;
-	
-		buf->frag_message.WriteBits( &pbuf[ pos ], send << 3 );
-
-		pos += send;
-		remaining -= send;
-
-		Netchan_AddFragbufToTail( wait, buf );
+		Con_Printf( "Warning:  %s is too big to transfer ( %i bytes )\n", filename, size );
+		return;
 	}
 
-	// Now add waiting list item to end of buffer queue
-	if ( !chan->waitlist[ FRAG_FILE_STREAM ] )
+	// File name goes at the front so the remote host knows where to save it
+	payload = Netchan_AllocPayload( namelen + size );
+	Q_memcpy( payload->data, filename, namelen );
+	Q_memcpy( payload->data + namelen, pbuf, size );
+
+	if ( chan->compress && net_compress.GetInt() )
 	{
-		chan->waitlist[ FRAG_FILE_STREAM ] = wait;
+		payload = Netchan_CompressPayload( payload );
 	}
-	else
-	{
-		p = chan->waitlist[ FRAG_FILE_STREAM ];
-		while ( p->next )
-		{
-			p = p->next;
-		}
 
-		p->next = wait;
-	}
+	// Now add it to end of the queue
+	Netchan_QueuePayload( chan, FRAG_FILE_STREAM, payload, chunksize );
 }
 
 /*
@@ -1272,98 +1197,68 @@ Netchan_CreateFileFragments
 */
 int Netchan_CreateFileFragments( qboolean server, netchan_t *chan, char *filename )
 {
-	fragbuf_t *buf;
+	fragpayload_t *payload;
 	int chunksize;
-	int send;
-	int remaining;
-	int pos;
-	int bufferid = 1;
 	FileHandle_t hfile;
 	int filesize = 0;
-	qboolean firstfragment = true;
-	
-	fragbufwaiting_t *wait, *p;
+	int namelen;
 	
 	chunksize = clamp( net_blocksize.GetInt(), 16, 512 );
 
+	// Somebody else is already downloading this one, share their copy
+	for ( payload = s_pFilePayloads; payload; payload = payload->nextfile )
+	{
+		if ( payload->compressed && !chan->compress )
+			continue;
+
+		if ( !Q_stricmp( payload->filename, filename ) )
+		{
+			payload->refcount++;
+			Netchan_QueuePayload( chan, FRAG_FILE_STREAM, payload, chunksize );
+			return 1;
+		}
+	}
+
 	if ( ( filesize = COM_OpenFile( filename, &hfile ) ) == -1 )
 	{
 		Con_Printf( "Warning:  Unable to open %s for transfer\n", filename );
 		return 0;
 	}
 
-	// close the file
-	COM_CloseFile( hfile );
-
-	wait = ( fragbufwaiting_t * )new fragbufwaiting_t;
-	memset( wait, 0, sizeof( *wait ) );
-
-	remaining = filesize;
-	pos = 0;
-	while ( remaining > 0 )
+	namelen = Q_strlen( filename ) + 1;
+	if ( namelen > MAX_OSPATH || filesize > NET_MAX_FILE_PAYLOAD - namelen )
 	{
-		send = min( remaining, chunksize );
-
-		buf = Netchan_AllocFragbuf();
-		if ( !buf )
-		{
-			Con_Printf( "Couldn't allocate fragbuf_t\n"  );
-			delete wait;
-
-			if ( server )
-			{
-				SV_DropClient( host_client, false, "Malloc problem" );
-			}
-			else
-			{
-				Host_Disconnect();
-			}
-			return 0;
-		}
-
-		buf->bufferid = bufferid++;
-
-		// Copy in data
-		buf->frag_message.Reset();
-
-		// 
-		if ( firstfragment )
-		{
-			firstfragment = false;
-			// Write filename
-			buf->frag_message.WriteString( filename );
-
-			// Send a bit less on first package
-			send -= buf->frag_message.GetNumBytesWritten();
-		}
-
-		buf->isfile = true;
-		buf->size = send;
-		buf->foffset = pos;
-		Q_strcpy( buf->filename, filename );
-
-		pos += send;
-		remaining -= send;
-
-		Netchan_AddFragbufToTail( wait, buf );
+		Con_Printf( "Warning:  %s is too big to transfer ( %i bytes )\n", filename, filesize );
+		COM_CloseFile( hfile );
+		return 0;
 	}
 
-	// Now add waiting list item to end of buffer queue
-	if ( !chan->waitlist[ FRAG_FILE_STREAM ] )
+	// Read the whole file once, rather than reopening it for every fragment
+	payload = Netchan_AllocPayload( namelen + filesize );
+	Q_memcpy( payload->data, filename, namelen );
+	if ( g_pFileSystem->Read( payload->data + namelen, filesize, hfile ) != filesize )
 	{
-		chan->waitlist[ FRAG_FILE_STREAM ] = wait;
+		Con_Printf( "Warning:  Unable to read %s for transfer\n", filename );
+		COM_CloseFile( hfile );
+		Netchan_ReleasePayload( payload );
+		return 0;
 	}
-	else
-	{
-		p = chan->waitlist[ FRAG_FILE_STREAM ];
-		while ( p->next )
-		{
-			p = p->next;
-		}
 
-		p->next = wait;
+	// close the file
+	COM_CloseFile( hfile );
+
+	if ( chan->compress && net_compress.GetInt() )
+	{
+		payload = Netchan_CompressPayload( payload );
 	}
 
+	Q_strncpy( payload->filename, filename, sizeof( payload->filename ) );
+	payload->nextfile = s_pFilePayloads;
+	s_pFilePayloads = payload;
+
+	// Now add it to end of the queue
+	Netchan_QueuePayload( chan, FRAG_FILE_STREAM, payload, chunksize );
+
 	return 1;
 }
 
@@ -1375,19 +1270,22 @@ Netchan_FlushIncoming
 */
 void Netchan_FlushIncoming( netchan_t *chan, int stream )
 {
-	fragbuf_t *p, *n;
+	fragrecv_t *pin;
 
 	SZ_Clear( &net_message );
 	MSG_GetReadBuf()->Reset();
 
-	p = chan->incomingbufs[ stream ];
-	while ( p )
+	pin = &chan->incoming[ stream ];
+	if ( pin->data )
 	{
-		n =p->next;
-		delete p;
-		p = n;
+		delete[] pin->data;
 	}
-	chan->incomingbufs[ stream ] = NULL;
+	pin->data = NULL;
+	pin->allocated = 0;
+	pin->size = 0;
+	pin->received = 0;
+	pin->compressed = false;
+
 	chan->incomingready[ stream ] = false;
 }
 
@@ -1399,35 +1297,54 @@ Netchan_CopyNormalFragments
 */
 qboolean Netchan_CopyNormalFragments( netchan_t *chan )
 {
-	fragbuf_t *p, *n;
+	fragrecv_t *pin;
 
 	if ( !chan->incomingready[ FRAG_NORMAL_STREAM ] )
 		return false;
 
-	if ( !chan->incomingbufs[ FRAG_NORMAL_STREAM ] )
+	pin = &chan->incoming[ FRAG_NORMAL_STREAM ];
+	if ( !pin->data )
 	{
 		Con_Printf( "Netchan_CopyNormalFragments:  Called with no fragments readied\n" );
 		chan->incomingready[ FRAG_NORMAL_STREAM ] = false;
 		return false;
 	}
 
-	p = chan->incomingbufs[ FRAG_NORMAL_STREAM ];
-
 	SZ_Clear( &net_message );
 	MSG_BeginReading();
 
-	while ( p )
+	if ( pin->compressed )
 	{
-		n = p->next;
-		
-		// Copy it in
-		SZ_Write( &net_message, p->frag_message.GetData(), p->frag_message.GetNumBytesWritten() );
+		// Decompress straight into the message buffer
+		int size = Netchan_UncompressedSize( pin, net_message.maxsize );
+		if ( size < 0 || NET_LZDecompress( pin->data + 4, pin->size - 4, net_message.data, size ) != size )
+		{
+			Con_Printf( "Netchan_CopyNormalFragments:  Bad compressed message, ignored\n" );
+			Netchan_FlushIncoming( chan, FRAG_NORMAL_STREAM );
+			return false;
+		}
 
-		delete p;
-		p = n;
+		net_message.cursize = size;
 	}
-	
-	chan->incomingbufs[ FRAG_NORMAL_STREAM ] = NULL;
+	else
+	{
+		if ( pin->size > net_message.maxsize )
+		{
+			Con_Printf( "Netchan_CopyNormalFragments:  %i byte message too big, ignored\n", pin->size );
+			Netchan_FlushIncoming( chan, FRAG_NORMAL_STREAM );
+			return false;
+		}
+
+		// Copy it in
+		SZ_Write( &net_message, pin->data, pin->size );
+	}
+
+	delete[] pin->data;
+	pin->data = NULL;
+	pin->allocated = 0;
+	pin->size = 0;
+	pin->received = 0;
+	pin->compressed = false;
 
 	// Reset flag
 	chan->incomingready[ FRAG_NORMAL_STREAM ] = false;
@@ -1444,32 +1361,49 @@ Netchan_CopyFileFragments
 qboolean Netchan_CopyFileFragments( netchan_t *chan )
 {
 	char filename[ MAX_OSPATH ];
-	fragbuf_t *p, *n;
+	fragrecv_t *pin;
+	byte *nameend;
+	int namelen;
 	int nsize;
-	unsigned char *buffer;
 	FileHandle_t hfile;
-	int pos;
 
 	if ( !chan->incomingready[ FRAG_FILE_STREAM ] )
 		return false;
 
-	if ( !chan->incomingbufs[ FRAG_FILE_STREAM ] )
+	pin = &chan->incoming[ FRAG_FILE_STREAM ];
+	if ( !pin->data )
 	{
 		Con_Printf( "Netchan_CopyFileFragments:  Called with no fragments readied\n" );
 		chan->incomingready[ FRAG_FILE_STREAM ] = false;
 		return false;
 	}
 
-	p = chan->incomingbufs[ FRAG_FILE_STREAM ];
+	if ( pin->compressed )
+	{
+		byte *data;
+		int size;
 
-	SZ_Clear( &net_message );
-	// Copy in first chunk so we can get filename out
-	SZ_Write( &net_message, p->frag_message.GetData(), p->frag_message.GetNumBytesWritten() );
+		size = Netchan_UncompressedSize( pin, NET_MAX_FILE_PAYLOAD );
+		data = ( size > 0 ) ? new byte[ size ] : NULL;
+		if ( !data || NET_LZDecompress( pin->data + 4, pin->size - 4, data, size ) != size )
+		{
+			Con_Printf( "Netchan_CopyFileFragments:  Bad compressed file, ignored\n" );
+			delete[] data;
+			Netchan_FlushIncoming( chan, FRAG_FILE_STREAM );
+			return false;
+		}
 
-	MSG_BeginReading();
+		delete[] pin->data;
+		pin->data = data;
+		pin->allocated = size;
+		pin->size = size;
+		pin->compressed = false;
+	}
 
-	Q_strcpy( filename, MSG_ReadString() );
-	if ( Q_strlen( filename ) <= 0 )
+	// File name is at the front
+	nameend = ( byte * )memchr( pin->data, 0, min( pin->size, MAX_OSPATH ) );
+	namelen = nameend ? nameend - pin->data : 0;
+	if ( namelen <= 0 )
 	{
 		Con_Printf( "File fragment received with no filename\nFlushing input queue\n" );
 		
@@ -1477,7 +1411,9 @@ qboolean Netchan_CopyFileFragments( netchan_t *chan )
 		Netchan_FlushIncoming( chan, FRAG_FILE_STREAM );
 		return false;
 	}
-	else if ( Q_strstr( filename, ".." ) )
+
+	Q_strncpy( filename, ( char * )pin->data, sizeof( filename ) );
+	if ( Q_strstr( filename, ".." ) )
 	{
 		Con_Printf( "File fragment received with relative path, ignoring\n" );
 		
@@ -1502,69 +1438,11 @@ qboolean Netchan_CopyFileFragments( netchan_t *chan )
 
 	COM_CreatePath( filename );
 
-	// Create file from buffers
-	nsize = 0;
-	while ( p )
-	{
-		nsize += p->frag_message.GetNumBytesWritten(); // Size will include a bit of slop, oh well
-		if ( p == chan->incomingbufs[ FRAG_FILE_STREAM ] )
-		{
-			nsize -= MSG_GetReadBuf()->GetNumBytesRead();
-		}
-		p = p->next;
-	}
-
-	buffer = new unsigned char[ nsize + 1 ];
-	if ( !buffer )
-	{
-		Con_Printf( "Buffer allocation failed on %i bytes\n", nsize + 1 );
-		
-		// Clear out bufs
-		Netchan_FlushIncoming( chan, FRAG_FILE_STREAM );
-		return false;
-	}
-
-	Q_memset( buffer, 0, nsize + 1 );
-
-	p = chan->incomingbufs[ FRAG_FILE_STREAM ];
-	pos = 0;
-	while ( p )
-	{
-		int cursize;
-
-		n = p->next;
-		
-		cursize = p->frag_message.GetNumBytesWritten();
-
-		// First message has the file name, don't write that into the data stream, just write the rest of the actual data
-		if ( p == chan->incomingbufs[ FRAG_FILE_STREAM ] ) 
-		{
-			// Copy it in
-			cursize -= MSG_GetReadBuf()->GetNumBytesRead();
-			Q_memcpy( &buffer[ pos ], &p->frag_message.GetData()[ MSG_GetReadBuf()->GetNumBytesRead() ], cursize );
-		}
-		else
-		{
-			Q_memcpy( &buffer[ pos ], p->frag_message.GetData(), cursize);
-		}
-
-		pos += cursize;
-
-		delete p;
-		p = n;
-	}
-
-	COM_WriteFile ( filename, buffer, pos );
-	delete[] buffer;
+	// The data was reassembled in place, write it straight out
+	COM_WriteFile( filename, pin->data + namelen + 1, pin->size - namelen - 1 );
 
 	// clear remnants
-	SZ_Clear( &net_message );
-	MSG_GetReadBuf()->Reset();
-	
-	chan->incomingbufs[ FRAG_FILE_STREAM ] = NULL;
-
-	// Reset flag
-	chan->incomingready[ FRAG_FILE_STREAM ] = false;
+	Netchan_FlushIncoming( chan, FRAG_FILE_STREAM );
 
 	return true;
 }
@@ -1580,7 +1458,7 @@ qboolean Netchan_IsSending( netchan_t *chan )
 	int i;
 	for ( i = 0; i < MAX_STREAMS; i++ )
 	{
-		if ( chan->fragbufs[ i ] )
+		if ( chan->fragsend[ i ] )
 		{
 			return true;
 		}
@@ -1588,6 +1466,28 @@ qboolean Netchan_IsSending( netchan_t *chan )
 	return false;
 }
 
+/*
+==============================
+Netchan_QueuedBytes
+
+==============================
+*/
+int Netchan_QueuedBytes( netchan_t *chan )
+{
+	fragsend_t *send;
+	int bytes = 0;
+	int i;
+
+	for ( i = 0; i < MAX_STREAMS; i++ )
+	{
+		for ( send = chan->fragsend[ i ]; send; send = send->next )
+		{
+			bytes += send->payload->size - send->sendpos;
+		}
+	}
+	return bytes;
+}
+
 /*
 ==============================
 Netchan_IsReceiving
@@ -1599,7 +1499,7 @@ qboolean Netchan_IsReceiving( netchan_t *chan )
 	int i;
 	for ( i = 0; i < MAX_STREAMS; i++ )
 	{
-		if ( chan->incomingbufs[ i ] )
+		if ( chan->incoming[ i ].data )
 		{
 			return true;
 		}
@@ -1635,9 +1535,6 @@ Netchan_UpdateProgress
 */
 void Netchan_UpdateProgress( netchan_t *chan )
 {
-	fragbuf_t *p;
-	int c = 0;
-	int total = 0;
 	int i;
 	float bestpercent = 0.0;
 
@@ -1653,7 +1550,7 @@ void Netchan_UpdateProgress( netchan_t *chan )
 	if ( net_drawslider.GetInt() != 1 )
 	{
 		// Do show slider for file downloads.
-		if ( !chan->incomingbufs[ FRAG_FILE_STREAM ] )
+		if ( !chan->incoming[ FRAG_FILE_STREAM ].data )
 		{
 			return;
 		}
@@ -1662,57 +1559,28 @@ void Netchan_UpdateProgress( netchan_t *chan )
 	for ( i = MAX_STREAMS - 1; i >= 0; i-- )
 	{
 		// Receiving data
-		if ( chan->incomingbufs[ i ] )
+		if ( chan->incoming[ i ].data )
 		{
-			// 
-			p = chan->incomingbufs[ i ];
-
-			total = FRAG_GETCOUNT( p->bufferid );
-			while ( p )
-			{
-				c++;
-				p = p->next;
-			}
-
-			if ( total )
+			if ( chan->incoming[ i ].size )
 			{
 				float percent;
 
-				percent = 100.0 * ( float ) c / (float) total;
+				percent = 100.0 * ( float )chan->incoming[ i ].received / ( float )chan->incoming[ i ].size;
 
 				if ( percent > bestpercent )
 				{
 					bestpercent = percent;
 				}
 			}
-
-			p = chan->incomingbufs[ i ];
-			if ( i == FRAG_FILE_STREAM ) 
-			{
-				char sz[ 1024 ];
-				char *in, *out;
-				int len = 0;
-
-				in = (char *)p->frag_message.GetData();
-				out = sz;
-				while ( *in )
-				{
-					*out++ = *in++;
-					len++;
-					if ( len > 128 )
-						break;
-				}
-				*out = '\0';
-			}
 		}
 		// Sending data
-		else if ( chan->fragbufs[ i ] )
+		else if ( chan->fragsend[ i ] )
 		{
-			if ( chan->fragbufcount[ i ] )
+			if ( chan->fragsend[ i ]->payload->size )
 			{
 				float percent;
 				
-				percent = 100.0 * (float)chan->fragbufs[ i ]->bufferid / (float)chan->fragbufcount[ i ];
+				percent = 100.0 * (float)chan->fragsend[ i ]->sendpos / (float)chan->fragsend[ i ]->payload->size;
 
 				if ( percent > bestpercent )
 				{
@@ -0,0 +1,263 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Small LZ77 codec for netchan payloads.
+//
+// The stream is a run of sequences, each one a token byte followed by literals and
+// a match:
+//
+//	token			high nibble is the literal count, low nibble is the match length - 4.
+//					15 in either means more length bytes follow ( added up until one is < 255 ).
+//	literals		copied as is
+//	offset			2 bytes, little endian, distance back to the start of the match
+//
+// The last sequence has literals only and ends the stream.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "net_lz.h"
+#include <string.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define LZ_MIN_MATCH	4
+#define LZ_MAX_OFFSET	65535
+#define LZ_HASH_BITS	14
+#define LZ_HASH_SIZE	( 1 << LZ_HASH_BITS )
+
+
+static inline unsigned int LZ_Read32( const unsigned char *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( p[3] << 24 );
+}
+
+static inline unsigned int LZ_Hash( unsigned int v )
+{
+	return ( v * 2654435761U ) >> ( 32 - LZ_HASH_BITS );
+}
+
+// Writes the extra bytes for a length that didn't fit in its nibble. Returns NULL on overflow.
+static inline unsigned char *LZ_WriteLength( unsigned char *pOut, unsigned char *pOutEnd, int nLength )
+{
+	while ( nLength >= 255 )
+	{
+		if ( pOut >= pOutEnd )
+			return NULL;
+		*pOut++ = 255;
+		nLength -= 255;
+	}
+
+	if ( pOut >= pOutEnd )
+		return NULL;
+	*pOut++ = (unsigned char)nLength;
+	return pOut;
+}
+
+// Writes one sequence.  pMatch is NULL for the last one.  Returns NULL on overflow.
+static unsigned char *LZ_WriteSequence( unsigned char *pOut, unsigned char *pOutEnd,
+	const unsigned char *pLiterals, int nLiterals, int nOffset, int nMatchLength )
+{
+	unsigned char *pToken;
+	int nMatchCode;
+
+	if ( pOut >= pOutEnd )
+		return NULL;
+
+	pToken = pOut++;
+	*pToken = 0;
+
+	if ( nLiterals >= 15 )
+	{
+		*pToken = 15 << 4;
+		pOut = LZ_WriteLength( pOut, pOutEnd, nLiterals - 15 );
+		if ( !pOut )
+			return NULL;
+	}
+	else
+	{
+		*pToken = nLiterals << 4;
+	}
+
+	if ( nLiterals > pOutEnd - pOut )
+		return NULL;
+	memcpy( pOut, pLiterals, nLiterals );
+	pOut += nLiterals;
+
+	if ( !nMatchLength )
+		return pOut;
+
+	if ( pOutEnd - pOut < 2 )
+		return NULL;
+	*pOut++ = nOffset & 0xff;
+	*pOut++ = nOffset >> 8;
+
+	nMatchCode = nMatchLength - LZ_MIN_MATCH;
+	if ( nMatchCode >= 15 )
+	{
+		*pToken |= 15;
+		pOut = LZ_WriteLength( pOut, pOutEnd, nMatchCode - 15 );
+	}
+	else
+	{
+		*pToken |= nMatchCode;
+	}
+
+	return pOut;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Greedy compressor with a single entry hash table
+//-----------------------------------------------------------------------------
+int NET_LZCompress( const unsigned char *pInput, int nInputSize, unsigned char *pOutput, int nOutputSize )
+{
+	int hashTable[ LZ_HASH_SIZE ];
+	const unsigned char *pIn = pInput;
+	const unsigned char *pInEnd = pInput + nInputSize;
+	const unsigned char *pMatchLimit = pInEnd - LZ_MIN_MATCH;
+	const unsigned char *pLiterals = pInput;
+	unsigned char *pOut = pOutput;
+	unsigned char *pOutEnd = pOutput + nOutputSize;
+
+	if ( nInputSize <= 0 || nOutputSize <= 0 )
+		return 0;
+
+	memset( hashTable, 0xff, sizeof( hashTable ) );
+
+	while ( pIn <= pMatchLimit )
+	{
+		unsigned int v = LZ_Read32( pIn );
+		unsigned int h = LZ_Hash( v );
+		int nCandidate = hashTable[ h ];
+		int nPos = pIn - pInput;
+
+		hashTable[ h ] = nPos;
+
+		if ( nCandidate < 0 || nPos - nCandidate > LZ_MAX_OFFSET || LZ_Read32( pInput + nCandidate ) != v )
+		{
+			++pIn;
+			continue;
+		}
+
+		// Extend the match as far as it goes
+		const unsigned char *pMatch = pInput + nCandidate + LZ_MIN_MATCH;
+		const unsigned char *pEnd = pIn + LZ_MIN_MATCH;
+		while ( pEnd < pInEnd && *pEnd == *pMatch )
+		{
+			++pEnd;
+			++pMatch;
+		}
+
+		pOut = LZ_WriteSequence( pOut, pOutEnd, pLiterals, pIn - pLiterals, nPos - nCandidate, pEnd - pIn );
+		if ( !pOut )
+			return 0;
+
+		// Keep the table warm across the match so the next one can be found
+		if ( pEnd - 2 > pIn && pEnd - 2 <= pMatchLimit )
+		{
+			hashTable[ LZ_Hash( LZ_Read32( pEnd - 2 ) ) ] = ( pEnd - 2 ) - pInput;
+		}
+
+		pIn = pEnd;
+		pLiterals = pIn;
+	}
+
+	pOut = LZ_WriteSequence( pOut, pOutEnd, pLiterals, pInEnd - pLiterals, 0, 0 );
+	if ( !pOut )
+		return 0;
+
+	return pOut - pOutput;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Decompressor, every read and write is bounds checked
+//-----------------------------------------------------------------------------
+int NET_LZDecompress( const unsigned char *pInput, int nInputSize, unsigned char *pOutput, int nOutputSize )
+{
+	const unsigned char *pIn = pInput;
+	const unsigned char *pInEnd = pInput + nInputSize;
+	unsigned char *pOut = pOutput;
+	unsigned char *pOutEnd = pOutput + nOutputSize;
+
+	if ( nInputSize <= 0 )
+		return -1;
+
+	while ( pIn < pInEnd )
+	{
+		int token = *pIn++;
+		int nLength = token >> 4;
+
+		// Literals
+		if ( nLength == 15 )
+		{
+			int b;
+			do
+			{
+				if ( pIn >= pInEnd )
+					return -1;
+				b = *pIn++;
+				nLength += b;
+				if ( nLength > nOutputSize )
+					return -1;
+			} while ( b == 255 );
+		}
+
+		if ( nLength > pInEnd - pIn || nLength > pOutEnd - pOut )
+			return -1;
+
+		memcpy( pOut, pIn, nLength );
+		pIn += nLength;
+		pOut += nLength;
+
+		// Last sequence has no match
+		if ( pIn == pInEnd )
+			break;
+
+		// Match
+		if ( pInEnd - pIn < 2 )
+			return -1;
+
+		int nOffset = pIn[0] | ( pIn[1] << 8 );
+		pIn += 2;
+
+		if ( nOffset == 0 || nOffset > pOut - pOutput )
+			return -1;
+
+		nLength = token & 15;
+		if ( nLength == 15 )
+		{
+			int b;
+			do
+			{
+				if ( pIn >= pInEnd )
+					return -1;
+				b = *pIn++;
+				nLength += b;
+				if ( nLength > nOutputSize )
+					return -1;
+			} while ( b == 255 );
+		}
+		nLength += LZ_MIN_MATCH;
+
+		if ( nLength > pOutEnd - pOut )
+			return -1;
+
+		// Matches can overlap what they're writing, those go a byte at a time
+		const unsigned char *pMatch = pOut - nOffset;
+		if ( nOffset >= nLength )
+		{
+			memcpy( pOut, pMatch, nLength );
+			pOut += nLength;
+		}
+		else
+		{
+			while ( nLength-- )
+			{
+				*pOut++ = *pMatch++;
+			}
+		}
+	}
+
+	return pOut - pOutput;
+}
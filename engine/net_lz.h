@@ -0,0 +1,25 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Small LZ77 codec for netchan payloads.  Built for speed rather than ratio,
+//			the server compresses signon data for every client that connects.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef NET_LZ_H
+#define NET_LZ_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Compresses nInputSize bytes into pOutput.  Returns the compressed size, or 0 if it
+// wouldn't fit in nOutputSize bytes ( pass nInputSize - 1 to only keep data that shrinks ).
+int		NET_LZCompress( const unsigned char *pInput, int nInputSize, unsigned char *pOutput, int nOutputSize );
+
+// Decompresses into pOutput.  Returns the decompressed size, or -1 if the data is corrupt
+// or doesn't fit in nOutputSize bytes.  Safe to call on data from the network.
+int		NET_LZDecompress( const unsigned char *pInput, int nInputSize, unsigned char *pOutput, int nOutputSize );
+
+
+#endif // NET_LZ_H
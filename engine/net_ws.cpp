@@ -9,6 +9,7 @@
 #include "host.h"
 #include "convar.h"
 #include "vstdlib/ICommandLine.h"
+#include "tier0/fasttimer.h"
 
 #if defined( _WIN32 )
 
@@ -31,6 +32,7 @@ typedef int socklen_t;
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/types.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
@@ -86,6 +88,30 @@ static byte	in_message_buf[ NET_MAX_MESSAGE ];
 static sizebuf_t   in_message;
 static netadr_t    in_from;
 
+static ConVar net_batchio( "net_batchio", "1", 0, "Receive and send packets in batches with recvmmsg/sendmmsg (Linux only)." );
+static ConVar net_iostats( "net_iostats", "0", 0, "Print the network syscall and packet counts per frame once a second." );
+
+// Syscall and packet counts for net_iostats.
+typedef struct
+{
+	int		frames;
+	int		recvcalls;
+	int		recvpackets;
+	int		sendcalls;
+	int		sendpackets;
+} netiostats_t;
+
+static netiostats_t	net_iostats_accum;
+static double		net_iostats_time = 0;
+
+#if defined( _LINUX )
+static int	NET_RecvBatched( netsrc_t sock, int net_socket, unsigned char **ppData, struct sockaddr *from );
+static int	NET_QueueSend( int s, const char *buf, int len, int flags, const struct sockaddr *to, int tolen );
+#endif
+static bool	NET_UseBatchIO( void );
+static bool	NET_IsSendBatching( void );
+void		*net_malloc( size_t size );
+
 int			ip_sockets[2] = { 0, 0 };
 static		int net_sleepforever = 1;
 
@@ -118,15 +144,6 @@ typedef struct packetlag_s
 
 static packetlag_t g_pLagData[2];  // List of lag structures, if fakelag is set.
 
-// Split long packets.  Anything over 1460 is failing on some routers
-typedef struct
-{
-	int		currentSequence;
-	int		splitCount;
-	int		totalSize;
-	char	buffer[ NET_MAX_MESSAGE ];	// This has to be big enough to hold the largest message
-} LONGPACKET;
-
 // Use this to pick apart the network stream, must be packed
 #pragma pack(1)
 typedef struct
@@ -737,81 +754,337 @@ qboolean    NET_LagPacket (qboolean newdata, netsrc_t sock, netadr_t *from, size
 #define MAX_SPLITPACKET_SPLITS ( NET_MAX_MESSAGE / SPLIT_SIZE )
 #define SPLIT_PACKET_STALE_TIME		15.0f
 
+// Split packet reassembly uses a fixed amount of memory: at most NET_SPLIT_ENTRIES messages
+// can be in flight, and their pieces share a slab of NET_SPLIT_CHUNKS piece-sized buffers.
+// When either runs out, the least recently active message is dropped. Each source can have
+// NET_SPLIT_MAX_PER_SOURCE messages in flight, so a source that keeps starting new messages
+// only drops its own older ones.
+#define NET_SPLIT_ENTRIES			256
+#define NET_SPLIT_HASH_SIZE			512		// Power of two, at least twice NET_SPLIT_ENTRIES.
+#define NET_SPLIT_CHUNKS			1024
+#define NET_SPLIT_MAX_PER_SOURCE	2
+
 class CSplitPacketEntry
 {
-public:
-	CSplitPacketEntry()
-	{
-		memset( &from, 0, sizeof( from ) );
-
-		int i;
-		for ( i = 0; i < MAX_SPLITPACKET_SPLITS; i++ )
-		{
-			splitflags[ i ] = -1;
-		}
-
-		memset( &netsplit, 0, sizeof( netsplit ) );
-		lastactivetime = 0.0f;
-	}
-
 public:
 	netadr_t		from;
-	int				splitflags[ MAX_SPLITPACKET_SPLITS ];
-	LONGPACKET		netsplit;
+	int				sequenceNumber;
+	int				packetCount;
+	// Number of pieces still missing.
+	int				splitCount;
+	// Set when the last piece arrives.
+	int				totalSize;
+	// Slab chunk holding each piece, -1 if it hasn't arrived.
+	short			chunks[ MAX_SPLITPACKET_SPLITS ];
 	// host_time the last time any entry was received for this entry
 	double			lastactivetime;
+
+	// LRU list, most recently active first.
+	short			lruprev;
+	short			lrunext;
 };
 
-CUtlVector< CSplitPacketEntry >	g_SplitPacketEntries( 1, 1 );
 
 //-----------------------------------------------------------------------------
-// Purpose: 
+// Open-addressed table of the messages being reassembled. Entries hash on the source
+// address only, so all of a source's messages are found by one probe.
 //-----------------------------------------------------------------------------
-void NET_DiscardStaleSplitpackets( void )
+class CSplitPacketTable
+{
+public:
+						CSplitPacketTable();
+
+	// Returns the entry for this message, starting a new one if needed.
+	CSplitPacketEntry	*FindOrCreate( const netadr_t &from, int sequenceNumber, int packetCount );
+
+	// Stores a piece. Returns false if there's no room, in which case the entry was freed.
+	bool				AddPiece( CSplitPacketEntry *pEntry, int packetNumber, const byte *pData, int size );
+
+	// Copies the finished message into pOut.
+	void				Gather( CSplitPacketEntry *pEntry, byte *pOut );
+
+	void				Free( CSplitPacketEntry *pEntry );
+	void				DiscardStale( double flTime );
+	void				RemoveAll();
+
+	int					GetNumEntries() const	{ return m_nEntries; }
+	int					GetNumChunksUsed() const	{ return NET_SPLIT_CHUNKS - m_nFreeChunks; }
+
+	// Messages dropped to make room, and because their source had too many in flight.
+	int					m_nEvictions;
+	int					m_nSourceDrops;
+
+private:
+	int					HashAdr( const netadr_t &adr ) const;
+	void				FreeIndex( int iEntry );
+	void				LRULink( int iEntry );
+	void				LRUUnlink( int iEntry );
+	int					AllocChunk( int iKeepEntry );
+
+	CSplitPacketEntry	m_Entries[ NET_SPLIT_ENTRIES ];
+	short				m_Hash[ NET_SPLIT_HASH_SIZE ];		// Entry index, -1 if empty.
+	short				m_FreeEntries[ NET_SPLIT_ENTRIES ];
+	int					m_nFreeEntries;
+	int					m_nEntries;
+	short				m_LRUHead;
+	short				m_LRUTail;
+
+	byte				m_Chunks[ NET_SPLIT_CHUNKS ][ SPLIT_SIZE ];
+	short				m_FreeChunks[ NET_SPLIT_CHUNKS ];
+	int					m_nFreeChunks;
+};
+
+
+CSplitPacketTable::CSplitPacketTable()
+{
+	RemoveAll();
+}
+
+
+void CSplitPacketTable::RemoveAll()
 {
 	int i;
-	for ( i = g_SplitPacketEntries.Count() - 1; i >= 0; i-- )
+	for ( i = 0; i < NET_SPLIT_HASH_SIZE; i++ )
 	{
-		CSplitPacketEntry *entry = &g_SplitPacketEntries[ i ];
-		Assert( entry );
+		m_Hash[ i ] = -1;
+	}
 
-		if ( host_time < ( entry->lastactivetime + SPLIT_PACKET_STALE_TIME ) )
-			continue;
+	for ( i = 0; i < NET_SPLIT_ENTRIES; i++ )
+	{
+		m_FreeEntries[ i ] = NET_SPLIT_ENTRIES - 1 - i;
+	}
+	m_nFreeEntries = NET_SPLIT_ENTRIES;
+	m_nEntries = 0;
 
-		g_SplitPacketEntries.Remove( i );
+	for ( i = 0; i < NET_SPLIT_CHUNKS; i++ )
+	{
+		m_FreeChunks[ i ] = NET_SPLIT_CHUNKS - 1 - i;
 	}
+	m_nFreeChunks = NET_SPLIT_CHUNKS;
+
+	m_LRUHead = m_LRUTail = -1;
+	m_nEvictions = 0;
+	m_nSourceDrops = 0;
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : *from - 
-// Output : CSplitPacketEntry
-//-----------------------------------------------------------------------------
-CSplitPacketEntry *NET_FindOrCreateSplitPacketEntry( netadr_t *from )
+
+int CSplitPacketTable::HashAdr( const netadr_t &adr ) const
 {
-	int i, count = g_SplitPacketEntries.Count();
-	CSplitPacketEntry *entry = NULL;
-	for ( i = 0; i < count; i++ )
+	unsigned int ip = ( adr.ip[0] << 24 ) | ( adr.ip[1] << 16 ) | ( adr.ip[2] << 8 ) | adr.ip[3];
+	unsigned int h = ( ip * 2654435761u ) ^ ( adr.port * 40503u );
+	return ( h ^ ( h >> 16 ) ) & ( NET_SPLIT_HASH_SIZE - 1 );
+}
+
+
+void CSplitPacketTable::LRULink( int iEntry )
+{
+	CSplitPacketEntry *pEntry = &m_Entries[ iEntry ];
+	pEntry->lruprev = -1;
+	pEntry->lrunext = m_LRUHead;
+	if ( m_LRUHead >= 0 )
+		m_Entries[ m_LRUHead ].lruprev = iEntry;
+	else
+		m_LRUTail = iEntry;
+	m_LRUHead = iEntry;
+}
+
+
+void CSplitPacketTable::LRUUnlink( int iEntry )
+{
+	CSplitPacketEntry *pEntry = &m_Entries[ iEntry ];
+	if ( pEntry->lruprev >= 0 )
+		m_Entries[ pEntry->lruprev ].lrunext = pEntry->lrunext;
+	else
+		m_LRUHead = pEntry->lrunext;
+
+	if ( pEntry->lrunext >= 0 )
+		m_Entries[ pEntry->lrunext ].lruprev = pEntry->lruprev;
+	else
+		m_LRUTail = pEntry->lruprev;
+}
+
+
+void CSplitPacketTable::FreeIndex( int iEntry )
+{
+	CSplitPacketEntry *pEntry = &m_Entries[ iEntry ];
+
+	int i;
+	for ( i = 0; i < pEntry->packetCount; i++ )
+	{
+		if ( pEntry->chunks[ i ] >= 0 )
+		{
+			m_FreeChunks[ m_nFreeChunks++ ] = pEntry->chunks[ i ];
+		}
+	}
+
+	// Find the entry's slot, then shift the rest of the probe run back over it so
+	// lookups never need tombstones.
+	int mask = NET_SPLIT_HASH_SIZE - 1;
+	int slot = HashAdr( pEntry->from );
+	while ( m_Hash[ slot ] != iEntry )
 	{
-		entry = &g_SplitPacketEntries[ i ];
-		Assert( entry );
+		Assert( m_Hash[ slot ] >= 0 );
+		slot = ( slot + 1 ) & mask;
+	}
 
-		if ( NET_CompareAdr( entry->from, *from ) )
+	int next = slot;
+	while ( 1 )
+	{
+		next = ( next + 1 ) & mask;
+		if ( m_Hash[ next ] < 0 )
 			break;
+
+		// Leave entries whose home slot is cyclically in (slot, next].
+		int home = HashAdr( m_Entries[ m_Hash[ next ] ].from );
+		if ( slot <= next ? ( slot < home && home <= next ) : ( slot < home || home <= next ) )
+			continue;
+
+		m_Hash[ slot ] = m_Hash[ next ];
+		slot = next;
+	}
+	m_Hash[ slot ] = -1;
+
+	LRUUnlink( iEntry );
+	m_FreeEntries[ m_nFreeEntries++ ] = iEntry;
+	--m_nEntries;
+}
+
+
+void CSplitPacketTable::Free( CSplitPacketEntry *pEntry )
+{
+	FreeIndex( pEntry - m_Entries );
+}
+
+
+CSplitPacketEntry *CSplitPacketTable::FindOrCreate( const netadr_t &from, int sequenceNumber, int packetCount )
+{
+	int mask = NET_SPLIT_HASH_SIZE - 1;
+	int nSameSource = 0;
+	int iOldestSameSource = -1;
+
+	int slot;
+	for ( slot = HashAdr( from ); m_Hash[ slot ] >= 0; slot = ( slot + 1 ) & mask )
+	{
+		int iEntry = m_Hash[ slot ];
+		CSplitPacketEntry *pEntry = &m_Entries[ iEntry ];
+		if ( !NET_CompareAdr( pEntry->from, from ) )
+			continue;
+
+		if ( pEntry->sequenceNumber == sequenceNumber )
+		{
+			LRUUnlink( iEntry );
+			LRULink( iEntry );
+			return pEntry;
+		}
+
+		++nSameSource;
+		if ( iOldestSameSource < 0 || pEntry->lastactivetime < m_Entries[ iOldestSameSource ].lastactivetime )
+		{
+			iOldestSameSource = iEntry;
+		}
+	}
+
+	// New message. Make room for it.
+	if ( nSameSource >= NET_SPLIT_MAX_PER_SOURCE )
+	{
+		FreeIndex( iOldestSameSource );
+		++m_nSourceDrops;
+	}
+
+	if ( !m_nFreeEntries )
+	{
+		FreeIndex( m_LRUTail );
+		++m_nEvictions;
+	}
+
+	int iEntry = m_FreeEntries[ --m_nFreeEntries ];
+	++m_nEntries;
+
+	CSplitPacketEntry *pEntry = &m_Entries[ iEntry ];
+	pEntry->from = from;
+	pEntry->sequenceNumber = sequenceNumber;
+	pEntry->packetCount = packetCount;
+	pEntry->splitCount = packetCount;
+	pEntry->totalSize = 0;
+	pEntry->lastactivetime = 0.0f;
+	for ( int i = 0; i < packetCount; i++ )
+	{
+		pEntry->chunks[ i ] = -1;
+	}
+
+	// Frees above may have moved things around, so probe again for an empty slot.
+	for ( slot = HashAdr( from ); m_Hash[ slot ] >= 0; slot = ( slot + 1 ) & mask )
+		;
+	m_Hash[ slot ] = iEntry;
+
+	LRULink( iEntry );
+	return pEntry;
+}
+
+
+int CSplitPacketTable::AllocChunk( int iKeepEntry )
+{
+	// Drop the least recently active messages until a chunk frees up.
+	while ( !m_nFreeChunks )
+	{
+		int iEntry = m_LRUTail;
+		if ( iEntry == iKeepEntry )
+			iEntry = m_Entries[ iEntry ].lruprev;
+
+		if ( iEntry < 0 )
+			return -1;
+
+		FreeIndex( iEntry );
+		++m_nEvictions;
 	}
 
-	if ( i >= count )
+	return m_FreeChunks[ --m_nFreeChunks ];
+}
+
+
+bool CSplitPacketTable::AddPiece( CSplitPacketEntry *pEntry, int packetNumber, const byte *pData, int size )
+{
+	int iChunk = AllocChunk( pEntry - m_Entries );
+	if ( iChunk < 0 )
 	{
-		CSplitPacketEntry newentry;
-		newentry.from = *from;
+		Free( pEntry );
+		return false;
+	}
 
-		g_SplitPacketEntries.AddToTail( newentry );
+	memcpy( m_Chunks[ iChunk ], pData, size );
+	pEntry->chunks[ packetNumber ] = iChunk;
+	return true;
+}
 
-		entry = &g_SplitPacketEntries[ g_SplitPacketEntries.Count() - 1 ];
+
+void CSplitPacketTable::Gather( CSplitPacketEntry *pEntry, byte *pOut )
+{
+	int nLastSize = pEntry->totalSize - ( pEntry->packetCount - 1 ) * SPLIT_SIZE;
+	for ( int i = 0; i < pEntry->packetCount; i++ )
+	{
+		memcpy( pOut + i * SPLIT_SIZE, m_Chunks[ pEntry->chunks[ i ] ], ( i == pEntry->packetCount - 1 ) ? nLastSize : SPLIT_SIZE );
 	}
+}
+
 
-	Assert( entry );
-	return entry;
+void CSplitPacketTable::DiscardStale( double flTime )
+{
+	// The LRU tail is the least recently active, so stop at the first one that isn't stale.
+	while ( m_LRUTail >= 0 && flTime >= ( m_Entries[ m_LRUTail ].lastactivetime + SPLIT_PACKET_STALE_TIME ) )
+	{
+		FreeIndex( m_LRUTail );
+	}
+}
+
+
+static CSplitPacketTable g_SplitPackets;
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void NET_DiscardStaleSplitpackets( void )
+{
+	g_SplitPackets.DiscardStale( host_time );
 }
 
 bool g_bForceShowMessages = false;
@@ -825,18 +1098,13 @@ bool g_bForceShowMessages = false;
 //-----------------------------------------------------------------------------
 qboolean NET_GetLong( netadr_t *from, byte *pData, int size, int *outSize )
 {
-	int				packetNumber, packetCount, sequenceNumber, offset;
+	int				packetNumber, packetCount, sequenceNumber;
 	short			packetID;
 	SPLITPACKET		*pHeader;
 	
-	CSplitPacketEntry *entry = NET_FindOrCreateSplitPacketEntry( from );
-	Assert( entry );
-	if ( !entry )
+	if ( size < (int)sizeof(SPLITPACKET) )
 		return false;
 
-	entry->lastactivetime = host_time;
-	Assert( NET_CompareAdr( entry->from, *from ) );
-
 	pHeader = ( SPLITPACKET * )pData;
 	sequenceNumber	= pHeader->sequenceNumber;
 	packetID		= pHeader->packetID;
@@ -846,7 +1114,8 @@ qboolean NET_GetLong( netadr_t *from, byte *pData, int size, int *outSize )
 	packetCount		= ( packetID & 0xff );	
 
 	if ( packetNumber >= MAX_SPLITPACKET_SPLITS ||
-		 packetCount > MAX_SPLITPACKET_SPLITS )
+		 packetCount > MAX_SPLITPACKET_SPLITS ||
+		 packetNumber >= packetCount )
 	{
 		Con_Printf( "NET_GetLong:  Split packet from %s with too many split parts (number %i/ count %i) where %i is max count allowed\n", 
 			NET_AdrToString( *from ), 
@@ -856,26 +1125,35 @@ qboolean NET_GetLong( netadr_t *from, byte *pData, int size, int *outSize )
 		return false;
 	}
 
-	// First packet in split series?
-	if ( entry->netsplit.currentSequence == -1 || 
-		sequenceNumber != entry->netsplit.currentSequence )
+	size -= sizeof(SPLITPACKET);
+	if ( size > (int)SPLIT_SIZE )
 	{
-		entry->netsplit.currentSequence	= sequenceNumber;
-		entry->netsplit.splitCount		= packetCount;
+		Con_DPrintf( "NET_GetLong:  Oversize split packet (%i bytes) from %s\n", size, NET_AdrToString( *from ) );
+		return false;
 	}
 
-	size -= sizeof(SPLITPACKET);
+	CSplitPacketEntry *entry = g_SplitPackets.FindOrCreate( *from, sequenceNumber, packetCount );
+	if ( entry->packetCount != packetCount )
+	{
+		Con_DPrintf( "NET_GetLong:  Split packet %i from %s changed its count from %i to %i\n", sequenceNumber, NET_AdrToString( *from ), entry->packetCount, packetCount );
+		return false;
+	}
+
+	entry->lastactivetime = host_time;
 
-	if ( entry->splitflags[ packetNumber ] != sequenceNumber )
+	if ( entry->chunks[ packetNumber ] < 0 )
 	{
+		// Copy the incoming data to the appropriate place in the buffer
+		if ( !g_SplitPackets.AddPiece( entry, packetNumber, pData + sizeof(SPLITPACKET), size ) )
+			return false;
+
 		// Last packet in sequence? set size
 		if ( packetNumber == (packetCount-1) )
 		{
-			entry->netsplit.totalSize = (packetCount-1) * SPLIT_SIZE + size;
+			entry->totalSize = (packetCount-1) * SPLIT_SIZE + size;
 		}
 
-		entry->netsplit.splitCount--;		// Count packet
-		entry->splitflags[ packetNumber ] = sequenceNumber;
+		entry->splitCount--;		// Count packet
 
 		if ( net_showpackets.GetInt() )
 		{
@@ -887,23 +1165,19 @@ qboolean NET_GetLong( netadr_t *from, byte *pData, int size, int *outSize )
 		Con_Printf( "NET_GetLong:  Ignoring duplicated split packet %i of %i ( %i bytes ) from %s\n", packetNumber + 1, packetCount, size, NET_AdrToString( *from ) );
 	}
 
-
-	// Copy the incoming data to the appropriate place in the buffer
-	offset = (packetNumber * SPLIT_SIZE);
-	memcpy( entry->netsplit.buffer + offset, pData + sizeof(SPLITPACKET), size );
-	
 	// Have we received all of the pieces to the packet?
-	if ( entry->netsplit.splitCount <= 0 )
+	if ( entry->splitCount <= 0 )
 	{
-		entry->netsplit.currentSequence = -1;	// Clear packet
-		if ( entry->netsplit.totalSize > sizeof(entry->netsplit.buffer) )
+		if ( entry->totalSize > NET_MAX_MESSAGE )
 		{
-			Con_Printf("Split packet too large! %d bytes from %s\n", entry->netsplit.totalSize, NET_AdrToString( *from ) );
+			Con_Printf("Split packet too large! %d bytes from %s\n", entry->totalSize, NET_AdrToString( *from ) );
+			g_SplitPackets.Free( entry );
 			return false;
 		}
 
-		memcpy( pData, entry->netsplit.buffer, entry->netsplit.totalSize );
-		*outSize = entry->netsplit.totalSize;
+		g_SplitPackets.Gather( entry, pData );
+		*outSize = entry->totalSize;
+		g_SplitPackets.Free( entry );
 
 		// Do this in release for now...
 #if 1 // defined( _DEBUG )
@@ -919,6 +1193,198 @@ qboolean NET_GetLong( netadr_t *from, byte *pData, int size, int *outSize )
 	return false;
 }
 
+
+//-----------------------------------------------------------------------------
+// Stress test for the split packet reassembly. Messages from many sources are split,
+// their pieces shuffled and interleaved with pieces of messages that never finish
+// (as from a flood of spoofed addresses), and the lot is fed through NET_GetLong.
+// Every message that comes out has to match what went in.
+//-----------------------------------------------------------------------------
+
+#define SPLITSTRESS_MAX_PIECES	16
+
+struct SplitStressMessage_t
+{
+	netadr_t	from;
+	int			sequenceNumber;
+	int			size;
+	int			nPieces;
+	int			nSent;
+	byte		order[ SPLITSTRESS_MAX_PIECES ];
+	byte		*pData;
+};
+
+static void NET_SplitStress_f( void )
+{
+	int nSources = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 64;
+	int nMessages = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 5000;
+	int nJunkPercent = ( Cmd_Argc() > 3 ) ? atoi( Cmd_Argv( 3 ) ) : 25;
+	nSources = clamp( nSources, 1, 4096 );
+	nMessages = max( nMessages, 1 );
+	nJunkPercent = clamp( nJunkPercent, 0, 90 );
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	// Build the messages up front so only NET_GetLong is timed.
+	SplitStressMessage_t *pMessages = new SplitStressMessage_t[ nMessages ];
+	int i;
+	for ( i = 0; i < nMessages; i++ )
+	{
+		SplitStressMessage_t *pMsg = &pMessages[ i ];
+		int iSource = random.RandomInt( 0, nSources - 1 );
+		memset( &pMsg->from, 0, sizeof( pMsg->from ) );
+		pMsg->from.type = NA_IP;
+		pMsg->from.ip[0] = 10;
+		pMsg->from.ip[1] = ( iSource >> 8 ) & 0xFF;
+		pMsg->from.ip[2] = iSource & 0xFF;
+		pMsg->from.ip[3] = 1;
+		pMsg->from.port = 27005;
+		pMsg->sequenceNumber = i + 1;
+		pMsg->size = random.RandomInt( SPLIT_SIZE + 1, SPLITSTRESS_MAX_PIECES * SPLIT_SIZE );
+		pMsg->nPieces = ( pMsg->size + SPLIT_SIZE - 1 ) / SPLIT_SIZE;
+		pMsg->nSent = 0;
+
+		pMsg->pData = new byte[ pMsg->size ];
+		for ( int j = 0; j < pMsg->size; j++ )
+		{
+			pMsg->pData[ j ] = (byte)random.RandomInt( 0, 255 );
+		}
+
+		// Send the pieces in a random order.
+		int j;
+		for ( j = 0; j < pMsg->nPieces; j++ )
+		{
+			pMsg->order[ j ] = j;
+		}
+		for ( j = pMsg->nPieces - 1; j > 0; j-- )
+		{
+			int k = random.RandomInt( 0, j );
+			byte tmp = pMsg->order[ j ];
+			pMsg->order[ j ] = pMsg->order[ k ];
+			pMsg->order[ k ] = tmp;
+		}
+	}
+
+	// Interleave the pieces of a window of messages, never more per source than the table allows.
+	CUtlVector< int > inFlight;
+	CUtlVector< int > sourceInFlight;
+	sourceInFlight.SetSize( 65536 );
+	memset( sourceInFlight.Base(), 0, sourceInFlight.Count() * sizeof( int ) );
+
+	byte packet[ NET_MAX_MESSAGE ];
+	int nextMessage = 0;
+	int nPieces = 0, nJunk = 0, nCompleted = 0, nCorrupt = 0;
+	int iJunkSequence = 0;
+	int nPeakChunks = 0;
+
+	g_SplitPackets.RemoveAll();
+	bool bSaveShowPackets = net_showpackets.GetInt() != 0;
+	net_showpackets.SetValue( 0 );
+
+	CFastTimer timer;
+	timer.Start();
+
+	while ( nextMessage < nMessages || inFlight.Count() )
+	{
+		// Top up the window.
+		while ( nextMessage < nMessages && inFlight.Count() < nSources )
+		{
+			SplitStressMessage_t *pMsg = &pMessages[ nextMessage ];
+			int iSource = ( pMsg->from.ip[1] << 8 ) | pMsg->from.ip[2];
+			if ( sourceInFlight[ iSource ] >= NET_SPLIT_MAX_PER_SOURCE )
+				break;
+
+			++sourceInFlight[ iSource ];
+			inFlight.AddToTail( nextMessage++ );
+		}
+
+		netadr_t from;
+		SPLITPACKET *pHeader = (SPLITPACKET *)packet;
+		pHeader->netID = -2;
+		int size;
+		int iInFlight = -1;
+
+		if ( random.RandomInt( 0, 99 ) < nJunkPercent || !inFlight.Count() )
+		{
+			// One piece of a message that never finishes, from a random address.
+			memset( &from, 0, sizeof( from ) );
+			from.type = NA_IP;
+			from.ip[0] = 192;
+			from.ip[1] = random.RandomInt( 0, 255 );
+			from.ip[2] = random.RandomInt( 0, 255 );
+			from.ip[3] = random.RandomInt( 0, 255 );
+			from.port = random.RandomInt( 1024, 65535 );
+			int count = random.RandomInt( 2, SPLITSTRESS_MAX_PIECES );
+			pHeader->sequenceNumber = ++iJunkSequence;
+			pHeader->packetID = ( random.RandomInt( 0, count - 1 ) << 8 ) + count;
+			size = sizeof( SPLITPACKET ) + SPLIT_SIZE;
+			memset( packet + sizeof( SPLITPACKET ), 0, SPLIT_SIZE );
+			++nJunk;
+		}
+		else
+		{
+			iInFlight = random.RandomInt( 0, inFlight.Count() - 1 );
+			SplitStressMessage_t *pMsg = &pMessages[ inFlight[ iInFlight ] ];
+			int iPiece = pMsg->order[ pMsg->nSent++ ];
+			int pieceSize = min( (int)SPLIT_SIZE, pMsg->size - iPiece * (int)SPLIT_SIZE );
+
+			from = pMsg->from;
+			pHeader->sequenceNumber = pMsg->sequenceNumber;
+			pHeader->packetID = ( iPiece << 8 ) + pMsg->nPieces;
+			memcpy( packet + sizeof( SPLITPACKET ), pMsg->pData + iPiece * SPLIT_SIZE, pieceSize );
+			size = sizeof( SPLITPACKET ) + pieceSize;
+			++nPieces;
+		}
+
+		int outSize = 0;
+		if ( NET_GetLong( &from, packet, size, &outSize ) )
+		{
+			SplitStressMessage_t *pMsg = iInFlight >= 0 ? &pMessages[ inFlight[ iInFlight ] ] : NULL;
+			if ( !pMsg || outSize != pMsg->size || memcmp( packet, pMsg->pData, outSize ) )
+			{
+				++nCorrupt;
+			}
+			++nCompleted;
+		}
+
+		nPeakChunks = max( nPeakChunks, g_SplitPackets.GetNumChunksUsed() );
+
+		// Retire the message once all its pieces are out, whether or not it survived.
+		if ( iInFlight >= 0 )
+		{
+			SplitStressMessage_t *pMsg = &pMessages[ inFlight[ iInFlight ] ];
+			if ( pMsg->nSent == pMsg->nPieces )
+			{
+				--sourceInFlight[ ( pMsg->from.ip[1] << 8 ) | pMsg->from.ip[2] ];
+				inFlight.FastRemove( iInFlight );
+			}
+		}
+	}
+
+	timer.End();
+	net_showpackets.SetValue( bSaveShowPackets ? 1 : 0 );
+
+	float flMS = timer.GetDuration().GetMillisecondsF();
+	int nTotal = nPieces + nJunk;
+	Con_Printf( "net_splitstress: %d sources, %d messages, %d%% junk\n", nSources, nMessages, nJunkPercent );
+	Con_Printf( "  %d pieces (%d junk) in %.2f ms, %.0f pieces/sec\n", nTotal, nJunk, flMS, flMS > 0 ? nTotal * 1000.0f / flMS : 0.0f );
+	Con_Printf( "  %d messages completed, %d dropped, %d corrupt\n", nCompleted, nMessages - nCompleted, nCorrupt );
+	Con_Printf( "  %d evictions, %d source cap drops, peak %d/%d chunks (%d bytes)\n", 
+		g_SplitPackets.m_nEvictions, g_SplitPackets.m_nSourceDrops, nPeakChunks, NET_SPLIT_CHUNKS, nPeakChunks * (int)SPLIT_SIZE );
+
+	g_SplitPackets.RemoveAll();
+
+	for ( i = 0; i < nMessages; i++ )
+	{
+		delete[] pMessages[ i ].pData;
+	}
+	delete[] pMessages;
+}
+
+static ConCommand net_splitstress( "net_splitstress", NET_SplitStress_f, "Feed shuffled, interleaved split packets from many sources through NET_GetLong and check the results. Usage: net_splitstress [sources] [messages] [junk percent]" );
+
+
 qboolean	NET_QueuePacket (netsrc_t sock)
 {
 	int				ret;
@@ -927,12 +1393,26 @@ qboolean	NET_QueuePacket (netsrc_t sock)
 	int				net_socket = 0;
 	int				err;
 	unsigned char	buf[ NET_MAX_MESSAGE ];
+	unsigned char	*pData = buf;
 
 	net_socket = ip_sockets[sock];
 	if (net_socket)
 	{
-		fromlen = sizeof(from);
-		ret = g_pVCR->Hook_recvfrom(net_socket, (char *)buf, NET_MAX_MESSAGE, 0, (struct sockaddr *)&from, (int *)&fromlen );
+#if defined( _LINUX )
+		if ( NET_UseBatchIO() )
+		{
+			ret = NET_RecvBatched( sock, net_socket, &pData, &from );
+		}
+		else
+#endif
+		{
+			fromlen = sizeof(from);
+			ret = g_pVCR->Hook_recvfrom(net_socket, (char *)buf, NET_MAX_MESSAGE, 0, (struct sockaddr *)&from, (int *)&fromlen );
+			++net_iostats_accum.recvcalls;
+			if ( ret != -1 )
+				++net_iostats_accum.recvpackets;
+		}
+
 		if ( ret != -1 )
 		{
 			SockadrToNetadr( &from, &in_from );
@@ -940,7 +1420,7 @@ qboolean	NET_QueuePacket (netsrc_t sock)
 			if ( ret < NET_MAX_MESSAGE )
 			{
 				// Transfer data
-				NET_TransferRawData( &in_message, buf, ret );
+				NET_TransferRawData( &in_message, pData, ret );
 
 				// Check for split message
 				if ( *(int *)in_message.data == -2 )
@@ -1001,6 +1481,249 @@ net_messages_t *NET_AllocMsg( int size );
 
 net_messages_t *normalqueue = NULL;
 
+
+//-----------------------------------------------------------------------------
+// Batched socket I/O (net_batchio). On Linux each socket is drained with one
+// recvmmsg into a ring of preallocated net_messages_t that NET_QueuePacket then
+// hands out one at a time, and the packets sent between NET_BeginSendBatch and
+// NET_FlushSendBatch go out in as few sendmmsg calls as possible.
+//-----------------------------------------------------------------------------
+
+static bool NET_UseBatchIO( void )
+{
+#if defined( _LINUX )
+	// VCR mode hooks recvfrom one packet at a time.
+	return net_batchio.GetInt() && g_pVCR->GetMode() == VCR_Disabled;
+#else
+	return false;
+#endif
+}
+
+#if defined( _LINUX )
+
+#define NET_RECV_BATCH			32
+// Clients split anything bigger than MAX_ROUTEABLE_PACKET, so this holds any packet we
+// expect. Bigger ones are reported as oversize.
+#define NET_RECV_BATCH_SIZE		2048
+
+#define NET_SEND_BATCH			64
+#define NET_SEND_BATCH_BYTES	( 64 * 1024 )
+
+typedef struct
+{
+	net_messages_t	slots[ NET_RECV_BATCH ];
+	struct mmsghdr	hdrs[ NET_RECV_BATCH ];
+	struct iovec	iovs[ NET_RECV_BATCH ];
+	struct sockaddr	addrs[ NET_RECV_BATCH ];
+	int				count;		// Number of slots the last recvmmsg filled.
+	int				next;		// Next slot for NET_QueuePacket.
+} net_recvbatch_t;
+
+typedef struct
+{
+	struct mmsghdr	hdrs[ NET_SEND_BATCH ];
+	struct iovec	iovs[ NET_SEND_BATCH ];
+	struct sockaddr	addrs[ NET_SEND_BATCH ];
+	byte			data[ NET_SEND_BATCH_BYTES ];
+	int				count;
+	int				bytes;
+	int				socket;		// All the queued packets go out on this socket.
+} net_sendbatch_t;
+
+static net_recvbatch_t	*net_recvbatch[2] = { NULL, NULL };
+static net_sendbatch_t	*net_sendbatch = NULL;
+static int				net_sendbatching = 0;
+
+
+static net_recvbatch_t *NET_GetRecvBatch( netsrc_t sock )
+{
+	net_recvbatch_t *pBatch = net_recvbatch[sock];
+	if ( pBatch )
+		return pBatch;
+
+	pBatch = ( net_recvbatch_t * )net_malloc( sizeof( net_recvbatch_t ) );
+	for ( int i = 0; i < NET_RECV_BATCH; i++ )
+	{
+		net_messages_t *pmsg = &pBatch->slots[ i ];
+		pmsg->buffer = ( unsigned char * )net_malloc( NET_RECV_BATCH_SIZE );
+		pmsg->preallocated = true;
+	}
+
+	net_recvbatch[sock] = pBatch;
+	return pBatch;
+}
+
+
+// Returns the next packet for the socket, refilling the ring with one recvmmsg when it's
+// empty. Returns -1 (with errno set) if there's nothing to read.
+static int NET_RecvBatched( netsrc_t sock, int net_socket, unsigned char **ppData, struct sockaddr *from )
+{
+	net_recvbatch_t *pBatch = NET_GetRecvBatch( sock );
+
+	if ( pBatch->next >= pBatch->count )
+	{
+		pBatch->next = pBatch->count = 0;
+
+		for ( int i = 0; i < NET_RECV_BATCH; i++ )
+		{
+			pBatch->iovs[i].iov_base = pBatch->slots[i].buffer;
+			pBatch->iovs[i].iov_len = NET_RECV_BATCH_SIZE;
+
+			memset( &pBatch->hdrs[i], 0, sizeof( pBatch->hdrs[i] ) );
+			pBatch->hdrs[i].msg_hdr.msg_name = &pBatch->addrs[i];
+			pBatch->hdrs[i].msg_hdr.msg_namelen = sizeof( pBatch->addrs[i] );
+			pBatch->hdrs[i].msg_hdr.msg_iov = &pBatch->iovs[i];
+			pBatch->hdrs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = recvmmsg( net_socket, pBatch->hdrs, NET_RECV_BATCH, MSG_DONTWAIT, NULL );
+		++net_iostats_accum.recvcalls;
+		if ( ret <= 0 )
+		{
+			if ( ret == 0 )
+				errno = EWOULDBLOCK;
+			return -1;
+		}
+
+		pBatch->count = ret;
+		net_iostats_accum.recvpackets += ret;
+	}
+
+	int i = pBatch->next++;
+	net_messages_t *pmsg = &pBatch->slots[i];
+	pmsg->buffersize = pBatch->hdrs[i].msg_len;
+	*from = pBatch->addrs[i];
+	*ppData = pmsg->buffer;
+
+	if ( pBatch->hdrs[i].msg_hdr.msg_flags & MSG_TRUNC )
+		return NET_MAX_MESSAGE;
+
+	return pmsg->buffersize;
+}
+
+
+static void NET_FlushSendQueue( void )
+{
+	net_sendbatch_t *pBatch = net_sendbatch;
+	if ( !pBatch || !pBatch->count )
+		return;
+
+	int iFirst = 0;
+	while ( iFirst < pBatch->count )
+	{
+		int ret = sendmmsg( pBatch->socket, &pBatch->hdrs[iFirst], pBatch->count - iFirst, 0 );
+		++net_iostats_accum.sendcalls;
+		if ( ret > 0 )
+		{
+			net_iostats_accum.sendpackets += ret;
+			iFirst += ret;
+			continue;
+		}
+
+		// Same as NET_SendPacket: a full socket buffer drops the rest, other errors only lose this one.
+		int err = errno;
+		if ( err == WSAEWOULDBLOCK )
+			break;
+
+		if ( err != WSAECONNRESET )
+		{
+			Con_DPrintf( "NET_FlushSendBatch: %s\n", NET_ErrorString( err ) );
+		}
+		++iFirst;
+	}
+
+	pBatch->count = 0;
+	pBatch->bytes = 0;
+}
+
+
+// Copies the packet into the send batch. Returns len, like sendto would.
+static int NET_QueueSend( int s, const char *buf, int len, int flags, const struct sockaddr *to, int tolen )
+{
+	if ( !net_sendbatch )
+	{
+		net_sendbatch = ( net_sendbatch_t * )net_malloc( sizeof( net_sendbatch_t ) );
+	}
+
+	net_sendbatch_t *pBatch = net_sendbatch;
+	if ( pBatch->count && ( pBatch->socket != s || pBatch->count == NET_SEND_BATCH || pBatch->bytes + len > NET_SEND_BATCH_BYTES ) )
+	{
+		NET_FlushSendQueue();
+	}
+
+	int i = pBatch->count++;
+	byte *pDest = &pBatch->data[ pBatch->bytes ];
+	memcpy( pDest, buf, len );
+	pBatch->bytes += len;
+	pBatch->socket = s;
+
+	memcpy( &pBatch->addrs[i], to, min( tolen, (int)sizeof( pBatch->addrs[i] ) ) );
+	pBatch->iovs[i].iov_base = pDest;
+	pBatch->iovs[i].iov_len = len;
+
+	memset( &pBatch->hdrs[i], 0, sizeof( pBatch->hdrs[i] ) );
+	pBatch->hdrs[i].msg_hdr.msg_name = &pBatch->addrs[i];
+	pBatch->hdrs[i].msg_hdr.msg_namelen = tolen;
+	pBatch->hdrs[i].msg_hdr.msg_iov = &pBatch->iovs[i];
+	pBatch->hdrs[i].msg_hdr.msg_iovlen = 1;
+	return len;
+}
+
+#endif // _LINUX
+
+
+static bool NET_IsSendBatching( void )
+{
+#if defined( _LINUX )
+	return net_sendbatching > 0;
+#else
+	return false;
+#endif
+}
+
+
+void NET_BeginSendBatch( void )
+{
+#if defined( _LINUX )
+	if ( NET_UseBatchIO() )
+	{
+		++net_sendbatching;
+	}
+#endif
+}
+
+
+void NET_FlushSendBatch( void )
+{
+#if defined( _LINUX )
+	if ( net_sendbatching > 0 )
+	{
+		if ( --net_sendbatching == 0 )
+		{
+			NET_FlushSendQueue();
+		}
+	}
+#endif
+
+	// Once a second, print what the batching is saving.
+	++net_iostats_accum.frames;
+	if ( host_time - net_iostats_time >= 1.0 )
+	{
+		netiostats_t &s = net_iostats_accum;
+		if ( net_iostats.GetInt() && s.frames )
+		{
+			Con_Printf( "net: %.1f frames/s, per frame: recv %.1f calls %.1f pkts, send %.1f calls %.1f pkts%s\n",
+				s.frames / ( host_time - net_iostats_time ),
+				(float)s.recvcalls / s.frames, (float)s.recvpackets / s.frames,
+				(float)s.sendcalls / s.frames, (float)s.sendpackets / s.frames,
+				NET_UseBatchIO() ? " (batched)" : "" );
+		}
+
+		memset( &net_iostats_accum, 0, sizeof( net_iostats_accum ) );
+		net_iostats_time = host_time;
+	}
+}
+
 void *hNetThread = NULL;
 unsigned long dwNetThreadId;
 //HANDLE hNetDone;
@@ -1296,6 +2019,26 @@ void NET_FlushQueues( void )
 		p = n;
 	}
 	normalqueue = NULL;
+
+#if defined( _LINUX )
+	for ( i = 0; i < 2; i++ )
+	{
+		if ( !net_recvbatch[ i ] )
+			continue;
+
+		for ( int j = 0; j < NET_RECV_BATCH; j++ )
+		{
+			delete[] net_recvbatch[ i ]->slots[ j ].buffer;
+		}
+		delete[] ( unsigned char * )net_recvbatch[ i ];
+		net_recvbatch[ i ] = NULL;
+	}
+
+	NET_FlushSendQueue();
+	delete[] ( unsigned char * )net_sendbatch;
+	net_sendbatch = NULL;
+	net_sendbatching = 0;
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -1316,7 +2059,19 @@ int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, int flags
 	// Don't send anything out in VCR mode.. it just annoys other people testing in multiplayer.
 	if ( g_pVCR->GetMode() != VCR_Playback )
 	{
-		nSend = sendto( s, buf, len, flags, to, tolen );
+#if defined( _LINUX )
+		if ( NET_IsSendBatching() && len <= NET_SEND_BATCH_BYTES )
+		{
+			nSend = NET_QueueSend( s, buf, len, flags, to, tolen );
+		}
+		else
+#endif
+		{
+			nSend = sendto( s, buf, len, flags, to, tolen );
+			++net_iostats_accum.sendcalls;
+			if ( nSend >= 0 )
+				++net_iostats_accum.sendpackets;
+		}
 	}
 
 #if defined( _DEBUG )
@@ -1486,11 +2241,15 @@ int NET_SendLong( netsrc_t sock, SOCKET s, const char FAR * buf, int len, int fl
 			packetNumber++;
 
 			// FIXME:  This was 15, but if you have a lot of packets, that will pause the server for a long time
+			// (Batched sends all go out together at the end of the frame anyway.)
+			if ( !NET_IsSendBatching() )
+			{
 #ifdef _WIN32
-			Sleep( 1 );
+				Sleep( 1 );
 #elif _LINUX
-			usleep( 1 );
+				usleep( 1 );
 #endif
+			}
 
 // Always bitch about split packets in debug
 #if !defined( _DEBUG )
@@ -24,6 +24,8 @@ bool PackedDataAllocator::Alloc(unsigned long size, DataHandle &theHandle)
 {
 	Free(theHandle);
 
+	CThreadAutoLock lock( m_Mutex );
+
 	int totalSize = sizeof(DataBlock) + size - 1;
 	if (totalSize <= 64)
 	{
@@ -59,6 +61,8 @@ void PackedDataAllocator::Free(DataHandle &theHandle)
 {
 	if(theHandle.m_pBlock)
 	{
+		CThreadAutoLock lock( m_Mutex );
+
 		theHandle.m_pBlock->m_nReferences--;
 		if(theHandle.m_pBlock->m_nReferences == 0)
 		{
@@ -86,6 +90,104 @@ void PackedDataAllocator::Free(DataHandle &theHandle)
 }
 
 
+// -------------------------------------------------------------------------------------------------- //
+// PackedDataArena.
+// -------------------------------------------------------------------------------------------------- //
+
+// Most ticks fit in one block. Anything bigger than a block gets a block of its own.
+#define ARENA_BLOCK_SIZE	( 16 * 1024 )
+#define ARENA_BLOCK_HEADER	PAD_NUMBER( sizeof( CBlock ), 8 )
+
+long volatile PackedDataArena::s_nArenas = 0;
+long volatile PackedDataArena::s_nBytesReserved = 0;
+
+
+PackedDataArena::PackedDataArena( int nTickNumber )
+{
+	m_pBlocks = NULL;
+	m_nTickNumber = nTickNumber;
+	m_bSnapshotDeleted = false;
+	m_nAllocations = 0;
+	m_nBytesUsed = 0;
+	m_nBytesReserved = 0;
+	m_nReferences = 1;
+
+	ThreadInterlockedIncrement( &s_nArenas );
+}
+
+
+PackedDataArena::~PackedDataArena()
+{
+	CBlock *pBlock = m_pBlocks;
+	while ( pBlock )
+	{
+		CBlock *pNext = pBlock->m_pNext;
+		free( pBlock );
+		pBlock = pNext;
+	}
+
+	ThreadInterlockedExchangeAdd( &s_nBytesReserved, -(long)m_nBytesReserved );
+	ThreadInterlockedDecrement( &s_nArenas );
+}
+
+
+void* PackedDataArena::Alloc( unsigned long size )
+{
+	size = PAD_NUMBER( size, 8 );
+
+	CBlock *pBlock = m_pBlocks;
+	if ( !pBlock || pBlock->m_nUsed + size > pBlock->m_nSize )
+	{
+		unsigned long nBlockSize = ARENA_BLOCK_SIZE - ARENA_BLOCK_HEADER;
+		if ( size > nBlockSize )
+			nBlockSize = size;
+		pBlock = (CBlock*)malloc( ARENA_BLOCK_HEADER + nBlockSize );
+		if ( !pBlock )
+			return NULL;
+
+		pBlock->m_nSize = nBlockSize;
+		pBlock->m_nUsed = 0;
+
+		// Keep allocating from the current block if this one is only for an oversized allocation.
+		if ( m_pBlocks && size > ARENA_BLOCK_SIZE / 2 )
+		{
+			pBlock->m_pNext = m_pBlocks->m_pNext;
+			m_pBlocks->m_pNext = pBlock;
+		}
+		else
+		{
+			pBlock->m_pNext = m_pBlocks;
+			m_pBlocks = pBlock;
+		}
+
+		m_nBytesReserved += ARENA_BLOCK_HEADER + nBlockSize;
+		ThreadInterlockedExchangeAdd( &s_nBytesReserved, (long)( ARENA_BLOCK_HEADER + nBlockSize ) );
+	}
+
+	void *pRet = (char*)pBlock + ARENA_BLOCK_HEADER + pBlock->m_nUsed;
+	pBlock->m_nUsed += size;
+	m_nBytesUsed += size;
+	++m_nAllocations;
+	return pRet;
+}
+
+
+void PackedDataArena::AddReference()
+{
+	ThreadInterlockedIncrement( &m_nReferences );
+}
+
+
+void PackedDataArena::ReleaseReference()
+{
+	Assert( m_nReferences > 0 );
+	if ( ThreadInterlockedDecrement( &m_nReferences ) == 0 )
+	{
+		delete this;
+	}
+}
+
+
 // -------------------------------------------------------------------------------------------------- //
 // PackedEntity.
 // -------------------------------------------------------------------------------------------------- //
@@ -93,19 +195,37 @@ void PackedDataAllocator::Free(DataHandle &theHandle)
 PackedEntity::PackedEntity()
 {
 	m_pChangeFrameList = 0;
+	m_pArena = NULL;
+	m_pData = NULL;
 }
 
 
 PackedEntity::~PackedEntity()
 {
+	FreeData();
+
 	if ( m_pChangeFrameList )
 		m_pChangeFrameList->Release();
 }
 
 
-bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size, PackedDataAllocator *pAllocator )
+void PackedEntity::FreeData()
 {
 	m_Data.Free();
+
+	if ( m_pArena )
+	{
+		m_pArena->ReleaseReference();
+		m_pArena = NULL;
+	}
+
+	m_pData = NULL;
+}
+
+
+bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size, PackedDataAllocator *pAllocator )
+{
+	FreeData();
 	
 	unsigned long nBytes = PAD_NUMBER( size, 4 );
 	if ( pAllocator->Alloc( nBytes, m_Data ) )
@@ -115,6 +235,7 @@ bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size, Pa
 		{
 			memcpy( pDest, pData, size );
 			m_Data.Unlock();
+			m_pData = pDest;
 			SetNumBits( nBytes * 8 );
 			return true;
 		}
@@ -124,6 +245,41 @@ bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size, Pa
 }
 
 
+bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size, PackedDataArena *pArena )
+{
+	FreeData();
+
+	unsigned long nBytes = PAD_NUMBER( size, 4 );
+	void *pDest = pArena->Alloc( nBytes );
+	if ( !pDest )
+		return false;
+
+	memcpy( pDest, pData, size );
+	pArena->AddReference();
+	m_pArena = pArena;
+	m_pData = pDest;
+	SetNumBits( nBytes * 8 );
+	return true;
+}
+
+
+void PackedEntity::MoveData( PackedDataArena *pArena )
+{
+	if ( !m_pArena || m_pArena == pArena )
+		return;
+
+	void *pDest = pArena->Alloc( GetNumBytes() );
+	if ( !pDest )
+		return;
+
+	memcpy( pDest, m_pData, GetNumBytes() );
+	pArena->AddReference();
+	m_pArena->ReleaseReference();
+	m_pArena = pArena;
+	m_pData = pDest;
+}
+
+
 int PackedEntity::GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps )
 {
 	if ( m_pChangeFrameList )
@@ -22,6 +22,7 @@
 #include "../public/mempool.h"
 #include "../public/utlvector.h"
 #include "../public/tier0/dbg.h"
+#include "../public/tier0/threadtools.h"
 
 
 // This is the maximum amount of data a PackedEntity can have. Having a limit allows us
@@ -82,6 +83,9 @@ private:
 // This allocates chunks of data for use by the networking data tables.
 // Eventually, it will just have a big block of memory to deal with and will 
 // unfragment the block as it goes.
+//
+// Alloc and Free may be called from several threads at once (old snapshots
+// are released by the worker threads that build client packets).
 // -------------------------------------------------------------------------------------------------- //
 
 class PackedDataAllocator
@@ -100,9 +104,106 @@ private:
 	CMemoryPool	m_64BytePool;
 	CMemoryPool	m_128BytePool;
 	CMemoryPool	m_1024BytePool;
+
+	CThreadMutex	m_Mutex;
+};
+
+
+// -------------------------------------------------------------------------------------------------- //
+//
+// PackedDataArena
+//
+// Bump allocator for all the entities packed during one tick. The tick's CFrameSnapshot holds a
+// reference, and so does each PackedEntity whose data lives in it. When the last reference goes
+// away, all the blocks are freed in one step instead of one Free per entity.
+//
+// Alloc is only called from the main thread while the client packs are computed.
+// AddReference and ReleaseReference may be called from any thread.
+// -------------------------------------------------------------------------------------------------- //
+
+class PackedDataArena
+{
+public:
+					PackedDataArena( int nTickNumber );
+
+	// Returns 8-byte aligned memory that stays valid until the arena is released.
+	void*			Alloc( unsigned long size );
+
+	void			AddReference();
+	void			ReleaseReference();
+
+	// Set by the snapshot manager once the tick's snapshot is gone and only packed entities
+	// reused by later ticks are keeping the arena alive.
+	void			SetSnapshotDeleted();
+	bool			IsSnapshotDeleted() const;
+
+	int				GetTickNumber() const;
+	int				GetReferenceCount() const;
+	int				GetNumAllocations() const;
+	unsigned long	GetBytesUsed() const;
+	unsigned long	GetBytesReserved() const;
+
+	// Totals for all the live arenas.
+	static long volatile	s_nArenas;
+	static long volatile	s_nBytesReserved;
+
+private:
+					~PackedDataArena();
+
+	class CBlock
+	{
+	public:
+		CBlock			*m_pNext;
+		unsigned long	m_nSize;
+		unsigned long	m_nUsed;
+	};
+
+	CBlock			*m_pBlocks;		// The block being allocated from is first.
+	int				m_nTickNumber;
+	bool			m_bSnapshotDeleted;
+	int				m_nAllocations;
+	unsigned long	m_nBytesUsed;
+	unsigned long	m_nBytesReserved;
+	long volatile	m_nReferences;
 };
 
 
+inline void PackedDataArena::SetSnapshotDeleted()
+{
+	m_bSnapshotDeleted = true;
+}
+
+inline bool PackedDataArena::IsSnapshotDeleted() const
+{
+	return m_bSnapshotDeleted;
+}
+
+inline int PackedDataArena::GetTickNumber() const
+{
+	return m_nTickNumber;
+}
+
+inline int PackedDataArena::GetReferenceCount() const
+{
+	return m_nReferences;
+}
+
+inline int PackedDataArena::GetNumAllocations() const
+{
+	return m_nAllocations;
+}
+
+inline unsigned long PackedDataArena::GetBytesUsed() const
+{
+	return m_nBytesUsed;
+}
+
+inline unsigned long PackedDataArena::GetBytesReserved() const
+{
+	return m_nBytesReserved;
+}
+
+
 // Replaces entity_state_t.
 // This is what we send to clients.
 
@@ -117,7 +218,9 @@ public:
 	int			GetNumBits() const;
 	int			GetNumBytes() const;
 
-	// Access the data in the entity.
+	// Access the data in the entity. GetData is a plain pointer that stays valid as long
+	// as the PackedEntity does; Lock/Unlock are kept for the client and the baselines.
+	void*		GetData() const;
 	void*		LockData();
 	void		UnlockData();
 	void		FreeData();
@@ -125,6 +228,13 @@ public:
 	// Copy the data into the PackedEntity's data and make sure the # bytes allocated is
 	// an integer multiple of 4.
 	bool		AllocAndCopyPadded( const void *pData, unsigned long size, PackedDataAllocator *pAllocator );
+	bool		AllocAndCopyPadded( const void *pData, unsigned long size, PackedDataArena *pArena );
+
+	// Copies the data into pArena and drops the reference on the arena it was in.
+	void		MoveData( PackedDataArena *pArena );
+
+	// Returns the arena the data lives in, or NULL if it came from a PackedDataAllocator.
+	PackedDataArena*	GetArena() const;
 
 	// These are like Get/Set, except SnagChangeFrameList clears out the
 	// PackedEntity's pointer since the usage model in sv_main is to keep
@@ -158,7 +268,9 @@ private:
 
 	CUtlVector<CSendProxyRecipients>	m_Recipients;
 
-	DataHandle			m_Data;					// Packed data.
+	DataHandle			m_Data;					// Packed data, if it came from a PackedDataAllocator.
+	PackedDataArena		*m_pArena;				// Packed data, if it came from an arena.
+	void				*m_pData;				// Points into m_Data or m_pArena.
 	int					m_nBits;				// Number of bits used to encode.
 	IChangeFrameList	*m_pChangeFrameList;	// Only the most current 
 };
@@ -181,19 +293,23 @@ inline int PackedEntity::GetNumBytes() const
 	return GetNumBits() >> 3; 
 }
 
+inline void* PackedEntity::GetData() const
+{
+	return m_pData;
+}
+
 inline void* PackedEntity::LockData()
 {
-	return m_Data.Lock();
+	return m_pData;
 }
 
 inline void PackedEntity::UnlockData()
 {
-	m_Data.Unlock();
 }
 
-inline void PackedEntity::FreeData()
+inline PackedDataArena* PackedEntity::GetArena() const
 {
-	m_Data.Free();
+	return m_pArena;
 }
 
 inline void PackedEntity::SetChangeFrameList( IChangeFrameList *pList )
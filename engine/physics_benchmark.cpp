@@ -0,0 +1,253 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: vphysics_benchmark: drops a field of box ragdolls onto a floor in a
+//			private physics environment and times the simulation single
+//			threaded and spread over the worker pool.  Final positions have
+//			to come out the same for every number of worker threads.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "sys_dll.h"
+#include "cmodel_private.h"
+#include "vphysics_interface.h"
+#include "vphysics/constraints.h"
+#include "checksum_crc.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+
+
+// Each ragdoll is a chain of boxes joined by ragdoll constraints in one group
+#define PHYS_BENCH_BONES		5
+#define PHYS_BENCH_BONE_LENGTH	12.0f
+#define PHYS_BENCH_BONE_WIDTH	4.0f
+#define PHYS_BENCH_SPACING		64.0f
+#define PHYS_BENCH_TIMESTEP		0.015f
+
+struct PhysBenchRagdoll_t
+{
+	IPhysicsObject			*m_pBones[PHYS_BENCH_BONES];
+	IPhysicsConstraint		*m_pConstraints[PHYS_BENCH_BONES-1];
+	IPhysicsConstraintGroup	*m_pGroup;
+};
+
+struct PhysBenchResult_t
+{
+	double		m_flMS;
+	CRC32_t		m_Checksum;
+	int			m_nAwake;
+};
+
+
+//-----------------------------------------------------------------------------
+// Builds the scene, runs it for nSteps ticks and checksums where everything ended up
+//-----------------------------------------------------------------------------
+static void PhysBench_Run( IPhysics *pPhysics, int nRagdolls, int nSteps, bool bParallel, PhysBenchResult_t &result )
+{
+	objectparams_t params =
+	{
+		NULL,
+		8.0f, // mass
+		1.0f, // inertia
+		0.1f, // damping
+		0.1f, // rotdamping
+		0.5f, // rotInertiaLimit
+		"vphysics_benchmark",
+		NULL, // game data
+		0.0f, // volume
+		1.0f, // drag coefficient
+		1.0f, // rolling drag
+		true, // enable collisions
+	};
+
+	int material = physprop->GetSurfaceIndex( "default" );
+	if ( material < 0 )
+	{
+		material = 0;
+	}
+
+	IPhysicsEnvironment *pEnv = pPhysics->CreateEnvironment();
+	pEnv->SetGravity( Vector( 0, 0, -600 ) );
+	pEnv->SetSimulationTimestep( PHYS_BENCH_TIMESTEP );
+	pEnv->EnableParallelSimulation( bParallel );
+
+	int nSide = 1;
+	while ( nSide * nSide < nRagdolls )
+	{
+		++nSide;
+	}
+
+	float flHalfSize = nSide * PHYS_BENCH_SPACING * 0.5f + PHYS_BENCH_SPACING;
+	CPhysCollide *pFloorCollide = physcollision->BBoxToCollide( Vector( -flHalfSize, -flHalfSize, -32 ), Vector( flHalfSize, flHalfSize, 0 ) );
+	IPhysicsObject *pFloor = pEnv->CreatePolyObjectStatic( pFloorCollide, material, vec3_origin, vec3_angle, &params );
+
+	Vector boneExtents( PHYS_BENCH_BONE_WIDTH, PHYS_BENCH_BONE_WIDTH, PHYS_BENCH_BONE_LENGTH * 0.5f );
+	CPhysCollide *pBoneCollide = physcollision->BBoxToCollide( -boneExtents, boneExtents );
+
+	PhysBenchRagdoll_t *pRagdolls = new PhysBenchRagdoll_t[nRagdolls];
+	int iRagdoll;
+	for ( iRagdoll=0; iRagdoll < nRagdolls; iRagdoll++ )
+	{
+		PhysBenchRagdoll_t &ragdoll = pRagdolls[iRagdoll];
+
+		// Spread them out in x/y and in height so some land while others are still
+		// falling, then tilt the chains so they fold up on landing and pile onto each other
+		Vector origin( ( ( iRagdoll % nSide ) - nSide * 0.5f ) * PHYS_BENCH_SPACING,
+			( ( iRagdoll / nSide ) - nSide * 0.5f ) * PHYS_BENCH_SPACING,
+			64.0f + ( ( iRagdoll * 7 ) % 16 ) * 48.0f );
+		QAngle angles( ( iRagdoll * 13 ) % 60, ( iRagdoll * 29 ) % 360, ( iRagdoll * 17 ) % 40 );
+		matrix3x4_t chainToWorld;
+		AngleMatrix( angles, chainToWorld );
+
+		int iBone;
+		for ( iBone=0; iBone < PHYS_BENCH_BONES; iBone++ )
+		{
+			Vector offset;
+			VectorRotate( Vector( 0, 0, iBone * PHYS_BENCH_BONE_LENGTH ), chainToWorld, offset );
+			ragdoll.m_pBones[iBone] = pEnv->CreatePolyObject( pBoneCollide, material, origin + offset, angles, &params );
+		}
+
+		ragdoll.m_pGroup = pEnv->CreateConstraintGroup();
+		for ( iBone=1; iBone < PHYS_BENCH_BONES; iBone++ )
+		{
+			constraint_ragdollparams_t joint;
+			joint.Defaults();
+			// Joint between the top of the parent and the bottom of the child
+			MatrixSetColumn( Vector( 0, 0, -PHYS_BENCH_BONE_LENGTH * 0.5f ), 3, joint.constraintToReference );
+			MatrixSetColumn( Vector( 0, 0, PHYS_BENCH_BONE_LENGTH * 0.5f ), 3, joint.constraintToAttached );
+			joint.axes[0].SetAxisFriction( -30, 30, 0 );
+			joint.axes[1].SetAxisFriction( -45, 45, 0 );
+			joint.axes[2].SetAxisFriction( -20, 20, 0 );
+			ragdoll.m_pConstraints[iBone-1] = pEnv->CreateRagdollConstraint( ragdoll.m_pBones[iBone], ragdoll.m_pBones[iBone-1], ragdoll.m_pGroup, joint );
+		}
+		ragdoll.m_pGroup->Activate();
+	}
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int iStep=0; iStep < nSteps; iStep++ )
+	{
+		pEnv->Simulate( PHYS_BENCH_TIMESTEP );
+	}
+	timer.End();
+
+	result.m_flMS = timer.GetDuration().GetMillisecondsF();
+	result.m_nAwake = pEnv->GetActiveObjectCount();
+
+	CRC32_Init( &result.m_Checksum );
+	for ( iRagdoll=0; iRagdoll < nRagdolls; iRagdoll++ )
+	{
+		for ( int iBone=0; iBone < PHYS_BENCH_BONES; iBone++ )
+		{
+			Vector position;
+			QAngle boneAngles;
+			pRagdolls[iRagdoll].m_pBones[iBone]->GetPosition( &position, &boneAngles );
+			CRC32_ProcessBuffer( &result.m_Checksum, &position, sizeof(position) );
+			CRC32_ProcessBuffer( &result.m_Checksum, &boneAngles, sizeof(boneAngles) );
+		}
+	}
+	CRC32_Final( &result.m_Checksum );
+
+	pEnv->SetQuickDelete( true );
+	for ( iRagdoll=0; iRagdoll < nRagdolls; iRagdoll++ )
+	{
+		PhysBenchRagdoll_t &ragdoll = pRagdolls[iRagdoll];
+		int iConstraint;
+		for ( iConstraint=0; iConstraint < PHYS_BENCH_BONES-1; iConstraint++ )
+		{
+			pEnv->DestroyConstraint( ragdoll.m_pConstraints[iConstraint] );
+		}
+		pEnv->DestroyConstraintGroup( ragdoll.m_pGroup );
+		for ( int iBone=0; iBone < PHYS_BENCH_BONES; iBone++ )
+		{
+			pEnv->DestroyObject( ragdoll.m_pBones[iBone] );
+		}
+	}
+	pEnv->DestroyObject( pFloor );
+	pPhysics->DestroyEnvironment( pEnv );
+
+	physcollision->DestroyCollide( pBoneCollide );
+	physcollision->DestroyCollide( pFloorCollide );
+	delete [] pRagdolls;
+}
+
+
+//-----------------------------------------------------------------------------
+// Usage: vphysics_benchmark [ragdolls] [steps] [maxthreads]
+//-----------------------------------------------------------------------------
+static void VPhysics_Benchmark_f( void )
+{
+	int nRagdolls = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 64;
+	int nSteps = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 200;
+	int nMaxThreads = ( Cmd_Argc() > 3 ) ? atoi( Cmd_Argv( 3 ) ) : 8;
+	nRagdolls = clamp( nRagdolls, 1, 4096 );
+	nSteps = max( nSteps, 1 );
+	nMaxThreads = clamp( nMaxThreads, 1, THREADPOOL_MAX_THREADS );
+
+	// The surface properties come from the game DLL and the collision interface is
+	// linked when the first map loads
+	if ( !physcollision || !physprop || physprop->SurfacePropCount() == 0 )
+	{
+		Con_Printf( "vphysics_benchmark: start a map first\n" );
+		return;
+	}
+
+	IPhysics *pPhysics = (IPhysics *)physicsFactory( VPHYSICS_INTERFACE_VERSION, NULL );
+	if ( !pPhysics )
+	{
+		Con_Printf( "vphysics_benchmark: can't get %s\n", VPHYSICS_INTERFACE_VERSION );
+		return;
+	}
+
+	Con_Printf( "\nvphysics_benchmark: %d ragdolls of %d bones, %d steps\n", nRagdolls, PHYS_BENCH_BONES, nSteps );
+	Con_Printf( "----------------------------------------------------------\n" );
+	Con_Printf( "Path       Threads    Total ms   ms/step  Speedup  Awake\n" );
+	Con_Printf( "----------------------------------------------------------\n" );
+
+	// Original single threaded order, for reference.  The parallel path orders its
+	// serial work differently so this isn't expected to match the others bit for bit.
+	// With no worker threads the parallel path isn't taken at all, so start at one.
+	PhysBenchResult_t serial;
+	PhysBench_Run( pPhysics, nRagdolls, nSteps, false, serial );
+	Con_Printf( "Serial           - %11.3f %9.3f    1.00x  %5d\n", serial.m_flMS, serial.m_flMS / nSteps, serial.m_nAwake );
+
+	int nSavedThreads = ThreadPool_GetThreadCount();
+	int nMismatches = 0;
+	PhysBenchResult_t reference;
+	for ( int nThreads=1; nThreads <= nMaxThreads; nThreads *= 2 )
+	{
+		ThreadPool_SetThreadCount( nThreads );
+		CM_ReclaimTraceInfos();
+
+		PhysBenchResult_t result;
+		PhysBench_Run( pPhysics, nRagdolls, nSteps, true, result );
+		if ( nThreads == 1 )
+		{
+			reference = result;
+		}
+
+		bool bMatch = ( result.m_Checksum == reference.m_Checksum );
+		if ( !bMatch )
+		{
+			++nMismatches;
+		}
+		Con_Printf( "Parallel  %8d %11.3f %9.3f  %6.2fx  %5d%s\n", nThreads, result.m_flMS, result.m_flMS / nSteps,
+			( result.m_flMS > 0 ) ? serial.m_flMS / result.m_flMS : 0.0, result.m_nAwake, bMatch ? "" : "  MISMATCH" );
+	}
+
+	ThreadPool_SetThreadCount( nSavedThreads );
+	CM_ReclaimTraceInfos();
+
+	if ( nMismatches )
+	{
+		Con_Printf( "%d runs did NOT match the 1 thread run.\n", nMismatches );
+	}
+	else
+	{
+		Con_Printf( "Final positions matched for every thread count.\n" );
+	}
+	Con_Printf( "\n" );
+}
+
+static ConCommand vphysics_benchmark( "vphysics_benchmark", VPhysics_Benchmark_f, "Simulate a pile of ragdolls in a private physics environment with and without the worker threads and check the results match. Usage: vphysics_benchmark [ragdolls] [steps] [maxthreads]" );
@@ -51,6 +51,7 @@ void ED_ClearEdict (edict_t *e)
 
 	e->serial_number = sn;	// Preserve the serial number.
 	e->entity_created = 0;	// No player has seen this entity yet.
+	e->transmitflags = FL_EDICT_FULLCHECK;
 }
 
 /*
@@ -422,6 +422,8 @@ void SV_ClearPacketEntities( PackedEntities *frame );
 void SV_ExtractFromUserinfo (client_t *cl);
 char *SV_ExtractNameFromUserinfo( client_t *cl );
 void SV_ClearMemory( void );
+// The client's share of the worker pool (cl_decodethreads), see SV_UpdateWorkerPool
+void SV_SetClientWorkerThreads( int nThreads );
 
 void SV_ResetModInfo( void );
 
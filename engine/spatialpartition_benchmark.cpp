@@ -0,0 +1,1038 @@
+//========= Copyright © 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: spatialpartition_record/spatialpartition_benchmark: records
+//			everything done with the spatial partition (run with
+//			-partitionrecord for this), then replays it through new copies of
+//			both the voxel tree and the loose grid, checks they find the same
+//			handles and times them.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "ispatialpartitioninternal.h"
+#include "cmodel.h"
+#include "host.h"
+#include "gl_model_private.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include "utlvector.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+
+
+#define PARTITION_FILE_ID		"SPATPART"
+#define PARTITION_FILE_VERSION	1
+
+// Most records spatialpartition_benchmark will load
+#define PARTITION_MAX_RECORDS	( 4 * 1024 * 1024 )
+
+// Handles are unsigned shorts
+#define PARTITION_MAX_HANDLES	65536
+
+enum
+{
+	PARTITION_REC_INIT = 0,		// v0 = worldmin, v1 = worldmax
+	PARTITION_REC_CREATE,
+	PARTITION_REC_CREATEBOX,	// listmask, v0 = mins, v1 = maxs
+	PARTITION_REC_DESTROY,
+	PARTITION_REC_INSERT,		// listmask
+	PARTITION_REC_REMOVE,		// listmask
+	PARTITION_REC_REMOVEALL,
+	PARTITION_REC_FASTREMOVE,
+	PARTITION_REC_FASTINSERT,
+	PARTITION_REC_MOVED,		// v0 = mins, v1 = maxs
+	PARTITION_REC_SUPPRESS,		// listmask
+	PARTITION_REC_POINT,		// listmask, v0 = point
+	PARTITION_REC_BOX,			// listmask, v0 = mins, v1 = maxs
+	PARTITION_REC_SPHERE,		// listmask, v0 = center, radius
+	PARTITION_REC_RAY,			// listmask, v0 = start, v1 = delta, v2 = extents
+	PARTITION_REC_RAYS,			// listmask, count PARTITION_REC_RAYDATA records follow
+	PARTITION_REC_RAYDATA,		// v0 = start, v1 = delta, v2 = extents
+
+	PARTITION_REC_COUNT
+};
+
+#define PARTITION_RECF_COARSE	( 1 << 0 )
+#define PARTITION_RECF_ISRAY	( 1 << 1 )
+#define PARTITION_RECF_ISSWEPT	( 1 << 2 )
+#define PARTITION_RECF_SUPPRESS	( 1 << 3 )
+
+typedef struct
+{
+	char		id[8];
+	int			version;
+	char		mapname[MAX_QPATH];
+} partitionheader_t;
+
+typedef struct
+{
+	int			type;				// PARTITION_REC_
+	int			handle;				// The handle when it was recorded
+	int			listmask;
+	int			flags;				// PARTITION_RECF_
+	int			count;				// Rays in a PARTITION_REC_RAYS
+	Vector		v0, v1, v2;
+	float		radius;
+} partitionrecord_t;
+
+static FileHandle_t s_hPartitionFile = FILESYSTEM_INVALID_HANDLE;
+static int s_nPartitionRecords = 0;
+static CThreadMutex s_PartitionMutex;		// Enumerations can be on any thread
+static volatile bool s_bPartitionRecording = false;
+
+
+//-----------------------------------------------------------------------------
+// Writes records, all of them together even with other threads recording
+//-----------------------------------------------------------------------------
+static void Partition_WriteRecords( const partitionrecord_t *pRecords, int nRecords )
+{
+	CThreadAutoLock lock( s_PartitionMutex );
+	if ( s_hPartitionFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	g_pFileSystem->Write( pRecords, nRecords * sizeof( partitionrecord_t ), s_hPartitionFile );
+	s_nPartitionRecords += nRecords;
+}
+
+static void Partition_InitRecord( partitionrecord_t &record, int type, int handle, int listmask )
+{
+	memset( &record, 0, sizeof( record ) );
+	record.type = type;
+	record.handle = handle;
+	record.listmask = listmask;
+}
+
+static void Partition_InitRayRecord( partitionrecord_t &record, int type, SpatialPartitionListMask_t listMask, const Ray_t &ray )
+{
+	Partition_InitRecord( record, type, 0, listMask );
+	record.v0 = ray.m_Start;
+	record.v1 = ray.m_Delta;
+	record.v2 = ray.m_Extents;
+	record.flags = ( ray.m_IsRay ? PARTITION_RECF_ISRAY : 0 ) | ( ray.m_IsSwept ? PARTITION_RECF_ISSWEPT : 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// What the recorder knows about each handle, so it can write out the state of
+// the partition when recording starts
+//-----------------------------------------------------------------------------
+struct PartitionShadow_t
+{
+	bool			m_bInUse;
+	bool			m_bHasBox;
+	bool			m_bFastRemoved;
+	unsigned int	m_ListFlags;
+	unsigned int	m_FastRemovedFlags;
+	Vector			m_Min;
+	Vector			m_Max;
+};
+
+
+//-----------------------------------------------------------------------------
+// Passes everything through to the real spatial partition, keeps track of
+// the handles and records what's done while recording
+//-----------------------------------------------------------------------------
+class CSpatialPartitionRecorder : public ISpatialPartitionInternal
+{
+public:
+	CSpatialPartitionRecorder( ISpatialPartitionInternal *pPartition );
+	virtual ~CSpatialPartitionRecorder();
+
+	// Methods of ISpatialPartition
+	SpatialPartitionHandle_t CreateHandle( IHandleEntity *pHandleEntity );
+	SpatialPartitionHandle_t CreateHandle( IHandleEntity *pHandleEntity,
+		SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs );
+	void DestroyHandle( SpatialPartitionHandle_t handle );
+
+	void Insert( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle );
+	void Remove( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle );
+	void Remove( SpatialPartitionHandle_t handle );
+
+	SpatialTempHandle_t FastRemove( SpatialPartitionHandle_t handle );
+	void FastInsert( SpatialPartitionHandle_t handle, SpatialTempHandle_t tempHandle );
+
+	void ElementMoved( SpatialPartitionHandle_t handle, 
+		const Vector& mins, const Vector& maxs );
+
+	void EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
+		const Vector& pt, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
+		const Vector& mins, const Vector& maxs, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsInSphere( SpatialPartitionListMask_t listMask,
+		const Vector& origin, float radius, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
+		const Ray_t& ray, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+
+	virtual void SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress );
+	virtual SpatialPartitionListMask_t GetSuppressedLists();
+
+	// Methods of ISpatialPartitionInternal
+	void	Init( const Vector& worldmin, const Vector& worldmax );
+	void	EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask,
+		const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator );
+
+	// Writes what's in the partition now, recording starts from there
+	bool	WriteState();
+
+private:
+	PartitionShadow_t &Shadow( SpatialPartitionHandle_t handle );
+	void	Record( int type, SpatialPartitionHandle_t handle, int listmask );
+	void	RecordBox( int type, SpatialPartitionHandle_t handle, int listmask, const Vector& mins, const Vector& maxs );
+
+	ISpatialPartitionInternal *m_pPartition;
+
+	CUtlVector< PartitionShadow_t >	m_Shadow;
+	bool	m_bInitialized;
+	Vector	m_WorldMins;
+	Vector	m_WorldMaxs;
+};
+
+static CSpatialPartitionRecorder *s_pPartitionRecorder = NULL;
+
+ISpatialPartitionInternal *CreateSpatialPartitionRecorder( ISpatialPartitionInternal *pPartition )
+{
+	Assert( !s_pPartitionRecorder );
+	s_pPartitionRecorder = new CSpatialPartitionRecorder( pPartition );
+	return s_pPartitionRecorder;
+}
+
+
+CSpatialPartitionRecorder::CSpatialPartitionRecorder( ISpatialPartitionInternal *pPartition )
+{
+	m_pPartition = pPartition;
+	m_bInitialized = false;
+	m_WorldMins.Init();
+	m_WorldMaxs.Init();
+}
+
+CSpatialPartitionRecorder::~CSpatialPartitionRecorder()
+{
+}
+
+PartitionShadow_t &CSpatialPartitionRecorder::Shadow( SpatialPartitionHandle_t handle )
+{
+	if ( handle >= m_Shadow.Count() )
+	{
+		int nFirst = m_Shadow.AddMultipleToTail( handle + 1 - m_Shadow.Count() );
+		memset( &m_Shadow[nFirst], 0, ( m_Shadow.Count() - nFirst ) * sizeof( PartitionShadow_t ) );
+	}
+	return m_Shadow[handle];
+}
+
+void CSpatialPartitionRecorder::Record( int type, SpatialPartitionHandle_t handle, int listmask )
+{
+	if ( !s_bPartitionRecording )
+		return;
+
+	partitionrecord_t record;
+	Partition_InitRecord( record, type, handle, listmask );
+	Partition_WriteRecords( &record, 1 );
+}
+
+void CSpatialPartitionRecorder::RecordBox( int type, SpatialPartitionHandle_t handle, int listmask, 
+										  const Vector& mins, const Vector& maxs )
+{
+	if ( !s_bPartitionRecording )
+		return;
+
+	partitionrecord_t record;
+	Partition_InitRecord( record, type, handle, listmask );
+	record.v0 = mins;
+	record.v1 = maxs;
+	Partition_WriteRecords( &record, 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Handle changes only happen on the main thread, so the shadow doesn't need a lock
+//-----------------------------------------------------------------------------
+SpatialPartitionHandle_t CSpatialPartitionRecorder::CreateHandle( IHandleEntity *pHandleEntity )
+{
+	SpatialPartitionHandle_t handle = m_pPartition->CreateHandle( pHandleEntity );
+
+	PartitionShadow_t &shadow = Shadow( handle );
+	memset( &shadow, 0, sizeof( shadow ) );
+	shadow.m_bInUse = true;
+
+	Record( PARTITION_REC_CREATE, handle, 0 );
+	return handle;
+}
+
+SpatialPartitionHandle_t CSpatialPartitionRecorder::CreateHandle( IHandleEntity *pHandleEntity,
+	SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs )
+{
+	SpatialPartitionHandle_t handle = m_pPartition->CreateHandle( pHandleEntity, listMask, mins, maxs );
+
+	PartitionShadow_t &shadow = Shadow( handle );
+	memset( &shadow, 0, sizeof( shadow ) );
+	shadow.m_bInUse = true;
+	shadow.m_bHasBox = true;
+	shadow.m_ListFlags = listMask;
+	shadow.m_Min = mins;
+	shadow.m_Max = maxs;
+
+	RecordBox( PARTITION_REC_CREATEBOX, handle, listMask, mins, maxs );
+	return handle;
+}
+
+void CSpatialPartitionRecorder::DestroyHandle( SpatialPartitionHandle_t handle )
+{
+	m_pPartition->DestroyHandle( handle );
+	if ( handle == PARTITION_INVALID_HANDLE )
+		return;
+
+	Shadow( handle ).m_bInUse = false;
+	Record( PARTITION_REC_DESTROY, handle, 0 );
+}
+
+void CSpatialPartitionRecorder::Insert( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle )
+{
+	m_pPartition->Insert( listMask, handle );
+	Shadow( handle ).m_ListFlags |= listMask;
+	Record( PARTITION_REC_INSERT, handle, listMask );
+}
+
+void CSpatialPartitionRecorder::Remove( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle )
+{
+	m_pPartition->Remove( listMask, handle );
+	Shadow( handle ).m_ListFlags &= ~listMask;
+	Record( PARTITION_REC_REMOVE, handle, listMask );
+}
+
+void CSpatialPartitionRecorder::Remove( SpatialPartitionHandle_t handle )
+{
+	m_pPartition->Remove( handle );
+	Shadow( handle ).m_ListFlags = 0;
+	Record( PARTITION_REC_REMOVEALL, handle, 0 );
+}
+
+SpatialTempHandle_t CSpatialPartitionRecorder::FastRemove( SpatialPartitionHandle_t handle )
+{
+	SpatialTempHandle_t tempHandle = m_pPartition->FastRemove( handle );
+
+	PartitionShadow_t &shadow = Shadow( handle );
+	shadow.m_bFastRemoved = true;
+	shadow.m_FastRemovedFlags = shadow.m_ListFlags;
+	shadow.m_ListFlags = 0;
+
+	Record( PARTITION_REC_FASTREMOVE, handle, 0 );
+	return tempHandle;
+}
+
+void CSpatialPartitionRecorder::FastInsert( SpatialPartitionHandle_t handle, SpatialTempHandle_t tempHandle )
+{
+	m_pPartition->FastInsert( handle, tempHandle );
+
+	PartitionShadow_t &shadow = Shadow( handle );
+	shadow.m_bFastRemoved = false;
+	shadow.m_ListFlags = shadow.m_FastRemovedFlags;
+
+	Record( PARTITION_REC_FASTINSERT, handle, 0 );
+}
+
+void CSpatialPartitionRecorder::ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs )
+{
+	m_pPartition->ElementMoved( handle, mins, maxs );
+
+	PartitionShadow_t &shadow = Shadow( handle );
+	shadow.m_bHasBox = true;
+	shadow.m_Min = mins;
+	shadow.m_Max = maxs;
+
+	RecordBox( PARTITION_REC_MOVED, handle, 0, mins, maxs );
+}
+
+void CSpatialPartitionRecorder::SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress )
+{
+	m_pPartition->SuppressLists( nListMask, bSuppress );
+
+	if ( s_bPartitionRecording )
+	{
+		partitionrecord_t record;
+		Partition_InitRecord( record, PARTITION_REC_SUPPRESS, 0, nListMask );
+		record.flags = bSuppress ? PARTITION_RECF_SUPPRESS : 0;
+		Partition_WriteRecords( &record, 1 );
+	}
+}
+
+SpatialPartitionListMask_t CSpatialPartitionRecorder::GetSuppressedLists()
+{
+	return m_pPartition->GetSuppressedLists();
+}
+
+void CSpatialPartitionRecorder::Init( const Vector& worldmin, const Vector& worldmax )
+{
+	m_pPartition->Init( worldmin, worldmax );
+
+	// That got rid of all the handles
+	m_Shadow.RemoveAll();
+	m_bInitialized = true;
+	m_WorldMins = worldmin;
+	m_WorldMaxs = worldmax;
+
+	RecordBox( PARTITION_REC_INIT, 0, 0, worldmin, worldmax );
+}
+
+
+//-----------------------------------------------------------------------------
+// Enumerations can come from any thread
+//-----------------------------------------------------------------------------
+void CSpatialPartitionRecorder::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
+	const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	if ( s_bPartitionRecording )
+	{
+		partitionrecord_t record;
+		Partition_InitRecord( record, PARTITION_REC_POINT, 0, listMask );
+		record.flags = coarseTest ? PARTITION_RECF_COARSE : 0;
+		record.v0 = pt;
+		Partition_WriteRecords( &record, 1 );
+	}
+
+	m_pPartition->EnumerateElementsAtPoint( listMask, pt, coarseTest, pIterator );
+}
+
+void CSpatialPartitionRecorder::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
+	const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	if ( s_bPartitionRecording )
+	{
+		partitionrecord_t record;
+		Partition_InitRecord( record, PARTITION_REC_BOX, 0, listMask );
+		record.flags = coarseTest ? PARTITION_RECF_COARSE : 0;
+		record.v0 = mins;
+		record.v1 = maxs;
+		Partition_WriteRecords( &record, 1 );
+	}
+
+	m_pPartition->EnumerateElementsInBox( listMask, mins, maxs, coarseTest, pIterator );
+}
+
+void CSpatialPartitionRecorder::EnumerateElementsInSphere( SpatialPartitionListMask_t listMask,
+	const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	if ( s_bPartitionRecording )
+	{
+		partitionrecord_t record;
+		Partition_InitRecord( record, PARTITION_REC_SPHERE, 0, listMask );
+		record.flags = coarseTest ? PARTITION_RECF_COARSE : 0;
+		record.v0 = origin;
+		record.radius = radius;
+		Partition_WriteRecords( &record, 1 );
+	}
+
+	m_pPartition->EnumerateElementsInSphere( listMask, origin, radius, coarseTest, pIterator );
+}
+
+void CSpatialPartitionRecorder::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
+	const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	if ( s_bPartitionRecording )
+	{
+		partitionrecord_t record;
+		Partition_InitRayRecord( record, PARTITION_REC_RAY, listMask, ray );
+		record.flags |= coarseTest ? PARTITION_RECF_COARSE : 0;
+		Partition_WriteRecords( &record, 1 );
+	}
+
+	m_pPartition->EnumerateElementsAlongRay( listMask, ray, coarseTest, pIterator );
+}
+
+void CSpatialPartitionRecorder::EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask,
+	const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator )
+{
+	if ( s_bPartitionRecording && nRays > 0 && nRays <= MAX_PARTITION_RAYS )
+	{
+		partitionrecord_t records[ MAX_PARTITION_RAYS + 1 ];
+		Partition_InitRecord( records[0], PARTITION_REC_RAYS, 0, listMask );
+		records[0].count = nRays;
+		for ( int i = 0; i < nRays; ++i )
+		{
+			Partition_InitRayRecord( records[i + 1], PARTITION_REC_RAYDATA, listMask, pRays[i] );
+		}
+		Partition_WriteRecords( records, nRays + 1 );
+	}
+
+	m_pPartition->EnumerateElementsAlongRays( listMask, pRays, nRays, pIterator );
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes what's in the partition now, as if it had all just been made
+//-----------------------------------------------------------------------------
+bool CSpatialPartitionRecorder::WriteState()
+{
+	if ( !m_bInitialized )
+		return false;
+
+	CUtlVector< partitionrecord_t > records;
+	int i = records.AddToTail();
+	Partition_InitRecord( records[i], PARTITION_REC_INIT, 0, 0 );
+	records[i].v0 = m_WorldMins;
+	records[i].v1 = m_WorldMaxs;
+
+	SpatialPartitionListMask_t suppressed = m_pPartition->GetSuppressedLists();
+	if ( suppressed )
+	{
+		i = records.AddToTail();
+		Partition_InitRecord( records[i], PARTITION_REC_SUPPRESS, 0, suppressed );
+		records[i].flags = PARTITION_RECF_SUPPRESS;
+	}
+
+	for ( int handle = 0; handle < m_Shadow.Count(); ++handle )
+	{
+		const PartitionShadow_t &shadow = m_Shadow[handle];
+		if ( !shadow.m_bInUse )
+			continue;
+
+		i = records.AddToTail();
+		Partition_InitRecord( records[i], PARTITION_REC_CREATE, handle, 0 );
+
+		unsigned int listFlags = shadow.m_bFastRemoved ? shadow.m_FastRemovedFlags : shadow.m_ListFlags;
+		if ( listFlags )
+		{
+			i = records.AddToTail();
+			Partition_InitRecord( records[i], PARTITION_REC_INSERT, handle, listFlags );
+		}
+
+		if ( shadow.m_bHasBox )
+		{
+			i = records.AddToTail();
+			Partition_InitRecord( records[i], PARTITION_REC_MOVED, handle, 0 );
+			records[i].v0 = shadow.m_Min;
+			records[i].v1 = shadow.m_Max;
+		}
+
+		if ( shadow.m_bFastRemoved )
+		{
+			i = records.AddToTail();
+			Partition_InitRecord( records[i], PARTITION_REC_FASTREMOVE, handle, 0 );
+		}
+	}
+
+	Partition_WriteRecords( records.Base(), records.Count() );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Stops recording
+//-----------------------------------------------------------------------------
+static void Partition_StopRecording( void )
+{
+	if ( s_hPartitionFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	s_bPartitionRecording = false;
+
+	CThreadAutoLock lock( s_PartitionMutex );
+	g_pFileSystem->Close( s_hPartitionFile );
+	s_hPartitionFile = FILESYSTEM_INVALID_HANDLE;
+
+	Con_Printf( "spatialpartition_record: stopped, recorded %d operations.\n", s_nPartitionRecords );
+}
+
+
+static void Partition_Record_f( void )
+{
+	if ( !s_pPartitionRecorder )
+	{
+		Con_Printf( "spatialpartition_record: start the game with -partitionrecord first.\n" );
+		return;
+	}
+
+	if ( Cmd_Argc() < 2 )
+	{
+		if ( s_hPartitionFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			Con_Printf( "Usage: spatialpartition_record <filename>, spatialpartition_record with no filename stops recording.\n" );
+		}
+		Partition_StopRecording();
+		return;
+	}
+
+	if ( !host_state.worldmodel )
+	{
+		Con_Printf( "spatialpartition_record: no map loaded.\n" );
+		return;
+	}
+
+	Partition_StopRecording();
+
+	FileHandle_t hFile = g_pFileSystem->Open( Cmd_Argv( 1 ), "wb" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Con_Printf( "spatialpartition_record: couldn't open %s.\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	partitionheader_t header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.id, PARTITION_FILE_ID, sizeof( header.id ) );
+	header.version = PARTITION_FILE_VERSION;
+	Q_strncpy( header.mapname, host_state.worldmodel->name, sizeof( header.mapname ) );
+	g_pFileSystem->Write( &header, sizeof( header ), hFile );
+
+	{
+		CThreadAutoLock lock( s_PartitionMutex );
+		s_hPartitionFile = hFile;
+		s_nPartitionRecords = 0;
+	}
+
+	// Everything from here on is on top of what's there now.  Handles only
+	// change on this thread, so nothing can get in between.
+	s_pPartitionRecorder->WriteState();
+	s_bPartitionRecording = true;
+
+	Con_Printf( "spatialpartition_record: recording spatial partition operations on %s to %s.\n", header.mapname, Cmd_Argv( 1 ) );
+}
+
+static ConCommand spatialpartition_record( "spatialpartition_record", Partition_Record_f, "Record everything done with the spatial partition into a file for spatialpartition_benchmark, needs -partitionrecord. Usage: spatialpartition_record <filename>, or spatialpartition_record to stop" );
+
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+enum
+{
+	PARTITION_BENCH_UPDATE = 0,		// Handles being made, moved, put in lists...
+	PARTITION_BENCH_QUERY,			// Points, boxes and spheres
+	PARTITION_BENCH_RAY,			// Rays and packets of rays
+
+	PARTITION_BENCH_COUNT
+};
+
+static int Partition_BenchCategory( int type )
+{
+	if ( type == PARTITION_REC_RAY || type == PARTITION_REC_RAYS )
+		return PARTITION_BENCH_RAY;
+	if ( type >= PARTITION_REC_POINT )
+		return PARTITION_BENCH_QUERY;
+	return PARTITION_BENCH_UPDATE;
+}
+
+
+//-----------------------------------------------------------------------------
+// Counts what a query finds.  The replay gives each handle a made up entity
+// pointer from the recorded handle, so both partitions give the same sums.
+//-----------------------------------------------------------------------------
+class CPartitionReplayEnum : public IPartitionEnumerator, public IPartitionRaysEnumerator
+{
+public:
+	void Reset()
+	{
+		m_nCount = 0;
+		m_nChecksum = 0;
+	}
+
+	IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		++m_nCount;
+		m_nChecksum += (unsigned int)(size_t)pHandleEntity * 2654435769U;
+		return ITERATION_CONTINUE;
+	}
+
+	IterationRetval_t EnumElement( IHandleEntity *pHandleEntity, unsigned int nRayMask )
+	{
+		++m_nCount;
+		m_nChecksum += ( (unsigned int)(size_t)pHandleEntity * 2654435769U ) ^ nRayMask;
+		return ITERATION_CONTINUE;
+	}
+
+	int				m_nCount;
+	unsigned int	m_nChecksum;
+};
+
+static IHandleEntity *Partition_ReplayEntity( int handle )
+{
+	return (IHandleEntity *)(size_t)( handle + 1 );
+}
+
+static void Partition_RecordToRay( const partitionrecord_t &record, Ray_t &ray )
+{
+	ray.m_Start = record.v0;
+	ray.m_Delta = record.v1;
+	ray.m_Extents = record.v2;
+	ray.m_StartOffset.Init();
+	ray.m_IsRay = ( record.flags & PARTITION_RECF_ISRAY ) != 0;
+	ray.m_IsSwept = ( record.flags & PARTITION_RECF_ISSWEPT ) != 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs one record, returns how many records it used
+//-----------------------------------------------------------------------------
+static int Partition_Replay( ISpatialPartitionInternal *pPartition, const partitionrecord_t *pRecords, 
+							SpatialPartitionHandle_t *pHandles, SpatialTempHandle_t *pTempHandles,
+							CPartitionReplayEnum &enumerator )
+{
+	const partitionrecord_t &record = pRecords[0];
+	bool bCoarse = ( record.flags & PARTITION_RECF_COARSE ) != 0;
+	SpatialPartitionHandle_t handle = pHandles[record.handle];
+
+	switch ( record.type )
+	{
+	case PARTITION_REC_INIT:
+		pPartition->Init( record.v0, record.v1 );
+		break;
+	case PARTITION_REC_CREATE:
+		pHandles[record.handle] = pPartition->CreateHandle( Partition_ReplayEntity( record.handle ) );
+		break;
+	case PARTITION_REC_CREATEBOX:
+		pHandles[record.handle] = pPartition->CreateHandle( Partition_ReplayEntity( record.handle ), 
+			record.listmask, record.v0, record.v1 );
+		break;
+	case PARTITION_REC_DESTROY:
+		pPartition->DestroyHandle( handle );
+		break;
+	case PARTITION_REC_INSERT:
+		pPartition->Insert( record.listmask, handle );
+		break;
+	case PARTITION_REC_REMOVE:
+		pPartition->Remove( record.listmask, handle );
+		break;
+	case PARTITION_REC_REMOVEALL:
+		pPartition->Remove( handle );
+		break;
+	case PARTITION_REC_FASTREMOVE:
+		pTempHandles[record.handle] = pPartition->FastRemove( handle );
+		break;
+	case PARTITION_REC_FASTINSERT:
+		pPartition->FastInsert( handle, pTempHandles[record.handle] );
+		break;
+	case PARTITION_REC_MOVED:
+		pPartition->ElementMoved( handle, record.v0, record.v1 );
+		break;
+	case PARTITION_REC_SUPPRESS:
+		pPartition->SuppressLists( record.listmask, ( record.flags & PARTITION_RECF_SUPPRESS ) != 0 );
+		break;
+	case PARTITION_REC_POINT:
+		pPartition->EnumerateElementsAtPoint( record.listmask, record.v0, bCoarse, &enumerator );
+		break;
+	case PARTITION_REC_BOX:
+		pPartition->EnumerateElementsInBox( record.listmask, record.v0, record.v1, bCoarse, &enumerator );
+		break;
+	case PARTITION_REC_SPHERE:
+		pPartition->EnumerateElementsInSphere( record.listmask, record.v0, record.radius, bCoarse, &enumerator );
+		break;
+	case PARTITION_REC_RAY:
+		{
+			Ray_t ray;
+			Partition_RecordToRay( record, ray );
+			pPartition->EnumerateElementsAlongRay( record.listmask, ray, bCoarse, &enumerator );
+		}
+		break;
+	case PARTITION_REC_RAYS:
+		{
+			Ray_t rays[MAX_PARTITION_RAYS];
+			for ( int i = 0; i < record.count; ++i )
+			{
+				Partition_RecordToRay( pRecords[i + 1], rays[i] );
+			}
+			pPartition->EnumerateElementsAlongRays( record.listmask, rays, record.count, &enumerator );
+		}
+		return record.count + 1;
+	}
+	return 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Makes sure a recording only uses handles it made, so the replay can't crash
+//-----------------------------------------------------------------------------
+static bool Partition_CheckRecords( const partitionrecord_t *pRecords, int nRecords, int *pQueries )
+{
+	CUtlVector< bool > created;
+	created.SetSize( PARTITION_MAX_HANDLES );
+	memset( created.Base(), 0, created.Count() * sizeof( bool ) );
+
+	*pQueries = 0;
+	if ( nRecords <= 0 || pRecords[0].type != PARTITION_REC_INIT )
+		return false;
+
+	for ( int i = 0; i < nRecords; ++i )
+	{
+		const partitionrecord_t &record = pRecords[i];
+		if ( record.type < 0 || record.type >= PARTITION_REC_COUNT || record.type == PARTITION_REC_RAYDATA )
+			return false;
+		if ( record.handle < 0 || record.handle >= PARTITION_MAX_HANDLES )
+			return false;
+
+		switch ( record.type )
+		{
+		case PARTITION_REC_INIT:
+			memset( created.Base(), 0, created.Count() * sizeof( bool ) );
+			break;
+
+		case PARTITION_REC_CREATE:
+		case PARTITION_REC_CREATEBOX:
+			if ( created[record.handle] )
+				return false;
+			created[record.handle] = true;
+			break;
+
+		case PARTITION_REC_DESTROY:
+			if ( !created[record.handle] )
+				return false;
+			created[record.handle] = false;
+			break;
+
+		case PARTITION_REC_INSERT:
+		case PARTITION_REC_REMOVE:
+		case PARTITION_REC_REMOVEALL:
+		case PARTITION_REC_FASTREMOVE:
+		case PARTITION_REC_FASTINSERT:
+		case PARTITION_REC_MOVED:
+			if ( !created[record.handle] )
+				return false;
+			break;
+
+		case PARTITION_REC_RAYS:
+			if ( record.count <= 0 || record.count > MAX_PARTITION_RAYS || i + record.count >= nRecords )
+				return false;
+			for ( int j = 1; j <= record.count; ++j )
+			{
+				if ( pRecords[i + j].type != PARTITION_REC_RAYDATA )
+					return false;
+			}
+			i += record.count;
+			++*pQueries;
+			break;
+
+		case PARTITION_REC_POINT:
+		case PARTITION_REC_BOX:
+		case PARTITION_REC_SPHERE:
+		case PARTITION_REC_RAY:
+			++*pQueries;
+			break;
+		}
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// What each query found in one partition, and how long each kind of thing took
+//-----------------------------------------------------------------------------
+struct PartitionBenchResult_t
+{
+	CUtlVector< int >			m_Counts;
+	CUtlVector< unsigned int >	m_Checksums;
+	CCycleCount					m_Time[PARTITION_BENCH_COUNT];
+};
+
+static void Partition_Benchmark( ISpatialPartitionInternal *pPartition, const partitionrecord_t *pRecords, 
+								int nRecords, int nIterations, PartitionBenchResult_t &result )
+{
+	SpatialPartitionHandle_t *pHandles = new SpatialPartitionHandle_t[PARTITION_MAX_HANDLES];
+	SpatialTempHandle_t *pTempHandles = new SpatialTempHandle_t[PARTITION_MAX_HANDLES];
+	memset( pHandles, 0, PARTITION_MAX_HANDLES * sizeof( SpatialPartitionHandle_t ) );
+	memset( pTempHandles, 0, PARTITION_MAX_HANDLES * sizeof( SpatialTempHandle_t ) );
+
+	CPartitionReplayEnum enumerator;
+
+	// First see what every query finds.
+	int iRecord;
+	for ( iRecord = 0; iRecord < nRecords; )
+	{
+		enumerator.Reset();
+		int nUsed = Partition_Replay( pPartition, &pRecords[iRecord], pHandles, pTempHandles, enumerator );
+		if ( pRecords[iRecord].type >= PARTITION_REC_POINT )
+		{
+			result.m_Counts.AddToTail( enumerator.m_nCount );
+			result.m_Checksums.AddToTail( enumerator.m_nChecksum );
+		}
+		iRecord += nUsed;
+	}
+
+	// Now time it.  Every replay starts with an Init, which isn't counted.
+	for ( int i = 0; i < PARTITION_BENCH_COUNT; ++i )
+	{
+		result.m_Time[i].Init();
+	}
+
+	for ( int iIteration = 0; iIteration < nIterations; iIteration++ )
+	{
+		for ( iRecord = 0; iRecord < nRecords; )
+		{
+			const partitionrecord_t &record = pRecords[iRecord];
+			if ( record.type == PARTITION_REC_INIT )
+			{
+				iRecord += Partition_Replay( pPartition, &record, pHandles, pTempHandles, enumerator );
+				continue;
+			}
+
+			CTimeAdder timer( &result.m_Time[ Partition_BenchCategory( record.type ) ] );
+			iRecord += Partition_Replay( pPartition, &record, pHandles, pTempHandles, enumerator );
+		}
+	}
+
+	delete [] pHandles;
+	delete [] pTempHandles;
+}
+
+
+static void Partition_Benchmark_f( void )
+{
+	if ( Cmd_Argc() < 2 )
+	{
+		Con_Printf( "Usage: spatialpartition_benchmark <filename> [iterations]\n" );
+		return;
+	}
+
+	if ( s_bPartitionRecording )
+	{
+		Con_Printf( "spatialpartition_benchmark: stop spatialpartition_record first.\n" );
+		return;
+	}
+
+	int nIterations = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 10;
+	nIterations = max( nIterations, 1 );
+
+	FileHandle_t hFile = g_pFileSystem->Open( Cmd_Argv( 1 ), "rb" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Con_Printf( "spatialpartition_benchmark: couldn't open %s.\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	partitionheader_t header;
+	if ( g_pFileSystem->Read( &header, sizeof( header ), hFile ) != sizeof( header ) ||
+		memcmp( header.id, PARTITION_FILE_ID, sizeof( header.id ) ) || header.version != PARTITION_FILE_VERSION )
+	{
+		Con_Printf( "spatialpartition_benchmark: %s isn't a spatialpartition_record file.\n", Cmd_Argv( 1 ) );
+		g_pFileSystem->Close( hFile );
+		return;
+	}
+	header.mapname[ sizeof( header.mapname ) - 1 ] = 0;
+
+	int nRecords = ( g_pFileSystem->Size( hFile ) - sizeof( header ) ) / sizeof( partitionrecord_t );
+	nRecords = min( nRecords, PARTITION_MAX_RECORDS );
+	if ( nRecords <= 0 )
+	{
+		Con_Printf( "spatialpartition_benchmark: %s is empty.\n", Cmd_Argv( 1 ) );
+		g_pFileSystem->Close( hFile );
+		return;
+	}
+
+	partitionrecord_t *pRecords = new partitionrecord_t[nRecords];
+	g_pFileSystem->Read( pRecords, nRecords * sizeof( partitionrecord_t ), hFile );
+	g_pFileSystem->Close( hFile );
+
+	// A packet of rays cut off at the end of the file is just dropped
+	int iRecord;
+	for ( iRecord = 0; iRecord < nRecords; ++iRecord )
+	{
+		if ( pRecords[iRecord].type == PARTITION_REC_RAYS && iRecord + pRecords[iRecord].count >= nRecords )
+		{
+			nRecords = iRecord;
+			break;
+		}
+	}
+
+	int nQueries;
+	if ( !Partition_CheckRecords( pRecords, nRecords, &nQueries ) )
+	{
+		Con_Printf( "spatialpartition_benchmark: %s has bad records in it.\n", Cmd_Argv( 1 ) );
+		delete [] pRecords;
+		return;
+	}
+
+	int nCount[PARTITION_BENCH_COUNT] = { 0 };
+	int nCoarse = 0;
+	for ( iRecord = 0; iRecord < nRecords; ++iRecord )
+	{
+		const partitionrecord_t &record = pRecords[iRecord];
+		if ( record.type == PARTITION_REC_INIT || record.type == PARTITION_REC_RAYDATA )
+			continue;
+
+		++nCount[ Partition_BenchCategory( record.type ) ];
+		if ( record.type >= PARTITION_REC_POINT && ( record.flags & PARTITION_RECF_COARSE ) )
+		{
+			++nCoarse;
+		}
+	}
+
+	// Each one gets a new partition so neither one is warmed up by the game
+	PartitionBenchResult_t treeResult, gridResult;
+
+	ISpatialPartitionInternal *pTree = CreateSpatialPartitionTree();
+	Partition_Benchmark( pTree, pRecords, nRecords, nIterations, treeResult );
+	delete pTree;
+
+	ISpatialPartitionInternal *pGrid = CreateSpatialPartitionGrid();
+	Partition_Benchmark( pGrid, pRecords, nRecords, nIterations, gridResult );
+	delete pGrid;
+
+	// Coarse queries are allowed to find extra things, and the two do
+	// different amounts of extra, so only exact queries have to match
+	int nMismatches = 0;
+	int iQuery = 0;
+	for ( iRecord = 0; iRecord < nRecords; ++iRecord )
+	{
+		const partitionrecord_t &record = pRecords[iRecord];
+		if ( record.type < PARTITION_REC_POINT || record.type == PARTITION_REC_RAYDATA )
+			continue;
+
+		if ( !( record.flags & PARTITION_RECF_COARSE ) && 
+			( treeResult.m_Counts[iQuery] != gridResult.m_Counts[iQuery] || 
+			  treeResult.m_Checksums[iQuery] != gridResult.m_Checksums[iQuery] ) )
+		{
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "spatialpartition_benchmark: query %d (record %d): the voxel tree found %d handles, the grid found %d\n",
+					iQuery, iRecord, treeResult.m_Counts[iQuery], gridResult.m_Counts[iQuery] );
+			}
+			++nMismatches;
+		}
+		++iQuery;
+	}
+	Assert( iQuery == nQueries );
+
+	Con_Printf( "\nspatialpartition_benchmark: %s, %d updates, %d point/box/sphere queries, %d ray queries, %d iterations\n",
+		header.mapname, nCount[PARTITION_BENCH_UPDATE], nCount[PARTITION_BENCH_QUERY], nCount[PARTITION_BENCH_RAY], nIterations );
+	Con_Printf( "-------------------------------------------------------------\n" );
+	Con_Printf( "Partition     Updates ms    Queries ms       Rays ms      Total ms\n" );
+	Con_Printf( "-------------------------------------------------------------\n" );
+
+	double flTotalMS[2];
+	for ( int i = 0; i < 2; ++i )
+	{
+		const PartitionBenchResult_t &result = ( i == 0 ) ? treeResult : gridResult;
+		double flUpdateMS = result.m_Time[PARTITION_BENCH_UPDATE].GetMillisecondsF();
+		double flQueryMS = result.m_Time[PARTITION_BENCH_QUERY].GetMillisecondsF();
+		double flRayMS = result.m_Time[PARTITION_BENCH_RAY].GetMillisecondsF();
+		flTotalMS[i] = flUpdateMS + flQueryMS + flRayMS;
+
+		Con_Printf( "%-12s %11.3f  %12.3f  %12.3f  %12.3f\n", ( i == 0 ) ? "Voxel tree" : "Loose grid",
+			flUpdateMS, flQueryMS, flRayMS, flTotalMS[i] );
+	}
+	Con_Printf( "Speedup: %.2fx\n", ( flTotalMS[1] > 0 ) ? flTotalMS[0] / flTotalMS[1] : 0.0 );
+
+	if ( nMismatches )
+	{
+		Con_Printf( "%d of %d queries did NOT find the same handles.\n", nMismatches, nQueries - nCoarse );
+	}
+	else
+	{
+		Con_Printf( "All %d exact queries found the same handles.\n", nQueries - nCoarse );
+	}
+
+	if ( nCoarse )
+	{
+		Con_Printf( "%d coarse queries weren't checked, they can find extra handles.\n", nCoarse );
+	}
+	Con_Printf( "\n" );
+
+	delete [] pRecords;
+}
+
+static ConCommand spatialpartition_benchmark( "spatialpartition_benchmark", Partition_Benchmark_f, "Replay spatial partition operations recorded with spatialpartition_record through the voxel tree and the loose grid, check they find the same handles and time them. Usage: spatialpartition_benchmark <filename> [iterations]" );
@@ -0,0 +1,1413 @@
+//========= Copyright © 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Loose hashed grid version of the spatial partition.  Pick it over
+//			the voxel tree in cspatialpartition.cpp with -spatialgrid.
+//
+// $NoKeywords: $
+//
+// Algorithm:
+//
+// The grid has a level for each power of two cell size from GRID_CELL_SIZE
+// up to the size of the world, and a last level with one cell that takes
+// anything too big for the others.  Each handle lives in exactly one cell:
+// the one that holds the center of its box, on the first level whose cells
+// are at least as big as the box.  Cells are loose, the handles in them can
+// stick out by up to half a cell on each side, so a query looks at the cells
+// that could hold a center within half a cell of what it's asking about.
+// Cells past the edge of the world are clamped into the edge cells.
+//
+// Moving a handle only touches the grid when its center crosses into another
+// cell or it changes size enough to go to another level.  Otherwise only
+// its box gets updated, in place.
+//
+// Only cells with handles in them exist.  They're found through an open
+// addressed hash keyed on level and cell coordinates, and each level keeps
+// a list of its cells for queries that cover more cells than there are.
+// A cell keeps the boxes and list flags of its handles in one array, so a
+// query can reject most of them with one SSE compare each without going
+// back to the handles.
+//
+// Since a handle is only in one cell a query never finds it twice, so there
+// is no enumeration id; enumerations can nest and run on any thread, as long
+// as nothing changes the grid while they do.
+//
+//=============================================================================
+
+#include "ispatialpartitioninternal.h"
+#include "utllinkedlist.h"
+#include "utlvector.h"
+#include "vector.h"
+#include "mathlib.h"
+#include "collisionutils.h"
+#include "cmodel.h"
+#include <float.h>
+#include <stdlib.h>
+#include "tier0/dbg.h"
+#include <xmmintrin.h>
+
+
+//-----------------------------------------------------------------------------
+// Size of the cells on the finest level, the next level up has cells twice
+// as big and so on
+//-----------------------------------------------------------------------------
+#define GRID_CELL_SIZE			64
+#define GRID_MAX_LEVELS			16
+#define GRID_TEST_EPSILON		(0.03125f)
+#define GRID_INITIAL_HASH_SIZE	1024
+
+// Handles are gathered from a cell this many at a time before going to the enumerator
+#define GRID_ENUM_BATCH			64
+
+// Most cells EnumerateElementsAlongRays collects on one level before it just
+// looks at everything in the box around the packet
+#define GRID_MAX_PACKET_CELLS	512
+
+
+//-----------------------------------------------------------------------------
+// A handle's box and lists, as kept in its cell.  The list flags and handle
+// ride along in the w of the box so the box loads straight into SSE.
+//-----------------------------------------------------------------------------
+struct GridElement_t
+{
+	Vector			m_Min;
+	unsigned int	m_ListFlags;
+	Vector			m_Max;
+	int				m_Handle;
+};
+
+
+//-----------------------------------------------------------------------------
+// All the information associated with a particular handle
+//-----------------------------------------------------------------------------
+struct GridHandle_t
+{
+	IHandleEntity	*m_pHandleEntity;
+	unsigned int	m_ListFlags;	// which lists is it in?
+	Vector			m_Min;
+	Vector			m_Max;
+	int				m_nCell;		// -1 until it's been given a box
+	int				m_nElement;		// Where it is in the cell's m_Elements
+};
+
+
+struct GridCell_t
+{
+	unsigned int	m_nKey;
+	int				m_nLevel;
+	int				m_nCoord[3];
+	int				m_nLevelIndex;	// Where it is in its level's m_Cells
+	CUtlVector< GridElement_t >	m_Elements;
+};
+
+
+struct GridLevel_t
+{
+	float			m_flCellSize;
+	float			m_flInvCellSize;
+	float			m_flHalfCellSize;
+	int				m_nCells[3];	// Across the world on each axis
+	unsigned int	m_nFirstKey;	// Cell keys on this level start here
+	int				m_nHandles;
+	CUtlVector< int >	m_Cells;	// The cells with handles in them
+};
+
+
+struct GridHashEntry_t
+{
+	unsigned int	m_nKey;
+	int				m_nCell;		// -1 if the entry is empty
+};
+
+
+class CGridEnumBase;
+
+
+//-----------------------------------------------------------------------------
+// The spatial partition class
+//-----------------------------------------------------------------------------
+class CSpatialPartitionGrid : public ISpatialPartitionInternal
+{
+public:
+	// constructor, destructor
+	CSpatialPartitionGrid();
+	virtual ~CSpatialPartitionGrid();
+
+	// Methods of ISpatialPartition
+	SpatialPartitionHandle_t CreateHandle( IHandleEntity *pHandleEntity );
+	SpatialPartitionHandle_t CreateHandle( IHandleEntity *pHandleEntity,
+		SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs );
+	void DestroyHandle( SpatialPartitionHandle_t handle );
+
+	void Insert( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle );
+	void Remove( SpatialPartitionListMask_t listMask, SpatialPartitionHandle_t handle );
+	void Remove( SpatialPartitionHandle_t handle );
+
+	SpatialTempHandle_t FastRemove( SpatialPartitionHandle_t handle );
+	void FastInsert( SpatialPartitionHandle_t handle, SpatialTempHandle_t tempHandle );
+
+	void ElementMoved( SpatialPartitionHandle_t handle, 
+		const Vector& mins, const Vector& maxs );
+
+	void EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
+		const Vector& pt, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
+		const Vector& mins, const Vector& maxs, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsInSphere( SpatialPartitionListMask_t listMask,
+		const Vector& origin, float radius, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+	
+	void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
+		const Ray_t& ray, bool coarseTest, 
+		IPartitionEnumerator* pIterator );
+
+	virtual void SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress );
+	virtual SpatialPartitionListMask_t GetSuppressedLists();
+
+	// Methods of ISpatialPartitionInternal
+	void	Init( const Vector& worldmin, const Vector& worldmax );
+	void	EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask,
+		const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator );
+
+	// Gets handle info (for enumerations)
+	const GridHandle_t&	HandleInfo( SpatialPartitionHandle_t handle ) const;
+
+private:
+	// Frees all the cells
+	void	PurgeCells();
+
+	// Which cell a box goes in
+	int		LevelForBox( const Vector& mins, const Vector& maxs ) const;
+	int		CellCoord( const GridLevel_t &level, int nAxis, float flValue ) const;
+	unsigned int CellKey( const GridLevel_t &level, const int *pCoord ) const;
+
+	// The hash from cell keys to cells
+	unsigned int HashSlot( unsigned int nKey ) const;
+	int		FindCell( unsigned int nKey ) const;
+	void	AddCellToHash( unsigned int nKey, int nCell );
+	void	RemoveCellFromHash( unsigned int nKey );
+	void	GrowHash();
+
+	// Creates, frees cells
+	int		AllocCell( unsigned int nKey, int nLevel, const int *pCoord );
+	void	FreeCell( int nCell );
+
+	// Inserts/Removes a handle from the grid
+	void	InsertIntoGrid( SpatialPartitionHandle_t handle );
+	void	RemoveFromGrid( SpatialPartitionHandle_t handle );
+
+	// Hands the cells a query might find something in to the enumerator
+	bool	EnumerateCellsInBox( int nLevel, const Vector& mins, const Vector& maxs, CGridEnumBase *pEnum );
+	bool	EnumerateCellsAlongRay( int nLevel, const Ray_t& ray, CGridEnumBase *pEnum );
+
+	// Runs a query over every level with anything on it
+	void	EnumerateBox( const Vector& mins, const Vector& maxs, CGridEnumBase *pEnum );
+
+	Vector	m_vecOrigin;
+	int		m_nLevels;
+	GridLevel_t	m_Levels[GRID_MAX_LEVELS];
+
+	// Stores all unique elements
+	CUtlLinkedList< GridHandle_t, SpatialPartitionHandle_t >	m_Handle;
+
+	CUtlVector< GridCell_t* >	m_Cells;
+	CUtlVector< int >			m_FreeCells;
+
+	// Size is a power of two, never more than half full
+	CUtlVector< GridHashEntry_t >	m_Hash;
+	int		m_nHashBits;
+	int		m_nHashCount;
+
+	bool	m_bSSE;
+
+	SpatialPartitionListMask_t m_nSuppressedListMask;
+};
+
+
+//-----------------------------------------------------------------------------
+// Base class for performing element enumeration.  VisitCell gets each cell
+// the query reaches along with a box that only handles touching it can
+// satisfy the query; EnumerateCell tests the cell's handles against that box
+// with SSE and gives the ones that touch it to Intersect and EnumElement.
+//-----------------------------------------------------------------------------
+class CGridEnumBase
+{
+public:
+	CGridEnumBase( const CSpatialPartitionGrid *pPartition, SpatialPartitionListMask_t listMask, 
+		bool coarseTest, bool bSSE )
+	{
+		m_pPartition = pPartition;
+		m_ListMask = listMask;
+		m_CoarseTest = coarseTest;
+		m_bSSE = bSSE;
+		m_Mins[3] = m_Maxs[3] = 0.0f;
+	}
+
+	void SetBounds( const Vector& mins, const Vector& maxs )
+	{
+		m_Mins[0] = mins.x; m_Mins[1] = mins.y; m_Mins[2] = mins.z;
+		m_Maxs[0] = maxs.x; m_Maxs[1] = maxs.y; m_Maxs[2] = maxs.z;
+	}
+
+	virtual bool VisitCell( const GridCell_t *pCell, const Vector& mins, const Vector& maxs )
+	{
+		SetBounds( mins, maxs );
+		return EnumerateCell( pCell );
+	}
+
+	bool EnumerateCell( const GridCell_t *pCell )
+	{
+		SpatialPartitionHandle_t hits[GRID_ENUM_BATCH];
+
+		int i = 0;
+		while ( i < pCell->m_Elements.Count() )
+		{
+			// The enumerator can't change the grid, but don't hold on to the array while it runs anyway
+			const GridElement_t *pElements = pCell->m_Elements.Base();
+			int nElements = pCell->m_Elements.Count();
+			int nHits = 0;
+
+			if ( m_bSSE )
+			{
+				__m128 queryMins = _mm_loadu_ps( m_Mins );
+				__m128 queryMaxs = _mm_loadu_ps( m_Maxs );
+				for ( ; i < nElements && nHits < GRID_ENUM_BATCH; ++i )
+				{
+					const GridElement_t &element = pElements[i];
+					if ( !( element.m_ListFlags & m_ListMask ) )
+						continue;
+
+					// Only x, y and z count, w is the list flags
+					__m128 overlap = _mm_and_ps( _mm_cmple_ps( _mm_loadu_ps( &element.m_Min.x ), queryMaxs ),
+						_mm_cmpge_ps( _mm_loadu_ps( &element.m_Max.x ), queryMins ) );
+					if ( ( _mm_movemask_ps( overlap ) & 7 ) == 7 )
+					{
+						hits[nHits++] = (SpatialPartitionHandle_t)element.m_Handle;
+					}
+				}
+			}
+			else
+			{
+				for ( ; i < nElements && nHits < GRID_ENUM_BATCH; ++i )
+				{
+					const GridElement_t &element = pElements[i];
+					if ( !( element.m_ListFlags & m_ListMask ) )
+						continue;
+
+					if ( ( element.m_Min.x <= m_Maxs[0] ) && ( element.m_Max.x >= m_Mins[0] ) &&
+						 ( element.m_Min.y <= m_Maxs[1] ) && ( element.m_Max.y >= m_Mins[1] ) &&
+						 ( element.m_Min.z <= m_Maxs[2] ) && ( element.m_Max.z >= m_Mins[2] ) )
+					{
+						hits[nHits++] = (SpatialPartitionHandle_t)element.m_Handle;
+					}
+				}
+			}
+
+			for ( int j = 0; j < nHits; ++j )
+			{
+				const GridHandle_t &handleInfo = m_pPartition->HandleInfo( hits[j] );
+
+				// If it's not a coarse test, actually do the intersection
+				if ( !m_CoarseTest && !Intersect( handleInfo ) )
+					continue;
+
+				if ( EnumElement( handleInfo ) == ITERATION_STOP )
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// The box test is exact for boxes and points, other shapes have to check again
+	virtual bool Intersect( const GridHandle_t &handleInfo )
+	{
+		return true;
+	}
+
+	virtual IterationRetval_t EnumElement( const GridHandle_t &handleInfo ) = 0;
+
+protected:
+	const CSpatialPartitionGrid *m_pPartition;
+	int		m_ListMask;
+	bool	m_CoarseTest;
+	bool	m_bSSE;
+	float	m_Mins[4];
+	float	m_Maxs[4];
+};
+
+
+//-----------------------------------------------------------------------------
+// Boxes and points
+//-----------------------------------------------------------------------------
+class CGridEnum : public CGridEnumBase
+{
+public:
+	CGridEnum( const CSpatialPartitionGrid *pPartition, SpatialPartitionListMask_t listMask, 
+		bool coarseTest, bool bSSE, IPartitionEnumerator* pIterator ) :
+		CGridEnumBase( pPartition, listMask, coarseTest, bSSE )
+	{
+		m_pIterator = pIterator;
+	}
+
+	IterationRetval_t EnumElement( const GridHandle_t &handleInfo )
+	{
+		return m_pIterator->EnumElement( handleInfo.m_pHandleEntity );
+	}
+
+protected:
+	IPartitionEnumerator* m_pIterator;
+};
+
+
+//-----------------------------------------------------------------------------
+// Spheres, the box test is against the box around it
+//-----------------------------------------------------------------------------
+class CGridEnumSphere : public CGridEnum
+{
+public:
+	CGridEnumSphere( const CSpatialPartitionGrid *pPartition, SpatialPartitionListMask_t listMask, 
+		bool coarseTest, bool bSSE, IPartitionEnumerator* pIterator, const Vector& center, float radius ) :
+		CGridEnum( pPartition, listMask, coarseTest, bSSE, pIterator )
+	{
+		VectorCopy( center, m_Center );
+		m_Radius = radius;
+	}
+
+	bool Intersect( const GridHandle_t &handleInfo )
+	{
+		return IsBoxIntersectingSphere( handleInfo.m_Min, handleInfo.m_Max,
+			m_Center, m_Radius );
+	}
+
+private:
+	Vector	m_Center;
+	float	m_Radius;
+};
+
+
+//-----------------------------------------------------------------------------
+// Rays, the box test is against the box around the part of the ray that
+// could reach the cell
+//-----------------------------------------------------------------------------
+class CGridEnumRay : public CGridEnum
+{
+public:
+	CGridEnumRay( const CSpatialPartitionGrid *pPartition, SpatialPartitionListMask_t listMask, 
+		bool coarseTest, bool bSSE, IPartitionEnumerator* pIterator, const Ray_t& ray ) :
+		CGridEnum( pPartition, listMask, coarseTest, bSSE, pIterator )
+	{
+		m_pRay = &ray;
+	}
+
+	// Same test as the voxel tree does
+	bool Intersect( const GridHandle_t &handleInfo )
+	{
+		if (m_pRay->m_IsRay)
+		{
+			return IsBoxIntersectingRay( handleInfo.m_Min, handleInfo.m_Max, 
+				m_pRay->m_Start, m_pRay->m_Delta );
+		}
+		else
+		{
+			// Thicken the box by the ray extents
+			Vector bmin, bmax;
+			VectorAdd( handleInfo.m_Max, m_pRay->m_Extents, bmax );
+			VectorSubtract( handleInfo.m_Min, m_pRay->m_Extents, bmin );
+
+			return IsBoxIntersectingRay( bmin, bmax, m_pRay->m_Start, m_pRay->m_Delta );
+		}
+	}
+
+private:
+	const Ray_t* m_pRay;
+};
+
+
+//-----------------------------------------------------------------------------
+// Packets of rays.  Each ray's walk through a level just collects cells, then
+// each of them gets looked at once against the box around the whole packet.
+//-----------------------------------------------------------------------------
+static int GridCellCompare( const void *a, const void *b )
+{
+	const GridCell_t *pCellA = *(const GridCell_t * const *)a;
+	const GridCell_t *pCellB = *(const GridCell_t * const *)b;
+	if ( pCellA == pCellB )
+		return 0;
+	return ( pCellA < pCellB ) ? -1 : 1;
+}
+
+class CGridEnumRays : public CGridEnumBase
+{
+public:
+	CGridEnumRays( const CSpatialPartitionGrid *pPartition, SpatialPartitionListMask_t listMask, 
+		bool bSSE, IPartitionRaysEnumerator* pIterator, const Ray_t *pRays, int nRays ) :
+		CGridEnumBase( pPartition, listMask, false, bSSE )
+	{
+		m_pRaysIterator = pIterator;
+		m_pRays = pRays;
+		m_nRays = nRays;
+		m_nRayMask = 0;
+		m_nCells = 0;
+		m_bOverflow = false;
+	}
+
+	void BeginLevel()
+	{
+		m_nCells = 0;
+		m_bOverflow = false;
+	}
+
+	bool VisitCell( const GridCell_t *pCell, const Vector& mins, const Vector& maxs )
+	{
+		if ( m_nCells == GRID_MAX_PACKET_CELLS )
+		{
+			m_bOverflow = true;
+			return false;
+		}
+
+		m_pCells[m_nCells++] = pCell;
+		return true;
+	}
+
+	bool Overflowed() const
+	{
+		return m_bOverflow;
+	}
+
+	// Looks at each cell the rays went through once
+	bool EnumerateCells()
+	{
+		qsort( m_pCells, m_nCells, sizeof( m_pCells[0] ), GridCellCompare );
+		for ( int i = 0; i < m_nCells; ++i )
+		{
+			if ( i > 0 && m_pCells[i] == m_pCells[i - 1] )
+				continue;
+
+			if ( !EnumerateCell( m_pCells[i] ) )
+				return false;
+		}
+		return true;
+	}
+
+	// Same test as the voxel tree does, against every ray
+	bool Intersect( const GridHandle_t &handleInfo )
+	{
+		m_nRayMask = 0;
+		for ( int i = 0; i < m_nRays; ++i )
+		{
+			const Ray_t &ray = m_pRays[i];
+
+			Vector bmin, bmax;
+			VectorSubtract( handleInfo.m_Min, ray.m_Extents, bmin );
+			VectorAdd( handleInfo.m_Max, ray.m_Extents, bmax );
+
+			bool bHit;
+			if ( !ray.m_IsSwept )
+			{
+				bHit = IsPointInBox( ray.m_Start, bmin, bmax );
+			}
+			else
+			{
+				bHit = IsBoxIntersectingRay( bmin, bmax, ray.m_Start, ray.m_Delta );
+			}
+
+			if ( bHit )
+			{
+				m_nRayMask |= ( 1U << i );
+			}
+		}
+		return ( m_nRayMask != 0 );
+	}
+
+	IterationRetval_t EnumElement( const GridHandle_t &handleInfo )
+	{
+		return m_pRaysIterator->EnumElement( handleInfo.m_pHandleEntity, m_nRayMask );
+	}
+
+private:
+	IPartitionRaysEnumerator* m_pRaysIterator;
+	const Ray_t* m_pRays;
+	int		m_nRays;
+	unsigned int m_nRayMask;
+
+	// Sorted as pointers, the order doesn't matter, only finding the repeats
+	const GridCell_t *m_pCells[GRID_MAX_PACKET_CELLS];
+	int		m_nCells;
+	bool	m_bOverflow;
+};
+
+
+//-----------------------------------------------------------------------------
+// Creates a grid, for SpatialPartition() and spatialpartition_benchmark
+//-----------------------------------------------------------------------------
+ISpatialPartitionInternal *CreateSpatialPartitionGrid()
+{
+	return new CSpatialPartitionGrid;
+}
+
+
+//-----------------------------------------------------------------------------
+// constructor, destructor
+//-----------------------------------------------------------------------------
+CSpatialPartitionGrid::CSpatialPartitionGrid()
+{
+	m_vecOrigin.Init();
+	m_nLevels = 0;
+	m_nHashBits = 0;
+	m_nHashCount = 0;
+	m_bSSE = false;
+	m_nSuppressedListMask = 0;
+}
+
+CSpatialPartitionGrid::~CSpatialPartitionGrid()
+{
+	PurgeCells();
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees all the cells
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::PurgeCells()
+{
+	for ( int i = 0; i < m_Cells.Count(); ++i )
+	{
+		delete m_Cells[i];
+	}
+	m_Cells.Purge();
+	m_FreeCells.Purge();
+	m_Hash.Purge();
+	m_nHashBits = 0;
+	m_nHashCount = 0;
+
+	for ( int nLevel = 0; nLevel < GRID_MAX_LEVELS; ++nLevel )
+	{
+		m_Levels[nLevel].m_Cells.Purge();
+		m_Levels[nLevel].m_nHandles = 0;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Methods of ISpatialPartitionInternal
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::Init( const Vector& worldmin, const Vector& worldmax )
+{
+	m_nSuppressedListMask = 0;
+
+	// Clear stuff out baby
+	PurgeCells();
+	m_Handle.Purge();
+
+	// Reserve some memory
+	m_Handle.EnsureCapacity( 256 );
+	m_Cells.EnsureCapacity( 256 );
+
+	m_bSSE = MathLib_SSEEnabled();
+
+	// Levels get added until one cell covers the world, then there's one more
+	// level for anything that's bigger than that
+	m_vecOrigin = worldmin;
+	Vector worldSize;
+	VectorSubtract( worldmax, worldmin, worldSize );
+
+	unsigned int nFirstKey = 0;
+	float flCellSize = GRID_CELL_SIZE;
+	m_nLevels = 0;
+	while ( m_nLevels < GRID_MAX_LEVELS )
+	{
+		GridLevel_t &level = m_Levels[m_nLevels];
+		bool bLastLevel = ( m_nLevels == GRID_MAX_LEVELS - 1 );
+		if ( m_nLevels > 0 )
+		{
+			// Stop once there's one cell each way, the next level is the last one
+			GridLevel_t &prevLevel = m_Levels[m_nLevels - 1];
+			if ( prevLevel.m_nCells[0] == 1 && prevLevel.m_nCells[1] == 1 && prevLevel.m_nCells[2] == 1 )
+			{
+				bLastLevel = true;
+			}
+		}
+
+		// The last level's one cell gets everything, whatever the coordinates
+		level.m_flCellSize = flCellSize;
+		level.m_flInvCellSize = bLastLevel ? 0.0f : 1.0f / flCellSize;
+		level.m_flHalfCellSize = 0.5f * flCellSize;
+		for ( int i = 0; i < 3; ++i )
+		{
+			level.m_nCells[i] = bLastLevel ? 1 : Floor2Int( max( worldSize[i], 0.0f ) * level.m_flInvCellSize ) + 1;
+		}
+		level.m_nFirstKey = nFirstKey;
+		level.m_nHandles = 0;
+		nFirstKey += level.m_nCells[0] * level.m_nCells[1] * level.m_nCells[2];
+
+		++m_nLevels;
+		flCellSize *= 2.0f;
+		if ( bLastLevel )
+			break;
+	}
+
+	m_Hash.SetSize( GRID_INITIAL_HASH_SIZE );
+	for ( int i = 0; i < m_Hash.Count(); ++i )
+	{
+		m_Hash[i].m_nCell = -1;
+	}
+	m_nHashBits = 10;
+	Assert( ( 1 << m_nHashBits ) == GRID_INITIAL_HASH_SIZE );
+}
+
+
+//-----------------------------------------------------------------------------
+// Which level a box goes on, the first one with cells at least as big
+//-----------------------------------------------------------------------------
+inline int CSpatialPartitionGrid::LevelForBox( const Vector& mins, const Vector& maxs ) const
+{
+	float flSize = max( max( maxs.x - mins.x, maxs.y - mins.y ), maxs.z - mins.z );
+
+	int nLevel = 0;
+	while ( ( nLevel < m_nLevels - 1 ) && ( flSize > m_Levels[nLevel].m_flCellSize ) )
+	{
+		++nLevel;
+	}
+	return nLevel;
+}
+
+
+//-----------------------------------------------------------------------------
+// Which cell a coordinate is in, things past the edges go in the edge cells.
+// Clamp before converting, Floor2Int doesn't do huge numbers.
+//-----------------------------------------------------------------------------
+inline int CSpatialPartitionGrid::CellCoord( const GridLevel_t &level, int nAxis, float flValue ) const
+{
+	float flCell = ( flValue - m_vecOrigin[nAxis] ) * level.m_flInvCellSize;
+	flCell = clamp( flCell, 0.0f, (float)( level.m_nCells[nAxis] - 1 ) );
+	return Floor2Int( flCell );
+}
+
+inline unsigned int CSpatialPartitionGrid::CellKey( const GridLevel_t &level, const int *pCoord ) const
+{
+	return level.m_nFirstKey + pCoord[0] + level.m_nCells[0] * ( pCoord[1] + level.m_nCells[1] * pCoord[2] );
+}
+
+
+//-----------------------------------------------------------------------------
+// The hash from cell keys to cells
+//-----------------------------------------------------------------------------
+inline unsigned int CSpatialPartitionGrid::HashSlot( unsigned int nKey ) const
+{
+	// Fibonacci hashing, the top bits are the well mixed ones
+	return ( nKey * 2654435769U ) >> ( 32 - m_nHashBits );
+}
+
+inline int CSpatialPartitionGrid::FindCell( unsigned int nKey ) const
+{
+	unsigned int nMask = m_Hash.Count() - 1;
+	for ( unsigned int i = HashSlot( nKey ); ; i = ( i + 1 ) & nMask )
+	{
+		const GridHashEntry_t &entry = m_Hash[i];
+		if ( entry.m_nCell < 0 || entry.m_nKey == nKey )
+			return entry.m_nCell;
+	}
+}
+
+void CSpatialPartitionGrid::AddCellToHash( unsigned int nKey, int nCell )
+{
+	if ( ( m_nHashCount + 1 ) * 2 > m_Hash.Count() )
+	{
+		GrowHash();
+	}
+
+	unsigned int nMask = m_Hash.Count() - 1;
+	unsigned int i = HashSlot( nKey );
+	while ( m_Hash[i].m_nCell >= 0 )
+	{
+		Assert( m_Hash[i].m_nKey != nKey );
+		i = ( i + 1 ) & nMask;
+	}
+
+	m_Hash[i].m_nKey = nKey;
+	m_Hash[i].m_nCell = nCell;
+	++m_nHashCount;
+}
+
+void CSpatialPartitionGrid::RemoveCellFromHash( unsigned int nKey )
+{
+	unsigned int nMask = m_Hash.Count() - 1;
+	unsigned int i = HashSlot( nKey );
+	while ( m_Hash[i].m_nKey != nKey || m_Hash[i].m_nCell < 0 )
+	{
+		Assert( m_Hash[i].m_nCell >= 0 );
+		i = ( i + 1 ) & nMask;
+	}
+
+	// Pull back any entries after it that would otherwise be cut off from their slot
+	unsigned int j = i;
+	for (;;)
+	{
+		j = ( j + 1 ) & nMask;
+		if ( m_Hash[j].m_nCell < 0 )
+			break;
+
+		unsigned int nSlot = HashSlot( m_Hash[j].m_nKey );
+		bool bStays = ( i <= j ) ? ( ( i < nSlot ) && ( nSlot <= j ) ) : ( ( i < nSlot ) || ( nSlot <= j ) );
+		if ( bStays )
+			continue;
+
+		m_Hash[i] = m_Hash[j];
+		i = j;
+	}
+
+	m_Hash[i].m_nCell = -1;
+	--m_nHashCount;
+}
+
+void CSpatialPartitionGrid::GrowHash()
+{
+	CUtlVector< GridHashEntry_t > oldHash;
+	oldHash.AddMultipleToTail( m_Hash.Count(), m_Hash.Base() );
+
+	++m_nHashBits;
+	m_Hash.SetSize( 1 << m_nHashBits );
+	for ( int i = 0; i < m_Hash.Count(); ++i )
+	{
+		m_Hash[i].m_nCell = -1;
+	}
+
+	unsigned int nMask = m_Hash.Count() - 1;
+	for ( int i = 0; i < oldHash.Count(); ++i )
+	{
+		if ( oldHash[i].m_nCell < 0 )
+			continue;
+
+		unsigned int j = HashSlot( oldHash[i].m_nKey );
+		while ( m_Hash[j].m_nCell >= 0 )
+		{
+			j = ( j + 1 ) & nMask;
+		}
+		m_Hash[j] = oldHash[i];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Creates, frees cells.  Freed cells keep their element arrays for reuse.
+//-----------------------------------------------------------------------------
+int CSpatialPartitionGrid::AllocCell( unsigned int nKey, int nLevel, const int *pCoord )
+{
+	int nCell;
+	if ( m_FreeCells.Count() )
+	{
+		nCell = m_FreeCells[ m_FreeCells.Count() - 1 ];
+		m_FreeCells.Remove( m_FreeCells.Count() - 1 );
+	}
+	else
+	{
+		nCell = m_Cells.AddToTail( new GridCell_t );
+	}
+
+	GridCell_t *pCell = m_Cells[nCell];
+	pCell->m_nKey = nKey;
+	pCell->m_nLevel = nLevel;
+	pCell->m_nCoord[0] = pCoord[0];
+	pCell->m_nCoord[1] = pCoord[1];
+	pCell->m_nCoord[2] = pCoord[2];
+	pCell->m_nLevelIndex = m_Levels[nLevel].m_Cells.AddToTail( nCell );
+	Assert( pCell->m_Elements.Count() == 0 );
+
+	AddCellToHash( nKey, nCell );
+	return nCell;
+}
+
+void CSpatialPartitionGrid::FreeCell( int nCell )
+{
+	GridCell_t *pCell = m_Cells[nCell];
+	Assert( pCell->m_Elements.Count() == 0 );
+
+	RemoveCellFromHash( pCell->m_nKey );
+
+	CUtlVector< int > &levelCells = m_Levels[pCell->m_nLevel].m_Cells;
+	int nLast = levelCells[ levelCells.Count() - 1 ];
+	levelCells.FastRemove( pCell->m_nLevelIndex );
+	if ( nLast != nCell )
+	{
+		m_Cells[nLast]->m_nLevelIndex = pCell->m_nLevelIndex;
+	}
+
+	m_FreeCells.AddToTail( nCell );
+}
+
+
+//-----------------------------------------------------------------------------
+// Inserts a handle into the cell for its box
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::InsertIntoGrid( SpatialPartitionHandle_t handle )
+{
+	GridHandle_t &handleInfo = m_Handle[handle];
+	Assert( handleInfo.m_nCell < 0 );
+
+	int nLevel = LevelForBox( handleInfo.m_Min, handleInfo.m_Max );
+	const GridLevel_t &level = m_Levels[nLevel];
+
+	int coord[3];
+	for ( int i = 0; i < 3; ++i )
+	{
+		coord[i] = CellCoord( level, i, 0.5f * ( handleInfo.m_Min[i] + handleInfo.m_Max[i] ) );
+	}
+
+	unsigned int nKey = CellKey( level, coord );
+	int nCell = FindCell( nKey );
+	if ( nCell < 0 )
+	{
+		nCell = AllocCell( nKey, nLevel, coord );
+	}
+
+	GridCell_t *pCell = m_Cells[nCell];
+	int nElement = pCell->m_Elements.AddToTail();
+	GridElement_t &element = pCell->m_Elements[nElement];
+	element.m_Min = handleInfo.m_Min;
+	element.m_Max = handleInfo.m_Max;
+	element.m_ListFlags = handleInfo.m_ListFlags;
+	element.m_Handle = handle;
+
+	handleInfo.m_nCell = nCell;
+	handleInfo.m_nElement = nElement;
+	++m_Levels[nLevel].m_nHandles;
+}
+
+
+//-----------------------------------------------------------------------------
+// Removes a handle from its cell, freeing the cell if that empties it
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::RemoveFromGrid( SpatialPartitionHandle_t handle )
+{
+	GridHandle_t &handleInfo = m_Handle[handle];
+	if ( handleInfo.m_nCell < 0 )
+		return;
+
+	GridCell_t *pCell = m_Cells[handleInfo.m_nCell];
+	CUtlVector< GridElement_t > &elements = pCell->m_Elements;
+
+	// The last element moves into the hole
+	int nLast = elements.Count() - 1;
+	if ( handleInfo.m_nElement != nLast )
+	{
+		m_Handle[ elements[nLast].m_Handle ].m_nElement = handleInfo.m_nElement;
+	}
+	elements.FastRemove( handleInfo.m_nElement );
+
+	--m_Levels[pCell->m_nLevel].m_nHandles;
+	if ( elements.Count() == 0 )
+	{
+		FreeCell( handleInfo.m_nCell );
+	}
+
+	handleInfo.m_nCell = -1;
+	handleInfo.m_nElement = -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Create/destroy handle
+//-----------------------------------------------------------------------------
+SpatialPartitionHandle_t CSpatialPartitionGrid::CreateHandle( IHandleEntity *pHandleEntity )
+{
+	SpatialPartitionHandle_t handle = m_Handle.AddToTail();
+	GridHandle_t &handleInfo = m_Handle[handle];
+	handleInfo.m_pHandleEntity = pHandleEntity;
+	handleInfo.m_ListFlags = 0;
+	handleInfo.m_Min.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	handleInfo.m_Max.Init( FLT_MIN, FLT_MIN, FLT_MIN );
+	handleInfo.m_nCell = -1;
+	handleInfo.m_nElement = -1;
+
+	return handle;
+}
+
+SpatialPartitionHandle_t CSpatialPartitionGrid::CreateHandle( IHandleEntity *pHandleEntity,
+	SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs )
+{
+	SpatialPartitionHandle_t handle = CreateHandle( pHandleEntity );
+	GridHandle_t &handleInfo = m_Handle[handle];
+	handleInfo.m_ListFlags = listMask;
+	handleInfo.m_Min = mins;
+	handleInfo.m_Max = maxs;
+	InsertIntoGrid( handle );
+	return handle;
+}
+
+void CSpatialPartitionGrid::DestroyHandle( SpatialPartitionHandle_t handle )
+{
+	if (handle != PARTITION_INVALID_HANDLE)
+	{
+		RemoveFromGrid( handle );
+		m_Handle.Remove( handle );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Insert/remove handles into/from groups.  The cell keeps a copy of the flags.
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::Insert( SpatialPartitionListMask_t listId, 
+								SpatialPartitionHandle_t handle )
+{
+	Assert( m_Handle.IsValidIndex(handle) );
+	FastInsert( handle, m_Handle[handle].m_ListFlags | listId );
+}
+
+void CSpatialPartitionGrid::Remove( SpatialPartitionListMask_t listId, 
+								SpatialPartitionHandle_t handle )
+{
+	Assert( m_Handle.IsValidIndex(handle) );
+	FastInsert( handle, m_Handle[handle].m_ListFlags & ~listId );
+}
+
+void CSpatialPartitionGrid::Remove( SpatialPartitionHandle_t handle )
+{
+	Assert( m_Handle.IsValidIndex(handle) );
+	FastInsert( handle, 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Fast way to remove a handle from all groups + re-add it to the groups it was in
+//-----------------------------------------------------------------------------
+SpatialTempHandle_t CSpatialPartitionGrid::FastRemove( SpatialPartitionHandle_t handle )
+{
+	Assert( m_Handle.IsValidIndex(handle) );
+	SpatialTempHandle_t oldLists = m_Handle[handle].m_ListFlags;
+	FastInsert( handle, 0 );
+	return oldLists;
+}
+
+void CSpatialPartitionGrid::FastInsert( SpatialPartitionHandle_t handle, SpatialTempHandle_t tempHandle )
+{
+	Assert( m_Handle.IsValidIndex(handle) );
+	GridHandle_t &handleInfo = m_Handle[handle];
+	handleInfo.m_ListFlags = tempHandle;
+	if ( handleInfo.m_nCell >= 0 )
+	{
+		m_Cells[handleInfo.m_nCell]->m_Elements[handleInfo.m_nElement].m_ListFlags = tempHandle;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// For debugging.... suppress queries on particular lists
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress )
+{
+	if (bSuppress)
+	{
+		m_nSuppressedListMask |= nListMask;
+	}
+	else
+	{
+		m_nSuppressedListMask &= ~nListMask;
+	}
+}
+
+SpatialPartitionListMask_t CSpatialPartitionGrid::GetSuppressedLists()
+{
+	return m_nSuppressedListMask;
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets handle info (for enumerations)
+//-----------------------------------------------------------------------------
+inline const GridHandle_t& CSpatialPartitionGrid::HandleInfo( SpatialPartitionHandle_t handle ) const
+{
+	return m_Handle[handle];
+}
+
+
+//-----------------------------------------------------------------------------
+// Call this when the element moves.  Only goes to another cell if the
+// center moved out of this one or the box changed level.
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::ElementMoved( SpatialPartitionHandle_t handle, 
+		const Vector& mins, const Vector& maxs )
+{
+	GridHandle_t &handleInfo = m_Handle[handle];
+	handleInfo.m_Min = mins;
+	handleInfo.m_Max = maxs;
+
+	if ( handleInfo.m_nCell >= 0 )
+	{
+		GridCell_t *pCell = m_Cells[handleInfo.m_nCell];
+		const GridLevel_t &level = m_Levels[pCell->m_nLevel];
+
+		bool bSameCell = ( LevelForBox( mins, maxs ) == pCell->m_nLevel );
+		for ( int i = 0; bSameCell && i < 3; ++i )
+		{
+			bSameCell = ( CellCoord( level, i, 0.5f * ( mins[i] + maxs[i] ) ) == pCell->m_nCoord[i] );
+		}
+
+		if ( bSameCell )
+		{
+			GridElement_t &element = pCell->m_Elements[handleInfo.m_nElement];
+			element.m_Min = mins;
+			element.m_Max = maxs;
+			return;
+		}
+
+		RemoveFromGrid( handle );
+	}
+
+	InsertIntoGrid( handle );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hands every cell on a level that could have a handle touching the box to
+// the enumerator, along with the box
+//-----------------------------------------------------------------------------
+bool CSpatialPartitionGrid::EnumerateCellsInBox( int nLevel, const Vector& mins, const Vector& maxs, 
+												CGridEnumBase *pEnum )
+{
+	const GridLevel_t &level = m_Levels[nLevel];
+	float flLoose = level.m_flHalfCellSize + GRID_TEST_EPSILON;
+
+	int lo[3], hi[3];
+	int nCells = 1;
+	for ( int i = 0; i < 3; ++i )
+	{
+		lo[i] = CellCoord( level, i, mins[i] - flLoose );
+		hi[i] = CellCoord( level, i, maxs[i] + flLoose );
+		nCells *= hi[i] - lo[i] + 1;
+	}
+
+	// Cheaper to look at every cell on the level than to look up the ones in the box
+	if ( nCells > level.m_Cells.Count() )
+	{
+		for ( int i = 0; i < level.m_Cells.Count(); ++i )
+		{
+			const GridCell_t *pCell = m_Cells[ level.m_Cells[i] ];
+			if ( pCell->m_nCoord[0] < lo[0] || pCell->m_nCoord[0] > hi[0] ||
+				 pCell->m_nCoord[1] < lo[1] || pCell->m_nCoord[1] > hi[1] ||
+				 pCell->m_nCoord[2] < lo[2] || pCell->m_nCoord[2] > hi[2] )
+			{
+				continue;
+			}
+
+			if ( !pEnum->VisitCell( pCell, mins, maxs ) )
+				return false;
+		}
+		return true;
+	}
+
+	int coord[3];
+	for ( coord[2] = lo[2]; coord[2] <= hi[2]; ++coord[2] )
+	{
+		for ( coord[1] = lo[1]; coord[1] <= hi[1]; ++coord[1] )
+		{
+			for ( coord[0] = lo[0]; coord[0] <= hi[0]; ++coord[0] )
+			{
+				int nCell = FindCell( CellKey( level, coord ) );
+				if ( nCell < 0 )
+					continue;
+
+				if ( !pEnum->VisitCell( m_Cells[nCell], mins, maxs ) )
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Walks a ray through a level one slab of cells at a time along the axis it
+// moves furthest on.  In each slab only the part of the ray that can reach
+// the handles there counts, both for which cells to look at and for the box
+// the handles are tested against.
+//-----------------------------------------------------------------------------
+bool CSpatialPartitionGrid::EnumerateCellsAlongRay( int nLevel, const Ray_t& ray, CGridEnumBase *pEnum )
+{
+	const GridLevel_t &level = m_Levels[nLevel];
+
+	int nAxis = 0;
+	if ( FloatMakePositive( ray.m_Delta[1] ) > FloatMakePositive( ray.m_Delta[nAxis] ) )
+		nAxis = 1;
+	if ( FloatMakePositive( ray.m_Delta[2] ) > FloatMakePositive( ray.m_Delta[nAxis] ) )
+		nAxis = 2;
+
+	Vector end, sweptMins, sweptMaxs;
+	VectorAdd( ray.m_Start, ray.m_Delta, end );
+	for ( int i = 0; i < 3; ++i )
+	{
+		sweptMins[i] = min( ray.m_Start[i], end[i] ) - ray.m_Extents[i] - GRID_TEST_EPSILON;
+		sweptMaxs[i] = max( ray.m_Start[i], end[i] ) + ray.m_Extents[i] + GRID_TEST_EPSILON;
+	}
+
+	int nFirst = CellCoord( level, nAxis, sweptMins[nAxis] - level.m_flHalfCellSize );
+	int nLast = CellCoord( level, nAxis, sweptMaxs[nAxis] + level.m_flHalfCellSize );
+	int nSlabs = nLast - nFirst + 1;
+
+	// Short rays and levels with hardly any cells just get the box around them looked at
+	if ( ( FloatMakePositive( ray.m_Delta[nAxis] ) * level.m_flInvCellSize < 1.0f ) || 
+		 ( level.m_Cells.Count() <= nSlabs ) )
+	{
+		return EnumerateCellsInBox( nLevel, sweptMins, sweptMaxs, pEnum );
+	}
+
+	int nStep = 1;
+	if ( ray.m_Delta[nAxis] < 0.0f )
+	{
+		nStep = -1;
+		nFirst = nLast;
+	}
+
+	int nAxis1 = ( nAxis + 1 ) % 3;
+	int nAxis2 = ( nAxis + 2 ) % 3;
+	float flLoose = level.m_flHalfCellSize + GRID_TEST_EPSILON;
+	float flInvDelta = 1.0f / ray.m_Delta[nAxis];
+
+	for ( int nSlab = 0; nSlab < nSlabs; ++nSlab )
+	{
+		int coord[3];
+		coord[nAxis] = nFirst + nSlab * nStep;
+
+		// Where the ray can reach handles centered in this slab.  The edge
+		// slabs also have everything past the edge of the world.
+		float flSlabMin = ( coord[nAxis] == 0 ) ? -FLT_MAX : 
+			m_vecOrigin[nAxis] + coord[nAxis] * level.m_flCellSize - flLoose - ray.m_Extents[nAxis];
+		float flSlabMax = ( coord[nAxis] == level.m_nCells[nAxis] - 1 ) ? FLT_MAX : 
+			m_vecOrigin[nAxis] + ( coord[nAxis] + 1 ) * level.m_flCellSize + flLoose + ray.m_Extents[nAxis];
+
+		// Clip the ray to the slab
+		float t0 = ( flSlabMin - ray.m_Start[nAxis] ) * flInvDelta;
+		float t1 = ( flSlabMax - ray.m_Start[nAxis] ) * flInvDelta;
+		if ( t0 > t1 )
+		{
+			float flTemp = t0;
+			t0 = t1;
+			t1 = flTemp;
+		}
+
+		t0 = max( t0, 0.0f );
+		t1 = min( t1, 1.0f );
+		if ( t0 > t1 )
+			continue;
+
+		Vector p0, p1, segMins, segMaxs;
+		VectorMA( ray.m_Start, t0, ray.m_Delta, p0 );
+		VectorMA( ray.m_Start, t1, ray.m_Delta, p1 );
+		for ( int i = 0; i < 3; ++i )
+		{
+			segMins[i] = min( p0[i], p1[i] ) - ray.m_Extents[i] - GRID_TEST_EPSILON;
+			segMaxs[i] = max( p0[i], p1[i] ) + ray.m_Extents[i] + GRID_TEST_EPSILON;
+		}
+
+		int lo1 = CellCoord( level, nAxis1, segMins[nAxis1] - flLoose );
+		int hi1 = CellCoord( level, nAxis1, segMaxs[nAxis1] + flLoose );
+		int lo2 = CellCoord( level, nAxis2, segMins[nAxis2] - flLoose );
+		int hi2 = CellCoord( level, nAxis2, segMaxs[nAxis2] + flLoose );
+		for ( coord[nAxis2] = lo2; coord[nAxis2] <= hi2; ++coord[nAxis2] )
+		{
+			for ( coord[nAxis1] = lo1; coord[nAxis1] <= hi1; ++coord[nAxis1] )
+			{
+				int nCell = FindCell( CellKey( level, coord ) );
+				if ( nCell < 0 )
+					continue;
+
+				if ( !pEnum->VisitCell( m_Cells[nCell], segMins, segMaxs ) )
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs a box query over every level with anything on it
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateBox( const Vector& mins, const Vector& maxs, CGridEnumBase *pEnum )
+{
+	for ( int nLevel = 0; nLevel < m_nLevels; ++nLevel )
+	{
+		if ( !m_Levels[nLevel].m_nHandles )
+			continue;
+
+		if ( !EnumerateCellsInBox( nLevel, mins, maxs, pEnum ) )
+			return;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities surrounding a point
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, 
+	const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	CGridEnum enumPoint( this, listMask, coarseTest, m_bSSE, pIterator );
+	EnumerateBox( pt, pt, &enumPoint );
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities in a box...  The box test is exact and cheap, so coarse
+// tests get it too.
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, 
+	const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// If this assertion fails, you're using a list
+	// at a point where the spatial partition elements aren't set up!
+	Assert( (listMask & m_nSuppressedListMask) == 0);
+
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	CGridEnum enumBox( this, listMask, coarseTest, m_bSSE, pIterator );
+	EnumerateBox( mins, maxs, &enumBox );
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities in a sphere...
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, 
+	const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// If this assertion fails, you're using a list
+	// at a point where the spatial partition elements aren't set up!
+	Assert( (listMask & m_nSuppressedListMask) == 0);
+	
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+
+	Vector mins, maxs;
+	Vector extents( radius, radius, radius );
+	VectorSubtract( origin, extents, mins );
+	VectorAdd( origin, extents, maxs );
+
+	CGridEnumSphere enumSphere( this, listMask, coarseTest, m_bSSE, pIterator, origin, radius );
+	EnumerateBox( mins, maxs, &enumSphere );
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities along a ray...
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, 
+	const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	// If this assertion fails, you're using a list
+	// at a point where the spatial partition elements aren't set up!
+	Assert( (listMask & m_nSuppressedListMask) == 0);
+	
+	// Early-out.
+	if ( listMask == 0 )
+		return;
+	
+	// No ray? Just do a simpler box test
+	if (!ray.m_IsSwept)
+	{
+		Vector mins, maxs;
+		VectorSubtract( ray.m_Start, ray.m_Extents, mins );
+		VectorAdd( ray.m_Start, ray.m_Extents, maxs );
+		EnumerateElementsInBox( listMask, mins, maxs, coarseTest, pIterator );
+		return;
+	}
+
+	CGridEnumRay enumRay( this, listMask, coarseTest, m_bSSE, pIterator, ray );
+	for ( int nLevel = 0; nLevel < m_nLevels; ++nLevel )
+	{
+		if ( !m_Levels[nLevel].m_nHandles )
+			continue;
+
+		if ( !EnumerateCellsAlongRay( nLevel, ray, &enumRay ) )
+			return;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Gets all entities along a packet of rays...
+//-----------------------------------------------------------------------------
+void CSpatialPartitionGrid::EnumerateElementsAlongRays( SpatialPartitionListMask_t listMask, 
+	const Ray_t *pRays, int nRays, IPartitionRaysEnumerator* pIterator )
+{
+	// If this assertion fails, you're using a list
+	// at a point where the spatial partition elements aren't set up!
+	Assert( (listMask & m_nSuppressedListMask) == 0);
+	Assert( nRays <= MAX_PARTITION_RAYS );
+
+	// Early-out.
+	if ( listMask == 0 || nRays <= 0 )
+		return;
+
+	// Box around the whole packet
+	Vector packetMins( FLT_MAX, FLT_MAX, FLT_MAX );
+	Vector packetMaxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	int i;
+	for ( i = 0; i < nRays; ++i )
+	{
+		const Ray_t &ray = pRays[i];
+		for ( int j = 0; j < 3; ++j )
+		{
+			float flEnd = ray.m_Start[j] + ray.m_Delta[j];
+			packetMins[j] = min( packetMins[j], min( ray.m_Start[j], flEnd ) - ray.m_Extents[j] - GRID_TEST_EPSILON );
+			packetMaxs[j] = max( packetMaxs[j], max( ray.m_Start[j], flEnd ) + ray.m_Extents[j] + GRID_TEST_EPSILON );
+		}
+	}
+
+	CGridEnumRays enumRays( this, listMask, m_bSSE, pIterator, pRays, nRays );
+	enumRays.SetBounds( packetMins, packetMaxs );
+
+	for ( int nLevel = 0; nLevel < m_nLevels; ++nLevel )
+	{
+		if ( !m_Levels[nLevel].m_nHandles )
+			continue;
+
+		enumRays.BeginLevel();
+		for ( i = 0; i < nRays; ++i )
+		{
+			const Ray_t &ray = pRays[i];
+			if ( ray.m_IsSwept )
+			{
+				if ( !EnumerateCellsAlongRay( nLevel, ray, &enumRays ) )
+					break;
+			}
+			else
+			{
+				Vector mins, maxs;
+				VectorSubtract( ray.m_Start, ray.m_Extents, mins );
+				VectorAdd( ray.m_Start, ray.m_Extents, maxs );
+				if ( !EnumerateCellsInBox( nLevel, mins, maxs, &enumRays ) )
+					break;
+			}
+		}
+
+		bool bContinue = true;
+		if ( enumRays.Overflowed() )
+		{
+			// Went through too many cells to keep track of, test everything
+			// on the level against the box around the packet instead
+			const GridLevel_t &level = m_Levels[nLevel];
+			for ( int j = 0; bContinue && j < level.m_Cells.Count(); ++j )
+			{
+				bContinue = enumRays.EnumerateCell( m_Cells[ level.m_Cells[j] ] );
+			}
+		}
+		else
+		{
+			bContinue = enumRays.EnumerateCells();
+		}
+
+		if ( !bContinue )
+			return;
+	}
+}
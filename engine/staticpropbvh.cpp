@@ -0,0 +1,608 @@
+//========= Copyright © 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Bounding volume hierarchy over the solid static props.  It's
+//			built top down with the surface area heuristic and flattened
+//			depth first, nodes are tested against queries with SSE.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "staticpropbvh.h"
+#include "mathlib.h"
+#include "collisionutils.h"
+#include "cmodel.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+#include "tier0/dbg.h"
+#include <float.h>
+#include <stdlib.h>
+#include <xmmintrin.h>
+
+
+// Most props in a leaf
+#define STATICPROP_BVH_LEAF_SIZE		4
+
+// Below this the nodes are split in half instead, which keeps the depth down
+// when the props are laid out badly
+#define STATICPROP_BVH_MAX_SAH_DEPTH	40
+
+// Deeper than a tree built with the above can get
+#define STATICPROP_BVH_STACK_SIZE		64
+
+// Props are put in with their boxes this much bigger, so the queries can be
+// done with SSE and a little slop instead of matching the spatial
+// partition's tests exactly.  Whatever gets the props checks them anyway.
+#define STATICPROP_BVH_BLOAT			1.0f
+
+// Rays with less than this along an axis are treated as parallel to it, like IsBoxIntersectingRay does
+#define STATICPROP_BVH_PARALLEL_EPSILON	1e-8f
+
+// Clears the w of a vector loaded with _mm_loadu_ps, that's the int after it in the nodes and props
+static const unsigned int s_BVHXYZMask[4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0 };
+
+
+//-----------------------------------------------------------------------------
+// Box test.  All the tests take the bounds of a node or a prop, and with SSE
+// they read the int after each vector.
+//-----------------------------------------------------------------------------
+class CBVHBoxTest
+{
+public:
+	CBVHBoxTest( const Vector &mins, const Vector &maxs, bool bSSE )
+	{
+		for ( int i = 0; i < 3; ++i )
+		{
+			m_Mins[i] = mins[i];
+			m_Maxs[i] = maxs[i];
+		}
+		m_Mins[3] = m_Maxs[3] = 0.0f;
+		m_bSSE = bSSE;
+	}
+
+	bool TestNode( const Vector &mins, const Vector &maxs ) const
+	{
+		if ( m_bSSE )
+		{
+			__m128 overlap = _mm_and_ps( _mm_cmple_ps( _mm_loadu_ps( &mins.x ), _mm_loadu_ps( m_Maxs ) ),
+				_mm_cmple_ps( _mm_loadu_ps( m_Mins ), _mm_loadu_ps( &maxs.x ) ) );
+			return ( _mm_movemask_ps( overlap ) & 7 ) == 7;
+		}
+
+		return ( mins.x <= m_Maxs[0] ) && ( maxs.x >= m_Mins[0] ) &&
+			( mins.y <= m_Maxs[1] ) && ( maxs.y >= m_Mins[1] ) &&
+			( mins.z <= m_Maxs[2] ) && ( maxs.z >= m_Mins[2] );
+	}
+
+	bool TestProp( const Vector &mins, const Vector &maxs ) const
+	{
+		return TestNode( mins, maxs );
+	}
+
+private:
+	float	m_Mins[4];
+	float	m_Maxs[4];
+	bool	m_bSSE;
+};
+
+
+//-----------------------------------------------------------------------------
+// Sphere test.  Nodes are only checked against the sphere's box.
+//-----------------------------------------------------------------------------
+class CBVHSphereTest
+{
+public:
+	CBVHSphereTest( const Vector &center, float radius, bool bSSE ) :
+		m_BoxTest( center - Vector( radius, radius, radius ), center + Vector( radius, radius, radius ), bSSE )
+	{
+		m_Center = center;
+		m_flRadius = radius;
+	}
+
+	bool TestNode( const Vector &mins, const Vector &maxs ) const
+	{
+		return m_BoxTest.TestNode( mins, maxs );
+	}
+
+	bool TestProp( const Vector &mins, const Vector &maxs ) const
+	{
+		return m_BoxTest.TestNode( mins, maxs ) && IsBoxIntersectingSphere( mins, maxs, m_Center, m_flRadius );
+	}
+
+private:
+	CBVHBoxTest	m_BoxTest;
+	Vector		m_Center;
+	float		m_flRadius;
+};
+
+
+//-----------------------------------------------------------------------------
+// Ray test.  Boxes are grown by the ray's extents and clipped against the
+// segment from the start to the end of the ray.
+//-----------------------------------------------------------------------------
+class CBVHRayTest
+{
+public:
+	void Init( const Ray_t &ray, bool bSSE )
+	{
+		m_bSSE = bSSE;
+		for ( int i = 0; i < 3; ++i )
+		{
+			float flEnd = ray.m_Start[i] + ray.m_Delta[i];
+			m_Start[i] = ray.m_Start[i];
+			m_Extents[i] = ray.m_Extents[i];
+			m_RayMins[i] = min( ray.m_Start[i], flEnd ) - ray.m_Extents[i];
+			m_RayMaxs[i] = max( ray.m_Start[i], flEnd ) + ray.m_Extents[i];
+
+			// The box test against the swept bounds is all there is to do on the
+			// axes the ray's parallel to.  Their t's come out as 0 and the far
+			// one is pushed out to FLT_MAX.
+			if ( FloatMakePositive( ray.m_Delta[i] ) < STATICPROP_BVH_PARALLEL_EPSILON )
+			{
+				m_InvDelta[i] = 0.0f;
+				m_ParallelFar[i] = FLT_MAX;
+			}
+			else
+			{
+				m_InvDelta[i] = 1.0f / ray.m_Delta[i];
+				m_ParallelFar[i] = -FLT_MAX;
+			}
+		}
+		m_Start[3] = m_Extents[3] = m_InvDelta[3] = m_RayMins[3] = m_RayMaxs[3] = 0.0f;
+		m_ParallelFar[3] = FLT_MAX;
+	}
+
+	bool TestNode( const Vector &mins, const Vector &maxs ) const
+	{
+		if ( m_bSSE )
+		{
+			__m128 xyz = _mm_loadu_ps( (const float*)s_BVHXYZMask );
+			__m128 boxMins = _mm_and_ps( _mm_loadu_ps( &mins.x ), xyz );
+			__m128 boxMaxs = _mm_and_ps( _mm_loadu_ps( &maxs.x ), xyz );
+
+			__m128 overlap = _mm_and_ps( _mm_cmple_ps( boxMins, _mm_loadu_ps( m_RayMaxs ) ),
+				_mm_cmple_ps( _mm_loadu_ps( m_RayMins ), boxMaxs ) );
+			if ( ( _mm_movemask_ps( overlap ) & 7 ) != 7 )
+				return false;
+
+			__m128 start = _mm_loadu_ps( m_Start );
+			__m128 extents = _mm_loadu_ps( m_Extents );
+			__m128 invDelta = _mm_loadu_ps( m_InvDelta );
+			__m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_sub_ps( boxMins, extents ), start ), invDelta );
+			__m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_add_ps( boxMaxs, extents ), start ), invDelta );
+			__m128 tnear = _mm_min_ps( t1, t2 );
+			__m128 tfar = _mm_max_ps( _mm_max_ps( t1, t2 ), _mm_loadu_ps( m_ParallelFar ) );
+
+			tnear = _mm_max_ps( tnear, _mm_shuffle_ps( tnear, tnear, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+			tnear = _mm_max_ps( tnear, _mm_shuffle_ps( tnear, tnear, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+			tfar = _mm_min_ps( tfar, _mm_shuffle_ps( tfar, tfar, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+			tfar = _mm_min_ps( tfar, _mm_shuffle_ps( tfar, tfar, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+
+			tnear = _mm_max_ss( tnear, _mm_setzero_ps() );
+			tfar = _mm_min_ss( tfar, _mm_set_ss( 1.0f ) );
+			return _mm_comile_ss( tnear, tfar ) != 0;
+		}
+
+		if ( ( mins.x > m_RayMaxs[0] ) || ( maxs.x < m_RayMins[0] ) ||
+			( mins.y > m_RayMaxs[1] ) || ( maxs.y < m_RayMins[1] ) ||
+			( mins.z > m_RayMaxs[2] ) || ( maxs.z < m_RayMins[2] ) )
+			return false;
+
+		float tmin = 0.0f;
+		float tmax = 1.0f;
+		for ( int i = 0; i < 3; ++i )
+		{
+			if ( m_InvDelta[i] == 0.0f )
+				continue;
+
+			float t1 = ( mins[i] - m_Extents[i] - m_Start[i] ) * m_InvDelta[i];
+			float t2 = ( maxs[i] + m_Extents[i] - m_Start[i] ) * m_InvDelta[i];
+			if ( t1 > t2 )
+			{
+				float temp = t1;
+				t1 = t2;
+				t2 = temp;
+			}
+			if ( t1 > tmin )
+				tmin = t1;
+			if ( t2 < tmax )
+				tmax = t2;
+			if ( tmin > tmax )
+				return false;
+		}
+		return true;
+	}
+
+	bool TestProp( const Vector &mins, const Vector &maxs ) const
+	{
+		return TestNode( mins, maxs );
+	}
+
+private:
+	float	m_Start[4];
+	float	m_Extents[4];
+	float	m_InvDelta[4];
+	float	m_ParallelFar[4];
+	float	m_RayMins[4];
+	float	m_RayMaxs[4];
+	bool	m_bSSE;
+};
+
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+CStaticPropBVH::CStaticPropBVH()
+{
+	m_nDepth = 0;
+	m_flBuildTime = 0.0f;
+	m_bSSE = false;
+	m_nQueries = m_nNodesVisited = m_nPropsTested = m_nPropsFound = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a prop, call Build when they're all in
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::AddProp( IHandleEntity *pHandleEntity, const Vector &mins, const Vector &maxs )
+{
+	Vector bloat( STATICPROP_BVH_BLOAT, STATICPROP_BVH_BLOAT, STATICPROP_BVH_BLOAT );
+
+	int i = m_Props.AddToTail();
+	m_Props[i].m_Mins = mins - bloat;
+	m_Props[i].m_Maxs = maxs + bloat;
+	m_Props[i].m_nEntity = m_Entities.AddToTail( pHandleEntity );
+	m_Props[i].m_nUnused = 0;
+}
+
+void CStaticPropBVH::Purge()
+{
+	m_Nodes.Purge();
+	m_Props.Purge();
+	m_Entities.Purge();
+	m_nDepth = 0;
+	m_flBuildTime = 0.0f;
+	m_nQueries = m_nNodesVisited = m_nPropsTested = m_nPropsFound = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Accessors
+//-----------------------------------------------------------------------------
+int CStaticPropBVH::PropCount() const
+{
+	return m_Props.Count();
+}
+
+int CStaticPropBVH::NodeCount() const
+{
+	return m_Nodes.Count();
+}
+
+int CStaticPropBVH::Depth() const
+{
+	return m_nDepth;
+}
+
+float CStaticPropBVH::BuildTime() const
+{
+	return m_flBuildTime;
+}
+
+void CStaticPropBVH::GetStats( StaticPropBVHStats_t &stats ) const
+{
+	stats.m_nQueries = m_nQueries;
+	stats.m_nNodesVisited = m_nNodesVisited;
+	stats.m_nPropsTested = m_nPropsTested;
+	stats.m_nPropsFound = m_nPropsFound;
+}
+
+void CStaticPropBVH::AddStats( int nNodesVisited, int nPropsTested, int nPropsFound ) const
+{
+	ThreadInterlockedIncrement( &m_nQueries );
+	ThreadInterlockedExchangeAdd( &m_nNodesVisited, nNodesVisited );
+	if ( nPropsTested )
+	{
+		ThreadInterlockedExchangeAdd( &m_nPropsTested, nPropsTested );
+	}
+	if ( nPropsFound )
+	{
+		ThreadInterlockedExchangeAdd( &m_nPropsFound, nPropsFound );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds the tree
+//-----------------------------------------------------------------------------
+static int s_nBVHSortAxis;
+
+static int BVHCompareProps( const void *p1, const void *p2 )
+{
+	const StaticPropBVHProp_t *pProp1 = (const StaticPropBVHProp_t*)p1;
+	const StaticPropBVHProp_t *pProp2 = (const StaticPropBVHProp_t*)p2;
+	float flCenter1 = pProp1->m_Mins[s_nBVHSortAxis] + pProp1->m_Maxs[s_nBVHSortAxis];
+	float flCenter2 = pProp2->m_Mins[s_nBVHSortAxis] + pProp2->m_Maxs[s_nBVHSortAxis];
+	if ( flCenter1 < flCenter2 )
+		return -1;
+	if ( flCenter1 > flCenter2 )
+		return 1;
+	return pProp1->m_nEntity - pProp2->m_nEntity;
+}
+
+static float BVHSurfaceArea( const Vector &mins, const Vector &maxs )
+{
+	Vector size;
+	VectorSubtract( maxs, mins, size );
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+void CStaticPropBVH::Build()
+{
+	CFastTimer timer;
+	timer.Start();
+
+	m_Nodes.RemoveAll();
+	m_nDepth = 0;
+	m_bSSE = MathLib_SSEEnabled();
+	m_nQueries = m_nNodesVisited = m_nPropsTested = m_nPropsFound = 0;
+
+	if ( m_Props.Count() )
+	{
+		m_Nodes.EnsureCapacity( 2 * m_Props.Count() );
+		BuildNode( 0, m_Props.Count(), 1 );
+	}
+
+	timer.End();
+	m_flBuildTime = timer.GetDuration().GetMillisecondsF();
+}
+
+int CStaticPropBVH::BuildNode( int nFirst, int nCount, int nDepth )
+{
+	m_nDepth = max( m_nDepth, nDepth );
+
+	Vector mins, maxs, centerMins, centerMaxs;
+	ClearBounds( mins, maxs );
+	ClearBounds( centerMins, centerMaxs );
+	int i;
+	for ( i = nFirst; i < nFirst + nCount; ++i )
+	{
+		const StaticPropBVHProp_t &prop = m_Props[i];
+		AddPointToBounds( prop.m_Mins, mins, maxs );
+		AddPointToBounds( prop.m_Maxs, mins, maxs );
+		AddPointToBounds( ( prop.m_Mins + prop.m_Maxs ) * 0.5f, centerMins, centerMaxs );
+	}
+
+	int iNode = m_Nodes.AddToTail();
+	m_Nodes[iNode].m_Mins = mins;
+	m_Nodes[iNode].m_Maxs = maxs;
+
+	if ( nCount <= STATICPROP_BVH_LEAF_SIZE )
+	{
+		m_Nodes[iNode].m_nChild = nFirst;
+		m_Nodes[iNode].m_nCount = nCount;
+		return iNode;
+	}
+
+	// Sort along the axis the centers are most spread out on
+	Vector centerSize;
+	VectorSubtract( centerMaxs, centerMins, centerSize );
+	s_nBVHSortAxis = 0;
+	if ( centerSize.y > centerSize[s_nBVHSortAxis] )
+		s_nBVHSortAxis = 1;
+	if ( centerSize.z > centerSize[s_nBVHSortAxis] )
+		s_nBVHSortAxis = 2;
+	qsort( &m_Props[nFirst], nCount, sizeof( StaticPropBVHProp_t ), BVHCompareProps );
+
+	// Split where the two halves' surface area times their prop count is the lowest
+	int nSplit = nCount / 2;
+	if ( nDepth < STATICPROP_BVH_MAX_SAH_DEPTH && centerSize[s_nBVHSortAxis] > 0.0f )
+	{
+		CUtlVector< float > rightArea;
+		rightArea.SetSize( nCount );
+
+		Vector sideMins, sideMaxs;
+		ClearBounds( sideMins, sideMaxs );
+		for ( i = nCount; --i > 0; )
+		{
+			AddPointToBounds( m_Props[nFirst + i].m_Mins, sideMins, sideMaxs );
+			AddPointToBounds( m_Props[nFirst + i].m_Maxs, sideMins, sideMaxs );
+			rightArea[i] = BVHSurfaceArea( sideMins, sideMaxs ) * ( nCount - i );
+		}
+
+		float flBestCost = FLT_MAX;
+		ClearBounds( sideMins, sideMaxs );
+		for ( i = 1; i < nCount; ++i )
+		{
+			AddPointToBounds( m_Props[nFirst + i - 1].m_Mins, sideMins, sideMaxs );
+			AddPointToBounds( m_Props[nFirst + i - 1].m_Maxs, sideMins, sideMaxs );
+			float flCost = BVHSurfaceArea( sideMins, sideMaxs ) * i + rightArea[i];
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				nSplit = i;
+			}
+		}
+	}
+
+	// The left child always comes right after its parent
+	BuildNode( nFirst, nSplit, nDepth + 1 );
+	int iRight = BuildNode( nFirst + nSplit, nCount - nSplit, nDepth + 1 );
+
+	m_Nodes[iNode].m_nChild = iRight;
+	m_Nodes[iNode].m_nCount = 0;
+	return iNode;
+}
+
+
+//-----------------------------------------------------------------------------
+// Walks the tree, enumerating every prop that passes the test
+//-----------------------------------------------------------------------------
+template< class T >
+void CStaticPropBVH::Enumerate( T &test, IPartitionEnumerator *pIterator ) const
+{
+	if ( !m_Nodes.Count() )
+		return;
+
+	const StaticPropBVHNode_t *pNodes = m_Nodes.Base();
+	const StaticPropBVHProp_t *pProps = m_Props.Base();
+
+	int nStack[STATICPROP_BVH_STACK_SIZE];
+	int nStackCount = 0;
+	int iNode = 0;
+
+	int nNodesVisited = 0;
+	int nPropsTested = 0;
+	int nPropsFound = 0;
+
+	while ( true )
+	{
+		const StaticPropBVHNode_t &node = pNodes[iNode];
+		++nNodesVisited;
+
+		if ( test.TestNode( node.m_Mins, node.m_Maxs ) )
+		{
+			if ( !node.m_nCount )
+			{
+				Assert( nStackCount < STATICPROP_BVH_STACK_SIZE );
+				nStack[nStackCount++] = node.m_nChild;
+				++iNode;
+				continue;
+			}
+
+			for ( int i = 0; i < node.m_nCount; ++i )
+			{
+				const StaticPropBVHProp_t &prop = pProps[node.m_nChild + i];
+				++nPropsTested;
+				if ( !test.TestProp( prop.m_Mins, prop.m_Maxs ) )
+					continue;
+
+				++nPropsFound;
+				if ( pIterator->EnumElement( m_Entities[prop.m_nEntity] ) == ITERATION_STOP )
+				{
+					AddStats( nNodesVisited, nPropsTested, nPropsFound );
+					return;
+				}
+			}
+		}
+
+		if ( !nStackCount )
+			break;
+		iNode = nStack[--nStackCount];
+	}
+
+	AddStats( nNodesVisited, nPropsTested, nPropsFound );
+}
+
+
+//-----------------------------------------------------------------------------
+// Queries
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::EnumerateInBox( const Vector &mins, const Vector &maxs, IPartitionEnumerator *pIterator ) const
+{
+	CBVHBoxTest test( mins, maxs, m_bSSE );
+	Enumerate( test, pIterator );
+}
+
+void CStaticPropBVH::EnumerateInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator ) const
+{
+	CBVHSphereTest test( center, radius, m_bSSE );
+	Enumerate( test, pIterator );
+}
+
+void CStaticPropBVH::EnumerateAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator ) const
+{
+	CBVHRayTest test;
+	test.Init( ray, m_bSSE );
+	Enumerate( test, pIterator );
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns which of the rays in nRayMask touch the box
+//-----------------------------------------------------------------------------
+static unsigned int BVHTestRays( const CBVHRayTest *pTests, int nRays, unsigned int nRayMask, 
+								const Vector &mins, const Vector &maxs )
+{
+	unsigned int nHitMask = 0;
+	for ( int i = 0; i < nRays; ++i )
+	{
+		if ( ( nRayMask & ( 1U << i ) ) && pTests[i].TestNode( mins, maxs ) )
+		{
+			nHitMask |= ( 1U << i );
+		}
+	}
+	return nHitMask;
+}
+
+void CStaticPropBVH::EnumerateAlongRays( const Ray_t *pRays, int nRays, IPartitionRaysEnumerator *pIterator ) const
+{
+	Assert( nRays <= MAX_PARTITION_RAYS );
+	if ( !m_Nodes.Count() || nRays <= 0 )
+		return;
+
+	CBVHRayTest tests[MAX_PARTITION_RAYS];
+	int i;
+	for ( i = 0; i < nRays; ++i )
+	{
+		tests[i].Init( pRays[i], m_bSSE );
+	}
+
+	const StaticPropBVHNode_t *pNodes = m_Nodes.Base();
+	const StaticPropBVHProp_t *pProps = m_Props.Base();
+
+	// Each node on the stack has the rays that got into its parent
+	int nStack[STATICPROP_BVH_STACK_SIZE];
+	unsigned int nStackMask[STATICPROP_BVH_STACK_SIZE];
+	int nStackCount = 0;
+	int iNode = 0;
+	unsigned int nRayMask = ( nRays == 32 ) ? 0xFFFFFFFF : ( ( 1U << nRays ) - 1 );
+
+	int nNodesVisited = 0;
+	int nPropsTested = 0;
+	int nPropsFound = 0;
+
+	while ( true )
+	{
+		const StaticPropBVHNode_t &node = pNodes[iNode];
+		++nNodesVisited;
+
+		unsigned int nHitMask = BVHTestRays( tests, nRays, nRayMask, node.m_Mins, node.m_Maxs );
+		if ( nHitMask )
+		{
+			if ( !node.m_nCount )
+			{
+				Assert( nStackCount < STATICPROP_BVH_STACK_SIZE );
+				nStack[nStackCount] = node.m_nChild;
+				nStackMask[nStackCount] = nHitMask;
+				++nStackCount;
+				++iNode;
+				nRayMask = nHitMask;
+				continue;
+			}
+
+			for ( i = 0; i < node.m_nCount; ++i )
+			{
+				const StaticPropBVHProp_t &prop = pProps[node.m_nChild + i];
+				++nPropsTested;
+				unsigned int nPropMask = BVHTestRays( tests, nRays, nHitMask, prop.m_Mins, prop.m_Maxs );
+				if ( !nPropMask )
+					continue;
+
+				++nPropsFound;
+				if ( pIterator->EnumElement( m_Entities[prop.m_nEntity], nPropMask ) == ITERATION_STOP )
+				{
+					AddStats( nNodesVisited, nPropsTested, nPropsFound );
+					return;
+				}
+			}
+		}
+
+		if ( !nStackCount )
+			break;
+		--nStackCount;
+		iNode = nStack[nStackCount];
+		nRayMask = nStackMask[nStackCount];
+	}
+
+	AddStats( nNodesVisited, nPropsTested, nPropsFound );
+}
@@ -0,0 +1,108 @@
+//========= Copyright © 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Bounding volume hierarchy over the solid static props, built once
+//			at level load.  Props never move, so unlike the spatial partition
+//			it never has to be updated.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef STATICPROPBVH_H
+#define STATICPROPBVH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "vector.h"
+#include "utlvector.h"
+#include "ispatialpartitioninternal.h"
+
+struct Ray_t;
+
+
+//-----------------------------------------------------------------------------
+// Nodes are 32 bytes, so two fit in a cache line.  The left child of an inner
+// node is always the node right after it.
+//-----------------------------------------------------------------------------
+struct StaticPropBVHNode_t
+{
+	Vector	m_Mins;
+	int		m_nChild;		// Right child of an inner node, first prop of a leaf
+	Vector	m_Maxs;
+	int		m_nCount;		// Props in a leaf, 0 for inner nodes
+};
+
+struct StaticPropBVHProp_t
+{
+	Vector	m_Mins;
+	int		m_nEntity;		// Index into m_Entities
+	Vector	m_Maxs;
+	int		m_nUnused;
+};
+
+
+//-----------------------------------------------------------------------------
+// Query counts since the BVH was built
+//-----------------------------------------------------------------------------
+struct StaticPropBVHStats_t
+{
+	int		m_nQueries;
+	int		m_nNodesVisited;
+	int		m_nPropsTested;
+	int		m_nPropsFound;
+};
+
+
+//-----------------------------------------------------------------------------
+// The BVH.  Enumerations don't change anything but the stats, so they can be
+// done from any thread.
+//-----------------------------------------------------------------------------
+class CStaticPropBVH
+{
+public:
+	CStaticPropBVH();
+
+	// Add every prop, then build it
+	void	AddProp( IHandleEntity *pHandleEntity, const Vector &mins, const Vector &maxs );
+	void	Build();
+	void	Purge();
+
+	int		PropCount() const;
+	int		NodeCount() const;
+	int		Depth() const;
+	float	BuildTime() const;		// In milliseconds
+	void	GetStats( StaticPropBVHStats_t &stats ) const;
+
+	// Props that can touch these are enumerated, with a bit of slop.  They
+	// don't come out in any particular order.
+	void	EnumerateInBox( const Vector &mins, const Vector &maxs, IPartitionEnumerator *pIterator ) const;
+	void	EnumerateInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator ) const;
+	void	EnumerateAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator ) const;
+
+	// Walks the tree once for up to MAX_PARTITION_RAYS rays, with a bit set in
+	// the ray mask for each ray that can touch the prop
+	void	EnumerateAlongRays( const Ray_t *pRays, int nRays, IPartitionRaysEnumerator *pIterator ) const;
+
+private:
+	int		BuildNode( int nFirst, int nCount, int nDepth );
+	void	AddStats( int nNodesVisited, int nPropsTested, int nPropsFound ) const;
+
+	template< class T > void Enumerate( T &test, IPartitionEnumerator *pIterator ) const;
+
+	CUtlVector< StaticPropBVHNode_t >	m_Nodes;
+	CUtlVector< StaticPropBVHProp_t >	m_Props;
+	CUtlVector< IHandleEntity* >		m_Entities;
+
+	int		m_nDepth;
+	float	m_flBuildTime;
+	bool	m_bSSE;
+
+	// Stats, updated with interlocked adds
+	mutable long volatile m_nQueries;
+	mutable long volatile m_nNodesVisited;
+	mutable long volatile m_nPropsTested;
+	mutable long volatile m_nPropsFound;
+};
+
+
+#endif // STATICPROPBVH_H
@@ -15,6 +15,7 @@
 //=============================================================================
 
 #include "staticpropmgr.h"
+#include "staticpropbvh.h"
 #include "convar.h"
 #include "vcollide_parse.h"
 #include "engine/icollideable.h"
@@ -45,6 +46,7 @@ static ConVar r_DrawSpecificStaticProp( "r_DrawSpecificStaticProp", "-1" );
 static ConVar r_drawstaticprops( "r_drawstaticprops", "1" );
 static ConVar r_colorstaticprops( "r_colorstaticprops", "0" );
 static ConVar vcollide_wireframe( "vcollide_wireframe", "0" );
+static ConVar staticprop_bvh( "staticprop_bvh", "1", 0, "Put solid static props in a BVH for traces instead of the spatial partition's solid lists, takes effect on the next map" );
 #ifdef _DEBUG
 static ConVar r_DrawWrongStaticProp( "r_DrawWrongStaticProp", "1" ); // VXP
 #endif
@@ -170,9 +172,12 @@ public:
 public:
 	bool Init( int index, StaticPropLump_t &lump, model_t *pModel );
 
-	// KD Tree
-	void InsertPropIntoKDTree();
+	// KD Tree.  Props that go in the BVH are only put in the static prop lists.
+	void InsertPropIntoKDTree( bool bSolidLists );
 	void RemovePropFromKDTree();
+	bool IsInKDTree() const;
+	const Vector& KDTreeMins() const;
+	const Vector& KDTreeMaxs() const;
 
 	void PrecacheLighting( );
 	void RecomputeStaticLighting( );
@@ -195,6 +200,8 @@ private:
 	QAngle					m_Angles;
 	model_t*				m_pModel;
 	SpatialPartitionHandle_t	m_Partition;
+	Vector					m_KDTreeMins;	// Bounds it's in the KD tree with
+	Vector					m_KDTreeMaxs;
 	ModelInstanceHandle_t	m_ModelInstance;
 	unsigned char			m_Alpha;
 	unsigned char			m_nSolidType;
@@ -242,6 +249,11 @@ public:
 	virtual bool IsStaticProp( IHandleEntity *pHandleEntity ) const;
 	virtual bool IsStaticProp( CBaseHandle handle ) const;
 	virtual int GetStaticPropIndex( IHandleEntity *pHandleEntity ) const;
+	virtual bool HasPropBVH() const;
+	virtual void EnumerateSolidPropsAtPoint( const Vector &pt, IPartitionEnumerator *pIterator );
+	virtual void EnumerateSolidPropsInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator );
+	virtual void EnumerateSolidPropsAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator );
+	virtual void EnumerateSolidPropsAlongRays( const Ray_t *pRays, int nRays, IPartitionRaysEnumerator *pIterator );
 
 	// methods of IStaticPropMgrClient
 	virtual void ComputePropOpacity( const Vector &viewOrigin );
@@ -256,6 +268,9 @@ public:
 
 	// methods of IStaticPropMgrServer
 
+	// For prop_crosshair
+	void PrintPropBVHStats( void );
+
 private:
 	void OutputLevelStats( void );
  	void PrecacheLighting( );
@@ -292,6 +307,10 @@ private:
 	// Static props that fade...
 	CUtlVector<StaticPropFade_t>	m_StaticPropFade;
 
+	// Solid static props, when staticprop_bvh was on at level load
+	CStaticPropBVH					m_PropBVH;
+	bool							m_bUsePropBVH;
+
 	bool							m_bLevelInitialized;
 	bool							m_bClientInitialized;
 };
@@ -860,7 +879,7 @@ int CStaticProp::DrawModel( int flags )
 //-----------------------------------------------------------------------------
 // KD Tree
 //-----------------------------------------------------------------------------
-void CStaticProp::InsertPropIntoKDTree()
+void CStaticProp::InsertPropIntoKDTree( bool bSolidLists )
 {
 	Assert( m_Partition == PARTITION_INVALID_HANDLE );
 	if ( m_nSolidType == SOLID_NONE )
@@ -895,10 +914,14 @@ void CStaticProp::InsertPropIntoKDTree()
 	}
 
 	// add the entity to the KD tree so we will collide against it
-	m_Partition = SpatialPartition()->CreateHandle( this, 
-		PARTITION_CLIENT_SOLID_EDICTS | PARTITION_CLIENT_STATIC_PROPS | 
-		PARTITION_ENGINE_SOLID_EDICTS | PARTITION_ENGINE_STATIC_PROPS, 
-		mins, maxs );
+	SpatialPartitionListMask_t listMask = PARTITION_CLIENT_STATIC_PROPS | PARTITION_ENGINE_STATIC_PROPS;
+	if ( bSolidLists )
+	{
+		listMask |= PARTITION_CLIENT_SOLID_EDICTS | PARTITION_ENGINE_SOLID_EDICTS;
+	}
+	m_Partition = SpatialPartition()->CreateHandle( this, listMask, mins, maxs );
+	m_KDTreeMins = mins;
+	m_KDTreeMaxs = maxs;
 
 	Assert( m_Partition != PARTITION_INVALID_HANDLE );
 }
@@ -913,6 +936,21 @@ void CStaticProp::RemovePropFromKDTree()
 	}
 }
 
+inline bool CStaticProp::IsInKDTree() const
+{
+	return m_Partition != PARTITION_INVALID_HANDLE;
+}
+
+inline const Vector& CStaticProp::KDTreeMins() const
+{
+	return m_KDTreeMins;
+}
+
+inline const Vector& CStaticProp::KDTreeMaxs() const
+{
+	return m_KDTreeMaxs;
+}
+
 
 //-----------------------------------------------------------------------------
 // Create VPhysics representation
@@ -1003,6 +1041,7 @@ CStaticPropMgr::CStaticPropMgr()
 {
 	m_bLevelInitialized = false;
 	m_bClientInitialized = false;
+	m_bUsePropBVH = false;
 }
 
 CStaticPropMgr::~CStaticPropMgr()
@@ -1109,7 +1148,24 @@ void CStaticPropMgr::UnserializeModels( CUtlBuffer& buf )
 		}
 
 		// Add the prop to the K-D tree for collision
-		m_StaticProps[i].InsertPropIntoKDTree( );
+		m_StaticProps[i].InsertPropIntoKDTree( !m_bUsePropBVH );
+	}
+
+	// Build the BVH over the ones that went in the KD tree
+	if ( m_bUsePropBVH )
+	{
+		for ( int iProp = 0; iProp < count; ++iProp )
+		{
+			CStaticProp &prop = m_StaticProps[iProp];
+			if ( prop.IsInKDTree() )
+			{
+				m_PropBVH.AddProp( &prop, prop.KDTreeMins(), prop.KDTreeMaxs() );
+			}
+		}
+		m_PropBVH.Build();
+
+		DevMsg( "Static prop BVH: %d props, %d nodes, depth %d, built in %.2f ms\n", 
+			m_PropBVH.PropCount(), m_PropBVH.NodeCount(), m_PropBVH.Depth(), m_PropBVH.BuildTime() );
 	}
 }
 
@@ -1180,6 +1236,7 @@ void CStaticPropMgr::LevelInit()
 	m_bLevelInitialized = true;
 
 	// Read in static props that have been compiled into the bsp file
+	m_bUsePropBVH = staticprop_bvh.GetBool();
 	UnserializeStaticProps();
 
 	//	OutputLevelStats();
@@ -1251,9 +1308,11 @@ void CStaticPropMgr::LevelShutdown()
 		modelloader->ReleaseModel( m_StaticPropDict[i].m_pModel, IModelLoader::FMODELLOADER_STATICPROP );
 	}
 
+	m_PropBVH.Purge();
 	m_StaticProps.Purge();
 	m_StaticPropDict.Purge();
 	m_StaticPropFade.Purge();
+	m_bUsePropBVH = false;
 }
 
 
@@ -1318,6 +1377,66 @@ int CStaticPropMgr::GetStaticPropIndex( IHandleEntity *pHandleEntity ) const
 }
 
 
+//-----------------------------------------------------------------------------
+// Solid props in the BVH
+//-----------------------------------------------------------------------------
+bool CStaticPropMgr::HasPropBVH() const
+{
+	return m_bUsePropBVH;
+}
+
+void CStaticPropMgr::EnumerateSolidPropsAtPoint( const Vector &pt, IPartitionEnumerator *pIterator )
+{
+	if ( m_bUsePropBVH )
+	{
+		m_PropBVH.EnumerateInBox( pt, pt, pIterator );
+	}
+}
+
+void CStaticPropMgr::EnumerateSolidPropsInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator )
+{
+	if ( m_bUsePropBVH )
+	{
+		m_PropBVH.EnumerateInSphere( center, radius, pIterator );
+	}
+}
+
+void CStaticPropMgr::EnumerateSolidPropsAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator )
+{
+	if ( m_bUsePropBVH )
+	{
+		m_PropBVH.EnumerateAlongRay( ray, pIterator );
+	}
+}
+
+void CStaticPropMgr::EnumerateSolidPropsAlongRays( const Ray_t *pRays, int nRays, IPartitionRaysEnumerator *pIterator )
+{
+	if ( m_bUsePropBVH )
+	{
+		m_PropBVH.EnumerateAlongRays( pRays, nRays, pIterator );
+	}
+}
+
+void CStaticPropMgr::PrintPropBVHStats( void )
+{
+	if ( !m_bUsePropBVH )
+	{
+		Msg( "no static prop BVH, staticprop_bvh was 0 when the level was loaded\n" );
+		return;
+	}
+
+	StaticPropBVHStats_t stats;
+	m_PropBVH.GetStats( stats );
+
+	Msg( "static prop BVH: %d props, %d nodes, depth %d, built in %.2f ms\n", 
+		m_PropBVH.PropCount(), m_PropBVH.NodeCount(), m_PropBVH.Depth(), m_PropBVH.BuildTime() );
+
+	float flQueries = stats.m_nQueries ? (float)stats.m_nQueries : 1.0f;
+	Msg( "%d queries since then: %.1f nodes visited, %.1f props tested, %.1f props found per query\n",
+		stats.m_nQueries, stats.m_nNodesVisited / flQueries, stats.m_nPropsTested / flQueries, stats.m_nPropsFound / flQueries );
+}
+
+
 //-----------------------------------------------------------------------------
 // Compute static lighting
 //-----------------------------------------------------------------------------
@@ -1595,6 +1714,8 @@ void Cmd_PropCrosshair_f (void)
 		Msg( "hit prop %d\n", tr.hitbox + 1 );
 	else
 		Msg( "didn't hit a prop\n" );
+
+	s_StaticPropMgr.PrintPropBVHStats();
 }
 
 static ConCommand prop_crosshair( "prop_crosshair", Cmd_PropCrosshair_f );
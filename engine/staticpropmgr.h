@@ -28,6 +28,8 @@
 // foward declarations
 //-----------------------------------------------------------------------------
 class ICollideable;
+class IPartitionEnumerator;
+class IPartitionRaysEnumerator;
 FORWARD_DECLARE_HANDLE( LightCacheHandle_t );
 
 
@@ -71,6 +73,16 @@ public:
 
 	// Returns the static prop index (useful for networking)
 	virtual int GetStaticPropIndex( IHandleEntity *pHandleEntity ) const = 0;
+
+	// With staticprop_bvh, solid static props go in a BVH at level load instead
+	// of the spatial partition's solid edict lists (they're still in its static
+	// prop lists).  Anything looking for solids has to look here as well, these
+	// don't find anything when there's no BVH.
+	virtual bool HasPropBVH() const = 0;
+	virtual void EnumerateSolidPropsAtPoint( const Vector &pt, IPartitionEnumerator *pIterator ) = 0;
+	virtual void EnumerateSolidPropsInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator ) = 0;
+	virtual void EnumerateSolidPropsAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator ) = 0;
+	virtual void EnumerateSolidPropsAlongRays( const Ray_t *pRays, int nRays, IPartitionRaysEnumerator *pIterator ) = 0;
 };
 
 
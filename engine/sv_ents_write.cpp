@@ -18,6 +18,7 @@
 #include "net_synctags.h"
 #include "dt_instrumentation_server.h"
 #include "LocalNetworkBackdoor.h"
+#include "tier0/threadtools.h"
 
 
 extern ConVar g_CV_DTWatchEnt;
@@ -45,6 +46,278 @@ public:
 
 static CUtlLinkedList<CChangeTrack*, int> g_Tracks;
 
+// SV_CreatePacketEntities can run on the worker threads, so all access to g_Tracks goes through this.
+static CThreadMutex g_TracksMutex;
+
+
+//-----------------------------------------------------------------------------
+// Shared delta cache.
+//
+// Clients that acked the same tick get identical prop deltas for an entity unless
+// a send proxy treats them differently. The first client to write a given
+// (entity, from tick, to tick, proxy recipients) delta stores the bits here and
+// the other clients splice them into their packets with WriteBits.
+//-----------------------------------------------------------------------------
+
+static ConVar sv_deltacache( "sv_deltacache", "1", 0, "Share encoded entity deltas between clients that acked the same tick." );
+
+struct DeltaCacheKey_t
+{
+	int				m_iEntity;
+	int				m_iFromTick;		// -1 when deltaing from the baseline.
+	int				m_iToTick;
+	unsigned long	m_OldRecipients;	// Bit N set if the client is in the Nth proxy's recipients.
+	unsigned long	m_NewRecipients;
+};
+
+class CDeltaCache
+{
+public:
+				CDeltaCache();
+
+	// If the delta is cached, append it to pOut and return true.
+	bool		Lookup( const DeltaCacheKey_t &key, bf_write *pOut );
+
+	// Store nBits of pSrc, starting at iStartBit, under key.
+	void		Add( const DeltaCacheKey_t &key, bf_write *pSrc, int iStartBit );
+
+	// Stats accumulate for the life of the server and are printed with the sv_deltatime report.
+	void		PrintStats();
+	void		ResetStats();
+
+private:
+	// The cache is split by entity index so the worker threads, which are each on a
+	// different client and usually a different entity, rarely want the same lock.
+	enum
+	{
+		NUM_SHARDS = 64,						// Must be a power of two.
+		HASH_SIZE = 8192 / NUM_SHARDS,			// Per shard, must be a power of two.
+		DATA_SIZE = 2 * 1024 * 1024 / NUM_SHARDS
+	};
+
+	struct Entry_t
+	{
+		DeltaCacheKey_t	m_Key;
+		int				m_iDataOffset;	// Byte offset into m_Data.
+		int				m_nBits;
+	};
+
+	struct Shard_t
+	{
+		Entry_t			m_Entries[HASH_SIZE];
+		unsigned char	m_Data[DATA_SIZE];
+		int				m_nDataUsed;
+		int				m_nEntries;
+		int				m_iCurTick;
+
+		int				m_nLookups;
+		int				m_nHits;
+		double			m_flBytesSaved;
+
+		CThreadMutex	m_Mutex;
+	};
+
+	Shard_t*	GetShard( const DeltaCacheKey_t &key );
+	void		ResetForTick( Shard_t *pShard, int iToTick );
+	int			FindSlot( const Shard_t *pShard, const DeltaCacheKey_t &key ) const;
+
+	Shard_t			m_Shards[NUM_SHARDS];
+};
+
+static CDeltaCache g_DeltaCache;
+
+
+static inline bool SV_DeltaCacheKeysEqual( const DeltaCacheKey_t &a, const DeltaCacheKey_t &b )
+{
+	// Field by field, the struct can have padding.
+	return a.m_iEntity == b.m_iEntity &&
+		a.m_iFromTick == b.m_iFromTick &&
+		a.m_iToTick == b.m_iToTick &&
+		a.m_OldRecipients == b.m_OldRecipients &&
+		a.m_NewRecipients == b.m_NewRecipients;
+}
+
+
+CDeltaCache::CDeltaCache()
+{
+	for ( int i=0; i < NUM_SHARDS; i++ )
+	{
+		Shard_t *pShard = &m_Shards[i];
+		pShard->m_iCurTick = -1;
+		pShard->m_nDataUsed = 0;
+		pShard->m_nEntries = 0;
+		memset( pShard->m_Entries, 0xFF, sizeof( pShard->m_Entries ) );
+	}
+	ResetStats();
+}
+
+
+inline CDeltaCache::Shard_t* CDeltaCache::GetShard( const DeltaCacheKey_t &key )
+{
+	return &m_Shards[ key.m_iEntity & ( NUM_SHARDS - 1 ) ];
+}
+
+
+void CDeltaCache::ResetForTick( Shard_t *pShard, int iToTick )
+{
+	if ( pShard->m_iCurTick == iToTick )
+		return;
+
+	pShard->m_iCurTick = iToTick;
+	pShard->m_nDataUsed = 0;
+	pShard->m_nEntries = 0;
+	memset( pShard->m_Entries, 0xFF, sizeof( pShard->m_Entries ) );
+}
+
+
+int CDeltaCache::FindSlot( const Shard_t *pShard, const DeltaCacheKey_t &key ) const
+{
+	// The low bits of the entity index picked the shard, so leave them out of the hash.
+	unsigned long hash = (unsigned long)( key.m_iEntity / NUM_SHARDS ) * 2654435761UL;
+	hash ^= (unsigned long)key.m_iFromTick * 40503UL;
+	hash ^= key.m_OldRecipients ^ ( key.m_NewRecipients << 1 );
+
+	int iSlot = (int)( hash & ( HASH_SIZE - 1 ) );
+	for ( ;; )
+	{
+		const Entry_t *pEntry = &pShard->m_Entries[iSlot];
+		if ( pEntry->m_Key.m_iEntity == -1 || SV_DeltaCacheKeysEqual( pEntry->m_Key, key ) )
+			return iSlot;
+
+		iSlot = ( iSlot + 1 ) & ( HASH_SIZE - 1 );
+	}
+}
+
+
+bool CDeltaCache::Lookup( const DeltaCacheKey_t &key, bf_write *pOut )
+{
+	Shard_t *pShard = GetShard( key );
+
+	CThreadAutoLock lock( pShard->m_Mutex );
+	ResetForTick( pShard, key.m_iToTick );
+
+	++pShard->m_nLookups;
+
+	const Entry_t *pEntry = &pShard->m_Entries[ FindSlot( pShard, key ) ];
+	if ( pEntry->m_Key.m_iEntity == -1 )
+		return false;
+
+	pOut->WriteBits( &pShard->m_Data[pEntry->m_iDataOffset], pEntry->m_nBits );
+
+	++pShard->m_nHits;
+	pShard->m_flBytesSaved += pEntry->m_nBits / 8.0;
+	return true;
+}
+
+
+void CDeltaCache::Add( const DeltaCacheKey_t &key, bf_write *pSrc, int iStartBit )
+{
+	int nBits = pSrc->GetNumBitsWritten() - iStartBit;
+	if ( pSrc->IsOverflowed() || nBits <= 0 )
+		return;
+
+	Shard_t *pShard = GetShard( key );
+
+	CThreadAutoLock lock( pShard->m_Mutex );
+	ResetForTick( pShard, key.m_iToTick );
+
+	// Keep the table at most half full so the probes stay short.
+	int nBytes = PAD_NUMBER( BitByte( nBits ), 4 );
+	if ( pShard->m_nEntries >= HASH_SIZE / 2 || pShard->m_nDataUsed + nBytes > DATA_SIZE )
+		return;
+
+	Entry_t *pEntry = &pShard->m_Entries[ FindSlot( pShard, key ) ];
+	if ( pEntry->m_Key.m_iEntity != -1 )
+		return;	// Another thread beat us to it.
+
+	bf_read src( "CDeltaCache::Add", pSrc->GetData(), pSrc->GetNumBytesWritten() );
+	src.Seek( iStartBit );
+
+	bf_write dest( "CDeltaCache::Add", &pShard->m_Data[pShard->m_nDataUsed], nBytes );
+	dest.WriteBitsFromBuffer( &src, nBits );
+
+	pEntry->m_Key = key;
+	pEntry->m_iDataOffset = pShard->m_nDataUsed;
+	pEntry->m_nBits = nBits;
+
+	pShard->m_nDataUsed += nBytes;
+	++pShard->m_nEntries;
+}
+
+
+void CDeltaCache::PrintStats()
+{
+	int nLookups = 0;
+	int nHits = 0;
+	double flBytesSaved = 0;
+	for ( int i=0; i < NUM_SHARDS; i++ )
+	{
+		Shard_t *pShard = &m_Shards[i];
+
+		CThreadAutoLock lock( pShard->m_Mutex );
+		nLookups += pShard->m_nLookups;
+		nHits += pShard->m_nHits;
+		flBytesSaved += pShard->m_flBytesSaved;
+	}
+
+	Con_Printf( "Delta cache: %d lookups, %d hits (%.1f%%), %.1fk saved\n\n",
+		nLookups,
+		nHits,
+		nLookups ? nHits * 100.0f / nLookups : 0.0f,
+		flBytesSaved / 1024.0 );
+}
+
+
+void CDeltaCache::ResetStats()
+{
+	for ( int i=0; i < NUM_SHARDS; i++ )
+	{
+		Shard_t *pShard = &m_Shards[i];
+
+		CThreadAutoLock lock( pShard->m_Mutex );
+		pShard->m_nLookups = 0;
+		pShard->m_nHits = 0;
+		pShard->m_flBytesSaved = 0;
+	}
+}
+
+
+static inline unsigned long SV_GetRecipientMask( const CSendProxyRecipients *pRecipients, int nRecipients, int iClient )
+{
+	Assert( nRecipients <= 32 );
+
+	unsigned long mask = 0;
+	for ( int i=0; i < nRecipients; i++ )
+	{
+		if ( pRecipients[i].m_Bits.Get( iClient ) )
+			mask |= ( 1UL << i );
+	}
+	return mask;
+}
+
+
+// Fills in the cache key for writing pTo's props as a delta from pFrom (NULL for a baseline).
+// Returns false if the delta shouldn't be cached.
+static bool SV_SetupDeltaCacheKey( 
+	DeltaCacheKey_t &key, 
+	int iClient,
+	int iFromTick, 
+	int iToTick, 
+	const PackedEntity *pFrom, 
+	const PackedEntity *pTo )
+{
+	// The instrumentation and dtwatchent both want to see every write.
+	if ( !sv_deltacache.GetInt() || g_bServerDTIEnabled || g_CV_DTWatchEnt.GetInt() != -1 )
+		return false;
+
+	key.m_iEntity = pTo->m_nEntityIndex;
+	key.m_iFromTick = iFromTick;
+	key.m_iToTick = iToTick;
+	key.m_OldRecipients = pFrom ? SV_GetRecipientMask( pFrom->GetRecipients(), pFrom->GetNumRecipients(), iClient ) : 0;
+	key.m_NewRecipients = SV_GetRecipientMask( pTo->GetRecipients(), pTo->GetNumRecipients(), iClient );
+	return true;
+}
+
 
 // These are the main variables used by the SV_CreatePacketEntities function.
 // The function is split up into multiple smaller ones and they pass this structure around.
@@ -84,7 +357,7 @@ public:
 // Delta timing helpers.
 //-----------------------------------------------------------------------------
 
-CChangeTrack* GetChangeTrack( const char *pName )
+static CChangeTrack* FindOrAddChangeTrack( const char *pName )
 {
 	FOR_EACH_LL( g_Tracks, i )
 	{
@@ -105,8 +378,33 @@ CChangeTrack* GetChangeTrack( const char *pName )
 }
 
 
+CChangeTrack* GetChangeTrack( const char *pName )
+{
+	CThreadAutoLock lock( g_TracksMutex );
+	return FindOrAddChangeTrack( pName );
+}
+
+
+// Accumulates one CalcDelta sample for the class. Safe to call from any thread.
+static void AddChangeTrackSample( const char *pName, bool bChanged, const CCycleCount &calcDelta, const CCycleCount &encode )
+{
+	CThreadAutoLock lock( g_TracksMutex );
+
+	CChangeTrack *pTrack = FindOrAddChangeTrack( pName );
+	if ( bChanged )
+		++pTrack->m_nChanged;
+	else
+		++pTrack->m_nUnchanged;
+
+	CCycleCount::Add( pTrack->m_Count, calcDelta, pTrack->m_Count );
+	CCycleCount::Add( pTrack->m_EncodeCount, encode, pTrack->m_EncodeCount );
+}
+
+
 void PrintChangeTracks()
 {
+	CThreadAutoLock lock( g_TracksMutex );
+
 	Con_Printf( "\n\n" );
 	Con_Printf( "------------------------------------------------------------------------\n" );
 	Con_Printf( "CalcDelta MS / %% time / Encode MS / # Changed / # Unchanged / Class Name\n" );
@@ -137,6 +435,18 @@ void PrintChangeTracks()
 	Con_Printf( "\n\n" );
 	Con_Printf( "Total CalcDelta MS: %.2f\n\n", total.GetMillisecondsF() );
 	Con_Printf( "Total Encode    MS: %.2f\n\n", encodeTotal.GetMillisecondsF() );
+
+	g_DeltaCache.PrintStats();
+}
+
+
+void SV_CheckDeltaPrint()
+{
+	if ( sv_deltatime.GetInt() && sv_deltaprint.GetInt() )
+	{
+		PrintChangeTracks();
+		sv_deltaprint.SetValue( 0 );
+	}
 }
 
 
@@ -256,6 +566,33 @@ static inline int SV_WriteDeltaHeader(
 }
 
 
+// Entity props are encoded into a buffer this size first so their length can be written
+// in front of them.
+#define ENTITY_PROPS_BUFFER_SIZE	PAD_NUMBER( ( ENTITY_PROPS_MAX_BITS + 7 ) / 8, 4 )
+
+static inline void SV_WriteEntityProps( CEntityWriteInfo &u, int entnum, bf_write *pProps )
+{
+	int nBits = pProps->GetNumBitsWritten();
+	if ( pProps->IsOverflowed() || nBits > ENTITY_PROPS_MAX_BITS )
+	{
+		Host_Error( "SV_WriteEntityProps: props for ent %d overflowed.\n", entnum );
+	}
+
+	if ( nBits < ( 1 << ENTITY_PROPS_SHORT_BITS ) )
+	{
+		u.m_pBuf->WriteOneBit( 0 );
+		u.m_pBuf->WriteUBitLong( nBits, ENTITY_PROPS_SHORT_BITS );
+	}
+	else
+	{
+		u.m_pBuf->WriteOneBit( 1 );
+		u.m_pBuf->WriteUBitLong( nBits, ENTITY_PROPS_LONG_BITS );
+	}
+
+	u.m_pBuf->WriteBits( pProps->GetBasePointer(), nBits );
+}
+
+
 // Calculates the delta between the two states and writes the delta and the new properties
 // into u.m_pBuf. Returns false if the states are the same.
 //
@@ -271,9 +608,26 @@ static void SV_CalcDeltaAndWriteProps(
 	PackedEntity *pTo
 	)
 {
+	char propsData[ENTITY_PROPS_BUFFER_SIZE];
+	bf_write props( "SV_CalcDeltaAndWriteProps->props", propsData, sizeof( propsData ) );
+
+	// Every client that gets this entity from the same baseline this tick gets the same props.
+	DeltaCacheKey_t cacheKey;
+	bool bCache = SV_SetupDeltaCacheKey( cacheKey, u.m_pClient - svs.clients, -1, u.m_pToSnapshot->m_nTickNumber, NULL, pTo );
+	if ( bCache && g_DeltaCache.Lookup( cacheKey, &props ) )
+	{
+		SV_WriteEntityProps( u, pTo->m_nEntityIndex, &props );
+		return;
+	}
+
 	// Calculate the delta props.
 	int deltaProps[MAX_DATATABLE_PROPS];
-	void *pToData = pTo->LockData();
+	void *pToData = pTo->GetData();
+
+	bool bDeltaTime = sv_deltatime.GetInt() != 0;
+	CFastTimer calcDeltaTimer;
+	if ( bDeltaTime )
+		calcDeltaTimer.Start();
 
 	int nDeltaProps = SendTable_CalcDelta(
 		pTo->m_pSendTable, 
@@ -289,7 +643,12 @@ static void SV_CalcDeltaAndWriteProps(
 		
 		pTo->m_nEntityIndex	);
 
-	
+	CFastTimer encodeTimer;
+	if ( bDeltaTime )
+	{
+		calcDeltaTimer.End();
+		encodeTimer.Start();
+	}
 
 	// Cull out props given what the proxies say.
 	int culledProps[MAX_DATATABLE_PROPS];
@@ -321,13 +680,24 @@ static void SV_CalcDeltaAndWriteProps(
 		pToData,				// object data
 		pTo->GetNumBits(),
 
-		u.m_pBuf,				// output buffer
+		&props,					// output buffer
 
 		pTo->m_nEntityIndex,
 		culledProps,
 		nCulledProps );
 
-	pTo->UnlockData();
+	if ( bDeltaTime )
+	{
+		encodeTimer.End();
+		AddChangeTrackSample( pTo->m_pSendTable->GetName(), nDeltaProps != 0, calcDeltaTimer.GetDuration(), encodeTimer.GetDuration() );
+	}
+
+	if ( bCache )
+	{
+		g_DeltaCache.Add( cacheKey, &props, 0 );
+	}
+
+	SV_WriteEntityProps( u, pTo->m_nEntityIndex, &props );
 }
 
 
@@ -354,7 +724,18 @@ static inline void SV_WritePropsFromPackedEntity(
 		}
 	}
 
-	void *pToData = pTo->LockData();
+	char propsData[ENTITY_PROPS_BUFFER_SIZE];
+	bf_write props( "SV_WritePropsFromPackedEntity->props", propsData, sizeof( propsData ) );
+
+	DeltaCacheKey_t cacheKey;
+	bool bCache = SV_SetupDeltaCacheKey( cacheKey, u.m_pClient - svs.clients, u.m_pFromSnapshot->m_nTickNumber, u.m_pToSnapshot->m_nTickNumber, pFrom, pTo );
+	if ( bCache && g_DeltaCache.Lookup( cacheKey, &props ) )
+	{
+		SV_WriteEntityProps( u, pTo->m_nEntityIndex, &props );
+		return;
+	}
+
+	void *pToData = pTo->GetData();
 
 	// Cull out the properties that their proxies said not to send to this client.
 	int culledProps[MAX_DATATABLE_PROPS];
@@ -379,14 +760,19 @@ static inline void SV_WritePropsFromPackedEntity(
 		pTo->m_pSendTable, 
 		pToData,
 		pTo->GetNumBits(),
-		u.m_pBuf, 
+		&props, 
 		pTo->m_nEntityIndex,
 		
 		culledProps,
 		nCulledProps
 		);
 
-	pTo->UnlockData();
+	if ( bCache )
+	{
+		g_DeltaCache.Add( cacheKey, &props, 0 );
+	}
+
+	SV_WriteEntityProps( u, pTo->m_nEntityIndex, &props );
 }
 
 
@@ -31,5 +31,8 @@ void SV_DereferenceUnusedSnapshots( client_t *client, int start );
 // frames older than host_framecount because you can't delta from those frames anymore.
 bool SV_IsClientDeltaSequenceValid( client_t *pClient );
 
+// Prints the sv_deltatime stats if sv_deltaprint is set. Must be called from the main thread.
+void SV_CheckDeltaPrint();
+
 
 #endif // SV_ENTS_WRITE_H
@@ -10,11 +10,22 @@
 #include "edict.h"
 #include "const.h"
 #include "utllinkedlist.h"
+#include "utlvector.h"
 #include "sys_dll.h"
+#include "packed_entity.h"
 
 
 DEFINE_FIXEDSIZE_ALLOCATOR( CFrameSnapshot, 64, 64 );
 
+static ConVar sv_snapshotarena( "sv_snapshotarena", "1", 0, "Pack each tick's entities into one arena that is freed with the snapshot." );
+
+// Snapshots live in a ring indexed by tick, so taking a snapshot and reclaiming the
+// released ones never walks a list. 256 ticks covers every delta base a client at a
+// normal update rate can ack. A snapshot still referenced when its slot comes around
+// again (a client with a very old delta base) moves to m_EvictedSnapshots.
+#define SNAPSHOT_RING_SIZE	256
+#define SNAPSHOT_RING_MASK	( SNAPSHOT_RING_SIZE - 1 )
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -42,16 +53,36 @@ public:
 	virtual bool			UsePreviouslySentPacket( CFrameSnapshot* pSnapshot, int entity, int entSerialNumber );
 	virtual PackedEntity*	GetPreviouslySentPacket( int iEntity, int iSerialNumber );
 
+	// Prints the memory used by each snapshot's packed entities.
+	void	PrintMemoryStats();
+
 private:
 	void	DestroyPackedEntity( PackedEntityHandle_t handle );
+	void	ReclaimSnapshots();
 	void	DeleteFrameSnapshot( CFrameSnapshot* pSnapshot );
+	void	CompactArenas( PackedDataArena *pArena );
+	void	PrintSnapshotMemory( CFrameSnapshot *pSnapshot, int &nSnapshotArenas, unsigned long &nTotalUsed );
 	
-	CUtlLinkedList<CFrameSnapshot*, unsigned short>			m_FrameSnapshots;
+	CFrameSnapshot*			m_pTickRing[ SNAPSHOT_RING_SIZE ];
+	CUtlVector<CFrameSnapshot*>	m_EvictedSnapshots;
+	int						m_nSnapshots;
+	int						m_nNewestTick;
+
+	// Bumped by CFrameSnapshot::ReleaseReference when a snapshot loses its last reference.
+	// The snapshot itself is deleted by ReclaimSnapshots on the main thread, so snapshots,
+	// m_PackedEntities and the packed entity reference counts are only ever changed there
+	// and the worker threads never need a lock.
+	long volatile			m_nUnreferencedSnapshots;
+
 	CUtlLinkedList< PackedEntity, PackedEntityHandle_t >	m_PackedEntities; 
 
 	// The most recently sent packets for each entity
 	PackedEntityHandle_t	m_pPackedData[ MAX_EDICTS ];
 	byte					m_pSerialNumber[ MAX_EDICTS ];
+
+	// Set when a snapshot is deleted while packed entities in newer snapshots (or the
+	// most recently sent list) still have data in its arena.
+	bool					m_bCompactArenas;
 };
 
 // Expose interface
@@ -63,7 +94,12 @@ IFrameSnapshot *framesnapshot = ( IFrameSnapshot * )&g_FrameSnapshotManager;
 //-----------------------------------------------------------------------------
 CFrameSnapshotManager::CFrameSnapshotManager( void )
 {
+	memset( m_pTickRing, 0, sizeof( m_pTickRing ) );
+	m_nSnapshots = 0;
+	m_nNewestTick = 0;
+	m_nUnreferencedSnapshots = 0;
 	memset( m_pPackedData, 0xFF, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
+	m_bCompactArenas = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -79,7 +115,7 @@ CFrameSnapshotManager::~CFrameSnapshotManager( void )
 	}
 	else
 	{
-		Assert( m_FrameSnapshots.Count() == 0 );
+		Assert( m_nSnapshots == 0 );
 	}
 #endif
 }
@@ -90,12 +126,16 @@ CFrameSnapshotManager::~CFrameSnapshotManager( void )
 
 void CFrameSnapshotManager::LevelChanged()
 {
+	// The client frames are gone by now, so every snapshot should be waiting to be deleted.
+	ReclaimSnapshots();
+
 	// Clear all lists...
-	Assert( m_FrameSnapshots.Count() == 0 );
+	Assert( m_nSnapshots == 0 );
 
 	// Release the most recent snapshot...
 	m_PackedEntities.RemoveAll();
 	memset( m_pPackedData, 0xFF, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
+	m_bCompactArenas = false;
 }
 
 
@@ -105,7 +145,13 @@ void CFrameSnapshotManager::LevelChanged()
 //-----------------------------------------------------------------------------
 CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int ticknumber )
 {
+	Assert( Plat_IsPrimaryThread() );
+
+	// Free whatever the clients let go of last tick.
+	ReclaimSnapshots();
+
 	CFrameSnapshot *snap = new CFrameSnapshot;
+
 	snap->AddReference();
 	snap->m_nTickNumber = ticknumber;
 	memset( snap->m_Entities, 0, sizeof( snap->m_Entities ) );
@@ -128,16 +174,96 @@ CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int ticknumber )
 	// Blat out packed data
 	memset( snap->m_pPackedData, 0xFF, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 
-	snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
+	snap->m_pArena = NULL;
+	if ( sv_snapshotarena.GetInt() )
+	{
+		snap->m_pArena = new PackedDataArena( ticknumber );
+	}
+
+	// Anything left in this tick's slot is still referenced, ReclaimSnapshots
+	// already freed it otherwise.
+	CFrameSnapshot *&pSlot = m_pTickRing[ ticknumber & SNAPSHOT_RING_MASK ];
+	if ( pSlot )
+	{
+		m_EvictedSnapshots.AddToTail( pSlot );
+	}
+	pSlot = snap;
+	++m_nSnapshots;
+	m_nNewestTick = ticknumber;
+
+	if ( m_bCompactArenas && snap->m_pArena )
+	{
+		CompactArenas( snap->m_pArena );
+	}
 	return snap;
 }
 
+
+//-----------------------------------------------------------------------------
+// Deletes the snapshots whose last reference went away. The worker threads are
+// idle whenever this runs, so nothing can be looking at them.
+//-----------------------------------------------------------------------------
+
+void CFrameSnapshotManager::ReclaimSnapshots()
+{
+	if ( m_nUnreferencedSnapshots == 0 )
+		return;
+
+	m_nUnreferencedSnapshots = 0;
+
+	int i;
+	for ( i=0; i < SNAPSHOT_RING_SIZE; i++ )
+	{
+		CFrameSnapshot *pSnapshot = m_pTickRing[i];
+		if ( pSnapshot && pSnapshot->m_nReferences == 0 )
+		{
+			m_pTickRing[i] = NULL;
+			DeleteFrameSnapshot( pSnapshot );
+		}
+	}
+
+	for ( i=m_EvictedSnapshots.Count()-1; i >= 0; i-- )
+	{
+		CFrameSnapshot *pSnapshot = m_EvictedSnapshots[i];
+		if ( pSnapshot->m_nReferences == 0 )
+		{
+			m_EvictedSnapshots.FastRemove( i );
+			DeleteFrameSnapshot( pSnapshot );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Packed entities that outlive their snapshot (unchanged entities keep being
+// reused by later snapshots, and the most recently sent list holds on to every
+// entity) would keep the whole arena of the tick they were packed on alive.
+// This moves their data into pArena so the old arena can go away. The client
+// packs aren't being written here, so nothing is reading the data.
+//-----------------------------------------------------------------------------
+
+void CFrameSnapshotManager::CompactArenas( PackedDataArena *pArena )
+{
+	for ( PackedEntityHandle_t i=m_PackedEntities.Head(); i != m_PackedEntities.InvalidIndex(); i=m_PackedEntities.Next( i ) )
+	{
+		PackedDataArena *pOldArena = m_PackedEntities[i].GetArena();
+		if ( pOldArena && pOldArena->IsSnapshotDeleted() )
+		{
+			m_PackedEntities[i].MoveData( pArena );
+		}
+	}
+
+	m_bCompactArenas = false;
+}
+
 //-----------------------------------------------------------------------------
 // Cleans up packed entity data
 //-----------------------------------------------------------------------------
 
 void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 {
+	Assert( Plat_IsPrimaryThread() );
+
 	// Decrement reference counts of all packed entities
 	for (int i = 0; i < MAX_EDICTS; ++i)
 	{
@@ -150,7 +276,20 @@ void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 		}
 	}
 
-	m_FrameSnapshots.Remove( pSnapshot->m_ListIndex );
+	// Anything still left in the arena belongs to packed entities that newer snapshots use.
+	if ( pSnapshot->m_pArena )
+	{
+		if ( pSnapshot->m_pArena->GetReferenceCount() > 1 )
+		{
+			pSnapshot->m_pArena->SetSnapshotDeleted();
+			m_bCompactArenas = true;
+		}
+
+		pSnapshot->m_pArena->ReleaseReference();
+		pSnapshot->m_pArena = NULL;
+	}
+
+	--m_nSnapshots;
 	delete pSnapshot;
 }
 
@@ -248,6 +387,71 @@ PackedEntity* CFrameSnapshotManager::GetPackedEntity( CFrameSnapshot* pSnapshot,
 }
 
 
+//-----------------------------------------------------------------------------
+// Prints the memory used by each snapshot's packed entities.
+//-----------------------------------------------------------------------------
+
+void CFrameSnapshotManager::PrintSnapshotMemory( CFrameSnapshot *pSnapshot, int &nSnapshotArenas, unsigned long &nTotalUsed )
+{
+	int nEntities = 0;
+	for ( int iEntity=0; iEntity < MAX_EDICTS; iEntity++ )
+	{
+		if ( pSnapshot->m_pPackedData[iEntity] != m_PackedEntities.InvalidIndex() )
+			++nEntities;
+	}
+
+	PackedDataArena *pArena = pSnapshot->m_pArena;
+	if ( pArena )
+	{
+		++nSnapshotArenas;
+		nTotalUsed += pArena->GetBytesUsed();
+		Con_Printf( "%8d %8d %8d %10lu %10lu\n", pSnapshot->m_nTickNumber, nEntities, 
+			pArena->GetNumAllocations(), pArena->GetBytesUsed(), pArena->GetBytesReserved() );
+	}
+	else
+	{
+		Con_Printf( "%8d %8d %8s %10s %10s\n", pSnapshot->m_nTickNumber, nEntities, "-", "-", "-" );
+	}
+}
+
+void CFrameSnapshotManager::PrintMemoryStats()
+{
+	ReclaimSnapshots();
+
+	Con_Printf( "%8s %8s %8s %10s %10s\n", "tick", "entities", "packed", "used", "reserved" );
+
+	int nSnapshotArenas = 0;
+	unsigned long nTotalUsed = 0;
+	for ( int i=0; i < m_EvictedSnapshots.Count(); i++ )
+	{
+		PrintSnapshotMemory( m_EvictedSnapshots[i], nSnapshotArenas, nTotalUsed );
+	}
+
+	// Oldest tick first
+	for ( int i=1; i <= SNAPSHOT_RING_SIZE; i++ )
+	{
+		CFrameSnapshot *pSnapshot = m_pTickRing[ ( m_nNewestTick + i ) & SNAPSHOT_RING_MASK ];
+		if ( pSnapshot )
+		{
+			PrintSnapshotMemory( pSnapshot, nSnapshotArenas, nTotalUsed );
+		}
+	}
+
+	Con_Printf( "%d snapshots (%d evicted from the tick ring), %d packed entities\n", 
+		m_nSnapshots, m_EvictedSnapshots.Count(), m_PackedEntities.Count() );
+	Con_Printf( "%d arenas (%d kept alive by reused entities), %lu bytes used by snapshots, %ld bytes reserved\n",
+		PackedDataArena::s_nArenas, PackedDataArena::s_nArenas - nSnapshotArenas, nTotalUsed, PackedDataArena::s_nBytesReserved );
+}
+
+
+static void SV_SnapshotMemory_f( void )
+{
+	g_FrameSnapshotManager.PrintMemoryStats();
+}
+
+static ConCommand sv_snapshotmemory( "sv_snapshotmemory", SV_SnapshotMemory_f, "Print the memory used by the packed entities in each live snapshot." );
+
+
 
 
 // ------------------------------------------------------------------------------------------------ //
@@ -282,16 +486,16 @@ CFrameSnapshot::~CFrameSnapshot()
 void CFrameSnapshot::AddReference()
 {
 	Assert( m_nReferences < 0xFFFF );
-	++m_nReferences;
+	ThreadInterlockedIncrement( &m_nReferences );
 }
 
 void CFrameSnapshot::ReleaseReference()
 {
 	Assert( m_nReferences > 0 );
-	--m_nReferences;
-	if ( m_nReferences == 0 )
+	if ( ThreadInterlockedDecrement( &m_nReferences ) == 0 )
 	{
-		g_FrameSnapshotManager.DeleteFrameSnapshot( this );
+		// The manager deletes it on the main thread at the start of the next tick.
+		ThreadInterlockedIncrement( &g_FrameSnapshotManager.m_nUnreferencedSnapshots );
 	}
 }
 
@@ -25,6 +25,7 @@
 #include "keys.h"
 #include "vengineserver_impl.h"
 #include "sv_filter.h"
+#include "sv_relay.h"
 #include "pr_edict.h"
 #include "screen.h"
 #include "sys_dll.h"
@@ -39,6 +40,9 @@
 #include "networkstringtable.h"
 #include "dt_send_eng.h"
 #include "sv_packedentities.h"
+#include "sv_ents_write.h"
+#include "dt_instrumentation_server.h"
+#include "LocalNetworkBackdoor.h"
 #include "testscriptmgr.h"
 #include "PlayerState.h"
 #include "saverestoretypes.h"
@@ -50,6 +54,7 @@
 #include "vstdlib/ICommandLine.h"
 #include "gameeventmanager.h"
 #include "enginebugreporter.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -64,6 +69,7 @@ struct ClientFrameCache
 };
 
 extern ConVar host_name;
+extern ConVar net_compress;
 extern ConVar deathmatch;
 
 // Server default maxplayers value
@@ -110,6 +116,9 @@ ConVar  sv_VoiceCodec("sv_VoiceCodec", "voice_miles", 0, "Specifies which voice
 ConVar  sv_deltatrace( "sv_deltatrace", "0", 0, "For debugging, print entity creation/deletion info to console." );
 ConVar  sv_packettrace( "sv_packettrace", "1", 0, "For debugging, print entity creation/deletion info to console." );
 
+static void SV_WorkerThreadsChanged_f( ConVar *var, char const *pOldString );
+ConVar	sv_workerthreads( "sv_workerthreads", "0", 0, "Number of worker threads used to build client entity packets in parallel (0 = build them on the main thread).", SV_WorkerThreadsChanged_f );
+
 
 // Prints important entity creation/deletion events to console
 #if defined( _DEBUG )
@@ -722,6 +731,10 @@ void SV_Shutdown( void )
 	// TODO clear stuff out here
 	SV_MapOverClients( SV_DeleteClientFrames );
 
+	SV_RelayShutdown();
+
+	ThreadPool_Shutdown();
+
 	// Actually performs a shutdown.
 	framesnapshot->LevelChanged();
 
@@ -1927,6 +1940,12 @@ void SV_ConnectClient ()
 	// Set up the network channel.
 	Netchan_Setup (NS_SERVER, &client->netchan, adr );
 
+	// Compress fragments if the client can take them
+	client->netchan.compress = ( net_compress.GetInt() && Q_atoi( Info_ValueForKey( protinfo, "lz" ) ) ) ? true : false;
+
+	// Spectator relays log reliable data separately from the datagrams they forward
+	client->netchan.fragreliable = Q_atoi( Info_ValueForKey( protinfo, "relay" ) ) ? true : false;
+
 	// Will get reset from userinfo, but this value comes from sv_updaterate ( the default )
 	host_client->next_messageinterval = 0.05;
 	host_client->next_messagetime = realtime + host_client->next_messageinterval;
@@ -1934,7 +1953,7 @@ void SV_ConnectClient ()
 	host_client->delta_sequence = -1;
 
 	// Tell client connection worked.
-	Netchan_OutOfBandPrint (NS_SERVER, adr, "%c0000000000000000", S2C_CONNECTION );
+	Netchan_OutOfBandPrint (NS_SERVER, adr, "%c0000000000000000 %i", S2C_CONNECTION, client->netchan.compress ? 1 : 0 );
 
 	// Display debug message.
 	if ( host_client->netchan.remote_address.type != NA_LOOPBACK  )
@@ -3481,7 +3500,27 @@ static void WriteClientDatagramHeader( bf_write& msg, client_t* client )
 	SV_WriteClientdataToMessage (client, &msg);
 
 	// Update shared client/server string tables
-	SV_UpdateStringTables( client, &msg );
+	if ( client->netchan.fragreliable )
+	{
+		// A relay acks every datagram for its viewers, so one lost on the way to a viewer
+		//  would never be resent, and the relay only keeps reliable data for viewers that
+		//  join later.  Send the changes as their own reliable message, the relay keeps those.
+		static byte stringtables[ NET_MAX_PAYLOAD ];
+		bf_write buf( "WriteClientDatagramHeader->stringtables", stringtables, sizeof( stringtables ) );
+
+		SV_UpdateStringTables( client, &buf );
+		if ( buf.GetNumBytesWritten() )
+		{
+			Netchan_CreateFragments( true, &client->netchan, &buf );
+		}
+
+		// Same as the serverinfo, don't send these again in the datagram
+		client->tabledef_acknowledged_tickcount = host_tickcount;
+	}
+	else
+	{
+		SV_UpdateStringTables( client, &msg );
+	}
 
 //	COM_Log( "sv.log", "sending world state %i(%i), last command number executed %i(%i)\n",
 //		client->netchan.outgoing_sequence, client->netchan.outgoing_sequence & SV_UPDATE_MASK,
@@ -3636,23 +3675,98 @@ void SV_HandleClientDatagramOverflow( client_t *pClient )
 
 
 
+//-----------------------------------------------------------------------------
+// Parallel packet entity construction.
+//
+// Once SV_ComputeClientPacks has packed every entity for the tick, each client's
+// SV_EmitPacketEntities only reads the snapshots and writes into its own buffer,
+// so with sv_workerthreads > 0 the clients are spread across the tier0 worker pool.
+//-----------------------------------------------------------------------------
+
+// On a listen server the pool is shared with the client's entity decode (cl_decodethreads).
+// Both cvars go through here so neither side can shrink the pool below what the other asked for.
+static int s_nClientWorkerThreads = 0;
+
+static void SV_UpdateWorkerPool( void )
+{
+	ThreadPool_SetThreadCount( max( sv_workerthreads.GetInt(), s_nClientWorkerThreads ) );
+	CM_ReclaimTraceInfos();
+}
+
+void SV_SetClientWorkerThreads( int nThreads )
+{
+	s_nClientWorkerThreads = nThreads;
+	SV_UpdateWorkerPool();
+}
+
+static void SV_WorkerThreadsChanged_f( ConVar *var, char const *pOldString )
+{
+	SV_UpdateWorkerPool();
+}
+
+// Each client's datagram is built in its own buffer so they can be written at the same time.
+static byte g_ClientDatagramBuffers[MAX_CLIENTS][NET_MAX_PAYLOAD];
+
+struct EmitPacketEntitiesJob_t
+{
+	client_t			**m_pClients;
+	client_frame_t		**m_pPack;
+	bf_write			*m_pMsgs;
+	bool				*m_pWriteEntities;
+	CFrameSnapshot		*m_pSnapshot;
+};
+
+static void SV_EmitPacketEntitiesJob( void *pContext, int iClient )
+{
+	EmitPacketEntitiesJob_t *pJob = (EmitPacketEntitiesJob_t*)pContext;
+	if ( !pJob->m_pWriteEntities[iClient] )
+		return;
+
+	// CVProfile ignores worker threads, but the timeline trace picks this up
+	VPROF_BUDGET( "SV_EmitPacketEntities", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	SV_EmitPacketEntities( pJob->m_pClients[iClient], pJob->m_pPack[iClient], pJob->m_pSnapshot, &pJob->m_pMsgs[iClient] );
+}
+
+// The local network backdoor and the datatable instrumentation both keep global state
+// while entities are written, so they force the serial path.
+static bool SV_CanEmitPacketEntitiesInParallel()
+{
+	return ThreadPool_GetThreadCount() > 0 && !g_pLocalNetworkBackdoor && !g_bServerDTIEnabled;
+}
+
+static void SV_EmitPacketEntitiesForClients( EmitPacketEntitiesJob_t *pJob, int clientCount )
+{
+	if ( SV_CanEmitPacketEntitiesInParallel() )
+	{
+		ThreadPool_ParallelFor( clientCount, SV_EmitPacketEntitiesJob, pJob );
+	}
+	else
+	{
+		for ( int i=0; i < clientCount; i++ )
+		{
+			SV_EmitPacketEntitiesJob( pJob, i );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Sends datagrams to all clients who need one
 //-----------------------------------------------------------------------------
 
 static void SV_SendClientDatagrams ( int clientCount, client_t** clients, CFrameSnapshot* pSnapshot )
 {
-	byte		buf[NET_MAX_PAYLOAD];
 	bool		wrotedatagram;
 	int i;
 	client_frame_t *pPack[MAX_CLIENTS];
-
-	bf_write msg;
-	msg.SetDebugName( "SV_SendClientDatagrams->msg" );
+	bf_write	msgs[MAX_CLIENTS];
+	bool		bWriteEntities[MAX_CLIENTS];
 
 	// Compute the client packs
 	SV_ComputeClientPacks( clientCount, clients, pSnapshot, pPack );
 
+	// Write the datagram headers. These call into the game DLL so they stay on the main thread.
 	for (i = 0; i < clientCount; ++i)
 	{
 		client_t *pClient = clients[i];
@@ -3662,20 +3776,39 @@ static void SV_SendClientDatagrams ( int clientCount, client_t** clients, CFrame
 		
 		TRACE_PACKET( ( "SV Send (%d)\n", pClient->netchan.outgoing_sequence ) );
 
-		wrotedatagram = false;
-		msg.StartWriting(buf, sizeof(buf));
+		msgs[i].SetDebugName( "SV_SendClientDatagrams->msg" );
+		msgs[i].StartWriting( g_ClientDatagramBuffers[i], sizeof( g_ClientDatagramBuffers[i] ) );
 
 		// If we've sent an uncompressed packet and don't know if the client has received it
 		// or not, we don't send more entity data.
 		// See the definition of m_ForceWaitForAck and the comments in SV_ForceWaitForAck
 		// for info about why we do this.
-		if ( pClient->m_ForceWaitForAck == -1 || pClient->m_bResendNoDelta )
+		bWriteEntities[i] = ( pClient->m_ForceWaitForAck == -1 || pClient->m_bResendNoDelta );
+		if ( bWriteEntities[i] )
 		{
-			WriteClientDatagramHeader( msg, pClient );
+			WriteClientDatagramHeader( msgs[i], pClient );
+		}
+	}
+
+	// Encode the packet entities as a delta from the
+	// last packetentities acknowledged by each client
+	EmitPacketEntitiesJob_t job;
+	job.m_pClients = clients;
+	job.m_pPack = pPack;
+	job.m_pMsgs = msgs;
+	job.m_pWriteEntities = bWriteEntities;
+	job.m_pSnapshot = pSnapshot;
+	SV_EmitPacketEntitiesForClients( &job, clientCount );
 
-			// Encode the packet entities as a delta from the
-			// last packetentities acknowledged by the client
-			SV_EmitPacketEntities( pClient, pPack[i], pSnapshot, &msg );
+	for (i = 0; i < clientCount; ++i)
+	{
+		client_t *pClient = clients[i];
+		bf_write &msg = msgs[i];
+
+		wrotedatagram = false;
+
+		if ( bWriteEntities[i] )
+		{
 			pClient->m_bResendNoDelta = false;
 
 			SV_EmitEvents( pClient, pPack[i], &msg );
@@ -3712,12 +3845,135 @@ static void SV_SendClientDatagrams ( int clientCount, client_t** clients, CFrame
 		// Send the datagram
 		if ( !pClient->fakeclient )
 		{
-			Netchan_TransmitBits( &pClient->netchan, msg.GetNumBitsWritten(), buf );
+			Netchan_TransmitBits( &pClient->netchan, msg.GetNumBitsWritten(), g_ClientDatagramBuffers[i] );
 		}
 	}
+
+	SV_CheckDeltaPrint();
 }
 
 
+//-----------------------------------------------------------------------------
+// Times full packet entity updates for increasing client counts, on the main
+// thread and on the worker pool. The active clients' most recent frames are
+// reused round-robin to stand in for bigger servers. Nothing is sent.
+//-----------------------------------------------------------------------------
+
+struct BenchPacketEntitiesJob_t
+{
+	client_t			**m_pClients;
+	int					m_nRealClients;
+	bf_write			*m_pMsgs;
+};
+
+static void SV_BenchPacketEntitiesJob( void *pContext, int iItem )
+{
+	BenchPacketEntitiesJob_t *pJob = (BenchPacketEntitiesJob_t*)pContext;
+	client_t *pClient = pJob->m_pClients[iItem % pJob->m_nRealClients];
+	client_frame_t *pFrame = &pClient->frames[(pClient->netchan.outgoing_sequence - 1) & SV_UPDATE_MASK];
+
+	bf_write *pMsg = &pJob->m_pMsgs[iItem];
+	pMsg->Reset();
+	SV_CreatePacketEntities( sv_packet_nodelta, pClient, pFrame, pFrame->GetSnapshot(), pMsg );
+}
+
+static void SV_BenchPacketEntities_f( void )
+{
+	if ( !sv.active )
+	{
+		Con_Printf( "sv_benchpacketentities: no server running.\n" );
+		return;
+	}
+
+	int nIterations = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 10;
+	nIterations = max( nIterations, 1 );
+
+	client_t *pRealClients[MAX_CLIENTS];
+	int nRealClients = 0;
+	for ( int i=0; i < svs.maxclients; i++ )
+	{
+		client_t *pClient = &svs.clients[i];
+		if ( !pClient->active || !pClient->spawned || !pClient->frames )
+			continue;
+
+		client_frame_t *pFrame = &pClient->frames[(pClient->netchan.outgoing_sequence - 1) & SV_UPDATE_MASK];
+		if ( pFrame->GetSnapshot() )
+		{
+			pRealClients[nRealClients++] = pClient;
+		}
+	}
+
+	if ( nRealClients == 0 )
+	{
+		Con_Printf( "sv_benchpacketentities: need at least one spawned client.\n" );
+		return;
+	}
+
+	const int nMaxBenchClients = 64;
+	byte *pBuffers = new byte[nMaxBenchClients * NET_MAX_PAYLOAD];
+	bf_write msgs[nMaxBenchClients];
+	for ( int iMsg=0; iMsg < nMaxBenchClients; iMsg++ )
+	{
+		msgs[iMsg].StartWriting( &pBuffers[iMsg * NET_MAX_PAYLOAD], NET_MAX_PAYLOAD );
+	}
+
+	BenchPacketEntitiesJob_t job;
+	job.m_pClients = pRealClients;
+	job.m_nRealClients = nRealClients;
+	job.m_pMsgs = msgs;
+
+	bool bParallel = SV_CanEmitPacketEntitiesInParallel();
+
+	Con_Printf( "\nSV_CreatePacketEntities (full updates, %d iterations, %d worker threads%s)\n", 
+		nIterations, ThreadPool_GetThreadCount(), bParallel ? "" : ", parallel path disabled" );
+	Con_Printf( "------------------------------------------------------\n" );
+	Con_Printf( "Clients   Serial ms/tick   Parallel ms/tick   Speedup\n" );
+	Con_Printf( "------------------------------------------------------\n" );
+
+	for ( int nClients=1; nClients <= nMaxBenchClients; nClients *= 2 )
+	{
+		CFastTimer serialTimer;
+		serialTimer.Start();
+		for ( int iSerial=0; iSerial < nIterations; iSerial++ )
+		{
+			for ( int iClient=0; iClient < nClients; iClient++ )
+			{
+				SV_BenchPacketEntitiesJob( &job, iClient );
+			}
+		}
+		serialTimer.End();
+
+		CFastTimer parallelTimer;
+		parallelTimer.Start();
+		for ( int iParallel=0; iParallel < nIterations; iParallel++ )
+		{
+			if ( bParallel )
+			{
+				ThreadPool_ParallelFor( nClients, SV_BenchPacketEntitiesJob, &job );
+			}
+			else
+			{
+				for ( int iClient=0; iClient < nClients; iClient++ )
+				{
+					SV_BenchPacketEntitiesJob( &job, iClient );
+				}
+			}
+		}
+		parallelTimer.End();
+
+		double flSerialMS = serialTimer.GetDuration().GetMillisecondsF() / nIterations;
+		double flParallelMS = parallelTimer.GetDuration().GetMillisecondsF() / nIterations;
+		Con_Printf( "%4d      %10.3f       %10.3f         %5.2fx\n", 
+			nClients, flSerialMS, flParallelMS, ( flParallelMS > 0 ) ? flSerialMS / flParallelMS : 0.0 );
+	}
+
+	Con_Printf( "\n" );
+	delete [] pBuffers;
+}
+
+static ConCommand sv_benchpacketentities( "sv_benchpacketentities", SV_BenchPacketEntities_f, "Time SV_CreatePacketEntities against client count with and without sv_workerthreads. Usage: sv_benchpacketentities [iterations]" );
+
+
 //-----------------------------------------------------------------------------
 // This function contains all the logic to determine if we should send a datagram
 // to a particular client
@@ -3829,6 +4085,9 @@ void SV_SendClientMessages (void)
 	// Take new snapshot
 	CFrameSnapshot* pSnapshot = framesnapshot->TakeTickSnapshot( host_tickcount );
 
+	// Every client's packet for this frame goes out in one batch.
+	NET_BeginSendBatch();
+
 	// update frags, names, etc
 	SV_UpdateToReliableMessages ();
 
@@ -3859,6 +4118,8 @@ void SV_SendClientMessages (void)
 	if (receivingClientCount)
 		SV_SendClientDatagrams( receivingClientCount, pReceivingClients, pSnapshot );
 
+	NET_FlushSendBatch();
+
 	// Allow game .dll to run code, including unsetting EF_MUZZLEFLASH and EF_NOINTERP on effects fields
 	// etc.
 	serverGameClients->PostClientMessagesSent();
@@ -11,6 +11,7 @@
 #include "eiface.h"
 #include "networkstringtablecontainerserver.h"
 #include "dt_send_eng.h"
+#include "dt.h"
 #include "changeframelist.h"
 #include "sv_main.h"
 #include "dt_instrumentation_server.h"
@@ -19,9 +20,15 @@
 #include "tier0/vprof.h"
 #include "host.h"
 #include "networkstringtableserver.h"
+#include "cmodel_engine.h"
 
 ConVar sv_instancebaselines( "sv_instancebaselines", "1", 0, "Enable instanced baselines. Saves network overhead." );
 ConVar sv_debugmanualmode( "sv_debugmanualmode", "0", 0, "Make sure entities correctly report whether or not their network data has changed." );
+ConVar sv_partialpack( "sv_partialpack", "1", 0, "Only re-encode the props whose network vars changed since an entity was last packed." );
+ConVar sv_pvsbitsets( "sv_pvsbitsets", "1", 0, "Skip CheckTransmit for FL_EDICT_PVSCHECK entities outside a client's PVS, using per-cluster edict bitsets." );
+
+
+#define PVS_EDICT_DWORDS	( PAD_NUMBER( MAX_EDICTS, 32 ) / 32 )
 
 
 class ClientPackInfo_t : public CCheckTransmitInfo
@@ -34,9 +41,160 @@ public:
 	
 	int					m_ClientBit;
 	int					m_ClientArea;
+
+	// FL_EDICT_PVSCHECK edicts this client's PVS can see. Clients with the same PVS
+	// point at the first one's bits.
+	unsigned int		m_PVSEdictBits[PVS_EDICT_DWORDS];
+	const unsigned int	*m_pPVSEdicts;
 };
 
 
+//-----------------------------------------------------------------------------
+// Per-tick edict bitsets for each cluster that has a FL_EDICT_PVSCHECK edict in it.
+// A client's visible set is the OR of the bitsets of the clusters its PVS has set,
+// so the per-edict cluster loop only runs once per tick instead of once per client.
+//-----------------------------------------------------------------------------
+class CPVSEdictBits
+{
+public:
+	void	Build( const int *pEdicts, int nEdicts );
+
+	// Fills pOut with the edicts from Build that touch a cluster pPVS has set.
+	void	ComputeVisible( byte *pPVS, unsigned int *pOut ) const;
+
+private:
+	int		AddToCluster( int iCluster );
+
+	// Cluster -> index into m_OccupiedClusters + 1, or 0 if nothing is in the cluster.
+	CUtlVector< int >			m_ClusterSlot;
+	CUtlVector< int >			m_OccupiedClusters;
+	// PVS_EDICT_DWORDS for each entry in m_OccupiedClusters.
+	CUtlVector< unsigned int >	m_SlotBits;
+	// Edicts that span too many clusters use their headnode instead.
+	CUtlVector< int >			m_HeadnodeEdicts;
+};
+
+static CPVSEdictBits g_PVSEdictBits;
+
+
+int CPVSEdictBits::AddToCluster( int iCluster )
+{
+	int iSlot = m_ClusterSlot[iCluster] - 1;
+	if ( iSlot < 0 )
+	{
+		iSlot = m_OccupiedClusters.AddToTail( iCluster );
+		m_ClusterSlot[iCluster] = iSlot + 1;
+
+		int iFirst = m_SlotBits.AddMultipleToTail( PVS_EDICT_DWORDS );
+		memset( &m_SlotBits[iFirst], 0, PVS_EDICT_DWORDS * sizeof( unsigned int ) );
+	}
+
+	return iSlot;
+}
+
+
+void CPVSEdictBits::Build( const int *pEdicts, int nEdicts )
+{
+	// Only touch the cluster slots we used last tick.
+	int nClusters = CM_NumClusters();
+	if ( m_ClusterSlot.Count() != nClusters )
+	{
+		m_ClusterSlot.SetSize( nClusters );
+		memset( m_ClusterSlot.Base(), 0, nClusters * sizeof( int ) );
+	}
+	else
+	{
+		for ( int i=0; i < m_OccupiedClusters.Count(); i++ )
+			m_ClusterSlot[ m_OccupiedClusters[i] ] = 0;
+	}
+
+	m_OccupiedClusters.RemoveAll();
+	m_SlotBits.RemoveAll();
+	m_HeadnodeEdicts.RemoveAll();
+
+	for ( int i=0; i < nEdicts; i++ )
+	{
+		int iEdict = pEdicts[i];
+		edict_t *ent = &sv.edicts[iEdict];
+
+		if ( ent->clusterCount < 0 )
+		{
+			m_HeadnodeEdicts.AddToTail( iEdict );
+			continue;
+		}
+
+		unsigned int bit = 1 << ( iEdict & 31 );
+		for ( int iCluster=0; iCluster < ent->clusterCount; iCluster++ )
+		{
+			int cluster = ent->clusters[iCluster];
+			if ( cluster < 0 || cluster >= nClusters )
+				continue;
+
+			int iSlot = AddToCluster( cluster );
+			m_SlotBits[ iSlot * PVS_EDICT_DWORDS + (iEdict >> 5) ] |= bit;
+		}
+	}
+}
+
+
+void CPVSEdictBits::ComputeVisible( byte *pPVS, unsigned int *pOut ) const
+{
+	memset( pOut, 0, PVS_EDICT_DWORDS * sizeof( unsigned int ) );
+
+	const unsigned int *pSlotBits = m_SlotBits.Base();
+	for ( int iSlot=0; iSlot < m_OccupiedClusters.Count(); iSlot++, pSlotBits += PVS_EDICT_DWORDS )
+	{
+		int cluster = m_OccupiedClusters[iSlot];
+		if ( !( pPVS[cluster >> 3] & ( 1 << ( cluster & 7 ) ) ) )
+			continue;
+
+		for ( int i=0; i < PVS_EDICT_DWORDS; i++ )
+			pOut[i] |= pSlotBits[i];
+	}
+
+	for ( int i=0; i < m_HeadnodeEdicts.Count(); i++ )
+	{
+		int iEdict = m_HeadnodeEdicts[i];
+		if ( CM_HeadnodeVisible( sv.edicts[iEdict].headnode, pPVS ) )
+			pOut[iEdict >> 5] |= 1 << ( iEdict & 31 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Sets up m_pPVSEdicts for each client. Clients whose PVS matches an earlier
+// client's (usually because they're in the same cluster) share its bits.
+//-----------------------------------------------------------------------------
+static void SV_ComputePVSEdictBits( int clientCount, ClientPackInfo_t *info, const int *pEdicts, int nEdicts )
+{
+	VPROF( "SV_ComputePVSEdictBits" );
+
+	g_PVSEdictBits.Build( pEdicts, nEdicts );
+
+	int nPVSBytes = ( CM_NumClusters() + 7 ) / 8;
+	for ( int iClient=0; iClient < clientCount; iClient++ )
+	{
+		ClientPackInfo_t *pInfo = &info[iClient];
+		pInfo->m_pPVSEdicts = NULL;
+
+		for ( int iOther=0; iOther < iClient; iOther++ )
+		{
+			if ( !memcmp( info[iOther].m_PVS, pInfo->m_PVS, nPVSBytes ) )
+			{
+				pInfo->m_pPVSEdicts = info[iOther].m_pPVSEdicts;
+				break;
+			}
+		}
+
+		if ( !pInfo->m_pPVSEdicts )
+		{
+			g_PVSEdictBits.ComputeVisible( pInfo->m_PVS, pInfo->m_PVSEdictBits );
+			pInfo->m_pPVSEdicts = pInfo->m_PVSEdictBits;
+		}
+	}
+}
+
+
 static void SV_ComputeClientPackInfo( client_t* pClient, ClientPackInfo_t *pInfo )
 {
 	// Grab the client's edict pointer
@@ -158,6 +316,84 @@ bool SV_GetInstanceBaseline( ServerClass *pClass, void const **pData, int *pData
 }
 
 
+//-----------------------------------------------------------------------------
+// Re-encodes only the props whose network vars changed since the entity was packed 
+// into pPrevFrame and copies the rest from it. Returns the number of props that 
+// changed (in pDeltaProps), or -1 if the entity can't say what changed and needs 
+// a full encode.
+//-----------------------------------------------------------------------------
+
+static int SV_PackChangedProps( 
+	int edictIdx, 
+	edict_t *ent, 
+	SendTable *pSendTable, 
+	PackedEntity *pPrevFrame, 
+	bf_write *pOut, 
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	int *pDeltaProps,
+	int nMaxDeltaProps )
+{
+	if ( !sv_partialpack.GetInt() )
+		return -1;
+
+	const NetworkVarChange_t *pVarChanges;
+	int nVarChanges = ent->m_pEnt->GetNetworkVarChanges( &pVarChanges );
+	if ( nVarChanges < 0 )
+		return -1;
+
+	int encodeProps[MAX_DATATABLE_PROPS];
+	int nEncodeProps = SendTable_GetPropsFromVarChanges( pSendTable, pVarChanges, nVarChanges, encodeProps, ARRAYSIZE( encodeProps ) );
+
+	int nDeltaProps;
+	if ( !SendTable_EncodeChangedProps( 
+		pSendTable, 
+		ent->m_pEnt, 
+		pPrevFrame->GetData(), pPrevFrame->GetNumBits(), 
+		encodeProps, nEncodeProps, 
+		pOut, 
+		edictIdx, 
+		pRecipients, 
+		pDeltaProps, nMaxDeltaProps, nDeltaProps ) )
+	{
+		Host_Error( "SV_PackEntity: SendTable_EncodeChangedProps returned false (ent %d).\n", edictIdx );
+	}
+
+	// Make sure the network vars told us about everything that changed.
+	if ( sv_debugmanualmode.GetInt() )
+	{
+		char checkData[MAX_PACKEDENTITY_DATA];
+		bf_write checkBuf( "SV_PackChangedProps->checkBuf", checkData, sizeof( checkData ) );
+		SendTable_Encode( pSendTable, ent->m_pEnt, &checkBuf, NULL, edictIdx );
+
+		int missedProps[MAX_DATATABLE_PROPS];
+		int nMissedProps = SendTable_CalcDelta(
+			pSendTable,
+			pOut->GetData(), pOut->GetNumBitsWritten(),
+			checkData, checkBuf.GetNumBitsWritten(),
+			missedProps,
+			ARRAYSIZE( missedProps ),
+			edictIdx
+			);
+
+		for ( int i=0; i < nMissedProps; i++ )
+		{
+			Msg( "Entity %d (class '%s') changed '%s' without a network var reporting it.\n", 
+				edictIdx,
+				STRING( ent->classname ),
+				pSendTable->m_pPrecalc->GetProp( missedProps[i] )->GetName() );
+		}
+
+		if ( nMissedProps )
+		{
+			pOut->Reset();
+			return -1;
+		}
+	}
+
+	return nDeltaProps;
+}
+
+
 //-----------------------------------------------------------------------------
 // Pack the entity....
 //-----------------------------------------------------------------------------
@@ -191,9 +427,26 @@ static inline void SV_PackEntity(
 		unsigned char tempData[ sizeof( CSendProxyRecipients ) * MAX_DATATABLE_PROXIES ];
 		CUtlMemory< CSendProxyRecipients > recip( (CSendProxyRecipients*)tempData, pSendTable->GetNumDataTableProxies() );
 
-		if( !SendTable_Encode( pSendTable, ent->m_pEnt, &writeBuf, NULL, edictIdx, &recip ) )
-		{							 
-			Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", edictIdx );
+		// If this entity was previously in there, then it should have a valid IChangeFrameList 
+		// which we can delta against to figure out which properties have changed.
+		//
+		// If not, then we want to setup a new IChangeFrameList.
+		PackedEntity *pPrevFrame = framesnapshot->GetPreviouslySentPacket( edictIdx, pSnapshot->m_Entities[ edictIdx ].m_nSerialNumber );
+
+		// If the entity's network vars can tell us what changed, then only those props need encoding.
+		int deltaProps[MAX_DATATABLE_PROPS];
+		int nChanges = -1;
+		if ( pPrevFrame )
+		{
+			nChanges = SV_PackChangedProps( edictIdx, ent, pSendTable, pPrevFrame, &writeBuf, &recip, deltaProps, ARRAYSIZE( deltaProps ) );
+		}
+
+		if ( nChanges == -1 )
+		{
+			if( !SendTable_Encode( pSendTable, ent->m_pEnt, &writeBuf, NULL, edictIdx, &recip ) )
+			{							 
+				Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", edictIdx );
+			}
 		}
 
 		SV_EnsureInstanceBaseline( edictIdx, packedData, writeBuf.GetNumBytesWritten() );
@@ -201,29 +454,22 @@ static inline void SV_PackEntity(
 		int nFlatProps = SendTable_GetNumFlatProps( pSendTable );
 		IChangeFrameList *pChangeFrame;
 
-		// If this entity was previously in there, then it should have a valid IChangeFrameList 
-		// which we can delta against to figure out which properties have changed.
-		//
-		// If not, then we want to setup a new IChangeFrameList.
-		PackedEntity *pPrevFrame = framesnapshot->GetPreviouslySentPacket( edictIdx, pSnapshot->m_Entities[ edictIdx ].m_nSerialNumber );
 		if ( pPrevFrame )
 		{
 			// Calculate a delta.
-			bf_read bfPrev( "SV_PackEntity->bfPrev", pPrevFrame->LockData(), pPrevFrame->GetNumBytes() );
-			bf_read bfNew( "SV_PackEntity->bfNew", packedData, writeBuf.GetNumBytesWritten() );
-			
-			int deltaProps[MAX_DATATABLE_PROPS];
-
-			int nChanges = SendTable_CalcDelta(
-				pSendTable, 
-				pPrevFrame->LockData(), pPrevFrame->GetNumBits(),
-				packedData,	writeBuf.GetNumBitsWritten(),
-				
-				deltaProps,
-				ARRAYSIZE( deltaProps ),
+			if ( nChanges == -1 )
+			{
+				nChanges = SendTable_CalcDelta(
+					pSendTable, 
+					pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
+					packedData,	writeBuf.GetNumBitsWritten(),
+					
+					deltaProps,
+					ARRAYSIZE( deltaProps ),
 
-				edictIdx
-				);
+					edictIdx
+					);
+			}
 
 			// If it's non-manual-mode, but we detect that there are no changes here, then just
 			// use the previous pSnapshot if it's available (as though the entity were manual mode).
@@ -273,7 +519,14 @@ static inline void SV_PackEntity(
 		pCurFrame->SetChangeFrameList( pChangeFrame );
 		pCurFrame->m_nEntityIndex = edictIdx;
 		pCurFrame->m_pSendTable = pSendTable;
-		pCurFrame->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten(), &g_PackedDataAllocator );
+		if ( pSnapshot->m_pArena )
+		{
+			pCurFrame->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten(), pSnapshot->m_pArena );
+		}
+		else
+		{
+			pCurFrame->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten(), &g_PackedDataAllocator );
+		}
 		pCurFrame->SetRecipients( recip );
 	}
 }
@@ -357,9 +610,12 @@ void SV_ComputeClientPacks(
 	}
 
 
-	// Figure out which entities should be sent.
+	// Figure out which entities can be sent.
 	int validEdicts[MAX_EDICTS];
 	int nValidEdicts = 0;
+	int pvsEdicts[MAX_EDICTS];
+	int nPVSEdicts = 0;
+	bool bUsePVSBits = sv_pvsbitsets.GetBool();
 	for ( int iEdict=0; iEdict < sv.num_edicts; iEdict++ )
 	{
 		edict_t* ent = SV_GetEdictToTransmit( iEdict, snapshot );
@@ -374,11 +630,37 @@ void SV_ComputeClientPacks(
 
 		validEdicts[nValidEdicts++] = iEdict;
 
+		if ( bUsePVSBits && ( ent->transmitflags & FL_EDICT_PVSCHECK ) )
+			pvsEdicts[nPVSEdicts++] = iEdict;
+	}
+
+	// Only bother with the bitsets if something can use them.
+	if ( nPVSEdicts )
+	{
+		SV_ComputePVSEdictBits( clientCount, info, pvsEdicts, nPVSEdicts );
+	}
+
+	// Figure out which entities should be sent.
+	for ( int iValidEdict=0; iValidEdict < nValidEdicts; iValidEdict++ )
+	{
+		int iEdict = validEdicts[iValidEdict];
+		edict_t* ent = &sv.edicts[iEdict];
+		SendTable* pSendTable = GetEntSendTable( ent );
+
+		bool bPVSCheck = bUsePVSBits && ( ent->transmitflags & FL_EDICT_PVSCHECK );
+		int iPVSDWord = iEdict >> 5;
+		unsigned int pvsBit = 1 << ( iEdict & 31 );
+
 		for ( int iClient=0; iClient < clientCount; iClient++ )
 		{		
 			ClientPackInfo_t *pInfo = &info[iClient];
 			Assert( pInfo );
 
+			// The entity only cares about clients that can see it, so don't ask it about this one.
+			// (IsInPVS lets an entity see itself, so the client's own edict always gets checked.)
+			if ( bPVSCheck && ent != pInfo->m_pClientEnt && !( pInfo->m_pPVSEdicts[iPVSDWord] & pvsBit ) )
+				continue;
+
 			int areaCount = pInfo->m_AreasNetworked.Count();
 
 			for ( int iArea=0; iArea < areaCount; iArea++ )
@@ -0,0 +1,1078 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Spectator relay.  A dedicated server with no map loaded connects to a
+//			game server as one client ( relay_connect ) and fans the stream out to
+//			viewers that connect to it like they would to a game server.
+//
+//			The game server sends the relay all reliable data as fragment payloads
+//			( netchan_t::fragreliable ).  Each one is kept in a log and queued on
+//			every viewer channel as a shared payload, so the data is copied and
+//			compressed once no matter how many viewers there are.  New viewers get
+//			the whole log, which starts with the serverinfo and signon.  Past
+//			relay_maxlogbytes the oldest messages after the signon are dropped from
+//			the log, so late viewers miss prints and the like from long ago.  The
+//			game server sends a relay its string table changes as messages of their
+//			own, and those are never dropped, so every viewer has all the entries.  A
+//			viewer that can't keep up with the reliable data is dropped rather than
+//			holding on to more and more of it.  Datagrams
+//			are forwarded as is under the game server's sequence number, so the
+//			entity deltas in them refer to the same packets for every viewer.  A
+//			viewer that lost the packet a delta refers to asks for a full update
+//			and the relay asks the game server for one on its behalf.
+//
+//			Viewers see what the relay's own player sees and their usercmds are
+//			ignored.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "client.h"
+#include "server.h"
+#include "sv_relay.h"
+#include "sv_filter.h"
+#include "protocol.h"
+#include "proto_oob.h"
+#include "info.h"
+#include "utlvector.h"
+#include "vstdlib/random.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Resend getchallenge/connect this often until the game server answers
+#define RELAY_RETRY_INTERVAL		3.0
+// Keep packets going to the game server at least this often, it only answers packets during signon
+#define RELAY_KEEPALIVE_INTERVAL	0.05
+
+extern ConVar net_compress;
+
+// Shared with the game server code
+int		SV_CheckProtocol( netadr_t *adr, int nProtocol );
+int		SV_CheckChallenge( netadr_t *adr, int nChallengeValue );
+void	SV_RejectConnection( netadr_t *adr, char *fmt, ... );
+void	SVC_GetChallenge( void );
+void	SV_ParseRcom( void );
+void	Netchan_FlushIncoming( netchan_t *chan, int stream );
+
+static ConVar relay_maxviewers( "relay_maxviewers", "64", 0, "Most viewers a spectator relay takes.", true, 0, true, 1024 );
+static ConVar relay_name( "relay_name", "relay", 0, "Player name a spectator relay uses on the game server." );
+static ConVar relay_timeout( "relay_timeout", "30", 0, "Seconds without packets before a spectator relay reconnects to the game server or drops a viewer." );
+static ConVar relay_fullupdateinterval( "relay_fullupdateinterval", "1", 0, "Least seconds between full entity updates a spectator relay asks for on behalf of its viewers." );
+static ConVar relay_maxlogbytes( "relay_maxlogbytes", "4194304", 0, "Bytes of reliable data a spectator relay keeps for viewers joining late, the signon is always kept.", true, 65536, false, 0 );
+static ConVar relay_maxbacklog( "relay_maxbacklog", "262144", 0, "Bytes of reliable data a spectator relay viewer can fall behind by before it's dropped.", true, 16384, false, 0 );
+
+typedef enum
+{
+	RELAY_DISCONNECTED = 0,
+	RELAY_CHALLENGING,		// Sent getchallenge
+	RELAY_CONNECTING,		// Sent connect
+	RELAY_SERVERINFO,		// Sent "new", waiting for the serverinfo
+	RELAY_STREAMING,		// Signed on, forwarding datagrams
+} relaystate_t;
+
+// Reliable data from the game server, in the order it was sent
+typedef struct
+{
+	fragpayload_t	*payload;
+	// NULL if compressing didn't make it smaller
+	fragpayload_t	*compressed;
+	// String table changes, kept for late viewers however big the log gets
+	bool			stringtables;
+} relaylog_t;
+
+typedef struct
+{
+	netchan_t	netchan;
+	// Sent "new", so new log entries go out to it
+	bool		joined;
+	// Got the whole log once, datagrams are forwarded from now on
+	bool		streaming;
+	// Lost the frame a delta was based on and wants a full update
+	bool		wantsfull;
+} relayviewer_t;
+
+static relaystate_t		s_RelayState = RELAY_DISCONNECTED;
+static netadr_t			s_RelayAdr;
+static netchan_t		s_RelayChan;
+static int				s_nRelayChallenge;
+static char				s_szRelayKey[ 33 ];
+static double			s_flRelayRetryTime;
+static double			s_flRelayLastSend;
+
+static CUtlVector< relaylog_t >			s_RelayLog;
+static int								s_nRelayLogBytes;
+// Log entries up to the spawn reply, these are never trimmed.  0 until the prespawn reply shows up.
+static int								s_nRelaySignonEntries;
+static CUtlVector< relayviewer_t * >	s_RelayViewers;
+
+// Full update asked for on behalf of the viewers, clears once the game server acks this sequence
+static int				s_nFullUpdateSequence;
+static double			s_flNextFullUpdate;
+
+//-----------------------------------------------------------------------------
+// Purpose: Releases the logged reliable data
+//-----------------------------------------------------------------------------
+static void SV_Relay_ResetLog( void )
+{
+	int i;
+
+	for ( i = 0; i < s_RelayLog.Count(); i++ )
+	{
+		Netchan_ReleasePayload( s_RelayLog[ i ].payload );
+		if ( s_RelayLog[ i ].compressed )
+		{
+			Netchan_ReleasePayload( s_RelayLog[ i ].compressed );
+		}
+	}
+
+	s_RelayLog.Purge();
+	s_nRelayLogBytes		= 0;
+	s_nRelaySignonEntries	= 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the oldest entries after the signon until the log fits in relay_maxlogbytes.
+//			String table changes stay.  Viewers that have the entries queued keep their
+//			own references.
+//-----------------------------------------------------------------------------
+static void SV_Relay_TrimLog( void )
+{
+	relaylog_t *entry;
+	int i;
+
+	if ( !s_nRelaySignonEntries )
+		return;
+
+	i = s_nRelaySignonEntries;
+	while ( i < s_RelayLog.Count() && s_nRelayLogBytes > relay_maxlogbytes.GetInt() )
+	{
+		entry = &s_RelayLog[ i ];
+		if ( entry->stringtables )
+		{
+			i++;
+			continue;
+		}
+
+		s_nRelayLogBytes -= entry->payload->size;
+		Netchan_ReleasePayload( entry->payload );
+		if ( entry->compressed )
+		{
+			Netchan_ReleasePayload( entry->compressed );
+		}
+		s_RelayLog.Remove( i );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues a log entry on a viewer channel
+//-----------------------------------------------------------------------------
+static void SV_Relay_QueueLogEntry( relayviewer_t *viewer, relaylog_t *entry )
+{
+	if ( viewer->netchan.compress && entry->compressed )
+	{
+		Netchan_QueueSharedPayload( &viewer->netchan, entry->compressed );
+	}
+	else
+	{
+		Netchan_QueueSharedPayload( &viewer->netchan, entry->payload );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Logs a reliable message from the game server and sends it to the viewers that joined
+//-----------------------------------------------------------------------------
+static void SV_Relay_AppendLog( byte *data, int size )
+{
+	relaylog_t entry;
+	int i;
+
+	entry.payload		= Netchan_CreatePayload( data, size, false );
+	entry.compressed	= NULL;
+	// The game server sends string table changes on their own ( WriteClientDatagramHeader )
+	entry.stringtables	= ( size > 0 && data[ 0 ] == svc_updatestringtable );
+
+	if ( net_compress.GetInt() )
+	{
+		entry.compressed = Netchan_CreatePayload( data, size, true );
+		if ( !entry.compressed->compressed )
+		{
+			Netchan_ReleasePayload( entry.compressed );
+			entry.compressed = NULL;
+		}
+	}
+
+	s_RelayLog.AddToTail( entry );
+	s_nRelayLogBytes += size;
+
+	for ( i = 0; i < s_RelayViewers.Count(); i++ )
+	{
+		if ( s_RelayViewers[ i ]->joined )
+		{
+			SV_Relay_QueueLogEntry( s_RelayViewers[ i ], &entry );
+		}
+	}
+
+	SV_Relay_TrimLog();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Is this the "reconnect" the game server sends everyone when it changes level?
+//-----------------------------------------------------------------------------
+static bool SV_Relay_IsReconnect( byte *data, int size )
+{
+	static const char cmd[] = "reconnect\n";
+	byte pattern[ sizeof( cmd ) + 1 ];
+	int shift, i, j;
+
+	pattern[ 0 ] = svc_stufftext;
+	Q_memcpy( pattern + 1, cmd, sizeof( cmd ) );
+
+	// Reliable messages get appended at whatever bit the last one ended on, so try every alignment
+	for ( shift = 0; shift < 8; shift++ )
+	{
+		for ( i = 0; i + (int)sizeof( pattern ) <= size; i++ )
+		{
+			for ( j = 0; j < (int)sizeof( pattern ); j++ )
+			{
+				int next = ( i + j + 1 < size ) ? data[ i + j + 1 ] : 0;
+				byte b = ( byte )( ( data[ i + j ] >> shift ) | ( next << ( 8 - shift ) ) );
+				if ( b != pattern[ j ] )
+					break;
+			}
+
+			if ( j == (int)sizeof( pattern ) )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Is this the prespawn reply?  It's the signon buffer with svc_signonnum 1 at the
+//			very end, the rest of the last byte is padding.
+//-----------------------------------------------------------------------------
+static bool SV_Relay_IsPrespawnReply( byte *data, int size )
+{
+	bf_read buf( "SV_Relay_IsPrespawnReply", data, size );
+	int pad;
+
+	for ( pad = 0; pad < 8 && size * 8 - pad >= 16; pad++ )
+	{
+		buf.Seek( size * 8 - pad - 16 );
+		if ( buf.ReadUBitLong( 8 ) != svc_signonnum || buf.ReadUBitLong( 8 ) != 1 )
+			continue;
+
+		if ( !pad || !buf.ReadUBitLong( pad ) )
+			return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Pulls the spawn count out of the serverinfo message
+//-----------------------------------------------------------------------------
+static bool SV_Relay_ParseServerinfo( byte *data, int size, int *spawncount )
+{
+	char text[ 2048 ];
+	bf_read buf( "SV_Relay_ParseServerinfo", data, size );
+	int cmd;
+
+	cmd = buf.ReadByte();
+	if ( cmd == svc_print )
+	{
+		buf.ReadString( text, sizeof( text ) );
+		cmd = buf.ReadByte();
+	}
+
+	if ( cmd != svc_serverinfo || buf.ReadShort() != PROTOCOL_VERSION )
+		return false;
+
+	*spawncount = buf.ReadLong();
+	return !buf.IsOverflowed();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends svc_disconnect and frees the viewer
+//-----------------------------------------------------------------------------
+static void SV_Relay_DropViewer( int index, bool notify )
+{
+	relayviewer_t *viewer = s_RelayViewers[ index ];
+	byte final[ 1 ];
+
+	if ( notify )
+	{
+		final[ 0 ] = svc_disconnect;
+		Netchan_Transmit( &viewer->netchan, 1, final );
+	}
+
+	Con_DPrintf( "Relay viewer %s dropped\n", NET_AdrToString( viewer->netchan.remote_address ) );
+
+	Netchan_Clear( &viewer->netchan );
+	delete viewer;
+
+	s_RelayViewers.Remove( index );
+}
+
+static void SV_Relay_DropViewers( void )
+{
+	while ( s_RelayViewers.Count() )
+	{
+		SV_Relay_DropViewer( s_RelayViewers.Count() - 1, true );
+	}
+}
+
+static int SV_Relay_FindViewer( netadr_t adr )
+{
+	int i;
+
+	for ( i = 0; i < s_RelayViewers.Count(); i++ )
+	{
+		if ( NET_CompareAdr( adr, s_RelayViewers[ i ]->netchan.remote_address ) )
+			return i;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts over with a fresh connection to the game server
+//-----------------------------------------------------------------------------
+static void SV_Relay_Reconnect( void )
+{
+	// Viewer sequence numbers follow the game server connection, they can't carry over to a new one
+	SV_Relay_DropViewers();
+	SV_Relay_ResetLog();
+
+	Netchan_Clear( &s_RelayChan );
+
+	s_RelayState			= RELAY_CHALLENGING;
+	s_flRelayRetryTime		= 0.0;
+	s_nFullUpdateSequence	= 0;
+	s_flNextFullUpdate		= 0.0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Acks the game server and asks for entity deltas
+//-----------------------------------------------------------------------------
+static void SV_Relay_SendUpstream( void )
+{
+	byte data[ 16 ];
+	bf_write buf( "SV_Relay_SendUpstream", data, sizeof( data ) );
+	int i;
+
+	if ( s_RelayState == RELAY_STREAMING )
+	{
+		// Viewers that lost a delta base get a full update through us
+		if ( !s_nFullUpdateSequence && realtime >= s_flNextFullUpdate )
+		{
+			for ( i = 0; i < s_RelayViewers.Count(); i++ )
+			{
+				if ( s_RelayViewers[ i ]->wantsfull )
+					break;
+			}
+
+			if ( i != s_RelayViewers.Count() )
+			{
+				s_nFullUpdateSequence	= s_RelayChan.outgoing_sequence;
+				s_flNextFullUpdate		= realtime + relay_fullupdateinterval.GetFloat();
+
+				for ( i = 0; i < s_RelayViewers.Count(); i++ )
+				{
+					s_RelayViewers[ i ]->wantsfull = false;
+				}
+			}
+		}
+
+		// Every packet we get is a good delta base, we don't need to parse it
+		if ( !s_nFullUpdateSequence && s_RelayChan.incoming_sequence )
+		{
+			buf.WriteByte( clc_delta );
+			buf.WriteUBitLong( s_RelayChan.incoming_sequence & DELTAFRAME_MASK, DELTAFRAME_NUMBITS );
+		}
+	}
+
+	Netchan_Transmit( &s_RelayChan, buf.GetNumBytesWritten(), buf.GetBasePointer() );
+	s_flRelayLastSend = realtime;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Handles a completed reliable message from the game server
+//-----------------------------------------------------------------------------
+static void SV_Relay_ReliablePayload( byte *data, int size )
+{
+	int spawncount;
+	int i;
+
+	if ( s_RelayState == RELAY_SERVERINFO )
+	{
+		// Anything before the serverinfo belongs to the last level
+		if ( !SV_Relay_ParseServerinfo( data, size, &spawncount ) )
+			return;
+
+		SV_Relay_AppendLog( data, size );
+
+		// We don't load anything, so sign on right away.  The replies are logged for the viewers.
+		s_RelayChan.message.WriteByte( clc_stringcmd );
+		s_RelayChan.message.WriteString( va( "prespawn %i", spawncount ) );
+		s_RelayChan.message.WriteByte( clc_stringcmd );
+		s_RelayChan.message.WriteString( va( "spawn %i", spawncount ) );
+		s_RelayChan.message.WriteByte( clc_stringcmd );
+		s_RelayChan.message.WriteString( va( "begin %i", spawncount ) );
+
+		s_RelayState = RELAY_STREAMING;
+
+		Con_Printf( "Relay signed on to %s, server number %i\n", NET_AdrToString( s_RelayAdr ), spawncount );
+		return;
+	}
+
+	SV_Relay_AppendLog( data, size );
+
+	// We sent spawn in the same packet as prespawn, so its reply is the next one
+	if ( !s_nRelaySignonEntries && SV_Relay_IsPrespawnReply( data, size ) )
+	{
+		s_nRelaySignonEntries = s_RelayLog.Count() + 1;
+	}
+
+	if ( !SV_Relay_IsReconnect( data, size ) )
+		return;
+
+	// Level change.  The viewers got the reconnect and will send "new" again, start the log over.
+	Con_Printf( "Relay: %s is changing level\n", NET_AdrToString( s_RelayAdr ) );
+
+	SV_Relay_ResetLog();
+
+	for ( i = 0; i < s_RelayViewers.Count(); i++ )
+	{
+		s_RelayViewers[ i ]->joined		= false;
+		s_RelayViewers[ i ]->streaming	= false;
+		s_RelayViewers[ i ]->wantsfull	= false;
+	}
+
+	s_RelayChan.message.WriteByte( clc_stringcmd );
+	s_RelayChan.message.WriteString( "new" );
+
+	s_RelayState			= RELAY_SERVERINFO;
+	s_nFullUpdateSequence	= 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends a datagram from the game server to every viewer
+//-----------------------------------------------------------------------------
+static void SV_Relay_Broadcast( byte *data, int bits )
+{
+	relayviewer_t *viewer;
+	int i;
+
+	for ( i = 0; i < s_RelayViewers.Count(); i++ )
+	{
+		viewer = s_RelayViewers[ i ];
+
+		// Choked viewers lose this one, like they would on a game server
+		if ( !Netchan_CanPacket( &viewer->netchan ) )
+			continue;
+
+		// Hold datagrams back until the signon is through
+		if ( viewer->joined && !viewer->streaming &&
+			!Netchan_IsSending( &viewer->netchan ) && !viewer->netchan.reliable_length )
+		{
+			viewer->streaming = true;
+		}
+
+		// Same sequence number the game server used, so the deltas in it line up
+		viewer->netchan.outgoing_sequence = s_RelayChan.incoming_sequence;
+
+		if ( viewer->streaming )
+		{
+			Netchan_TransmitBits( &viewer->netchan, bits, data );
+		}
+		else
+		{
+			Netchan_TransmitBits( &viewer->netchan, 0, NULL );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sequenced packet from the game server
+//-----------------------------------------------------------------------------
+static void SV_Relay_ReadUpstream( void )
+{
+	byte datagram[ NET_MAX_PAYLOAD ];
+	int bits = 0;
+	int sequence;
+	bf_read *msg;
+
+	if ( s_RelayState < RELAY_SERVERINFO )
+		return;
+
+	sequence = s_RelayChan.incoming_sequence;
+
+	if ( Netchan_Process( &s_RelayChan ) )
+	{
+		// Reliable data comes as fragments, what's left is the datagram.  Grab it before
+		//  the fragments get copied over net_message.
+		msg = MSG_GetReadBuf();
+		bits = min( msg->GetNumBitsLeft(), ( int )sizeof( datagram ) << 3 );
+		msg->ReadBits( datagram, bits );
+	}
+
+	// Stale, duplicate or bad packet
+	if ( s_RelayChan.incoming_sequence == sequence )
+		return;
+
+	if ( Netchan_IncomingReady( &s_RelayChan ) )
+	{
+		if ( Netchan_CopyNormalFragments( &s_RelayChan ) )
+		{
+			SV_Relay_ReliablePayload( net_message.data, net_message.cursize );
+		}
+
+		// Nothing to do with files
+		if ( s_RelayChan.incomingready[ FRAG_FILE_STREAM ] )
+		{
+			Netchan_FlushIncoming( &s_RelayChan, FRAG_FILE_STREAM );
+			s_RelayChan.incomingready[ FRAG_FILE_STREAM ] = false;
+		}
+	}
+
+	// The full update went out in answer to the packet that asked for it
+	if ( s_nFullUpdateSequence && s_RelayChan.incoming_acknowledged >= s_nFullUpdateSequence )
+	{
+		s_nFullUpdateSequence = 0;
+	}
+
+	if ( s_RelayState == RELAY_STREAMING )
+	{
+		SV_Relay_Broadcast( datagram, bits );
+	}
+
+	SV_Relay_SendUpstream();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Connectionless packet from the game server
+//-----------------------------------------------------------------------------
+static void SV_Relay_UpstreamConnectionless( void )
+{
+	char protinfo[ 1024 ];
+	char userinfo[ 256 ];
+	char *s;
+
+	MSG_BeginReading();
+	MSG_ReadLong();		// skip the -1 marker
+
+	s = MSG_ReadStringLine();
+	Cmd_TokenizeString( s );
+
+	switch ( Cmd_Argv( 0 )[ 0 ] )
+	{
+	case S2C_CHALLENGE:
+		if ( s_RelayState != RELAY_CHALLENGING || Cmd_Argc() != 3 )
+			break;
+
+		s_nRelayChallenge = Q_atoi( Cmd_Argv( 1 ) );
+		s_RelayState = RELAY_CONNECTING;
+
+		protinfo[ 0 ] = 0;
+		Info_SetValueForKey( protinfo, "prot", va( "%i", PROTOCOL_HASHEDCDKEY ), sizeof( protinfo ) );
+		Info_SetValueForKey( protinfo, "raw", s_szRelayKey, sizeof( protinfo ) );
+		Info_SetValueForKey( protinfo, "relay", "1", sizeof( protinfo ) );
+		if ( net_compress.GetInt() )
+		{
+			Info_SetValueForKey( protinfo, "lz", "1", sizeof( protinfo ) );
+		}
+
+		userinfo[ 0 ] = 0;
+		Info_SetValueForKey( userinfo, "name", relay_name.GetString(), sizeof( userinfo ) );
+		Info_SetValueForKey( userinfo, "rate", va( "%i", MAX_RATE ), sizeof( userinfo ) );
+
+		Netchan_OutOfBandPrint( NS_SERVER, s_RelayAdr, "connect %i %i \"%s\" \"%s\"\n",
+			PROTOCOL_VERSION, s_nRelayChallenge, protinfo, userinfo );
+		s_flRelayRetryTime = realtime + RELAY_RETRY_INTERVAL;
+		break;
+
+	case S2C_CONNECTION:
+		if ( s_RelayState != RELAY_CONNECTING )
+			break;
+
+		Netchan_Setup( NS_SERVER, &s_RelayChan, s_RelayAdr );
+		s_RelayChan.compress = ( Cmd_Argc() > 1 && Q_atoi( Cmd_Argv( 1 ) ) ) ? true : false;
+		s_RelayChan.rate = MAX_RATE;
+
+		s_RelayChan.message.WriteByte( clc_stringcmd );
+		s_RelayChan.message.WriteString( "new" );
+		s_RelayState = RELAY_SERVERINFO;
+
+		Con_Printf( "Relay connected to %s\n", NET_AdrToString( s_RelayAdr ) );
+		SV_Relay_SendUpstream();
+		break;
+
+	case S2C_CONNREJECT:
+	case S2C_BADPASSWORD:
+		if ( s_RelayState != RELAY_CONNECTING )
+			break;
+
+		Con_Printf( "Relay: %s refused the connection: %s\n", NET_AdrToString( s_RelayAdr ), s + 1 );
+		SV_RelayShutdown();
+		break;
+
+	default:
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A viewer wants in.  Same checks as a game server, but no game code to ask.
+//-----------------------------------------------------------------------------
+static void SV_Relay_ConnectViewer( void )
+{
+	relayviewer_t *viewer;
+	netadr_t adr;
+	char protinfo[ 1024 ];
+	char userinfo[ 1024 ];
+	int index;
+	int rate;
+
+	adr = net_from;
+
+	if ( Cmd_Argc() < 5 )
+	{
+		SV_RejectConnection( &adr, "Insufficient connection info\n" );
+		return;
+	}
+
+	if ( !SV_CheckProtocol( &adr, Q_atoi( Cmd_Argv( 1 ) ) ) ||
+		 !SV_CheckChallenge( &adr, Q_atoi( Cmd_Argv( 2 ) ) ) )
+	{
+		return;
+	}
+
+	Q_strncpy( protinfo, Cmd_Argv( 3 ), sizeof( protinfo ) - 1 );
+	protinfo[ sizeof( protinfo ) - 1 ] = 0;
+	Q_strncpy( userinfo, Cmd_Argv( 4 ), sizeof( userinfo ) - 1 );
+	userinfo[ sizeof( userinfo ) - 1 ] = 0;
+
+	// A reconnecting viewer keeps its slot
+	index = SV_Relay_FindViewer( adr );
+	if ( index < 0 )
+	{
+		if ( s_RelayViewers.Count() >= relay_maxviewers.GetInt() )
+		{
+			SV_RejectConnection( &adr, "Relay is full.\n" );
+			return;
+		}
+
+		viewer = new relayviewer_t;
+		Q_memset( viewer, 0, sizeof( *viewer ) );
+		s_RelayViewers.AddToTail( viewer );
+	}
+	else
+	{
+		viewer = s_RelayViewers[ index ];
+	}
+
+	Netchan_Setup( NS_SERVER, &viewer->netchan, adr );
+	viewer->netchan.compress = ( net_compress.GetInt() && Q_atoi( Info_ValueForKey( protinfo, "lz" ) ) ) ? true : false;
+
+	rate = Q_atoi( Info_ValueForKey( userinfo, "rate" ) );
+	viewer->netchan.rate = rate ? clamp( rate, MIN_RATE, MAX_RATE ) : DEFAULT_RATE;
+
+	viewer->joined		= false;
+	viewer->streaming	= false;
+	viewer->wantsfull	= false;
+
+	// The extra argument tells the client it's watching through a relay
+	Netchan_OutOfBandPrint( NS_SERVER, adr, "%c0000000000000000 %i 1", S2C_CONNECTION, viewer->netchan.compress ? 1 : 0 );
+
+	Con_DPrintf( "Relay viewer connected, adr: %s\n", NET_AdrToString( adr ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Connectionless packet from anyone but the game server
+//-----------------------------------------------------------------------------
+static void SV_Relay_ConnectionlessPacket( void )
+{
+	char *s;
+	char *c;
+
+	MSG_BeginReading();
+	MSG_ReadLong();		// skip the -1 marker
+
+	s = MSG_ReadStringLine();
+	Cmd_TokenizeString( s );
+	c = Cmd_Argv( 0 );
+
+	if ( !Q_strcmp( c, "getchallenge" ) )
+	{
+		SVC_GetChallenge();
+	}
+	else if ( !Q_strcmp( c, "connect" ) )
+	{
+		SV_Relay_ConnectViewer();
+	}
+	else if ( !Q_strcmp( c, "rcon" ) )
+	{
+		SV_ParseRcom();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Parses what a viewer sent.  Viewers only send string commands and acks.
+// Output : false if the viewer was dropped
+//-----------------------------------------------------------------------------
+static bool SV_Relay_ExecuteViewerMessage( int index, bool datagram )
+{
+	relayviewer_t *viewer = s_RelayViewers[ index ];
+	bool delta = false;
+	char *cmd;
+	int c;
+	int i;
+
+	while ( 1 )
+	{
+		if ( MSG_IsOverflowed() )
+		{
+			SV_Relay_DropViewer( index, true );
+			return false;
+		}
+
+		// Are we at the end?
+		if ( MSG_GetReadBuf()->GetNumBitsLeft() < 8 )
+			break;
+
+		c = MSG_ReadByte();
+		switch ( c )
+		{
+		case clc_nop:
+			break;
+
+		case clc_delta:
+			MSG_GetReadBuf()->ReadUBitLong( DELTAFRAME_NUMBITS );
+			delta = true;
+			break;
+
+		case clc_stringcmd:
+			cmd = MSG_ReadString();
+			Cmd_TokenizeString( cmd );
+
+			if ( !Q_strcmp( Cmd_Argv( 0 ), "new" ) )
+			{
+				// Everything the game server sent since the level started
+				if ( !viewer->joined )
+				{
+					for ( i = 0; i < s_RelayLog.Count(); i++ )
+					{
+						SV_Relay_QueueLogEntry( viewer, &s_RelayLog[ i ] );
+					}
+				}
+				viewer->joined = true;
+			}
+			else if ( !Q_strcmp( Cmd_Argv( 0 ), "dropclient" ) || !Q_strcmp( Cmd_Argv( 0 ), "drop" ) )
+			{
+				SV_Relay_DropViewer( index, false );
+				return false;
+			}
+			// The signon replies are in the log already, everything else goes nowhere
+			break;
+
+		default:
+			// Something a game server would run, skip the rest
+			return true;
+		}
+	}
+
+	// No delta request means the viewer wants a full update
+	if ( datagram && viewer->streaming && !delta )
+	{
+		viewer->wantsfull = true;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sequenced packet from a viewer
+//-----------------------------------------------------------------------------
+static void SV_Relay_ReadViewer( int index )
+{
+	relayviewer_t *viewer = s_RelayViewers[ index ];
+
+	if ( Netchan_Process( &viewer->netchan ) )
+	{
+		if ( !SV_Relay_ExecuteViewerMessage( index, true ) )
+			return;
+	}
+
+	if ( Netchan_IncomingReady( &viewer->netchan ) )
+	{
+		if ( Netchan_CopyNormalFragments( &viewer->netchan ) )
+		{
+			MSG_BeginReading();
+			if ( !SV_Relay_ExecuteViewerMessage( index, false ) )
+				return;
+		}
+
+		if ( viewer->netchan.incomingready[ FRAG_FILE_STREAM ] )
+		{
+			Netchan_FlushIncoming( &viewer->netchan, FRAG_FILE_STREAM );
+			viewer->netchan.incomingready[ FRAG_FILE_STREAM ] = false;
+		}
+	}
+}
+
+static void SV_Relay_ReadPackets( void )
+{
+	int index;
+
+	while ( NET_GetPacket( NS_SERVER ) )
+	{
+		MSG_GetReadBuf()->Reset();
+
+		if ( Filter_ShouldDiscard( &net_from ) )
+		{
+			Filter_SendBan( &net_from );	// tell them we aren't listening...
+			continue;
+		}
+
+		if ( NET_CompareAdr( net_from, s_RelayAdr ) )
+		{
+			if ( *(int *)net_message.data == -1 )
+			{
+				SV_Relay_UpstreamConnectionless();
+			}
+			else
+			{
+				SV_Relay_ReadUpstream();
+			}
+
+			if ( s_RelayState == RELAY_DISCONNECTED )
+				return;
+			continue;
+		}
+
+		// check for connectionless packet (0xffffffff) first
+		if ( *(int *)net_message.data == -1 )
+		{
+			SV_Relay_ConnectionlessPacket();
+			continue;
+		}
+
+		index = SV_Relay_FindViewer( net_from );
+		if ( index >= 0 )
+		{
+			SV_Relay_ReadViewer( index );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+bool SV_RelayActive( void )
+{
+	return s_RelayState != RELAY_DISCONNECTED;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs in place of SV_Frame while relaying
+//-----------------------------------------------------------------------------
+void SV_RelayFrame( void )
+{
+	relayviewer_t *viewer;
+	int backlog;
+	int i;
+
+	if ( s_RelayState == RELAY_DISCONNECTED )
+		return;
+
+	VPROF( "SV_RelayFrame" );
+
+	if ( sv.active )
+	{
+		Con_Printf( "Relay stopped, a map was loaded\n" );
+		SV_RelayShutdown();
+		return;
+	}
+
+	NET_BeginSendBatch();
+
+	SV_Relay_ReadPackets();
+
+	switch ( s_RelayState )
+	{
+	case RELAY_DISCONNECTED:
+		break;
+
+	case RELAY_CHALLENGING:
+	case RELAY_CONNECTING:
+		if ( realtime < s_flRelayRetryTime )
+			break;
+
+		// Start over from the challenge, the old one may have been thrown out
+		s_RelayState = RELAY_CHALLENGING;
+		s_flRelayRetryTime = realtime + RELAY_RETRY_INTERVAL;
+		Netchan_OutOfBandPrint( NS_SERVER, s_RelayAdr, "getchallenge\n" );
+		break;
+
+	default:
+		if ( realtime - s_RelayChan.last_received > relay_timeout.GetFloat() )
+		{
+			Con_Printf( "Relay lost the connection to %s, reconnecting\n", NET_AdrToString( s_RelayAdr ) );
+			SV_Relay_Reconnect();
+		}
+		else if ( realtime - s_flRelayLastSend > RELAY_KEEPALIVE_INTERVAL )
+		{
+			SV_Relay_SendUpstream();
+		}
+		break;
+	}
+
+	for ( i = s_RelayViewers.Count() - 1; i >= 0; i-- )
+	{
+		viewer = s_RelayViewers[ i ];
+
+		if ( realtime - viewer->netchan.last_received > relay_timeout.GetFloat() )
+		{
+			SV_Relay_DropViewer( i, true );
+			continue;
+		}
+
+		// A viewer still getting the log may be as far behind as one joining now
+		backlog = relay_maxbacklog.GetInt();
+		if ( !viewer->streaming )
+		{
+			backlog += s_nRelayLogBytes;
+		}
+
+		if ( viewer->joined && Netchan_QueuedBytes( &viewer->netchan ) > backlog )
+		{
+			Con_DPrintf( "Relay viewer %s fell behind\n", NET_AdrToString( viewer->netchan.remote_address ) );
+			SV_Relay_DropViewer( i, true );
+		}
+	}
+
+	NET_FlushSendBatch();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void SV_RelayShutdown( void )
+{
+	byte final[ 13 ];
+
+	if ( s_RelayState == RELAY_DISCONNECTED )
+		return;
+
+	SV_Relay_DropViewers();
+	SV_Relay_ResetLog();
+
+	// Let the game server free the slot now instead of timing us out
+	if ( s_RelayState >= RELAY_SERVERINFO )
+	{
+		final[ 0 ] = clc_stringcmd;
+		Q_strcpy( ( char * )( final + 1 ), "dropclient\n" );
+		Netchan_Transmit( &s_RelayChan, sizeof( final ), final );
+	}
+
+	Netchan_Clear( &s_RelayChan );
+	s_RelayState = RELAY_DISCONNECTED;
+}
+
+static void SV_RelayConnect_f( void )
+{
+	char address[ MAX_OSPATH ];
+	int i;
+
+	if ( Cmd_Argc() != 2 )
+	{
+		Con_Printf( "Usage:  relay_connect <address>\n" );
+		return;
+	}
+
+	if ( cls.state != ca_dedicated || sv.active )
+	{
+		Con_Printf( "relay_connect only runs on a dedicated server without a map loaded\n" );
+		return;
+	}
+
+	Q_strncpy( address, Cmd_Argv( 1 ), sizeof( address ) - 1 );
+	address[ sizeof( address ) - 1 ] = 0;
+
+	NET_Config( true );
+
+	netadr_t adr;
+	if ( !NET_StringToAdr( address, &adr ) )
+	{
+		Con_Printf( "Bad server address %s\n", address );
+		return;
+	}
+
+	if ( adr.port == 0 )
+	{
+		adr.port = BigShort( ( unsigned short )Q_atoi( PORT_SERVER ) );
+	}
+
+	SV_RelayShutdown();
+
+	s_RelayAdr = adr;
+
+	// The game server wants a key hash, make up one per relay run
+	for ( i = 0; i < 4; i++ )
+	{
+		Q_snprintf( s_szRelayKey + i * 8, sizeof( s_szRelayKey ) - i * 8, "%08x", ( RandomInt( 0, 0xFFFF ) << 16 ) | RandomInt( 0, 0xFFFF ) );
+	}
+
+	Q_memset( &s_RelayChan, 0, sizeof( s_RelayChan ) );
+	SV_Relay_Reconnect();
+
+	Con_Printf( "Relay connecting to %s...\n", NET_AdrToString( s_RelayAdr ) );
+}
+
+static void SV_RelayDisconnect_f( void )
+{
+	if ( s_RelayState == RELAY_DISCONNECTED )
+	{
+		Con_Printf( "Relay isn't running\n" );
+		return;
+	}
+
+	SV_RelayShutdown();
+	Con_Printf( "Relay stopped\n" );
+}
+
+static void SV_RelayStatus_f( void )
+{
+	static const char *states[] = { "disconnected", "challenging", "connecting", "signing on", "streaming" };
+	relayviewer_t *viewer;
+	int i;
+
+	Con_Printf( "relay:    %s\n", states[ s_RelayState ] );
+	if ( s_RelayState == RELAY_DISCONNECTED )
+		return;
+
+	Con_Printf( "server:   %s\n", NET_AdrToString( s_RelayAdr ) );
+	Con_Printf( "log:      %i messages, %i bytes\n", s_RelayLog.Count(), s_nRelayLogBytes );
+	if ( s_RelayState >= RELAY_SERVERINFO )
+	{
+		Con_Printf( "incoming: %.1f k/s\n", s_RelayChan.flow[ FLOW_INCOMING ].avgkbytespersec );
+	}
+
+	Con_Printf( "viewers:  %i / %i\n", s_RelayViewers.Count(), relay_maxviewers.GetInt() );
+	for ( i = 0; i < s_RelayViewers.Count(); i++ )
+	{
+		viewer = s_RelayViewers[ i ];
+		Con_Printf( "  %-21s %-10s %5.1f k/s\n",
+			NET_AdrToString( viewer->netchan.remote_address ),
+			viewer->streaming ? "streaming" : ( viewer->joined ? "signon" : "connected" ),
+			viewer->netchan.flow[ FLOW_OUTGOING ].avgkbytespersec );
+	}
+}
+
+static ConCommand relay_connect( "relay_connect", SV_RelayConnect_f, "Relay the game server at <address> to spectators connecting to this server." );
+static ConCommand relay_disconnect( "relay_disconnect", SV_RelayDisconnect_f, "Stop relaying and drop the spectators." );
+static ConCommand relay_status( "relay_status", SV_RelayStatus_f, "Show the spectator relay connection and viewers." );
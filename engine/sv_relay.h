@@ -0,0 +1,22 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Spectator relay.  A dedicated server with no map loaded connects to a
+//			game server as one client and fans the stream it gets out to viewers.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef SV_RELAY_H
+#define SV_RELAY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Is the relay connected or connecting to a game server?
+bool SV_RelayActive( void );
+// Read packets from the game server and the viewers and forward the stream, once per tick
+void SV_RelayFrame( void );
+// Drop the viewers and the game server connection
+void SV_RelayShutdown( void );
+
+#endif // SV_RELAY_H
@@ -16,6 +16,8 @@ int Sys_CompareFileTime(long ft1, long ft2);
 char const* Sys_FindFirst (const char *path, char *basename);
 char const* Sys_FindNext (char *basename);
 void Sys_FindClose (void);
+void *Sys_MapFile( const char *pPath, int size );
+void Sys_UnmapFile( void *pBase, int size );
 
 
 
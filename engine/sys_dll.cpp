@@ -14,6 +14,11 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <dsound.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "quakedef.h"
@@ -233,6 +238,68 @@ void Sys_FindClose (void)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Map a file into memory.  The pages are copy on write so nothing
+//			written to them goes back to the file.
+// Input  : *pPath - full path of the file
+//			size - size the file is expected to be
+// Output : void *Sys_MapFile, NULL if it can't be mapped or isn't that size
+//-----------------------------------------------------------------------------
+void *Sys_MapFile( const char *pPath, int size )
+{
+	if ( size <= 0 )
+		return NULL;
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFile( pPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	void *pBase = NULL;
+	if ( GetFileSize( hFile, NULL ) == (DWORD)size )
+	{
+		HANDLE hMapping = CreateFileMapping( hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		if ( hMapping )
+		{
+			// the view keeps the mapping open
+			pBase = MapViewOfFile( hMapping, FILE_MAP_COPY, 0, 0, size );
+			CloseHandle( hMapping );
+		}
+	}
+	CloseHandle( hFile );
+	return pBase;
+#else
+	int fd = open( pPath, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	void *pBase = NULL;
+	struct stat buf;
+	if ( fstat( fd, &buf ) == 0 && buf.st_size == size )
+	{
+		pBase = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+		if ( pBase == MAP_FAILED )
+		{
+			pBase = NULL;
+		}
+	}
+	close( fd );
+	return pBase;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Unmap a file mapped by Sys_MapFile
+//-----------------------------------------------------------------------------
+void Sys_UnmapFile( void *pBase, int size )
+{
+#ifdef _WIN32
+	UnmapViewOfFile( pBase );
+#else
+	munmap( pBase, size );
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Set OS version # for Win32
 //-----------------------------------------------------------------------------
@@ -0,0 +1,428 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: trace_benchmark: fires packets of rays around the loaded map through
+//			IEngineTrace::TraceRay one at a time and through TraceRays, and
+//			checks that both give the same traces.
+//
+//			trace_threadtest: runs a mix of traces on the worker threads at
+//			once and checks they come out the same as on the main thread.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "quakedef.h"
+#include "enginetrace.h"
+#include "cmodel_engine.h"
+#include "gametrace.h"
+#include "server.h"
+#include "gl_model_private.h"
+#include "ispatialpartitioninternal.h"
+#include "staticpropmgr.h"
+#include "edict.h"
+#include "iservernetworkable.h"
+#include "vstdlib/random.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+
+
+// Rays in each packet, like the pellets of a shotgun blast or an NPC checking
+// lines of sight to a few spots on each of its enemies
+#define TRACE_BENCH_RAYS	MAX_PARTITION_RAYS
+#define TRACE_BENCH_LENGTH	2048.0f
+
+// Traces each worker job takes at a time in trace_threadtest
+#define TRACE_THREADTEST_CHUNK	64
+
+
+//-----------------------------------------------------------------------------
+// Picks a spot in the map that isn't inside solid
+//-----------------------------------------------------------------------------
+static bool TraceBench_FindOrigin( CUniformRandomStream &random, const Vector &worldMins, const Vector &worldMaxs, Vector &origin )
+{
+	for ( int iTry=0; iTry < 1000; iTry++ )
+	{
+		origin.Init( random.RandomFloat( worldMins.x, worldMaxs.x ),
+			random.RandomFloat( worldMins.y, worldMaxs.y ),
+			random.RandomFloat( worldMins.z, worldMaxs.z ) );
+
+		if ( ( CM_PointContents( origin, 0 ) & MASK_SOLID ) == 0 )
+			return true;
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Same fraction and end point, and the same entity unless two were hit at the
+// same fraction
+//-----------------------------------------------------------------------------
+static bool TraceBench_TracesMatch( const trace_t &a, const trace_t &b, bool *pTie )
+{
+	*pTie = false;
+	if ( a.fraction != b.fraction || a.startsolid != b.startsolid || a.allsolid != b.allsolid ||
+		a.endpos != b.endpos || a.contents != b.contents )
+	{
+		return false;
+	}
+
+	if ( a.m_pEnt != b.m_pEnt )
+	{
+		*pTie = true;
+	}
+	return true;
+}
+
+
+static void Trace_Benchmark_f( void )
+{
+	if ( !sv.active || !host_state.worldmodel )
+	{
+		Con_Printf( "trace_benchmark: no map loaded.\n" );
+		return;
+	}
+
+	int nPackets = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 256;
+	float flSpread = ( Cmd_Argc() > 2 ) ? atof( Cmd_Argv( 2 ) ) : 10.0f;
+	int nIterations = ( Cmd_Argc() > 3 ) ? atoi( Cmd_Argv( 3 ) ) : 10;
+	nPackets = max( nPackets, 1 );
+	nIterations = max( nIterations, 1 );
+
+	// The same rays every time for a given set of arguments
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	// Each packet starts from one spot and fans out within flSpread degrees of a random direction
+	int nRays = nPackets * TRACE_BENCH_RAYS;
+	Ray_t *pRays = new Ray_t[nRays];
+	for ( int iPacket=0; iPacket < nPackets; iPacket++ )
+	{
+		Vector origin;
+		if ( !TraceBench_FindOrigin( random, host_state.worldmodel->mins, host_state.worldmodel->maxs, origin ) )
+		{
+			Con_Printf( "trace_benchmark: couldn't find any empty space in the map.\n" );
+			delete [] pRays;
+			return;
+		}
+
+		QAngle aim( random.RandomFloat( -45, 45 ), random.RandomFloat( 0, 360 ), 0 );
+		for ( int iRay=0; iRay < TRACE_BENCH_RAYS; iRay++ )
+		{
+			QAngle angles( aim.x + random.RandomFloat( -flSpread, flSpread ), aim.y + random.RandomFloat( -flSpread, flSpread ), 0 );
+			Vector forward;
+			AngleVectors( angles, &forward );
+
+			pRays[iPacket * TRACE_BENCH_RAYS + iRay].Init( origin, origin + forward * TRACE_BENCH_LENGTH );
+		}
+	}
+
+	trace_t *pSingleTraces = new trace_t[nRays];
+	trace_t *pBatchTraces = new trace_t[nRays];
+	CTraceFilterHitAll filter;
+
+	// First make sure both ways come up with the same traces.
+	int iRay;
+	for ( iRay=0; iRay < nRays; iRay++ )
+	{
+		g_pEngineTraceServer->TraceRay( pRays[iRay], MASK_SHOT, &filter, &pSingleTraces[iRay] );
+	}
+	g_pEngineTraceServer->TraceRays( pRays, nRays, MASK_SHOT, &filter, pBatchTraces );
+
+	int nMismatches = 0;
+	int nTies = 0;
+	int nHits = 0;
+	for ( iRay=0; iRay < nRays; iRay++ )
+	{
+		bool bTie;
+		if ( !TraceBench_TracesMatch( pSingleTraces[iRay], pBatchTraces[iRay], &bTie ) )
+		{
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "trace_benchmark: ray %d: TraceRay fraction %f, TraceRays fraction %f\n",
+					iRay, pSingleTraces[iRay].fraction, pBatchTraces[iRay].fraction );
+			}
+			++nMismatches;
+		}
+
+		if ( bTie )
+		{
+			++nTies;
+		}
+
+		if ( pSingleTraces[iRay].DidHit() )
+		{
+			++nHits;
+		}
+	}
+
+	// Now time them.
+	CFastTimer singleTimer;
+	singleTimer.Start();
+	for ( int iSingleIteration=0; iSingleIteration < nIterations; iSingleIteration++ )
+	{
+		for ( iRay=0; iRay < nRays; iRay++ )
+		{
+			g_pEngineTraceServer->TraceRay( pRays[iRay], MASK_SHOT, &filter, &pSingleTraces[iRay] );
+		}
+	}
+	singleTimer.End();
+
+	CFastTimer batchTimer;
+	batchTimer.Start();
+	for ( int iBatchIteration=0; iBatchIteration < nIterations; iBatchIteration++ )
+	{
+		for ( int iPacket=0; iPacket < nPackets; iPacket++ )
+		{
+			g_pEngineTraceServer->TraceRays( &pRays[iPacket * TRACE_BENCH_RAYS], TRACE_BENCH_RAYS, 
+				MASK_SHOT, &filter, &pBatchTraces[iPacket * TRACE_BENCH_RAYS] );
+		}
+	}
+	batchTimer.End();
+
+	double flSingleMS = singleTimer.GetDuration().GetMillisecondsF();
+	double flBatchMS = batchTimer.GetDuration().GetMillisecondsF();
+	double flRays = (double)nRays * nIterations;
+
+	Con_Printf( "\ntrace_benchmark: %s, %d packets of %d rays, %.0f degree spread, %d iterations\n",
+		sv.name, nPackets, TRACE_BENCH_RAYS, flSpread, nIterations );
+	Con_Printf( "%d of %d rays hit something.\n", nHits, nRays );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Path          Total ms      Rays/sec\n" );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "TraceRay    %10.3f  %12.0f\n", flSingleMS, ( flSingleMS > 0 ) ? flRays * 1000.0 / flSingleMS : 0.0 );
+	Con_Printf( "TraceRays   %10.3f  %12.0f\n", flBatchMS, ( flBatchMS > 0 ) ? flRays * 1000.0 / flBatchMS : 0.0 );
+	Con_Printf( "Speedup: %.2fx\n", ( flBatchMS > 0 ) ? flSingleMS / flBatchMS : 0.0 );
+
+	if ( nMismatches )
+	{
+		Con_Printf( "%d of %d traces did NOT match.\n", nMismatches, nRays );
+	}
+	else
+	{
+		Con_Printf( "All traces matched.\n" );
+	}
+
+	if ( nTies )
+	{
+		Con_Printf( "%d traces hit two entities at the same fraction and reported different ones.\n", nTies );
+	}
+	Con_Printf( "\n" );
+
+	delete [] pRays;
+	delete [] pSingleTraces;
+	delete [] pBatchTraces;
+}
+
+static ConCommand trace_benchmark( "trace_benchmark", Trace_Benchmark_f, "Time IEngineTrace::TraceRays against TraceRay on each ray, firing packets of rays around the loaded map, and check they give the same traces. Usage: trace_benchmark [packets] [spread degrees] [iterations]" );
+
+
+//-----------------------------------------------------------------------------
+// Only lets through what the engine can trace on its own.  Static props and
+// SOLID_VPHYSICS entities go through vphysics, and custom ray tests call into
+// the game dll, neither of which is safe on a worker thread.
+//-----------------------------------------------------------------------------
+class CTraceFilterThreadSafe : public CTraceFilter
+{
+public:
+	virtual TraceType_t	GetTraceType() const
+	{
+		return TRACE_EVERYTHING_FILTER_PROPS;
+	}
+
+	virtual bool ShouldHitEntity( IHandleEntity *pHandleEntity, int contentsMask )
+	{
+		if ( StaticPropMgr()->IsStaticProp( pHandleEntity ) )
+			return false;
+
+		edict_t *pEdict = static_cast<IServerNetworkable*>( pHandleEntity )->GetEdict();
+		ICollideable *pCollide = pEdict ? pEdict->GetCollideable() : NULL;
+		if ( !pCollide )
+			return false;
+
+		if ( pCollide->GetSolidFlags() & ( FSOLID_CUSTOMRAYTEST | FSOLID_CUSTOMBOXTEST ) )
+			return false;
+
+		return ( pCollide->GetSolid() == SOLID_BBOX ) || ( pCollide->GetSolid() == SOLID_BSP );
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+// Every field a caller might look at has to match exactly
+//-----------------------------------------------------------------------------
+static bool TraceThreadTest_TracesMatch( const trace_t &a, const trace_t &b )
+{
+	return ( a.fraction == b.fraction ) && ( a.endpos == b.endpos ) &&
+		( a.startsolid == b.startsolid ) && ( a.allsolid == b.allsolid ) &&
+		( a.contents == b.contents ) && ( a.plane.normal == b.plane.normal ) &&
+		( a.plane.dist == b.plane.dist ) && ( a.m_pEnt == b.m_pEnt ) &&
+		( a.surface.name == b.surface.name ) && ( a.surface.surfaceProps == b.surface.surfaceProps ) &&
+		( a.surface.flags == b.surface.flags ) && ( a.dispFlags == b.dispFlags );
+}
+
+
+struct TraceThreadTestJob_t
+{
+	const Ray_t		*m_pRays;
+	trace_t			*m_pTraces;
+	int				m_nRays;
+	ITraceFilter	*m_pFilter;
+};
+
+static void TraceThreadTest_Job( void *pContext, int iChunk )
+{
+	TraceThreadTestJob_t *pJob = (TraceThreadTestJob_t *)pContext;
+
+	int iFirst = iChunk * TRACE_THREADTEST_CHUNK;
+	int iLast = min( iFirst + TRACE_THREADTEST_CHUNK, pJob->m_nRays );
+	for ( int iRay=iFirst; iRay < iLast; iRay++ )
+	{
+		g_pEngineTraceServer->TraceRay( pJob->m_pRays[iRay], MASK_SOLID, pJob->m_pFilter, &pJob->m_pTraces[iRay] );
+	}
+}
+
+
+static void Trace_ThreadTest_f( void )
+{
+	if ( !sv.active || !host_state.worldmodel )
+	{
+		Con_Printf( "trace_threadtest: no map loaded.\n" );
+		return;
+	}
+
+	int nRays = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 16384;
+	int nThreads = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 4;
+	int nIterations = ( Cmd_Argc() > 3 ) ? atoi( Cmd_Argv( 3 ) ) : 10;
+	nRays = max( nRays, 1 );
+	nThreads = clamp( nThreads, 0, THREADPOOL_MAX_THREADS );
+	nIterations = max( nIterations, 1 );
+
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	// A third each of lines, swept hulls and boxes that don't move, so the
+	// box hull and every brush and displacement test gets hit from all threads
+	Ray_t *pRays = new Ray_t[nRays];
+	int iRay;
+	for ( iRay=0; iRay < nRays; iRay++ )
+	{
+		Vector start;
+		if ( !TraceBench_FindOrigin( random, host_state.worldmodel->mins, host_state.worldmodel->maxs, start ) )
+		{
+			Con_Printf( "trace_threadtest: couldn't find any empty space in the map.\n" );
+			delete [] pRays;
+			return;
+		}
+
+		QAngle angles( random.RandomFloat( -90, 90 ), random.RandomFloat( 0, 360 ), 0 );
+		Vector forward;
+		AngleVectors( angles, &forward );
+		Vector end = start + forward * random.RandomFloat( 16.0f, TRACE_BENCH_LENGTH );
+
+		Vector extents( random.RandomFloat( 4, 32 ), random.RandomFloat( 4, 32 ), random.RandomFloat( 4, 36 ) );
+		switch ( iRay % 3 )
+		{
+		case 0:
+			pRays[iRay].Init( start, end );
+			break;
+		case 1:
+			pRays[iRay].Init( start, end, -extents, extents );
+			break;
+		default:
+			pRays[iRay].Init( start, start, -extents, extents );
+			break;
+		}
+	}
+
+	trace_t *pReferenceTraces = new trace_t[nRays];
+	trace_t *pThreadedTraces = new trace_t[nRays];
+	CTraceFilterThreadSafe filter;
+
+	// Reference traces, on this thread
+	CFastTimer serialTimer;
+	serialTimer.Start();
+	for ( int iSerialIteration=0; iSerialIteration < nIterations; iSerialIteration++ )
+	{
+		for ( iRay=0; iRay < nRays; iRay++ )
+		{
+			g_pEngineTraceServer->TraceRay( pRays[iRay], MASK_SOLID, &filter, &pReferenceTraces[iRay] );
+		}
+	}
+	serialTimer.End();
+
+	TraceThreadTestJob_t job;
+	job.m_pRays = pRays;
+	job.m_pTraces = pThreadedTraces;
+	job.m_nRays = nRays;
+	job.m_pFilter = &filter;
+	int nChunks = ( nRays + TRACE_THREADTEST_CHUNK - 1 ) / TRACE_THREADTEST_CHUNK;
+
+	// Check every iteration, a race won't necessarily show up the first time
+	int nSavedThreads = ThreadPool_GetThreadCount();
+	ThreadPool_SetThreadCount( nThreads );
+	CM_ReclaimTraceInfos();
+
+	int nMismatches = 0;
+	double flThreadMS = 0.0;
+	for ( int iThreadIteration=0; iThreadIteration < nIterations; iThreadIteration++ )
+	{
+		CFastTimer threadTimer;
+		threadTimer.Start();
+		ThreadPool_ParallelFor( nChunks, TraceThreadTest_Job, &job );
+		threadTimer.End();
+		flThreadMS += threadTimer.GetDuration().GetMillisecondsF();
+
+		for ( iRay=0; iRay < nRays; iRay++ )
+		{
+			if ( TraceThreadTest_TracesMatch( pReferenceTraces[iRay], pThreadedTraces[iRay] ) )
+				continue;
+
+			if ( nMismatches < 5 )
+			{
+				Con_Printf( "trace_threadtest: iteration %d, ray %d: fraction %f on the main thread, %f threaded\n",
+					iThreadIteration, iRay, pReferenceTraces[iRay].fraction, pThreadedTraces[iRay].fraction );
+			}
+			++nMismatches;
+		}
+	}
+
+	ThreadPool_SetThreadCount( nSavedThreads );
+	CM_ReclaimTraceInfos();
+
+	int nHits = 0;
+	for ( iRay=0; iRay < nRays; iRay++ )
+	{
+		if ( pReferenceTraces[iRay].DidHit() )
+		{
+			++nHits;
+		}
+	}
+
+	double flSerialMS = serialTimer.GetDuration().GetMillisecondsF();
+	double flRays = (double)nRays * nIterations;
+
+	Con_Printf( "\ntrace_threadtest: %s, %d traces, %d worker threads, %d iterations\n",
+		sv.name, nRays, nThreads, nIterations );
+	Con_Printf( "%d of %d traces hit something.\n", nHits, nRays );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Path          Total ms    Traces/sec\n" );
+	Con_Printf( "-------------------------------------------\n" );
+	Con_Printf( "Main thread %10.3f  %12.0f\n", flSerialMS, ( flSerialMS > 0 ) ? flRays * 1000.0 / flSerialMS : 0.0 );
+	Con_Printf( "Threaded    %10.3f  %12.0f\n", flThreadMS, ( flThreadMS > 0 ) ? flRays * 1000.0 / flThreadMS : 0.0 );
+	Con_Printf( "Speedup: %.2fx\n", ( flThreadMS > 0 ) ? flSerialMS / flThreadMS : 0.0 );
+
+	if ( nMismatches )
+	{
+		Con_Printf( "%d of %d threaded traces did NOT match.\n", nMismatches, nRays * nIterations );
+	}
+	else
+	{
+		Con_Printf( "All traces matched.\n" );
+	}
+	Con_Printf( "\n" );
+
+	delete [] pRays;
+	delete [] pReferenceTraces;
+	delete [] pThreadedTraces;
+}
+
+static ConCommand trace_threadtest( "trace_threadtest", Trace_ThreadTest_f, "Run traces on the worker threads at the same time and check they match the same traces run on the main thread. Static props and vphysics entities are skipped. Usage: trace_threadtest [traces] [threads] [iterations]" );
@@ -21,6 +21,7 @@
 #include "cmd.h"
 
 #include "tier0/vprof.h"
+#include "vstdlib/strtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,6 +29,7 @@
 
 #ifdef VPROF_ENABLED
 static ConVar vprof_dump_spikes( "vprof_dump_spikes","0", 0, "Framerate at which vprof will begin to dump spikes to the console. 0 = disabled." );
+static ConVar vprof_trace_budget( "vprof_trace_budget", "0", 0, "While vprof_trace is recording, write the trace out whenever a server tick takes longer than this many msec. 0 = disabled." );
 
 static void (*g_pfnDeferredOp)();
 
@@ -154,6 +156,77 @@ DEFERRED_CON_COMMAND(vprof_generate_report_AI_only, "Generate a report to the co
 	g_VProfCurrentProfile.Resume();
 }
 
+//-----------------------------------------------------------------------------
+// Timeline trace
+//-----------------------------------------------------------------------------
+
+static double g_flTraceTickStart;
+static double g_flLastTraceDumpTime;
+
+static void VProfTrace_Write( const char *pszFileName )
+{
+	if ( g_VProfTrace.WriteChromeTrace( pszFileName ) )
+	{
+		Msg( "VProf trace written to %s\n", pszFileName );
+	}
+	else
+	{
+		Msg( "Couldn't write VProf trace to %s\n", pszFileName );
+	}
+}
+
+void VProfTrace_BeginTick( int tick )
+{
+	if ( !g_VProfTrace.IsRecording() )
+		return;
+
+	g_VProfTrace.MarkTick( tick );
+	g_flTraceTickStart = Sys_FloatTime();
+}
+
+void VProfTrace_EndTick( int tick )
+{
+	if ( !g_VProfTrace.IsRecording() || vprof_trace_budget.GetFloat() <= 0 )
+		return;
+
+	double now = Sys_FloatTime();
+	double msec = ( now - g_flTraceTickStart ) * 1000.0;
+	if ( msec <= vprof_trace_budget.GetFloat() )
+		return;
+
+	// Don't write a file every tick when the server is just slow
+	if ( now - g_flLastTraceDumpTime <= MAX_SPIKE_REPORT )
+		return;
+
+	char szFileName[ 64 ];
+	Q_snprintf( szFileName, sizeof( szFileName ), "vprof_trace_%d.json", tick );
+
+	Msg( "Tick %d took %.2f msec, over vprof_trace_budget\n", tick, msec );
+	VProfTrace_Write( szFileName );
+
+	g_flLastTraceDumpTime = Sys_FloatTime();
+}
+
+DEFERRED_CON_COMMAND(vprof_trace, "Toggle recording the VProf timeline trace")
+{
+	if ( !g_VProfTrace.IsRecording() )
+	{
+		Msg("VProf trace recording.\n");
+		g_VProfTrace.Start();
+	}
+	else
+	{
+		Msg("VProf trace stopped.\n");
+		g_VProfTrace.Stop();
+	}
+}
+
+// Runs from Cbuf_Execute on the primary thread, between ticks, so nothing is recording
+CON_COMMAND(vprof_trace_dump, "Write the VProf timeline trace as a Chrome trace ( chrome://tracing ). Optional file name.")
+{
+	VProfTrace_Write( ( Cmd_Argc() > 1 ) ? Cmd_Argv( 1 ) : "vprof_trace.json" );
+}
+
 #ifdef MOVE_BACK_TO_PANEL
 	DEFERRED_CON_COMMAND(vprof_expand_all, "Expand the whole vprof tree")
 	{
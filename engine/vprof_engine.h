@@ -11,4 +11,8 @@
 void PreUpdateProfile();
 void PostUpdateProfile();
 
+// Server tick boundaries for the timeline trace
+void VProfTrace_BeginTick( int tick );
+void VProfTrace_EndTick( int tick );
+
 #endif
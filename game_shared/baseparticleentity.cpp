@@ -13,6 +13,10 @@ END_PREDICTION_DATA()
 
 CBaseParticleEntity::CBaseParticleEntity( void )
 {
+#if !defined( CLIENT_DLL )
+	// ShouldTransmit below is a plain area + PVS test.
+	SetTransmitPVSBound( true );
+#endif
 }
 
 #if !defined( CLIENT_DLL )
@@ -26,6 +26,9 @@ class hk_Breakable_Constraint : public hk_Constraint
 
 		virtual void init_constraint(const void /*blueprint*/ *);
 
+		virtual bool fires_events() { return true; }
+			//: breaking fires the constraint broken event
+
 		void write_to_blueprint( hk_Breakable_Constraint_BP * );
 		void FireEventIfBroken();
 
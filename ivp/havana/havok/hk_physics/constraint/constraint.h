@@ -48,6 +48,9 @@ public:
 
 	virtual void init_constraint(const void /*blueprint*/ *) = 0;
 		//: Set the constraint parameters from the blueprrint
+
+	virtual bool fires_events() { return false; }
+		//: true if stepping the constraint may call back into the environment
 };
 
 #endif /* HK_PHYSICS_CONSTRAINT_H */
@@ -123,6 +123,16 @@ public:
      ********************************************************************************/
     virtual IVP_CONTROLLER_PRIORITY get_controller_priority() = 0;
 
+    /********************************************************************************
+     *	Name:	  	controller_is_thread_safe   	
+     *	Description:	Return IVP_TRUE if do_simulation_controller only changes the cores
+     *			in core_list and its own data, never uses the environment's
+     *			memory managers and never calls back into the application.
+     *			Simulation units which only have such controllers are
+     *			simulated on the IVP_Thread_Pool, if there is one.
+     ********************************************************************************/
+    virtual IVP_BOOL controller_is_thread_safe() { return IVP_FALSE; };
+
     virtual ~IVP_Controller() { ; };
 };
 
@@ -144,6 +154,7 @@ public:
 
     void do_simulation_controller(IVP_Event_Sim *,IVP_U_Vector<IVP_Core> *core_list);
     IVP_CONTROLLER_PRIORITY get_controller_priority() { return IVP_CP_GRAVITY; };
+    IVP_BOOL controller_is_thread_safe() { return IVP_TRUE; };
     virtual ~IVP_Standard_Gravity_Controller() { ; };
     void core_is_going_to_be_deleted_event(IVP_Core *) { ; }
 };
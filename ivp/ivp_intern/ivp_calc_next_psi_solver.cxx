@@ -199,7 +199,7 @@ void IVP_Calc_Next_PSI_Solver::calc_next_PSI_matrix(IVP_Event_Sim *event_sim,IVP
 	IVP_Real_Object *r_obj = core->objects.element_at(c);
 	IVP_Hull_Manager *h_manager = r_obj->get_hull_manager();
 	h_manager->increase_hull_by_x(event_sim->environment->get_current_time(), event_sim->delta_time, new_speed, core->current_speed);
-	if (h_manager->are_events_in_hull()){
+	if (active_hull_managers_out && h_manager->are_events_in_hull()){	// NULL: caller collects them (parallel version)
 	    active_hull_managers_out->add(h_manager);
 	}
     }
@@ -341,9 +341,49 @@ void IVP_Calc_Next_PSI_Solver::prefetch0_calc_next_PSI_matrix(IVP_Core *core)
 }
 
 
+// below this the thread pool costs more than it saves
+#define IVP_PARALLEL_PSI_MIN_CORES 64
+#define IVP_PARALLEL_PSI_CORES_PER_JOB 16
+
+struct IVP_Calc_Next_PSI_Job {
+    IVP_Event_Sim *es;
+    IVP_U_Vector<IVP_Core> *cores;
+};
+
+static void ivp_calc_next_PSI_matrix_job( void *context, int job_index ) {
+    IVP_Calc_Next_PSI_Job *job = (IVP_Calc_Next_PSI_Job *)context;
+    int first = job_index * IVP_PARALLEL_PSI_CORES_PER_JOB;
+    int last = first + IVP_PARALLEL_PSI_CORES_PER_JOB;
+    if ( last > job->cores->len() ) last = job->cores->len();
+    for (int i = first; i < last; i++){
+	IVP_Calc_Next_PSI_Solver nps(job->cores->element_at(i));
+	nps.calc_next_PSI_matrix(job->es, NULL);
+    }
+}
+
 void IVP_Calc_Next_PSI_Solver::commit_all_calc_next_PSI_matrix(IVP_Environment *env, IVP_U_Vector<IVP_Core> *cores_which_needs_calc_next_psi, IVP_U_Vector<IVP_Hull_Manager_Base> *active_hulls_out){
     IVP_Event_Sim es(env, env->get_delta_PSI_time());
     int i;
+    IVP_Thread_Pool *pool = env->get_thread_pool();
+    if ( pool && pool->has_workers() && cores_which_needs_calc_next_psi->len() >= IVP_PARALLEL_PSI_MIN_CORES ){
+	// cores are independent, only the hull managers have to be collected in the same order as below
+	IVP_Calc_Next_PSI_Job job;
+	job.es = &es;
+	job.cores = cores_which_needs_calc_next_psi;
+	int n_jobs = ( cores_which_needs_calc_next_psi->len() + IVP_PARALLEL_PSI_CORES_PER_JOB - 1 ) / IVP_PARALLEL_PSI_CORES_PER_JOB;
+	pool->run_jobs( n_jobs, ivp_calc_next_PSI_matrix_job, &job );
+
+	for (i = cores_which_needs_calc_next_psi->len()-1; i>=0; i--){
+	    IVP_Core *core = cores_which_needs_calc_next_psi->element_at(i);
+	    for(int c = core->objects.len()-1;c>=0;c--){
+		IVP_Hull_Manager *h_manager = core->objects.element_at(c)->get_hull_manager();
+		if (h_manager->are_events_in_hull()){
+		    active_hulls_out->add(h_manager);
+		}
+	    }
+	}
+	return;
+    }
     for (i = cores_which_needs_calc_next_psi->len()-1; i>1;i--){
 	IVP_IF_PREFETCH_ENABLED(IVP_TRUE){
 	    IVP_Core *pcore = cores_which_needs_calc_next_psi->element_at(i-2);
@@ -261,6 +261,7 @@ IVP_Simulation_Unit::IVP_Simulation_Unit() {
     sim_unit_movement_type = IVP_MT_NOT_SIM;
     sim_unit_just_slowed_down = IVP_FALSE;
     sim_unit_has_fast_objects = IVP_FALSE;
+    sim_unit_check_movement_state = IVP_FALSE;
 }
 
 void IVP_Simulation_Unit::rem_sim_unit_controller( IVP_Controller *rem_controller ) {
@@ -712,16 +713,20 @@ void IVP_Simulation_Unit::init_moving_core_for_psi(IVP_Core *core, const IVP_Tim
 
 
 void IVP_Simulation_Unit::simulate_single_sim_unit_psi(IVP_Event_Sim *es, IVP_U_Vector<IVP_Core> *touched_cores) {
+    es->sim_unit = this;
+    es->environment->sim_unit_mem->start_memory_transaction();
+    this->prepare_sim_unit_psi(es);
+    this->do_sim_unit_controllers_psi(es);
+    this->finish_sim_unit_psi(es, touched_cores);
+    es->environment->sim_unit_mem->end_memory_transaction();
+}
+
+void IVP_Simulation_Unit::prepare_sim_unit_psi(IVP_Event_Sim *es) {
 #ifdef DEBUG
     IVP_IF(1) {
         this->sim_unit_debug_consistency();
     }
 #endif
-    es->sim_unit = this;
-    es->environment->sim_unit_mem->start_memory_transaction();
-    
-    int controller_num=controller_cores.len();
-
     IVP_Time current_time = es->environment->get_current_time();
 
     int fast_moving_flag = 0;
@@ -767,19 +772,22 @@ void IVP_Simulation_Unit::simulate_single_sim_unit_psi(IVP_Event_Sim *es, IVP_U_
 	fast_moving_flag |= fast_moving_core;
     }
 
-    IVP_BOOL check_movement_state;
     if( fast_moving_flag < 0 ) {
 	this->sim_unit_has_fast_objects = IVP_TRUE;
-	check_movement_state = es->environment->must_perform_movement_check(); //do not always make movement check
-//	check_movement_state = IVP_FALSE;   // this might be wrong if flag is set to IVP_MT_SLOW
+	sim_unit_check_movement_state = es->environment->must_perform_movement_check(); //do not always make movement check
+//	sim_unit_check_movement_state = IVP_FALSE;   // this might be wrong if flag is set to IVP_MT_SLOW
     } else {
 	this->sim_unit_just_slowed_down = this->sim_unit_has_fast_objects;
 	if(sim_unit_just_slowed_down) {
 	    this->sim_unit_clear_movement_check_values();
 	}
 	sim_unit_has_fast_objects = IVP_FALSE;
-	check_movement_state = es->environment->must_perform_movement_check(); //do not always make movement check
+	sim_unit_check_movement_state = es->environment->must_perform_movement_check(); //do not always make movement check
     }
+}
+
+void IVP_Simulation_Unit::do_sim_unit_controllers_psi(IVP_Event_Sim *es) {
+    int controller_num=controller_cores.len();
 
     //controllers are sorted
     for(int j=controller_num-1;j>=0;j--) {
@@ -796,7 +804,9 @@ void IVP_Simulation_Unit::simulate_single_sim_unit_psi(IVP_Event_Sim *es, IVP_U_
 	    }
 	}
     }    
-    
+}
+
+void IVP_Simulation_Unit::finish_sim_unit_psi(IVP_Event_Sim *es, IVP_U_Vector<IVP_Core> *touched_cores) {
     for (int c = sim_unit_cores.len()-1; c>=0; c--) {
 	IVP_Core *core = sim_unit_cores.element_at(c);
         core->calc_next_PSI_matrix(touched_cores, es);
@@ -805,7 +815,7 @@ void IVP_Simulation_Unit::simulate_single_sim_unit_psi(IVP_Event_Sim *es, IVP_U_
 	}
     }
 
-    if(check_movement_state==IVP_TRUE) {
+    if(sim_unit_check_movement_state==IVP_TRUE) {
 	this->sim_unit_calc_movement_state(es->environment);
     }
     
@@ -821,7 +831,16 @@ void IVP_Simulation_Unit::simulate_single_sim_unit_psi(IVP_Event_Sim *es, IVP_U_
     if(union_find_needed_for_sim_unit) {
         do_sim_unit_union_find();
     }
-    es->environment->sim_unit_mem->end_memory_transaction();
+}
+
+IVP_BOOL IVP_Simulation_Unit::sim_unit_controllers_are_thread_safe() {
+    for (int j = controller_cores.len()-1; j>=0; j--) {
+	IVP_Controller *my_controller = controller_cores.element_at(j)->l_controller;
+	if ( !my_controller->controller_is_thread_safe() ) {
+	    return IVP_FALSE;
+	}
+    }
+    return IVP_TRUE;
 }
 
 void IVP_Simulation_Unit::reset_time( IVP_Time offset){
@@ -858,6 +877,10 @@ void IVP_Sim_Units_Manager::simulate_sim_units_psi(IVP_Environment *env, IVP_U_V
     IVP_Simulation_Unit *n2_su;
 
     IVP_Sim_Units_Manager *sman = this;
+    if ( env->get_thread_pool() && env->get_thread_pool()->has_workers() ) {
+	sman->simulate_sim_units_psi_parallel(env, touched_cores);
+	return;
+    }
     IVP_Event_Sim es(env);
 
     s_u = sman->sim_units_slots[0];
@@ -916,6 +939,68 @@ sim_units_0:
 #endif
 }
 
+static void ivp_sim_unit_controllers_job( void *context, int job_index ) {
+    IVP_Sim_Units_Manager *sman = (IVP_Sim_Units_Manager *)context;
+    IVP_Simulation_Unit *s_u = sman->psi_parallel_sim_units.element_at(job_index);
+    IVP_Event_Sim es(sman->l_environment);
+    es.sim_unit = s_u;
+    s_u->do_sim_unit_controllers_psi(&es);
+}
+
+/********************************************************************************
+ *	Name:	    	simulate_sim_units_psi_parallel
+ *	Description:	Same as simulate_sim_units_psi, but the controllers of all
+ *			sim units which only have thread safe controllers are run on
+ *			the environment's thread pool.  Everything touching more than
+ *			the sim unit itself (movement checks, friction systems,
+ *			union find, memory transactions) stays in this thread and
+ *			always happens in the same order, so the result does not
+ *			depend on the number of threads.
+ ********************************************************************************/
+void IVP_Sim_Units_Manager::simulate_sim_units_psi_parallel(IVP_Environment *env, IVP_U_Vector<IVP_Core> *touched_cores) {
+    IVP_Event_Sim es(env);
+
+    // units split off by the union find are added at the head and wait for the next psi, same as in the linked list walk
+    psi_sim_units.remove_all();
+    psi_parallel_sim_units.remove_all();
+    IVP_Simulation_Unit *s_u;
+    for ( s_u = sim_units_slots[0]; s_u; s_u = s_u->next_sim_unit ) {
+	psi_sim_units.add(s_u);
+    }
+
+    int i;
+    for ( i = 0; i < psi_sim_units.len(); i++ ) {
+	s_u = psi_sim_units.element_at(i);
+	if ( !s_u->sim_unit_controllers_are_thread_safe() ) continue;
+	es.sim_unit = s_u;
+	env->sim_unit_mem->start_memory_transaction();
+	s_u->prepare_sim_unit_psi(&es);
+	env->sim_unit_mem->end_memory_transaction();
+	psi_parallel_sim_units.add(s_u);
+    }
+
+    int n_parallel = psi_parallel_sim_units.len();
+    if ( n_parallel > 1 ) {
+	env->get_thread_pool()->run_jobs( n_parallel, ivp_sim_unit_controllers_job, this );
+    } else if ( n_parallel == 1 ) {
+	ivp_sim_unit_controllers_job( this, 0 );
+    }
+
+    int p = 0;
+    for ( i = 0; i < psi_sim_units.len(); i++ ) {
+	s_u = psi_sim_units.element_at(i);
+	if ( p < n_parallel && psi_parallel_sim_units.element_at(p) == s_u ) {
+	    p++;
+	    es.sim_unit = s_u;
+	    env->sim_unit_mem->start_memory_transaction();
+	    s_u->finish_sim_unit_psi(&es, touched_cores);
+	    env->sim_unit_mem->end_memory_transaction();
+	} else {
+	    s_u->simulate_single_sim_unit_psi(&es, touched_cores);
+	}
+    }
+}
+
 void IVP_Sim_Units_Manager::reset_time( IVP_Time offset){
     for ( IVP_Simulation_Unit *s = this->sim_units_slots[0];
 	  s;
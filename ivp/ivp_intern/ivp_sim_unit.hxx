@@ -25,6 +25,7 @@ public:
     IVP_BOOL union_find_needed_for_sim_unit:2;
     IVP_BOOL sim_unit_has_fast_objects:2; //fast moving objects: some optimizations like: no energy controll ...
     IVP_BOOL sim_unit_just_slowed_down:2; //changing from fast moving to slowly moving
+    IVP_BOOL sim_unit_check_movement_state:2; //set by prepare_sim_unit_psi for finish_sim_unit_psi
     
     IVP_Simulation_Unit *prev_sim_unit;
     IVP_Simulation_Unit *next_sim_unit;
@@ -73,6 +74,12 @@ public:
 
     void reset_time( IVP_Time offset);
     void simulate_single_sim_unit_psi(class IVP_Event_Sim *es, IVP_U_Vector<IVP_Core> *touched_cores_out);
+
+    // simulate_single_sim_unit_psi in three steps, only do_sim_unit_controllers_psi may run in a worker thread
+    void prepare_sim_unit_psi(class IVP_Event_Sim *es);		// init cores for psi
+    void do_sim_unit_controllers_psi(class IVP_Event_Sim *es);
+    void finish_sim_unit_psi(class IVP_Event_Sim *es, IVP_U_Vector<IVP_Core> *touched_cores_out); // movement state, mindists, union find
+    IVP_BOOL sim_unit_controllers_are_thread_safe();
     
 //    inline void prefetch0_simulate_single_sim_unit_psi();   // first level prefetch
 //    inline void prefetch1_simulate_single_sim_unit_psi();   // second level prefetch
@@ -93,6 +100,9 @@ public:
   
     IVP_Simulation_Unit *sim_units_slots[ IVP_SIM_SLOTS_NUM ];
     IVP_Simulation_Unit *still_slot;
+
+    IVP_U_Vector<IVP_Simulation_Unit> psi_sim_units;		// simulate_sim_units_psi_parallel: all units at the start of the psi
+    IVP_U_Vector<IVP_Simulation_Unit> psi_parallel_sim_units;	// the ones with thread safe controllers
   
     IVP_Sim_Units_Manager(IVP_Environment *env);
     void add_sim_unit_to_manager(IVP_Simulation_Unit *sim_u);
@@ -101,6 +111,7 @@ public:
     void rem_unit_from_slot(IVP_Simulation_Unit *sim_u,IVP_Simulation_Unit **slot);
 
     void simulate_sim_units_psi(IVP_Environment *env, IVP_U_Vector<IVP_Core> *touched_cores_out);
+    void simulate_sim_units_psi_parallel(IVP_Environment *env, IVP_U_Vector<IVP_Core> *touched_cores_out);
 
     void reset_time( IVP_Time offset );
 };
@@ -209,6 +209,16 @@ void hk_Local_Constraint_System::apply_effector_PSI( hk_PSI_Info& pi, hk_Array<h
 	}
 }
 
+IVP_BOOL hk_Local_Constraint_System::controller_is_thread_safe()
+{
+	for ( int i = 0; i < m_constraints.length(); i++ ){
+		if ( m_constraints.element_at(i)->fires_events() ){
+			return IVP_FALSE;
+		}
+	}
+	return IVP_TRUE;
+}
+
 hk_real hk_Local_Constraint_System::get_epsilon()
 {
 	return 0.2f;
@@ -46,6 +46,9 @@ public:	// internal
 
 	void apply_effector_collision(	hk_PSI_Info&,	hk_Array<hk_Entity*>* ){ ;}
 
+	IVP_BOOL controller_is_thread_safe();
+	//: thread safe unless one of the constraints fires events
+
 	hk_real get_epsilon();
 	inline bool is_active() const { return m_is_active; }
 
@@ -131,6 +131,27 @@ public:
 #endif // HAVANA_CONSTRAINTS
 };
 
+/********************************************************************************
+ *	Name:	     	IVP_Thread_Pool	
+ *	Description:	Worker threads supplied by the application, see
+ *			IVP_Environment::set_thread_pool().  During the PSI the
+ *			controllers of simulation units which only have thread safe
+ *			controllers (see IVP_Controller::controller_is_thread_safe)
+ *			and the integration of all cores are spread over it.
+ *			The friction and contact solver always runs serially.
+ *	Note:		The results do not depend on the number of threads, but
+ *			they are not bit for bit the same as with no pool, so
+ *			the parallel path is only taken while has_workers().
+ ********************************************************************************/
+class IVP_Thread_Pool {
+public:
+    // call job( context, i ) once for every i in [0,n_jobs) and return when all are done
+    virtual void run_jobs( int n_jobs, void (*job)( void *context, int job_index ), void *context ) = 0;
+    // IVP_FALSE if there are no threads to help, the PSI then runs the original serial path
+    virtual IVP_BOOL has_workers() = 0;
+    virtual ~IVP_Thread_Pool() { ; };
+};
+
 
 /********************************************************************************
  *	Name:	  	IVP_Environment     	
@@ -140,6 +161,7 @@ public:
 class IVP_Environment {		// the environment
 
     friend class IVP_Simulation_Unit;
+    friend class IVP_Sim_Units_Manager;
     friend class IVP_Friction_System;
     friend class IVP_Friction_Sys_Static;
     friend class IVP_Friction_Solver;
@@ -170,6 +192,7 @@ class IVP_Environment {		// the environment
     IVP_Range_Manager	     *range_manager;
     IVP_Anomaly_Manager	     *anomaly_manager;
     IVP_Anomaly_Limits	     *anomaly_limits;
+    IVP_Thread_Pool	     *thread_pool;
 
 	IVP_PerformanceCounter   *performancecounter;
     class	IVP_Universe_Manager  *universe_manager;
@@ -324,6 +347,8 @@ public:
     IVP_Universe_Manager 	 *get_universe_manager() const			{ return universe_manager; };
     IVP_Anomaly_Manager		 *get_anomaly_manager() const                   { return anomaly_manager; }
     IVP_Anomaly_Limits		 *get_anomaly_limits() const                   { return anomaly_limits; }
+    IVP_Thread_Pool		 *get_thread_pool() const                      { return thread_pool; }
+    void			 set_thread_pool( IVP_Thread_Pool *pool )      { thread_pool = pool; } // NULL simulates everything in the calling thread, in the original order
 
     IVP_Real_Object	         *get_static_object() const                     { return static_object; }; // a env. global static ball
     IVP_Freeze_Manager           *get_freeze_manager()                          { return &freeze_manager; };
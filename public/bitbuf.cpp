@@ -71,6 +71,35 @@ public:
 CBitWriteMasksInit g_BitWriteMasksInit;
 
 
+// Returns the 32 bits starting at iBit. This only touches the bytes the bits are in,
+// so it won't read past the end of a buffer.
+static inline unsigned int BitBuf_Load32( const unsigned char *pData, int iBit )
+{
+	const unsigned char *p = pData + (iBit >> 3);
+	unsigned int shift = iBit & 7;
+
+	unsigned int ret = *((unsigned int*)p);
+	if ( shift )
+		ret = (ret >> shift) | ((unsigned int)p[4] << (32 - shift));
+
+	return ret;
+}
+
+// Returns nBits (<= 32) bits starting at iBit. Like BitBuf_Load32, it only reads the bytes the bits are in.
+static inline unsigned int BitBuf_LoadBits( const unsigned char *pData, int iBit, int nBits )
+{
+	const unsigned char *p = pData + (iBit >> 3);
+	unsigned int shift = iBit & 7;
+	int nBytes = (shift + nBits + 7) >> 3;
+
+	uint64 qword = 0;
+	for ( int i=0; i < nBytes; i++ )
+		qword |= (uint64)p[i] << (i << 3);
+
+	return (unsigned int)((qword >> shift) & (((uint64)1 << nBits) - 1));
+}
+
+
 // ---------------------------------------------------------------------------------------- //
 // bf_write
 // ---------------------------------------------------------------------------------------- //
@@ -203,38 +232,47 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 	MEASURECODE( "bf_write::WriteBits" );
 #endif
 
-	unsigned char *pOut = (unsigned char*)pInData;
+	const unsigned char *pIn = (const unsigned char*)pInData;
 	int nBitsLeft = nBits;
 
-	
-	// Get output dword-aligned.
-	while(((unsigned long)pOut & 3) != 0 && nBitsLeft >= 8)
+	// Bounds checking..
+	if ( (m_iCurBit+nBits) > m_nDataBits )
 	{
-		WriteUBitLong( *pOut, 8, false );
-		++pOut;
-		nBitsLeft -= 8;
+		m_iCurBit = m_nDataBits;
+		SetOverflowFlag();
+		CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, GetDebugName() );
+		return false;
 	}
 
-	// Read dwords.
-	while(nBitsLeft >= 32)
+	// Get the output dword-aligned.
+	int nHeadBits = min( (32 - (m_iCurBit & 31)) & 31, nBitsLeft );
+	if ( nHeadBits )
 	{
-		WriteUBitLong( *((unsigned long*)pOut), 32, false );
-		pOut += sizeof(unsigned long);
-		nBitsLeft -= 32;
+		WriteUBitLong( BitBuf_LoadBits( pIn, 0, nHeadBits ), nHeadBits, false );
+		nBitsLeft -= nHeadBits;
 	}
 
-	// Read the remaining bytes.
-	while(nBitsLeft >= 8)
+	// Now the output can be stored a dword at a time. If the input is byte-aligned
+	// at this point it's a straight copy, otherwise each dword is shifted out of it.
+	int nDWords = nBitsLeft >> 5;
+	unsigned int *pOut = &((unsigned int*)m_pData)[m_iCurBit >> 5];
+	if ( (nHeadBits & 7) == 0 )
 	{
-		WriteUBitLong( *pOut, 8, false );
-		++pOut;
-		nBitsLeft -= 8;
+		memcpy( pOut, pIn + (nHeadBits >> 3), nDWords << 2 );
+	}
+	else
+	{
+		for ( int i=0; i < nDWords; i++ )
+			pOut[i] = BitBuf_Load32( pIn, nHeadBits + (i << 5) );
 	}
+
+	m_iCurBit += nDWords << 5;
+	nBitsLeft -= nDWords << 5;
 	
-	// Read the remaining bits.
-	if(nBitsLeft)
+	// Write the remaining bits.
+	if ( nBitsLeft )
 	{
-		WriteUBitLong( *pOut, nBitsLeft, false );
+		WriteUBitLong( BitBuf_LoadBits( pIn, nBits - nBitsLeft, nBitsLeft ), nBitsLeft, false );
 	}
 
 	return !IsOverflowed();
@@ -243,7 +281,38 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 
 bool bf_write::WriteBitsFromBuffer( bf_read *pIn, int nBits )
 {
-	// This could be optimized a little by
+	if ( nBits <= pIn->GetNumBitsLeft() && nBits <= GetNumBitsLeft() )
+	{
+		// Get the output dword-aligned.
+		int nHeadBits = min( (32 - (m_iCurBit & 31)) & 31, nBits );
+		if ( nHeadBits )
+		{
+			WriteUBitLong( pIn->ReadUBitLong( nHeadBits ), nHeadBits );
+			nBits -= nHeadBits;
+		}
+
+		// Shift whole dwords out of the input.
+		unsigned int *pOut = &((unsigned int*)m_pData)[m_iCurBit >> 5];
+		int nDWords = nBits >> 5;
+		for ( int i=0; i < nDWords; i++ )
+		{
+			pOut[i] = BitBuf_Load32( pIn->m_pData, pIn->m_iCurBit );
+			pIn->m_iCurBit += 32;
+		}
+
+		m_iCurBit += nDWords << 5;
+		nBits -= nDWords << 5;
+
+		if ( nBits )
+		{
+			WriteUBitLong( pIn->ReadUBitLong( nBits ), nBits );
+		}
+
+		return !IsOverflowed() && !pIn->IsOverflowed();
+	}
+
+	// One of the buffers is going to overflow. Go a dword at a time so it
+	// happens where it always has.
 	while ( nBits > 32 )
 	{
 		WriteUBitLong( pIn->ReadUBitLong( 32 ), 32 );
@@ -530,22 +599,34 @@ bool bf_read::ReadBits(void *pOutData, int nBits)
 	unsigned char *pOut = (unsigned char*)pOutData;
 	int nBitsLeft = nBits;
 
-	
-	// Get output dword-aligned.
-	while(((unsigned long)pOut & 3) != 0 && nBitsLeft >= 8)
+	// Bounds checking..
+	if ( (m_iCurBit+nBits) > m_nDataBits )
 	{
-		*pOut = (unsigned char)ReadUBitLong(8);
-		++pOut;
-		nBitsLeft -= 8;
+		m_iCurBit = m_nDataBits;
+		SetOverflowFlag();
+		memset( pOut, 0, BitByte( nBits ) );
+		return false;
 	}
 
-	// Read dwords.
-	while(nBitsLeft >= 32)
+	int nDWords = nBitsLeft >> 5;
+	if ( (m_iCurBit & 7) == 0 )
+	{
+		// Byte-aligned, so it's a straight copy.
+		memcpy( pOut, &m_pData[m_iCurBit >> 3], nDWords << 2 );
+		m_iCurBit += nDWords << 5;
+		pOut += nDWords << 2;
+	}
+	else
 	{
-		*((unsigned long*)pOut) = ReadUBitLong(32);
-		pOut += sizeof(unsigned long);
-		nBitsLeft -= 32;
+		// Shift dwords out of the buffer.
+		for ( int i=0; i < nDWords; i++ )
+		{
+			*((unsigned int*)pOut) = BitBuf_Load32( m_pData, m_iCurBit );
+			m_iCurBit += 32;
+			pOut += sizeof(unsigned int);
+		}
 	}
+	nBitsLeft -= nDWords << 5;
 
 	// Read the remaining bytes.
 	while(nBitsLeft >= 8)
@@ -317,11 +317,23 @@ inline void bf_write::WriteUBitLong( unsigned int curData, int numbits, bool bCh
 	int nBitsLeft = numbits;
 	int iCurBit = m_iCurBit;
 
-	// Mask in a dword.
 	unsigned int iDWord = iCurBit >> 5;
 	Assert( (iDWord*4 + sizeof(long)) <= (unsigned int)m_nDataBytes );
 
 	unsigned long iCurBitMasked = iCurBit & 31;
+
+	// If there's a qword to work in, mask the value in with one read-modify-write
+	// whether or not it spans a dword. Only the last dword of the buffer can't do this.
+	if ( (iDWord*4 + sizeof(uint64)) <= (unsigned int)m_nDataBytes )
+	{
+		uint64 mask = (((uint64)1 << numbits) - 1) << iCurBitMasked;
+		uint64 *pQWord = (uint64*)&((unsigned long*)m_pData)[iDWord];
+		*pQWord = (*pQWord & ~mask) | (((uint64)curData << iCurBitMasked) & mask);
+		m_iCurBit += numbits;
+		return;
+	}
+
+	// Mask in a dword.
 	((unsigned long*)m_pData)[iDWord] &= g_BitWriteMasks[iCurBitMasked][nBitsLeft];
 	((unsigned long*)m_pData)[iDWord] |= curData << iCurBitMasked;
 
@@ -601,6 +613,21 @@ inline unsigned int bf_read::ReadUBitLong( int numbits )
 
 	// Read the current dword.
 	int idword1 = m_iCurBit >> 5;
+
+	// Shift the bits out of a qword if there is one. This only falls through to
+	// the dword code when reading the last dword of the buffer.
+	if ( (idword1*4 + (int)sizeof(uint64)) <= m_nDataBytes )
+	{
+		uint64 qword = *(uint64*)&((unsigned int*)m_pData)[idword1];
+		unsigned int ret = (unsigned int)(qword >> (m_iCurBit & 31));
+		m_iCurBit += numbits;
+
+		if ( numbits != 32 )
+			ret &= g_ExtraMasks[numbits];
+
+		return ret;
+	}
+
 	unsigned int dword1 = ((unsigned int*)m_pData)[idword1];
 	dword1 >>= (m_iCurBit & 31); // Get the bits we're interested in.
 
@@ -443,7 +443,7 @@ public:
 
 };
 
-#define CLIENT_DLL_INTERFACE_VERSION		"VClient007"
+#define CLIENT_DLL_INTERFACE_VERSION		"VClient008"
 
 
 #endif // CDLL_INT_H
@@ -113,5 +113,27 @@ public:
 };
 
 
+// SendProp::GetStockProxy() and RecvProp::GetStockProxy().
+// The prop setup functions run in the game DLLs, so the engine can't compare proxy function
+// pointers against its own copies. Instead, SetProxyFn records which of the stock proxies
+// a prop uses, and the engine reads and writes those variables in place.
+typedef enum
+{
+	DSTOCKPROXY_NONE=0,		// A custom proxy.
+	DSTOCKPROXY_INT8,		// SendProxy_Int8ToInt32, RecvProxy_Int32ToInt8.
+	DSTOCKPROXY_INT16,		// SendProxy_Int16ToInt32, RecvProxy_Int32ToInt16.
+	DSTOCKPROXY_INT32,		// SendProxy_Int32ToInt32, RecvProxy_Int32ToInt32.
+	DSTOCKPROXY_UINT8,		// SendProxy_UInt8ToInt32.
+	DSTOCKPROXY_UINT16,		// SendProxy_UInt16ToInt32.
+	DSTOCKPROXY_UINT32,		// SendProxy_UInt32ToInt32.
+	DSTOCKPROXY_FLOAT,		// SendProxy_FloatToFloat, RecvProxy_FloatToFloat.
+	DSTOCKPROXY_ANGLE,		// SendProxy_AngleToFloat.
+	DSTOCKPROXY_VECTOR,		// SendProxy_VectorToVector, RecvProxy_VectorToVector.
+	DSTOCKPROXY_QANGLES,	// SendProxy_QAngles.
+	DSTOCKPROXY_STRING,		// SendProxy_StringToString, RecvProxy_StringToString.
+	DSTOCKPROXY_DATATABLE	// SendProxy_DataTableToDataTable, DataTableRecvProxy_StaticDataTable.
+} DTStockProxy;
+
+
 
 #endif // DATATABLE_COMMON_H
@@ -43,6 +43,33 @@ RecvProp::RecvProp()
 	m_pArrayProp = NULL;
 	m_ArrayLengthProxy = NULL;
 	m_bInsideArray = false;
+	m_StockProxy = DSTOCKPROXY_NONE;
+}
+
+void RecvProp::SetProxyFn( RecvVarProxyFn fn )
+{
+	m_ProxyFn = fn;
+
+	if ( fn == RecvProxy_Int32ToInt8 )
+		m_StockProxy = DSTOCKPROXY_INT8;
+	else if ( fn == RecvProxy_Int32ToInt16 )
+		m_StockProxy = DSTOCKPROXY_INT16;
+	else if ( fn == RecvProxy_Int32ToInt32 )
+		m_StockProxy = DSTOCKPROXY_INT32;
+	else if ( fn == RecvProxy_FloatToFloat )
+		m_StockProxy = DSTOCKPROXY_FLOAT;
+	else if ( fn == RecvProxy_VectorToVector )
+		m_StockProxy = DSTOCKPROXY_VECTOR;
+	else if ( fn == RecvProxy_StringToString )
+		m_StockProxy = DSTOCKPROXY_STRING;
+	else
+		m_StockProxy = DSTOCKPROXY_NONE;
+}
+
+void RecvProp::SetDataTableProxyFn( DataTableRecvVarProxyFn fn )
+{
+	m_DataTableProxyFn = fn;
+	m_StockProxy = ( fn == DataTableRecvProxy_StaticDataTable ) ? DSTOCKPROXY_DATATABLE : DSTOCKPROXY_NONE;
 }
 
 // ---------------------------------------------------------------------- //
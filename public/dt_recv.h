@@ -108,6 +108,10 @@ public:
 	bool					IsInsideArray() const;
 	void					SetInsideArray();
 
+	// Which stock proxy the prop uses (DSTOCKPROXY_NONE if it's a custom one). This is set by
+	// SetProxyFn and SetDataTableProxyFn.
+	DTStockProxy			GetStockProxy() const;
+
 
 public:
 
@@ -121,6 +125,10 @@ private:
 
 	bool					m_bInsideArray;		// Set to true by the engine if this property sits inside an array.
 
+	// Sits in the padding after m_bInsideArray so the members after it don't move. The client
+	// DLL builds these statically, CLIENT_DLL_INTERFACE_VERSION was bumped when it was added.
+	unsigned char			m_StockProxy;		// See GetStockProxy().
+
 	// If this is an array (DPT_Array).
 	RecvProp				*m_pArrayProp;
 	ArrayLengthRecvProxyFn	m_ArrayLengthProxy;
@@ -423,21 +431,11 @@ inline RecvVarProxyFn RecvProp::GetProxyFn() const
 	return m_ProxyFn; 
 }
 
-inline void RecvProp::SetProxyFn( RecvVarProxyFn fn )
-{
-	m_ProxyFn = fn; 
-}
-
 inline DataTableRecvVarProxyFn RecvProp::GetDataTableProxyFn() const
 {
 	return m_DataTableProxyFn; 
 }
 
-inline void RecvProp::SetDataTableProxyFn( DataTableRecvVarProxyFn fn )
-{
-	m_DataTableProxyFn = fn; 
-}
-
 inline int RecvProp::GetOffset() const	
 {
 	return m_Offset; 
@@ -478,5 +476,10 @@ inline void RecvProp::SetInsideArray()
 	m_bInsideArray = true;
 }
 
+inline DTStockProxy RecvProp::GetStockProxy() const
+{
+	return (DTStockProxy)m_StockProxy;
+}
+
 
 #endif // DATATABLE_RECV_H
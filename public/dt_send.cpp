@@ -409,6 +409,7 @@ SendProp::SendProp()
 	m_nElements = 1;
 	m_ElementStride = -1;
 	m_DataTableProxyIndex = DATATABLE_PROXY_INDEX_INVALID; // set it to a questionable value.
+	m_StockProxy = DSTOCKPROXY_NONE;
 }
 
 
@@ -417,6 +418,44 @@ SendProp::~SendProp()
 }
 
 
+void SendProp::SetProxyFn( SendVarProxyFn f )
+{
+	m_ProxyFn = f;
+
+	if ( f == SendProxy_Int8ToInt32 )
+		m_StockProxy = DSTOCKPROXY_INT8;
+	else if ( f == SendProxy_Int16ToInt32 )
+		m_StockProxy = DSTOCKPROXY_INT16;
+	else if ( f == SendProxy_Int32ToInt32 )
+		m_StockProxy = DSTOCKPROXY_INT32;
+	else if ( f == SendProxy_UInt8ToInt32 )
+		m_StockProxy = DSTOCKPROXY_UINT8;
+	else if ( f == SendProxy_UInt16ToInt32 )
+		m_StockProxy = DSTOCKPROXY_UINT16;
+	else if ( f == SendProxy_UInt32ToInt32 )
+		m_StockProxy = DSTOCKPROXY_UINT32;
+	else if ( f == SendProxy_FloatToFloat )
+		m_StockProxy = DSTOCKPROXY_FLOAT;
+	else if ( f == SendProxy_AngleToFloat )
+		m_StockProxy = DSTOCKPROXY_ANGLE;
+	else if ( f == SendProxy_VectorToVector )
+		m_StockProxy = DSTOCKPROXY_VECTOR;
+	else if ( f == SendProxy_QAngles )
+		m_StockProxy = DSTOCKPROXY_QANGLES;
+	else if ( f == SendProxy_StringToString )
+		m_StockProxy = DSTOCKPROXY_STRING;
+	else
+		m_StockProxy = DSTOCKPROXY_NONE;
+}
+
+
+void SendProp::SetDataTableProxyFn( SendTableProxyFn f )
+{
+	m_DataTableProxyFn = f;
+	m_StockProxy = ( f == SendProxy_DataTableToDataTable ) ? DSTOCKPROXY_DATATABLE : DSTOCKPROXY_NONE;
+}
+
+
 int SendProp::GetNumArrayLengthBits() const
 {
 	Assert( GetType() == DPT_Array );
@@ -182,6 +182,15 @@ public:
 	unsigned char		GetDataTableProxyIndex() const;
 	void				SetDataTableProxyIndex( unsigned char val );
 
+	// Returns true if the prop uses one of the stock proxies, which only read the variable at
+	// GetOffset() (or, for datatables, just point at it). The engine relies on this to figure out 
+	// which props to re-encode when an entity's network vars change.
+	bool				IsDirectProxy() const;
+
+	// Which stock proxy the prop uses (DSTOCKPROXY_NONE if it's a custom one). This is set by
+	// SetProxyFn and SetDataTableProxyFn.
+	DTStockProxy		GetStockProxy() const;
+
 
 public:
 
@@ -216,6 +225,10 @@ private:
 	int					m_Offset;
 
 	unsigned char		m_DataTableProxyIndex;	// See GetDataTableProxyIndex().
+
+	// Sits in the padding after m_DataTableProxyIndex. The game DLL builds these statically,
+	// INTERFACEVERSION_SERVERGAMEDLL was bumped when it was added.
+	unsigned char		m_StockProxy;			// See GetStockProxy().
 };
 
 
@@ -235,22 +248,12 @@ inline SendVarProxyFn SendProp::GetProxyFn() const
 	return m_ProxyFn; 
 }
 
-inline void SendProp::SetProxyFn( SendVarProxyFn f )
-{
-	m_ProxyFn = f; 
-}
-
 inline SendTableProxyFn SendProp::GetDataTableProxyFn() const
 {
 	Assert( m_Type == DPT_DataTable );
 	return m_DataTableProxyFn; 
 }
 
-inline void SendProp::SetDataTableProxyFn( SendTableProxyFn f )
-{
-	m_DataTableProxyFn = f; 
-}
-
 inline SendTable* SendProp::GetDataTable() const
 {
 	return m_pDataTable;
@@ -355,6 +358,16 @@ inline void SendProp::SetDataTableProxyIndex( unsigned char val )
 	m_DataTableProxyIndex = val;
 }
 
+inline bool SendProp::IsDirectProxy() const
+{
+	return m_StockProxy != DSTOCKPROXY_NONE;
+}
+
+inline DTStockProxy SendProp::GetStockProxy() const
+{
+	return (DTStockProxy)m_StockProxy;
+}
+
 
 // -------------------------------------------------------------------------------------------------------------- //
 // SendTable.
@@ -75,6 +75,11 @@ class IServerNetworkable;
 // Entities can span this many clusters before we revert to a slower area checking algorithm
 #define	MAX_ENT_CLUSTERS	24
 
+// edict_t::transmitflags. These let the engine skip CheckTransmit calls it can answer itself.
+#define FL_EDICT_FULLCHECK	0		// Call CheckTransmit for every client (default).
+#define FL_EDICT_PVSCHECK	(1<<0)	// ShouldTransmit never returns true for a client whose PVS can't see the
+									// entity, so the engine only calls CheckTransmit for clients that can.
+
 
 class IServerEntity;
 
@@ -162,6 +167,10 @@ public:
 	int			headnode;			
 	// For dynamic "area portals"
 	int			areanum, areanum2;	
+
+	// FL_EDICT_ flags. Set by the game DLL, cleared when the edict is reused.  The game DLL
+	//  indexes the edict array too, INTERFACEVERSION_SERVERGAMEDLL was bumped when it was added.
+	int			transmitflags;
 };
 
 inline ICollideable *edict_t::GetCollideable()
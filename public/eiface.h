@@ -223,7 +223,7 @@ public:
 // interface the game DLL exposes to the engine
 //-----------------------------------------------------------------------------
 
-#define INTERFACEVERSION_SERVERGAMEDLL			"ServerGameDLL002"
+#define INTERFACEVERSION_SERVERGAMEDLL			"ServerGameDLL004"
 
 class IServerGameDLL
 {
@@ -301,7 +301,7 @@ public:
 //-----------------------------------------------------------------------------
 // Interface to get at server entities
 //-----------------------------------------------------------------------------
-#define INTERFACEVERSION_SERVERGAMEENTS			"ServerGameEnts001"
+#define INTERFACEVERSION_SERVERGAMEENTS			"ServerGameEnts002"
 
 class IServerGameEnts
 {
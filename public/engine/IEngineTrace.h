@@ -118,8 +118,8 @@ public:
 //-----------------------------------------------------------------------------
 // Interface the engine exposes to the game DLL
 //-----------------------------------------------------------------------------
-#define INTERFACEVERSION_ENGINETRACE_SERVER	"EngineTraceServer002"
-#define INTERFACEVERSION_ENGINETRACE_CLIENT	"EngineTraceClient002"
+#define INTERFACEVERSION_ENGINETRACE_SERVER	"EngineTraceServer003"
+#define INTERFACEVERSION_ENGINETRACE_CLIENT	"EngineTraceClient003"
 class IEngineTrace
 {
 public:
@@ -138,6 +138,12 @@ public:
 
 	// Same thing, but enumerate entitys within a box
 	virtual void	EnumerateEntities( const Vector &vecAbsMins, const Vector &vecAbsMaxs, IEntityEnumerator *pEnumerator ) = 0;
+
+	// TraceRay for a batch of rays with the same mask + filter.  Rays that start near each
+	// other share the walk through the world and the entity list, so group them when you can.
+	// If a ray hits two things at exactly the same fraction, which one it reports can differ
+	// from TraceRay.  The filter may see each entity once for the whole batch.
+	virtual void	TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces ) = 0;
 };
 
 
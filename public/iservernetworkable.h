@@ -23,6 +23,17 @@ enum EntityChange_t
 };
 
 
+// A network var that changed, as a byte range from the start of the object.
+struct NetworkVarChange_t
+{
+	unsigned short	m_Offset;
+	unsigned short	m_nBytes;
+};
+
+// Once more vars than this change between packs, the object just reports that everything changed.
+#define MAX_NETWORKVAR_CHANGES	16
+
+
 class ServerClass;
 class SendTable;
 struct edict_t;
@@ -101,6 +112,11 @@ public:
 	// In place of a generic QueryInterface.
 	virtual CBaseNetworkable* GetBaseNetworkable() = 0;
 	virtual CBaseEntity*	GetBaseEntity() = 0; // Only used by game code.
+
+	// Points ppChanges at the network vars that changed since the last ResetNetworkStateChanges
+	// and returns how many there are. Returns -1 if the object can't tell (something called
+	// NetworkStateChanged directly), in which case the engine re-encodes all of its props.
+	virtual int				GetNetworkVarChanges( const NetworkVarChange_t **ppChanges ) = 0;
 };
 
 
@@ -116,9 +116,11 @@ inline int InternalCheckDeclareClass( const char *pClassName, const char *pClass
 		CBaseEntity *m_pEnt;
 	};
 
+	// The chained object doesn't necessarily live inside the entity, so its vars just flag the whole entity as changed.
 	#define DECLARE_NETWORKVAR_CHAIN() \
 		CAutoInitEntPtr __m_pChainEntity; \
-		void NetworkStateChanged() { if ( g_bUseNetworkVars ) __m_pChainEntity.m_pEnt->NetworkStateChanged(); }
+		void NetworkStateChanged() { if ( g_bUseNetworkVars ) __m_pChainEntity.m_pEnt->NetworkStateChanged(); } \
+		void NetworkStateChanged( void *pVar, int nBytes ) { NetworkStateChanged(); }
 
 	#define IMPLEMENT_NETWORKVAR_CHAIN( varName ) \
 		(varName)->__m_pChainEntity.m_pEnt = this;
@@ -133,10 +135,18 @@ static inline void DispatchNetworkStateChanged( T *pObj )
 		pObj->NetworkStateChanged();
 }
 
+template< class T >
+static inline void DispatchNetworkStateChanged( T *pObj, void *pVar, int nBytes )
+{
+	if ( g_bUseNetworkVars )
+		pObj->NetworkStateChanged( pVar, nBytes );
+}
+
 #define DECLARE_EMBEDDED_NETWORKVAR() \
 	template <typename T> friend int ServerClassInit(T *);	\
 	template <typename T> friend int ClientClassInit(T *); \
-	virtual void NetworkStateChanged() {}
+	virtual void NetworkStateChanged() {} \
+	virtual void NetworkStateChanged( void *pVar, int nBytes ) { NetworkStateChanged(); }
 
 #define CNetworkVarEmbedded( type, name ) \
 	class NetworkVar_##name; \
@@ -151,6 +161,10 @@ static inline void DispatchNetworkStateChanged( T *pObj )
 		{ \
 			DispatchNetworkStateChanged( (ThisClass_##name*)( ((char*)this) - GetOffset_##name() ) ); \
 		} \
+		virtual void NetworkStateChanged( void *pVar, int nBytes ) \
+		{ \
+			DispatchNetworkStateChanged( (ThisClass_##name*)( ((char*)this) - GetOffset_##name() ), pVar, nBytes ); \
+		} \
 	}; \
 	NetworkVar_##name name; 
 
@@ -487,24 +501,24 @@ private:
 // but a derived class does. Then, the entity is only flagged as changed when the variable is changed in
 // an entity that wants to transmit the variable.
 	#define CNetworkVarForDerived( type, name ) \
-		virtual void NetworkStateChanged_##name() {} \
+		virtual void NetworkStateChanged_##name( void *pVar, int nBytes ) {} \
 		NETWORK_VAR_START( type, name ) \
 		NETWORK_VAR_END( type, name, CNetworkVarBase, NetworkStateChanged_##name )
 
 	#define CNetworkVectorForDerived( name ) \
-		virtual void NetworkStateChanged_##name() {} \
+		virtual void NetworkStateChanged_##name( void *pVar, int nBytes ) {} \
 		CNetworkVectorInternal( Vector, name, NetworkStateChanged_##name )
 		
 	#define CNetworkHandleForDerived( type, name ) \
-		virtual void NetworkStateChanged_##name() {} \
+		virtual void NetworkStateChanged_##name( void *pVar, int nBytes ) {} \
 		CNetworkHandleInternal( type, name, NetworkStateChanged_##name )
 		
 	#define CNetworkArrayForDerived( type, name, count ) \
-		virtual void NetworkStateChanged_##name() {} \
+		virtual void NetworkStateChanged_##name( void *pVar, int nBytes ) {} \
 		CNetworkArrayInternal( type, name, count, NetworkStateChanged_##name )
 		
 	#define IMPLEMENT_NETWORK_VAR_FOR_DERIVED( name ) \
-		virtual void NetworkStateChanged_##name() { if ( g_bUseNetworkVars ) NetworkStateChanged(); }
+		virtual void NetworkStateChanged_##name( void *pVar, int nBytes ) { if ( g_bUseNetworkVars ) NetworkStateChanged( pVar, nBytes ); }
 
 
 // Vectors + some convenient helper functions.
@@ -539,7 +553,7 @@ private:
 	protected: \
 		void NetworkStateChanged() \
 		{ \
-			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)this) - MyOffsetOf(ThisClass,name)))->NetworkStateChanged(); \
+			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)this) - MyOffsetOf(ThisClass,name)))->NetworkStateChanged( this, sizeof( m_Value ) ); \
 		} \
 	private: \
 		char m_Value[length]; \
@@ -568,7 +582,7 @@ private:
 	protected: \
 		void NetworkStateChanged() \
 		{ \
-			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)this) - MyOffsetOf(ThisClass,name)))->stateChangedFn(); \
+			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)this) - MyOffsetOf(ThisClass,name)))->stateChangedFn( this, sizeof( m_Value ) ); \
 		} \
 		type m_Value[count]; \
 	}; \
@@ -579,6 +593,9 @@ private:
 
 
 // Internal macros used in definitions of network vars.
+//
+// stateChangedFn gets the address and size of the var that changed so entities can tell the
+// engine which of their props need to be re-encoded.
 #define NETWORK_VAR_START( type, name ) \
 	class NetworkVar_##name; \
 	friend class NetworkVar_##name; \
@@ -592,7 +609,7 @@ private:
 #define NETWORK_VAR_END( type, name, base, stateChangedFn ) \
 		static void NetworkStateChanged( void *ptr ) \
 		{ \
-			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)ptr) - MyOffsetOf(ThisClass,name)))->stateChangedFn(); \
+			if ( g_bUseNetworkVars ) ((ThisClass*)(((char*)ptr) - MyOffsetOf(ThisClass,name)))->stateChangedFn( ptr, sizeof( ((ThisClass*)0)->name ) ); \
 		} \
 	}; \
 	base< type, NetworkVar_##name > name;
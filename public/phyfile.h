@@ -17,4 +17,29 @@ typedef struct phyheader_s
 	long	checkSum;	// checksum of source .mdl file
 } phyheader_t;
 
+// Mapped layout.  The solids are stored at aligned offsets so the file can be mapped and
+// the compact surfaces used in place (they only hold offsets, never pointers).  The first
+// fields match phyheader_t, the header size is the version.
+#define PHY_MAPPED_ALIGN	32
+
+typedef struct phymappedheader_s
+{
+	int		size;			// sizeof(phymappedheader_t)
+	int		id;
+	int		solidCount;
+	int		checkSum;		// checksum of source .mdl file
+	int		keyDataOffset;	// key text, including its terminator
+	int		keyDataSize;
+	int		unused[2];
+} phymappedheader_t;
+
+// One per solid, following the header
+typedef struct phymappedsolid_s
+{
+	int				offset;	// from the start of the file, a multiple of PHY_MAPPED_ALIGN
+	int				size;
+	unsigned int	crc;	// CRC32 of the solid, used to share identical solids between models
+	int				unused;
+} phymappedsolid_t;
+
 #endif // PHYFILE_H
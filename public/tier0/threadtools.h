@@ -0,0 +1,124 @@
+//========= Copyright � 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Portable thread primitives (interlocked operations, mutexes) and a
+//			small fork/join worker pool shared by every module that links tier0.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef THREADTOOLS_H
+#define THREADTOOLS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+
+
+//-----------------------------------------------------------------------------
+// Interlocked operations. All of these return the *new* value except
+// ThreadInterlockedExchangeAdd and ThreadInterlockedCompareExchange which
+// return the value the target held before the operation.
+//-----------------------------------------------------------------------------
+
+PLATFORM_INTERFACE long ThreadInterlockedIncrement( long volatile *pDest );
+PLATFORM_INTERFACE long ThreadInterlockedDecrement( long volatile *pDest );
+PLATFORM_INTERFACE long ThreadInterlockedExchangeAdd( long volatile *pDest, long value );
+PLATFORM_INTERFACE long ThreadInterlockedCompareExchange( long volatile *pDest, long value, long comperand );
+
+
+//-----------------------------------------------------------------------------
+// A non-recursive lock. Backed by a CRITICAL_SECTION on Win32 and a
+// pthread_mutex_t on Linux; the storage is opaque so this header doesn't
+// drag in windows.h or pthread.h.
+//-----------------------------------------------------------------------------
+
+class DBG_CLASS CThreadMutex
+{
+public:
+				CThreadMutex();
+				~CThreadMutex();
+
+	void		Lock();
+	void		Unlock();
+
+private:
+	// Big enough for a CRITICAL_SECTION (24 bytes) or pthread_mutex_t (24 bytes on i386).
+	unsigned char	m_Storage[32];
+
+	// No copying.
+				CThreadMutex( const CThreadMutex & );
+	CThreadMutex& operator=( const CThreadMutex & );
+};
+
+
+// Scoped lock helper.
+class CThreadAutoLock
+{
+public:
+	CThreadAutoLock( CThreadMutex &mutex ) : m_Mutex( mutex )	{ m_Mutex.Lock(); }
+	~CThreadAutoLock()											{ m_Mutex.Unlock(); }
+
+private:
+	CThreadMutex	&m_Mutex;
+};
+
+
+//-----------------------------------------------------------------------------
+// A pointer with a separate value for each thread, NULL until the thread sets
+// it. Backed by a TLS index on Win32 and a pthread key on Linux, so it also
+// works in DLLs loaded with LoadLibrary, where __declspec(thread) doesn't.
+// Nothing is freed when a thread exits.
+//-----------------------------------------------------------------------------
+
+class DBG_CLASS CThreadLocalPtr
+{
+public:
+				CThreadLocalPtr();
+				~CThreadLocalPtr();
+
+	void		*Get() const;
+	void		Set( void *pValue );
+
+private:
+	// DWORD TLS index or pthread_key_t.
+	unsigned long	m_Index;
+
+	// No copying.
+				CThreadLocalPtr( const CThreadLocalPtr & );
+	CThreadLocalPtr& operator=( const CThreadLocalPtr & );
+};
+
+
+//-----------------------------------------------------------------------------
+// Worker pool.
+//
+// ThreadPool_ParallelFor calls pfnJob( pContext, iItem ) once for every
+// iItem in [0,nItems) and returns when all of them are done. The calling
+// thread takes items too, so with 0 worker threads this is just a loop.
+//
+// Only one ParallelFor runs at a time. A ParallelFor issued from inside a job
+// (or from a second thread while one is in flight) runs serially on the
+// calling thread.
+//
+// Worker threads register themselves with Plat_RegisterThread, so
+// Plat_IsPrimaryThread() is false inside a job that runs on a worker. Code
+// that touches main-thread-only state (VPROF, the console, etc.) must check it.
+//-----------------------------------------------------------------------------
+
+typedef void (*ThreadJobFn_t)( void *pContext, int iItem );
+
+// Sets the number of worker threads (not counting the caller). Clamped to
+// [0, THREADPOOL_MAX_THREADS]. Threads are started or stopped as needed.
+#define THREADPOOL_MAX_THREADS	16
+
+PLATFORM_INTERFACE void		ThreadPool_SetThreadCount( int nThreads );
+PLATFORM_INTERFACE int		ThreadPool_GetThreadCount();
+PLATFORM_INTERFACE void		ThreadPool_ParallelFor( int nItems, ThreadJobFn_t pfnJob, void *pContext );
+
+// Stops all worker threads. Safe to call more than once.
+PLATFORM_INTERFACE void		ThreadPool_Shutdown();
+
+
+#endif // THREADTOOLS_H
@@ -284,6 +284,67 @@ private:
 
 DBG_INTERFACE CVProfile g_VProfCurrentProfile;
 
+//-----------------------------------------------------------------------------
+//
+// Timeline of every scope entered and exited, so single ticks can be looked
+// at instead of averages.  Unlike CVProfile this records on any thread; each
+// thread writes into its own ring of events without taking a lock.
+//
+
+#define VPROF_TRACE_EVENTS	16384		// Per thread, must be a power of two
+
+enum VProfTraceEventType_t
+{
+	VPTE_ENTER,
+	VPTE_EXIT,
+	VPTE_TICK,		// Start of a server tick
+};
+
+struct VProfTraceEvent_t
+{
+	int64		m_Cycles;
+	const char	*m_pszName;				// Scope name, NULL for exits and ticks
+	const char	*m_pszBudgetGroup;
+	int			m_nType;
+	int			m_nTick;
+};
+
+class CVProfTraceBuffer;
+
+class DBG_CLASS CVProfTrace
+{
+public:
+	CVProfTrace();
+	~CVProfTrace();
+
+	void Start();
+	void Stop();
+	bool IsRecording() const;
+
+	void EnterScope( const char *pszName, const char *pBudgetGroupName );
+	void ExitScope();
+	void MarkTick( int tick );
+
+	// Forget everything recorded so far
+	void Clear();
+
+	// Writes what's left in every thread's ring in the Chrome trace event format
+	//  (chrome://tracing).  The rings aren't locked, so this should be called from
+	//  the primary thread while no jobs are running.
+	bool WriteChromeTrace( const char *pszFileName );
+
+private:
+	CVProfTraceBuffer *GetThreadBuffer();
+	void Record( int type, const char *pszName, const char *pBudgetGroupName, int tick );
+
+	bool				m_bRecording;
+	CVProfTraceBuffer	*m_pBuffers;
+};
+
+//-------------------------------------
+
+DBG_INTERFACE CVProfTrace g_VProfTrace;
+
 //-----------------------------------------------------------------------------
 
 class CVProfScope
@@ -291,6 +352,10 @@ class CVProfScope
 public:
 	CVProfScope( const char * pszName, int detailLevel, const char *pBudgetGroupName, bool bAssertAccounted );
 	~CVProfScope();
+
+private:
+	// Only write the exit if the entry went into the trace
+	bool	m_bTraced;
 };
 
 //-----------------------------------------------------------------------------
@@ -541,8 +606,8 @@ inline void CVProfile::EnterScope( const char *pszName, int detailLevel, const c
 	if ( m_enabled != 0 || !m_fAtRoot ) // if became disabled, need to unwind back to root before stopping
 	{
 		// Only account for vprof stuff on the primary thread.
-		//if( !Plat_IsPrimaryThread() )
-		//	return;
+		if( !Plat_IsPrimaryThread() )
+			return;
 
 		if ( pszName != m_pCurNode->GetName() ) 
 		{
@@ -567,8 +632,8 @@ inline void CVProfile::ExitScope()
 	if ( !m_fAtRoot || m_enabled != 0 )
 	{
 		// Only account for vprof stuff on the primary thread.
-		//if( !Plat_IsPrimaryThread() )
-		//	return;
+		if( !Plat_IsPrimaryThread() )
+			return;
 
 		// ExitScope will indicate whether we should back up to our parent (we may
 		// be profiling a recursive function)
@@ -660,6 +725,12 @@ inline CVProfNode *CVProfile::GetRoot()
 inline CVProfScope::CVProfScope( const char * pszName, int detailLevel, const char *pBudgetGroupName, bool bAssertAccounted )
 { 
 	g_VProfCurrentProfile.EnterScope( pszName, detailLevel, pBudgetGroupName, bAssertAccounted ); 
+
+	m_bTraced = g_VProfTrace.IsRecording();
+	if ( m_bTraced )
+	{
+		g_VProfTrace.EnterScope( pszName, pBudgetGroupName );
+	}
 }
 
 //-------------------------------------
@@ -667,6 +738,45 @@ inline CVProfScope::CVProfScope( const char * pszName, int detailLevel, const ch
 inline CVProfScope::~CVProfScope()					
 { 
 	g_VProfCurrentProfile.ExitScope(); 
+
+	if ( m_bTraced )
+	{
+		g_VProfTrace.ExitScope();
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// CVProfTrace, inline methods
+//
+
+inline bool CVProfTrace::IsRecording() const
+{
+	return m_bRecording;
+}
+
+//-------------------------------------
+
+inline void CVProfTrace::EnterScope( const char *pszName, const char *pBudgetGroupName )
+{
+	Record( VPTE_ENTER, pszName, pBudgetGroupName, -1 );
+}
+
+//-------------------------------------
+
+inline void CVProfTrace::ExitScope()
+{
+	Record( VPTE_EXIT, NULL, NULL, -1 );
+}
+
+//-------------------------------------
+
+inline void CVProfTrace::MarkTick( int tick )
+{
+	if ( m_bRecording )
+	{
+		Record( VPTE_TICK, NULL, NULL, tick );
+	}
 }
 
 #endif
@@ -103,7 +103,7 @@ enum PhysInterfaceId_t
 class ISave;
 class IRestore;
 
-#define VPHYSICS_INTERFACE_VERSION	"VPhysics029"
+#define VPHYSICS_INTERFACE_VERSION	"VPhysics030"
 class IPhysics
 {
 public:
@@ -120,7 +120,22 @@ class CPhysPolysoup;
 class ICollisionQuery;
 class IVPhysicsKeyParser;
 
-#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision007"
+#define VPHYSICS_COLLISION_INTERFACE_VERSION	"VPhysicsCollision008"
+
+// Called when none of the solids in a file passed to VCollideLoadFile are in use anymore
+typedef void (*VCollideReleaseFn_t)( const void *pFile, void *pContext );
+
+// Totals for the solids currently loaded by VCollideLoad/VCollideLoadFile
+struct vcollidestats_t
+{
+	int		solidCount;		// distinct solids
+	int		solidBytes;
+	int		copiedBytes;	// solids copied to the heap
+	int		mappedBytes;	// solids used in place from the file data
+	int		sharedCount;	// loads that found an identical solid already loaded
+	int		sharedBytes;
+	int		fileCount;		// files with solids used in place
+};
 
 class IPhysicsCollision
 {
@@ -187,6 +202,12 @@ public:
 	virtual void			VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int size ) = 0;
 	// destroyts the set of solids created by VCollideLoad
 	virtual void			VCollideUnload( vcollide_t *pVCollide ) = 0;
+	// loads a whole .phy file, either layout.  Identical solids are shared between vcollides.
+	// If pfnRelease is set the file data must stay valid until pfnRelease is called, mapped
+	// files are then used in place.  That can happen before this returns if nothing in the
+	// file was needed.  Otherwise the solids are copied.
+	virtual bool			VCollideLoadFile( vcollide_t *pOutput, const void *pFile, int fileSize, VCollideReleaseFn_t pfnRelease, void *pContext ) = 0;
+	virtual void			VCollideGetStats( vcollidestats_t *pStats ) = 0;
 
 	// begins parsing a vcollide.  NOTE: This keeps pointers to the text
 	// If you free the text and call members of IVPhysicsKeyParser, it will crash
@@ -531,6 +552,11 @@ public:
 	// get the number of ticks simulated in the last call to simulate
 	virtual int GetTimestepsSimulatedLast() = 0;
 
+	// Spread the simulation of independent groups of objects over the tier0 worker pool.
+	// Results don't depend on the number of worker threads and all callbacks still
+	// happen in the thread calling Simulate().
+	virtual void EnableParallelSimulation( bool enable ) = 0;
+
 	// UNDONE: Expose spatial callback oriented controllers (you could implement AI-based or more complex fluid with this)
 	//			Physics trigger / phantom object
 	// UNDONE: Expose performance scalability options
@@ -0,0 +1,410 @@
+//========= Copyright � 1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Portable thread primitives and the shared worker pool.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifdef _WIN32
+#define WIN_32_LEAN_AND_MEAN
+#include <windows.h>
+#elif _LINUX
+#include <pthread.h>
+#endif
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+
+
+// -------------------------------------------------------------------------------------------------- //
+// Interlocked operations.
+// -------------------------------------------------------------------------------------------------- //
+
+#ifdef _WIN32
+
+long ThreadInterlockedIncrement( long volatile *pDest )
+{
+	return InterlockedIncrement( (long*)pDest );
+}
+
+long ThreadInterlockedDecrement( long volatile *pDest )
+{
+	return InterlockedDecrement( (long*)pDest );
+}
+
+long ThreadInterlockedExchangeAdd( long volatile *pDest, long value )
+{
+	return InterlockedExchangeAdd( (long*)pDest, value );
+}
+
+long ThreadInterlockedCompareExchange( long volatile *pDest, long value, long comperand )
+{
+	return (long)InterlockedCompareExchange( (void**)pDest, (void*)value, (void*)comperand );
+}
+
+#elif _LINUX
+
+long ThreadInterlockedExchangeAdd( long volatile *pDest, long value )
+{
+	long result = value;
+	__asm__ __volatile__( "lock; xaddl %0, %1"
+		: "+r" (result), "+m" (*pDest)
+		:
+		: "memory" );
+	return result;
+}
+
+long ThreadInterlockedIncrement( long volatile *pDest )
+{
+	return ThreadInterlockedExchangeAdd( pDest, 1 ) + 1;
+}
+
+long ThreadInterlockedDecrement( long volatile *pDest )
+{
+	return ThreadInterlockedExchangeAdd( pDest, -1 ) - 1;
+}
+
+long ThreadInterlockedCompareExchange( long volatile *pDest, long value, long comperand )
+{
+	long result;
+	__asm__ __volatile__( "lock; cmpxchgl %2, %1"
+		: "=a" (result), "+m" (*pDest)
+		: "r" (value), "0" (comperand)
+		: "memory" );
+	return result;
+}
+
+#endif
+
+
+// -------------------------------------------------------------------------------------------------- //
+// CThreadMutex.
+// -------------------------------------------------------------------------------------------------- //
+
+#ifdef _WIN32
+	#define MUTEX_IMPL()	((CRITICAL_SECTION*)m_Storage)
+#elif _LINUX
+	#define MUTEX_IMPL()	((pthread_mutex_t*)m_Storage)
+#endif
+
+CThreadMutex::CThreadMutex()
+{
+#ifdef _WIN32
+	Assert( sizeof( CRITICAL_SECTION ) <= sizeof( m_Storage ) );
+	InitializeCriticalSection( MUTEX_IMPL() );
+#elif _LINUX
+	Assert( sizeof( pthread_mutex_t ) <= sizeof( m_Storage ) );
+	pthread_mutex_init( MUTEX_IMPL(), NULL );
+#endif
+}
+
+CThreadMutex::~CThreadMutex()
+{
+#ifdef _WIN32
+	DeleteCriticalSection( MUTEX_IMPL() );
+#elif _LINUX
+	pthread_mutex_destroy( MUTEX_IMPL() );
+#endif
+}
+
+void CThreadMutex::Lock()
+{
+#ifdef _WIN32
+	EnterCriticalSection( MUTEX_IMPL() );
+#elif _LINUX
+	pthread_mutex_lock( MUTEX_IMPL() );
+#endif
+}
+
+void CThreadMutex::Unlock()
+{
+#ifdef _WIN32
+	LeaveCriticalSection( MUTEX_IMPL() );
+#elif _LINUX
+	pthread_mutex_unlock( MUTEX_IMPL() );
+#endif
+}
+
+
+// -------------------------------------------------------------------------------------------------- //
+// CThreadLocalPtr.
+// -------------------------------------------------------------------------------------------------- //
+
+CThreadLocalPtr::CThreadLocalPtr()
+{
+#ifdef _WIN32
+	m_Index = TlsAlloc();
+	Assert( m_Index != TLS_OUT_OF_INDEXES );
+#elif _LINUX
+	pthread_key_t key;
+	int result = pthread_key_create( &key, NULL );
+	Assert( result == 0 );
+	m_Index = (unsigned long)key;
+#endif
+}
+
+CThreadLocalPtr::~CThreadLocalPtr()
+{
+#ifdef _WIN32
+	TlsFree( m_Index );
+#elif _LINUX
+	pthread_key_delete( (pthread_key_t)m_Index );
+#endif
+}
+
+void *CThreadLocalPtr::Get() const
+{
+#ifdef _WIN32
+	return TlsGetValue( m_Index );
+#elif _LINUX
+	return pthread_getspecific( (pthread_key_t)m_Index );
+#endif
+}
+
+void CThreadLocalPtr::Set( void *pValue )
+{
+#ifdef _WIN32
+	TlsSetValue( m_Index, pValue );
+#elif _LINUX
+	pthread_setspecific( (pthread_key_t)m_Index, pValue );
+#endif
+}
+
+
+// -------------------------------------------------------------------------------------------------- //
+// Worker pool.
+// -------------------------------------------------------------------------------------------------- //
+
+// The job currently being dispatched.
+static ThreadJobFn_t	s_pfnJob = NULL;
+static void				*s_pJobContext = NULL;
+static int				s_nJobItems = 0;
+static long volatile	s_iNextJobItem = 0;
+
+// Number of threads (workers plus the caller) that still have to check in for the current job.
+static long volatile	s_nJobThreadsActive = 0;
+
+// Nonzero while a ParallelFor is in flight. Nested or concurrent calls run serially.
+static long volatile	s_bPoolBusy = 0;
+
+static int				s_nPoolThreads = 0;
+static bool				s_bPoolExit = false;
+
+#ifdef _WIN32
+static HANDLE			s_hPoolThreads[THREADPOOL_MAX_THREADS];
+static HANDLE			s_hJobStartSemaphore = NULL;
+static HANDLE			s_hJobDoneEvent = NULL;
+#elif _LINUX
+static pthread_t		s_PoolThreads[THREADPOOL_MAX_THREADS];
+static pthread_mutex_t	s_PoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	s_JobStartCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	s_JobDoneCond = PTHREAD_COND_INITIALIZER;
+static unsigned int		s_JobGeneration = 0;
+#endif
+
+
+static void ThreadPool_RunJobItems()
+{
+	for ( ;; )
+	{
+		int iItem = (int)ThreadInterlockedIncrement( &s_iNextJobItem ) - 1;
+		if ( iItem >= s_nJobItems )
+			break;
+
+		s_pfnJob( s_pJobContext, iItem );
+	}
+}
+
+
+#ifdef _WIN32
+
+static DWORD WINAPI ThreadPool_WorkerFunc( LPVOID pv )
+{
+	Plat_RegisterThread( "Pool Worker" );
+
+	for ( ;; )
+	{
+		WaitForSingleObject( s_hJobStartSemaphore, INFINITE );
+		if ( s_bPoolExit )
+			break;
+
+		ThreadPool_RunJobItems();
+
+		if ( ThreadInterlockedDecrement( &s_nJobThreadsActive ) == 0 )
+		{
+			SetEvent( s_hJobDoneEvent );
+		}
+	}
+
+	return 0;
+}
+
+#elif _LINUX
+
+static void* ThreadPool_WorkerFunc( void *pv )
+{
+	Plat_RegisterThread( "Pool Worker" );
+
+	// The generation the pool was at when this thread was created.  Reading s_JobGeneration
+	// here instead would miss a job started before the thread got going.
+	unsigned int lastGeneration = (unsigned int)(unsigned long)pv;
+	for ( ;; )
+	{
+		pthread_mutex_lock( &s_PoolMutex );
+		while ( !s_bPoolExit && s_JobGeneration == lastGeneration )
+		{
+			pthread_cond_wait( &s_JobStartCond, &s_PoolMutex );
+		}
+		lastGeneration = s_JobGeneration;
+		pthread_mutex_unlock( &s_PoolMutex );
+
+		if ( s_bPoolExit )
+			break;
+
+		ThreadPool_RunJobItems();
+
+		pthread_mutex_lock( &s_PoolMutex );
+		if ( --s_nJobThreadsActive == 0 )
+		{
+			pthread_cond_signal( &s_JobDoneCond );
+		}
+		pthread_mutex_unlock( &s_PoolMutex );
+	}
+
+	return NULL;
+}
+
+#endif
+
+
+void ThreadPool_Shutdown()
+{
+	if ( s_nPoolThreads == 0 )
+		return;
+
+	Assert( !s_bPoolBusy );
+	s_bPoolExit = true;
+
+#ifdef _WIN32
+	ReleaseSemaphore( s_hJobStartSemaphore, s_nPoolThreads, NULL );
+	WaitForMultipleObjects( s_nPoolThreads, s_hPoolThreads, TRUE, INFINITE );
+	for ( int i=0; i < s_nPoolThreads; i++ )
+	{
+		CloseHandle( s_hPoolThreads[i] );
+	}
+	CloseHandle( s_hJobStartSemaphore );
+	CloseHandle( s_hJobDoneEvent );
+	s_hJobStartSemaphore = s_hJobDoneEvent = NULL;
+#elif _LINUX
+	pthread_mutex_lock( &s_PoolMutex );
+	pthread_cond_broadcast( &s_JobStartCond );
+	pthread_mutex_unlock( &s_PoolMutex );
+	for ( int i=0; i < s_nPoolThreads; i++ )
+	{
+		pthread_join( s_PoolThreads[i], NULL );
+	}
+#endif
+
+	s_nPoolThreads = 0;
+	s_bPoolExit = false;
+}
+
+
+void ThreadPool_SetThreadCount( int nThreads )
+{
+	if ( nThreads < 0 )
+		nThreads = 0;
+	else if ( nThreads > THREADPOOL_MAX_THREADS )
+		nThreads = THREADPOOL_MAX_THREADS;
+
+	if ( nThreads == s_nPoolThreads )
+		return;
+
+	ThreadPool_Shutdown();
+	if ( nThreads == 0 )
+		return;
+
+#ifdef _WIN32
+	s_hJobStartSemaphore = CreateSemaphore( NULL, 0, THREADPOOL_MAX_THREADS, NULL );
+	s_hJobDoneEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+	for ( int i=0; i < nThreads; i++ )
+	{
+		DWORD dwThreadID;
+		s_hPoolThreads[i] = CreateThread( NULL, 0, ThreadPool_WorkerFunc, NULL, 0, &dwThreadID );
+		if ( !s_hPoolThreads[i] )
+			break;
+		++s_nPoolThreads;
+	}
+#elif _LINUX
+	pthread_mutex_lock( &s_PoolMutex );
+	unsigned int startGeneration = s_JobGeneration;
+	pthread_mutex_unlock( &s_PoolMutex );
+
+	for ( int i=0; i < nThreads; i++ )
+	{
+		if ( pthread_create( &s_PoolThreads[i], NULL, ThreadPool_WorkerFunc, (void *)(unsigned long)startGeneration ) != 0 )
+			break;
+		++s_nPoolThreads;
+	}
+#endif
+}
+
+
+int ThreadPool_GetThreadCount()
+{
+	return s_nPoolThreads;
+}
+
+
+void ThreadPool_ParallelFor( int nItems, ThreadJobFn_t pfnJob, void *pContext )
+{
+	if ( nItems <= 0 )
+		return;
+
+	// Run it inline if there's nobody to help or if the pool is already in use.
+	if ( s_nPoolThreads == 0 || nItems == 1 || ThreadInterlockedCompareExchange( &s_bPoolBusy, 1, 0 ) != 0 )
+	{
+		for ( int i=0; i < nItems; i++ )
+		{
+			pfnJob( pContext, i );
+		}
+		return;
+	}
+
+	s_pfnJob = pfnJob;
+	s_pJobContext = pContext;
+	s_nJobItems = nItems;
+	s_iNextJobItem = 0;
+	s_nJobThreadsActive = s_nPoolThreads + 1;
+
+#ifdef _WIN32
+	ReleaseSemaphore( s_hJobStartSemaphore, s_nPoolThreads, NULL );
+
+	ThreadPool_RunJobItems();
+
+	if ( ThreadInterlockedDecrement( &s_nJobThreadsActive ) != 0 )
+	{
+		WaitForSingleObject( s_hJobDoneEvent, INFINITE );
+	}
+#elif _LINUX
+	pthread_mutex_lock( &s_PoolMutex );
+	++s_JobGeneration;
+	pthread_cond_broadcast( &s_JobStartCond );
+	pthread_mutex_unlock( &s_PoolMutex );
+
+	ThreadPool_RunJobItems();
+
+	pthread_mutex_lock( &s_PoolMutex );
+	--s_nJobThreadsActive;
+	while ( s_nJobThreadsActive > 0 )
+	{
+		pthread_cond_wait( &s_JobDoneCond, &s_PoolMutex );
+	}
+	pthread_mutex_unlock( &s_PoolMutex );
+#endif
+
+	s_pfnJob = NULL;
+	s_pJobContext = NULL;
+	s_bPoolBusy = 0;
+}
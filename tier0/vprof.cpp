@@ -19,7 +19,10 @@
 #include <algorithm>
 #pragma warning(pop)
 
+#include <stdio.h>
+
 #include "tier0/vprof.h"
+#include "tier0/threadtools.h"
 
 // NOTE: Explicitly and intentionally using STL in here to not generate any
 // cyclical dependencies between the low-level debug library and the higher
@@ -763,5 +766,217 @@ void CVProfile::RegisterNumBudgetGroupsChangedCallBack( void (*pCallBack)(void)
 	m_pNumBudgetGroupsChangedCallBack = pCallBack;
 }
 
+//=============================================================================
+
+CVProfTrace g_VProfTrace;
+
+//-----------------------------------------------------------------------------
+// One thread's events.  Only the owning thread writes to it, m_nWritten counts
+// every event ever recorded so the ring position is m_nWritten & mask.
+//-----------------------------------------------------------------------------
+
+class CVProfTraceBuffer
+{
+public:
+	VProfTraceEvent_t	m_Events[ VPROF_TRACE_EVENTS ];
+	unsigned volatile	m_nWritten;
+	bool				m_bPrimaryThread;
+	CVProfTraceBuffer	*m_pNext;
+};
+
+#ifdef _WIN32
+static __declspec(thread) CVProfTraceBuffer *s_pThreadTraceBuffer = NULL;
+#else
+static __thread CVProfTraceBuffer *s_pThreadTraceBuffer = NULL;
+#endif
+
+// Only taken the first time a thread records something
+static CThreadMutex s_TraceBufferMutex;
+
+//-------------------------------------
+
+CVProfTrace::CVProfTrace()
+ :	m_bRecording( false ),
+	m_pBuffers( NULL )
+{
+}
+
+CVProfTrace::~CVProfTrace()
+{
+	m_bRecording = false;
+	while ( m_pBuffers )
+	{
+		CVProfTraceBuffer *pNext = m_pBuffers->m_pNext;
+		delete m_pBuffers;
+		m_pBuffers = pNext;
+	}
+}
+
+//-------------------------------------
+
+void CVProfTrace::Start()
+{
+	Clear();
+	m_bRecording = true;
+}
+
+void CVProfTrace::Stop()
+{
+	m_bRecording = false;
+}
+
+void CVProfTrace::Clear()
+{
+	for ( CVProfTraceBuffer *pBuffer = m_pBuffers; pBuffer; pBuffer = pBuffer->m_pNext )
+	{
+		pBuffer->m_nWritten = 0;
+	}
+}
+
+//-------------------------------------
+
+CVProfTraceBuffer *CVProfTrace::GetThreadBuffer()
+{
+	CVProfTraceBuffer *pBuffer = s_pThreadTraceBuffer;
+	if ( !pBuffer )
+	{
+		pBuffer = new CVProfTraceBuffer;
+		pBuffer->m_nWritten = 0;
+		pBuffer->m_bPrimaryThread = Plat_IsPrimaryThread();
+
+		s_TraceBufferMutex.Lock();
+		pBuffer->m_pNext = m_pBuffers;
+		m_pBuffers = pBuffer;
+		s_TraceBufferMutex.Unlock();
+
+		s_pThreadTraceBuffer = pBuffer;
+	}
+	return pBuffer;
+}
+
+//-------------------------------------
+
+void CVProfTrace::Record( int type, const char *pszName, const char *pBudgetGroupName, int tick )
+{
+	CVProfTraceBuffer *pBuffer = GetThreadBuffer();
+
+	CCycleCount now;
+	now.Sample();
+
+	VProfTraceEvent_t *pEvent = &pBuffer->m_Events[ pBuffer->m_nWritten & ( VPROF_TRACE_EVENTS - 1 ) ];
+	pEvent->m_Cycles = now.m_Int64;
+	pEvent->m_pszName = pszName;
+	pEvent->m_pszBudgetGroup = pBudgetGroupName;
+	pEvent->m_nType = type;
+	pEvent->m_nTick = tick;
+
+	// The event is filled in before it's counted
+	pBuffer->m_nWritten++;
+}
+
+//-------------------------------------
+
+static void WriteJSONString( FILE *fp, const char *pszString )
+{
+	fputc( '"', fp );
+	for ( ; *pszString; pszString++ )
+	{
+		if ( *pszString == '"' || *pszString == '\\' )
+		{
+			fputc( '\\', fp );
+		}
+		if ( (unsigned char)*pszString >= ' ' )
+		{
+			fputc( *pszString, fp );
+		}
+	}
+	fputc( '"', fp );
+}
+
+//-------------------------------------
+
+bool CVProfTrace::WriteChromeTrace( const char *pszFileName )
+{
+	FILE *fp = fopen( pszFileName, "wt" );
+	if ( !fp )
+		return false;
+
+	CVProfTraceBuffer *pBuffer;
+
+	// Timestamps are relative to the oldest event still in any ring
+	int64 baseCycles = 0;
+	bool bHaveBase = false;
+	for ( pBuffer = m_pBuffers; pBuffer; pBuffer = pBuffer->m_pNext )
+	{
+		unsigned nWritten = pBuffer->m_nWritten;
+		unsigned nEvents = min( nWritten, (unsigned)VPROF_TRACE_EVENTS );
+		if ( nEvents == 0 )
+			continue;
+
+		int64 cycles = pBuffer->m_Events[ ( nWritten - nEvents ) & ( VPROF_TRACE_EVENTS - 1 ) ].m_Cycles;
+		if ( !bHaveBase || cycles < baseCycles )
+		{
+			baseCycles = cycles;
+			bHaveBase = true;
+		}
+	}
+
+	fprintf( fp, "{\"traceEvents\":[\n" );
+
+	int tid = 0;
+	for ( pBuffer = m_pBuffers; pBuffer; pBuffer = pBuffer->m_pNext, tid++ )
+	{
+		fprintf( fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":", ( tid > 0 ) ? ",\n" : "", tid );
+		if ( pBuffer->m_bPrimaryThread )
+		{
+			fprintf( fp, "\"Primary Thread\"}}" );
+		}
+		else
+		{
+			fprintf( fp, "\"Thread %d\"}}", tid );
+		}
+
+		unsigned nWritten = pBuffer->m_nWritten;
+		unsigned nEvents = min( nWritten, (unsigned)VPROF_TRACE_EVENTS );
+
+		// Exits whose entry has already been overwritten are dropped
+		int depth = 0;
+		for ( unsigned i = nWritten - nEvents; i != nWritten; i++ )
+		{
+			const VProfTraceEvent_t *pEvent = &pBuffer->m_Events[ i & ( VPROF_TRACE_EVENTS - 1 ) ];
+			double timestamp = (double)( pEvent->m_Cycles - baseCycles ) * g_ClockSpeedMicrosecondsMultiplier;
+
+			switch ( pEvent->m_nType )
+			{
+			case VPTE_ENTER:
+				depth++;
+				fprintf( fp, ",\n{\"name\":" );
+				WriteJSONString( fp, pEvent->m_pszName );
+				fprintf( fp, ",\"cat\":" );
+				WriteJSONString( fp, pEvent->m_pszBudgetGroup ? pEvent->m_pszBudgetGroup : VPROF_BUDGETGROUP_OTHER_UNACCOUNTED );
+				fprintf( fp, ",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}", timestamp, tid );
+				break;
+
+			case VPTE_EXIT:
+				if ( depth == 0 )
+					break;
+				depth--;
+				fprintf( fp, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}", timestamp, tid );
+				break;
+
+			case VPTE_TICK:
+				fprintf( fp, ",\n{\"name\":\"Tick %d\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}", pEvent->m_nTick, timestamp, tid );
+				break;
+			}
+		}
+	}
+
+	fprintf( fp, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+
+	bool bOk = !ferror( fp );
+	fclose( fp );
+	return bOk;
+}
+
 #endif	
 
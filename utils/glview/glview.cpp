@@ -449,23 +449,17 @@ void ReadPHYFile(char *name, int nList)
 	if (!fp)
 		Error ("Couldn't open %s", name);
 
-	phyheader_t header;
-	
-	fread( &header, sizeof(header), 1, fp );
-	if ( header.size != sizeof(header) || header.solidCount <= 0 )
-		return;
-
-	int pos = ftell( fp );
 	fseek( fp, 0, SEEK_END );
-	int fileSize = ftell(fp) - pos;
-	fseek( fp, pos, SEEK_SET );
+	int fileSize = ftell(fp);
+	fseek( fp, 0, SEEK_SET );
 
 	char *buf = (char *)_alloca( fileSize );
 	fread( buf, fileSize, 1, fp );
 	fclose( fp );
 
 	vcollide_t collide;
-	physcollision->VCollideLoad( &collide, header.solidCount, (const char *)buf, fileSize );
+	if ( !physcollision->VCollideLoadFile( &collide, buf, fileSize, NULL, NULL ) )
+		return;
 
 	int i;
 	for (i = 0; i < 3; i++)  // Find the center point so we can put the viewer there by default
@@ -473,7 +467,7 @@ void ReadPHYFile(char *name, int nList)
 
 	glNewList (nList, GL_COMPILE);
 
-	for ( i = 0; i < header.solidCount; i++ )
+	for ( i = 0; i < collide.solidCount; i++ )
 	{
 		Vector *outVerts;
 		int vertCount = physcollision->CreateDebugMesh( collide.solids[i], &outVerts );
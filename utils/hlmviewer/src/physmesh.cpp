@@ -117,29 +117,23 @@ void CStudioPhysics::Load( studiohdr_t *pstudiohdr, const char *pFilename )
 
 	LoadPhysicsProperties();
 
-	phyheader_t header;
-	
-	fread( &header, sizeof(header), 1, fp );
-	if ( header.size != sizeof(header) || header.solidCount <= 0 )
-		return;
-
-	int pos = ftell( fp );
 	fseek( fp, 0, SEEK_END );
-	int fileSize = ftell(fp) - pos;
-	fseek( fp, pos, SEEK_SET );
+	int fileSize = ftell(fp);
+	fseek( fp, 0, SEEK_SET );
 
 	char *buf = (char *)_alloca( fileSize );
 	fread( buf, fileSize, 1, fp );
 	fclose( fp );
 
-	physcollision->VCollideLoad( &m_vcollide, header.solidCount, (const char *)buf, fileSize );
+	if ( !physcollision->VCollideLoadFile( &m_vcollide, buf, fileSize, NULL, NULL ) )
+		return;
 
-	m_pList = new CPhysmesh[header.solidCount];
-	m_listCount = header.solidCount;
+	m_pList = new CPhysmesh[m_vcollide.solidCount];
+	m_listCount = m_vcollide.solidCount;
 
 	int i;
 
-	for ( i = 0; i < header.solidCount; i++ )
+	for ( i = 0; i < m_vcollide.solidCount; i++ )
 	{
 		m_pList[i].Clear();
 		m_pList[i].m_vertCount = physcollision->CreateDebugMesh( m_vcollide.solids[i], &m_pList[i].m_pVerts );
@@ -148,7 +142,7 @@ void CStudioPhysics::Load( studiohdr_t *pstudiohdr, const char *pFilename )
 
 	ParseKeydata();
 
-	for ( i = 0; i < header.solidCount; i++ )
+	for ( i = 0; i < m_vcollide.solidCount; i++ )
 	{
 		CPhysmesh *pmesh = m_pList + i;
 		int boneIndex = FindBoneIndex( pstudiohdr, pmesh->m_boneName );
@@ -0,0 +1,1202 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: One load bot's connection to the server.  This is cl_main.cpp and
+//			cl_parse.cpp cut down to what a bot needs to sign on and get
+//			snapshots, on top of the engine's own net_chan.cpp.  It skips over
+//			anything it doesn't care about.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifdef _WIN32
+#include <winsock.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "loadbot.h"
+#include "proto_oob.h"
+#include "mathlib.h"
+#include "dt_recv_eng.h"
+#include "networkstringtableitem.h"
+#include "packed_entity.h"
+#include "event_system.h"
+#include "EngineSoundInternal.h"
+#include "vstdlib/strtools.h"
+#include "tier0/platform.h"
+#include <stdarg.h>
+#include <time.h>
+
+// Resend getchallenge/connect this often until the server answers
+#define LOADBOT_RETRY_INTERVAL	2.0
+
+// Give up on a server that's gone quiet for this long
+#define LOADBOT_TIMEOUT			30.0
+
+// Strings in createstringtables can start with part of one of the last few strings
+#define SUBSTRING_BITS			5
+#define MAX_STRING_HISTORY		31
+
+extern ConVar net_compress;
+
+//-----------------------------------------------------------------------------
+// Purpose: Non-blocking UDP socket on any port
+//-----------------------------------------------------------------------------
+lbsocket_t LoadBot_OpenSocket( void )
+{
+	struct sockaddr_in	address;
+	lbsocket_t			sock;
+
+	sock = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+#ifdef _WIN32
+	if ( sock == INVALID_SOCKET )
+		return ( lbsocket_t )-1;
+
+	unsigned long nonblocking = 1;
+	if ( ioctlsocket( sock, FIONBIO, &nonblocking ) == SOCKET_ERROR )
+	{
+		closesocket( sock );
+		return ( lbsocket_t )-1;
+	}
+#else
+	if ( sock < 0 )
+		return -1;
+
+	if ( fcntl( sock, F_SETFL, fcntl( sock, F_GETFL, 0 ) | O_NONBLOCK ) < 0 )
+	{
+		close( sock );
+		return -1;
+	}
+#endif
+
+	// Snapshots come in bursts, don't lose them to a small receive buffer
+	int bufsize = 256 * 1024;
+	setsockopt( sock, SOL_SOCKET, SO_RCVBUF, ( char * )&bufsize, sizeof( bufsize ) );
+
+	memset( &address, 0, sizeof( address ) );
+	address.sin_family		= AF_INET;
+	address.sin_addr.s_addr	= INADDR_ANY;
+	address.sin_port		= 0;
+
+	if ( bind( sock, ( struct sockaddr * )&address, sizeof( address ) ) < 0 )
+	{
+		LoadBot_CloseSocket( sock );
+		return ( lbsocket_t )-1;
+	}
+
+	return sock;
+}
+
+void LoadBot_CloseSocket( lbsocket_t sock )
+{
+#ifdef _WIN32
+	closesocket( sock );
+#else
+	close( sock );
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Connectionless packets go through net_chan.cpp too
+//-----------------------------------------------------------------------------
+static void LoadBot_OutOfBandPrint( loadbot_t *bot, double time, const char *fmt, ... )
+{
+	va_list		argptr;
+	char		string[ 2048 ];
+	netadr_t	adr;
+
+	va_start( argptr, fmt );
+	Q_vsnprintf( string, sizeof( string ), fmt, argptr );
+	va_end( argptr );
+
+	LoadBot_ServerAdr( &adr );
+	LoadBot_SetNetBot( bot, time );
+	Netchan_OutOfBand( NS_CLIENT, adr, strlen( string ) + 1, ( byte * )string );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Throw away everything we know about the level
+//-----------------------------------------------------------------------------
+static void LoadBot_ClearLevel( loadbot_t *bot )
+{
+	int i;
+
+	for ( i = 0; i < bot->baselines.Count(); i++ )
+	{
+		delete[] bot->baselines[ i ].data;
+	}
+	bot->baselines.RemoveAll();
+
+	for ( i = 0; i < MAX_EDICTS; i++ )
+	{
+		delete[] bot->staticbaselines[ i ].data;
+		bot->staticbaselines[ i ].data		= NULL;
+		bot->staticbaselines[ i ].bytes		= 0;
+		bot->staticbaselines[ i ].classid	= -1;
+
+		bot->entclass[ i ] = -1;
+	}
+
+	bot->numtables		= 0;
+	bot->baselinetable	= -1;
+	bot->validsequence	= 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_Init( loadbot_t *bot, int index, lbsocket_t sock )
+{
+	int i;
+
+	bot->index = index;
+	bot->sock = sock;
+	bot->state = BOT_CHALLENGING;
+
+	// The server turns away clients that share a key hash
+	Q_snprintf( bot->key, sizeof( bot->key ), "%08x%08x%08x%08x", index, ( int )time( NULL ), rand(), rand() );
+
+	bot->challenge		= 0;
+	bot->retrytime		= 0.0;
+	bot->nextsend		= 0.0;
+	bot->lastreceived	= 0.0;
+
+	// Netchan_Setup clears out whatever's in here first
+	memset( &bot->netchan, 0, sizeof( bot->netchan ) );
+
+	memset( bot->senttime, 0, sizeof( bot->senttime ) );
+
+	bot->signon			= 0;
+	bot->spawncount		= 0;
+	bot->playernum		= 0;
+	bot->numclasses		= 0;
+	bot->classbits		= 0;
+
+	for ( i = 0; i < MAX_EDICTS; i++ )
+	{
+		bot->staticbaselines[ i ].data = NULL;
+	}
+	LoadBot_ClearLevel( bot );
+
+	for ( i = 0; i <= LOADBOT_CMD_BACKUP; i++ )
+	{
+		bot->cmds[ i ].Reset();
+	}
+	bot->command_number	= 0;
+	bot->scriptpos		= 0;
+	bot->yaw			= ( float )( ( index * 37 ) % 360 );
+
+	bot->lasttick		= 0;
+	bot->lastticktime	= 0.0;
+
+	bot->activetime		= 0.0;
+	bot->bytesin		= 0;
+	bot->bytesout		= 0;
+	bot->packetsin		= 0;
+	bot->packetsout		= 0;
+	bot->snapshots		= 0;
+	bot->entities		= 0;
+	bot->badentities	= 0;
+	bot->decodetime		= 0.0;
+	bot->unparsed		= 0;
+}
+
+void LoadBot_Shutdown( loadbot_t *bot )
+{
+	LoadBot_ClearLevel( bot );
+	Netchan_Clear( &bot->netchan );
+
+	LoadBot_CloseSocket( bot->sock );
+	bot->state = BOT_DISCONNECTED;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends a sequenced packet, remembering when it went out
+//-----------------------------------------------------------------------------
+static void LoadBot_Transmit( loadbot_t *bot, byte *data, int bits, double time )
+{
+	bot->senttime[ bot->netchan.outgoing_sequence & LOADBOT_SEQUENCE_MASK ] = time;
+
+	LoadBot_SetNetBot( bot, time );
+	Netchan_TransmitBits( &bot->netchan, bits, data );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Next line of the script into cmds[ 0 ]
+//-----------------------------------------------------------------------------
+static void LoadBot_CreateCmd( loadbot_t *bot )
+{
+	const botscriptcmd_t *script;
+	CUserCmd *cmd;
+	int i;
+
+	for ( i = LOADBOT_CMD_BACKUP; i > 0; i-- )
+	{
+		bot->cmds[ i ] = bot->cmds[ i - 1 ];
+	}
+
+	script = &g_BotScript[ bot->scriptpos ];
+	bot->scriptpos = ( bot->scriptpos + 1 ) % g_BotScript.Count();
+
+	bot->yaw = anglemod( bot->yaw + script->yaw );
+
+	cmd = &bot->cmds[ 0 ];
+	cmd->Reset();
+	cmd->command_number	= ++bot->command_number;
+	cmd->msec			= 1000 / g_nBotCmdRate;
+	cmd->viewangles.Init( script->pitch, bot->yaw, 0.0f );
+	cmd->forwardmove	= script->forwardmove;
+	cmd->sidemove		= script->sidemove;
+	cmd->upmove			= script->upmove;
+	cmd->buttons		= script->buttons;
+	cmd->impulse		= ( byte )script->impulse;
+	cmd->lerp_msec		= 100.0f;
+	cmd->updaterate		= ( byte )g_nBotUpdateRate;
+	cmd->commandrate	= ( byte )g_nBotCmdRate;
+	cmd->random_seed	= bot->command_number * 1103515245 + 12345;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A usercmd and the delta request, once a cmdrate tick
+//-----------------------------------------------------------------------------
+static void LoadBot_SendMove( loadbot_t *bot, double time )
+{
+	byte		data[ 256 ];
+	bf_write	buf( "LoadBot_SendMove", data, sizeof( data ) );
+	CUserCmd	nullcmd;
+	CUserCmd	*from;
+	int			numbackup, i;
+
+	if ( bot->state == BOT_ACTIVE )
+	{
+		LoadBot_CreateCmd( bot );
+
+		numbackup = min( LOADBOT_CMD_BACKUP, bot->command_number - 1 );
+
+		buf.WriteByte( clc_move );
+		buf.WriteOneBit( 0 );
+		buf.WriteUBitLong( numbackup, NUM_BACKUP_COMMAND_BITS );
+		buf.WriteByte( 1 );
+
+		// Oldest first, the server reads them back the same way
+		from = &nullcmd;
+		for ( i = numbackup; i >= 0; i-- )
+		{
+			WriteUsercmd( &buf, &bot->cmds[ i ], from );
+			from = &bot->cmds[ i ];
+		}
+
+		buf.WriteUBitLong( 0xffffffff, 32 );
+	}
+
+	// No delta base means a full update
+	if ( bot->validsequence )
+	{
+		buf.WriteByte( clc_delta );
+		buf.WriteUBitLong( bot->validsequence & DELTAFRAME_MASK, DELTAFRAME_NUMBITS );
+	}
+
+	LoadBot_Transmit( bot, buf.GetData(), buf.GetNumBitsWritten(), time );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_Frame( loadbot_t *bot, double time )
+{
+	switch ( bot->state )
+	{
+	case BOT_DISCONNECTED:
+		return;
+
+	case BOT_CHALLENGING:
+	case BOT_CONNECTING:
+		if ( time < bot->retrytime )
+			return;
+
+		bot->state = BOT_CHALLENGING;
+		bot->retrytime = time + LOADBOT_RETRY_INTERVAL;
+		LoadBot_OutOfBandPrint( bot, time, "getchallenge\n" );
+		return;
+
+	default:
+		break;
+	}
+
+	if ( time - bot->lastreceived > LOADBOT_TIMEOUT )
+	{
+		printf( "Bot %i timed out\n", bot->index );
+		bot->state = BOT_DISCONNECTED;
+		return;
+	}
+
+	if ( time < bot->nextsend )
+		return;
+
+	// Keep to the rate on average without bunching up after a slow frame
+	bot->nextsend += 1.0 / g_nBotCmdRate;
+	if ( bot->nextsend < time )
+	{
+		bot->nextsend = time + 1.0 / g_nBotCmdRate;
+	}
+
+	LoadBot_SendMove( bot, time );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_Disconnect( loadbot_t *bot )
+{
+	int i;
+
+	if ( bot->state < BOT_SERVERINFO || bot->state == BOT_DISCONNECTED )
+		return;
+
+	// Same as CL_Disconnect, send it a few times in case some get lost
+	for ( i = 0; i < 3; i++ )
+	{
+		byte		data[ 32 ];
+		bf_write	buf( "LoadBot_Disconnect", data, sizeof( data ) );
+
+		buf.WriteByte( clc_stringcmd );
+		buf.WriteString( "dropclient\n" );
+		LoadBot_Transmit( bot, buf.GetData(), buf.GetNumBitsWritten(), Plat_FloatTime() );
+	}
+
+	bot->state = BOT_DISCONNECTED;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: getchallenge/connect replies in net_message
+//-----------------------------------------------------------------------------
+static void LoadBot_Connectionless( loadbot_t *bot, double time )
+{
+	char		line[ 1024 ];
+	unsigned	challenge;
+	int			compress;
+	int			i;
+
+	// Skip the -1 and take the first line
+	for ( i = 0; i + 4 < net_message.cursize && i < ( int )sizeof( line ) - 1; i++ )
+	{
+		if ( !net_message.data[ i + 4 ] || net_message.data[ i + 4 ] == '\n' )
+			break;
+		line[ i ] = net_message.data[ i + 4 ];
+	}
+	line[ i ] = 0;
+
+	switch ( line[ 0 ] )
+	{
+	case S2C_CHALLENGE:
+		if ( bot->state != BOT_CHALLENGING || sscanf( line + 1, "%*s %u", &challenge ) != 1 )
+			break;
+
+		bot->challenge = ( int )challenge;
+		bot->state = BOT_CONNECTING;
+		bot->retrytime = time + LOADBOT_RETRY_INTERVAL;
+
+		// Same protinfo as CL_SendConnectPacket
+		LoadBot_OutOfBandPrint( bot, time, "connect %i %i \"\\prot\\%i\\raw\\%s%s\" \"\\name\\%s%i\\rate\\%i\\cl_updaterate\\%i\\cl_cmdrate\\%i\"\n",
+			PROTOCOL_VERSION, bot->challenge, PROTOCOL_HASHEDCDKEY, bot->key, net_compress.GetInt() ? "\\lz\\1" : "",
+			g_pBotName, bot->index, g_nBotRate, g_nBotUpdateRate, g_nBotCmdRate );
+		break;
+
+	case S2C_CONNECTION:
+		if ( bot->state != BOT_CONNECTING )
+			break;
+
+		// Same as CL_ConnectClient
+		LoadBot_SetNetBot( bot, time );
+		Netchan_Setup( NS_CLIENT, &bot->netchan, net_from );
+		bot->netchan.compress = ( sscanf( line + 1, "%*s %i", &compress ) == 1 && compress ) ? true : false;
+
+		bot->state = BOT_SERVERINFO;
+		bot->signon = 0;
+		bot->nextsend = time;
+
+		bot->netchan.message.WriteByte( clc_stringcmd );
+		bot->netchan.message.WriteString( "new" );
+		break;
+
+	case S2C_CONNREJECT:
+	case S2C_BADPASSWORD:
+		if ( bot->state != BOT_CONNECTING )
+			break;
+
+		printf( "Bot %i refused: %s\n", bot->index, line + 1 );
+		bot->state = BOT_DISCONNECTED;
+		break;
+
+	default:
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reliable string commands from the bot
+//-----------------------------------------------------------------------------
+static void LoadBot_StringCmd( loadbot_t *bot, const char *fmt, ... )
+{
+	va_list		argptr;
+	char		string[ 256 ];
+
+	va_start( argptr, fmt );
+	Q_vsnprintf( string, sizeof( string ), fmt, argptr );
+	va_end( argptr );
+
+	bot->netchan.message.WriteByte( clc_stringcmd );
+	bot->netchan.message.WriteString( string );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps string table user data we need, which is just the instance baselines
+//-----------------------------------------------------------------------------
+static void LoadBot_SetBaseline( botbaseline_t *baseline, int classid, bf_read *buf, int bytes )
+{
+	delete[] baseline->data;
+
+	baseline->classid	= classid;
+	baseline->bytes		= bytes;
+	baseline->data		= new byte[ PAD_NUMBER( bytes, 4 ) + 4 ];
+	memset( baseline->data, 0, PAD_NUMBER( bytes, 4 ) + 4 );
+
+	buf->ReadBits( baseline->data, bytes << 3 );
+}
+
+static void LoadBot_ReadStringUserData( loadbot_t *bot, int table, const char *string, bf_read *buf )
+{
+	int bytes, classid;
+
+	if ( !buf->ReadOneBit() )
+		return;
+
+	bytes = buf->ReadUBitLong( CNetworkStringTableItem::MAX_USERDATA_BITS );
+
+	// The key is the class index
+	classid = atoi( string );
+	if ( table != bot->baselinetable || classid < 0 || classid >= MAX_DATATABLES )
+	{
+		buf->SeekRelative( bytes << 3 );
+		return;
+	}
+
+	while ( bot->baselines.Count() <= classid )
+	{
+		int i = bot->baselines.AddToTail();
+		bot->baselines[ i ].classid	= i;
+		bot->baselines[ i ].data	= NULL;
+		bot->baselines[ i ].bytes	= 0;
+	}
+
+	LoadBot_SetBaseline( &bot->baselines[ classid ], classid, buf, bytes );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_createstringtables
+//-----------------------------------------------------------------------------
+static bool LoadBot_ParseStringTables( loadbot_t *bot, bf_read *buf )
+{
+	char	history[ MAX_STRING_HISTORY ][ 1 << SUBSTRING_BITS ];
+	char	name[ 256 ];
+	char	entry[ 1024 ];
+	int		numhistory;
+	int		i, j, maxentries, used, index, bytestocopy, len;
+
+	bot->numtables = buf->ReadByte();
+	if ( bot->numtables > MAX_TABLES )
+		return false;
+
+	for ( i = 0; i < bot->numtables; i++ )
+	{
+		numhistory = 0;
+
+		buf->ReadString( name, sizeof( name ) );
+		maxentries = buf->ReadShort();
+		if ( maxentries <= 0 )
+			return false;
+
+		bot->tableentrybits[ i ] = Q_log2( maxentries );
+		if ( !stricmp( name, INSTANCE_BASELINE_TABLENAME ) )
+		{
+			bot->baselinetable = i;
+		}
+
+		used = buf->ReadUBitLong( bot->tableentrybits[ i ] );
+
+		for ( j = 0; j < used; j++ )
+		{
+			if ( buf->ReadOneBit() )
+			{
+				index = buf->ReadUBitLong( Q_log2( numhistory ) + 1 );
+				bytestocopy = buf->ReadUBitLong( SUBSTRING_BITS );
+				if ( index >= numhistory )
+					return false;
+
+				Q_strncpy( entry, history[ index ], bytestocopy + 1 );
+				len = strlen( entry );
+				buf->ReadString( entry + len, sizeof( entry ) - len );
+			}
+			else
+			{
+				buf->ReadString( entry, sizeof( entry ) );
+			}
+
+			LoadBot_ReadStringUserData( bot, i, entry, buf );
+
+			if ( numhistory >= MAX_STRING_HISTORY )
+			{
+				memmove( history[ 0 ], history[ 1 ], sizeof( history[ 0 ] ) * ( MAX_STRING_HISTORY - 1 ) );
+				numhistory--;
+			}
+			Q_strncpy( history[ numhistory++ ], entry, sizeof( history[ 0 ] ) );
+
+			if ( buf->IsOverflowed() )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_updatestringtable
+//-----------------------------------------------------------------------------
+static bool LoadBot_ParseUpdateStringTable( loadbot_t *bot, bf_read *buf )
+{
+	char	entry[ 1024 ];
+	int		table;
+
+	table = buf->ReadUBitLong( Q_log2( MAX_TABLES ) );
+	if ( table >= bot->numtables )
+		return false;
+
+	while ( buf->ReadOneBit() )
+	{
+		buf->ReadUBitLong( bot->tableentrybits[ table ] );
+		buf->ReadString( entry, sizeof( entry ) );
+		LoadBot_ReadStringUserData( bot, table, entry, buf );
+
+		if ( buf->IsOverflowed() )
+			return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_spawnbaseline, from the signon
+//-----------------------------------------------------------------------------
+static bool LoadBot_ParseSpawnBaseline( loadbot_t *bot, bf_read *buf )
+{
+	byte		packed[ MAX_PACKEDENTITY_DATA ];
+	bf_write	out( "LoadBot_ParseSpawnBaseline", packed, sizeof( packed ) );
+	RecvTable	*table;
+	int			entnum, classid;
+
+	entnum = buf->ReadUBitLong( MAX_EDICT_BITS );
+	classid = buf->ReadUBitLong( bot->classbits );
+
+	// There's no length, we need the decoder to find the end of it
+	table = LoadBot_GetClassTable( classid );
+	if ( !table || !RecvTable_CopyEncoding( table, buf, &out, entnum ) || out.IsOverflowed() )
+		return false;
+
+	bf_read in( "LoadBot_ParseSpawnBaseline", packed, sizeof( packed ), out.GetNumBitsWritten() );
+	LoadBot_SetBaseline( &bot->staticbaselines[ entnum ], classid, &in, out.GetNumBytesWritten() );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Static baseline if the entity has one of the right class, else the class's
+//-----------------------------------------------------------------------------
+static const botbaseline_t *LoadBot_GetBaseline( loadbot_t *bot, int entnum, int classid )
+{
+	if ( bot->staticbaselines[ entnum ].data && bot->staticbaselines[ entnum ].classid == classid )
+		return &bot->staticbaselines[ entnum ];
+
+	if ( classid >= 0 && classid < bot->baselines.Count() && bot->baselines[ classid ].data )
+		return &bot->baselines[ classid ];
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_packetentities/svc_deltapacketentities.  Reads the same way as
+//			CL_ReadPacketEntities, but only remembers each entity's class.
+//-----------------------------------------------------------------------------
+static void LoadBot_ParsePacketEntities( loadbot_t *bot, bf_read *buf, bool delta, double time )
+{
+	const botbaseline_t	*baseline;
+	RecvTable			*table;
+	int					startbit, endbit, headercount, base;
+	int					entnum, classid, nbits;
+	bool				ok;
+
+	buf->ReadShort();
+	if ( delta )
+	{
+		buf->ReadUBitLong( DELTAFRAME_NUMBITS );
+	}
+
+	startbit = buf->GetNumBitsRead();
+	endbit = startbit + buf->ReadUBitLong( DELTASIZE_BITS );
+
+	// This answers the packet the server had last heard from us
+	LoadBot_RecordLatency( time - bot->senttime[ bot->netchan.incoming_acknowledged & LOADBOT_SEQUENCE_MASK ] );
+	bot->snapshots++;
+
+	if ( bot->state == BOT_SPAWNING )
+	{
+		bot->state = BOT_ACTIVE;
+		bot->activetime = time;
+	}
+
+	double start = Plat_FloatTime();
+
+	ok = LoadBot_TablesReady();
+	headercount = ok ? buf->ReadUBitLong( MAX_EDICT_BITS ) : 0;
+	base = 0;
+
+	while ( ok && headercount-- > 0 )
+	{
+		if ( !buf->ReadOneBit() )
+		{
+			entnum = base + buf->ReadUBitLong( DELTA_OFFSET_BITS );
+		}
+		else
+		{
+			entnum = buf->ReadUBitLong( MAX_EDICT_BITS );
+		}
+		base = entnum;
+
+		if ( entnum >= MAX_EDICTS )
+		{
+			ok = false;
+			break;
+		}
+
+		// Leave PVS
+		if ( buf->ReadOneBit() )
+		{
+			// Deleted
+			if ( buf->ReadOneBit() )
+			{
+				bot->entclass[ entnum ] = -1;
+			}
+			continue;
+		}
+
+		baseline = NULL;
+
+		// Enter PVS
+		if ( buf->ReadOneBit() )
+		{
+			buf->ReadOneBit();	// recreate
+			classid = buf->ReadUBitLong( bot->classbits );
+			buf->ReadUBitLong( NUM_NETWORKED_EHANDLE_SERIAL_NUMBER_BITS );
+
+			baseline = LoadBot_GetBaseline( bot, entnum, classid );
+			if ( !baseline )
+			{
+				ok = false;
+				break;
+			}
+
+			bot->entclass[ entnum ] = classid;
+		}
+		else
+		{
+			classid = bot->entclass[ entnum ];
+		}
+
+		table = LoadBot_GetClassTable( classid );
+		if ( !table )
+		{
+			ok = false;
+			break;
+		}
+
+		nbits = buf->ReadOneBit() ? buf->ReadUBitLong( ENTITY_PROPS_LONG_BITS ) : buf->ReadUBitLong( ENTITY_PROPS_SHORT_BITS );
+		if ( buf->IsOverflowed() || buf->GetNumBitsRead() + nbits > endbit )
+		{
+			ok = false;
+			break;
+		}
+
+		if ( !LoadBot_DecodeEntity( table, entnum, baseline, buf, nbits ) )
+		{
+			bot->badentities++;
+			ok = false;
+			break;
+		}
+
+		bot->entities++;
+	}
+
+	// Explicit deletes
+	if ( ok && delta )
+	{
+		while ( buf->ReadOneBit() )
+		{
+			bot->entclass[ buf->ReadUBitLong( MAX_EDICT_BITS ) ] = -1;
+		}
+	}
+
+	bot->decodetime += Plat_FloatTime() - start;
+
+	// If we can't keep up with the entities, ask for full updates until we can
+	bot->validsequence = ( ok && !buf->IsOverflowed() ) ? bot->netchan.incoming_sequence : 0;
+
+	buf->Seek( endbit );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_serverinfo.  The rest of the signon waits for the string tables.
+//-----------------------------------------------------------------------------
+static void LoadBot_ParseServerinfo( loadbot_t *bot, bf_read *buf )
+{
+	char text[ 256 ];
+
+	if ( buf->ReadShort() != PROTOCOL_VERSION )
+	{
+		printf( "Bot %i: server is using a different protocol\n", bot->index );
+		bot->state = BOT_DISCONNECTED;
+		return;
+	}
+
+	bot->spawncount = buf->ReadLong();
+	buf->ReadLong();		// map CRC
+	buf->ReadLong();		// client.dll CRC
+	buf->ReadByte();		// maxclients
+	bot->playernum = buf->ReadByte();
+	buf->ReadString( text, sizeof( text ) );	// gamedir
+	buf->ReadString( text, sizeof( text ) );	// map
+	buf->ReadString( text, sizeof( text ) );	// sky
+	buf->ReadLong();		// game event CRC
+
+	LoadBot_ClearLevel( bot );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Asks for the signon data once the string tables are in, like
+//			CL_RegisterResources.  Bots don't load anything for the level.
+//-----------------------------------------------------------------------------
+static void LoadBot_RegisterResources( loadbot_t *bot )
+{
+	if ( bot->state != BOT_SERVERINFO )
+		return;
+
+	// SendTables from an earlier signon that didn't get as far as the class info are no good
+	LoadBot_BeginTables();
+
+	LoadBot_StringCmd( bot, "prespawn %i", bot->spawncount );
+	bot->state = BOT_PRESPAWN;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: svc_signonnum, the next step of the signon like CL_SignonReply
+//-----------------------------------------------------------------------------
+static void LoadBot_SignonNum( loadbot_t *bot, int signon )
+{
+	if ( signon <= bot->signon )
+	{
+		printf( "Bot %i: received signon %i when at %i\n", bot->index, signon, bot->signon );
+		LoadBot_Disconnect( bot );
+		return;
+	}
+
+	bot->signon = signon;
+
+	switch ( signon )
+	{
+	case 1:
+		LoadBot_StringCmd( bot, "spawn %i", bot->spawncount );
+		break;
+
+	case 2:
+		LoadBot_StringCmd( bot, "begin %i", bot->spawncount );
+		bot->state = BOT_SPAWNING;
+		break;
+
+	default:
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs through server messages.  Returns false if it had to stop before
+//			the end, either at something it can't parse or at bad data.
+//-----------------------------------------------------------------------------
+static bool LoadBot_ParseMessages( loadbot_t *bot, bf_read *buf, double time )
+{
+	char	text[ 2048 ];
+	Vector	vec;
+	QAngle	angles;
+	int		cmd, i, count;
+
+	while ( 1 )
+	{
+		if ( buf->IsOverflowed() )
+			return false;
+
+		if ( buf->GetNumBitsLeft() < 8 )
+			return true;
+
+		cmd = buf->ReadByte();
+
+		switch ( cmd )
+		{
+		case svc_nop:
+		case svc_clientdata:
+		case svc_choke:
+			break;
+
+		case svc_disconnect:
+			printf( "Bot %i: server disconnected\n", bot->index );
+			bot->state = BOT_DISCONNECTED;
+			return true;
+
+		case svc_event:
+			count = buf->ReadUBitLong( Q_log2( MAX_EVENT_QUEUE ) );
+			for ( i = 0; i < count; i++ )
+			{
+				buf->ReadUBitLong( bot->classbits );
+				buf->SeekRelative( buf->ReadUBitLong( EVENT_DATA_LEN_BITS ) );
+				if ( buf->ReadOneBit() )
+				{
+					buf->ReadUBitLong( 16 );
+				}
+			}
+			break;
+
+		case svc_event_reliable:
+			buf->ReadUBitLong( bot->classbits );
+			buf->SeekRelative( buf->ReadUBitLong( EVENT_DATA_LEN_BITS ) );
+			if ( buf->ReadOneBit() )
+			{
+				buf->ReadUBitLong( 16 );
+			}
+			break;
+
+		case svc_setview:
+		case svc_stopsound:
+		case svc_roomtype:
+			buf->ReadShort();
+			break;
+
+		case svc_sound:
+			buf->ReadUBitLong( 8 );
+			i = buf->ReadUBitLong( SND_FLAG_BITS_ENCODE );
+			if ( i & SND_VOLUME )
+			{
+				buf->ReadUBitLong( 8 );
+			}
+			if ( i & SND_SOUNDLEVEL )
+			{
+				buf->ReadUBitLong( 8 );
+			}
+			buf->ReadUBitLong( 3 );
+			buf->ReadUBitLong( MAX_EDICT_BITS );
+			buf->ReadUBitLong( MAX_SOUND_INDEX_BITS );
+			buf->ReadBitCoord();
+			buf->ReadBitCoord();
+			buf->ReadBitCoord();
+			if ( i & SND_PITCH )
+			{
+				buf->ReadUBitLong( 8 );
+			}
+			if ( i & SND_DELAY )
+			{
+				buf->ReadSBitLong( MAX_SOUND_DELAY_MSEC_ENCODE_BITS );
+			}
+			break;
+
+		case svc_time:
+			LoadBot_RecordTick( bot, buf->ReadLong(), time );
+			break;
+
+		case svc_stufftext:
+			buf->ReadString( text, sizeof( text ) );
+			// Level change, start the signon over like CL_Reconnect_f
+			if ( !Q_strncmp( text, "reconnect", 9 ) )
+			{
+				LoadBot_ClearLevel( bot );
+				LoadBot_StringCmd( bot, "new" );
+				bot->state = BOT_SERVERINFO;
+				bot->signon = 0;
+			}
+			break;
+
+		case svc_print:
+		case svc_centerprint:
+		case svc_finale:
+		case svc_restore:
+		case svc_cutscene:
+		case svc_voiceinit:
+			buf->ReadString( text, sizeof( text ) );
+			break;
+
+		case svc_setangle:
+			buf->ReadBitAngle( 16 );
+			buf->ReadBitAngle( 16 );
+			buf->ReadBitAngle( 16 );
+			break;
+
+		case svc_addangle:
+			buf->ReadBitAngle( 16 );
+			buf->ReadBitAngle( 16 );
+			break;
+
+		case svc_serverinfo:
+			LoadBot_ParseServerinfo( bot, buf );
+			break;
+
+		case svc_lightstyle:
+			if ( buf->ReadOneBit() )
+			{
+				for ( i = 0; i < MAX_LIGHTSTYLES; i++ )
+				{
+					if ( buf->ReadOneBit() )
+					{
+						buf->ReadString( text, sizeof( text ) );
+					}
+				}
+			}
+			else
+			{
+				buf->ReadUBitLong( MAX_LIGHTSTYLE_INDEX_BITS );
+				buf->ReadString( text, sizeof( text ) );
+			}
+			break;
+
+		case svc_updateuserinfo:
+			buf->ReadUBitLong( MAX_CLIENT_BITS );
+			if ( buf->ReadOneBit() )
+			{
+				buf->SeekRelative( 16 << 3 );
+				buf->ReadString( text, sizeof( text ) );
+			}
+			break;
+
+		case svc_createstringtables:
+			if ( !LoadBot_ParseStringTables( bot, buf ) )
+				return false;
+			LoadBot_RegisterResources( bot );
+			break;
+
+		case svc_updatestringtable:
+			if ( !LoadBot_ParseUpdateStringTable( bot, buf ) )
+				return false;
+			break;
+
+		case svc_entitymessage:
+			buf->ReadUBitLong( MAX_EDICT_BITS );
+			buf->ReadString( text, sizeof( text ) );
+			buf->SeekRelative( buf->ReadByte() << 3 );
+			break;
+
+		case svc_spawnbaseline:
+			if ( !LoadBot_ParseSpawnBaseline( bot, buf ) )
+				return false;
+			break;
+
+		case svc_bspdecal:
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadUBitLong( MAX_DECAL_INDEX_BITS );
+			if ( buf->ReadUBitLong( MAX_EDICT_BITS ) )
+			{
+				buf->ReadUBitLong( SP_MODEL_INDEX_BITS );
+			}
+			break;
+
+		case svc_signonnum:
+			LoadBot_SignonNum( bot, buf->ReadByte() );
+			if ( bot->state == BOT_DISCONNECTED )
+				return true;
+			break;
+
+		case svc_setpause:
+		case svc_cdtrack:
+		case svc_skippedupdate:
+			buf->ReadByte();
+			break;
+
+		case svc_spawnstaticsound:
+			i = buf->ReadUBitLong( SND_FLAG_BITS_ENCODE );
+			buf->ReadBitCoord();
+			buf->ReadBitCoord();
+			buf->ReadBitCoord();
+			buf->ReadUBitLong( MAX_SOUND_INDEX_BITS );
+			if ( i & SND_VOLUME )
+			{
+				buf->ReadByte();
+			}
+			if ( i & SND_SOUNDLEVEL )
+			{
+				buf->ReadByte();
+			}
+			buf->ReadUBitLong( MAX_EDICT_BITS );
+			if ( i & SND_PITCH )
+			{
+				buf->ReadByte();
+			}
+			if ( i & SND_DELAY )
+			{
+				buf->ReadSBitLong( MAX_SOUND_DELAY_MSEC_ENCODE_BITS );
+			}
+			break;
+
+		case svc_packetentities:
+		case svc_deltapacketentities:
+			LoadBot_ParsePacketEntities( bot, buf, cmd == svc_deltapacketentities, time );
+			break;
+
+		case svc_setconvar:
+			buf->ReadByte();
+			count = buf->ReadByte();
+			for ( i = 0; i < count * 2; i++ )
+			{
+				buf->ReadString( text, sizeof( text ) );
+			}
+			break;
+
+		case svc_sendlogo:
+			buf->ReadLong();
+			break;
+
+		case svc_crosshairangle:
+			buf->ReadChar();
+			buf->ReadChar();
+			break;
+
+		case svc_soundfade:
+			buf->SeekRelative( 4 * 32 );
+			break;
+
+		case svc_voicedata:
+			buf->ReadByte();
+			buf->SeekRelative( buf->ReadShort() << 3 );
+			break;
+
+		case svc_sendtable:
+			if ( !LoadBot_ReadSendTable( buf ) )
+				return false;
+			break;
+
+		case svc_classinfo:
+			switch ( buf->ReadByte() )
+			{
+			case CLASSINFO_NUMCLASSES:
+				bot->numclasses = buf->ReadShort();
+				bot->classbits = Q_log2( bot->numclasses ) + 1;
+				break;
+			case CLASSINFO_CLASSDATA:
+				i = buf->ReadUBitLong( bot->classbits );
+				buf->ReadString( text, sizeof( text ) );	// network name
+				buf->ReadString( text, sizeof( text ) );
+				LoadBot_SetClassTable( i, text );
+				break;
+			case CLASSINFO_ENDCLASSES:
+				if ( !LoadBot_TablesReady() && !LoadBot_BuildDecoders() )
+				{
+					printf( "Couldn't build decoders from the server's SendTables, the bots won't decode entities\n" );
+				}
+				break;
+			default:
+				return false;
+			}
+			break;
+
+		case svc_debugentityoverlay:
+			buf->SeekRelative( 2 * 16 + 32 + 4 * 16 );
+			buf->ReadString( text, sizeof( text ) );
+			break;
+
+		case svc_debugboxoverlay:
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitAngles( angles );
+			buf->SeekRelative( 4 * 16 + 32 );
+			break;
+
+		case svc_debuglineoverlay:
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitVec3Coord( vec );
+			buf->SeekRelative( 4 * 16 + 32 );
+			break;
+
+		case svc_debugtextoverlay:
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadFloat();
+			buf->ReadString( text, sizeof( text ) );
+			break;
+
+		case svc_debuggridoverlay:
+			buf->ReadBitVec3Coord( vec );
+			break;
+
+		case svc_debugscreentext:
+			buf->SeekRelative( 3 * 32 + 4 * 16 );
+			buf->ReadString( text, sizeof( text ) );
+			break;
+
+		case svc_debugtriangleoverlay:
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitVec3Coord( vec );
+			buf->ReadBitVec3Coord( vec );
+			buf->SeekRelative( 5 * 16 + 32 );
+			break;
+
+		default:
+			// Game events and user messages need the game's own definitions to skip over
+			bot->unparsed++;
+			return false;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drains the bot's socket, the same way CL_ReadPackets does
+//-----------------------------------------------------------------------------
+void LoadBot_ReadPackets( loadbot_t *bot, double time )
+{
+	LoadBot_SetNetBot( bot, time );
+
+	while ( bot->state != BOT_DISCONNECTED && LoadBot_GetPacket( bot ) )
+	{
+		bot->lastreceived = time;
+
+		if ( net_message.cursize >= 4 && *( int * )net_message.data == -1 )
+		{
+			LoadBot_Connectionless( bot, time );
+			continue;
+		}
+
+		if ( bot->state < BOT_SERVERINFO || net_message.cursize < 8 )
+			continue;
+
+		if ( !Netchan_Process( &bot->netchan ) )
+			continue;
+
+		LoadBot_ParseMessages( bot, MSG_GetReadBuf(), time );
+	}
+
+	if ( bot->state < BOT_SERVERINFO || bot->state == BOT_DISCONNECTED || !Netchan_IncomingReady( &bot->netchan ) )
+		return;
+
+	if ( Netchan_CopyNormalFragments( &bot->netchan ) )
+	{
+		MSG_BeginReading();
+		LoadBot_ParseMessages( bot, MSG_GetReadBuf(), time );
+	}
+
+	// Files are no use to a bot, this just frees them
+	Netchan_CopyFileFragments( &bot->netchan );
+}
@@ -0,0 +1,463 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Snapshot decoding for the load bots.  There's no client DLL to get
+//			RecvTables from, so they're built from the SendTables the server
+//			sends at prespawn and the engine's decoders are set up on them.
+//			Every bot talks to the same server, so one set of tables is
+//			shared by all of them.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "loadbot.h"
+#include "dt.h"
+#include "dt_recv_eng.h"
+#include "dt_recv_decoder.h"
+#include "tier0/dbg.h"
+#include <stdarg.h>
+
+// A SendProp as the server described it
+typedef struct
+{
+	int			type;
+	char		*name;
+	int			flags;
+	char		*tablename;		// DPT_DataTable
+	int			numelements;	// DPT_Array
+} botsendprop_t;
+
+typedef struct
+{
+	char		*name;
+	bool		needsdecoder;
+	CUtlVector< botsendprop_t > props;
+
+	// The svc_sendtable data after the needs decoder bit.  RecvTable_RecvInfo reads
+	//  it again once the RecvTables exist.
+	byte		*data;
+	int			bits;
+
+	// Built from the props
+	RecvTable	*recvtable;
+	int			size;
+	bool		building;
+} botsendtable_t;
+
+static CUtlVector< botsendtable_t * >	s_SendTables;
+// Table name for each server class, resolved to a RecvTable when the decoders are built
+static CUtlVector< char * >				s_ClassTableNames;
+static CUtlVector< RecvTable * >		s_ClassTables;
+
+static bool		s_bTablesReady = false;
+
+// Entities are decoded here and thrown away, the bots don't keep any entity state
+static byte		*s_pScratch = NULL;
+
+//-----------------------------------------------------------------------------
+// Purpose: The engine's datatable code reports through these
+//-----------------------------------------------------------------------------
+void Con_Printf( const char *fmt, ... )
+{
+	va_list		argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+void Con_DPrintf( const char *fmt, ... )
+{
+}
+
+const char *GetObjectClassName( int objectID )
+{
+	return "[unknown]";
+}
+
+bool g_bDTIEnabled = false;
+
+void DTI_HookRecvDecoder( CRecvDecoder *pDecoder )
+{
+}
+
+void _DTI_HookDeltaBits( CRecvDecoder *pDecoder, int iProp, int nDeltaBits, int nDataBits )
+{
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+bool LoadBot_TablesReady( void )
+{
+	return s_bTablesReady;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Throw away anything collected from a signon that didn't finish
+//-----------------------------------------------------------------------------
+void LoadBot_BeginTables( void )
+{
+	int i, j;
+
+	if ( s_bTablesReady )
+		return;
+
+	for ( i = 0; i < s_SendTables.Count(); i++ )
+	{
+		botsendtable_t *table = s_SendTables[ i ];
+
+		for ( j = 0; j < table->props.Count(); j++ )
+		{
+			delete[] table->props[ j ].name;
+			delete[] table->props[ j ].tablename;
+		}
+
+		delete[] table->name;
+		delete[] table->data;
+		delete table;
+	}
+	s_SendTables.RemoveAll();
+
+	for ( i = 0; i < s_ClassTableNames.Count(); i++ )
+	{
+		delete[] s_ClassTableNames[ i ];
+	}
+	s_ClassTableNames.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Parse an svc_sendtable, keeping it if the decoders aren't built yet
+//-----------------------------------------------------------------------------
+bool LoadBot_ReadSendTable( bf_read *buf )
+{
+	char	name[ 256 ];
+	int		i, numprops, type, flags;
+	bool	keep = !s_bTablesReady;
+
+	botsendtable_t *table = keep ? new botsendtable_t : NULL;
+
+	bool needsdecoder = buf->ReadOneBit() != 0;
+	int start = buf->GetNumBitsRead();
+
+	buf->ReadString( name, sizeof( name ) );
+	numprops = buf->ReadUBitLong( PROPINFOBITS_NUMPROPS );
+
+	if ( table )
+	{
+		table->name = new char[ strlen( name ) + 1 ];
+		strcpy( table->name, name );
+		table->needsdecoder = needsdecoder;
+		table->data = NULL;
+		table->bits = 0;
+		table->recvtable = NULL;
+		table->size = 0;
+		table->building = false;
+		s_SendTables.AddToTail( table );
+	}
+
+	// Same layout RecvTable_RecvInfo reads
+	for ( i = 0; i < numprops; i++ )
+	{
+		botsendprop_t prop;
+
+		type = buf->ReadUBitLong( PROPINFOBITS_TYPE );
+		buf->ReadString( name, sizeof( name ) );
+		flags = buf->ReadUBitLong( PROPINFOBITS_FLAGS );
+
+		prop.type = type;
+		prop.flags = flags;
+		prop.name = NULL;
+		prop.tablename = NULL;
+		prop.numelements = 0;
+
+		if ( table )
+		{
+			prop.name = new char[ strlen( name ) + 1 ];
+			strcpy( prop.name, name );
+		}
+
+		if ( type == DPT_DataTable )
+		{
+			buf->ReadString( name, sizeof( name ) );
+			if ( table )
+			{
+				prop.tablename = new char[ strlen( name ) + 1 ];
+				strcpy( prop.tablename, name );
+			}
+		}
+		else if ( flags & SPROP_EXCLUDE )
+		{
+			buf->ReadString( name, sizeof( name ) );
+		}
+		else if ( type == DPT_String )
+		{
+			buf->ReadUBitLong( PROPINFOBITS_STRINGBUFFERLEN );
+		}
+		else if ( type == DPT_Array )
+		{
+			prop.numelements = buf->ReadUBitLong( PROPINFOBITS_NUMELEMENTS );
+		}
+		else
+		{
+			buf->ReadBitFloat();
+			buf->ReadBitFloat();
+			buf->ReadUBitLong( PROPINFOBITS_NUMBITS );
+		}
+
+		if ( table )
+		{
+			table->props.AddToTail( prop );
+		}
+	}
+
+	if ( buf->IsOverflowed() )
+		return false;
+
+	if ( table )
+	{
+		// Keep a copy of the bits for RecvTable_RecvInfo
+		bf_read	from = *buf;
+		bf_write to;
+
+		table->bits = buf->GetNumBitsRead() - start;
+		table->data = new byte[ PAD_NUMBER( table->bits, 8 ) / 8 ];
+
+		from.Seek( start );
+		to.StartWriting( table->data, PAD_NUMBER( table->bits, 8 ) / 8 );
+		to.WriteBitsFromBuffer( &from, table->bits );
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: From svc_classinfo
+//-----------------------------------------------------------------------------
+void LoadBot_SetClassTable( int classid, const char *tablename )
+{
+	if ( s_bTablesReady || classid < 0 )
+		return;
+
+	while ( s_ClassTableNames.Count() <= classid )
+	{
+		s_ClassTableNames.AddToTail( NULL );
+	}
+
+	delete[] s_ClassTableNames[ classid ];
+	s_ClassTableNames[ classid ] = new char[ strlen( tablename ) + 1 ];
+	strcpy( s_ClassTableNames[ classid ], tablename );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+static botsendtable_t *LoadBot_FindSendTable( const char *name )
+{
+	for ( int i = 0; i < s_SendTables.Count(); i++ )
+	{
+		if ( !stricmp( s_SendTables[ i ]->name, name ) )
+			return s_SendTables[ i ];
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Make a RecvTable with a prop for each SendProp, laid out one after
+//			another in a made up structure
+//-----------------------------------------------------------------------------
+static bool LoadBot_BuildRecvTable_R( botsendtable_t *table )
+{
+	int		i, size, offset, elementsize, numprops;
+
+	if ( table->recvtable )
+		return true;
+
+	if ( table->building )
+	{
+		Con_Printf( "SendTable %s contains itself\n", table->name );
+		return false;
+	}
+	table->building = true;
+
+	RecvProp *props = new RecvProp[ table->props.Count() ];
+	numprops = 0;
+	offset = 0;
+	elementsize = 0;
+
+	for ( i = 0; i < table->props.Count(); i++ )
+	{
+		botsendprop_t *prop = &table->props[ i ];
+		RecvProp *out;
+
+		// Excludes only matter when the server flattens its tables
+		if ( prop->flags & SPROP_EXCLUDE )
+			continue;
+
+		out = &props[ numprops++ ];
+
+		switch ( prop->type )
+		{
+		case DPT_Int:
+			*out = RecvPropInt( prop->name, offset, sizeof( int ) );
+			size = sizeof( int );
+			break;
+		case DPT_Float:
+			*out = RecvPropFloat( prop->name, offset, sizeof( float ) );
+			size = sizeof( float );
+			break;
+		case DPT_Vector:
+			*out = RecvPropVector( prop->name, offset, sizeof( Vector ) );
+			size = sizeof( Vector );
+			break;
+		case DPT_String:
+			*out = RecvPropString( prop->name, offset, DT_MAX_STRING_BUFFERSIZE );
+			size = DT_MAX_STRING_BUFFERSIZE;
+			break;
+		case DPT_Array:
+			// The element prop comes right before the array and was sized already.
+			//  Its elements live in the array's storage.
+			if ( !elementsize )
+			{
+				Con_Printf( "Array %s/%s has no element prop\n", table->name, prop->name );
+				return false;
+			}
+			*out = InternalRecvPropArray( prop->numelements, elementsize, prop->name, NULL );
+			out->SetOffset( offset );
+			size = elementsize * prop->numelements;
+			elementsize = 0;
+			break;
+		case DPT_DataTable:
+			{
+				botsendtable_t *child = LoadBot_FindSendTable( prop->tablename );
+				if ( !child )
+				{
+					Con_Printf( "Missing SendTable %s (referenced by %s)\n", prop->tablename, table->name );
+					return false;
+				}
+
+				if ( !LoadBot_BuildRecvTable_R( child ) )
+					return false;
+
+				*out = RecvPropDataTable( prop->name, offset, 0, child->recvtable );
+				size = child->size;
+			}
+			break;
+		default:
+			Con_Printf( "Unknown prop type %i for %s/%s\n", prop->type, table->name, prop->name );
+			return false;
+		}
+
+		if ( prop->flags & SPROP_INSIDEARRAY )
+		{
+			out->SetOffset( 0 );
+			elementsize = size;
+			continue;
+		}
+
+		offset += PAD_NUMBER( size, 4 );
+	}
+
+	table->recvtable = new RecvTable( props, numprops, table->name );
+	table->size = offset;
+	table->building = false;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called at the end of svc_classinfo, once every SendTable has come in
+//-----------------------------------------------------------------------------
+bool LoadBot_BuildDecoders( void )
+{
+	CUtlVector< RecvTable * > tables;
+	int		i, scratchsize;
+
+	if ( s_bTablesReady )
+		return true;
+
+	// Don't keep trying if the server sent something we can't handle, the bots
+	//  just won't decode entities
+	s_bTablesReady = true;
+
+	for ( i = 0; i < s_SendTables.Count(); i++ )
+	{
+		if ( !LoadBot_BuildRecvTable_R( s_SendTables[ i ] ) )
+			return false;
+
+		tables.AddToTail( s_SendTables[ i ]->recvtable );
+	}
+
+	if ( !RecvTable_Init( tables.Base(), tables.Count() ) )
+		return false;
+
+	scratchsize = 0;
+	for ( i = 0; i < s_SendTables.Count(); i++ )
+	{
+		botsendtable_t *table = s_SendTables[ i ];
+		bf_read buf( "LoadBot_BuildDecoders", table->data, PAD_NUMBER( table->bits, 8 ) / 8, table->bits );
+
+		if ( !RecvTable_RecvInfo( &buf, table->needsdecoder ) )
+			return false;
+
+		if ( table->needsdecoder )
+		{
+			scratchsize = max( scratchsize, table->size );
+		}
+	}
+
+	if ( !RecvTable_CreateDecoders() )
+		return false;
+
+	for ( i = 0; i < s_ClassTableNames.Count(); i++ )
+	{
+		botsendtable_t *table = s_ClassTableNames[ i ] ? LoadBot_FindSendTable( s_ClassTableNames[ i ] ) : NULL;
+
+		s_ClassTables.AddToTail( ( table && table->needsdecoder ) ? table->recvtable : NULL );
+	}
+
+	s_pScratch = new byte[ max( scratchsize, 4 ) ];
+	memset( s_pScratch, 0, max( scratchsize, 4 ) );
+
+	Con_Printf( "Built decoders for %i classes from %i SendTables\n", s_ClassTables.Count(), s_SendTables.Count() );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+RecvTable *LoadBot_GetClassTable( int classid )
+{
+	if ( classid < 0 || classid >= s_ClassTables.Count() )
+		return NULL;
+
+	return s_ClassTables[ classid ];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Decode the baseline and then nbits of props from buf, leaving buf
+//			just past the props
+//-----------------------------------------------------------------------------
+bool LoadBot_DecodeEntity( RecvTable *table, int entnum, const botbaseline_t *baseline, bf_read *buf, int nbits )
+{
+	bool	ok = true;
+
+	if ( baseline )
+	{
+		bf_read from( "LoadBot_DecodeEntity->from", baseline->data, baseline->bytes );
+		ok = RecvTable_Decode( table, s_pScratch, &from, entnum );
+	}
+
+	int start = buf->GetNumBitsRead();
+	int end = start + nbits;
+
+	bf_read props;
+	props.StartReading( buf->GetBasePointer(), PAD_NUMBER( end, 8 ) / 8, start, end );
+
+	if ( ok )
+	{
+		ok = RecvTable_Decode( table, s_pScratch, &props, entnum ) && !props.IsOverflowed();
+	}
+
+	buf->Seek( end );
+	return ok;
+}
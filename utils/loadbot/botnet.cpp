@@ -0,0 +1,249 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: What net_chan.cpp needs from the rest of the engine, so the bots use
+//			the same channel code as the client.  Packets go in and out through
+//			the socket of whichever bot is being run.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifdef _WIN32
+#include <winsock.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "loadbot.h"
+#include "client.h"
+#include "server.h"
+#include "conprint.h"
+#include "cmd.h"
+#include "demo.h"
+#include "filesystem_engine.h"
+#include <stdarg.h>
+
+#ifdef _WIN32
+typedef int socklen_t;
+#endif
+
+// Same as net_chan.cpp, bandwidth numbers include it
+#define UDP_HEADER_SIZE			28
+
+double			realtime = 0.0;
+netadr_t		net_from;
+sizebuf_t		net_message;
+
+// Big enough for any packet the server sends
+static byte		s_NetMessageBuffer[ NET_MAX_MESSAGE ];
+static bf_read	s_NetMessageRead;
+
+// net_chan.cpp only checks these for the listen server's own channels
+client_static_t	cls;
+CServerState	sv;
+ConVar			sv_lan( "sv_lan", "0" );
+ConVar			scr_downloading( "scr_downloading", "-1" );
+IFileSystem		*g_pFileSystem = NULL;
+
+// Bot the channel code is running for
+static loadbot_t *s_pNetBot = NULL;
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_NetInit( void )
+{
+	net_message.data = s_NetMessageBuffer;
+	net_message.maxsize = sizeof( s_NetMessageBuffer );
+	net_message.cursize = 0;
+
+	Netchan_Init();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Points NET_SendPacket at the bot's socket and brings realtime up to
+//			date before any Netchan_ call for it
+//-----------------------------------------------------------------------------
+void LoadBot_SetNetBot( loadbot_t *bot, double time )
+{
+	s_pNetBot = bot;
+	realtime = time;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_ServerAdr( netadr_t *adr )
+{
+	memset( adr, 0, sizeof( *adr ) );
+	adr->type = NA_IP;
+	memcpy( adr->ip, &g_nBotServerIP, sizeof( adr->ip ) );
+	adr->port = htons( g_nBotServerPort );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Next packet from the server into net_message, like NET_GetPacket
+//-----------------------------------------------------------------------------
+bool LoadBot_GetPacket( loadbot_t *bot )
+{
+	struct sockaddr_in	from;
+	socklen_t			fromlen;
+	int					length;
+
+	while ( 1 )
+	{
+		fromlen = sizeof( from );
+		length = recvfrom( bot->sock, ( char * )net_message.data, net_message.maxsize, 0, ( struct sockaddr * )&from, &fromlen );
+		if ( length <= 0 )
+			return false;
+
+		if ( from.sin_addr.s_addr == g_nBotServerIP && from.sin_port == htons( g_nBotServerPort ) )
+			break;
+	}
+
+	memset( &net_from, 0, sizeof( net_from ) );
+	net_from.type = NA_IP;
+	memcpy( net_from.ip, &from.sin_addr, sizeof( net_from.ip ) );
+	net_from.port = from.sin_port;
+
+	net_message.cursize = length;
+
+	bot->bytesin += length + UDP_HEADER_SIZE;
+	bot->packetsin++;
+	return true;
+}
+
+void NET_SendPacket( netsrc_t sock, int length, void *data, netadr_t to )
+{
+	struct sockaddr_in	addr;
+
+	if ( !s_pNetBot )
+		return;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	memcpy( &addr.sin_addr, to.ip, sizeof( to.ip ) );
+	addr.sin_port = to.port;
+
+	sendto( s_pNetBot->sock, ( const char * )data, length, 0, ( struct sockaddr * )&addr, sizeof( addr ) );
+
+	s_pNetBot->bytesout += length + UDP_HEADER_SIZE;
+	s_pNetBot->packetsout++;
+}
+
+qboolean NET_CompareAdr( netadr_t a, netadr_t b )
+{
+	return ( a.type == b.type && !memcmp( a.ip, b.ip, sizeof( a.ip ) ) && a.port == b.port ) ? true : false;
+}
+
+const char *NET_AdrToString( netadr_t a )
+{
+	static char s[ 64 ];
+
+	Q_snprintf( s, sizeof( s ), "%i.%i.%i.%i:%i", a.ip[ 0 ], a.ip[ 1 ], a.ip[ 2 ], a.ip[ 3 ], ntohs( a.port ) );
+	return s;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: net_message reading and writing, the same as common.cpp
+//-----------------------------------------------------------------------------
+bf_read *MSG_GetReadBuf( void )
+{
+	return &s_NetMessageRead;
+}
+
+void MSG_BeginReading( void )
+{
+	s_NetMessageRead.StartReading( net_message.data, net_message.cursize );
+}
+
+int MSG_ReadByte( void )
+{
+	return s_NetMessageRead.ReadByte();
+}
+
+int MSG_ReadLong( void )
+{
+	return s_NetMessageRead.ReadLong();
+}
+
+void MSG_WriteLong( sizebuf_t *sb, int c )
+{
+	byte buf[ 4 ];
+
+	buf[ 0 ] = c & 0xff;
+	buf[ 1 ] = ( c >> 8 ) & 0xff;
+	buf[ 2 ] = ( c >> 16 ) & 0xff;
+	buf[ 3 ] = c >> 24;
+
+	SZ_Write( sb, buf, sizeof( buf ) );
+}
+
+void SZ_Clear( sizebuf_t *buf )
+{
+	buf->cursize = 0;
+	buf->overflowed = false;
+}
+
+void SZ_Write( sizebuf_t *buf, const void *data, int length )
+{
+	if ( buf->cursize + length > buf->maxsize )
+	{
+		buf->overflowed = true;
+		return;
+	}
+
+	memcpy( buf->data + buf->cursize, data, length );
+	buf->cursize += length;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Console output from the channel code
+//-----------------------------------------------------------------------------
+void Con_Printf( const char *fmt, ... )
+{
+	va_list argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+void Con_DPrintf( const char *fmt, ... )
+{
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The client retries its connection from here, the bots time out instead
+//-----------------------------------------------------------------------------
+void Cbuf_AddText( char *text )
+{
+}
+
+bool Demo_IsPlayingBack( void )
+{
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bots don't download anything, file stream payloads are thrown away
+//-----------------------------------------------------------------------------
+int COM_OpenFile( const char *filename, FileHandle_t *file )
+{
+	*file = NULL;
+	return -1;
+}
+
+void COM_CloseFile( FileHandle_t hFile )
+{
+}
+
+void COM_WriteFile( char *filename, void *data, int len )
+{
+}
+
+void COM_CreatePath( char *path )
+{
+}
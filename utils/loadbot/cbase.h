@@ -0,0 +1,22 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: UserCmd.cpp is shared with the game DLLs and wants their cbase.h
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef CBASE_H
+#define CBASE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/dbg.h"
+#include "vector.h"
+#include "vstdlib/strtools.h"
+// imovehelper.h, through usercmd.h, only forward declares these
+#include "basehandle.h"
+#include "soundflags.h"
+#include "shareddefs.h"
+
+#endif // CBASE_H
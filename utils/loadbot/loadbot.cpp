@@ -0,0 +1,519 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Load generator for dedicated servers.  Connects a number of headless
+//			bot clients over real UDP, has them play a usercmd script and reports
+//			what the server manages: tick rate, bandwidth per client, and how
+//			long snapshots take to come back.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifdef _WIN32
+#include <winsock.h>
+#else
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#include "loadbot.h"
+#include "in_buttons.h"
+#include "dt_recv_eng.h"
+#include "tier0/platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+unsigned int			g_nBotServerIP = 0;
+unsigned short			g_nBotServerPort = 27015;
+int						g_nBotRate = 10000;
+int						g_nBotUpdateRate = 20;
+int						g_nBotCmdRate = 30;
+const char				*g_pBotName = "loadbot";
+CUtlVector< botscriptcmd_t > g_BotScript;
+
+const char *g_UsageString = "usage:  loadbot -server <address[:port]> [-bots <count>] [-ramp <bots per second>] [-duration <seconds>]\n"
+							"                [-report <seconds>] [-rate <bytes/sec>] [-updaterate <n>] [-cmdrate <n>]\n"
+							"                [-script <file>] [-name <prefix>]\n";
+
+// Snapshot latency histogram, 0.1 msec buckets
+#define LATENCY_BUCKETS			20000
+#define LATENCY_BUCKET_SIZE		0.0001
+
+typedef struct
+{
+	int		buckets[ LATENCY_BUCKETS + 1 ];	// Last one holds everything past the end
+	int		count;
+	double	max;
+} latencyhistogram_t;
+
+static latencyhistogram_t	s_LatencyInterval;
+static latencyhistogram_t	s_LatencyTotal;
+
+// Server ticks seen in svc_time against the wall clock time between them, over all bots
+typedef struct
+{
+	double	ticks;
+	double	time;
+	int		snapshots;
+} tickstats_t;
+
+static tickstats_t	s_TicksInterval;
+static tickstats_t	s_TicksTotal;
+
+static volatile bool s_bQuit = false;
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void LoadBot_RecordLatency( double latency )
+{
+	int bucket = ( int )( latency / LATENCY_BUCKET_SIZE );
+	bucket = clamp( bucket, 0, LATENCY_BUCKETS );
+
+	s_LatencyInterval.buckets[ bucket ]++;
+	s_LatencyInterval.count++;
+	s_LatencyInterval.max = max( s_LatencyInterval.max, latency );
+
+	s_LatencyTotal.buckets[ bucket ]++;
+	s_LatencyTotal.count++;
+	s_LatencyTotal.max = max( s_LatencyTotal.max, latency );
+}
+
+void LoadBot_RecordTick( loadbot_t *bot, int tick, double time )
+{
+	// Only count steady state, not level changes or long stalls
+	if ( bot->lasttick && tick > bot->lasttick && time - bot->lastticktime < 1.0 )
+	{
+		s_TicksInterval.ticks += tick - bot->lasttick;
+		s_TicksInterval.time += time - bot->lastticktime;
+		s_TicksInterval.snapshots++;
+
+		s_TicksTotal.ticks += tick - bot->lasttick;
+		s_TicksTotal.time += time - bot->lastticktime;
+		s_TicksTotal.snapshots++;
+	}
+
+	bot->lasttick = tick;
+	bot->lastticktime = time;
+}
+
+static double LoadBot_Percentile( const latencyhistogram_t *h, float fraction )
+{
+	int i, target, total;
+
+	if ( !h->count )
+		return 0.0;
+
+	target = ( int )( h->count * fraction );
+	total = 0;
+	for ( i = 0; i < LATENCY_BUCKETS; i++ )
+	{
+		total += h->buckets[ i ];
+		if ( total > target )
+			return ( i + 1 ) * LATENCY_BUCKET_SIZE;
+	}
+
+	return h->max;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bandwidth is per bot since it got its first snapshot so the signon
+//			doesn't throw it off.  The rest covers interval seconds.
+//-----------------------------------------------------------------------------
+static void LoadBot_Report( CUtlVector< loadbot_t * > &bots, double time, double interval,
+	const latencyhistogram_t *latency, const tickstats_t *ticks, bool final )
+{
+	static int		lastentities = 0;
+	static int		lastprops = 0;
+	static double	lastdecodetime = 0.0;
+	int				i, active = 0, connecting = 0, dropped = 0, entities = 0, props;
+	double			decodetime = 0.0, inrate, totalin = 0.0, totalout = 0.0, minin = 0.0, maxin = 0.0;
+
+	for ( i = 0; i < bots.Count(); i++ )
+	{
+		loadbot_t *bot = bots[ i ];
+
+		entities += bot->entities;
+		decodetime += bot->decodetime;
+
+		if ( bot->state == BOT_DISCONNECTED )
+		{
+			dropped++;
+			continue;
+		}
+
+		if ( bot->state != BOT_ACTIVE )
+		{
+			connecting++;
+			continue;
+		}
+
+		double activefor = max( time - bot->activetime, 0.001 );
+		inrate = bot->bytesin / activefor;
+
+		if ( !active || inrate < minin )
+			minin = inrate;
+		if ( !active || inrate > maxin )
+			maxin = inrate;
+
+		totalin += inrate;
+		totalout += bot->bytesout / activefor;
+		active++;
+	}
+
+	double tickrate = ( ticks->time > 0.0 ) ? ticks->ticks / ticks->time : 0.0;
+	double tickmsec = ( tickrate > 0.0 ) ? 1000.0 / tickrate : 0.0;
+	double snapmsec = ticks->snapshots ? ticks->time * 1000.0 / ticks->snapshots : 0.0;
+
+	if ( !final )
+	{
+		entities -= lastentities;
+		props = g_nPropsDecoded - lastprops;
+		decodetime -= lastdecodetime;
+
+		lastentities += entities;
+		lastprops += props;
+		lastdecodetime += decodetime;
+	}
+	else
+	{
+		props = g_nPropsDecoded;
+	}
+
+	interval = max( interval, 0.001 );
+
+	printf( "%s%4i bots  %4i active  %4i connecting  %4i dropped\n", final ? "\nTotal:  " : "", bots.Count(), active, connecting, dropped );
+	printf( "  server     %.1f ticks/sec  %.2f msec/tick  snapshot every %.1f msec\n", tickrate, tickmsec, snapmsec );
+	printf( "  bytes/sec  in %.0f avg  %.0f min  %.0f max  out %.0f avg per bot\n",
+		active ? totalin / active : 0.0, minin, maxin, active ? totalout / active : 0.0 );
+	printf( "  latency    %.1f p50  %.1f p90  %.1f p99  %.1f max msec over %i snapshots\n",
+		LoadBot_Percentile( latency, 0.50f ) * 1000.0, LoadBot_Percentile( latency, 0.90f ) * 1000.0,
+		LoadBot_Percentile( latency, 0.99f ) * 1000.0, latency->max * 1000.0, latency->count );
+	printf( "  decoding   %.0f entities/sec  %.0f props/sec  %.3f msec per snapshot\n",
+		entities / interval, props / interval, latency->count ? decodetime * 1000.0 / latency->count : 0.0 );
+	fflush( stdout );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: One usercmd per line: forwardmove sidemove upmove pitch yaw buttons impulse.
+//			yaw is how far to turn each command.  # starts a comment.
+//-----------------------------------------------------------------------------
+static bool LoadBot_LoadScript( const char *filename )
+{
+	char			line[ 256 ];
+	botscriptcmd_t	cmd;
+	FILE			*f;
+	int				linenum = 0;
+
+	f = fopen( filename, "r" );
+	if ( !f )
+	{
+		printf( "Couldn't open %s\n", filename );
+		return false;
+	}
+
+	while ( fgets( line, sizeof( line ), f ) )
+	{
+		linenum++;
+
+		char *comment = strchr( line, '#' );
+		if ( comment )
+		{
+			*comment = 0;
+		}
+
+		char *p = line;
+		while ( *p == ' ' || *p == '\t' )
+		{
+			p++;
+		}
+		if ( !*p || *p == '\r' || *p == '\n' )
+			continue;
+
+		memset( &cmd, 0, sizeof( cmd ) );
+		if ( sscanf( p, "%f %f %f %f %f %i %i", &cmd.forwardmove, &cmd.sidemove, &cmd.upmove,
+			&cmd.pitch, &cmd.yaw, &cmd.buttons, &cmd.impulse ) < 5 )
+		{
+			printf( "%s(%i): expected forwardmove sidemove upmove pitch yaw [buttons] [impulse]\n", filename, linenum );
+			fclose( f );
+			return false;
+		}
+
+		g_BotScript.AddToTail( cmd );
+	}
+
+	fclose( f );
+
+	if ( !g_BotScript.Count() )
+	{
+		printf( "%s has no commands\n", filename );
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Circle strafe, jumping and shooting now and then
+//-----------------------------------------------------------------------------
+static void LoadBot_DefaultScript( void )
+{
+	botscriptcmd_t cmd;
+	int i;
+
+	for ( i = 0; i < 90; i++ )
+	{
+		memset( &cmd, 0, sizeof( cmd ) );
+		cmd.forwardmove	= 200.0f;
+		cmd.sidemove	= ( i < 45 ) ? 150.0f : -150.0f;
+		cmd.pitch		= 10.0f;
+		cmd.yaw			= ( i < 45 ) ? -4.0f : 4.0f;
+
+		if ( i % 30 == 0 )
+		{
+			cmd.buttons |= IN_JUMP;
+		}
+		if ( i % 15 < 3 )
+		{
+			cmd.buttons |= IN_ATTACK;
+		}
+
+		g_BotScript.AddToTail( cmd );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Address and optional port, port defaults to 27015
+//-----------------------------------------------------------------------------
+static bool LoadBot_ResolveServer( const char *address )
+{
+	char	host[ 256 ];
+	char	*colon;
+
+	Q_strncpy( host, address, sizeof( host ) );
+
+	colon = strchr( host, ':' );
+	if ( colon )
+	{
+		*colon = 0;
+		g_nBotServerPort = ( unsigned short )atoi( colon + 1 );
+	}
+
+	g_nBotServerIP = inet_addr( host );
+	if ( g_nBotServerIP == INADDR_NONE )
+	{
+		struct hostent *h = gethostbyname( host );
+		if ( !h )
+			return false;
+
+		g_nBotServerIP = *( unsigned int * )h->h_addr_list[ 0 ];
+	}
+
+	return g_nBotServerPort != 0;
+}
+
+static void LoadBot_Quit( int sig )
+{
+	s_bQuit = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+int main( int argc, char *argv[] )
+{
+	CUtlVector< loadbot_t * > bots;
+	const char	*server = NULL;
+	const char	*script = NULL;
+	int			numbots = 16;
+	float		ramp = 10.0f;
+	float		duration = 60.0f;
+	float		report = 5.0f;
+	int			i;
+
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( !stricmp( argv[ i ], "-server" ) && i + 1 < argc )
+		{
+			server = argv[ ++i ];
+		}
+		else if ( !stricmp( argv[ i ], "-bots" ) && i + 1 < argc )
+		{
+			numbots = clamp( atoi( argv[ ++i ] ), 1, LOADBOT_MAX_BOTS );
+		}
+		else if ( !stricmp( argv[ i ], "-ramp" ) && i + 1 < argc )
+		{
+			ramp = max( ( float )atof( argv[ ++i ] ), 0.1f );
+		}
+		else if ( !stricmp( argv[ i ], "-duration" ) && i + 1 < argc )
+		{
+			duration = ( float )atof( argv[ ++i ] );
+		}
+		else if ( !stricmp( argv[ i ], "-report" ) && i + 1 < argc )
+		{
+			report = max( ( float )atof( argv[ ++i ] ), 1.0f );
+		}
+		else if ( !stricmp( argv[ i ], "-rate" ) && i + 1 < argc )
+		{
+			g_nBotRate = clamp( atoi( argv[ ++i ] ), MIN_RATE, MAX_RATE );
+		}
+		else if ( !stricmp( argv[ i ], "-updaterate" ) && i + 1 < argc )
+		{
+			g_nBotUpdateRate = clamp( atoi( argv[ ++i ] ), 1, 100 );
+		}
+		else if ( !stricmp( argv[ i ], "-cmdrate" ) && i + 1 < argc )
+		{
+			g_nBotCmdRate = clamp( atoi( argv[ ++i ] ), 1, 100 );
+		}
+		else if ( !stricmp( argv[ i ], "-script" ) && i + 1 < argc )
+		{
+			script = argv[ ++i ];
+		}
+		else if ( !stricmp( argv[ i ], "-name" ) && i + 1 < argc )
+		{
+			g_pBotName = argv[ ++i ];
+		}
+		else
+		{
+			printf( g_UsageString );
+			return 1;
+		}
+	}
+
+	if ( !server )
+	{
+		printf( g_UsageString );
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsadata;
+	if ( WSAStartup( MAKEWORD( 1, 1 ), &wsadata ) )
+	{
+		printf( "Couldn't start winsock\n" );
+		return 1;
+	}
+#endif
+
+	if ( !LoadBot_ResolveServer( server ) )
+	{
+		printf( "Couldn't resolve %s\n", server );
+		return 1;
+	}
+
+	if ( script )
+	{
+		if ( !LoadBot_LoadScript( script ) )
+			return 1;
+	}
+	else
+	{
+		LoadBot_DefaultScript();
+	}
+
+	srand( ( unsigned int )time( NULL ) );
+	signal( SIGINT, LoadBot_Quit );
+
+	LoadBot_NetInit();
+
+	printf( "%i bots to %s, rate %i, updaterate %i, cmdrate %i, %i script commands\n",
+		numbots, server, g_nBotRate, g_nBotUpdateRate, g_nBotCmdRate, g_BotScript.Count() );
+
+	double starttime = Plat_FloatTime();
+	double endtime = ( duration > 0.0f ) ? starttime + duration : 0.0;
+	double nextreport = starttime + report;
+	double lastreport = starttime;
+	double now = starttime;
+
+	while ( !s_bQuit && ( !endtime || now < endtime ) )
+	{
+		fd_set		readable;
+		timeval		timeout;
+		int			maxsock = 0;
+
+		now = Plat_FloatTime();
+
+		// Bring the bots in gradually, everyone connecting at once is its own test
+		while ( bots.Count() < numbots && now >= starttime + bots.Count() / ramp )
+		{
+			lbsocket_t sock = LoadBot_OpenSocket();
+#ifndef _WIN32
+			if ( sock >= FD_SETSIZE )
+			{
+				LoadBot_CloseSocket( sock );
+				sock = -1;
+			}
+#endif
+			if ( sock == ( lbsocket_t )-1 )
+			{
+				printf( "Couldn't open a socket for bot %i, stopping at %i bots\n", bots.Count(), bots.Count() );
+				numbots = bots.Count();
+				break;
+			}
+
+			loadbot_t *bot = new loadbot_t;
+			LoadBot_Init( bot, bots.Count(), sock );
+			bots.AddToTail( bot );
+		}
+
+		FD_ZERO( &readable );
+		for ( i = 0; i < bots.Count(); i++ )
+		{
+			LoadBot_Frame( bots[ i ], now );
+
+			if ( bots[ i ]->state != BOT_DISCONNECTED )
+			{
+				FD_SET( bots[ i ]->sock, &readable );
+				maxsock = max( maxsock, ( int )bots[ i ]->sock );
+			}
+		}
+
+		// Don't sleep past the next send by much
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 1000;
+		if ( select( maxsock + 1, &readable, NULL, NULL, &timeout ) > 0 )
+		{
+			now = Plat_FloatTime();
+
+			for ( i = 0; i < bots.Count(); i++ )
+			{
+				if ( bots[ i ]->state != BOT_DISCONNECTED && FD_ISSET( bots[ i ]->sock, &readable ) )
+				{
+					LoadBot_ReadPackets( bots[ i ], now );
+				}
+			}
+		}
+
+		if ( now >= nextreport )
+		{
+			printf( "\n%.0f seconds\n", now - starttime );
+			LoadBot_Report( bots, now, now - lastreport, &s_LatencyInterval, &s_TicksInterval, false );
+
+			memset( &s_LatencyInterval, 0, sizeof( s_LatencyInterval ) );
+			memset( &s_TicksInterval, 0, sizeof( s_TicksInterval ) );
+			lastreport = now;
+			nextreport += report;
+		}
+	}
+
+	LoadBot_Report( bots, now, now - starttime, &s_LatencyTotal, &s_TicksTotal, true );
+
+	for ( i = 0; i < bots.Count(); i++ )
+	{
+		LoadBot_Disconnect( bots[ i ] );
+		LoadBot_Shutdown( bots[ i ] );
+		delete bots[ i ];
+	}
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return 0;
+}
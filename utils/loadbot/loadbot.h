@@ -0,0 +1,175 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Headless bot clients for load testing a dedicated server.  Each bot
+//			is a real UDP connection on the engine's netchan that signs on like
+//			a client, sends usercmds and decodes the snapshots it gets back with
+//			the engine's RecvTable code.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef LOADBOT_H
+#define LOADBOT_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#ifdef _WIN32
+// select() has to take every bot's socket, this has to come before winsock.h
+#define FD_SETSIZE	1024
+#endif
+
+#include "quakedef.h"
+#include "protocol.h"
+#include "net.h"
+#include "cbase.h"
+#include "usercmd.h"
+#include "utlvector.h"
+#include "dt_recv.h"
+#include "networkstringtabledefs.h"
+
+#ifdef _WIN32
+typedef unsigned int	lbsocket_t;
+#else
+typedef int				lbsocket_t;
+#endif
+
+#define LOADBOT_MAX_BOTS			1000
+
+// Send times are kept for this many outgoing packets to measure snapshot latency, must be a power of two
+#define LOADBOT_SEQUENCE_BACKUP		64
+#define LOADBOT_SEQUENCE_MASK		( LOADBOT_SEQUENCE_BACKUP - 1 )
+
+// Usercmds sent along with each new one in case packets get lost, like cl_cmdbackup
+#define LOADBOT_CMD_BACKUP			2
+
+typedef enum
+{
+	BOT_CHALLENGING = 0,	// Sent getchallenge
+	BOT_CONNECTING,			// Sent connect
+	BOT_SERVERINFO,			// Sent "new", waiting for the serverinfo and string tables
+	BOT_PRESPAWN,			// Sent prespawn, spawn follows the server's svc_signonnum messages
+	BOT_SPAWNING,			// Sent begin, waiting for the first snapshot
+	BOT_ACTIVE,				// Getting snapshots
+	BOT_DISCONNECTED,
+} botstate_t;
+
+// Entity baseline, either static from svc_spawnbaseline or per class from the
+//  InstanceBaseline string table
+typedef struct
+{
+	int			classid;
+	byte		*data;
+	int			bytes;
+} botbaseline_t;
+
+typedef struct
+{
+	int			index;
+	lbsocket_t	sock;
+	botstate_t	state;
+	char		key[ 33 ];
+	int			challenge;
+
+	// Resend getchallenge/connect until the server answers
+	double		retrytime;
+	double		nextsend;
+	double		lastreceived;
+
+	// Set up when the server accepts the connect, net_chan.cpp does all the sequencing
+	netchan_t	netchan;
+
+	// Realtime each outgoing packet went out, indexed by sequence
+	double		senttime[ LOADBOT_SEQUENCE_BACKUP ];
+
+	// From the signon
+	int			signon;
+	int			spawncount;
+	int			playernum;
+	int			numclasses;
+	int			classbits;
+	int			numtables;
+	int			tableentrybits[ MAX_TABLES ];
+	int			baselinetable;
+	// Instance baselines by class
+	CUtlVector< botbaseline_t >	baselines;
+	botbaseline_t				staticbaselines[ MAX_EDICTS ];
+
+	// Class of each entity we've seen enter the PVS
+	short		entclass[ MAX_EDICTS ];
+	// Last packet the entities parsed in, deltas are asked for from it
+	int			validsequence;
+
+	// Usercmds, newest at command_number
+	CUserCmd	cmds[ LOADBOT_CMD_BACKUP + 1 ];
+	int			command_number;
+	int			scriptpos;
+	float		yaw;
+
+	// Server tick from svc_time
+	int			lasttick;
+	double		lastticktime;
+
+	// Stats
+	double		activetime;
+	int			bytesin;
+	int			bytesout;
+	int			packetsin;
+	int			packetsout;
+	int			snapshots;
+	int			entities;
+	int			badentities;
+	double		decodetime;
+	int			unparsed;
+} loadbot_t;
+
+// One line of the usercmd script
+typedef struct
+{
+	float		forwardmove;
+	float		sidemove;
+	float		upmove;
+	float		pitch;
+	float		yaw;
+	int			buttons;
+	int			impulse;
+} botscriptcmd_t;
+
+// Options from the command line
+extern unsigned int	g_nBotServerIP;		// Network byte order
+extern unsigned short	g_nBotServerPort;
+extern int			g_nBotRate;
+extern int			g_nBotUpdateRate;
+extern int			g_nBotCmdRate;
+extern const char	*g_pBotName;
+extern CUtlVector< botscriptcmd_t > g_BotScript;
+
+// Stats shared by all the bots
+void		LoadBot_RecordLatency( double latency );
+void		LoadBot_RecordTick( loadbot_t *bot, int tick, double time );
+
+// botclient.cpp
+lbsocket_t	LoadBot_OpenSocket( void );
+void		LoadBot_CloseSocket( lbsocket_t sock );
+void		LoadBot_Init( loadbot_t *bot, int index, lbsocket_t sock );
+void		LoadBot_Shutdown( loadbot_t *bot );
+void		LoadBot_Frame( loadbot_t *bot, double time );
+void		LoadBot_ReadPackets( loadbot_t *bot, double time );
+void		LoadBot_Disconnect( loadbot_t *bot );
+
+// botnet.cpp
+void		LoadBot_NetInit( void );
+void		LoadBot_SetNetBot( loadbot_t *bot, double time );
+bool		LoadBot_GetPacket( loadbot_t *bot );
+void		LoadBot_ServerAdr( netadr_t *adr );
+
+// botdecode.cpp
+bool		LoadBot_TablesReady( void );
+void		LoadBot_BeginTables( void );
+bool		LoadBot_ReadSendTable( bf_read *buf );
+void		LoadBot_SetClassTable( int classid, const char *tablename );
+bool		LoadBot_BuildDecoders( void );
+RecvTable	*LoadBot_GetClassTable( int classid );
+bool		LoadBot_DecodeEntity( RecvTable *table, int entnum, const botbaseline_t *baseline, bf_read *buf, int nbits );
+
+#endif // LOADBOT_H
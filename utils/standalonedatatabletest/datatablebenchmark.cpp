@@ -0,0 +1,390 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Times SendTable_Encode and RecvTable_Decode on an entity-like table,
+//			once through the proxies and g_PropTypeFns and once with the prop
+//			codecs, and checks that both produce the same bits and the same
+//			decoded data.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "stdafx.h"
+#include "quakedef.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+#include "mathlib.h"
+#include "dt.h"
+#include "dt_send.h"
+#include "dt_recv.h"
+#include "convar.h"
+#include "tier0/platform.h"
+#include "datatablebenchmark.h"
+
+
+extern ConVar g_CV_DTPropCodecs;
+
+
+#define BENCH_NUM_OBJECTS	256
+#define BENCH_BUFFER_SIZE	1024
+
+
+// ------------------------------------------------------------------------------------------- //
+// Server structures and tables. These are laid out like a typical entity: mostly stock proxies,
+// a few custom ones, coords, angles, quantized floats, a string, an array, and a child table.
+// ------------------------------------------------------------------------------------------- //
+
+class DTBenchServerSub
+{
+public:
+	int				m_nSubInt;
+	float			m_flSubFloat;
+};
+
+BEGIN_SEND_TABLE_NOBASE( DTBenchServerSub, DT_DTBenchSub )
+	SendPropInt( SENDINFO_NOCHECK( m_nSubInt ), 12 ),
+	SendPropFloat( SENDINFO_NOCHECK( m_flSubFloat ), 10, 0, 0.0f, 1.0f ),
+END_SEND_TABLE()
+
+
+class DTBenchServer
+{
+public:
+	DTBenchServerSub	m_Sub;
+
+	Vector			m_vecOrigin;
+	QAngle			m_angRotation;
+	Vector			m_vecVelocity;
+	Vector			m_vecNormal;
+	float			m_flSimulationTime;
+	float			m_flCycle;
+	float			m_flYaw;
+	float			m_flCustom;
+	short			m_nModelIndex;
+	unsigned char	m_nRenderMode;
+	char			m_iTeamNum;
+	int				m_fFlags;
+	int				m_iHealth;
+	unsigned short	m_nSequence;
+	char			m_szName[32];
+	int				m_iAmmo[8];
+};
+
+void SendProxy_DTBenchCustomFloat( const void *pStruct, const void *pData, DVariant *pOut, int iElement, int objectID )
+{
+	pOut->m_Float = *((float*)pData) * 0.5f;
+}
+
+BEGIN_SEND_TABLE_NOBASE( DTBenchServer, DT_DTBench )
+	SendPropDataTable( SENDINFO_DT( m_Sub ), &REFERENCE_SEND_TABLE( DT_DTBenchSub ) ),
+
+	SendPropVector( SENDINFO_NOCHECK( m_vecOrigin ), -1, SPROP_COORD ),
+	SendPropQAngles( SENDINFO_NOCHECK( m_angRotation ), 13 ),
+	SendPropVector( SENDINFO_NOCHECK( m_vecVelocity ), 16, 0, -2048.0f, 2048.0f ),
+	SendPropVector( SENDINFO_NOCHECK( m_vecNormal ), 0, SPROP_NORMAL ),
+	SendPropFloat( SENDINFO_NOCHECK( m_flSimulationTime ), -1, SPROP_NOSCALE ),
+	SendPropFloat( SENDINFO_NOCHECK( m_flCycle ), 8, SPROP_ROUNDDOWN, 0.0f, 1.0f ),
+	SendPropAngle( SENDINFO_NOCHECK( m_flYaw ), 11 ),
+	SendPropFloat( SENDINFO_NOCHECK( m_flCustom ), 16, 0, 0.0f, 512.0f, SendProxy_DTBenchCustomFloat ),
+	SendPropInt( SENDINFO_NOCHECK( m_nModelIndex ), 11 ),
+	SendPropInt( SENDINFO_NOCHECK( m_nRenderMode ), 8, SPROP_UNSIGNED ),
+	SendPropInt( SENDINFO_NOCHECK( m_iTeamNum ), 6 ),
+	SendPropInt( SENDINFO_NOCHECK( m_fFlags ), 32 ),
+	SendPropInt( SENDINFO_NOCHECK( m_iHealth ), 10 ),
+	SendPropInt( SENDINFO_NOCHECK( m_nSequence ), 9, SPROP_UNSIGNED ),
+	SendPropString( SENDINFO_NOCHECK( m_szName ) ),
+
+	SendPropArray(
+		SendPropInt( SENDINFO_NOCHECK( m_iAmmo[0] ), 10, SPROP_UNSIGNED ),
+		m_iAmmo ),
+END_SEND_TABLE()
+
+
+// ------------------------------------------------------------------------------------------- //
+// Client structures and tables.
+// ------------------------------------------------------------------------------------------- //
+
+class DTBenchClientSub
+{
+public:
+	int				m_nSubInt;
+	float			m_flSubFloat;
+};
+
+BEGIN_RECV_TABLE_NOBASE( DTBenchClientSub, DT_DTBenchSub )
+	RecvPropInt( RECVINFO( m_nSubInt ) ),
+	RecvPropFloat( RECVINFO( m_flSubFloat ) ),
+END_RECV_TABLE()
+
+
+class DTBenchClient
+{
+public:
+	DTBenchClientSub	m_Sub;
+
+	Vector			m_vecOrigin;
+	QAngle			m_angRotation;
+	Vector			m_vecVelocity;
+	Vector			m_vecNormal;
+	float			m_flSimulationTime;
+	float			m_flCycle;
+	float			m_flYaw;
+	float			m_flCustom;
+	short			m_nModelIndex;
+	unsigned char	m_nRenderMode;
+	char			m_iTeamNum;
+	int				m_fFlags;
+	int				m_iHealth;
+	unsigned short	m_nSequence;
+	char			m_szName[32];
+	int				m_iAmmo[8];
+};
+
+void RecvProxy_DTBenchCustomFloat( const CRecvProxyData *pData, void *pStruct, void *pOut )
+{
+	*((float*)pOut) = pData->m_Value.m_Float * 2.0f;
+}
+
+BEGIN_RECV_TABLE_NOBASE( DTBenchClient, DT_DTBench )
+	RecvPropDataTable( RECVINFO_DT( m_Sub ), 0, &REFERENCE_RECV_TABLE( DT_DTBenchSub ) ),
+
+	RecvPropVector( RECVINFO( m_vecOrigin ) ),
+	RecvPropQAngles( RECVINFO( m_angRotation ) ),
+	RecvPropVector( RECVINFO( m_vecVelocity ) ),
+	RecvPropVector( RECVINFO( m_vecNormal ) ),
+	RecvPropFloat( RECVINFO( m_flSimulationTime ) ),
+	RecvPropFloat( RECVINFO( m_flCycle ) ),
+	RecvPropFloat( RECVINFO( m_flYaw ) ),
+	RecvPropFloat( RECVINFO( m_flCustom ), 0, RecvProxy_DTBenchCustomFloat ),
+	RecvPropInt( RECVINFO( m_nModelIndex ) ),
+	RecvPropInt( RECVINFO( m_nRenderMode ) ),
+	RecvPropInt( RECVINFO( m_iTeamNum ) ),
+	RecvPropInt( RECVINFO( m_fFlags ) ),
+	RecvPropInt( RECVINFO( m_iHealth ) ),
+	RecvPropInt( RECVINFO( m_nSequence ) ),
+	RecvPropString( RECVINFO_STRING( m_szName ) ),
+
+	RecvPropArray(
+		RecvPropInt( RECVINFO( m_iAmmo[0] ) ),
+		m_iAmmo ),
+END_RECV_TABLE()
+
+
+// ------------------------------------------------------------------------------------------- //
+// Helpers.
+// ------------------------------------------------------------------------------------------- //
+
+static float Bench_RandomFloat( float minVal, float maxVal )
+{
+	return minVal + ( (float)rand() / RAND_MAX ) * ( maxVal - minVal );
+}
+
+static void Bench_RandomizeServer( DTBenchServer *pServer )
+{
+	pServer->m_Sub.m_nSubInt = rand() & 0x7FF;
+	pServer->m_Sub.m_flSubFloat = Bench_RandomFloat( 0, 1 );
+
+	pServer->m_vecOrigin.Init( Bench_RandomFloat( -4096, 4096 ), Bench_RandomFloat( -4096, 4096 ), Bench_RandomFloat( -4096, 4096 ) );
+	pServer->m_angRotation.Init( Bench_RandomFloat( -180, 360 ), Bench_RandomFloat( -180, 360 ), Bench_RandomFloat( -180, 360 ) );
+	pServer->m_vecVelocity.Init( Bench_RandomFloat( -2048, 2048 ), Bench_RandomFloat( -2048, 2048 ), Bench_RandomFloat( -2048, 2048 ) );
+
+	pServer->m_vecNormal.Init( Bench_RandomFloat( -1, 1 ), Bench_RandomFloat( -1, 1 ), Bench_RandomFloat( -1, 1 ) );
+	VectorNormalize( pServer->m_vecNormal );
+
+	pServer->m_flSimulationTime = Bench_RandomFloat( 0, 10000 );
+	pServer->m_flCycle = Bench_RandomFloat( 0, 1 );
+	pServer->m_flYaw = Bench_RandomFloat( 0, 360 );
+	pServer->m_flCustom = Bench_RandomFloat( 0, 1024 );
+	pServer->m_nModelIndex = (short)( rand() & 0x3FF );
+	pServer->m_nRenderMode = (unsigned char)rand();
+	pServer->m_iTeamNum = (char)( rand() & 0x1F );
+	pServer->m_fFlags = rand() | ( rand() << 16 );
+	pServer->m_iHealth = ( rand() % 1000 ) - 500;
+	pServer->m_nSequence = (unsigned short)( rand() & 0x1FF );
+
+	int nameLen = rand() % ( sizeof( pServer->m_szName ) - 1 );
+	for ( int i=0; i < nameLen; i++ )
+		pServer->m_szName[i] = 'a' + ( rand() % 26 );
+	pServer->m_szName[nameLen] = 0;
+
+	for ( int iAmmo=0; iAmmo < ARRAYSIZE( pServer->m_iAmmo ); iAmmo++ )
+		pServer->m_iAmmo[iAmmo] = rand() & 0x3FF;
+}
+
+
+static int g_BenchSendTableSpawnCount = 1000;
+
+static bool Bench_WriteSendTable_R( SendTable *pTable, bf_write &bfWrite, bool bNeedsDecoder )
+{
+	if( pTable->GetWriteSpawnCount() == g_BenchSendTableSpawnCount )
+		return true;
+
+	pTable->SetWriteSpawnCount( g_BenchSendTableSpawnCount );
+
+	bfWrite.WriteOneBit( 1 );
+	bfWrite.WriteOneBit( bNeedsDecoder );
+
+	if( !SendTable_SendInfo( pTable, &bfWrite ) )
+		return false;
+
+	for( int i=0; i < pTable->m_nProps; i++ )
+	{
+		SendProp *pProp = &pTable->m_pProps[i];
+
+		if( pProp->m_Type == DPT_DataTable )
+			if( !Bench_WriteSendTable_R( pProp->GetDataTable(), bfWrite, false ) )
+				return false;
+	}
+
+	return true;
+}
+
+
+// The results of one pass over all the objects.
+class CBenchPass
+{
+public:
+	unsigned char	m_Encoded[BENCH_NUM_OBJECTS][BENCH_BUFFER_SIZE];
+	int				m_nEncodedBits[BENCH_NUM_OBJECTS];
+	DTBenchClient	m_Decoded[BENCH_NUM_OBJECTS];
+
+	double			m_flEncodeTime;
+	double			m_flDecodeTime;
+};
+
+
+static void Bench_RunPass(
+	bool bUseCodecs,
+	int nIterations,
+	SendTable *pSendTable,
+	RecvTable *pRecvTable,
+	DTBenchServer *pServers,
+	CBenchPass *pPass )
+{
+	g_CV_DTPropCodecs.SetValue( bUseCodecs ? 1 : 0 );
+
+	memset( pPass->m_Decoded, 0, sizeof( pPass->m_Decoded ) );
+
+	// Encode.
+	double flStart = Plat_FloatTime();
+	for ( int iIteration=0; iIteration < nIterations; iIteration++ )
+	{
+		for ( int iObject=0; iObject < BENCH_NUM_OBJECTS; iObject++ )
+		{
+			bf_write bfEncoded( "Bench_RunPass->bfEncoded", pPass->m_Encoded[iObject], BENCH_BUFFER_SIZE );
+			if ( !SendTable_Encode( pSendTable, &pServers[iObject], &bfEncoded, NULL, iObject, NULL ) )
+				Error( "Bench_RunPass: SendTable_Encode overflowed." );
+
+			pPass->m_nEncodedBits[iObject] = bfEncoded.GetNumBitsWritten();
+		}
+	}
+	pPass->m_flEncodeTime = Plat_FloatTime() - flStart;
+
+	// Decode.
+	flStart = Plat_FloatTime();
+	for ( int iIteration=0; iIteration < nIterations; iIteration++ )
+	{
+		for ( int iObject=0; iObject < BENCH_NUM_OBJECTS; iObject++ )
+		{
+			bf_read bfDecode( "Bench_RunPass->bfDecode", pPass->m_Encoded[iObject], BENCH_BUFFER_SIZE, pPass->m_nEncodedBits[iObject] );
+			if ( !RecvTable_Decode( pRecvTable, &pPass->m_Decoded[iObject], &bfDecode, iObject ) )
+				Error( "Bench_RunPass: RecvTable_Decode overflowed." );
+		}
+	}
+	pPass->m_flDecodeTime = Plat_FloatTime() - flStart;
+}
+
+
+// Returns the number of objects whose encoded bits or decoded data differ between the passes.
+static int Bench_ComparePasses( const CBenchPass *pA, const CBenchPass *pB )
+{
+	int nMismatches = 0;
+	for ( int iObject=0; iObject < BENCH_NUM_OBJECTS; iObject++ )
+	{
+		bool bSame =
+			pA->m_nEncodedBits[iObject] == pB->m_nEncodedBits[iObject] &&
+			CompareBitArrays( pA->m_Encoded[iObject], pB->m_Encoded[iObject], pA->m_nEncodedBits[iObject], pB->m_nEncodedBits[iObject] ) &&
+			memcmp( &pA->m_Decoded[iObject], &pB->m_Decoded[iObject], sizeof( pA->m_Decoded[iObject] ) ) == 0;
+
+		if ( !bSame )
+		{
+			printf( "  object %d: mismatch (%d bits vs %d bits)\n", iObject, pA->m_nEncodedBits[iObject], pB->m_nEncodedBits[iObject] );
+			++nMismatches;
+		}
+	}
+
+	return nMismatches;
+}
+
+
+// ------------------------------------------------------------------------------------------- //
+// Entry point.
+// ------------------------------------------------------------------------------------------- //
+
+bool RunDataTableBenchmark( int nIterations )
+{
+	RecvTable *pRecvTable = &REFERENCE_RECV_TABLE( DT_DTBench );
+	SendTable *pSendTable = &REFERENCE_SEND_TABLE( DT_DTBench );
+
+	SendTable_Init( &pSendTable, 1 );
+	RecvTable_Init( &pRecvTable, 1 );
+
+	// Send the table info to the "client" and build the decoders.
+	++g_BenchSendTableSpawnCount;
+
+	unsigned char commBuf[8192];
+	bf_write bfWrite( "RunDataTableBenchmark->commBuf", commBuf, sizeof( commBuf ) );
+	if ( !Bench_WriteSendTable_R( pSendTable, bfWrite, true ) )
+		Error( "RunDataTableBenchmark: SendTable_SendInfo failed." );
+	bfWrite.WriteOneBit( 0 );
+
+	bf_read bfRead( "RunDataTableBenchmark->bfRead", commBuf, sizeof( commBuf ) );
+	while ( bfRead.ReadOneBit() )
+	{
+		if ( !RecvTable_RecvInfo( &bfRead, bfRead.ReadOneBit() != 0 ) )
+			Error( "RunDataTableBenchmark: RecvTable_RecvInfo failed." );
+	}
+
+	if ( !RecvTable_CreateDecoders() )
+		Error( "RunDataTableBenchmark: RecvTable_CreateDecoders failed." );
+
+	// Make up some objects.
+	DTBenchServer *pServers = new DTBenchServer[BENCH_NUM_OBJECTS];
+	memset( pServers, 0, sizeof( DTBenchServer ) * BENCH_NUM_OBJECTS );
+	for ( int iObject=0; iObject < BENCH_NUM_OBJECTS; iObject++ )
+		Bench_RandomizeServer( &pServers[iObject] );
+
+	CBenchPass *pGeneric = new CBenchPass;
+	CBenchPass *pCodecs = new CBenchPass;
+
+	// Warm up the caches, then time each path.
+	Bench_RunPass( false, 1, pSendTable, pRecvTable, pServers, pGeneric );
+	Bench_RunPass( false, nIterations, pSendTable, pRecvTable, pServers, pGeneric );
+	Bench_RunPass( true, 1, pSendTable, pRecvTable, pServers, pCodecs );
+	Bench_RunPass( true, nIterations, pSendTable, pRecvTable, pServers, pCodecs );
+
+	int nMismatches = Bench_ComparePasses( pGeneric, pCodecs );
+
+	double nObjects = (double)nIterations * BENCH_NUM_OBJECTS;
+	printf( "Datatable benchmark: %d props, %d objects x %d iterations\n",
+		SendTable_GetNumFlatProps( pSendTable ), BENCH_NUM_OBJECTS, nIterations );
+	printf( "               encode (us/obj)   decode (us/obj)\n" );
+	printf( "  generic      %14.3f   %14.3f\n", pGeneric->m_flEncodeTime * 1000000.0 / nObjects, pGeneric->m_flDecodeTime * 1000000.0 / nObjects );
+	printf( "  codecs       %14.3f   %14.3f\n", pCodecs->m_flEncodeTime * 1000000.0 / nObjects, pCodecs->m_flDecodeTime * 1000000.0 / nObjects );
+	printf( "  speedup      %13.2fx   %13.2fx\n",
+		pGeneric->m_flEncodeTime / max( pCodecs->m_flEncodeTime, 0.000001 ),
+		pGeneric->m_flDecodeTime / max( pCodecs->m_flDecodeTime, 0.000001 ) );
+	printf( "  %s\n", nMismatches ? "MISMATCH: the codecs don't match the generic path!" : "Encoded bits and decoded data match." );
+
+	delete pGeneric;
+	delete pCodecs;
+	delete [] pServers;
+
+	g_CV_DTPropCodecs.SetValue( 1 );
+
+	SendTable_Term();
+	RecvTable_Term();
+
+	return nMismatches == 0;
+}
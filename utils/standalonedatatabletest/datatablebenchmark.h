@@ -0,0 +1,20 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef DATATABLEBENCHMARK_H
+#define DATATABLEBENCHMARK_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+// Times encoding and decoding a test table with and without the prop codecs (see CPropCodec) 
+// and verifies that they produce the same results. Returns false if they don't.
+bool RunDataTableBenchmark( int nIterations );
+
+
+#endif // DATATABLEBENCHMARK_H
@@ -4,10 +4,12 @@
 #include "stdafx.h"
 #include "quakedef.h"
 #include <stdarg.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include "vector.h"
-#include "datatable_test.h"
+#include "dt_test.h"
+#include "datatablebenchmark.h"
 
 
 float vec3_origin[3] = {0,0,0};
@@ -41,8 +43,19 @@ int main(int argc, char* argv[])
 			srandNum = time(0);
 			srand(srandNum);
 		}
+		else if(stricmp(argv[1], "-benchmark") == 0)
+		{
+			// Time the generic encode/decode path against the prop codecs.
+			int nIterations = 1000;
+			if(argc > 2)
+				nIterations = atoi(argv[2]);
+
+			return RunDataTableBenchmark(nIterations) ? 0 : 1;
+		}
 	}
 
+#ifdef _DEBUG
 	RunDataTableTest();
+#endif
 	return 0;
 }
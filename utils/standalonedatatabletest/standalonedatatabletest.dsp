@@ -89,7 +89,7 @@ LINK32=link.exe
 # PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
 # Begin Source File
 
-SOURCE=..\..\engine\bitbuf.cpp
+SOURCE=..\..\Public\bitbuf.cpp
 # End Source File
 # Begin Source File
 
@@ -97,19 +97,55 @@ SOURCE=..\..\Public\convar.cpp
 # End Source File
 # Begin Source File
 
-SOURCE=..\..\engine\datatable.cpp
+SOURCE=.\datatablebenchmark.cpp
 # End Source File
 # Begin Source File
 
-SOURCE=..\..\Public\datatable_recv.cpp
+SOURCE=..\..\engine\dt.cpp
 # End Source File
 # Begin Source File
 
-SOURCE=..\..\Public\datatable_send.cpp
+SOURCE=..\..\engine\dt_common_eng.cpp
 # End Source File
 # Begin Source File
 
-SOURCE=..\..\engine\datatable_test.cpp
+SOURCE=..\..\engine\dt_encode.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_instrumentation.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_instrumentation_server.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_recv_decoder.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_recv_eng.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\Public\dt_recv.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_send_eng.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\Public\dt_send.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_stack.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\engine\dt_test.cpp
 # End Source File
 # Begin Source File
 
@@ -133,6 +169,10 @@ SOURCE=..\..\common\vstring.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=.\datatablebenchmark.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\StdAfx.h
 # End Source File
 # End Group
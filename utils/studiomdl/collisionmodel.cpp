@@ -33,6 +33,7 @@
 #include "studiomdl.h"
 #include "physdll.h"
 #include "phyfile.h"
+#include "checksum_crc.h"
 #include "utlvector.h"
 #include "vcollide_parse.h"
 #include "vstdlib/strtools.h"
@@ -2185,7 +2186,8 @@ void WriteCollisionModel( long checkSum )
 		if ( fp )
 		{
 			// write out the collision header (size is version)
-			phyheader_t header;
+			phymappedheader_t header;
+			memset( &header, 0, sizeof(header) );
 			header.size = sizeof(header);
 			header.id = 0;
 			header.checkSum = checkSum;
@@ -2198,22 +2200,43 @@ void WriteCollisionModel( long checkSum )
 				pPhys = pPhys->m_pNext;
 			}
 
+			// the header and solid table get written again once the offsets are known
+			CUtlVector<phymappedsolid_t> solids;
+			solids.AddMultipleToTail( header.solidCount );
+			memset( solids.Base(), 0, header.solidCount * sizeof(phymappedsolid_t) );
 			fwrite( &header, sizeof(header), 1, fp );
+			fwrite( solids.Base(), sizeof(phymappedsolid_t), header.solidCount, fp );
 
-			// Write out the binary physics collision data
+			// Write out the binary physics collision data, aligned so the engine can use it in place
+			int solidIndex = 0;
 			pPhys = g_JointedModel.m_pCollisionList;
 			while ( pPhys )
 			{
 				int size = physcollision->CollideSize( pPhys->m_pCollisionData );
-				fwrite( &size, sizeof(int), 1, fp );
 				char *buf = (char *)stackalloc( size );
 				physcollision->CollideWrite( buf, pPhys->m_pCollisionData );
+
+				while ( ftell( fp ) % PHY_MAPPED_ALIGN )
+				{
+					fputc( 0, fp );
+				}
+
+				CRC32_t crc;
+				CRC32_Init( &crc );
+				CRC32_ProcessBuffer( &crc, buf, size );
+				CRC32_Final( &crc );
+
+				solids[solidIndex].offset = ftell( fp );
+				solids[solidIndex].size = size;
+				solids[solidIndex].crc = (unsigned int)crc;
 				fwrite( buf, size, 1, fp );
 				pPhys = pPhys->m_pNext;
+				solidIndex++;
 			}
+			header.keyDataOffset = ftell( fp );
 
 			// write out the properties of each solid
-			int solidIndex = 0;
+			solidIndex = 0;
 			pPhys = g_JointedModel.m_pCollisionList;
 			while ( pPhys )
 			{
@@ -2340,6 +2363,11 @@ void WriteCollisionModel( long checkSum )
 				fwrite( g_JointedModel.m_textCommands.Base(), g_JointedModel.m_textCommands.Size(), 1, fp );
 			}
 			fwrite( &terminator, sizeof(terminator), 1, fp );
+
+			header.keyDataSize = ftell( fp ) - header.keyDataOffset;
+			fseek( fp, 0, SEEK_SET );
+			fwrite( &header, sizeof(header), 1, fp );
+			fwrite( solids.Base(), sizeof(phymappedsolid_t), header.solidCount, fp );
 			fclose( fp );
 		}
 		else
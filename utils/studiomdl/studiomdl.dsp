@@ -124,6 +124,10 @@ SOURCE=..\..\public\characterset.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\public\checksum_crc.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\common\cmdlib.cpp
 # End Source File
 # Begin Source File
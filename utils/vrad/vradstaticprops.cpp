@@ -400,7 +400,7 @@ bool LoadStudioCollisionModel( char const* pModelName, CUtlBuffer& buf )
 
 	phyheader_t *header = (phyheader_t *)buf.PeekGet();
 
-	if ( header->size != sizeof(*header) || header->solidCount <= 0 )
+	if ( ( header->size != sizeof(phyheader_t) && header->size != sizeof(phymappedheader_t) ) || header->solidCount <= 0 )
 		return false;
 
 	return true;
@@ -583,13 +583,10 @@ void CVradStaticPropMgr::CreateCollisionModel( char const* pModelName )
 	VectorCopy( pHdr->hull_min, m_StaticPropDict[i].m_Mins );
 	VectorCopy( pHdr->hull_max, m_StaticPropDict[i].m_Maxs );
 
-	if ( LoadStudioCollisionModel( pModelName, bufphy ) )
+	vcollide_t *pCollide = &m_StaticPropDict[i].m_loadedModel;
+	if ( LoadStudioCollisionModel( pModelName, bufphy ) &&
+		s_pPhysCollision->VCollideLoadFile( pCollide, bufphy.PeekGet(), bufphy.TellPut() - bufphy.TellGet(), NULL, NULL ) )
 	{
-		phyheader_t header;
-		bufphy.Get( &header, sizeof(header) );
-
-		vcollide_t *pCollide = &m_StaticPropDict[i].m_loadedModel;
-		s_pPhysCollision->VCollideLoad( pCollide, header.solidCount, (const char *)bufphy.PeekGet(), bufphy.TellPut() - bufphy.TellGet() );
 		m_StaticPropDict[i].m_pModel = m_StaticPropDict[i].m_loadedModel.solids[0];
 
 		/*
@@ -19,6 +19,9 @@
 #include "vector.h"
 #include "cmodel.h"
 #include "utlvector.h"
+#include "utlrbtree.h"
+#include "checksum_crc.h"
+#include "phyfile.h"
 #include "physics_trace.h"
 #include "vcollide_parse_private.h"
 #include "vphysics_internal.h"
@@ -68,6 +71,8 @@ public:
 	virtual void			VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int size );
 	// destroyts the set of solids created by VCollideLoad
 	virtual void			VCollideUnload( vcollide_t *pVCollide );
+	virtual bool			VCollideLoadFile( vcollide_t *pOutput, const void *pFile, int fileSize, VCollideReleaseFn_t pfnRelease, void *pContext );
+	virtual void			VCollideGetStats( vcollidestats_t *pStats );
 
 	// Trace an AABB against a collide
 	void TraceBox( const Vector &start, const Vector &end, const Vector &mins, const Vector &maxs, const CPhysCollide *pCollide, const Vector &collideOrigin, const QAngle &collideAngles, trace_t *ptr );
@@ -802,6 +807,204 @@ float CPhysicsCollision::CollideSurfaceArea( CPhysCollide *pCollide )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Solids loaded from .phy data, kept by content so every model with an
+//			identical collision model uses the same one.  Solids from a file passed
+//			to VCollideLoadFile with a release function point into the file, it's
+//			released when none of them are in use anymore.
+//-----------------------------------------------------------------------------
+struct vcollidefile_t
+{
+	const void			*pData;
+	VCollideReleaseFn_t	pfnRelease;
+	void				*pContext;
+	int					refCount;	// solids that point into the file
+};
+
+struct vcollidesolid_t
+{
+	CPhysCollide		*pCollide;
+	int					size;
+	unsigned int		crc;
+	int					refCount;
+	vcollidefile_t		*pFile;		// NULL if the solid was copied to the heap
+};
+
+class CVCollideCache
+{
+public:
+	CVCollideCache();
+
+	// Returns the solid matching this data.  If there isn't one yet it's used in place
+	// from pFile, or copied if pFile is NULL.
+	CPhysCollide	*AddSolid( const char *pData, int size, unsigned int crc, vcollidefile_t *pFile );
+	void			ReleaseSolid( CPhysCollide *pCollide );
+	void			GetStats( vcollidestats_t *pStats );
+
+private:
+	static bool		ContentLessFunc( vcollidesolid_t * const &lhs, vcollidesolid_t * const &rhs );
+	static bool		PointerLessFunc( vcollidesolid_t * const &lhs, vcollidesolid_t * const &rhs );
+
+	CUtlRBTree<vcollidesolid_t *, int>	m_byContent;
+	CUtlRBTree<vcollidesolid_t *, int>	m_byPointer;
+	int									m_fileCount;
+};
+
+static CVCollideCache g_VCollideCache;
+
+static unsigned int SolidCRC( const char *pData, int size )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, (void *)pData, size );
+	CRC32_Final( &crc );
+	return (unsigned int)crc;
+}
+
+CVCollideCache::CVCollideCache() : m_byContent( 0, 0, ContentLessFunc ), m_byPointer( 0, 0, PointerLessFunc )
+{
+	m_fileCount = 0;
+}
+
+bool CVCollideCache::ContentLessFunc( vcollidesolid_t * const &lhs, vcollidesolid_t * const &rhs )
+{
+	if ( lhs->crc != rhs->crc )
+		return lhs->crc < rhs->crc;
+	if ( lhs->size != rhs->size )
+		return lhs->size < rhs->size;
+	return memcmp( lhs->pCollide, rhs->pCollide, lhs->size ) < 0;
+}
+
+bool CVCollideCache::PointerLessFunc( vcollidesolid_t * const &lhs, vcollidesolid_t * const &rhs )
+{
+	return lhs->pCollide < rhs->pCollide;
+}
+
+CPhysCollide *CVCollideCache::AddSolid( const char *pData, int size, unsigned int crc, vcollidefile_t *pFile )
+{
+	vcollidesolid_t test;
+	test.pCollide = (CPhysCollide *)pData;
+	test.size = size;
+	test.crc = crc;
+	vcollidesolid_t *pTest = &test;
+
+	int index = m_byContent.Find( pTest );
+	if ( m_byContent.IsValidIndex( index ) )
+	{
+		vcollidesolid_t *pSolid = m_byContent[index];
+		pSolid->refCount++;
+		return pSolid->pCollide;
+	}
+
+	vcollidesolid_t *pSolid = new vcollidesolid_t;
+	pSolid->size = size;
+	pSolid->crc = crc;
+	pSolid->refCount = 1;
+	pSolid->pFile = pFile;
+	if ( pFile )
+	{
+		pSolid->pCollide = (CPhysCollide *)pData;
+		if ( !pFile->refCount )
+		{
+			m_fileCount++;
+		}
+		pFile->refCount++;
+	}
+	else
+	{
+		BEGIN_IVP_ALLOCATION();
+		pSolid->pCollide = (CPhysCollide *)ivp_malloc_aligned( size, 32 );
+		END_IVP_ALLOCATION();
+		memcpy( pSolid->pCollide, pData, size );
+	}
+
+	m_byContent.Insert( pSolid );
+	m_byPointer.Insert( pSolid );
+	return pSolid->pCollide;
+}
+
+void CVCollideCache::ReleaseSolid( CPhysCollide *pCollide )
+{
+	vcollidesolid_t test;
+	test.pCollide = pCollide;
+	vcollidesolid_t *pTest = &test;
+
+	int index = m_byPointer.Find( pTest );
+	if ( !m_byPointer.IsValidIndex( index ) )
+	{
+		Assert( 0 );
+		return;
+	}
+
+	vcollidesolid_t *pSolid = m_byPointer[index];
+	pSolid->refCount--;
+	if ( pSolid->refCount > 0 )
+		return;
+
+#if _DEBUG
+	// HACKHACK: 1024 is just "some big number"
+	// GetActiveEnvironmentByIndex() will eventually return NULL when there are no more environments.
+	// In HL2 & TF2, there are only 2 environments - so j > 1 is probably an error!
+	for ( int j = 0; j < 1024; j++ )
+	{
+		IPhysicsEnvironment *pEnv = g_PhysicsInternal->GetActiveEnvironmentByIndex( j );
+		if ( !pEnv )
+			break;
+
+		if ( pEnv->IsCollisionModelUsed( pCollide ) )
+		{
+		//	AssertMsg(0, "Freed collision model while in use!!!\n");
+			Warning( "Freed collision model while in use!!!\n" );
+			// leak it rather than crash
+			pSolid->refCount = 1;
+			return;
+		}
+	}
+#endif
+
+	m_byPointer.RemoveAt( index );
+	m_byContent.RemoveAt( m_byContent.Find( pSolid ) );
+
+	vcollidefile_t *pFile = pSolid->pFile;
+	if ( pFile )
+	{
+		pFile->refCount--;
+		if ( !pFile->refCount )
+		{
+			m_fileCount--;
+			pFile->pfnRelease( pFile->pData, pFile->pContext );
+			delete pFile;
+		}
+	}
+	else
+	{
+		ivp_free_aligned( pSolid->pCollide );
+	}
+	delete pSolid;
+}
+
+void CVCollideCache::GetStats( vcollidestats_t *pStats )
+{
+	memset( pStats, 0, sizeof(*pStats) );
+	for ( int i = m_byPointer.FirstInorder(); i != m_byPointer.InvalidIndex(); i = m_byPointer.NextInorder( i ) )
+	{
+		vcollidesolid_t *pSolid = m_byPointer[i];
+		pStats->solidCount++;
+		pStats->solidBytes += pSolid->size;
+		if ( pSolid->pFile )
+		{
+			pStats->mappedBytes += pSolid->size;
+		}
+		else
+		{
+			pStats->copiedBytes += pSolid->size;
+		}
+		pStats->sharedCount += pSolid->refCount - 1;
+		pStats->sharedBytes += (pSolid->refCount - 1) * pSolid->size;
+	}
+	pStats->fileCount = m_fileCount;
+}
+
 // loads a set of solids into a vcollide_t
 void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const char *pBuffer, int bufferSize )
 {
@@ -811,57 +1014,133 @@ void CPhysicsCollision::VCollideLoad( vcollide_t *pOutput, int solidCount, const
 	pOutput->solidCount = solidCount;
 	pOutput->solids = new CPhysCollide *[solidCount];
 
-	BEGIN_IVP_ALLOCATION();
-
 	for ( int i = 0; i < solidCount; i++ )
 	{
 		int size;
 		memcpy( &size, pBuffer + position, sizeof(int) );
 		position += sizeof(int);
 
-		pOutput->solids[i] = (CPhysCollide *)ivp_malloc_aligned( size, 32 );
-		memcpy( pOutput->solids[i], pBuffer + position, size );
+		pOutput->solids[i] = g_VCollideCache.AddSolid( pBuffer + position, size, SolidCRC( pBuffer + position, size ), NULL );
 		position += size;
 	}
 
-	END_IVP_ALLOCATION();
-
 	int keySize = bufferSize - position;
 
 	pOutput->pKeyValues = new char[keySize];
 	memcpy( pOutput->pKeyValues, pBuffer + position, keySize );
 }
 
-// destroyts the set of solids created by VCollideCreateCPhysCollide
-void CPhysicsCollision::VCollideUnload( vcollide_t *pVCollide )
+// loads a .phy file in either layout.  The mapped layout is used in place when the caller
+// keeps the file around for us.
+bool CPhysicsCollision::VCollideLoadFile( vcollide_t *pOutput, const void *pFile, int fileSize, VCollideReleaseFn_t pfnRelease, void *pContext )
 {
-	for ( int i = 0; i < pVCollide->solidCount; i++ )
+	memset( pOutput, 0, sizeof(*pOutput) );
+	const char *pData = (const char *)pFile;
+
+	phymappedheader_t header;
+	memset( &header, 0, sizeof(header) );
+	if ( fileSize >= (int)sizeof(phyheader_t) )
 	{
-#if _DEBUG
-		// HACKHACK: 1024 is just "some big number"
-		// GetActiveEnvironmentByIndex() will eventually return NULL when there are no more environments.
-		// In HL2 & TF2, there are only 2 environments - so j > 1 is probably an error!
-		for ( int j = 0; j < 1024; j++ )
+		memcpy( &header, pData, fileSize < (int)sizeof(header) ? sizeof(phyheader_t) : sizeof(header) );
+	}
+
+	if ( header.size == sizeof(phyheader_t) )
+	{
+		// old layout, the solids are packed so they always have to be copied
+		bool loaded = false;
+		if ( header.solidCount > 0 )
+		{
+			VCollideLoad( pOutput, header.solidCount, pData + sizeof(phyheader_t), fileSize - sizeof(phyheader_t) );
+			loaded = true;
+		}
+		if ( pfnRelease )
 		{
-			IPhysicsEnvironment *pEnv = g_PhysicsInternal->GetActiveEnvironmentByIndex( j );
-			if ( !pEnv )
-				break;
+			pfnRelease( pFile, pContext );
+		}
+		return loaded;
+	}
 
-			if ( pEnv->IsCollisionModelUsed( (CPhysCollide *)pVCollide->solids[i] ) )
-			{
- 			//	AssertMsg(0, "Freed collision model while in use!!!\n");
-				Warning( "Freed collision model while in use!!!\n" );
-				return;
-			}
+	// check everything before taking any solids so a bad file never gets half loaded
+	bool valid = header.size == sizeof(phymappedheader_t) && header.solidCount > 0 &&
+		header.solidCount <= (fileSize - header.size) / (int)sizeof(phymappedsolid_t) &&
+		header.keyDataOffset >= header.size && header.keyDataSize >= 0 && header.keyDataOffset <= fileSize - header.keyDataSize;
+
+	const phymappedsolid_t *pSolids = (const phymappedsolid_t *)(pData + header.size);
+	int i;
+	for ( i = 0; valid && i < header.solidCount; i++ )
+	{
+		phymappedsolid_t solid;
+		memcpy( &solid, &pSolids[i], sizeof(solid) );
+		if ( solid.size <= 0 || solid.offset < header.size || solid.offset > fileSize - solid.size )
+		{
+			valid = false;
 		}
-#endif
-		ivp_free_aligned( pVCollide->solids[i] );
+	}
+
+	if ( !valid )
+	{
+		if ( pfnRelease )
+		{
+			pfnRelease( pFile, pContext );
+		}
+		return false;
+	}
+
+	vcollidefile_t *pMappedFile = NULL;
+	if ( pfnRelease )
+	{
+		pMappedFile = new vcollidefile_t;
+		pMappedFile->pData = pFile;
+		pMappedFile->pfnRelease = pfnRelease;
+		pMappedFile->pContext = pContext;
+		pMappedFile->refCount = 0;
+	}
+
+	pOutput->solidCount = header.solidCount;
+	pOutput->solids = new CPhysCollide *[header.solidCount];
+	for ( i = 0; i < header.solidCount; i++ )
+	{
+		phymappedsolid_t solid;
+		memcpy( &solid, &pSolids[i], sizeof(solid) );
+
+		// IVP needs 16 byte aligned ledges, copy the solid if the caller's buffer isn't aligned enough
+		const char *pSolid = pData + solid.offset;
+		vcollidefile_t *pSolidFile = ( ((unsigned int)pSolid) & 15 ) ? NULL : pMappedFile;
+		pOutput->solids[i] = g_VCollideCache.AddSolid( pSolid, solid.size, solid.crc, pSolidFile );
+	}
+
+	// the key text is small and the parser wants it terminated, always copy it
+	pOutput->pKeyValues = new char[header.keyDataSize + 1];
+	memcpy( pOutput->pKeyValues, pData + header.keyDataOffset, header.keyDataSize );
+	pOutput->pKeyValues[header.keyDataSize] = 0;
+
+	// every solid was already loaded from another file (or copied), we don't need this one
+	if ( pMappedFile && !pMappedFile->refCount )
+	{
+		delete pMappedFile;
+		pfnRelease( pFile, pContext );
+	}
+
+	return true;
+}
+
+// destroyts the set of solids created by VCollideCreateCPhysCollide
+void CPhysicsCollision::VCollideUnload( vcollide_t *pVCollide )
+{
+	for ( int i = 0; i < pVCollide->solidCount; i++ )
+	{
+		g_VCollideCache.ReleaseSolid( pVCollide->solids[i] );
 	}
 	delete[] pVCollide->solids;
 	delete[] pVCollide->pKeyValues;
 	memset( pVCollide, 0, sizeof(*pVCollide) );
 }
 
+void CPhysicsCollision::VCollideGetStats( vcollidestats_t *pStats )
+{
+	g_VCollideCache.GetStats( pStats );
+}
+
 // begins parsing a vcollide.  NOTE: This keeps pointers to the vcollide_t
 // If you delete the vcollide_t and call members of IVCollideParse, it will crash
 IVPhysicsKeyParser *CPhysicsCollision::VPhysicsKeyParserCreate( const char *pKeyData )
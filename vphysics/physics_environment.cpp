@@ -37,6 +37,7 @@
 #include "ivp_phantom.hxx"
 
 #include "tier0/dbg.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -948,6 +949,11 @@ public:
 	{ 
 		return IVP_CP_MOTION;
 	}
+	// only reads the object's drag settings and changes the core's speed
+	virtual IVP_BOOL controller_is_thread_safe()
+	{
+		return IVP_TRUE;
+	}
 	float GetAirDensity() { return m_airDensity; }
 	void SetAirDensity( float density ) { m_airDensity = density; }
 
@@ -962,6 +968,26 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Runs IVP's parallel PSI work on the tier0 worker pool
+//-----------------------------------------------------------------------------
+class CPhysicsThreadPool : public IVP_Thread_Pool
+{
+public:
+	virtual void run_jobs( int n_jobs, void (*job)( void *context, int job_index ), void *context )
+	{
+		ThreadPool_ParallelFor( n_jobs, job, context );
+	}
+
+	virtual IVP_BOOL has_workers()
+	{
+		return ThreadPool_GetThreadCount() > 0 ? IVP_TRUE : IVP_FALSE;
+	}
+};
+
+static CPhysicsThreadPool g_PhysicsThreadPool;
+
+
 //-----------------------------------------------------------------------------
 // Purpose: An ugly little class to get a callback on PSIs
 //-----------------------------------------------------------------------------
@@ -1275,6 +1301,11 @@ bool CPhysicsEnvironment::IsInSimulation( void ) const
 	return m_inSimulation;
 }
 
+void CPhysicsEnvironment::EnableParallelSimulation( bool enable )
+{
+	m_pPhysEnv->set_thread_pool( enable ? &g_PhysicsThreadPool : NULL );
+}
+
 void CPhysicsEnvironment::DestroyObject( IPhysicsObject *pObject )
 {
 	if ( !pObject )
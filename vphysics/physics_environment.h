@@ -58,6 +58,7 @@ public:
 	float			GetSimulationTime( void );
 	int				GetTimestepsSimulatedLast();
 	bool			IsInSimulation( void ) const;
+	void			EnableParallelSimulation( bool enable );
 
 	virtual void DestroyObject( IPhysicsObject * );
 	virtual void DestroySpring( IPhysicsSpring * );
@@ -120,6 +120,10 @@ SOURCE=..\public\characterset.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\public\checksum_crc.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\convert.cpp
 # End Source File
 # Begin Source File